@@ -0,0 +1,83 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/adaptive_sampler.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+constexpr std::chrono::seconds AdaptiveSampler::kAdaptationPeriod;
+
+AdaptiveSamplingOptions CreateAdaptiveSamplingOptions(
+    ::cartographer::common::LuaParameterDictionary* const
+        lua_parameter_dictionary) {
+  AdaptiveSamplingOptions options;
+  options.min_sampling_ratio =
+      lua_parameter_dictionary->GetDouble("min_sampling_ratio");
+  options.max_queued_range_data =
+      lua_parameter_dictionary->GetNonNegativeInt("max_queued_range_data");
+  options.min_queued_range_data =
+      lua_parameter_dictionary->GetNonNegativeInt("min_queued_range_data");
+  CHECK_GT(options.min_sampling_ratio, 0.);
+  CHECK_LT(options.min_queued_range_data, options.max_queued_range_data);
+  return options;
+}
+
+AdaptiveSampler::AdaptiveSampler(const double max_ratio,
+                                 const AdaptiveSamplingOptions& options)
+    : max_ratio_(max_ratio),
+      options_(options),
+      ratio_(max_ratio),
+      next_adaptation_time_(std::chrono::steady_clock::time_point::min()) {
+  CHECK_GE(max_ratio_, 0.);
+}
+
+bool AdaptiveSampler::Pulse() {
+  ++num_pulses_;
+  if (static_cast<double>(num_samples_) / num_pulses_ < ratio_) {
+    ++num_samples_;
+    return true;
+  }
+  return false;
+}
+
+bool AdaptiveSampler::Adapt(const int num_queued,
+                            const std::chrono::steady_clock::time_point now) {
+  if (now < next_adaptation_time_) {
+    return false;
+  }
+  next_adaptation_time_ = now + kAdaptationPeriod;
+  double new_ratio = ratio_;
+  if (num_queued > options_.max_queued_range_data) {
+    new_ratio = std::max(ratio_ / 2., options_.min_sampling_ratio);
+  } else if (num_queued < options_.min_queued_range_data) {
+    new_ratio = ratio_ + max_ratio_ / 10.;
+  }
+  new_ratio = std::min(new_ratio, max_ratio_);
+  if (new_ratio == ratio_) {
+    return false;
+  }
+  ratio_ = new_ratio;
+  // Otherwise, the samples taken at the previous ratio would delay the change.
+  num_pulses_ = 0;
+  num_samples_ = 0;
+  return true;
+}
+
+}  // namespace cartographer_ros
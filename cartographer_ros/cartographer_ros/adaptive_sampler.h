@@ -0,0 +1,79 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ADAPTIVE_SAMPLER_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ADAPTIVE_SAMPLER_H
+
+#include <chrono>
+
+#include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/port.h"
+
+namespace cartographer_ros {
+
+struct AdaptiveSamplingOptions {
+  // The ratio is never lowered below this.
+  double min_sampling_ratio;
+  // The ratio is lowered while more range data than this waits for SLAM, and
+  // raised again while fewer than 'min_queued_range_data' do. Online, local
+  // SLAM keeps up on the thread adding the data, so this mostly counts nodes
+  // waiting for global SLAM, which has fewer nodes to optimize when sampling
+  // less.
+  int max_queued_range_data;
+  int min_queued_range_data;
+};
+
+AdaptiveSamplingOptions CreateAdaptiveSamplingOptions(
+    ::cartographer::common::LuaParameterDictionary* lua_parameter_dictionary);
+
+// Like '::cartographer::common::FixedRatioSampler', but sheds load while SLAM
+// falls behind by lowering the ratio, which is restored as SLAM catches up.
+// Not thread-safe.
+class AdaptiveSampler {
+ public:
+  // Samples at 'max_ratio' until 'Adapt()' is called.
+  AdaptiveSampler(double max_ratio, const AdaptiveSamplingOptions& options);
+
+  AdaptiveSampler(const AdaptiveSampler&) = delete;
+  AdaptiveSampler& operator=(const AdaptiveSampler&) = delete;
+
+  // Returns true if this pulse should result in a sample.
+  bool Pulse();
+
+  // Halves the ratio if more than 'max_queued_range_data' are 'num_queued',
+  // or raises it by a tenth of 'max_ratio' if fewer than
+  // 'min_queued_range_data' are. Only one call per 'kAdaptationPeriod' has an
+  // effect, so that the queue has time to follow. Returns true if the ratio
+  // changed.
+  bool Adapt(int num_queued, std::chrono::steady_clock::time_point now);
+
+  double ratio() const { return ratio_; }
+
+  static constexpr std::chrono::seconds kAdaptationPeriod{1};
+
+ private:
+  const double max_ratio_;
+  const AdaptiveSamplingOptions options_;
+  double ratio_;
+  std::chrono::steady_clock::time_point next_adaptation_time_;
+  // Counted since the ratio last changed.
+  int64 num_pulses_ = 0;
+  int64 num_samples_ = 0;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ADAPTIVE_SAMPLER_H
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/adaptive_sampler.h"
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+AdaptiveSamplingOptions MakeOptions() {
+  AdaptiveSamplingOptions options;
+  options.min_sampling_ratio = 0.2;
+  options.max_queued_range_data = 20;
+  options.min_queued_range_data = 5;
+  return options;
+}
+
+int CountSamples(AdaptiveSampler* sampler, const int num_pulses) {
+  int num_samples = 0;
+  for (int i = 0; i != num_pulses; ++i) {
+    if (sampler->Pulse()) {
+      ++num_samples;
+    }
+  }
+  return num_samples;
+}
+
+TEST(AdaptiveSampler, SamplesAtTheAdaptedRatio) {
+  AdaptiveSampler sampler(1., MakeOptions());
+  EXPECT_EQ(10, CountSamples(&sampler, 10));
+  const auto now = std::chrono::steady_clock::now();
+  EXPECT_TRUE(sampler.Adapt(30, now));
+  EXPECT_DOUBLE_EQ(0.5, sampler.ratio());
+  EXPECT_EQ(5, CountSamples(&sampler, 10));
+}
+
+TEST(AdaptiveSampler, StaysWithinBounds) {
+  AdaptiveSampler sampler(0.8, MakeOptions());
+  auto now = std::chrono::steady_clock::now();
+  for (int i = 0; i != 10; ++i) {
+    sampler.Adapt(30, now);
+    now += AdaptiveSampler::kAdaptationPeriod;
+  }
+  EXPECT_DOUBLE_EQ(0.2, sampler.ratio());
+  // Queue sizes between the bounds keep the ratio.
+  EXPECT_FALSE(sampler.Adapt(10, now));
+  now += AdaptiveSampler::kAdaptationPeriod;
+  for (int i = 0; i != 20; ++i) {
+    sampler.Adapt(0, now);
+    now += AdaptiveSampler::kAdaptationPeriod;
+  }
+  EXPECT_DOUBLE_EQ(0.8, sampler.ratio());
+}
+
+TEST(AdaptiveSampler, AdaptsOncePerPeriod) {
+  AdaptiveSampler sampler(1., MakeOptions());
+  const auto now = std::chrono::steady_clock::now();
+  EXPECT_TRUE(sampler.Adapt(30, now));
+  EXPECT_FALSE(sampler.Adapt(30, now + std::chrono::milliseconds(500)));
+  EXPECT_DOUBLE_EQ(0.5, sampler.ratio());
+  EXPECT_TRUE(sampler.Adapt(30, now + AdaptiveSampler::kAdaptationPeriod));
+  EXPECT_DOUBLE_EQ(0.25, sampler.ratio());
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -17,23 +17,32 @@
 #include "cartographer_ros/assets_writer.h"
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <thread>
 
 #include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
 #include "cartographer/common/configuration_file_resolver.h"
 #include "cartographer/common/math.h"
 #include "cartographer/io/file_writer.h"
 #include "cartographer/io/points_processor.h"
 #include "cartographer/io/points_processor_pipeline_builder.h"
-#include "cartographer/io/proto_stream.h"
-#include "cartographer/io/proto_stream_deserializer.h"
 #include "cartographer/mapping/proto/pose_graph.pb.h"
 #include "cartographer/mapping/proto/trajectory_builder_options.pb.h"
 #include "cartographer/sensor/point_cloud.h"
 #include "cartographer/sensor/range_data.h"
 #include "cartographer/transform/transform_interpolation_buffer.h"
+#include "cartographer_ros/bag_message_type.h"
+#include "cartographer_ros/mapped_proto_stream_reader.h"
 #include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/offline_transform_store.h"
+#include "cartographer_ros/node_constants.h"
 #include "cartographer_ros/ros_map_writing_points_processor.h"
 #include "cartographer_ros/time_conversion.h"
 #include "cartographer_ros/urdf_reader.h"
@@ -45,15 +54,18 @@
 #include "rosbag/view.h"
 #include "tf2_eigen/tf2_eigen.h"
 #include "tf2_msgs/TFMessage.h"
-#include "tf2_ros/buffer.h"
 #include "urdf/model.h"
 
 namespace cartographer_ros {
 namespace {
 
-constexpr char kTfStaticTopic[] = "/tf_static";
 namespace carto = ::cartographer;
 
+// Messages are read from this long before the first until this long after the
+// last node of a trajectory. Points outside of the trajectory cannot be
+// projected, so the rest of the bag is not read.
+constexpr double kTrajectoryTimeWindowMarginSec = 5.;
+
 std::unique_ptr<carto::io::PointsProcessorPipelineBuilder>
 CreatePipelineBuilder(
     const std::vector<carto::mapping::proto::Trajectory>& trajectories,
@@ -92,7 +104,7 @@ std::unique_ptr<carto::common::LuaParameterDictionary> LoadLuaDictionary(
 template <typename T>
 std::unique_ptr<carto::io::PointsBatch> HandleMessage(
     const T& message, const std::string& tracking_frame,
-    const tf2_ros::Buffer& tf_buffer,
+    const OfflineTransformStore& tf_buffer,
     const carto::transform::TransformInterpolationBuffer&
         transform_interpolation_buffer) {
   const carto::common::Time start_time = FromRos(message.header.stamp);
@@ -107,20 +119,30 @@ std::unique_ptr<carto::io::PointsBatch> HandleMessage(
       ToPointCloudWithIntensities(message);
   CHECK_EQ(point_cloud.intensities.size(), point_cloud.points.size());
 
+  // Consecutive points often share their time, e.g. all points of a cloud
+  // without per-point time, so we only look up transforms when it changes.
+  absl::optional<carto::common::Time> last_time;
+  bool has_sensor_to_map = false;
+  carto::transform::Rigid3f sensor_to_map;
   for (size_t i = 0; i < point_cloud.points.size(); ++i) {
     const carto::common::Time time =
         point_cloud_time +
         carto::common::FromSeconds(point_cloud.points[i].time);
-    if (!transform_interpolation_buffer.Has(time)) {
+    if (!last_time.has_value() || last_time.value() != time) {
+      last_time = time;
+      has_sensor_to_map = transform_interpolation_buffer.Has(time);
+      if (has_sensor_to_map) {
+        const carto::transform::Rigid3d tracking_to_map =
+            transform_interpolation_buffer.Lookup(time);
+        const carto::transform::Rigid3d sensor_to_tracking =
+            ToRigid3d(tf_buffer.lookupTransform(
+                tracking_frame, message.header.frame_id, ToRos(time)));
+        sensor_to_map = (tracking_to_map * sensor_to_tracking).cast<float>();
+      }
+    }
+    if (!has_sensor_to_map) {
       continue;
     }
-    const carto::transform::Rigid3d tracking_to_map =
-        transform_interpolation_buffer.Lookup(time);
-    const carto::transform::Rigid3d sensor_to_tracking =
-        ToRigid3d(tf_buffer.lookupTransform(
-            tracking_frame, message.header.frame_id, ToRos(time)));
-    const carto::transform::Rigid3f sensor_to_map =
-        (tracking_to_map * sensor_to_tracking).cast<float>();
     points_batch->points.push_back(
         sensor_to_map *
         carto::sensor::ToRangefinderPoint(point_cloud.points[i]));
@@ -134,14 +156,199 @@ std::unique_ptr<carto::io::PointsBatch> HandleMessage(
   return points_batch;
 }
 
+// Projects the points of the bag of a trajectory into the map frame and passes
+// them to 'points_batch_callback' in bag order.
+void ProjectBag(
+    const std::string& bag_filename, const int trajectory_id,
+    const carto::mapping::proto::Trajectory& trajectory_proto,
+    const std::string& tracking_frame, const std::string& urdf_filename,
+    const bool use_bag_transforms,
+    const std::function<void(std::unique_ptr<carto::io::PointsBatch>)>&
+        points_batch_callback) {
+  LOG(INFO) << "Processing " << bag_filename << "...";
+  if (trajectory_proto.node_size() == 0) {
+    return;
+  }
+  OfflineTransformStore tf_buffer;
+  if (!urdf_filename.empty()) {
+    for (const auto& transform : ReadStaticTransformsFromUrdf(
+             urdf_filename, nullptr /* tf_buffer */)) {
+      tf_buffer.SetTransform(transform, true /* is_static */);
+    }
+  }
+
+  const carto::transform::TransformInterpolationBuffer
+      transform_interpolation_buffer(trajectory_proto);
+  rosbag::Bag bag;
+  bag.open(bag_filename, rosbag::bagmode::Read);
+  const double first_node_time_sec =
+      ToRos(carto::common::FromUniversal(trajectory_proto.node(0).timestamp()))
+          .toSec();
+  const double last_node_time_sec =
+      ToRos(carto::common::FromUniversal(
+                trajectory_proto.node(trajectory_proto.node_size() - 1)
+                    .timestamp()))
+          .toSec();
+  rosbag::View view;
+  AddBagTimeWindowQueries(
+      bag,
+      ::ros::Time(
+          std::max(0., first_node_time_sec - kTrajectoryTimeWindowMarginSec)),
+      ::ros::Time(last_node_time_sec + kTrajectoryTimeWindowMarginSec),
+      [use_bag_transforms](const rosbag::ConnectionInfo& connection_info) {
+        switch (GetBagMessageType(connection_info)) {
+          case BagMessageType::kTfMessage:
+            return use_bag_transforms;
+          case BagMessageType::kPointCloud2:
+          case BagMessageType::kMultiEchoLaserScan:
+          case BagMessageType::kLaserScan:
+            return true;
+          default:
+            return false;
+        }
+      },
+      &view);
+  const BagMessageTypes message_types(view.getConnections());
+  const ::ros::Time begin_time = view.getBeginTime();
+  const double duration_in_seconds = (view.getEndTime() - begin_time).toSec();
+
+  // We make sure that tf_messages are inserted before any data messages, so
+  // that tf lookups always work. The transforms behind the data are trimmed.
+  std::deque<rosbag::MessageInstance> delayed_messages;
+  // We publish tf messages one second earlier than other messages. Under
+  // the assumption of higher frequency tf this should ensure that tf can
+  // always interpolate.
+  const ::ros::Duration kDelay(1.);
+  // Transforms this long before the delayed messages are no longer needed.
+  const ::ros::Duration kTransformCacheDuration(10.);
+  ::ros::Time next_trim_time = ::ros::TIME_MIN;
+  for (const rosbag::MessageInstance& message : view) {
+    if (use_bag_transforms &&
+        message_types.Get(message) == BagMessageType::kTfMessage) {
+      auto tf_message = message.instantiate<tf2_msgs::TFMessage>();
+      for (const auto& transform : tf_message->transforms) {
+        tf_buffer.SetTransform(transform,
+                               message.getTopic() == kTfStaticTopic);
+      }
+    }
+    if (message.getTime() >= next_trim_time) {
+      const ::ros::Duration trim_delay = kDelay + kTransformCacheDuration;
+      if (message.getTime() > ::ros::Time(0.) + trim_delay) {
+        tf_buffer.TrimBefore(message.getTime() - trim_delay);
+      }
+      next_trim_time = message.getTime() + kDelay;
+    }
+
+    while (!delayed_messages.empty() && delayed_messages.front().getTime() <
+                                            message.getTime() - kDelay) {
+      const rosbag::MessageInstance& delayed_message = delayed_messages.front();
+
+      std::unique_ptr<carto::io::PointsBatch> points_batch;
+      switch (message_types.Get(delayed_message)) {
+        case BagMessageType::kPointCloud2:
+          points_batch = HandleMessage(
+              *delayed_message.instantiate<sensor_msgs::PointCloud2>(),
+              tracking_frame, tf_buffer, transform_interpolation_buffer);
+          break;
+        case BagMessageType::kMultiEchoLaserScan:
+          points_batch = HandleMessage(
+              *delayed_message.instantiate<sensor_msgs::MultiEchoLaserScan>(),
+              tracking_frame, tf_buffer, transform_interpolation_buffer);
+          break;
+        case BagMessageType::kLaserScan:
+          points_batch = HandleMessage(
+              *delayed_message.instantiate<sensor_msgs::LaserScan>(),
+              tracking_frame, tf_buffer, transform_interpolation_buffer);
+          break;
+        default:
+          break;
+      }
+      if (points_batch != nullptr) {
+        points_batch->trajectory_id = trajectory_id;
+        points_batch_callback(std::move(points_batch));
+      }
+      delayed_messages.pop_front();
+    }
+    delayed_messages.push_back(message);
+    LOG_EVERY_N(INFO, 10000)
+        << "Processed " << (message.getTime() - begin_time).toSec() << " of "
+        << duration_in_seconds << " bag time seconds of " << bag_filename
+        << "...";
+  }
+  bag.close();
+}
+
+// Hands the points batches of one trajectory from the thread projecting them
+// to the thread running the pipeline. Blocks the producer while full, so that
+// trajectories projected ahead of the pipeline only use bounded memory.
+class PointsBatchQueue {
+ public:
+  void Push(std::unique_ptr<carto::io::PointsBatch> points_batch) {
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(this, &PointsBatchQueue::CanPush));
+    if (!aborted_) {
+      queue_.push_back(std::move(points_batch));
+    }
+  }
+
+  // Called by the producer when it is done. 'error' is set if it failed.
+  void Close(const std::exception_ptr error) {
+    absl::MutexLock lock(&mutex_);
+    closed_ = true;
+    error_ = error;
+  }
+
+  // Discards the queued and all further points batches, so that the producer
+  // does not block any more.
+  void Abort() {
+    absl::MutexLock lock(&mutex_);
+    aborted_ = true;
+    queue_.clear();
+  }
+
+  // Returns 'nullptr' once the queue is closed and empty. Rethrows the error
+  // of the producer instead, if it failed.
+  std::unique_ptr<carto::io::PointsBatch> Pop() {
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(this, &PointsBatchQueue::CanPop));
+    if (queue_.empty()) {
+      if (error_ != nullptr) {
+        std::rethrow_exception(error_);
+      }
+      return nullptr;
+    }
+    std::unique_ptr<carto::io::PointsBatch> points_batch =
+        std::move(queue_.front());
+    queue_.pop_front();
+    return points_batch;
+  }
+
+ private:
+  static constexpr size_t kMaxQueuedPointsBatches = 128;
+
+  bool CanPush() const EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return aborted_ || queue_.size() < kMaxQueuedPointsBatches;
+  }
+  bool CanPop() const EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return closed_ || !queue_.empty();
+  }
+
+  absl::Mutex mutex_;
+  std::deque<std::unique_ptr<carto::io::PointsBatch>> queue_ GUARDED_BY(mutex_);
+  bool closed_ GUARDED_BY(mutex_) = false;
+  bool aborted_ GUARDED_BY(mutex_) = false;
+  std::exception_ptr error_ GUARDED_BY(mutex_);
+};
+
+constexpr size_t PointsBatchQueue::kMaxQueuedPointsBatches;
+
 }  // namespace
 
 AssetsWriter::AssetsWriter(const std::string& pose_graph_filename,
                            const std::vector<std::string>& bag_filenames,
                            const std::string& output_file_prefix)
     : bag_filenames_(bag_filenames),
-      pose_graph_(
-          carto::io::DeserializePoseGraphFromFile(pose_graph_filename)) {
+      pose_graph_(ReadPoseGraphFromFile(pose_graph_filename)) {
   CHECK_EQ(pose_graph_.trajectory_size(), bag_filenames_.size())
       << "Pose graphs contains " << pose_graph_.trajectory_size()
       << " trajectories while " << bag_filenames_.size()
@@ -169,7 +376,8 @@ void AssetsWriter::RegisterPointsProcessor(
 void AssetsWriter::Run(const std::string& configuration_directory,
                        const std::string& configuration_basename,
                        const std::string& urdf_filename,
-                       const bool use_bag_transforms) {
+                       const bool use_bag_transforms,
+                       const int num_parallel_trajectories) {
   const auto lua_parameter_dictionary =
       LoadLuaDictionary(configuration_directory, configuration_basename);
 
@@ -179,83 +387,68 @@ void AssetsWriter::Run(const std::string& configuration_directory,
   const std::string tracking_frame =
       lua_parameter_dictionary->GetString("tracking_frame");
 
+  CHECK_GE(num_parallel_trajectories, 1);
   do {
-    for (size_t trajectory_id = 0; trajectory_id < bag_filenames_.size();
-         ++trajectory_id) {
-      const carto::mapping::proto::Trajectory& trajectory_proto =
-          pose_graph_.trajectory(trajectory_id);
-      const std::string& bag_filename = bag_filenames_[trajectory_id];
-      LOG(INFO) << "Processing " << bag_filename << "...";
-      if (trajectory_proto.node_size() == 0) {
-        continue;
-      }
-      tf2_ros::Buffer tf_buffer;
-      if (!urdf_filename.empty()) {
-        ReadStaticTransformsFromUrdf(urdf_filename, &tf_buffer);
-      }
-
-      const carto::transform::TransformInterpolationBuffer
-          transform_interpolation_buffer(trajectory_proto);
-      rosbag::Bag bag;
-      bag.open(bag_filename, rosbag::bagmode::Read);
-      rosbag::View view(bag);
-      const ::ros::Time begin_time = view.getBeginTime();
-      const double duration_in_seconds =
-          (view.getEndTime() - begin_time).toSec();
-
-      // We need to keep 'tf_buffer' small because it becomes very inefficient
-      // otherwise. We make sure that tf_messages are published before any data
-      // messages, so that tf lookups always work.
-      std::deque<rosbag::MessageInstance> delayed_messages;
-      // We publish tf messages one second earlier than other messages. Under
-      // the assumption of higher frequency tf this should ensure that tf can
-      // always interpolate.
-      const ::ros::Duration kDelay(1.);
-      for (const rosbag::MessageInstance& message : view) {
-        if (use_bag_transforms && message.isType<tf2_msgs::TFMessage>()) {
-          auto tf_message = message.instantiate<tf2_msgs::TFMessage>();
-          for (const auto& transform : tf_message->transforms) {
+    // Trajectories are projected by up to 'num_parallel_trajectories'
+    // threads, each taking the next trajectory when it is done. The pipeline
+    // still receives the points ordered by trajectory, as if they were
+    // projected one by one, so that the assets do not depend on timing.
+    // Projecting a trajectory blocks while it is too far ahead of the
+    // pipeline.
+    const int num_trajectories = static_cast<int>(bag_filenames_.size());
+    const int num_threads = std::min(num_parallel_trajectories,
+                                     std::max(num_trajectories, 1));
+    std::vector<PointsBatchQueue> queues(num_trajectories);
+    std::atomic<int> next_trajectory_id{0};
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back([&]() {
+        for (int trajectory_id = next_trajectory_id++;
+             trajectory_id < num_trajectories;
+             trajectory_id = next_trajectory_id++) {
+          PointsBatchQueue* const queue = &queues[trajectory_id];
+          // Exceptions would terminate the process on this thread, they are
+          // handed to the pipeline thread instead.
+          std::exception_ptr error;
+          if (!failed) {
             try {
-              tf_buffer.setTransform(transform, "unused_authority",
-                                     message.getTopic() == kTfStaticTopic);
-            } catch (const tf2::TransformException& ex) {
-              LOG(WARNING) << ex.what();
+              ProjectBag(
+                  bag_filenames_[trajectory_id], trajectory_id,
+                  pose_graph_.trajectory(trajectory_id), tracking_frame,
+                  urdf_filename, use_bag_transforms,
+                  [queue](
+                      std::unique_ptr<carto::io::PointsBatch> points_batch) {
+                    queue->Push(std::move(points_batch));
+                  });
+            } catch (...) {
+              error = std::current_exception();
+              failed = true;
             }
           }
+          queue->Close(error);
         }
-
-        while (!delayed_messages.empty() && delayed_messages.front().getTime() <
-                                                message.getTime() - kDelay) {
-          const rosbag::MessageInstance& delayed_message =
-              delayed_messages.front();
-
-          std::unique_ptr<carto::io::PointsBatch> points_batch;
-          if (delayed_message.isType<sensor_msgs::PointCloud2>()) {
-            points_batch = HandleMessage(
-                *delayed_message.instantiate<sensor_msgs::PointCloud2>(),
-                tracking_frame, tf_buffer, transform_interpolation_buffer);
-          } else if (delayed_message
-                         .isType<sensor_msgs::MultiEchoLaserScan>()) {
-            points_batch = HandleMessage(
-                *delayed_message.instantiate<sensor_msgs::MultiEchoLaserScan>(),
-                tracking_frame, tf_buffer, transform_interpolation_buffer);
-          } else if (delayed_message.isType<sensor_msgs::LaserScan>()) {
-            points_batch = HandleMessage(
-                *delayed_message.instantiate<sensor_msgs::LaserScan>(),
-                tracking_frame, tf_buffer, transform_interpolation_buffer);
-          }
-          if (points_batch != nullptr) {
-            points_batch->trajectory_id = trajectory_id;
-            pipeline.back()->Process(std::move(points_batch));
-          }
-          delayed_messages.pop_front();
+      });
+    }
+    try {
+      for (PointsBatchQueue& queue : queues) {
+        while (std::unique_ptr<carto::io::PointsBatch> points_batch =
+                   queue.Pop()) {
+          pipeline.back()->Process(std::move(points_batch));
         }
-        delayed_messages.push_back(message);
-        LOG_EVERY_N(INFO, 10000)
-            << "Processed " << (message.getTime() - begin_time).toSec()
-            << " of " << duration_in_seconds << " bag time seconds...";
       }
-      bag.close();
+    } catch (...) {
+      failed = true;
+      for (PointsBatchQueue& queue : queues) {
+        queue.Abort();
+      }
+      for (std::thread& thread : threads) {
+        thread.join();
+      }
+      throw;
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
     }
   } while (pipeline.back()->Flush() ==
            carto::io::PointsProcessor::FlushResult::kRestartStream);
@@ -41,10 +41,14 @@ class AssetsWriter {
           factory);
 
   // Configures a points processing pipeline and pushes the points from the
-  // bag through the pipeline.
+  // bag through the pipeline. Up to 'num_parallel_trajectories' bags are read
+  // and projected at the same time, while the pipeline still receives the
+  // points ordered by trajectory. Rethrows exceptions thrown while reading a
+  // bag.
   void Run(const std::string& configuration_directory,
            const std::string& configuration_basename,
-           const std::string& urdf_filename, bool use_bag_transforms);
+           const std::string& urdf_filename, bool use_bag_transforms,
+           int num_parallel_trajectories);
 
   // Creates a FileWriterFactory which creates a FileWriter for storing assets.
   static ::cartographer::io::FileWriterFactory CreateFileWriterFactory(
@@ -40,6 +40,10 @@ DEFINE_string(output_file_prefix, "",
               "Will be prefixed to all output file names and can be used to "
               "define the output directory. If empty, the first bag filename "
               "will be used.");
+DEFINE_int32(num_parallel_trajectories, 1,
+             "Number of trajectories whose bags are read and projected at the "
+             "same time. Points still go through the pipeline ordered by "
+             "trajectory.");
 
 int main(int argc, char** argv) {
   FLAGS_alsologtostderr = true;
@@ -60,5 +64,6 @@ int main(int argc, char** argv) {
       FLAGS_output_file_prefix);
 
   asset_writer.Run(FLAGS_configuration_directory, FLAGS_configuration_basename,
-                   FLAGS_urdf_filename, FLAGS_use_bag_transforms);
+                   FLAGS_urdf_filename, FLAGS_use_bag_transforms,
+                   FLAGS_num_parallel_trajectories);
 }
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/async_state_writer.h"
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "cartographer/io/proto_stream.h"
+#include "cartographer_ros_msgs/StatusCode.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+constexpr absl::Duration kStatusPeriod = absl::Seconds(1);
+
+}  // namespace
+
+void AsyncStateWriter::Snapshot::WriteProto(
+    const google::protobuf::Message& proto) {
+  protos_.emplace_back(proto.New());
+  protos_.back()->CopyFrom(proto);
+}
+
+bool AsyncStateWriter::Snapshot::Close() { return true; }
+
+AsyncStateWriter::AsyncStateWriter(StatusCallback status_callback)
+    : status_callback_(std::move(status_callback)) {}
+
+AsyncStateWriter::~AsyncStateWriter() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool AsyncStateWriter::Write(const std::string& filename,
+                             std::unique_ptr<Snapshot> snapshot) {
+  absl::MutexLock lock(&mutex_);
+  if (writing_) {
+    return false;
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  writing_ = true;
+  thread_ = std::thread(&AsyncStateWriter::Run, this, filename,
+                        std::move(snapshot));
+  return true;
+}
+
+bool AsyncStateWriter::IsWriting() {
+  absl::MutexLock lock(&mutex_);
+  return writing_;
+}
+
+void AsyncStateWriter::Run(const std::string& filename,
+                           std::unique_ptr<Snapshot> snapshot) {
+  cartographer_ros_msgs::WriteStateStatus status;
+  status.filename = filename;
+  status.num_messages = snapshot->protos_.size();
+  status.finished = false;
+  status_callback_(status);
+  absl::Time next_status_time = absl::Now() + kStatusPeriod;
+
+  ::cartographer::io::ProtoStreamWriter writer(filename);
+  for (std::unique_ptr<google::protobuf::Message>& proto : snapshot->protos_) {
+    writer.WriteProto(*proto);
+    // The snapshot can be as large as the map, so free it while writing.
+    proto.reset();
+    ++status.num_written_messages;
+    if (absl::Now() >= next_status_time) {
+      status_callback_(status);
+      next_status_time = absl::Now() + kStatusPeriod;
+    }
+  }
+  status.finished = true;
+  if (writer.Close()) {
+    status.status.code = cartographer_ros_msgs::StatusCode::OK;
+    status.status.message = absl::StrCat("State written to '", filename, "'.");
+  } else {
+    status.status.code = cartographer_ros_msgs::StatusCode::INVALID_ARGUMENT;
+    status.status.message = absl::StrCat("Failed to write '", filename, "'.");
+    LOG(ERROR) << status.status.message;
+  }
+  status_callback_(status);
+
+  absl::MutexLock lock(&mutex_);
+  writing_ = false;
+}
+
+}  // namespace cartographer_ros
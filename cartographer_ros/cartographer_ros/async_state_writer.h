@@ -0,0 +1,83 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ASYNC_STATE_WRITER_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ASYNC_STATE_WRITER_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "cartographer/io/proto_stream_interface.h"
+#include "cartographer_ros_msgs/WriteStateStatus.h"
+#include "google/protobuf/message.h"
+
+namespace cartographer_ros {
+
+// Writes serialized SLAM states to .pbstream files on a background thread.
+// The state is first serialized into a 'Snapshot' in memory, which is quick
+// compared to compressing it and writing it to disk. At most one state is
+// written at a time.
+class AsyncStateWriter {
+ public:
+  // Keeps copies of all protos written to it.
+  class Snapshot : public ::cartographer::io::ProtoStreamWriterInterface {
+   public:
+    void WriteProto(const google::protobuf::Message& proto) override;
+    bool Close() override;
+
+   private:
+    friend class AsyncStateWriter;
+
+    std::vector<std::unique_ptr<google::protobuf::Message>> protos_;
+  };
+
+  // Called from the writing thread when it starts, about every second while
+  // it is writing and when it is finished.
+  using StatusCallback =
+      std::function<void(const cartographer_ros_msgs::WriteStateStatus&)>;
+
+  explicit AsyncStateWriter(StatusCallback status_callback);
+  // Waits until the state being written is finished.
+  ~AsyncStateWriter();
+
+  AsyncStateWriter(const AsyncStateWriter&) = delete;
+  AsyncStateWriter& operator=(const AsyncStateWriter&) = delete;
+
+  // Starts writing the 'snapshot' to 'filename'. Returns false if another
+  // state is still being written.
+  bool Write(const std::string& filename, std::unique_ptr<Snapshot> snapshot)
+      LOCKS_EXCLUDED(mutex_);
+
+  bool IsWriting() LOCKS_EXCLUDED(mutex_);
+
+ private:
+  void Run(const std::string& filename, std::unique_ptr<Snapshot> snapshot)
+      LOCKS_EXCLUDED(mutex_);
+
+  const StatusCallback status_callback_;
+  absl::Mutex mutex_;
+  bool writing_ GUARDED_BY(mutex_) = false;
+  // Only started by 'Write()' while holding 'mutex_'.
+  std::thread thread_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ASYNC_STATE_WRITER_H
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/async_state_writer.h"
+
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "cartographer/io/proto_stream.h"
+#include "cartographer/transform/proto/transform.pb.h"
+#include "cartographer_ros/temporary_file_test_helpers.h"
+#include "cartographer_ros_msgs/StatusCode.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+class AsyncStateWriterTest : public TemporaryFileTest {
+ protected:
+  AsyncStateWriterTest() : TemporaryFileTest("state.pbstream") {}
+};
+
+TEST_F(AsyncStateWriterTest, WritesSnapshot) {
+  constexpr int kNumProtos = 3;
+  std::vector<cartographer_ros_msgs::WriteStateStatus> statuses;
+  {
+    AsyncStateWriter writer(
+        [&statuses](const cartographer_ros_msgs::WriteStateStatus& status) {
+          statuses.push_back(status);
+        });
+    auto snapshot = absl::make_unique<AsyncStateWriter::Snapshot>();
+    for (int i = 0; i < kNumProtos; ++i) {
+      ::cartographer::transform::proto::Vector3d proto;
+      proto.set_x(i);
+      snapshot->WriteProto(proto);
+    }
+    ASSERT_TRUE(snapshot->Close());
+    ASSERT_TRUE(writer.Write(filename_, std::move(snapshot)));
+  }
+
+  ASSERT_GE(statuses.size(), 2);
+  EXPECT_FALSE(statuses.front().finished);
+  EXPECT_EQ(0, statuses.front().num_written_messages);
+  const cartographer_ros_msgs::WriteStateStatus& last_status = statuses.back();
+  EXPECT_TRUE(last_status.finished);
+  EXPECT_EQ(filename_, last_status.filename);
+  EXPECT_EQ(kNumProtos, last_status.num_messages);
+  EXPECT_EQ(kNumProtos, last_status.num_written_messages);
+  EXPECT_EQ(cartographer_ros_msgs::StatusCode::OK, last_status.status.code);
+
+  ::cartographer::io::ProtoStreamReader reader(filename_);
+  for (int i = 0; i < kNumProtos; ++i) {
+    ::cartographer::transform::proto::Vector3d proto;
+    ASSERT_TRUE(reader.ReadProto(&proto));
+    EXPECT_EQ(i, proto.x());
+  }
+  ::cartographer::transform::proto::Vector3d proto;
+  EXPECT_FALSE(reader.ReadProto(&proto));
+}
+
+}  // namespace
+}  // namespace cartographer_ros
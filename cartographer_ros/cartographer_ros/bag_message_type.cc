@@ -0,0 +1,113 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/bag_message_type.h"
+
+#include "cartographer_ros/node_constants.h"
+#include "cartographer_ros_msgs/LandmarkList.h"
+#include "glog/logging.h"
+#include "nav_msgs/Odometry.h"
+#include "ros/message_traits.h"
+#include "sensor_msgs/Imu.h"
+#include "sensor_msgs/LaserScan.h"
+#include "sensor_msgs/MultiEchoLaserScan.h"
+#include "sensor_msgs/NavSatFix.h"
+#include "sensor_msgs/PointCloud2.h"
+#include "tf2_msgs/TFMessage.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+template <typename MessageType>
+bool IsType(const rosbag::ConnectionInfo& connection_info) {
+  return connection_info.md5sum ==
+             ros::message_traits::MD5Sum<MessageType>::value() &&
+         connection_info.datatype ==
+             ros::message_traits::DataType<MessageType>::value();
+}
+
+}  // namespace
+
+BagMessageType GetBagMessageType(
+    const rosbag::ConnectionInfo& connection_info) {
+  if (IsType<tf2_msgs::TFMessage>(connection_info)) {
+    return BagMessageType::kTfMessage;
+  }
+  if (IsType<sensor_msgs::LaserScan>(connection_info)) {
+    return BagMessageType::kLaserScan;
+  }
+  if (IsType<sensor_msgs::MultiEchoLaserScan>(connection_info)) {
+    return BagMessageType::kMultiEchoLaserScan;
+  }
+  if (IsType<sensor_msgs::PointCloud2>(connection_info)) {
+    return BagMessageType::kPointCloud2;
+  }
+  if (IsType<sensor_msgs::Imu>(connection_info)) {
+    return BagMessageType::kImu;
+  }
+  if (IsType<nav_msgs::Odometry>(connection_info)) {
+    return BagMessageType::kOdometry;
+  }
+  if (IsType<sensor_msgs::NavSatFix>(connection_info)) {
+    return BagMessageType::kNavSatFix;
+  }
+  if (IsType<cartographer_ros_msgs::LandmarkList>(connection_info)) {
+    return BagMessageType::kLandmarkList;
+  }
+  return BagMessageType::kUnknown;
+}
+
+BagMessageTypes::BagMessageTypes(
+    const std::vector<const rosbag::ConnectionInfo*>& connections) {
+  for (const rosbag::ConnectionInfo* connection_info : connections) {
+    connection_to_message_type_[connection_info->header.get()] =
+        GetBagMessageType(*connection_info);
+  }
+}
+
+BagMessageType BagMessageTypes::Get(
+    const rosbag::MessageInstance& message) const {
+  const auto it =
+      connection_to_message_type_.find(message.getConnectionHeader().get());
+  CHECK(it != connection_to_message_type_.end())
+      << "Message on topic " << message.getTopic()
+      << " belongs to a connection not in the view.";
+  return it->second;
+}
+
+void AddBagTimeWindowQueries(const rosbag::Bag& bag, const ros::Time start_time,
+                             const ros::Time end_time,
+                             const BagConnectionFilter& connection_filter,
+                             rosbag::View* const view) {
+  view->addQuery(
+      bag,
+      [connection_filter](const rosbag::ConnectionInfo* connection_info) {
+        return !connection_filter || connection_filter(*connection_info);
+      },
+      start_time, end_time);
+  if (start_time > ros::TIME_MIN) {
+    view->addQuery(
+        bag,
+        [connection_filter](const rosbag::ConnectionInfo* connection_info) {
+          return connection_info->topic == kTfStaticTopic &&
+                 (!connection_filter || connection_filter(*connection_info));
+        },
+        ros::TIME_MIN, start_time - ros::Duration(0, 1));
+  }
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_BAG_MESSAGE_TYPE_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_BAG_MESSAGE_TYPE_H
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "ros/datatypes.h"
+#include "ros/time.h"
+#include "rosbag/bag.h"
+#include "rosbag/message_instance.h"
+#include "rosbag/structures.h"
+#include "rosbag/view.h"
+
+namespace cartographer_ros {
+
+// The message types handled when reading bags.
+enum class BagMessageType {
+  kUnknown,
+  kTfMessage,
+  kLaserScan,
+  kMultiEchoLaserScan,
+  kPointCloud2,
+  kImu,
+  kOdometry,
+  kNavSatFix,
+  kLandmarkList,
+};
+
+// Resolves the type of the messages of a bag connection from its MD5 sum.
+BagMessageType GetBagMessageType(const rosbag::ConnectionInfo& connection_info);
+
+// Resolves the types of the connections of a bag view once, so that messages
+// can be dispatched on their type without comparing MD5 sums and data types.
+class BagMessageTypes {
+ public:
+  explicit BagMessageTypes(
+      const std::vector<const rosbag::ConnectionInfo*>& connections);
+
+  BagMessageType Get(const rosbag::MessageInstance& message) const;
+
+ private:
+  // Keyed by the connection header, which all messages of a connection share.
+  std::unordered_map<const ros::M_string*, BagMessageType>
+      connection_to_message_type_;
+};
+
+// Decides whether the messages of a bag connection are read.
+using BagConnectionFilter = std::function<bool(const rosbag::ConnectionInfo&)>;
+
+// Adds the messages of 'bag' in ['start_time', 'end_time'] on the connections
+// accepted by 'connection_filter', or on all connections if it is empty, to
+// 'view'. Static transforms before 'start_time' are added as well, since they
+// are still valid in the window. Using the index of the bag, the view seeks to
+// the window and does not read chunks without messages it needs.
+void AddBagTimeWindowQueries(const rosbag::Bag& bag, ros::Time start_time,
+                             ros::Time end_time,
+                             const BagConnectionFilter& connection_filter,
+                             rosbag::View* view);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_BAG_MESSAGE_TYPE_H
@@ -65,8 +65,12 @@ void Run() {
   std::tie(node_options, trajectory_options) =
       LoadOptions(FLAGS_configuration_directory, FLAGS_configuration_basename);
 
-  auto map_builder = absl::make_unique<::cartographer::cloud::MapBuilderStub>(
-      FLAGS_server_address, FLAGS_client_id);
+  ThreadGroups thread_groups(node_options.thread_groups);
+  std::unique_ptr<::cartographer::cloud::MapBuilderStub> map_builder;
+  thread_groups.Capture(kBackgroundOptimizationThreadGroup, [&]() {
+    map_builder = absl::make_unique<::cartographer::cloud::MapBuilderStub>(
+        FLAGS_server_address, FLAGS_client_id);
+  });
 
   if (!FLAGS_load_state_filename.empty() && !FLAGS_upload_load_state_file) {
     map_builder->LoadStateFromFile(FLAGS_load_state_filename,
@@ -74,7 +78,7 @@ void Run() {
   }
 
   Node node(node_options, std::move(map_builder), &tf_buffer,
-            FLAGS_collect_metrics);
+            FLAGS_collect_metrics, &thread_groups);
 
   if (!FLAGS_load_state_filename.empty() && FLAGS_upload_load_state_file) {
     node.LoadState(FLAGS_load_state_filename, FLAGS_load_frozen_state);
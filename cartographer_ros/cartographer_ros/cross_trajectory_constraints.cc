@@ -0,0 +1,248 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/cross_trajectory_constraints.h"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "cartographer/common/fixed_ratio_sampler.h"
+#include "cartographer/common/thread_pool.h"
+#include "cartographer/mapping/2d/submap_2d.h"
+#include "cartographer/mapping/3d/submap_3d.h"
+#include "cartographer/mapping/internal/constraints/constraint_builder_2d.h"
+#include "cartographer/mapping/internal/constraints/constraint_builder_3d.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace carto = ::cartographer;
+
+namespace {
+
+using carto::mapping::NodeId;
+using carto::mapping::PoseGraphInterface;
+using carto::mapping::SubmapId;
+using carto::mapping::TrajectoryNode;
+using Constraint = PoseGraphInterface::Constraint;
+using TrajectoryState = PoseGraphInterface::TrajectoryState;
+
+// Smaller trajectory ID first.
+using TrajectoryPair = std::pair<int, int>;
+
+TrajectoryPair MakeTrajectoryPair(const int a, const int b) {
+  return TrajectoryPair(std::min(a, b), std::max(a, b));
+}
+
+// Decides which node and submap pairs are searched.
+class CandidateSelector {
+ public:
+  CandidateSelector(const PoseGraphInterface& pose_graph,
+                    const double sampling_ratio)
+      : trajectory_states_(pose_graph.GetTrajectoryStates()),
+        sampler_(sampling_ratio) {
+    for (const Constraint& constraint : pose_graph.constraints()) {
+      if (constraint.node_id.trajectory_id !=
+          constraint.submap_id.trajectory_id) {
+        connected_.insert(MakeTrajectoryPair(
+            constraint.node_id.trajectory_id,
+            constraint.submap_id.trajectory_id));
+      }
+    }
+  }
+
+  bool IsSearched(const int node_trajectory_id,
+                  const int submap_trajectory_id) const {
+    if (node_trajectory_id == submap_trajectory_id ||
+        connected_.count(MakeTrajectoryPair(node_trajectory_id,
+                                            submap_trajectory_id)) != 0) {
+      return false;
+    }
+    return !(IsFrozen(node_trajectory_id) && IsFrozen(submap_trajectory_id));
+  }
+
+  // Samples among the pairs which are searched.
+  bool Pulse() { return sampler_.Pulse(); }
+
+  int NumSearchedTrajectoryPairs() const {
+    int num_pairs = 0;
+    for (auto a = trajectory_states_.begin(); a != trajectory_states_.end();
+         ++a) {
+      for (auto b = std::next(a); b != trajectory_states_.end(); ++b) {
+        if (IsSearched(a->first, b->first)) {
+          ++num_pairs;
+        }
+      }
+    }
+    return num_pairs;
+  }
+
+ private:
+  bool IsFrozen(const int trajectory_id) const {
+    const auto it = trajectory_states_.find(trajectory_id);
+    return it != trajectory_states_.end() &&
+           it->second == TrajectoryState::FROZEN;
+  }
+
+  const std::map<int, TrajectoryState> trajectory_states_;
+  std::set<TrajectoryPair> connected_;
+  carto::common::FixedRatioSampler sampler_;
+};
+
+// Blocks until the computations started on 'constraint_builder' finished and
+// returns the constraints found.
+template <typename ConstraintBuilder>
+std::vector<Constraint> WaitForConstraints(
+    ConstraintBuilder* const constraint_builder) {
+  absl::Mutex mutex;
+  bool done = false;
+  std::vector<Constraint> result;
+  constraint_builder->WhenDone(
+      [&mutex, &done, &result](const std::vector<Constraint>& constraints) {
+        absl::MutexLock lock(&mutex);
+        result = constraints;
+        done = true;
+      });
+  absl::MutexLock lock(&mutex);
+  mutex.Await(absl::Condition(&done));
+  return result;
+}
+
+std::vector<Constraint> SearchConstraints2D(
+    const carto::mapping::proto::PoseGraphOptions& options,
+    const carto::mapping::MapById<NodeId, TrajectoryNode>& nodes,
+    const carto::mapping::MapById<SubmapId, PoseGraphInterface::SubmapData>&
+        submaps,
+    CandidateSelector* const candidate_selector,
+    carto::common::ThreadPool* const thread_pool) {
+  carto::mapping::constraints::ConstraintBuilder2D constraint_builder(
+      options.constraint_builder_options(), thread_pool);
+  for (const auto& node : nodes) {
+    for (const auto& submap : submaps) {
+      if (!submap.data.submap->insertion_finished() ||
+          !candidate_selector->IsSearched(node.id.trajectory_id,
+                                          submap.id.trajectory_id) ||
+          !candidate_selector->Pulse()) {
+        continue;
+      }
+      constraint_builder.MaybeAddGlobalConstraint(
+          submap.id,
+          static_cast<const carto::mapping::Submap2D*>(
+              submap.data.submap.get()),
+          node.id, node.data.constant_data.get());
+    }
+    constraint_builder.NotifyEndOfNode();
+  }
+  std::vector<Constraint> constraints =
+      WaitForConstraints(&constraint_builder);
+  // The constraint builder relates submaps to gravity-aligned nodes, while the
+  // pose graph takes constraints to the tracking frame, as when serialized.
+  for (Constraint& constraint : constraints) {
+    constraint.pose.zbar_ij =
+        constraint.pose.zbar_ij *
+        carto::transform::Rigid3d::Rotation(
+            nodes.at(constraint.node_id).constant_data->gravity_alignment);
+  }
+  return constraints;
+}
+
+std::vector<Constraint> SearchConstraints3D(
+    const carto::mapping::proto::PoseGraphOptions& options,
+    const std::vector<Constraint>& existing_constraints,
+    const carto::mapping::MapById<NodeId, TrajectoryNode>& nodes,
+    const carto::mapping::MapById<SubmapId, PoseGraphInterface::SubmapData>&
+        submaps,
+    CandidateSelector* const candidate_selector,
+    carto::common::ThreadPool* const thread_pool) {
+  // The scan matcher of a 3D submap is built from its nodes, relative to it.
+  std::map<SubmapId, std::vector<TrajectoryNode>> submap_nodes;
+  for (const Constraint& constraint : existing_constraints) {
+    if (constraint.tag != Constraint::INTRA_SUBMAP) {
+      continue;
+    }
+    const TrajectoryNode& node = nodes.at(constraint.node_id);
+    submap_nodes[constraint.submap_id].push_back(TrajectoryNode{
+        node.constant_data,
+        submaps.at(constraint.submap_id).pose.inverse() * node.global_pose});
+  }
+  carto::mapping::constraints::ConstraintBuilder3D constraint_builder(
+      options.constraint_builder_options(), thread_pool);
+  for (const auto& node : nodes) {
+    for (const auto& submap : submaps) {
+      if (!submap.data.submap->insertion_finished() ||
+          !candidate_selector->IsSearched(node.id.trajectory_id,
+                                          submap.id.trajectory_id) ||
+          !candidate_selector->Pulse()) {
+        continue;
+      }
+      constraint_builder.MaybeAddGlobalConstraint(
+          submap.id,
+          static_cast<const carto::mapping::Submap3D*>(
+              submap.data.submap.get()),
+          node.id, node.data.constant_data.get(), submap_nodes[submap.id],
+          node.data.global_pose.rotation(), submap.data.pose.rotation());
+    }
+    constraint_builder.NotifyEndOfNode();
+  }
+  return WaitForConstraints(&constraint_builder);
+}
+
+}  // namespace
+
+int AddCrossTrajectoryConstraints(
+    const carto::mapping::proto::MapBuilderOptions& options,
+    carto::mapping::PoseGraph* const pose_graph) {
+  // Loading a state and adding trajectories only queues work for the pose
+  // graph, which has to be done before its nodes, submaps and constraints are
+  // complete. There is no other way to wait for the pose graph to go idle.
+  LOG(INFO) << "Optimizing before searching cross-trajectory constraints...";
+  pose_graph->RunFinalOptimization();
+  CandidateSelector candidate_selector(
+      *pose_graph, options.pose_graph_options().global_sampling_ratio());
+  const int num_trajectory_pairs =
+      candidate_selector.NumSearchedTrajectoryPairs();
+  if (num_trajectory_pairs == 0) {
+    LOG(INFO) << "All trajectories are connected, not searching for "
+                 "cross-trajectory constraints.";
+    return 0;
+  }
+  LOG(INFO) << "Searching constraints between " << num_trajectory_pairs
+            << " pairs of trajectories...";
+  // Kept until the search finished, since the constraint builders refer to
+  // the nodes and submaps.
+  const auto nodes = pose_graph->GetTrajectoryNodes();
+  const auto submaps = pose_graph->GetAllSubmapData();
+  carto::common::ThreadPool thread_pool(
+      std::max(1, options.num_background_threads()));
+  const std::vector<Constraint> constraints =
+      options.use_trajectory_builder_3d()
+          ? SearchConstraints3D(options.pose_graph_options(),
+                                pose_graph->constraints(), nodes, submaps,
+                                &candidate_selector, &thread_pool)
+          : SearchConstraints2D(options.pose_graph_options(), nodes, submaps,
+                                &candidate_selector, &thread_pool);
+  LOG(INFO) << "Found " << constraints.size()
+            << " cross-trajectory constraints.";
+  pose_graph->AddSerializedConstraints(constraints);
+  return static_cast<int>(constraints.size());
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_CROSS_TRAJECTORY_CONSTRAINTS_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_CROSS_TRAJECTORY_CONSTRAINTS_H
+
+#include "cartographer/mapping/pose_graph.h"
+#include "cartographer/mapping/proto/map_builder_options.pb.h"
+
+namespace cartographer_ros {
+
+// Searches constraints between the nodes and the finished submaps of
+// different trajectories of 'pose_graph' by global scan matching, like global
+// SLAM does for new nodes, and adds them to 'pose_graph'. This joins
+// trajectories which were built separately, e.g. in several processes, and
+// loaded afterwards. Pairs of trajectories which are already connected or
+// both frozen are skipped. Node and submap pairs are sampled with the
+// 'global_sampling_ratio' of the pose graph options. Runs an optimization
+// first, which waits for all work queued by loading states and finishing
+// trajectories. Returns the number of constraints added.
+int AddCrossTrajectoryConstraints(
+    const ::cartographer::mapping::proto::MapBuilderOptions& options,
+    ::cartographer::mapping::PoseGraph* pose_graph);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_CROSS_TRAJECTORY_CONSTRAINTS_H
@@ -15,11 +15,16 @@
  */
 
 #include <iostream>
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
 #include "cartographer/transform/transform.h"
+#include "cartographer_ros/mapped_proto_stream_reader.h"
 #include "cartographer_ros/msg_conversion.h"
 #include "cartographer_ros/time_conversion.h"
 #include "geometry_msgs/TransformStamped.h"
@@ -31,6 +36,32 @@
 DEFINE_string(input, "", "pbstream file to process");
 DEFINE_string(output, "", "Bag file to write to.");
 DEFINE_string(parent_frame, "map", "Frame id to use as parent frame.");
+DEFINE_string(trajectory_ids, "",
+              "Comma-separated list of the trajectory ids to export. All "
+              "trajectories are exported if empty.");
+DEFINE_double(start_time, 0.,
+              "Nodes before this ROS time in seconds are not exported.");
+DEFINE_double(end_time, 0.,
+              "If positive, nodes after this ROS time in seconds are not "
+              "exported.");
+DEFINE_double(min_time_delta_sec, 0.,
+              "Nodes closer in time to the last exported node of their "
+              "trajectory are skipped.");
+DEFINE_double(min_distance, 0.,
+              "Nodes closer in meters to the last exported node of their "
+              "trajectory are skipped.");
+DEFINE_bool(batch_tf, false,
+            "Write the transforms of all trajectories with the same "
+            "timestamp into one /tf message instead of one message per "
+            "transform.");
+DEFINE_bool(write_transform_stamped_topics, true,
+            "Also write each trajectory to its own "
+            "geometry_msgs/TransformStamped topic.");
+DEFINE_string(compression, "none",
+              "Compression of the bag chunks: 'none', 'lz4' or 'bz2'.");
+DEFINE_int32(chunk_size, 0,
+             "If positive, the size in bytes at which bag chunks are written. "
+             "Larger chunks compress better.");
 
 namespace cartographer_ros {
 namespace {
@@ -51,30 +82,135 @@ geometry_msgs::TransformStamped ToTransformStamped(
   return transform_stamped;
 }
 
+struct ExportOptions {
+  // All trajectories are exported if empty.
+  std::set<int> trajectory_ids;
+  double start_time;
+  // Not limited if not positive.
+  double end_time;
+  double min_time_delta_sec;
+  double min_distance;
+  bool batch_tf;
+  bool write_transform_stamped_topics;
+  rosbag::CompressionType compression;
+  int chunk_size;
+};
+
+rosbag::CompressionType ParseCompression(const std::string& compression) {
+  if (compression == "none") {
+    return rosbag::compression::Uncompressed;
+  }
+  if (compression == "lz4") {
+    return rosbag::compression::LZ4;
+  }
+  if (compression == "bz2") {
+    return rosbag::compression::BZ2;
+  }
+  LOG(FATAL) << "Unknown compression '" << compression << "'.";
+}
+
+ExportOptions CreateExportOptions() {
+  ExportOptions options;
+  for (const std::string& trajectory_id :
+       absl::StrSplit(FLAGS_trajectory_ids, ',', absl::SkipEmpty())) {
+    int id;
+    CHECK(absl::SimpleAtoi(trajectory_id, &id))
+        << "Invalid trajectory id '" << trajectory_id << "'.";
+    options.trajectory_ids.insert(id);
+  }
+  options.start_time = FLAGS_start_time;
+  options.end_time = FLAGS_end_time;
+  options.min_time_delta_sec = FLAGS_min_time_delta_sec;
+  options.min_distance = FLAGS_min_distance;
+  options.batch_tf = FLAGS_batch_tf;
+  options.write_transform_stamped_topics = FLAGS_write_transform_stamped_topics;
+  options.compression = ParseCompression(FLAGS_compression);
+  options.chunk_size = FLAGS_chunk_size;
+  return options;
+}
+
+// Returns the nodes of 'trajectory' in the time window which are far enough
+// from the previously selected node.
+std::vector<const cartographer::mapping::proto::Trajectory::Node*>
+SelectNodes(const cartographer::mapping::proto::Trajectory& trajectory,
+            const ExportOptions& options) {
+  std::vector<const cartographer::mapping::proto::Trajectory::Node*> nodes;
+  for (const auto& node : trajectory.node()) {
+    const double time =
+        ToRos(::cartographer::common::FromUniversal(node.timestamp())).toSec();
+    if (time < options.start_time ||
+        (options.end_time > 0. && time > options.end_time)) {
+      continue;
+    }
+    if (!nodes.empty()) {
+      const auto& last_node = *nodes.back();
+      const double time_delta_sec = ::cartographer::common::ToSeconds(
+          ::cartographer::common::FromUniversal(node.timestamp()) -
+          ::cartographer::common::FromUniversal(last_node.timestamp()));
+      const double distance =
+          (::cartographer::transform::ToEigen(node.pose().translation()) -
+           ::cartographer::transform::ToEigen(last_node.pose().translation()))
+              .norm();
+      if (time_delta_sec < options.min_time_delta_sec ||
+          distance < options.min_distance) {
+        continue;
+      }
+    }
+    nodes.push_back(&node);
+  }
+  return nodes;
+}
+
 void pbstream_trajectories_to_bag(const std::string& pbstream_filename,
                                   const std::string& output_bag_filename,
-                                  const std::string& parent_frame_id) {
-  const auto pose_graph =
-      cartographer::io::DeserializePoseGraphFromFile(FLAGS_input);
+                                  const std::string& parent_frame_id,
+                                  const ExportOptions& options) {
+  const auto pose_graph = ReadPoseGraphFromFile(pbstream_filename);
 
   rosbag::Bag bag(output_bag_filename, rosbag::bagmode::Write);
-  for (const auto trajectory : pose_graph.trajectory()) {
+  bag.setCompression(options.compression);
+  if (options.chunk_size > 0) {
+    bag.setChunkThreshold(options.chunk_size);
+  }
+  // Only used if batching, written after all trajectories.
+  std::map<int64_t, tf2_msgs::TFMessage> timestamp_to_tf_msg;
+  for (const auto& trajectory : pose_graph.trajectory()) {
+    if (!options.trajectory_ids.empty() &&
+        options.trajectory_ids.count(trajectory.trajectory_id()) == 0) {
+      continue;
+    }
     const auto child_frame_id =
         absl::StrCat("trajectory_", trajectory.trajectory_id());
-    LOG(INFO)
-        << "Writing tf and geometry_msgs/TransformStamped for trajectory id "
-        << trajectory.trajectory_id() << " with " << trajectory.node_size()
-        << " nodes.";
-    for (const auto& node : trajectory.node()) {
-      tf2_msgs::TFMessage tf_msg;
+    const auto nodes = SelectNodes(trajectory, options);
+    LOG(INFO) << "Writing tf"
+              << (options.write_transform_stamped_topics
+                      ? " and geometry_msgs/TransformStamped"
+                      : "")
+              << " for trajectory id " << trajectory.trajectory_id()
+              << " with " << nodes.size() << " of "
+              << trajectory.node_size() << " nodes.";
+    for (const auto* node : nodes) {
       geometry_msgs::TransformStamped transform_stamped = ToTransformStamped(
-          node.timestamp(), parent_frame_id, child_frame_id, node.pose());
+          node->timestamp(), parent_frame_id, child_frame_id, node->pose());
+      if (options.write_transform_stamped_topics) {
+        bag.write(child_frame_id, transform_stamped.header.stamp,
+                  transform_stamped);
+      }
+      if (options.batch_tf) {
+        timestamp_to_tf_msg[node->timestamp()].transforms.push_back(
+            transform_stamped);
+        continue;
+      }
+      tf2_msgs::TFMessage tf_msg;
       tf_msg.transforms.push_back(transform_stamped);
-      bag.write(child_frame_id, transform_stamped.header.stamp,
-                transform_stamped);
       bag.write("/tf", transform_stamped.header.stamp, tf_msg);
     }
   }
+  for (const auto& entry : timestamp_to_tf_msg) {
+    bag.write("/tf",
+              ToRos(::cartographer::common::FromUniversal(entry.first)),
+              entry.second);
+  }
 }
 
 }  // namespace
@@ -96,7 +232,8 @@ int main(int argc, char* argv[]) {
   CHECK(!FLAGS_input.empty()) << "-input pbstream is missing.";
   CHECK(!FLAGS_output.empty()) << "-output is missing.";
 
-  cartographer_ros::pbstream_trajectories_to_bag(FLAGS_input, FLAGS_output,
-                                                 FLAGS_parent_frame);
+  cartographer_ros::pbstream_trajectories_to_bag(
+      FLAGS_input, FLAGS_output, FLAGS_parent_frame,
+      cartographer_ros::CreateExportOptions());
   return 0;
 }
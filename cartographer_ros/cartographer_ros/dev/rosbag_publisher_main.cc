@@ -14,9 +14,19 @@
  * limitations under the License.
  */
 
-#include "cartographer/common/time.h"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "cartographer_ros/quantile_sketch.h"
 #include "cartographer_ros/ros_log_sink.h"
-#include "cartographer_ros/time_conversion.h"
 #include "gflags/gflags.h"
 #include "nav_msgs/Odometry.h"
 #include "ros/ros.h"
@@ -30,29 +40,137 @@
 #include "tf2_msgs/TFMessage.h"
 
 DEFINE_string(bag_filename, "", "Bag to publish.");
+DEFINE_double(read_ahead_sec, 1.,
+              "How far ahead of playback messages are read and deserialized.");
 
 const int kQueueSize = 1;
+// Gives the reader a head start before the first message is due.
+const ros::Duration kStartDelay(0.1);
+// Sleeping is only accurate to a fraction of a millisecond, so the last part
+// of the wait for a message is spent spinning.
+const ros::Duration kSpinDuration(0.0005);
+const double kMaxPublishDelay = 0.001;
 
 template <typename MessagePtrType>
-void PublishWithModifiedTimestamp(MessagePtrType message,
-                                  const ros::Publisher& publisher,
-                                  ros::Duration bag_to_current) {
+MessagePtrType WithModifiedTimestamp(MessagePtrType message,
+                                     ros::Duration bag_to_current) {
   ros::Time& stamp = message->header.stamp;
   stamp += bag_to_current;
-  publisher.publish(message);
+  return message;
 }
 
 template <>
-void PublishWithModifiedTimestamp<tf2_msgs::TFMessage::Ptr>(
-    tf2_msgs::TFMessage::Ptr message, const ros::Publisher& publisher,
-    ros::Duration bag_to_current) {
+tf2_msgs::TFMessage::Ptr WithModifiedTimestamp<tf2_msgs::TFMessage::Ptr>(
+    tf2_msgs::TFMessage::Ptr message, ros::Duration bag_to_current) {
   for (const auto& transform : message->transforms) {
     ros::Time& stamp = const_cast<ros::Time&>(transform.header.stamp);
     stamp += bag_to_current;
   }
-  publisher.publish(message);
+  return message;
+}
+
+// Sleeps until shortly before 'time' and spins for the rest.
+void SleepAndSpinUntil(const ros::Time& time) {
+  const ros::Duration sleep_duration = time - ros::Time::now() - kSpinDuration;
+  if (sleep_duration > ros::Duration(0)) {
+    std::this_thread::sleep_for(
+        std::chrono::nanoseconds(sleep_duration.toNSec()));
+  }
+  while (ros::Time::now() < time) {
+  }
 }
 
+// Publishes the already deserialized messages of one topic at their planned
+// times on its own thread, so publishing a large message does not delay the
+// messages on other topics.
+class TopicPublisher {
+ public:
+  explicit TopicPublisher(ros::Publisher publisher)
+      : publisher_(std::move(publisher)) {
+    thread_ = std::thread(&TopicPublisher::Run, this);
+  }
+  ~TopicPublisher() { Finish(); }
+
+  TopicPublisher(const TopicPublisher&) = delete;
+  TopicPublisher& operator=(const TopicPublisher&) = delete;
+
+  template <typename MessagePtrType>
+  void Queue(const ros::Time& planned_publish_time, MessagePtrType message)
+      LOCKS_EXCLUDED(mutex_) {
+    absl::MutexLock lock(&mutex_);
+    messages_.push_back(
+        {planned_publish_time,
+         [this, message]() { publisher_.publish(message); }});
+  }
+
+  // Blocks until all queued messages are published.
+  void Finish() LOCKS_EXCLUDED(mutex_) {
+    {
+      absl::MutexLock lock(&mutex_);
+      finishing_ = true;
+    }
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  // Must only be called after 'Finish()'.
+  void PrintReport() const {
+    LOG(INFO) << "Publish delay in seconds on topic "
+              << publisher_.getTopic() << ":\n"
+              << publish_delays_.ToString();
+  }
+
+ private:
+  struct ScheduledMessage {
+    ros::Time planned_publish_time;
+    std::function<void()> publish;
+  };
+
+  void Run() LOCKS_EXCLUDED(mutex_) {
+    for (;;) {
+      ScheduledMessage message;
+      {
+        absl::MutexLock lock(&mutex_);
+        mutex_.Await(absl::Condition(this, &TopicPublisher::CanPublish));
+        if (messages_.empty()) {
+          return;
+        }
+        message = std::move(messages_.front());
+        messages_.pop_front();
+      }
+      SleepAndSpinUntil(message.planned_publish_time);
+      if (!ros::ok()) {
+        return;
+      }
+      const ros::Time publish_time = ros::Time::now();
+      message.publish();
+      const double publish_delay =
+          (publish_time - message.planned_publish_time).toSec();
+      publish_delays_.Add(publish_delay);
+      if (publish_delay > kMaxPublishDelay) {
+        LOG(WARNING) << "Playback on topic " << publisher_.getTopic()
+                     << " delayed by " << publish_delay
+                     << " s. planned_publish_time: "
+                     << message.planned_publish_time
+                     << " publish_time: " << publish_time;
+      }
+    }
+  }
+
+  bool CanPublish() const EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return finishing_ || !messages_.empty();
+  }
+
+  ros::Publisher publisher_;
+  // Only used by 'thread_' until it is joined.
+  cartographer_ros::QuantileSketch publish_delays_;
+  absl::Mutex mutex_;
+  std::deque<ScheduledMessage> messages_ GUARDED_BY(mutex_);
+  bool finishing_ GUARDED_BY(mutex_) = false;
+  std::thread thread_;
+};
+
 int main(int argc, char** argv) {
   google::InitGoogleLogging(argv[0]);
   google::SetUsageMessage(
@@ -63,7 +181,9 @@ int main(int argc, char** argv) {
       "they were recorded."
       "Contrary to rosbag play, it does not publish a clock, so time is"
       "hopefully smoother and it should be possible to reproduce timing"
-      "issues.\n"
+      "issues. Messages are deserialized ahead of time and each topic is "
+      "published from its own thread. A report of the publish delays is "
+      "logged at the end.\n"
       "It only plays message types related to Cartographer.\n");
   google::ParseCommandLineFlags(&argc, &argv, true);
   CHECK(!FLAGS_bag_filename.empty()) << "-bag_filename is missing.";
@@ -83,66 +203,81 @@ int main(int argc, char** argv) {
     LOG(ERROR) << "use_sim_time is true but not supported. Expect conflicting "
                   "ros::Time and message header times or weird behavior.";
   }
-  std::map<std::string, ros::Publisher> topic_to_publisher;
+  std::map<std::string, std::unique_ptr<TopicPublisher>> topic_to_publisher;
   for (const rosbag::ConnectionInfo* c : view.getConnections()) {
     const std::string& topic = c->topic;
     if (topic_to_publisher.count(topic) == 0) {
       ros::AdvertiseOptions options(c->topic, kQueueSize, c->md5sum,
                                     c->datatype, c->msg_def);
-      topic_to_publisher[topic] = node_handle.advertise(options);
+      topic_to_publisher[topic] =
+          absl::make_unique<TopicPublisher>(node_handle.advertise(options));
     }
   }
   ros::Duration(1).sleep();
   CHECK(ros::ok());
 
-  ros::Time current_start = ros::Time::now();
-  ros::Time bag_start = view.getBeginTime();
-  ros::Duration bag_to_current = current_start - bag_start;
+  // The timestamps are modified and the messages deserialized on this thread
+  // while they are published on the threads of 'topic_to_publisher'.
+  const ros::Time current_start = ros::Time::now() + kStartDelay;
+  const ros::Time bag_start = view.getBeginTime();
+  const ros::Duration bag_to_current = current_start - bag_start;
+  const ros::Duration read_ahead = ros::Duration(FLAGS_read_ahead_sec);
   for (const rosbag::MessageInstance& message : view) {
-    ros::Duration after_bag_start = message.getTime() - bag_start;
     if (!::ros::ok()) {
       break;
     }
-    ros::Time planned_publish_time = current_start + after_bag_start;
-    ros::Time::sleepUntil(planned_publish_time);
+    const ros::Time planned_publish_time =
+        current_start + (message.getTime() - bag_start);
+    const ros::Duration too_far_ahead =
+        planned_publish_time - ros::Time::now() - read_ahead;
+    if (too_far_ahead > ros::Duration(0)) {
+      too_far_ahead.sleep();
+    }
 
-    ros::Publisher& publisher = topic_to_publisher.at(message.getTopic());
+    TopicPublisher& publisher = *topic_to_publisher.at(message.getTopic());
     if (message.isType<sensor_msgs::PointCloud2>()) {
-      PublishWithModifiedTimestamp(
-          message.instantiate<sensor_msgs::PointCloud2>(), publisher,
-          bag_to_current);
+      publisher.Queue(planned_publish_time,
+                      WithModifiedTimestamp(
+                          message.instantiate<sensor_msgs::PointCloud2>(),
+                          bag_to_current));
     } else if (message.isType<sensor_msgs::MultiEchoLaserScan>()) {
-      PublishWithModifiedTimestamp(
-          message.instantiate<sensor_msgs::MultiEchoLaserScan>(), publisher,
-          bag_to_current);
+      publisher.Queue(
+          planned_publish_time,
+          WithModifiedTimestamp(
+              message.instantiate<sensor_msgs::MultiEchoLaserScan>(),
+              bag_to_current));
     } else if (message.isType<sensor_msgs::LaserScan>()) {
-      PublishWithModifiedTimestamp(
-          message.instantiate<sensor_msgs::LaserScan>(), publisher,
-          bag_to_current);
+      publisher.Queue(planned_publish_time,
+                      WithModifiedTimestamp(
+                          message.instantiate<sensor_msgs::LaserScan>(),
+                          bag_to_current));
     } else if (message.isType<sensor_msgs::Imu>()) {
-      PublishWithModifiedTimestamp(message.instantiate<sensor_msgs::Imu>(),
-                                   publisher, bag_to_current);
+      publisher.Queue(
+          planned_publish_time,
+          WithModifiedTimestamp(message.instantiate<sensor_msgs::Imu>(),
+                                bag_to_current));
     } else if (message.isType<nav_msgs::Odometry>()) {
-      PublishWithModifiedTimestamp(message.instantiate<nav_msgs::Odometry>(),
-                                   publisher, bag_to_current);
+      publisher.Queue(
+          planned_publish_time,
+          WithModifiedTimestamp(message.instantiate<nav_msgs::Odometry>(),
+                                bag_to_current));
     } else if (message.isType<tf2_msgs::TFMessage>()) {
-      PublishWithModifiedTimestamp(message.instantiate<tf2_msgs::TFMessage>(),
-                                   publisher, bag_to_current);
+      publisher.Queue(
+          planned_publish_time,
+          WithModifiedTimestamp(message.instantiate<tf2_msgs::TFMessage>(),
+                                bag_to_current));
     } else {
       LOG(WARNING) << "Skipping message with type " << message.getDataType();
     }
-
-    ros::Time current_time = ros::Time::now();
-    double simulation_delay = cartographer::common::ToSeconds(
-        cartographer_ros::FromRos(current_time) -
-        cartographer_ros::FromRos(planned_publish_time));
-    if (std::abs(simulation_delay) > 0.001) {
-      LOG(WARNING) << "Playback delayed by " << simulation_delay
-                   << " s. planned_publish_time: " << planned_publish_time
-                   << " current_time: " << current_time;
-    }
   }
   bag.close();
 
+  for (const auto& entry : topic_to_publisher) {
+    entry.second->Finish();
+  }
+  for (const auto& entry : topic_to_publisher) {
+    entry.second->PrintReport();
+  }
+
   ros::shutdown();
 }
@@ -14,17 +14,26 @@
  * limitations under the License.
  */
 
-#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
-#include "cartographer/common/math.h"
-#include "cartographer/io/proto_stream_deserializer.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_replace.h"
+#include "absl/strings/str_split.h"
 #include "cartographer/mapping/proto/pose_graph.pb.h"
 #include "cartographer/transform/transform_interpolation_buffer.h"
+#include "cartographer_ros/mapped_proto_stream_reader.h"
 #include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/quantile_sketch.h"
 #include "cartographer_ros/time_conversion.h"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
@@ -36,53 +45,150 @@
 #include "tf2_msgs/TFMessage.h"
 
 DEFINE_string(bag_filename, "",
-              "Bag file containing TF messages of the trajectory that will be "
-              "compared against the trajectory in the .pbstream file.");
+              "Comma-separated list of bag files containing TF messages of "
+              "the trajectories that will be compared against the "
+              "trajectories in the .pbstream file.");
 DEFINE_string(tf_parent_frame, "map",
               "The parent frame ID of the TF trajectory from the bag file.");
 DEFINE_string(tf_child_frame, "base_link",
               "The child frame ID of the TF trajectory from the bag file.");
 DEFINE_string(pbstream_filename, "",
-              "Proto stream file containing the pose graph. The last "
-              "trajectory will be used for comparison.");
+              "Proto stream file containing the pose graph. If it has as many "
+              "trajectories as there are bag files, the i-th bag is compared "
+              "against the i-th trajectory, like the offline node assigns "
+              "them. Otherwise, each bag is compared against all "
+              "trajectories in the time range of its TF samples.");
+DEFINE_string(comparisons, "",
+              "Semicolon-separated list of comparisons, each given as "
+              "'<pbstream_filename>:<bag_filenames>' with the "
+              "comma-separated list of bag files. Used instead of "
+              "-pbstream_filename and -bag_filename if set.");
+DEFINE_int32(num_threads, 4, "Number of bags compared in parallel.");
+DEFINE_string(report_filename, "",
+              "If set, the results are written to this file, as CSV if the "
+              "name ends in '.csv' and as JSON otherwise.");
 
 namespace cartographer_ros {
 namespace {
 
-double FractionSmallerThan(const std::vector<double>& v, double x) {
-  return static_cast<double>(std::count_if(
-             v.begin(), v.end(), [=](double value) { return value < x; })) /
-         v.size();
+constexpr std::array<double, 4> kTranslationThresholds = {1., 0.1, 0.05,
+                                                          0.01};
+
+struct Comparison {
+  std::string pbstream_filename;
+  std::vector<std::string> bag_filenames;
+};
+
+// Deviations of the TF samples from one trajectory, without storing them.
+struct TrajectoryDeviations {
+  int trajectory_id = 0;
+  QuantileSketch translation;
+  QuantileSketch rotation;
+  // The number of translation deviations smaller than each of
+  // 'kTranslationThresholds'.
+  std::array<uint64_t, kTranslationThresholds.size()>
+      num_translations_smaller_than{};
+};
+
+struct BagResult {
+  std::string pbstream_filename;
+  std::string bag_filename;
+  // TF samples not in the time range of any trajectory.
+  uint64_t num_uncovered_samples = 0;
+  // TF samples in the time range of more than one trajectory, which are
+  // compared against each of them.
+  uint64_t num_ambiguous_samples = 0;
+  std::vector<TrajectoryDeviations> trajectories;
+};
+
+double FractionSmallerThan(const TrajectoryDeviations& deviations,
+                           const size_t threshold_index) {
+  return static_cast<double>(
+             deviations.num_translations_smaller_than[threshold_index]) /
+         deviations.translation.count();
 }
 
-std::string QuantilesToString(std::vector<double>* v) {
-  if (v->empty()) return "(empty vector)";
-  std::sort(v->begin(), v->end());
-  std::stringstream result;
-  const int kNumQuantiles = 10;
-  for (int i = 0; i < kNumQuantiles; ++i) {
-    auto value = v->at(v->size() * i / kNumQuantiles);
-    auto percentage = 100 * i / kNumQuantiles;
-    result << percentage << "%: " << value << "\n";
-  }
-  result << "100%: " << v->back() << "\n";
-  return result.str();
+// The trajectories of a pose graph, shared read-only by the comparisons of
+// all its bags.
+struct PoseGraphTrajectories {
+  cartographer::mapping::proto::PoseGraph pose_graph_proto;
+  std::vector<cartographer::transform::TransformInterpolationBuffer>
+      transform_interpolation_buffers;
+  // See '-pbstream_filename'.
+  bool one_trajectory_per_bag = false;
+};
+
+// Calls 'task' for each index in [0, num_tasks) on 'num_threads' threads,
+// each taking the next index until all are done.
+template <typename TaskType>
+void RunInParallel(const size_t num_tasks, const int num_threads,
+                   const TaskType& task) {
+  std::atomic<size_t> next_task(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i != num_threads; ++i) {
+    threads.emplace_back([&]() {
+      for (size_t j = next_task++; j < num_tasks; j = next_task++) {
+        task(j);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
 }
 
-void Run(const std::string& pbstream_filename,
-         const std::string& bag_filename) {
-  cartographer::mapping::proto::PoseGraph pose_graph_proto =
-      cartographer::io::DeserializePoseGraphFromFile(pbstream_filename);
-  const cartographer::mapping::proto::Trajectory& last_trajectory_proto =
-      *pose_graph_proto.mutable_trajectory()->rbegin();
-  const cartographer::transform::TransformInterpolationBuffer
-      transform_interpolation_buffer(last_trajectory_proto);
+PoseGraphTrajectories ReadTrajectories(const Comparison& comparison) {
+  PoseGraphTrajectories trajectories;
+  trajectories.pose_graph_proto =
+      ReadPoseGraphFromFile(comparison.pbstream_filename);
+  for (const auto& trajectory_proto :
+       trajectories.pose_graph_proto.trajectory()) {
+    trajectories.transform_interpolation_buffers.emplace_back(
+        trajectory_proto);
+  }
+  const int num_trajectories =
+      trajectories.pose_graph_proto.trajectory_size();
+  trajectories.one_trajectory_per_bag =
+      comparison.bag_filenames.size() ==
+      static_cast<size_t>(num_trajectories);
+  if (!trajectories.one_trajectory_per_bag) {
+    LOG(WARNING) << comparison.pbstream_filename << " has "
+                 << num_trajectories << " trajectories for "
+                 << comparison.bag_filenames.size()
+                 << " bags, comparing each bag against all trajectories.";
+  }
+  return trajectories;
+}
 
+// Compares the TF trajectory of the bag at 'bag_index' against its
+// trajectory of the pose graph, see '-pbstream_filename'.
+BagResult CompareBag(const Comparison& comparison,
+                     const PoseGraphTrajectories& trajectories,
+                     const size_t bag_index) {
+  const cartographer::mapping::proto::PoseGraph& pose_graph_proto =
+      trajectories.pose_graph_proto;
+  const auto& transform_interpolation_buffers =
+      trajectories.transform_interpolation_buffers;
+  const std::string& bag_filename = comparison.bag_filenames[bag_index];
+  BagResult result{comparison.pbstream_filename, bag_filename};
+  // Indices into 'transform_interpolation_buffers' and the trajectories of
+  // the pose graph, in the order of 'result.trajectories'.
+  std::vector<int> trajectory_indices;
+  if (trajectories.one_trajectory_per_bag) {
+    trajectory_indices.push_back(static_cast<int>(bag_index));
+  } else {
+    for (int i = 0; i != pose_graph_proto.trajectory_size(); ++i) {
+      trajectory_indices.push_back(i);
+    }
+  }
+  for (const int trajectory_index : trajectory_indices) {
+    result.trajectories.emplace_back();
+    result.trajectories.back().trajectory_id =
+        pose_graph_proto.trajectory(trajectory_index).trajectory_id();
+  }
   rosbag::Bag bag;
   bag.open(bag_filename, rosbag::bagmode::Read);
   rosbag::View view(bag);
-  std::vector<double> deviation_translation, deviation_rotation;
-  const double signal_maximum = std::numeric_limits<double>::max();
   for (const rosbag::MessageInstance& message : view) {
     if (!message.isType<tf2_msgs::TFMessage>()) {
       continue;
@@ -95,35 +201,228 @@ void Run(const std::string& pbstream_filename,
       }
       const cartographer::common::Time transform_time =
           FromRos(message.getTime());
-      if (!transform_interpolation_buffer.Has(transform_time)) {
-        deviation_translation.push_back(signal_maximum);
-        deviation_rotation.push_back(signal_maximum);
-        continue;
+      const auto published_transform = ToRigid3d(transform);
+      int num_covering_trajectories = 0;
+      for (size_t i = 0; i != trajectory_indices.size(); ++i) {
+        const auto& transform_interpolation_buffer =
+            transform_interpolation_buffers[trajectory_indices[i]];
+        if (!transform_interpolation_buffer.Has(transform_time)) {
+          continue;
+        }
+        ++num_covering_trajectories;
+        const auto optimized_transform =
+            transform_interpolation_buffer.Lookup(transform_time);
+        TrajectoryDeviations& deviations = result.trajectories[i];
+        const double translation_deviation =
+            (published_transform.translation() -
+             optimized_transform.translation())
+                .norm();
+        deviations.translation.Add(translation_deviation);
+        deviations.rotation.Add(
+            published_transform.rotation().angularDistance(
+                optimized_transform.rotation()));
+        for (size_t j = 0; j != kTranslationThresholds.size(); ++j) {
+          if (translation_deviation < kTranslationThresholds[j]) {
+            ++deviations.num_translations_smaller_than[j];
+          }
+        }
+      }
+      if (num_covering_trajectories == 0) {
+        ++result.num_uncovered_samples;
+      } else if (num_covering_trajectories > 1) {
+        ++result.num_ambiguous_samples;
       }
-      auto optimized_transform =
-          transform_interpolation_buffer.Lookup(transform_time);
-      auto published_transform = ToRigid3d(transform);
-      deviation_translation.push_back((published_transform.translation() -
-                                       optimized_transform.translation())
-                                          .norm());
-      deviation_rotation.push_back(
-          published_transform.rotation().angularDistance(
-              optimized_transform.rotation()));
     }
   }
   bag.close();
-  LOG(INFO) << "Distribution of translation difference:\n"
-            << QuantilesToString(&deviation_translation);
-  LOG(INFO) << "Distribution of rotation difference:\n"
-            << QuantilesToString(&deviation_rotation);
-  LOG(INFO) << "Fraction of translation difference smaller than 1m: "
-            << FractionSmallerThan(deviation_translation, 1);
-  LOG(INFO) << "Fraction of translation difference smaller than 0.1m: "
-            << FractionSmallerThan(deviation_translation, 0.1);
-  LOG(INFO) << "Fraction of translation difference smaller than 0.05m: "
-            << FractionSmallerThan(deviation_translation, 0.05);
-  LOG(INFO) << "Fraction of translation difference smaller than 0.01m: "
-            << FractionSmallerThan(deviation_translation, 0.01);
+  return result;
+}
+
+void LogResult(const BagResult& result) {
+  LOG(INFO) << "Comparing " << result.bag_filename << " against "
+            << result.pbstream_filename << ", "
+            << result.num_uncovered_samples
+            << " TF samples are not covered by any trajectory, "
+            << result.num_ambiguous_samples
+            << " are covered by more than one.";
+  for (const TrajectoryDeviations& deviations : result.trajectories) {
+    if (deviations.translation.count() == 0) {
+      continue;
+    }
+    LOG(INFO) << "Trajectory " << deviations.trajectory_id
+              << ", distribution of translation difference:\n"
+              << deviations.translation.ToString();
+    LOG(INFO) << "Trajectory " << deviations.trajectory_id
+              << ", distribution of rotation difference:\n"
+              << deviations.rotation.ToString();
+    for (size_t i = 0; i != kTranslationThresholds.size(); ++i) {
+      LOG(INFO) << "Trajectory " << deviations.trajectory_id
+                << ", fraction of translation difference smaller than "
+                << kTranslationThresholds[i]
+                << "m: " << FractionSmallerThan(deviations, i);
+    }
+  }
+}
+
+// The values of a trajectory in report order. Quantiles of trajectories
+// without samples are NaN.
+std::vector<std::pair<std::string, double>> GetReportValues(
+    const TrajectoryDeviations& deviations) {
+  std::vector<std::pair<std::string, double>> values;
+  for (const auto& sketch :
+       {std::make_pair("translation", &deviations.translation),
+        std::make_pair("rotation", &deviations.rotation)}) {
+    values.emplace_back(absl::StrCat(sketch.first, "_mean"),
+                        sketch.second->mean());
+    for (const int percent : {50, 90, 99}) {
+      values.emplace_back(absl::StrCat(sketch.first, "_p", percent),
+                          sketch.second->count() == 0
+                              ? std::nan("")
+                              : sketch.second->Quantile(percent / 100.));
+    }
+    values.emplace_back(absl::StrCat(sketch.first, "_max"),
+                        sketch.second->max());
+  }
+  for (size_t i = 0; i != kTranslationThresholds.size(); ++i) {
+    values.emplace_back(absl::StrCat("fraction_translation_smaller_than_",
+                                     kTranslationThresholds[i]),
+                        FractionSmallerThan(deviations, i));
+  }
+  return values;
+}
+
+std::string Quote(const std::string& value) {
+  std::string quoted = "\"";
+  for (const char c : value) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+std::string CsvQuote(const std::string& value) {
+  return absl::StrCat(
+      "\"", absl::StrReplaceAll(value, {{"\"", "\"\""}}), "\"");
+}
+
+// Trajectories without TF samples in their time range are left out.
+void WriteJsonReport(const std::vector<BagResult>& results,
+                     std::ostream* out) {
+  *out << "{\"comparisons\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BagResult& result = results[i];
+    *out << (i == 0 ? "" : ",") << "\n  {\"pbstream_filename\": "
+         << Quote(result.pbstream_filename)
+         << ",\n   \"bag_filename\": " << Quote(result.bag_filename)
+         << ",\n   \"num_uncovered_samples\": "
+         << result.num_uncovered_samples
+         << ",\n   \"num_ambiguous_samples\": "
+         << result.num_ambiguous_samples << ",\n   \"trajectories\": [";
+    bool first = true;
+    for (const TrajectoryDeviations& deviations : result.trajectories) {
+      if (deviations.translation.count() == 0) {
+        continue;
+      }
+      *out << (first ? "" : ",") << "\n    {\"trajectory_id\": "
+           << deviations.trajectory_id
+           << ", \"num_samples\": " << deviations.translation.count();
+      for (const auto& value : GetReportValues(deviations)) {
+        *out << ", " << Quote(value.first) << ": " << value.second;
+      }
+      *out << "}";
+      first = false;
+    }
+    *out << "]}";
+  }
+  *out << "]}\n";
+}
+
+void WriteCsvReport(const std::vector<BagResult>& results,
+                    std::ostream* out) {
+  *out << "pbstream_filename,bag_filename,num_uncovered_samples,"
+          "num_ambiguous_samples,trajectory_id,num_samples";
+  for (const auto& value : GetReportValues(TrajectoryDeviations())) {
+    *out << "," << value.first;
+  }
+  *out << "\n";
+  for (const BagResult& result : results) {
+    for (const TrajectoryDeviations& deviations : result.trajectories) {
+      if (deviations.translation.count() == 0) {
+        continue;
+      }
+      *out << CsvQuote(result.pbstream_filename) << ","
+           << CsvQuote(result.bag_filename) << ","
+           << result.num_uncovered_samples << ","
+           << result.num_ambiguous_samples << "," << deviations.trajectory_id
+           << "," << deviations.translation.count();
+      for (const auto& value : GetReportValues(deviations)) {
+        *out << "," << value.second;
+      }
+      *out << "\n";
+    }
+  }
+}
+
+std::vector<Comparison> GetComparisons() {
+  std::vector<Comparison> comparisons;
+  if (FLAGS_comparisons.empty()) {
+    CHECK(!FLAGS_bag_filename.empty()) << "-bag_filename is missing.";
+    CHECK(!FLAGS_pbstream_filename.empty())
+        << "-pbstream_filename is missing.";
+    comparisons.push_back(
+        Comparison{FLAGS_pbstream_filename,
+                   absl::StrSplit(FLAGS_bag_filename, ',', absl::SkipEmpty())});
+    return comparisons;
+  }
+  for (const std::string& comparison_flag :
+       absl::StrSplit(FLAGS_comparisons, ';', absl::SkipEmpty())) {
+    const std::vector<std::string> parts = absl::StrSplit(comparison_flag, ':');
+    CHECK_EQ(parts.size(), 2)
+        << "Invalid comparison '" << comparison_flag << "'.";
+    comparisons.push_back(Comparison{
+        parts[0], absl::StrSplit(parts[1], ',', absl::SkipEmpty())});
+  }
+  return comparisons;
+}
+
+void Run(const std::vector<Comparison>& comparisons, const int num_threads) {
+  CHECK_GT(num_threads, 0);
+  // Each pose graph is only read once for all its bags.
+  std::vector<PoseGraphTrajectories> trajectories(comparisons.size());
+  RunInParallel(comparisons.size(), num_threads, [&](const size_t i) {
+    trajectories[i] = ReadTrajectories(comparisons[i]);
+  });
+
+  // Each (pbstream, bag) pair is its own task, the results keep the order of
+  // the comparisons and their bags.
+  std::vector<std::pair<size_t, size_t>> tasks;
+  for (size_t i = 0; i != comparisons.size(); ++i) {
+    for (size_t j = 0; j != comparisons[i].bag_filenames.size(); ++j) {
+      tasks.emplace_back(i, j);
+    }
+  }
+  std::vector<BagResult> results(tasks.size());
+  RunInParallel(tasks.size(), num_threads, [&](const size_t i) {
+    const size_t comparison_index = tasks[i].first;
+    results[i] = CompareBag(comparisons[comparison_index],
+                            trajectories[comparison_index], tasks[i].second);
+  });
+  for (const BagResult& result : results) {
+    LogResult(result);
+  }
+
+  if (!FLAGS_report_filename.empty()) {
+    std::ofstream report(FLAGS_report_filename);
+    if (absl::EndsWith(FLAGS_report_filename, ".csv")) {
+      WriteCsvReport(results, &report);
+    } else {
+      WriteJsonReport(results, &report);
+    }
+    report.close();
+    CHECK(report) << "Could not write " << FLAGS_report_filename;
+  }
 }
 
 }  // namespace
@@ -134,10 +433,9 @@ int main(int argc, char** argv) {
   google::InitGoogleLogging(argv[0]);
   google::SetUsageMessage(
       "\n\n"
-      "This compares a trajectory from a bag file against the "
-      "last trajectory in a pbstream file.\n");
+      "This compares the trajectories from bag files against the "
+      "trajectories in pbstream files.\n");
   google::ParseCommandLineFlags(&argc, &argv, true);
-  CHECK(!FLAGS_bag_filename.empty()) << "-bag_filename is missing.";
-  CHECK(!FLAGS_pbstream_filename.empty()) << "-pbstream_filename is missing.";
-  ::cartographer_ros::Run(FLAGS_pbstream_filename, FLAGS_bag_filename);
+  ::cartographer_ros::Run(::cartographer_ros::GetComparisons(),
+                          FLAGS_num_threads);
 }
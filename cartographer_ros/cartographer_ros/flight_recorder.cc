@@ -0,0 +1,107 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/flight_recorder.h"
+
+#include "glog/logging.h"
+#include "rosbag/bag.h"
+#include "rosbag/exceptions.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+// Writes any of the recorded message types at the given 'topic' and 'time'.
+class BagWriter : public boost::static_visitor<void> {
+ public:
+  BagWriter(const std::string& topic, const ::ros::Time& time,
+            rosbag::Bag* const bag)
+      : topic_(topic), time_(time), bag_(bag) {}
+
+  template <typename MessagePtr>
+  void operator()(const MessagePtr& msg) const {
+    bag_->write(topic_, time_, msg);
+  }
+
+ private:
+  const std::string& topic_;
+  const ::ros::Time& time_;
+  rosbag::Bag* const bag_;
+};
+
+}  // namespace
+
+FlightRecorder::FlightRecorder(const int num_messages,
+                               TopicResolver topic_resolver)
+    : num_messages_(num_messages), topic_resolver_(std::move(topic_resolver)) {
+  CHECK_GE(num_messages, 0);
+  absl::MutexLock lock(&mutex_);
+  entries_.resize(num_messages_);
+}
+
+FlightRecorder::~FlightRecorder() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool FlightRecorder::Write(const std::string& filename) {
+  if (!enabled()) {
+    return false;
+  }
+  absl::MutexLock lock(&mutex_);
+  if (writing_) {
+    return false;
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  // Only copies the pointers, so that recording continues right away.
+  std::vector<Entry> entries;
+  entries.reserve(num_recorded_messages_);
+  const size_t first_entry_index =
+      (next_entry_index_ + num_messages_ - num_recorded_messages_) %
+      num_messages_;
+  for (size_t i = 0; i < num_recorded_messages_; ++i) {
+    entries.push_back(entries_[(first_entry_index + i) % num_messages_]);
+  }
+  writing_ = true;
+  thread_ =
+      std::thread(&FlightRecorder::Run, this, filename, std::move(entries));
+  return true;
+}
+
+void FlightRecorder::Run(const std::string& filename,
+                         std::vector<Entry> entries) {
+  try {
+    rosbag::Bag bag(filename, rosbag::bagmode::Write);
+    for (const Entry& entry : entries) {
+      const std::string topic = topic_resolver_(entry.topic);
+      boost::apply_visitor(BagWriter(topic, entry.time, &bag), entry.msg);
+    }
+    bag.close();
+    LOG(INFO) << "Wrote " << entries.size() << " recorded messages to '"
+              << filename << "'.";
+  } catch (const rosbag::BagException& e) {
+    LOG(ERROR) << "Failed to write the recorded messages to '" << filename
+               << "': " << e.what();
+  }
+
+  absl::MutexLock lock(&mutex_);
+  writing_ = false;
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_FLIGHT_RECORDER_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_FLIGHT_RECORDER_H
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "boost/variant.hpp"
+#include "cartographer_ros_msgs/LandmarkList.h"
+#include "nav_msgs/Odometry.h"
+#include "ros/time.h"
+#include "sensor_msgs/Imu.h"
+#include "sensor_msgs/LaserScan.h"
+#include "sensor_msgs/MultiEchoLaserScan.h"
+#include "sensor_msgs/NavSatFix.h"
+#include "sensor_msgs/PointCloud2.h"
+
+namespace cartographer_ros {
+
+// Keeps the latest sensor messages handed to the node in a ring buffer, so
+// that they can be written to a bag and replayed when something went wrong.
+// Only the shared pointers to the messages are kept, recording does not copy
+// them.
+class FlightRecorder {
+ public:
+  // Maps the topics given to 'Record()' to the topics written to the bag.
+  using TopicResolver = std::function<std::string(const std::string&)>;
+
+  // Keeps the latest 'num_messages' messages, 0 disables recording.
+  FlightRecorder(int num_messages, TopicResolver topic_resolver);
+  // Waits until the recording being written is finished.
+  ~FlightRecorder();
+
+  FlightRecorder(const FlightRecorder&) = delete;
+  FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+  bool enabled() const { return num_messages_ > 0; }
+
+  // Records 'msg' received on 'topic' now, replacing the oldest message if
+  // the buffer is full.
+  template <typename MessagePtr>
+  void Record(const std::string& topic, const MessagePtr& msg)
+      LOCKS_EXCLUDED(mutex_) {
+    if (!enabled()) {
+      return;
+    }
+    const ::ros::Time now = ::ros::Time::now();
+    absl::MutexLock lock(&mutex_);
+    Entry& entry = entries_[next_entry_index_];
+    // Reuses the memory of the replaced topic.
+    entry.topic = topic;
+    entry.time = now;
+    entry.msg = msg;
+    next_entry_index_ = (next_entry_index_ + 1) % num_messages_;
+    if (num_recorded_messages_ < num_messages_) {
+      ++num_recorded_messages_;
+    }
+  }
+
+  // Starts writing the recorded messages to the bag 'filename' in the
+  // background, oldest first. Returns false if recording is disabled or if
+  // another recording is still being written.
+  bool Write(const std::string& filename) LOCKS_EXCLUDED(mutex_);
+
+ private:
+  using MessagePtr =
+      boost::variant<nav_msgs::Odometry::ConstPtr,
+                     sensor_msgs::NavSatFix::ConstPtr,
+                     cartographer_ros_msgs::LandmarkList::ConstPtr,
+                     sensor_msgs::Imu::ConstPtr,
+                     sensor_msgs::LaserScan::ConstPtr,
+                     sensor_msgs::MultiEchoLaserScan::ConstPtr,
+                     sensor_msgs::PointCloud2::ConstPtr>;
+
+  struct Entry {
+    std::string topic;
+    ::ros::Time time;
+    MessagePtr msg;
+  };
+
+  void Run(const std::string& filename, std::vector<Entry> entries)
+      LOCKS_EXCLUDED(mutex_);
+
+  const size_t num_messages_;
+  const TopicResolver topic_resolver_;
+  absl::Mutex mutex_;
+  // Holds 'num_messages_' entries, of which the 'num_recorded_messages_'
+  // before 'next_entry_index_' are recorded.
+  std::vector<Entry> entries_ GUARDED_BY(mutex_);
+  size_t next_entry_index_ GUARDED_BY(mutex_) = 0;
+  size_t num_recorded_messages_ GUARDED_BY(mutex_) = 0;
+  bool writing_ GUARDED_BY(mutex_) = false;
+  // Only started by 'Write()' while holding 'mutex_'.
+  std::thread thread_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_FLIGHT_RECORDER_H
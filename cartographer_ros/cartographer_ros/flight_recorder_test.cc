@@ -0,0 +1,83 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/flight_recorder.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "boost/make_shared.hpp"
+#include "cartographer_ros/temporary_file_test_helpers.h"
+#include "gtest/gtest.h"
+#include "rosbag/bag.h"
+#include "rosbag/view.h"
+
+namespace cartographer_ros {
+namespace {
+
+class FlightRecorderTest : public TemporaryFileTest {
+ protected:
+  FlightRecorderTest() : TemporaryFileTest("recording.bag") {}
+
+  void SetUp() override {
+    ::ros::Time::init();
+    TemporaryFileTest::SetUp();
+  }
+};
+
+TEST_F(FlightRecorderTest, WritesLatestMessages) {
+  {
+    FlightRecorder recorder(
+        2 /* num_messages */,
+        [](const std::string& topic) { return "/robot/" + topic; });
+    for (int i = 0; i < 3; ++i) {
+      auto imu = boost::make_shared<sensor_msgs::Imu>();
+      imu->header.seq = i;
+      recorder.Record("imu", sensor_msgs::Imu::ConstPtr(imu));
+    }
+    auto scan = boost::make_shared<sensor_msgs::LaserScan>();
+    scan->header.seq = 3;
+    recorder.Record("scan", sensor_msgs::LaserScan::ConstPtr(scan));
+    ASSERT_TRUE(recorder.Write(filename_));
+  }
+
+  rosbag::Bag bag(filename_, rosbag::bagmode::Read);
+  rosbag::View view(bag);
+  std::vector<std::string> topics;
+  for (const rosbag::MessageInstance& message : view) {
+    topics.push_back(message.getTopic());
+    if (message.isType<sensor_msgs::Imu>()) {
+      EXPECT_EQ(2, message.instantiate<sensor_msgs::Imu>()->header.seq);
+    } else {
+      ASSERT_TRUE(message.isType<sensor_msgs::LaserScan>());
+      EXPECT_EQ(3, message.instantiate<sensor_msgs::LaserScan>()->header.seq);
+    }
+  }
+  std::sort(topics.begin(), topics.end());
+  EXPECT_EQ((std::vector<std::string>{"/robot/imu", "/robot/scan"}), topics);
+}
+
+TEST(FlightRecorderDisabledTest, DoesNotWrite) {
+  FlightRecorder recorder(0 /* num_messages */,
+                          [](const std::string& topic) { return topic; });
+  EXPECT_FALSE(recorder.enabled());
+  recorder.Record("imu", sensor_msgs::Imu::ConstPtr(new sensor_msgs::Imu));
+  EXPECT_FALSE(recorder.Write("unused.bag"));
+}
+
+}  // namespace
+}  // namespace cartographer_ros
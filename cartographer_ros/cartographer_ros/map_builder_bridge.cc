@@ -16,11 +16,20 @@
 
 #include "cartographer_ros/map_builder_bridge.h"
 
+#include <algorithm>
+
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
 #include "cartographer/io/color.h"
 #include "cartographer/io/proto_stream.h"
+#include "cartographer_ros/cross_trajectory_constraints.h"
+#include "cartographer_ros/metrics/latency.h"
+#include "cartographer_ros/metrics/trajectory_accounting.h"
 #include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/node_constants.h"
+#include "cartographer_ros/parallel_proto_stream_reader.h"
+#include "cartographer_ros/submap_texture_codec.h"
 #include "cartographer_ros/time_conversion.h"
 #include "cartographer_ros_msgs/StatusCode.h"
 #include "cartographer_ros_msgs/StatusResponse.h"
@@ -33,6 +42,25 @@ using ::cartographer::transform::Rigid3d;
 constexpr double kTrajectoryLineStripMarkerScale = 0.07;
 constexpr double kLandmarkMarkerScale = 0.2;
 constexpr double kConstraintMarkerScale = 0.025;
+// Node and submap poses are copied again after this time, constraints and
+// landmark poses after 'kConstraintPublishPeriodSec', unless an optimization
+// finished meanwhile.
+constexpr std::chrono::milliseconds kPoseGraphSnapshotMaxAge(100);
+// Fraction of 'submap_texture_cache_size_mb' used for the textures transcoded
+// for clients asking for LZ4 compressed cells, the rest is used for the ones
+// with gzip compressed cells.
+constexpr double kLz4SubmapTextureCacheFraction = 0.25;
+
+// Indices, and ids, of the markers in the constraint list.
+enum ConstraintMarker {
+  kConstraintIntraMarker,
+  kResidualIntraMarker,
+  kConstraintInterSameTrajectoryMarker,
+  kResidualInterSameTrajectoryMarker,
+  kConstraintInterDiffTrajectoryMarker,
+  kResidualInterDiffTrajectoryMarker,
+  kNumConstraintMarkers
+};
 
 ::std_msgs::ColorRGBA ToMessage(const cartographer::io::FloatColor& color) {
   ::std_msgs::ColorRGBA result;
@@ -58,26 +86,15 @@ visualization_msgs::Marker CreateTrajectoryMarker(const int trajectory_id,
   return marker;
 }
 
-int GetLandmarkIndex(
-    const std::string& landmark_id,
-    std::unordered_map<std::string, int>* landmark_id_to_index) {
-  auto it = landmark_id_to_index->find(landmark_id);
-  if (it == landmark_id_to_index->end()) {
-    const int new_index = landmark_id_to_index->size();
-    landmark_id_to_index->emplace(landmark_id, new_index);
-    return new_index;
-  }
-  return it->second;
-}
-
 visualization_msgs::Marker CreateLandmarkMarker(int landmark_index,
                                                 const Rigid3d& landmark_pose,
-                                                const std::string& frame_id) {
+                                                const std::string& frame_id,
+                                                const ::ros::Time& stamp) {
   visualization_msgs::Marker marker;
   marker.ns = "Landmarks";
   marker.id = landmark_index;
   marker.type = visualization_msgs::Marker::SPHERE;
-  marker.header.stamp = ::ros::Time::now();
+  marker.header.stamp = stamp;
   marker.header.frame_id = frame_id;
   marker.scale.x = kLandmarkMarkerScale;
   marker.scale.y = kLandmarkMarkerScale;
@@ -94,15 +111,61 @@ void PushAndResetLineMarker(visualization_msgs::Marker* marker,
   marker->points.clear();
 }
 
+size_t GetSubmapTextureCacheBytes(const NodeOptions& node_options) {
+  return static_cast<size_t>(node_options.submap_texture_cache_size_mb) << 20;
+}
+
+size_t GetLz4SubmapTextureCacheBytes(const NodeOptions& node_options) {
+  return static_cast<size_t>(kLz4SubmapTextureCacheFraction *
+                             GetSubmapTextureCacheBytes(node_options));
+}
+
 }  // namespace
 
 MapBuilderBridge::MapBuilderBridge(
     const NodeOptions& node_options,
     std::unique_ptr<cartographer::mapping::MapBuilderInterface> map_builder,
-    tf2_ros::Buffer* const tf_buffer)
+    tf2_ros::BufferInterface* const tf_buffer)
     : node_options_(node_options),
       map_builder_(std::move(map_builder)),
-      tf_buffer_(tf_buffer) {}
+      tf_buffer_(tf_buffer),
+      submap_texture_cache_(GetSubmapTextureCacheBytes(node_options) -
+                            GetLz4SubmapTextureCacheBytes(node_options)),
+      lz4_submap_texture_cache_(GetLz4SubmapTextureCacheBytes(node_options)) {
+  if (node_options_.num_rangefinder_transform_threads > 0) {
+    rangefinder_transform_thread_pool_ =
+        absl::make_unique<cartographer::common::ThreadPool>(
+            node_options_.num_rangefinder_transform_threads);
+  }
+  // Remote pose graphs, e.g. the gRPC stub, do not implement the callback.
+  reports_optimizations_ =
+      dynamic_cast<::cartographer::mapping::PoseGraph*>(
+          map_builder_->pose_graph()) != nullptr;
+  if (reports_optimizations_) {
+    map_builder_->pose_graph()->SetGlobalSlamOptimizationCallback(
+        [this](const std::map<int, cartographer::mapping::SubmapId>&,
+               const std::map<int, cartographer::mapping::NodeId>&
+                   last_optimized_node_ids) {
+          ++num_global_optimizations_;
+          range_data_backpressure_.AddOptimizationResult(
+              last_optimized_node_ids);
+        });
+  }
+  if (node_options_.pose_graph_refresh_period_sec > 0.) {
+    pose_graph_refresh_thread_ =
+        std::thread(&MapBuilderBridge::RefreshPoseGraph, this);
+  }
+}
+
+MapBuilderBridge::~MapBuilderBridge() {
+  if (pose_graph_refresh_thread_.joinable()) {
+    {
+      absl::MutexLock lock(&pose_graph_refresh_mutex_);
+      shutting_down_ = true;
+    }
+    pose_graph_refresh_thread_.join();
+  }
+}
 
 void MapBuilderBridge::LoadState(const std::string& state_filename,
                                  bool load_frozen_state) {
@@ -114,33 +177,96 @@ void MapBuilderBridge::LoadState(const std::string& state_filename,
       << "The file containing the state to be loaded must be a "
          ".pbstream file.";
   LOG(INFO) << "Loading saved state '" << state_filename << "'...";
-  cartographer::io::ProtoStreamReader stream(state_filename);
-  map_builder_->LoadState(&stream, load_frozen_state);
+  if (node_options_.num_load_state_threads > 0) {
+    ParallelProtoStreamReader stream(state_filename,
+                                     node_options_.num_load_state_threads);
+    map_builder_->LoadState(&stream, load_frozen_state);
+  } else {
+    cartographer::io::ProtoStreamReader stream(state_filename);
+    map_builder_->LoadState(&stream, load_frozen_state);
+  }
 }
 
 int MapBuilderBridge::AddTrajectory(
     const std::set<cartographer::mapping::TrajectoryBuilderInterface::SensorId>&
         expected_sensor_ids,
     const TrajectoryOptions& trajectory_options) {
+  using SensorId =
+      ::cartographer::mapping::TrajectoryBuilderInterface::SensorId;
+  // The trajectory builder only gets the merged range data of the sensors
+  // which are merged.
+  std::set<SensorId> builder_sensor_ids = expected_sensor_ids;
+  const std::set<std::string>& merged_sensor_ids =
+      trajectory_options.rangefinder_merge.sensor_ids;
+  if (!merged_sensor_ids.empty()) {
+    for (const std::string& sensor_id : merged_sensor_ids) {
+      CHECK_EQ(builder_sensor_ids.erase(
+                   SensorId{SensorId::SensorType::RANGE, sensor_id}),
+               1u)
+          << "Merged topic '" << sensor_id << "' is not a rangefinder topic.";
+    }
+    builder_sensor_ids.insert(
+        SensorId{SensorId::SensorType::RANGE, kMergedRangefinderSensorId});
+  }
+  auto local_slam_data_slot = std::make_shared<LocalSlamDataSlot>();
+  RangeDataBackpressure* const range_data_backpressure =
+      &range_data_backpressure_;
+  // Nodes are only waited for if their optimization is reported.
+  const bool reports_optimizations = reports_optimizations_;
   const int trajectory_id = map_builder_->AddTrajectoryBuilder(
-      expected_sensor_ids, trajectory_options.trajectory_builder_options,
-      [this](const int trajectory_id, const ::cartographer::common::Time time,
-             const Rigid3d local_pose,
-             ::cartographer::sensor::RangeData range_data_in_local,
-             const std::unique_ptr<
-                 const ::cartographer::mapping::TrajectoryBuilderInterface::
-                     InsertionResult>) {
-        OnLocalSlamResult(trajectory_id, time, local_pose, range_data_in_local);
+      builder_sensor_ids, trajectory_options.trajectory_builder_options,
+      [local_slam_data_slot, range_data_backpressure, reports_optimizations](
+          const int trajectory_id, const ::cartographer::common::Time time,
+          const Rigid3d local_pose,
+          ::cartographer::sensor::RangeData range_data_in_local,
+          const std::unique_ptr<
+              const ::cartographer::mapping::TrajectoryBuilderInterface::
+                  InsertionResult>
+              insertion_result) {
+        range_data_backpressure->AddLocalSlamResult(
+            trajectory_id, time,
+            insertion_result == nullptr || !reports_optimizations
+                ? absl::optional<int>()
+                : absl::optional<int>(insertion_result->node_id.node_index));
+        const std::string latency_label = std::to_string(trajectory_id);
+        if (metrics::SampleLatency(metrics::LatencyStage::kLocalSlamResult,
+                                   latency_label)) {
+          metrics::ObserveLatency(
+              metrics::LatencyStage::kLocalSlamResult, latency_label,
+              std::max(0., ::cartographer::common::ToSeconds(
+                               FromRos(::ros::Time::now()) - time)));
+        }
+        OnLocalSlamResult(time, local_pose, std::move(range_data_in_local),
+                          local_slam_data_slot.get());
       });
   LOG(INFO) << "Added trajectory with ID '" << trajectory_id << "'.";
+  const metrics::TrajectoryAccounting accounting =
+      metrics::GetTrajectoryAccounting(trajectory_id);
+  local_slam_data_slot->local_slam_data_bytes =
+      accounting.local_slam_data_bytes;
+  local_slam_data_slots_[trajectory_id] = std::move(local_slam_data_slot);
+
+  ::cartographer::mapping::TrajectoryBuilderInterface* trajectory_builder =
+      map_builder_->GetTrajectoryBuilder(trajectory_id);
+  if (IsSensorDataBatchingEnabled(node_options_.sensor_data_batching)) {
+    auto sensor_data_batcher = absl::make_unique<SensorDataBatcher>(
+        node_options_.sensor_data_batching, trajectory_builder);
+    trajectory_builder = sensor_data_batcher.get();
+    sensor_data_batchers_[trajectory_id] = std::move(sensor_data_batcher);
+  }
 
   // Make sure there is no trajectory with 'trajectory_id' yet.
   CHECK_EQ(sensor_bridges_.count(trajectory_id), 0);
   sensor_bridges_[trajectory_id] = absl::make_unique<SensorBridge>(
-      trajectory_options.num_subdivisions_per_laser_scan,
+      trajectory_options.use_laser_scan_point_time
+          ? 1
+          : trajectory_options.num_subdivisions_per_laser_scan,
       trajectory_options.tracking_frame,
       node_options_.lookup_transform_timeout_sec, tf_buffer_,
-      map_builder_->GetTrajectoryBuilder(trajectory_id));
+      trajectory_builder,
+      rangefinder_transform_thread_pool_.get(),
+      trajectory_options.rangefinder_prefilters,
+      trajectory_options.rangefinder_merge, accounting);
   auto emplace_result =
       trajectory_options_.emplace(trajectory_id, trajectory_options);
   CHECK(emplace_result.second == true);
@@ -152,8 +278,25 @@ void MapBuilderBridge::FinishTrajectory(const int trajectory_id) {
 
   // Make sure there is a trajectory with 'trajectory_id'.
   CHECK(GetTrajectoryStates().count(trajectory_id));
+  // Range data waiting to be merged goes through the batcher, so it is
+  // flushed first.
+  const auto sensor_bridge = sensor_bridges_.find(trajectory_id);
+  if (sensor_bridge != sensor_bridges_.end()) {
+    sensor_bridge->second->Flush();
+  }
+  const auto sensor_data_batcher = sensor_data_batchers_.find(trajectory_id);
+  if (sensor_data_batcher != sensor_data_batchers_.end()) {
+    sensor_data_batcher->second->Flush();
+  }
   map_builder_->FinishTrajectory(trajectory_id);
   sensor_bridges_.erase(trajectory_id);
+  sensor_data_batchers_.erase(trajectory_id);
+  const auto local_slam_data_slot = local_slam_data_slots_.find(trajectory_id);
+  if (local_slam_data_slot != local_slam_data_slots_.end()) {
+    local_slam_data_slot->second->local_slam_data_bytes->Set(0.);
+    local_slam_data_slots_.erase(local_slam_data_slot);
+  }
+  range_data_backpressure_.FinishTrajectory(trajectory_id);
 }
 
 void MapBuilderBridge::RunFinalOptimization() {
@@ -161,39 +304,176 @@ void MapBuilderBridge::RunFinalOptimization() {
   map_builder_->pose_graph()->RunFinalOptimization();
 }
 
+void MapBuilderBridge::SearchCrossTrajectoryConstraints() {
+  auto* const pose_graph = dynamic_cast<::cartographer::mapping::PoseGraph*>(
+      map_builder_->pose_graph());
+  CHECK(pose_graph != nullptr)
+      << "The pose graph does not support adding constraints.";
+  AddCrossTrajectoryConstraints(node_options_.map_builder_options, pose_graph);
+}
+
 bool MapBuilderBridge::SerializeState(const std::string& filename,
                                       const bool include_unfinished_submaps) {
   return map_builder_->SerializeStateToFile(include_unfinished_submaps,
                                             filename);
 }
 
+void MapBuilderBridge::SerializeState(
+    const bool include_unfinished_submaps,
+    ::cartographer::io::ProtoStreamWriterInterface* const writer) {
+  map_builder_->SerializeState(include_unfinished_submaps, writer);
+}
+
+bool MapBuilderBridge::ComputeInitialTrajectoryPose(
+    const Rigid3d& tracking_to_map,
+    cartographer::mapping::proto::InitialTrajectoryPose* const
+        initial_trajectory_pose) {
+  const auto node_poses = map_builder_->pose_graph()->GetTrajectoryNodePoses();
+  if (node_poses.empty()) {
+    return false;
+  }
+  // Like for the start trajectory service, the pose is relative to the start
+  // of the trajectory, which its poses are interpolated at for time 0.
+  const auto first_node = node_poses.begin();
+  initial_trajectory_pose->set_to_trajectory_id(first_node->id.trajectory_id);
+  *initial_trajectory_pose->mutable_relative_pose() =
+      cartographer::transform::ToProto(first_node->data.global_pose.inverse() *
+                                       tracking_to_map);
+  initial_trajectory_pose->set_timestamp(
+      cartographer::common::ToUniversal(FromRos(::ros::Time(0))));
+  return true;
+}
+
 void MapBuilderBridge::HandleSubmapQuery(
     cartographer_ros_msgs::SubmapQuery::Request& request,
     cartographer_ros_msgs::SubmapQuery::Response& response) {
-  cartographer::mapping::proto::SubmapQuery::Response response_proto;
   cartographer::mapping::SubmapId submap_id{request.trajectory_id,
                                             request.submap_index};
+  std::shared_ptr<const SubmapTextureCache::Textures> textures;
+  int submap_version;
+  if (pose_graph_refresh_thread_.joinable()) {
+    // Serves the cached textures even if the submap changed since, they are
+    // recreated in the background.
+    textures = submap_texture_cache_.GetAnyVersion(submap_id, &submap_version);
+  } else {
+    // The version is 'num_range_data()', as in 'SubmapToProto()'.
+    const auto submap_data =
+        map_builder_->pose_graph()->GetSubmapData(submap_id);
+    if (submap_data.submap != nullptr) {
+      submap_version = submap_data.submap->num_range_data();
+      textures = submap_texture_cache_.Get(submap_id, submap_version);
+    }
+  }
+
+  if (textures == nullptr) {
+    const std::string error =
+        CreateSubmapTextures(submap_id, &submap_version, &textures);
+    if (!error.empty()) {
+      LOG(ERROR) << error;
+      response.status.code = cartographer_ros_msgs::StatusCode::NOT_FOUND;
+      response.status.message = error;
+      return;
+    }
+    submap_texture_cache_.Insert(submap_id, submap_version, textures);
+  }
+  if (request.cells_encoding ==
+      cartographer_ros_msgs::SubmapTexture::CELLS_ENCODING_LZ4) {
+    // Transcoded once per submap version, clients decode LZ4 much faster.
+    auto lz4_textures =
+        lz4_submap_texture_cache_.Get(submap_id, submap_version);
+    if (lz4_textures == nullptr) {
+      auto transcoded_textures =
+          std::make_shared<SubmapTextureCache::Textures>();
+      transcoded_textures->reserve(textures->size());
+      for (const auto& texture : *textures) {
+        transcoded_textures->push_back(EncodeSubmapTextureCells(
+            texture, cartographer_ros_msgs::SubmapTexture::CELLS_ENCODING_LZ4));
+      }
+      lz4_textures = std::move(transcoded_textures);
+      lz4_submap_texture_cache_.Insert(submap_id, submap_version,
+                                       lz4_textures);
+    }
+    textures = std::move(lz4_textures);
+  }
+  response.submap_version = submap_version;
+  response.textures = *textures;
+  response.status.message = "Success.";
+  response.status.code = cartographer_ros_msgs::StatusCode::OK;
+}
+
+std::string MapBuilderBridge::CreateSubmapTextures(
+    const cartographer::mapping::SubmapId& submap_id, int* const submap_version,
+    std::shared_ptr<const SubmapTextureCache::Textures>* const textures) {
+  cartographer::mapping::proto::SubmapQuery::Response response_proto;
   const std::string error =
       map_builder_->SubmapToProto(submap_id, &response_proto);
   if (!error.empty()) {
-    LOG(ERROR) << error;
-    response.status.code = cartographer_ros_msgs::StatusCode::NOT_FOUND;
-    response.status.message = error;
-    return;
+    return error;
   }
 
-  response.submap_version = response_proto.submap_version();
+  *submap_version = response_proto.submap_version();
+  auto created_textures = std::make_shared<SubmapTextureCache::Textures>();
+  created_textures->reserve(response_proto.textures_size());
   for (const auto& texture_proto : response_proto.textures()) {
-    response.textures.emplace_back();
-    auto& texture = response.textures.back();
-    texture.cells.insert(texture.cells.begin(), texture_proto.cells().begin(),
+    created_textures->emplace_back();
+    auto& texture = created_textures->back();
+    texture.cells.assign(texture_proto.cells().begin(),
                          texture_proto.cells().end());
     texture.width = texture_proto.width();
     texture.height = texture_proto.height();
     texture.resolution = texture_proto.resolution();
+    texture.cells_encoding =
+        cartographer_ros_msgs::SubmapTexture::CELLS_ENCODING_GZIP;
     texture.slice_pose = ToGeometryMsgPose(
         cartographer::transform::ToRigid3(texture_proto.slice_pose()));
   }
+  *textures = std::move(created_textures);
+  return "";
+}
+
+void MapBuilderBridge::HandleBatchSubmapQuery(
+    cartographer_ros_msgs::BatchSubmapQuery::Request& request,
+    cartographer_ros_msgs::BatchSubmapQuery::Response& response) {
+  response.results.reserve(request.submaps.size());
+  for (const auto& entry : request.submaps) {
+    response.results.emplace_back();
+    auto& result = response.results.back();
+    result.trajectory_id = entry.trajectory_id;
+    result.submap_index = entry.submap_index;
+    const cartographer::mapping::SubmapId submap_id{entry.trajectory_id,
+                                                    entry.submap_index};
+    bool unchanged;
+    if (pose_graph_refresh_thread_.joinable()) {
+      // Compares with the version 'HandleSubmapQuery()' would answer with.
+      int cached_submap_version;
+      unchanged = submap_texture_cache_.GetAnyVersion(
+                      submap_id, &cached_submap_version) != nullptr &&
+                  cached_submap_version == entry.known_submap_version;
+    } else {
+      // The version is 'num_range_data()', as in 'SubmapToProto()', which is
+      // cheap to get compared to creating the textures.
+      const auto submap_data =
+          map_builder_->pose_graph()->GetSubmapData(submap_id);
+      unchanged =
+          submap_data.submap != nullptr &&
+          submap_data.submap->num_range_data() == entry.known_submap_version;
+    }
+    if (unchanged) {
+      result.submap_version = entry.known_submap_version;
+      result.status.message = "Unchanged.";
+      result.status.code = cartographer_ros_msgs::StatusCode::OK;
+      continue;
+    }
+    cartographer_ros_msgs::SubmapQuery::Request submap_request;
+    submap_request.trajectory_id = entry.trajectory_id;
+    submap_request.submap_index = entry.submap_index;
+    submap_request.cells_encoding = request.cells_encoding;
+    cartographer_ros_msgs::SubmapQuery::Response submap_response;
+    HandleSubmapQuery(submap_request, submap_response);
+    result.status = std::move(submap_response.status);
+    result.submap_version = submap_response.submap_version;
+    result.textures = std::move(submap_response.textures);
+  }
   response.status.message = "Success.";
   response.status.code = cartographer_ros_msgs::StatusCode::OK;
 }
@@ -215,20 +495,32 @@ cartographer_ros_msgs::SubmapList MapBuilderBridge::GetSubmapList() {
   cartographer_ros_msgs::SubmapList submap_list;
   submap_list.header.stamp = ::ros::Time::now();
   submap_list.header.frame_id = node_options_.map_frame;
-  for (const auto& submap_id_pose :
-       map_builder_->pose_graph()->GetAllSubmapPoses()) {
-    cartographer_ros_msgs::SubmapEntry submap_entry;
-    submap_entry.is_frozen = map_builder_->pose_graph()->IsTrajectoryFrozen(
-        submap_id_pose.id.trajectory_id);
-    submap_entry.trajectory_id = submap_id_pose.id.trajectory_id;
-    submap_entry.submap_index = submap_id_pose.id.submap_index;
-    submap_entry.submap_version = submap_id_pose.data.version;
-    submap_entry.pose = ToGeometryMsgPose(submap_id_pose.data.pose);
-    submap_list.submap.push_back(submap_entry);
+  const std::shared_ptr<const PoseGraphSnapshot> snapshot =
+      GetPoseGraphSnapshot();
+  const auto& submap_poses = snapshot->submap_poses;
+  for (const int trajectory_id : submap_poses.trajectory_ids()) {
+    const bool is_frozen = snapshot->IsTrajectoryFrozen(trajectory_id);
+    for (const auto& submap_id_pose : submap_poses.trajectory(trajectory_id)) {
+      submap_list.submap.push_back(
+          ToSubmapEntry(submap_id_pose.id, submap_id_pose.data.version,
+                        submap_id_pose.data.pose, is_frozen));
+    }
   }
   return submap_list;
 }
 
+cartographer_ros_msgs::SubmapListUpdate MapBuilderBridge::GetSubmapListUpdate(
+    const bool full) {
+  const std::shared_ptr<const PoseGraphSnapshot> snapshot =
+      GetPoseGraphSnapshot();
+  absl::MutexLock lock(&submap_list_mutex_);
+  cartographer_ros_msgs::SubmapListUpdate submap_list_update =
+      submap_list_tracker_.GetUpdate(*snapshot, full);
+  submap_list_update.header.stamp = ::ros::Time::now();
+  submap_list_update.header.frame_id = node_options_.map_frame;
+  return submap_list_update;
+}
+
 std::unordered_map<int, MapBuilderBridge::LocalTrajectoryData>
 MapBuilderBridge::GetLocalTrajectoryData() {
   std::unordered_map<int, LocalTrajectoryData> local_trajectory_data;
@@ -236,20 +528,18 @@ MapBuilderBridge::GetLocalTrajectoryData() {
     const int trajectory_id = entry.first;
     const SensorBridge& sensor_bridge = *entry.second;
 
-    std::shared_ptr<const LocalTrajectoryData::LocalSlamData> local_slam_data;
-    {
-      absl::MutexLock lock(&mutex_);
-      if (local_slam_data_.count(trajectory_id) == 0) {
-        continue;
-      }
-      local_slam_data = local_slam_data_.at(trajectory_id);
+    LocalSlamDataSlot* const slot =
+        local_slam_data_slots_.at(trajectory_id).get();
+    std::shared_ptr<const LocalTrajectoryData::LocalSlamData> local_slam_data =
+        std::atomic_load(&slot->local_slam_data);
+    if (local_slam_data == nullptr) {
+      continue;
     }
 
     // Make sure there is a trajectory with 'trajectory_id'.
     CHECK_EQ(trajectory_options_.count(trajectory_id), 1);
     local_trajectory_data[trajectory_id] = {
-        local_slam_data,
-        map_builder_->pose_graph()->GetLocalToGlobalTransform(trajectory_id),
+        local_slam_data, GetLocalToGlobalTransform(trajectory_id, slot),
         sensor_bridge.tf_bridge().LookupToTracking(
             local_slam_data->time,
             trajectory_options_[trajectory_id].published_frame),
@@ -263,106 +553,179 @@ void MapBuilderBridge::HandleTrajectoryQuery(
     cartographer_ros_msgs::TrajectoryQuery::Response& response) {
   // This query is safe if the trajectory doesn't exist (returns 0 poses).
   // However, we can filter unwanted states at the higher level in the node.
-  const auto node_poses = map_builder_->pose_graph()->GetTrajectoryNodePoses();
-  for (const auto& node_id_data :
-       node_poses.trajectory(request.trajectory_id)) {
-    if (!node_id_data.data.constant_pose_data.has_value()) {
+  const std::shared_ptr<const PoseGraphSnapshot> snapshot =
+      GetPoseGraphSnapshot();
+  const int num_global_optimizations = snapshot->num_global_optimizations;
+  const auto& node_poses = snapshot->trajectory_node_poses;
+  int start_node_index = request.start_node_index;
+  // Optimizations do not move the nodes of frozen trajectories.
+  if (request.changed_only &&
+      (request.known_num_optimizations == num_global_optimizations ||
+       snapshot->IsTrajectoryFrozen(request.trajectory_id))) {
+    start_node_index = std::max(start_node_index, request.known_end_node_index);
+  }
+  const auto trajectory_node_poses =
+      node_poses.trajectory(request.trajectory_id);
+  response.end_node_index =
+      trajectory_node_poses.begin() == trajectory_node_poses.end()
+          ? 0
+          : (--trajectory_node_poses.end())->id.node_index + 1;
+  for (const auto& node_id_data : trajectory_node_poses) {
+    const int node_index = node_id_data.id.node_index;
+    if (request.end_node_index > 0 && node_index >= request.end_node_index) {
+      break;
+    }
+    if (node_index < start_node_index ||
+        (request.decimation > 1 && node_index % request.decimation != 0) ||
+        !node_id_data.data.constant_pose_data.has_value()) {
+      continue;
+    }
+    const ::ros::Time time =
+        ToRos(node_id_data.data.constant_pose_data.value().time);
+    if ((!request.start_time.isZero() && time < request.start_time) ||
+        (!request.end_time.isZero() && time >= request.end_time)) {
       continue;
     }
     geometry_msgs::PoseStamped pose_stamped;
     pose_stamped.header.frame_id = node_options_.map_frame;
-    pose_stamped.header.stamp =
-        ToRos(node_id_data.data.constant_pose_data.value().time);
+    pose_stamped.header.stamp = time;
     pose_stamped.pose = ToGeometryMsgPose(node_id_data.data.global_pose);
     response.trajectory.push_back(pose_stamped);
+    response.node_indices.push_back(node_index);
   }
+  response.num_optimizations = num_global_optimizations;
   response.status.code = cartographer_ros_msgs::StatusCode::OK;
   response.status.message = absl::StrCat(
       "Retrieved ", response.trajectory.size(),
       " trajectory nodes from trajectory ", request.trajectory_id, ".");
 }
 
-visualization_msgs::MarkerArray MapBuilderBridge::GetTrajectoryNodeList() {
-  visualization_msgs::MarkerArray trajectory_node_list;
-  const auto node_poses = map_builder_->pose_graph()->GetTrajectoryNodePoses();
+void MapBuilderBridge::UpdateLastConstrainedNodes(
+    const PoseGraphSnapshot::Constraints& constraints) {
   // Find the last node indices for each trajectory that have either
   // inter-submap or inter-trajectory constraints.
-  std::map<int, int /* node_index */>
-      trajectory_to_last_inter_submap_constrained_node;
-  std::map<int, int /* node_index */>
-      trajectory_to_last_inter_trajectory_constrained_node;
-  for (const int trajectory_id : node_poses.trajectory_ids()) {
-    trajectory_to_last_inter_submap_constrained_node[trajectory_id] = 0;
-    trajectory_to_last_inter_trajectory_constrained_node[trajectory_id] = 0;
-  }
-  const auto constraints = map_builder_->pose_graph()->constraints();
+  trajectory_to_last_inter_submap_constrained_node_.clear();
+  trajectory_to_last_inter_trajectory_constrained_node_.clear();
   for (const auto& constraint : constraints) {
     if (constraint.tag ==
         cartographer::mapping::PoseGraphInterface::Constraint::INTER_SUBMAP) {
-      if (constraint.node_id.trajectory_id ==
-          constraint.submap_id.trajectory_id) {
-        trajectory_to_last_inter_submap_constrained_node[constraint.node_id
-                                                             .trajectory_id] =
-            std::max(trajectory_to_last_inter_submap_constrained_node.at(
-                         constraint.node_id.trajectory_id),
-                     constraint.node_id.node_index);
+      const int trajectory_id = constraint.node_id.trajectory_id;
+      int& last_inter_submap_constrained_node =
+          trajectory_to_last_inter_submap_constrained_node_[trajectory_id];
+      if (trajectory_id == constraint.submap_id.trajectory_id) {
+        last_inter_submap_constrained_node = std::max(
+            last_inter_submap_constrained_node, constraint.node_id.node_index);
       } else {
-        trajectory_to_last_inter_trajectory_constrained_node
-            [constraint.node_id.trajectory_id] =
-                std::max(trajectory_to_last_inter_submap_constrained_node.at(
-                             constraint.node_id.trajectory_id),
-                         constraint.node_id.node_index);
+        trajectory_to_last_inter_trajectory_constrained_node_[trajectory_id] =
+            std::max(last_inter_submap_constrained_node,
+                     constraint.node_id.node_index);
       }
     }
   }
+}
+
+visualization_msgs::MarkerArray MapBuilderBridge::GetTrajectoryNodeList(
+    const bool changed_only) {
+  visualization_msgs::MarkerArray trajectory_node_list;
+  const std::shared_ptr<const PoseGraphSnapshot> snapshot =
+      GetPoseGraphSnapshot();
+  const int num_global_optimizations = snapshot->num_global_optimizations;
+  const auto& node_poses = snapshot->trajectory_node_poses;
+  absl::MutexLock lock(&trajectory_node_list_mutex_);
+  // Constraints are only looked at after optimizations, since only these move
+  // nodes that are already shown.
+  const bool optimized =
+      num_global_optimizations != trajectory_node_list_num_optimizations_;
+  if (optimized || !changed_only) {
+    UpdateLastConstrainedNodes(*snapshot->constraints);
+    trajectory_node_list_num_optimizations_ = num_global_optimizations;
+  }
 
   for (const int trajectory_id : node_poses.trajectory_ids()) {
-    visualization_msgs::Marker marker =
-        CreateTrajectoryMarker(trajectory_id, node_options_.map_frame);
+    const auto trajectory_node_poses = node_poses.trajectory(trajectory_id);
+    const int first_node_index = trajectory_node_poses.begin()->id.node_index;
+    const auto find_or_zero = [trajectory_id](const std::map<int, int>& map) {
+      const auto it = map.find(trajectory_id);
+      return it == map.end() ? 0 : it->second;
+    };
     int last_inter_submap_constrained_node = std::max(
-        node_poses.trajectory(trajectory_id).begin()->id.node_index,
-        trajectory_to_last_inter_submap_constrained_node.at(trajectory_id));
+        first_node_index,
+        find_or_zero(trajectory_to_last_inter_submap_constrained_node_));
     int last_inter_trajectory_constrained_node = std::max(
-        node_poses.trajectory(trajectory_id).begin()->id.node_index,
-        trajectory_to_last_inter_trajectory_constrained_node.at(trajectory_id));
+        first_node_index,
+        find_or_zero(trajectory_to_last_inter_trajectory_constrained_node_));
     last_inter_submap_constrained_node =
         std::max(last_inter_submap_constrained_node,
                  last_inter_trajectory_constrained_node);
 
-    if (map_builder_->pose_graph()->IsTrajectoryFrozen(trajectory_id)) {
+    const bool frozen = snapshot->IsTrajectoryFrozen(trajectory_id);
+    if (frozen) {
       last_inter_submap_constrained_node =
-          (--node_poses.trajectory(trajectory_id).end())->id.node_index;
+          (--trajectory_node_poses.end())->id.node_index;
       last_inter_trajectory_constrained_node =
           last_inter_submap_constrained_node;
     }
 
-    marker.color.a = 1.0;
-    for (const auto& node_id_data : node_poses.trajectory(trajectory_id)) {
+    // Markers before the one that was still growing at the last call are
+    // unchanged, unless nodes moved or the segments changed.
+    TrajectoryNodeMarkers& cached = trajectory_node_markers_[trajectory_id];
+    if (!changed_only || optimized || !cached.valid ||
+        cached.frozen != frozen ||
+        cached.last_inter_submap_constrained_node !=
+            last_inter_submap_constrained_node ||
+        cached.last_inter_trajectory_constrained_node !=
+            last_inter_trajectory_constrained_node) {
+      cached.valid = true;
+      cached.frozen = frozen;
+      cached.last_inter_submap_constrained_node =
+          last_inter_submap_constrained_node;
+      cached.last_inter_trajectory_constrained_node =
+          last_inter_trajectory_constrained_node;
+      cached.open_marker =
+          CreateTrajectoryMarker(trajectory_id, node_options_.map_frame);
+      cached.open_marker.color.a = 1.0;
+      cached.next_node_index = first_node_index;
+    }
+
+    visualization_msgs::Marker marker = cached.open_marker;
+    marker.header.stamp = ::ros::Time::now();
+    const auto push_and_reset_line_marker = [&](const int node_index) {
+      PushAndResetLineMarker(&marker, &trajectory_node_list.markers);
+      cached.next_node_index = node_index + 1;
+    };
+    for (const auto& node_id_data : trajectory_node_poses) {
+      const int node_index = node_id_data.id.node_index;
+      if (node_index < cached.next_node_index) {
+        continue;
+      }
       if (!node_id_data.data.constant_pose_data.has_value()) {
-        PushAndResetLineMarker(&marker, &trajectory_node_list.markers);
+        push_and_reset_line_marker(node_index);
+        cached.open_marker = marker;
         continue;
       }
       const ::geometry_msgs::Point node_point =
           ToGeometryMsgPoint(node_id_data.data.global_pose.translation());
       marker.points.push_back(node_point);
 
-      if (node_id_data.id.node_index ==
-          last_inter_trajectory_constrained_node) {
-        PushAndResetLineMarker(&marker, &trajectory_node_list.markers);
+      if (node_index == last_inter_trajectory_constrained_node) {
+        push_and_reset_line_marker(node_index);
         marker.points.push_back(node_point);
         marker.color.a = 0.5;
+        cached.open_marker = marker;
       }
-      if (node_id_data.id.node_index == last_inter_submap_constrained_node) {
-        PushAndResetLineMarker(&marker, &trajectory_node_list.markers);
+      if (node_index == last_inter_submap_constrained_node) {
+        push_and_reset_line_marker(node_index);
         marker.points.push_back(node_point);
         marker.color.a = 0.25;
+        cached.open_marker = marker;
       }
       // Work around the 16384 point limit in RViz by splitting the
       // trajectory into multiple markers.
       if (marker.points.size() == 16384) {
-        PushAndResetLineMarker(&marker, &trajectory_node_list.markers);
+        push_and_reset_line_marker(node_index);
         // Push back the last point, so the two markers appear connected.
         marker.points.push_back(node_point);
+        cached.open_marker = marker;
       }
     }
     PushAndResetLineMarker(&marker, &trajectory_node_list.markers);
@@ -382,109 +745,142 @@ visualization_msgs::MarkerArray MapBuilderBridge::GetTrajectoryNodeList() {
   return trajectory_node_list;
 }
 
-visualization_msgs::MarkerArray MapBuilderBridge::GetLandmarkPosesList() {
+visualization_msgs::MarkerArray MapBuilderBridge::GetLandmarkPosesList(
+    const bool changed_only) {
   visualization_msgs::MarkerArray landmark_poses_list;
-  const std::map<std::string, Rigid3d> landmark_poses =
-      map_builder_->pose_graph()->GetLandmarkPoses();
-  for (const auto& id_to_pose : landmark_poses) {
-    landmark_poses_list.markers.push_back(CreateLandmarkMarker(
-        GetLandmarkIndex(id_to_pose.first, &landmark_to_index_),
-        id_to_pose.second, node_options_.map_frame));
+  const std::shared_ptr<const PoseGraphSnapshot> snapshot =
+      GetPoseGraphSnapshot();
+  absl::MutexLock lock(&landmark_poses_list_mutex_);
+  // Snapshots share the landmark poses until they are read again from the
+  // pose graph, so nothing changed if they are the ones we saw last.
+  if (changed_only && snapshot->landmark_poses == published_landmark_poses_) {
+    return landmark_poses_list;
+  }
+  published_landmark_poses_ = snapshot->landmark_poses;
+  const ::ros::Time now = ::ros::Time::now();
+  for (const auto& id_to_pose : *snapshot->landmark_poses) {
+    auto it = published_landmarks_.find(id_to_pose.first);
+    if (it == published_landmarks_.end()) {
+      const int marker_id = published_landmarks_.size();
+      it = published_landmarks_
+               .emplace(id_to_pose.first,
+                        PublishedLandmark{marker_id, id_to_pose.second})
+               .first;
+    } else if (changed_only &&
+               it->second.pose.translation() ==
+                   id_to_pose.second.translation() &&
+               it->second.pose.rotation().coeffs() ==
+                   id_to_pose.second.rotation().coeffs()) {
+      continue;
+    }
+    it->second.pose = id_to_pose.second;
+    landmark_poses_list.markers.push_back(
+        CreateLandmarkMarker(it->second.marker_id, id_to_pose.second,
+                             node_options_.map_frame, now));
   }
   return landmark_poses_list;
 }
 
-visualization_msgs::MarkerArray MapBuilderBridge::GetConstraintList() {
-  visualization_msgs::MarkerArray constraint_list;
-  int marker_id = 0;
-  visualization_msgs::Marker constraint_intra_marker;
-  constraint_intra_marker.id = marker_id++;
-  constraint_intra_marker.ns = "Intra constraints";
-  constraint_intra_marker.type = visualization_msgs::Marker::LINE_LIST;
-  constraint_intra_marker.header.stamp = ros::Time::now();
-  constraint_intra_marker.header.frame_id = node_options_.map_frame;
-  constraint_intra_marker.scale.x = kConstraintMarkerScale;
-  constraint_intra_marker.pose.orientation.w = 1.0;
-
-  visualization_msgs::Marker residual_intra_marker = constraint_intra_marker;
-  residual_intra_marker.id = marker_id++;
-  residual_intra_marker.ns = "Intra residuals";
-  // This and other markers which are less numerous are set to be slightly
-  // above the intra constraints marker in order to ensure that they are
-  // visible.
-  residual_intra_marker.pose.position.z = 0.1;
-
-  visualization_msgs::Marker constraint_inter_same_trajectory_marker =
-      constraint_intra_marker;
-  constraint_inter_same_trajectory_marker.id = marker_id++;
-  constraint_inter_same_trajectory_marker.ns =
-      "Inter constraints, same trajectory";
-  constraint_inter_same_trajectory_marker.pose.position.z = 0.1;
-
-  visualization_msgs::Marker residual_inter_same_trajectory_marker =
-      constraint_intra_marker;
-  residual_inter_same_trajectory_marker.id = marker_id++;
-  residual_inter_same_trajectory_marker.ns = "Inter residuals, same trajectory";
-  residual_inter_same_trajectory_marker.pose.position.z = 0.1;
-
-  visualization_msgs::Marker constraint_inter_diff_trajectory_marker =
-      constraint_intra_marker;
-  constraint_inter_diff_trajectory_marker.id = marker_id++;
-  constraint_inter_diff_trajectory_marker.ns =
-      "Inter constraints, different trajectories";
-  constraint_inter_diff_trajectory_marker.pose.position.z = 0.1;
-
-  visualization_msgs::Marker residual_inter_diff_trajectory_marker =
-      constraint_intra_marker;
-  residual_inter_diff_trajectory_marker.id = marker_id++;
-  residual_inter_diff_trajectory_marker.ns =
-      "Inter residuals, different trajectories";
-  residual_inter_diff_trajectory_marker.pose.position.z = 0.1;
+void MapBuilderBridge::GetConstraintList(
+    visualization_msgs::MarkerArray* const constraint_list) {
+  // The markers are reused, so that their points keep their capacity.
+  auto& markers = constraint_list->markers;
+  if (markers.size() != static_cast<size_t>(kNumConstraintMarkers)) {
+    markers.assign(kNumConstraintMarkers, visualization_msgs::Marker());
+    visualization_msgs::Marker& constraint_intra_marker =
+        markers[kConstraintIntraMarker];
+    constraint_intra_marker.ns = "Intra constraints";
+    constraint_intra_marker.type = visualization_msgs::Marker::LINE_LIST;
+    constraint_intra_marker.header.frame_id = node_options_.map_frame;
+    constraint_intra_marker.scale.x = kConstraintMarkerScale;
+    constraint_intra_marker.pose.orientation.w = 1.0;
+    for (int i = kConstraintIntraMarker + 1; i != kNumConstraintMarkers; ++i) {
+      markers[i] = constraint_intra_marker;
+      // These markers are less numerous and set to be slightly above the
+      // intra constraints marker in order to ensure that they are visible.
+      markers[i].pose.position.z = 0.1;
+    }
+    markers[kResidualIntraMarker].ns = "Intra residuals";
+    markers[kConstraintInterSameTrajectoryMarker].ns =
+        "Inter constraints, same trajectory";
+    markers[kResidualInterSameTrajectoryMarker].ns =
+        "Inter residuals, same trajectory";
+    markers[kConstraintInterDiffTrajectoryMarker].ns =
+        "Inter constraints, different trajectories";
+    markers[kResidualInterDiffTrajectoryMarker].ns =
+        "Inter residuals, different trajectories";
+    // Except for intra constraints, all lines of a marker have the same
+    // color, so 'colors' stays empty for them.
+    markers[kResidualIntraMarker].color.a = 1.0;
+    markers[kResidualIntraMarker].color.r = 1.0;
+    // Bright yellow
+    markers[kConstraintInterSameTrajectoryMarker].color.a = 1.0;
+    markers[kConstraintInterSameTrajectoryMarker].color.r = 1.0;
+    markers[kConstraintInterSameTrajectoryMarker].color.g = 1.0;
+    // Bright orange
+    markers[kConstraintInterDiffTrajectoryMarker].color.a = 1.0;
+    markers[kConstraintInterDiffTrajectoryMarker].color.r = 1.0;
+    markers[kConstraintInterDiffTrajectoryMarker].color.g = 165. / 255.;
+    // Bright cyan
+    for (const int i : {kResidualInterSameTrajectoryMarker,
+                        kResidualInterDiffTrajectoryMarker}) {
+      markers[i].color.a = 1.0;
+      markers[i].color.g = 1.0;
+      markers[i].color.b = 1.0;
+    }
+  }
+  const ros::Time now = ros::Time::now();
+  for (int i = 0; i != kNumConstraintMarkers; ++i) {
+    markers[i].id = i;
+    markers[i].header.stamp = now;
+    markers[i].points.clear();
+    markers[i].colors.clear();
+  }
 
-  const auto trajectory_node_poses =
-      map_builder_->pose_graph()->GetTrajectoryNodePoses();
-  const auto submap_poses = map_builder_->pose_graph()->GetAllSubmapPoses();
-  const auto constraints = map_builder_->pose_graph()->constraints();
+  const std::shared_ptr<const PoseGraphSnapshot> snapshot =
+      GetPoseGraphSnapshot();
+  const auto& trajectory_node_poses = snapshot->trajectory_node_poses;
+  const auto& submap_poses = snapshot->submap_poses;
+  const auto& constraints = *snapshot->constraints;
+
+  // Beyond 'max_published_intra_submap_constraints', only every
+  // 'intra_submap_stride'-th intra-submap constraint is shown.
+  size_t intra_submap_stride = 1;
+  if (node_options_.max_published_intra_submap_constraints > 0) {
+    const size_t max_intra_submap_constraints =
+        node_options_.max_published_intra_submap_constraints;
+    const size_t num_intra_submap_constraints = std::count_if(
+        constraints.begin(), constraints.end(),
+        [](const cartographer::mapping::PoseGraphInterface::Constraint&
+               constraint) {
+          return constraint.tag == cartographer::mapping::PoseGraphInterface::
+                                       Constraint::INTRA_SUBMAP;
+        });
+    intra_submap_stride =
+        (num_intra_submap_constraints + max_intra_submap_constraints - 1) /
+        max_intra_submap_constraints;
+    intra_submap_stride = std::max<size_t>(intra_submap_stride, 1);
+  }
 
+  size_t intra_submap_index = 0;
   for (const auto& constraint : constraints) {
     visualization_msgs::Marker *constraint_marker, *residual_marker;
-    std_msgs::ColorRGBA color_constraint, color_residual;
-    if (constraint.tag ==
-        cartographer::mapping::PoseGraphInterface::Constraint::INTRA_SUBMAP) {
-      constraint_marker = &constraint_intra_marker;
-      residual_marker = &residual_intra_marker;
-      // Color mapping for submaps of various trajectories - add trajectory id
-      // to ensure different starting colors. Also add a fixed offset of 25
-      // to avoid having identical colors as trajectories.
-      color_constraint = ToMessage(
-          cartographer::io::GetColor(constraint.submap_id.submap_index +
-                                     constraint.submap_id.trajectory_id + 25));
-      color_residual.a = 1.0;
-      color_residual.r = 1.0;
-    } else {
-      if (constraint.node_id.trajectory_id ==
-          constraint.submap_id.trajectory_id) {
-        constraint_marker = &constraint_inter_same_trajectory_marker;
-        residual_marker = &residual_inter_same_trajectory_marker;
-        // Bright yellow
-        color_constraint.a = 1.0;
-        color_constraint.r = color_constraint.g = 1.0;
-      } else {
-        constraint_marker = &constraint_inter_diff_trajectory_marker;
-        residual_marker = &residual_inter_diff_trajectory_marker;
-        // Bright orange
-        color_constraint.a = 1.0;
-        color_constraint.r = 1.0;
-        color_constraint.g = 165. / 255.;
+    const bool intra_submap =
+        constraint.tag ==
+        cartographer::mapping::PoseGraphInterface::Constraint::INTRA_SUBMAP;
+    if (intra_submap) {
+      if (intra_submap_index++ % intra_submap_stride != 0) {
+        continue;
       }
-      // Bright cyan
-      color_residual.a = 1.0;
-      color_residual.b = color_residual.g = 1.0;
-    }
-
-    for (int i = 0; i < 2; ++i) {
-      constraint_marker->colors.push_back(color_constraint);
-      residual_marker->colors.push_back(color_residual);
+      constraint_marker = &markers[kConstraintIntraMarker];
+      residual_marker = &markers[kResidualIntraMarker];
+    } else if (constraint.node_id.trajectory_id ==
+               constraint.submap_id.trajectory_id) {
+      constraint_marker = &markers[kConstraintInterSameTrajectoryMarker];
+      residual_marker = &markers[kResidualInterSameTrajectoryMarker];
+    } else {
+      constraint_marker = &markers[kConstraintInterDiffTrajectoryMarker];
+      residual_marker = &markers[kResidualInterDiffTrajectoryMarker];
     }
 
     const auto submap_it = submap_poses.find(constraint.submap_id);
@@ -499,6 +895,16 @@ visualization_msgs::MarkerArray MapBuilderBridge::GetConstraintList() {
     const auto& trajectory_node_pose = node_it->data.global_pose;
     const Rigid3d constraint_pose = submap_pose * constraint.pose.zbar_ij;
 
+    if (intra_submap) {
+      // Color mapping for submaps of various trajectories - add trajectory id
+      // to ensure different starting colors. Also add a fixed offset of 25
+      // to avoid having identical colors as trajectories.
+      const std_msgs::ColorRGBA color_constraint = ToMessage(
+          cartographer::io::GetColor(constraint.submap_id.submap_index +
+                                     constraint.submap_id.trajectory_id + 25));
+      constraint_marker->colors.push_back(color_constraint);
+      constraint_marker->colors.push_back(color_constraint);
+    }
     constraint_marker->points.push_back(
         ToGeometryMsgPoint(submap_pose.translation()));
     constraint_marker->points.push_back(
@@ -509,14 +915,78 @@ visualization_msgs::MarkerArray MapBuilderBridge::GetConstraintList() {
     residual_marker->points.push_back(
         ToGeometryMsgPoint(trajectory_node_pose.translation()));
   }
+}
+
+int MapBuilderBridge::GetNumGlobalOptimizations() const {
+  if (reports_optimizations_) {
+    return num_global_optimizations_;
+  }
+  // Without optimization callbacks, all data derived from the pose graph is
+  // assumed to change every 'kPoseGraphSnapshotMaxAge'.
+  return static_cast<int>((std::chrono::steady_clock::now() - creation_time_) /
+                          kPoseGraphSnapshotMaxAge);
+}
+
+std::shared_ptr<const PoseGraphSnapshot>
+MapBuilderBridge::GetPoseGraphSnapshot() {
+  // Read before the pose graph is copied, so that an optimization finishing
+  // meanwhile leads to a new snapshot.
+  const int num_global_optimizations = GetNumGlobalOptimizations();
+  absl::MutexLock lock(&pose_graph_snapshot_mutex_);
+  if (pose_graph_snapshot_ != nullptr &&
+      pose_graph_refresh_thread_.joinable()) {
+    return pose_graph_snapshot_;
+  }
+  if (pose_graph_snapshot_ == nullptr ||
+      pose_graph_snapshot_->num_global_optimizations !=
+          num_global_optimizations ||
+      std::chrono::steady_clock::now() - pose_graph_snapshot_->time >
+          kPoseGraphSnapshotMaxAge) {
+    pose_graph_snapshot_ = TakePoseGraphSnapshot(
+        map_builder_->pose_graph(), num_global_optimizations,
+        pose_graph_snapshot_.get(),
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(kConstraintPublishPeriodSec)),
+        false /* include_local_to_global_transforms */);
+  }
+  return pose_graph_snapshot_;
+}
 
-  constraint_list.markers.push_back(constraint_intra_marker);
-  constraint_list.markers.push_back(residual_intra_marker);
-  constraint_list.markers.push_back(constraint_inter_same_trajectory_marker);
-  constraint_list.markers.push_back(residual_inter_same_trajectory_marker);
-  constraint_list.markers.push_back(constraint_inter_diff_trajectory_marker);
-  constraint_list.markers.push_back(residual_inter_diff_trajectory_marker);
-  return constraint_list;
+void MapBuilderBridge::RefreshPoseGraph() {
+  const absl::Duration refresh_period =
+      absl::Seconds(node_options_.pose_graph_refresh_period_sec);
+  std::shared_ptr<const PoseGraphSnapshot> snapshot;
+  while (true) {
+    snapshot = TakePoseGraphSnapshot(
+        map_builder_->pose_graph(), GetNumGlobalOptimizations(), snapshot.get(),
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(kConstraintPublishPeriodSec)),
+        true /* include_local_to_global_transforms */);
+    {
+      absl::MutexLock lock(&pose_graph_snapshot_mutex_);
+      pose_graph_snapshot_ = snapshot;
+    }
+    for (const auto& entry : submap_texture_cache_.GetVersions()) {
+      const auto it = snapshot->submap_poses.find(entry.first);
+      if (it == snapshot->submap_poses.end() ||
+          it->data.version == entry.second) {
+        continue;
+      }
+      int submap_version;
+      std::shared_ptr<const SubmapTextureCache::Textures> textures;
+      if (CreateSubmapTextures(entry.first, &submap_version, &textures)
+              .empty()) {
+        submap_texture_cache_.Insert(entry.first, submap_version,
+                                     std::move(textures));
+      }
+    }
+
+    absl::MutexLock lock(&pose_graph_refresh_mutex_);
+    if (pose_graph_refresh_mutex_.AwaitWithTimeout(
+            absl::Condition(&shutting_down_), refresh_period)) {
+      return;
+    }
+  }
 }
 
 SensorBridge* MapBuilderBridge::sensor_bridge(const int trajectory_id) {
@@ -524,15 +994,40 @@ SensorBridge* MapBuilderBridge::sensor_bridge(const int trajectory_id) {
 }
 
 void MapBuilderBridge::OnLocalSlamResult(
-    const int trajectory_id, const ::cartographer::common::Time time,
-    const Rigid3d local_pose,
-    ::cartographer::sensor::RangeData range_data_in_local) {
-  std::shared_ptr<const LocalTrajectoryData::LocalSlamData> local_slam_data =
-      std::make_shared<LocalTrajectoryData::LocalSlamData>(
-          LocalTrajectoryData::LocalSlamData{time, local_pose,
-                                             std::move(range_data_in_local)});
-  absl::MutexLock lock(&mutex_);
-  local_slam_data_[trajectory_id] = std::move(local_slam_data);
+    const ::cartographer::common::Time time, const Rigid3d& local_pose,
+    ::cartographer::sensor::RangeData range_data_in_local,
+    LocalSlamDataSlot* const slot) {
+  slot->local_slam_data_bytes->Set(static_cast<double>(
+      sizeof(LocalTrajectoryData::LocalSlamData) +
+      (range_data_in_local.returns.size() + range_data_in_local.misses.size()) *
+          sizeof(::cartographer::sensor::RangefinderPoint)));
+  std::atomic_store(
+      &slot->local_slam_data,
+      std::shared_ptr<const LocalTrajectoryData::LocalSlamData>(
+          std::make_shared<LocalTrajectoryData::LocalSlamData>(
+              LocalTrajectoryData::LocalSlamData{
+                  time, local_pose, std::move(range_data_in_local)})));
+}
+
+Rigid3d MapBuilderBridge::GetLocalToGlobalTransform(
+    const int trajectory_id, LocalSlamDataSlot* const slot) {
+  if (pose_graph_refresh_thread_.joinable()) {
+    const std::shared_ptr<const PoseGraphSnapshot> snapshot =
+        GetPoseGraphSnapshot();
+    const auto it = snapshot->local_to_global_transforms.find(trajectory_id);
+    if (it != snapshot->local_to_global_transforms.end()) {
+      return it->second;
+    }
+    // The trajectory was added after the snapshot was taken.
+  }
+  const int num_global_optimizations = GetNumGlobalOptimizations();
+  absl::MutexLock lock(&slot->mutex);
+  if (slot->local_to_global_num_optimizations != num_global_optimizations) {
+    slot->local_to_global =
+        map_builder_->pose_graph()->GetLocalToGlobalTransform(trajectory_id);
+    slot->local_to_global_num_optimizations = num_global_optimizations;
+  }
+  return slot->local_to_global;
 }
 
 }  // namespace cartographer_ros
@@ -17,22 +17,36 @@
 #ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_MAP_BUILDER_BRIDGE_H
 #define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_MAP_BUILDER_BRIDGE_H
 
+#include <atomic>
+#include <chrono>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 
 #include "absl/synchronization/mutex.h"
+#include "cartographer/common/thread_pool.h"
+#include "cartographer/io/proto_stream_interface.h"
 #include "cartographer/mapping/map_builder_interface.h"
 #include "cartographer/mapping/pose_graph_interface.h"
 #include "cartographer/mapping/proto/trajectory_builder_options.pb.h"
 #include "cartographer/mapping/trajectory_builder_interface.h"
+#include "cartographer/metrics/gauge.h"
 #include "cartographer_ros/node_options.h"
+#include "cartographer_ros/pose_graph_snapshot.h"
+#include "cartographer_ros/range_data_backpressure.h"
 #include "cartographer_ros/sensor_bridge.h"
+#include "cartographer_ros/sensor_data_batcher.h"
+#include "cartographer_ros/submap_list_tracker.h"
+#include "cartographer_ros/submap_texture_cache.h"
 #include "cartographer_ros/tf_bridge.h"
 #include "cartographer_ros/trajectory_options.h"
+#include "cartographer_ros_msgs/BatchSubmapQuery.h"
 #include "cartographer_ros_msgs/SubmapEntry.h"
 #include "cartographer_ros_msgs/SubmapList.h"
+#include "cartographer_ros_msgs/SubmapListUpdate.h"
 #include "cartographer_ros_msgs/SubmapQuery.h"
 #include "cartographer_ros_msgs/TrajectoryQuery.h"
 #include "geometry_msgs/TransformStamped.h"
@@ -67,7 +81,8 @@ class MapBuilderBridge {
   MapBuilderBridge(
       const NodeOptions& node_options,
       std::unique_ptr<cartographer::mapping::MapBuilderInterface> map_builder,
-      tf2_ros::Buffer* tf_buffer);
+      tf2_ros::BufferInterface* tf_buffer);
+  ~MapBuilderBridge();
 
   MapBuilderBridge(const MapBuilderBridge&) = delete;
   MapBuilderBridge& operator=(const MapBuilderBridge&) = delete;
@@ -80,12 +95,27 @@ class MapBuilderBridge {
       const TrajectoryOptions& trajectory_options);
   void FinishTrajectory(int trajectory_id);
   void RunFinalOptimization();
+  void SearchCrossTrajectoryConstraints();
+  // Sets 'initial_trajectory_pose' so that a new trajectory starts with its
+  // tracking frame at 'tracking_to_map', relative to the first trajectory
+  // which has nodes. Returns false if there is none.
+  bool ComputeInitialTrajectoryPose(
+      const ::cartographer::transform::Rigid3d& tracking_to_map,
+      ::cartographer::mapping::proto::InitialTrajectoryPose*
+          initial_trajectory_pose);
   bool SerializeState(const std::string& filename,
                       const bool include_unfinished_submaps);
+  void SerializeState(bool include_unfinished_submaps,
+                      ::cartographer::io::ProtoStreamWriterInterface* writer);
 
   void HandleSubmapQuery(
       cartographer_ros_msgs::SubmapQuery::Request& request,
       cartographer_ros_msgs::SubmapQuery::Response& response);
+  // Like 'HandleSubmapQuery()' for each of the requested submaps, but skips
+  // creating textures for submaps whose version the client already has.
+  void HandleBatchSubmapQuery(
+      cartographer_ros_msgs::BatchSubmapQuery::Request& request,
+      cartographer_ros_msgs::BatchSubmapQuery::Response& response);
   void HandleTrajectoryQuery(
       cartographer_ros_msgs::TrajectoryQuery::Request& request,
       cartographer_ros_msgs::TrajectoryQuery::Response& response);
@@ -94,35 +124,149 @@ class MapBuilderBridge {
            ::cartographer::mapping::PoseGraphInterface::TrajectoryState>
   GetTrajectoryStates();
   cartographer_ros_msgs::SubmapList GetSubmapList();
-  std::unordered_map<int, LocalTrajectoryData> GetLocalTrajectoryData()
-      LOCKS_EXCLUDED(mutex_);
-  visualization_msgs::MarkerArray GetTrajectoryNodeList();
-  visualization_msgs::MarkerArray GetLandmarkPosesList();
-  visualization_msgs::MarkerArray GetConstraintList();
+  // Returns the submaps which were added, changed or removed since the
+  // previous call, or all submaps if 'full' is true.
+  cartographer_ros_msgs::SubmapListUpdate GetSubmapListUpdate(bool full);
+  std::unordered_map<int, LocalTrajectoryData> GetLocalTrajectoryData();
+  // If 'changed_only' is true, markers that did not change since the last
+  // call are left out.
+  visualization_msgs::MarkerArray GetTrajectoryNodeList(bool changed_only);
+  // If 'changed_only' is true, markers of landmarks whose pose did not change
+  // since the last call are left out.
+  visualization_msgs::MarkerArray GetLandmarkPosesList(bool changed_only);
+  // Fills 'constraint_list', reusing the memory of its markers from previous
+  // calls.
+  void GetConstraintList(visualization_msgs::MarkerArray* constraint_list);
 
   SensorBridge* sensor_bridge(int trajectory_id);
+  RangeDataBackpressure* range_data_backpressure() {
+    return &range_data_backpressure_;
+  }
 
  private:
-  void OnLocalSlamResult(const int trajectory_id,
-                         const ::cartographer::common::Time time,
-                         const ::cartographer::transform::Rigid3d local_pose,
-                         ::cartographer::sensor::RangeData range_data_in_local)
-      LOCKS_EXCLUDED(mutex_);
+  // Holds the latest local SLAM result of a trajectory. It is written by the
+  // local SLAM callback and read when publishing poses without any lock.
+  struct LocalSlamDataSlot {
+    // Only accessed through std::atomic_load() and std::atomic_store().
+    std::shared_ptr<const LocalTrajectoryData::LocalSlamData> local_slam_data;
+    // Set before any data is added to the trajectory.
+    ::cartographer::metrics::Gauge* local_slam_data_bytes =
+        ::cartographer::metrics::Gauge::Null();
+
+    // Local to global transform, which only changes with optimizations.
+    absl::Mutex mutex;
+    int local_to_global_num_optimizations GUARDED_BY(mutex) = -1;
+    ::cartographer::transform::Rigid3d local_to_global GUARDED_BY(mutex);
+  };
+
+  static void OnLocalSlamResult(
+      ::cartographer::common::Time time,
+      const ::cartographer::transform::Rigid3d& local_pose,
+      ::cartographer::sensor::RangeData range_data_in_local,
+      LocalSlamDataSlot* slot);
+  ::cartographer::transform::Rigid3d GetLocalToGlobalTransform(
+      int trajectory_id, LocalSlamDataSlot* slot) LOCKS_EXCLUDED(slot->mutex);
+  void UpdateLastConstrainedNodes(
+      const PoseGraphSnapshot::Constraints& constraints)
+      EXCLUSIVE_LOCKS_REQUIRED(trajectory_node_list_mutex_);
+  // Returns the number of global optimizations, which is used to tell when
+  // data derived from the pose graph has to be read again.
+  int GetNumGlobalOptimizations() const;
+  // Returns the latest snapshot of the pose graph. Unless it is refreshed in
+  // the background, a new one is taken if an optimization finished since or
+  // the latest is too old.
+  std::shared_ptr<const PoseGraphSnapshot> GetPoseGraphSnapshot()
+      LOCKS_EXCLUDED(pose_graph_snapshot_mutex_);
+  // Creates the textures of 'submap_id' and sets 'submap_version' to their
+  // version. Returns an error message if the submap does not exist.
+  std::string CreateSubmapTextures(
+      const ::cartographer::mapping::SubmapId& submap_id, int* submap_version,
+      std::shared_ptr<const SubmapTextureCache::Textures>* textures);
+  // Run on 'pose_graph_refresh_thread_'.
+  void RefreshPoseGraph() LOCKS_EXCLUDED(pose_graph_refresh_mutex_);
+
+  // How the trajectory node list markers of one trajectory were built.
+  struct TrajectoryNodeMarkers {
+    bool valid = false;
+    bool frozen = false;
+    int last_inter_submap_constrained_node = 0;
+    int last_inter_trajectory_constrained_node = 0;
+    // The last marker as it was before adding nodes from 'next_node_index' on,
+    // from where building can continue if nodes were only appended.
+    visualization_msgs::Marker open_marker;
+    int next_node_index = 0;
+  };
+
+  // A landmark as it was last returned by GetLandmarkPosesList().
+  struct PublishedLandmark {
+    // Interned from the landmark ID when the landmark is first seen.
+    int marker_id;
+    ::cartographer::transform::Rigid3d pose;
+  };
 
-  absl::Mutex mutex_;
   const NodeOptions node_options_;
-  std::unordered_map<int,
-                     std::shared_ptr<const LocalTrajectoryData::LocalSlamData>>
-      local_slam_data_ GUARDED_BY(mutex_);
+  // Keyed with 'trajectory_id'. Slots are shared with the local SLAM
+  // callbacks, which write to them.
+  std::unordered_map<int, std::shared_ptr<LocalSlamDataSlot>>
+      local_slam_data_slots_;
   std::unique_ptr<cartographer::mapping::MapBuilderInterface> map_builder_;
-  tf2_ros::Buffer* const tf_buffer_;
-
-  std::unordered_map<std::string /* landmark ID */, int> landmark_to_index_;
+  tf2_ros::BufferInterface* const tf_buffer_;
+  // Shared by all sensor bridges, 'nullptr' if no extra threads are used.
+  std::unique_ptr<::cartographer::common::ThreadPool>
+      rangefinder_transform_thread_pool_;
+  // Holds the textures as created, with gzip compressed cells.
+  SubmapTextureCache submap_texture_cache_;
+  // Holds the textures transcoded for clients asking for LZ4 compressed cells.
+  SubmapTextureCache lz4_submap_texture_cache_;
 
   // These are keyed with 'trajectory_id'.
   std::unordered_map<int, TrajectoryOptions> trajectory_options_;
   std::unordered_map<int, std::unique_ptr<SensorBridge>> sensor_bridges_;
-  std::unordered_map<int, size_t> trajectory_to_highest_marker_id_;
+  // Only for trajectories with sensor data batching, used by their sensor
+  // bridges.
+  std::unordered_map<int, std::unique_ptr<SensorDataBatcher>>
+      sensor_data_batchers_;
+  // Incremented by the pose graph after each optimization, if it reports them.
+  bool reports_optimizations_ = false;
+  std::atomic<int> num_global_optimizations_{0};
+  const std::chrono::steady_clock::time_point creation_time_ =
+      std::chrono::steady_clock::now();
+  RangeDataBackpressure range_data_backpressure_;
+
+  // Concurrent readers wait for the one taking a snapshot, which is then
+  // shared by all of them.
+  absl::Mutex pose_graph_snapshot_mutex_;
+  std::shared_ptr<const PoseGraphSnapshot> pose_graph_snapshot_
+      GUARDED_BY(pose_graph_snapshot_mutex_);
+  // Only started if 'pose_graph_refresh_period_sec' is positive. It takes the
+  // snapshots and recreates the cached textures of submaps which changed, so
+  // that readers never wait for the map builder, e.g. for a remote server.
+  absl::Mutex pose_graph_refresh_mutex_;
+  bool shutting_down_ GUARDED_BY(pose_graph_refresh_mutex_) = false;
+  std::thread pose_graph_refresh_thread_;
+
+  absl::Mutex trajectory_node_list_mutex_;
+  std::unordered_map<int, size_t> trajectory_to_highest_marker_id_
+      GUARDED_BY(trajectory_node_list_mutex_);
+  int trajectory_node_list_num_optimizations_
+      GUARDED_BY(trajectory_node_list_mutex_) = -1;
+  std::map<int, int /* node_index */>
+      trajectory_to_last_inter_submap_constrained_node_
+          GUARDED_BY(trajectory_node_list_mutex_);
+  std::map<int, int /* node_index */>
+      trajectory_to_last_inter_trajectory_constrained_node_
+          GUARDED_BY(trajectory_node_list_mutex_);
+  std::map<int, TrajectoryNodeMarkers> trajectory_node_markers_
+      GUARDED_BY(trajectory_node_list_mutex_);
+
+  absl::Mutex landmark_poses_list_mutex_;
+  std::unordered_map<std::string /* landmark ID */, PublishedLandmark>
+      published_landmarks_ GUARDED_BY(landmark_poses_list_mutex_);
+  std::shared_ptr<const PoseGraphSnapshot::LandmarkPoses>
+      published_landmark_poses_ GUARDED_BY(landmark_poses_list_mutex_);
+
+  absl::Mutex submap_list_mutex_;
+  SubmapListTracker submap_list_tracker_ GUARDED_BY(submap_list_mutex_);
 };
 
 }  // namespace cartographer_ros
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/mapped_proto_stream_reader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#include "boost/iostreams/device/array.hpp"
+#include "boost/iostreams/filter/gzip.hpp"
+#include "boost/iostreams/filtering_stream.hpp"
+#include "cartographer/io/proto_stream_deserializer.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+// As written by '::cartographer::io::ProtoStreamWriter'.
+constexpr uint64_t kMagic = 0x7b1d1f7b5bf501db;
+constexpr size_t kSizeLength = 8;
+
+uint64_t ReadSizeAsLittleEndian(const char* const data) {
+  uint64_t size = 0;
+  for (size_t i = 0; i != kSizeLength; ++i) {
+    size |= static_cast<uint64_t>(static_cast<unsigned char>(data[i]))
+            << (8 * i);
+  }
+  return size;
+}
+
+}  // namespace
+
+MappedProtoStreamReader::MappedProtoStreamReader(const std::string& filename)
+    : filename_(filename), next_offset_(kSizeLength) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "Failed to open proto stream '" << filename
+                   << "': " << std::strerror(errno);
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << std::strerror(errno);
+  size_ = file_stat.st_size;
+  if (size_ > 0) {
+    void* const mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    CHECK(mapped != MAP_FAILED)
+        << "Failed to map '" << filename << "': " << std::strerror(errno);
+    data_ = static_cast<const char*>(mapped);
+    // The messages are mostly read in order.
+    madvise(mapped, size_, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  CHECK(size_ >= kSizeLength && ReadSizeAsLittleEndian(data_) == kMagic)
+      << "Failed to open proto stream '" << filename << "'.";
+}
+
+MappedProtoStreamReader::~MappedProtoStreamReader() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+}
+
+bool MappedProtoStreamReader::FindMessage(const int index,
+                                          Message* const message) const {
+  absl::MutexLock lock(&mutex_);
+  while (static_cast<int>(messages_.size()) <= index &&
+         size_ - next_offset_ >= kSizeLength) {
+    const uint64_t compressed_size =
+        ReadSizeAsLittleEndian(data_ + next_offset_);
+    if (compressed_size > size_ - next_offset_ - kSizeLength) {
+      LOG(WARNING) << "Proto stream '" << filename_ << "' is truncated.";
+      // Nothing after the truncated message is indexed.
+      next_offset_ = size_;
+      break;
+    }
+    messages_.push_back(
+        Message{data_ + next_offset_ + kSizeLength, compressed_size});
+    next_offset_ += kSizeLength + compressed_size;
+  }
+  if (static_cast<int>(messages_.size()) <= index) {
+    return false;
+  }
+  if (message != nullptr) {
+    *message = messages_[index];
+  }
+  return true;
+}
+
+int MappedProtoStreamReader::num_messages() const {
+  FindMessage(std::numeric_limits<int>::max(), nullptr);
+  absl::MutexLock lock(&mutex_);
+  return messages_.size();
+}
+
+bool MappedProtoStreamReader::ReadProto(
+    const int index, google::protobuf::Message* const proto) const {
+  CHECK_GE(index, 0);
+  Message message;
+  CHECK(FindMessage(index, &message))
+      << "Proto stream '" << filename_ << "' has no message " << index << ".";
+  // Decompresses straight from the mapped file, without copying it first.
+  boost::iostreams::filtering_istream in;
+  in.push(boost::iostreams::gzip_decompressor());
+  in.push(boost::iostreams::array_source(message.data, message.size));
+  return proto->ParseFromIstream(&in);
+}
+
+bool MappedProtoStreamReader::ReadProto(
+    google::protobuf::Message* const proto) {
+  if (eof()) {
+    return false;
+  }
+  return ReadProto(next_message_index_++, proto);
+}
+
+bool MappedProtoStreamReader::eof() const {
+  return !FindMessage(next_message_index_, nullptr);
+}
+
+::cartographer::mapping::proto::PoseGraph ReadPoseGraphFromFile(
+    const std::string& filename) {
+  MappedProtoStreamReader reader(filename);
+  // Only reads the header, the pose graph and the trajectory builder options.
+  ::cartographer::io::ProtoStreamDeserializer deserializer(&reader);
+  return deserializer.pose_graph();
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_MAPPED_PROTO_STREAM_READER_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_MAPPED_PROTO_STREAM_READER_H
+
+#include <string>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "cartographer/io/proto_stream_interface.h"
+#include "cartographer/mapping/proto/pose_graph.pb.h"
+#include "google/protobuf/message.h"
+
+namespace cartographer_ros {
+
+// Reads the same format as '::cartographer::io::ProtoStreamReader' from a
+// memory-mapped file. The messages are indexed by skipping over their
+// compressed data, so any of them can be decompressed without decompressing
+// those before it. The index is only built up to the messages read so far.
+class MappedProtoStreamReader
+    : public ::cartographer::io::ProtoStreamReaderInterface {
+ public:
+  explicit MappedProtoStreamReader(const std::string& filename);
+  ~MappedProtoStreamReader() override;
+
+  MappedProtoStreamReader(const MappedProtoStreamReader&) = delete;
+  MappedProtoStreamReader& operator=(const MappedProtoStreamReader&) = delete;
+
+  // Indexes all messages of the file. Thread-safe.
+  int num_messages() const LOCKS_EXCLUDED(mutex_);
+
+  // Decompresses and parses the message at 'index', which has to exist.
+  // Thread-safe.
+  bool ReadProto(int index, google::protobuf::Message* proto) const
+      LOCKS_EXCLUDED(mutex_);
+
+  // Reads the messages in order, like '::cartographer::io::ProtoStreamReader'.
+  bool ReadProto(google::protobuf::Message* proto) override
+      LOCKS_EXCLUDED(mutex_);
+  bool eof() const override LOCKS_EXCLUDED(mutex_);
+
+ private:
+  struct Message {
+    const char* data;
+    size_t size;
+  };
+
+  // Indexes messages until the one at 'index' is found, which is returned in
+  // 'message' unless it is nullptr. Returns false if the file ends before it.
+  bool FindMessage(int index, Message* message) const LOCKS_EXCLUDED(mutex_);
+
+  const std::string filename_;
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  mutable absl::Mutex mutex_;
+  mutable std::vector<Message> messages_ GUARDED_BY(mutex_);
+  // Where the size of the next message not yet in 'messages_' is.
+  mutable size_t next_offset_ GUARDED_BY(mutex_);
+  int next_message_index_ = 0;
+};
+
+// Like '::cartographer::io::DeserializePoseGraphFromFile()', but only reads
+// the parts of the file holding the header and the pose graph.
+::cartographer::mapping::proto::PoseGraph ReadPoseGraphFromFile(
+    const std::string& filename);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_MAPPED_PROTO_STREAM_READER_H
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/mapped_proto_stream_reader.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cartographer/io/proto_stream.h"
+#include "cartographer/transform/proto/transform.pb.h"
+#include "cartographer_ros/temporary_file_test_helpers.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+constexpr int kNumProtos = 10;
+
+class MappedProtoStreamReaderTest : public TemporaryFileTest {
+ protected:
+  MappedProtoStreamReaderTest() : TemporaryFileTest("test.pbstream") {}
+
+  void SetUp() override {
+    TemporaryFileTest::SetUp();
+    ASSERT_FALSE(HasFatalFailure());
+    ::cartographer::io::ProtoStreamWriter writer(filename_);
+    for (int i = 0; i != kNumProtos; ++i) {
+      ::cartographer::transform::proto::Vector3d proto;
+      proto.set_x(i);
+      writer.WriteProto(proto);
+    }
+    ASSERT_TRUE(writer.Close());
+  }
+};
+
+TEST_F(MappedProtoStreamReaderTest, ReadsProtosInOrder) {
+  MappedProtoStreamReader reader(filename_);
+  EXPECT_EQ(kNumProtos, reader.num_messages());
+  for (int i = 0; i != kNumProtos; ++i) {
+    EXPECT_FALSE(reader.eof());
+    ::cartographer::transform::proto::Vector3d proto;
+    ASSERT_TRUE(reader.ReadProto(&proto));
+    EXPECT_EQ(i, proto.x());
+  }
+  EXPECT_TRUE(reader.eof());
+  ::cartographer::transform::proto::Vector3d proto;
+  EXPECT_FALSE(reader.ReadProto(&proto));
+}
+
+TEST_F(MappedProtoStreamReaderTest, ReadsProtosByIndex) {
+  const MappedProtoStreamReader reader(filename_);
+  for (int i = kNumProtos - 1; i >= 0; --i) {
+    ::cartographer::transform::proto::Vector3d proto;
+    ASSERT_TRUE(reader.ReadProto(i, &proto));
+    EXPECT_EQ(i, proto.x());
+  }
+}
+
+TEST_F(MappedProtoStreamReaderTest, ReadsProtosBeforeTruncation) {
+  struct stat file_stat;
+  ASSERT_EQ(stat(filename_.c_str(), &file_stat), 0);
+  ASSERT_EQ(truncate(filename_.c_str(), file_stat.st_size - 1), 0);
+  MappedProtoStreamReader reader(filename_);
+  ::cartographer::transform::proto::Vector3d proto;
+  ASSERT_TRUE(reader.ReadProto(&proto));
+  EXPECT_EQ(0, proto.x());
+  EXPECT_EQ(kNumProtos - 1, reader.num_messages());
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -23,6 +23,44 @@ namespace metrics {
 
 using BucketBoundaries = ::cartographer::metrics::Histogram::BucketBoundaries;
 
+namespace {
+
+bool HasSameValues(const ::cartographer_ros_msgs::Metric& lhs,
+                   const ::cartographer_ros_msgs::Metric& rhs) {
+  if (lhs.value != rhs.value ||
+      lhs.counts_by_bucket.size() != rhs.counts_by_bucket.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs.counts_by_bucket.size(); ++i) {
+    if (lhs.counts_by_bucket[i].count != rhs.counts_by_bucket[i].count) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Metrics are only ever added to a family, so they can be compared by index.
+bool HasSameValues(const ::cartographer_ros_msgs::MetricFamily& lhs,
+                   const ::cartographer_ros_msgs::MetricFamily& rhs) {
+  if (lhs.metrics.size() != rhs.metrics.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs.metrics.size(); ++i) {
+    if (!HasSameValues(lhs.metrics[i], rhs.metrics[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+FamilyFactory::~FamilyFactory() {
+  for (const auto& callback : destruction_callbacks_) {
+    callback();
+  }
+}
+
 ::cartographer::metrics::Family<::cartographer::metrics::Counter>*
 FamilyFactory::NewCounterFamily(const std::string& name,
                                 const std::string& description) {
@@ -54,14 +92,43 @@ FamilyFactory::NewHistogramFamily(const std::string& name,
 
 void FamilyFactory::ReadMetrics(
     ::cartographer_ros_msgs::ReadMetrics::Response* response) const {
+  ReadMetricFamilies(&response->metric_families);
+}
+
+void FamilyFactory::AddDestructionCallback(std::function<void()> callback) {
+  destruction_callbacks_.push_back(std::move(callback));
+}
+
+void FamilyFactory::ReadChangedMetrics(
+    const bool changed_only,
+    std::vector<::cartographer_ros_msgs::MetricFamily>* const
+        metric_families) {
+  std::vector<::cartographer_ros_msgs::MetricFamily> all_metric_families;
+  ReadMetricFamilies(&all_metric_families);
+  absl::MutexLock lock(&mutex_);
+  for (auto& metric_family : all_metric_families) {
+    auto& last_read_metric_family =
+        last_read_metric_families_[metric_family.name];
+    if (changed_only &&
+        HasSameValues(metric_family, last_read_metric_family)) {
+      continue;
+    }
+    last_read_metric_family = metric_family;
+    metric_families->push_back(std::move(metric_family));
+  }
+}
+
+void FamilyFactory::ReadMetricFamilies(
+    std::vector<::cartographer_ros_msgs::MetricFamily>* const metric_families)
+    const {
   for (const auto& counter_family : counter_families_) {
-    response->metric_families.push_back(counter_family->ToRosMessage());
+    metric_families->push_back(counter_family->ToRosMessage());
   }
   for (const auto& gauge_family : gauge_families_) {
-    response->metric_families.push_back(gauge_family->ToRosMessage());
+    metric_families->push_back(gauge_family->ToRosMessage());
   }
   for (const auto& histogram_family : histogram_families_) {
-    response->metric_families.push_back(histogram_family->ToRosMessage());
+    metric_families->push_back(histogram_family->ToRosMessage());
   }
 }
 
@@ -17,14 +17,19 @@
 #ifndef CARTOGRAPHER_ROS_METRICS_FAMILY_FACTORY_H
 #define CARTOGRAPHER_ROS_METRICS_FAMILY_FACTORY_H
 
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "absl/synchronization/mutex.h"
 #include "cartographer/metrics/family_factory.h"
 #include "cartographer_ros/metrics/internal/counter.h"
 #include "cartographer_ros/metrics/internal/family.h"
 #include "cartographer_ros/metrics/internal/gauge.h"
 #include "cartographer_ros/metrics/internal/histogram.h"
+#include "cartographer_ros_msgs/MetricFamily.h"
 #include "cartographer_ros_msgs/ReadMetrics.h"
 
 namespace cartographer_ros {
@@ -32,10 +37,18 @@ namespace metrics {
 
 // Realizes the factory / registry interface for the metrics in libcartographer
 // and provides a wrapper to collect ROS messages from the metrics it owns.
+// Families have to be created before metrics are read, reading is
+// thread-safe.
 class FamilyFactory : public ::cartographer::metrics::FamilyFactory {
  public:
-  ::cartographer::metrics::Family<::cartographer::metrics::Counter>*
+  FamilyFactory() = default;
+  // Runs the callbacks added with 'AddDestructionCallback()'.
+  ~FamilyFactory() override;
+
+  FamilyFactory(const FamilyFactory&) = delete;
+  FamilyFactory& operator=(const FamilyFactory&) = delete;
 
+  ::cartographer::metrics::Family<::cartographer::metrics::Counter>*
   NewCounterFamily(const std::string& name,
                    const std::string& description) override;
   ::cartographer::metrics::Family<::cartographer::metrics::Gauge>*
@@ -49,10 +62,32 @@ class FamilyFactory : public ::cartographer::metrics::FamilyFactory {
   void ReadMetrics(
       ::cartographer_ros_msgs::ReadMetrics::Response* response) const;
 
+  // Adds a 'callback' which is run when this factory is destroyed, so that
+  // pointers to its families kept elsewhere can be reset. Like families, has
+  // to be added before metrics are read.
+  void AddDestructionCallback(std::function<void()> callback);
+
+  // Appends the families to 'metric_families'. If 'changed_only', families
+  // which did not change since the previous call are skipped.
+  void ReadChangedMetrics(
+      bool changed_only,
+      std::vector<::cartographer_ros_msgs::MetricFamily>* metric_families)
+      LOCKS_EXCLUDED(mutex_);
+
  private:
+  void ReadMetricFamilies(
+      std::vector<::cartographer_ros_msgs::MetricFamily>* metric_families)
+      const;
+
   std::vector<std::unique_ptr<CounterFamily>> counter_families_;
   std::vector<std::unique_ptr<GaugeFamily>> gauge_families_;
   std::vector<std::unique_ptr<HistogramFamily>> histogram_families_;
+  std::vector<std::function<void()>> destruction_callbacks_;
+
+  absl::Mutex mutex_;
+  // Keyed with the family name.
+  std::map<std::string, ::cartographer_ros_msgs::MetricFamily>
+      last_read_metric_families_ GUARDED_BY(mutex_);
 };
 
 }  // namespace metrics
@@ -17,32 +17,45 @@
 #ifndef CARTOGRAPHER_ROS_METRICS_INTERNAL_COUNTER_H
 #define CARTOGRAPHER_ROS_METRICS_INTERNAL_COUNTER_H
 
+#include <map>
+#include <string>
+
 #include "cartographer/metrics/counter.h"
-#include "cartographer_ros/metrics/internal/gauge.h"
+#include "cartographer_ros/metrics/internal/sharded_sum.h"
 #include "cartographer_ros_msgs/Metric.h"
 
 namespace cartographer_ros {
 namespace metrics {
 
+// Lock-free and sharded, since counters are incremented from hot loops of
+// many threads.
 class Counter : public ::cartographer::metrics::Counter {
  public:
   explicit Counter(const std::map<std::string, std::string>& labels)
-      : gauge_(labels) {}
+      : labels_(labels) {}
 
-  void Increment(const double value) override { gauge_.Increment(value); }
+  void Increment(const double value) override { value_.Add(value); }
 
-  void Increment() override { gauge_.Increment(); }
+  void Increment() override { Increment(1.); }
 
-  double Value() { return gauge_.Value(); }
+  double Value() { return value_.Value(); }
 
   cartographer_ros_msgs::Metric ToRosMessage() {
-    cartographer_ros_msgs::Metric msg = gauge_.ToRosMessage();
+    cartographer_ros_msgs::Metric msg;
     msg.type = cartographer_ros_msgs::Metric::TYPE_COUNTER;
+    for (const auto& label : labels_) {
+      cartographer_ros_msgs::MetricLabel label_msg;
+      label_msg.key = label.first;
+      label_msg.value = label.second;
+      msg.labels.push_back(label_msg);
+    }
+    msg.value = Value();
     return msg;
   }
 
  private:
-  Gauge gauge_;
+  const std::map<std::string, std::string> labels_;
+  ShardedSum value_;
 };
 
 }  // namespace metrics
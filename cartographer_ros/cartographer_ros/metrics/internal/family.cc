@@ -29,6 +29,7 @@ using BucketBoundaries = ::cartographer::metrics::Histogram::BucketBoundaries;
 Counter* CounterFamily::Add(const std::map<std::string, std::string>& labels) {
   auto wrapper = absl::make_unique<Counter>(labels);
   auto* ptr = wrapper.get();
+  absl::MutexLock lock(&mutex_);
   wrappers_.emplace_back(std::move(wrapper));
   return ptr;
 }
@@ -37,6 +38,7 @@ cartographer_ros_msgs::MetricFamily CounterFamily::ToRosMessage() {
   cartographer_ros_msgs::MetricFamily family_msg;
   family_msg.name = name_;
   family_msg.description = description_;
+  absl::MutexLock lock(&mutex_);
   for (const auto& wrapper : wrappers_) {
     family_msg.metrics.push_back(wrapper->ToRosMessage());
   }
@@ -46,6 +48,7 @@ cartographer_ros_msgs::MetricFamily CounterFamily::ToRosMessage() {
 Gauge* GaugeFamily::Add(const std::map<std::string, std::string>& labels) {
   auto wrapper = absl::make_unique<Gauge>(labels);
   auto* ptr = wrapper.get();
+  absl::MutexLock lock(&mutex_);
   wrappers_.emplace_back(std::move(wrapper));
   return ptr;
 }
@@ -54,6 +57,7 @@ cartographer_ros_msgs::MetricFamily GaugeFamily::ToRosMessage() {
   cartographer_ros_msgs::MetricFamily family_msg;
   family_msg.name = name_;
   family_msg.description = description_;
+  absl::MutexLock lock(&mutex_);
   for (const auto& wrapper : wrappers_) {
     family_msg.metrics.push_back(wrapper->ToRosMessage());
   }
@@ -64,6 +68,7 @@ Histogram* HistogramFamily::Add(
     const std::map<std::string, std::string>& labels) {
   auto wrapper = absl::make_unique<Histogram>(labels, boundaries_);
   auto* ptr = wrapper.get();
+  absl::MutexLock lock(&mutex_);
   wrappers_.emplace_back(std::move(wrapper));
   return ptr;
 }
@@ -72,6 +77,7 @@ cartographer_ros_msgs::MetricFamily HistogramFamily::ToRosMessage() {
   cartographer_ros_msgs::MetricFamily family_msg;
   family_msg.name = name_;
   family_msg.description = description_;
+  absl::MutexLock lock(&mutex_);
   for (const auto& wrapper : wrappers_) {
     family_msg.metrics.push_back(wrapper->ToRosMessage());
   }
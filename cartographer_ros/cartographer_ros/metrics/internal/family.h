@@ -20,6 +20,7 @@
 #include <memory>
 #include <string>
 
+#include "absl/synchronization/mutex.h"
 #include "cartographer/metrics/family_factory.h"
 #include "cartographer_ros/metrics/internal/counter.h"
 #include "cartographer_ros/metrics/internal/gauge.h"
@@ -39,7 +40,9 @@ class CounterFamily
  private:
   std::string name_;
   std::string description_;
-  std::vector<std::unique_ptr<Counter>> wrappers_;
+  // Metrics may be added while the family is read.
+  absl::Mutex mutex_;
+  std::vector<std::unique_ptr<Counter>> wrappers_ GUARDED_BY(mutex_);
 };
 
 class GaugeFamily
@@ -54,7 +57,8 @@ class GaugeFamily
  private:
   std::string name_;
   std::string description_;
-  std::vector<std::unique_ptr<Gauge>> wrappers_;
+  absl::Mutex mutex_;
+  std::vector<std::unique_ptr<Gauge>> wrappers_ GUARDED_BY(mutex_);
 };
 
 class HistogramFamily : public ::cartographer::metrics::Family<
@@ -71,7 +75,8 @@ class HistogramFamily : public ::cartographer::metrics::Family<
  private:
   std::string name_;
   std::string description_;
-  std::vector<std::unique_ptr<Histogram>> wrappers_;
+  absl::Mutex mutex_;
+  std::vector<std::unique_ptr<Histogram>> wrappers_ GUARDED_BY(mutex_);
   const BucketBoundaries boundaries_;
 };
 
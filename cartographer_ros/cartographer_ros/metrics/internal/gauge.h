@@ -17,16 +17,19 @@
 #ifndef CARTOGRAPHER_ROS_METRICS_INTERNAL_GAUGE_H
 #define CARTOGRAPHER_ROS_METRICS_INTERNAL_GAUGE_H
 
+#include <atomic>
 #include <map>
 #include <string>
 
-#include "absl/synchronization/mutex.h"
 #include "cartographer/metrics/gauge.h"
+#include "cartographer_ros/metrics/internal/sharded_sum.h"
 #include "cartographer_ros_msgs/Metric.h"
 
 namespace cartographer_ros {
 namespace metrics {
 
+// Lock-free. Unlike counters, gauges are not sharded, since 'Set()' has to
+// replace the value for all threads.
 class Gauge : public ::cartographer::metrics::Gauge {
  public:
   explicit Gauge(const std::map<std::string, std::string>& labels)
@@ -41,14 +44,10 @@ class Gauge : public ::cartographer::metrics::Gauge {
   void Increment() override { Increment(1.); }
 
   void Set(double value) override {
-    absl::MutexLock lock(&mutex_);
-    value_ = value;
+    value_.store(value, std::memory_order_relaxed);
   }
 
-  double Value() {
-    absl::MutexLock lock(&mutex_);
-    return value_;
-  }
+  double Value() { return value_.load(std::memory_order_relaxed); }
 
   cartographer_ros_msgs::Metric ToRosMessage() {
     cartographer_ros_msgs::Metric msg;
@@ -64,14 +63,10 @@ class Gauge : public ::cartographer::metrics::Gauge {
   }
 
  private:
-  void Add(const double value) {
-    absl::MutexLock lock(&mutex_);
-    value_ += value;
-  }
+  void Add(const double value) { AtomicAdd(value, &value_); }
 
-  absl::Mutex mutex_;
   const std::map<std::string, std::string> labels_;
-  double value_ GUARDED_BY(mutex_);
+  std::atomic<double> value_;
 };
 
 }  // namespace metrics
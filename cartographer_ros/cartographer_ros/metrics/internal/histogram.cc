@@ -17,7 +17,6 @@
 #include "cartographer_ros/metrics/internal/histogram.h"
 
 #include <algorithm>
-#include <numeric>
 
 #include "glog/logging.h"
 
@@ -30,10 +29,13 @@ Histogram::Histogram(const std::map<std::string, std::string>& labels,
                      const BucketBoundaries& bucket_boundaries)
     : labels_(labels),
       bucket_boundaries_(bucket_boundaries),
-      bucket_counts_(bucket_boundaries.size() + 1) {
-  absl::MutexLock lock(&mutex_);
+      bucket_counts_(
+          new std::atomic<uint64_t>[bucket_boundaries.size() + 1]) {
   CHECK(std::is_sorted(std::begin(bucket_boundaries_),
                        std::end(bucket_boundaries_)));
+  for (size_t i = 0; i <= bucket_boundaries_.size(); ++i) {
+    bucket_counts_[i].store(0, std::memory_order_relaxed);
+  }
 }
 
 void Histogram::Observe(double value) {
@@ -41,36 +43,37 @@ void Histogram::Observe(double value) {
       std::distance(bucket_boundaries_.begin(),
                     std::upper_bound(bucket_boundaries_.begin(),
                                      bucket_boundaries_.end(), value));
-  absl::MutexLock lock(&mutex_);
-  sum_ += value;
-  bucket_counts_[bucket_index] += 1;
+  sum_.Add(value);
+  bucket_counts_[bucket_index].fetch_add(1, std::memory_order_relaxed);
 }
 
 std::map<double, double> Histogram::CountsByBucket() {
-  absl::MutexLock lock(&mutex_);
   std::map<double, double> counts_by_bucket;
   // Add the finite buckets.
   for (size_t i = 0; i < bucket_boundaries_.size(); ++i) {
-    counts_by_bucket[bucket_boundaries_.at(i)] = bucket_counts_.at(i);
+    counts_by_bucket[bucket_boundaries_.at(i)] =
+        bucket_counts_[i].load(std::memory_order_relaxed);
   }
   // Add the "infinite" bucket.
-  counts_by_bucket[kInfiniteBoundary] = bucket_counts_.back();
+  counts_by_bucket[kInfiniteBoundary] =
+      bucket_counts_[bucket_boundaries_.size()].load(std::memory_order_relaxed);
   return counts_by_bucket;
 }
 
-double Histogram::Sum() {
-  absl::MutexLock lock(&mutex_);
-  return sum_;
-}
+double Histogram::Sum() { return sum_.Value(); }
 
 double Histogram::CumulativeCount() {
-  absl::MutexLock lock(&mutex_);
-  return std::accumulate(bucket_counts_.begin(), bucket_counts_.end(), 0.);
+  double count = 0.;
+  for (size_t i = 0; i <= bucket_boundaries_.size(); ++i) {
+    count += bucket_counts_[i].load(std::memory_order_relaxed);
+  }
+  return count;
 }
 
 cartographer_ros_msgs::Metric Histogram::ToRosMessage() {
   cartographer_ros_msgs::Metric msg;
   msg.type = cartographer_ros_msgs::Metric::TYPE_HISTOGRAM;
+  msg.value = Sum();
   for (const auto& label : labels_) {
     cartographer_ros_msgs::MetricLabel label_msg;
     label_msg.key = label.first;
@@ -17,11 +17,13 @@
 #ifndef CARTOGRAPHER_ROS_METRICS_INTERNAL_HISTOGRAM_H
 #define CARTOGRAPHER_ROS_METRICS_INTERNAL_HISTOGRAM_H
 
+#include <atomic>
+#include <cstdint>
 #include <map>
-#include <vector>
+#include <memory>
 
-#include "absl/synchronization/mutex.h"
 #include "cartographer/metrics/histogram.h"
+#include "cartographer_ros/metrics/internal/sharded_sum.h"
 #include "cartographer_ros_msgs/Metric.h"
 
 namespace cartographer_ros {
@@ -31,6 +33,8 @@ constexpr double kInfiniteBoundary = std::numeric_limits<double>::infinity();
 
 using BucketBoundaries = ::cartographer::metrics::Histogram::BucketBoundaries;
 
+// Lock-free. Observations only increment an atomic bucket count and add to a
+// sharded sum, the buckets are aggregated when the histogram is read.
 class Histogram : public ::cartographer::metrics::Histogram {
  public:
   explicit Histogram(const std::map<std::string, std::string>& labels,
@@ -47,11 +51,11 @@ class Histogram : public ::cartographer::metrics::Histogram {
   cartographer_ros_msgs::Metric ToRosMessage();
 
  private:
-  absl::Mutex mutex_;
   const std::map<std::string, std::string> labels_;
   const BucketBoundaries bucket_boundaries_;
-  std::vector<double> bucket_counts_ GUARDED_BY(mutex_);
-  double sum_ GUARDED_BY(mutex_);
+  // Has one more entry than 'bucket_boundaries_' for the "infinite" bucket.
+  const std::unique_ptr<std::atomic<uint64_t>[]> bucket_counts_;
+  ShardedSum sum_;
 };
 
 }  // namespace metrics
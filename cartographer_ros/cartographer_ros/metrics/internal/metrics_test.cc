@@ -17,11 +17,17 @@
 #include <algorithm>
 #include <array>
 #include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "cartographer/metrics/histogram.h"
+#include "cartographer_ros/metrics/family_factory.h"
 #include "cartographer_ros/metrics/internal/counter.h"
 #include "cartographer_ros/metrics/internal/gauge.h"
 #include "cartographer_ros/metrics/internal/histogram.h"
+#include "cartographer_ros/metrics/latency.h"
+#include "cartographer_ros/metrics/trajectory_accounting.h"
 #include "gtest/gtest.h"
 
 namespace cartographer_ros {
@@ -51,6 +57,32 @@ TEST(Metrics, CounterTest) {
   EXPECT_EQ(counter.Value(), 3.);
 }
 
+TEST(Metrics, ConcurrentIncrementTest) {
+  constexpr int kNumThreads = 8;
+  constexpr int kNumIncrements = 10000;
+  Counter counter({});
+  Gauge gauge({});
+  Histogram histogram({},
+                      ::cartographer::metrics::Histogram::FixedWidth(1, 3));
+  std::vector<std::thread> threads;
+  for (int i = 0; i != kNumThreads; ++i) {
+    threads.emplace_back([&counter, &gauge, &histogram]() {
+      for (int j = 0; j != kNumIncrements; ++j) {
+        counter.Increment();
+        gauge.Increment(2.);
+        histogram.Observe(1.5);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(counter.Value(), kNumThreads * kNumIncrements);
+  EXPECT_EQ(gauge.Value(), 2. * kNumThreads * kNumIncrements);
+  EXPECT_EQ(histogram.CountsByBucket()[2], kNumThreads * kNumIncrements);
+  EXPECT_EQ(histogram.Sum(), 1.5 * kNumThreads * kNumIncrements);
+}
+
 TEST(Metrics, HistogramFixedWidthTest) {
   auto boundaries = ::cartographer::metrics::Histogram::FixedWidth(1, 3);
   Histogram histogram({}, boundaries);
@@ -100,5 +132,160 @@ TEST(Metrics, HistogramScaledPowersOfTest) {
   EXPECT_EQ(histogram.CountsByBucket()[kInfiniteBoundary], 1);
 }
 
+TEST(Metrics, ReadChangedMetricsTest) {
+  FamilyFactory family_factory;
+  auto* const counter_family =
+      family_factory.NewCounterFamily("counter", "description");
+  auto* const counter = counter_family->Add({{"key", "value"}});
+  auto* const gauge_family =
+      family_factory.NewGaugeFamily("gauge", "description");
+  auto* const gauge = gauge_family->Add({});
+  const auto read_names = [&family_factory](const bool changed_only) {
+    std::vector<::cartographer_ros_msgs::MetricFamily> metric_families;
+    family_factory.ReadChangedMetrics(changed_only, &metric_families);
+    std::vector<std::string> names;
+    for (const auto& metric_family : metric_families) {
+      names.push_back(metric_family.name);
+    }
+    return names;
+  };
+
+  // Families which were never read count as changed.
+  EXPECT_EQ(read_names(true), (std::vector<std::string>{"counter", "gauge"}));
+  EXPECT_TRUE(read_names(true).empty());
+  counter->Increment();
+  EXPECT_EQ(read_names(true), std::vector<std::string>{"counter"});
+  // Setting the same value is no change, adding a metric is.
+  gauge->Set(0.);
+  EXPECT_TRUE(read_names(true).empty());
+  gauge_family->Add({{"key", "value"}});
+  EXPECT_EQ(read_names(true), std::vector<std::string>{"gauge"});
+  gauge->Set(2.);
+  EXPECT_EQ(read_names(false), (std::vector<std::string>{"counter", "gauge"}));
+  // Reading all families also counts as reading the changes.
+  EXPECT_TRUE(read_names(true).empty());
+}
+
+TEST(Metrics, LatencyTest) {
+  FamilyFactory family_factory;
+  RegisterLatencyMetrics(&family_factory);
+  ObserveLatency(LatencyStage::kTfLookup, "laser", 1e-3);
+  ObserveLatency(LatencyStage::kTfLookup, "laser", 2e-3);
+  ObserveLatency(LatencyStage::kTfLookup, "imu", 1e-3);
+
+  ::cartographer_ros_msgs::ReadMetrics::Response response;
+  family_factory.ReadMetrics(&response);
+  const auto family = std::find_if(
+      response.metric_families.begin(), response.metric_families.end(),
+      [](const ::cartographer_ros_msgs::MetricFamily& family) {
+        return family.name == "cartographer_ros_tf_lookup_latency";
+      });
+  ASSERT_NE(family, response.metric_families.end());
+  // Each label has its own histogram.
+  ASSERT_EQ(family->metrics.size(), 2u);
+  ASSERT_EQ(family->metrics[0].labels.size(), 1u);
+  EXPECT_EQ(family->metrics[0].labels[0].key, "frame_id");
+  EXPECT_EQ(family->metrics[0].labels[0].value, "laser");
+  double count = 0.;
+  for (const auto& bucket : family->metrics[0].counts_by_bucket) {
+    count += bucket.count;
+  }
+  EXPECT_EQ(count, 2.);
+
+  // Labels taking turns on a thread are sampled alike.
+  std::array<int, 2> num_sampled = {};
+  for (int i = 0; i != 1000; ++i) {
+    if (SampleLatency(LatencyStage::kConversion, i % 2 == 0 ? "a" : "b")) {
+      ++num_sampled[i % 2];
+    }
+  }
+  for (const int label_num_sampled : num_sampled) {
+    EXPECT_GT(label_num_sampled, 0);
+    EXPECT_LT(label_num_sampled, 500);
+  }
+}
+
+TEST(Metrics, LatencyAfterFactoryDestructionTest) {
+  {
+    FamilyFactory family_factory;
+    RegisterLatencyMetrics(&family_factory);
+    ObserveLatency(LatencyStage::kTfLookup, "laser", 1e-3);
+  }
+  // Latencies are dropped instead of being recorded into destroyed families.
+  ObserveLatency(LatencyStage::kTfLookup, "laser", 1e-3);
+
+  FamilyFactory family_factory;
+  RegisterLatencyMetrics(&family_factory);
+  ObserveLatency(LatencyStage::kTfLookup, "imu", 1e-3);
+  ::cartographer_ros_msgs::ReadMetrics::Response response;
+  family_factory.ReadMetrics(&response);
+  const auto family = std::find_if(
+      response.metric_families.begin(), response.metric_families.end(),
+      [](const ::cartographer_ros_msgs::MetricFamily& family) {
+        return family.name == "cartographer_ros_tf_lookup_latency";
+      });
+  ASSERT_NE(family, response.metric_families.end());
+  ASSERT_EQ(family->metrics.size(), 1u);
+  EXPECT_EQ(family->metrics[0].labels[0].value, "imu");
+}
+
+TEST(Metrics, TrajectoryAccountingTest) {
+  FamilyFactory family_factory;
+  RegisterTrajectoryAccountingMetrics(&family_factory);
+  const TrajectoryAccounting accounting = GetTrajectoryAccounting(3);
+  // The gauges are created once per trajectory.
+  EXPECT_EQ(GetTrajectoryAccounting(3).local_slam_data_bytes,
+            accounting.local_slam_data_bytes);
+  accounting.local_slam_data_bytes->Set(1024.);
+  {
+    ThreadCpuTimer cpu_timer(accounting.tf_lookup_cpu_seconds);
+    volatile double sum = 0.;
+    for (int i = 0; i != 100000; ++i) {
+      sum = sum + i;
+    }
+  }
+
+  ::cartographer_ros_msgs::ReadMetrics::Response response;
+  family_factory.ReadMetrics(&response);
+  const auto find_family = [&response](const std::string& name) {
+    return std::find_if(
+        response.metric_families.begin(), response.metric_families.end(),
+        [&name](const ::cartographer_ros_msgs::MetricFamily& family) {
+          return family.name == name;
+        });
+  };
+  const auto bytes_family =
+      find_family("cartographer_ros_trajectory_local_slam_data_bytes");
+  ASSERT_NE(bytes_family, response.metric_families.end());
+  ASSERT_EQ(bytes_family->metrics.size(), 1u);
+  ASSERT_EQ(bytes_family->metrics[0].labels.size(), 1u);
+  EXPECT_EQ(bytes_family->metrics[0].labels[0].key, "trajectory_id");
+  EXPECT_EQ(bytes_family->metrics[0].labels[0].value, "3");
+  EXPECT_EQ(bytes_family->metrics[0].value, 1024.);
+  const auto cpu_family =
+      find_family("cartographer_ros_trajectory_cpu_seconds");
+  ASSERT_NE(cpu_family, response.metric_families.end());
+  // One gauge per stage.
+  ASSERT_EQ(cpu_family->metrics.size(), 2u);
+  double cpu_seconds = 0.;
+  for (const auto& metric : cpu_family->metrics) {
+    cpu_seconds += metric.value;
+  }
+  EXPECT_GT(cpu_seconds, 0.);
+}
+
+TEST(Metrics, TrajectoryAccountingAfterFactoryDestructionTest) {
+  {
+    FamilyFactory family_factory;
+    RegisterTrajectoryAccountingMetrics(&family_factory);
+    EXPECT_NE(GetTrajectoryAccounting(0).conversion_cpu_seconds, nullptr);
+  }
+  // Null gauges are handed out instead of gauges of the destroyed factory.
+  const TrajectoryAccounting accounting = GetTrajectoryAccounting(0);
+  EXPECT_EQ(accounting.conversion_cpu_seconds, nullptr);
+  EXPECT_EQ(accounting.local_slam_data_bytes,
+            ::cartographer::metrics::Gauge::Null());
+}
+
 }  // namespace metrics
 }  // namespace cartographer_ros
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/metrics/internal/sharded_sum.h"
+
+namespace cartographer_ros {
+namespace metrics {
+
+namespace {
+
+// Returns the shard of the calling thread. Threads are assigned to the shards
+// round-robin when they first add to any sum.
+int GetShardIndex(const int num_shards) {
+  static std::atomic<int> next_thread_index(0);
+  thread_local const int thread_index =
+      next_thread_index.fetch_add(1, std::memory_order_relaxed);
+  return thread_index % num_shards;
+}
+
+}  // namespace
+
+constexpr int ShardedSum::kNumShards;
+
+ShardedSum::ShardedSum() {
+  for (Shard& shard : shards_) {
+    shard.value.store(0., std::memory_order_relaxed);
+  }
+}
+
+void ShardedSum::Add(const double value) {
+  AtomicAdd(value, &shards_[GetShardIndex(kNumShards)].value);
+}
+
+double ShardedSum::Value() const {
+  double sum = 0.;
+  for (const Shard& shard : shards_) {
+    sum += shard.value.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+}  // namespace metrics
+}  // namespace cartographer_ros
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_METRICS_INTERNAL_SHARDED_SUM_H
+#define CARTOGRAPHER_ROS_METRICS_INTERNAL_SHARDED_SUM_H
+
+#include <array>
+#include <atomic>
+
+namespace cartographer_ros {
+namespace metrics {
+
+// Adds 'value' to 'target' without locking.
+inline void AtomicAdd(const double value, std::atomic<double>* const target) {
+  double expected = target->load(std::memory_order_relaxed);
+  while (!target->compare_exchange_weak(expected, expected + value,
+                                        std::memory_order_relaxed)) {
+  }
+}
+
+// A sum that many threads can add to without contention. Each thread adds to
+// one of several shards, which are only summed up when the value is read.
+class ShardedSum {
+ public:
+  ShardedSum();
+
+  ShardedSum(const ShardedSum&) = delete;
+  ShardedSum& operator=(const ShardedSum&) = delete;
+
+  void Add(double value);
+  double Value() const;
+
+ private:
+  static constexpr int kNumShards = 16;
+  static constexpr int kCacheLineSize = 64;
+
+  // Aligned, which also pads it, so that threads adding to different shards
+  // do not write to the same cache line.
+  struct alignas(kCacheLineSize) Shard {
+    std::atomic<double> value;
+  };
+  static_assert(sizeof(Shard) == kCacheLineSize,
+                "Shards must not share cache lines.");
+
+  std::array<Shard, kNumShards> shards_;
+};
+
+}  // namespace metrics
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_METRICS_INTERNAL_SHARDED_SUM_H
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/metrics/latency.h"
+
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#include "absl/synchronization/mutex.h"
+#include "cartographer/metrics/histogram.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+namespace metrics {
+
+namespace carto = ::cartographer;
+
+namespace {
+
+// One in this many calls to 'SampleLatency()' on a thread returns true.
+constexpr int kLatencySamplingPeriod = 16;
+
+constexpr int kNumStages = static_cast<int>(LatencyStage::kNumStages);
+
+struct LatencyRegistry {
+  absl::Mutex mutex;
+  // The factory owning the families, they are reset when it is destroyed.
+  const FamilyFactory* factory GUARDED_BY(mutex) = nullptr;
+  carto::metrics::Family<carto::metrics::Histogram>* families[kNumStages]
+      GUARDED_BY(mutex) = {};
+  std::map<std::pair<int, std::string>, carto::metrics::Histogram*>
+      histograms GUARDED_BY(mutex);
+};
+
+LatencyRegistry* GetLatencyRegistry() {
+  static LatencyRegistry* const registry = new LatencyRegistry;
+  return registry;
+}
+
+const char* GetLabelKey(const LatencyStage stage) {
+  switch (stage) {
+    case LatencyStage::kConversion:
+    case LatencyStage::kMutexWait:
+      return "sensor_id";
+    case LatencyStage::kTfLookup:
+      return "frame_id";
+    case LatencyStage::kLocalSlamResult:
+      return "trajectory_id";
+    case LatencyStage::kNumStages:
+      break;
+  }
+  LOG(FATAL) << "Unknown latency stage " << static_cast<int>(stage);
+  return "";
+}
+
+}  // namespace
+
+const char* GetLatencyMetricName(const LatencyStage stage) {
+  switch (stage) {
+    case LatencyStage::kConversion:
+      return "cartographer_ros_sensor_conversion_latency";
+    case LatencyStage::kTfLookup:
+      return "cartographer_ros_tf_lookup_latency";
+    case LatencyStage::kMutexWait:
+      return "cartographer_ros_sensor_mutex_wait_latency";
+    case LatencyStage::kLocalSlamResult:
+      return "cartographer_ros_local_slam_result_latency";
+    case LatencyStage::kNumStages:
+      break;
+  }
+  LOG(FATAL) << "Unknown latency stage " << static_cast<int>(stage);
+  return "";
+}
+
+void RegisterLatencyMetrics(FamilyFactory* const factory) {
+  // From 10 us to about 10 s.
+  const auto boundaries =
+      carto::metrics::Histogram::ScaledPowersOf(2, 1e-5, 10.);
+  LatencyRegistry* const registry = GetLatencyRegistry();
+  absl::MutexLock lock(&registry->mutex);
+  registry->histograms.clear();
+  registry->factory = factory;
+  factory->AddDestructionCallback([registry, factory]() {
+    absl::MutexLock lock(&registry->mutex);
+    if (registry->factory != factory) {
+      return;
+    }
+    registry->factory = nullptr;
+    for (auto& family : registry->families) {
+      family = nullptr;
+    }
+    registry->histograms.clear();
+  });
+  registry->families[static_cast<int>(LatencyStage::kConversion)] =
+      factory->NewHistogramFamily(
+          GetLatencyMetricName(LatencyStage::kConversion),
+          "Time in seconds to convert a ROS message into sensor data",
+          boundaries);
+  registry->families[static_cast<int>(LatencyStage::kTfLookup)] =
+      factory->NewHistogramFamily(
+          GetLatencyMetricName(LatencyStage::kTfLookup),
+          "Time in seconds to look up a transform to the tracking frame",
+          boundaries);
+  registry->families[static_cast<int>(LatencyStage::kMutexWait)] =
+      factory->NewHistogramFamily(
+          GetLatencyMetricName(LatencyStage::kMutexWait),
+          "Time in seconds a sensor message waited for locks in the node",
+          boundaries);
+  registry->families[static_cast<int>(LatencyStage::kLocalSlamResult)] =
+      factory->NewHistogramFamily(
+          GetLatencyMetricName(LatencyStage::kLocalSlamResult),
+          "Time in seconds from the sensor data stamp to its local SLAM result",
+          boundaries);
+}
+
+void ObserveLatency(const LatencyStage stage, const std::string& label,
+                    const double seconds) {
+  const int stage_index = static_cast<int>(stage);
+  CHECK_LT(stage_index, kNumStages);
+  LatencyRegistry* const registry = GetLatencyRegistry();
+  absl::MutexLock lock(&registry->mutex);
+  if (registry->families[stage_index] == nullptr) {
+    return;
+  }
+  auto& histogram = registry->histograms[std::make_pair(stage_index, label)];
+  if (histogram == nullptr) {
+    histogram =
+        registry->families[stage_index]->Add({{GetLabelKey(stage), label}});
+  }
+  histogram->Observe(seconds);
+}
+
+bool SampleLatency(const LatencyStage stage, const std::string& label) {
+  // Counted by label, so that labels which take turns on a thread, e.g. the
+  // sensors of a trajectory, are all sampled.
+  thread_local std::unordered_map<std::string, int> num_calls[kNumStages];
+  int& label_num_calls = num_calls[static_cast<int>(stage)][label];
+  if (++label_num_calls < kLatencySamplingPeriod) {
+    return false;
+  }
+  label_num_calls = 0;
+  return true;
+}
+
+LatencyTimer::LatencyTimer(const LatencyStage stage, const std::string& label)
+    : stage_(stage), sampled_(SampleLatency(stage, label)) {
+  if (sampled_) {
+    label_ = label;
+    Start();
+  }
+}
+
+LatencyTimer::~LatencyTimer() {
+  if (!sampled_) {
+    return;
+  }
+  Stop();
+  ObserveLatency(stage_, label_,
+                 std::chrono::duration<double>(elapsed_).count());
+}
+
+void LatencyTimer::Start() {
+  if (sampled_ && !running_) {
+    running_ = true;
+    start_time_ = std::chrono::steady_clock::now();
+  }
+}
+
+void LatencyTimer::Stop() {
+  if (running_) {
+    running_ = false;
+    elapsed_ += std::chrono::steady_clock::now() - start_time_;
+  }
+}
+
+}  // namespace metrics
+}  // namespace cartographer_ros
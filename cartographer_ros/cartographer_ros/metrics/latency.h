@@ -0,0 +1,87 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_METRICS_LATENCY_H
+#define CARTOGRAPHER_ROS_METRICS_LATENCY_H
+
+#include <chrono>
+#include <string>
+
+#include "cartographer_ros/metrics/family_factory.h"
+
+namespace cartographer_ros {
+namespace metrics {
+
+// Stages of the way of sensor data from a ROS message to its local SLAM
+// result. Each has a histogram family labeled with the key given below.
+enum class LatencyStage {
+  // Converting a message into sensor data, by "sensor_id".
+  kConversion,
+  // Looking up a transform to the tracking frame, by "frame_id".
+  kTfLookup,
+  // Waiting for the locks in the node before handling a message, by
+  // "sensor_id".
+  kMutexWait,
+  // From the header stamp to the local SLAM result, by "trajectory_id".
+  kLocalSlamResult,
+  kNumStages
+};
+
+// Returns the name of the histogram family of 'stage'.
+const char* GetLatencyMetricName(LatencyStage stage);
+
+// Registers the latency histograms. Until this is called, and after 'factory'
+// is destroyed, latencies are not recorded.
+void RegisterLatencyMetrics(FamilyFactory* factory);
+
+// Records 'seconds' for 'label' of 'stage'. Thread-safe, but takes a lock, so
+// it should only be called for sampled measurements, see 'SampleLatency()'.
+void ObserveLatency(LatencyStage stage, const std::string& label,
+                    double seconds);
+
+// Returns true for one in a fixed number of calls for 'label' of 'stage' on the
+// calling thread, so that latencies can be measured cheaply enough to always be
+// enabled.
+bool SampleLatency(LatencyStage stage, const std::string& label);
+
+// Measures the time spent between 'Start()' and 'Stop()' calls for a sampled
+// subset of instances and records their sum on destruction. Runs from
+// construction on.
+class LatencyTimer {
+ public:
+  LatencyTimer(LatencyStage stage, const std::string& label);
+  ~LatencyTimer();
+
+  LatencyTimer(const LatencyTimer&) = delete;
+  LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+  void Start();
+  void Stop();
+
+ private:
+  const LatencyStage stage_;
+  const bool sampled_;
+  // Only set if 'sampled_'.
+  std::string label_;
+  bool running_ = false;
+  std::chrono::steady_clock::time_point start_time_;
+  std::chrono::steady_clock::duration elapsed_{0};
+};
+
+}  // namespace metrics
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_METRICS_LATENCY_H
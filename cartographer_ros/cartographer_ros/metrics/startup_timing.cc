@@ -0,0 +1,107 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/metrics/startup_timing.h"
+
+#include <map>
+#include <sstream>
+
+#include "absl/synchronization/mutex.h"
+#include "cartographer/metrics/gauge.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+namespace metrics {
+
+namespace carto = ::cartographer;
+
+namespace {
+
+struct StartupRegistry {
+  absl::Mutex mutex;
+  // The factory owning the family, it is reset when the factory is destroyed.
+  const FamilyFactory* factory GUARDED_BY(mutex) = nullptr;
+  carto::metrics::Family<carto::metrics::Gauge>* family GUARDED_BY(mutex) =
+      nullptr;
+  // Families create a new gauge for each call of 'Add()'.
+  std::map<std::string, carto::metrics::Gauge*> gauges GUARDED_BY(mutex);
+};
+
+StartupRegistry* GetStartupRegistry() {
+  static StartupRegistry* const registry = new StartupRegistry;
+  return registry;
+}
+
+}  // namespace
+
+void RegisterStartupTimingMetrics(FamilyFactory* const factory) {
+  StartupRegistry* const registry = GetStartupRegistry();
+  absl::MutexLock lock(&registry->mutex);
+  registry->gauges.clear();
+  registry->factory = factory;
+  factory->AddDestructionCallback([registry, factory]() {
+    absl::MutexLock lock(&registry->mutex);
+    if (registry->factory != factory) {
+      return;
+    }
+    registry->factory = nullptr;
+    registry->family = nullptr;
+    registry->gauges.clear();
+  });
+  registry->family = factory->NewGaugeFamily(
+      "cartographer_ros_startup_seconds",
+      "Time in seconds spent in each phase of starting the node");
+}
+
+void RecordStartupPhase(const std::string& phase, const double seconds) {
+  StartupRegistry* const registry = GetStartupRegistry();
+  absl::MutexLock lock(&registry->mutex);
+  if (registry->family == nullptr) {
+    return;
+  }
+  auto& gauge = registry->gauges[phase];
+  if (gauge == nullptr) {
+    gauge = registry->family->Add({{"phase", phase}});
+  }
+  gauge->Set(seconds);
+}
+
+StartupTiming::StartupTiming()
+    : start_time_(std::chrono::steady_clock::now()),
+      phase_start_time_(start_time_) {}
+
+void StartupTiming::EndPhase(const std::string& phase) {
+  const auto now = std::chrono::steady_clock::now();
+  phase_seconds_.emplace_back(
+      phase, std::chrono::duration<double>(now - phase_start_time_).count());
+  phase_start_time_ = now;
+}
+
+void StartupTiming::Report() const {
+  std::ostringstream breakdown;
+  for (const auto& entry : phase_seconds_) {
+    breakdown << (breakdown.tellp() > 0 ? ", " : "") << entry.first << " "
+              << entry.second << " s";
+    RecordStartupPhase(entry.first, entry.second);
+  }
+  LOG(INFO) << "Started in "
+            << std::chrono::duration<double>(phase_start_time_ - start_time_)
+                   .count()
+            << " s: " << breakdown.str();
+}
+
+}  // namespace metrics
+}  // namespace cartographer_ros
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_METRICS_STARTUP_TIMING_H
+#define CARTOGRAPHER_ROS_METRICS_STARTUP_TIMING_H
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cartographer_ros/metrics/family_factory.h"
+
+namespace cartographer_ros {
+namespace metrics {
+
+// Registers the gauges of the startup phases. Phases recorded before, or after
+// 'factory' is destroyed, are not reported as metrics.
+void RegisterStartupTimingMetrics(FamilyFactory* factory);
+
+// Sets the gauge of 'phase' to 'seconds'. Thread-safe.
+void RecordStartupPhase(const std::string& phase, double seconds);
+
+// Measures the phases of starting a node one after another, each running from
+// the end of the previous one and the first from construction on.
+class StartupTiming {
+ public:
+  StartupTiming();
+
+  StartupTiming(const StartupTiming&) = delete;
+  StartupTiming& operator=(const StartupTiming&) = delete;
+
+  // Ends the running phase, which is named 'phase'.
+  void EndPhase(const std::string& phase);
+
+  // Logs the time of each phase so far and records them as metrics.
+  void Report() const;
+
+  std::chrono::steady_clock::time_point start_time() const {
+    return start_time_;
+  }
+
+ private:
+  const std::chrono::steady_clock::time_point start_time_;
+  std::chrono::steady_clock::time_point phase_start_time_;
+  std::vector<std::pair<std::string, double>> phase_seconds_;
+};
+
+}  // namespace metrics
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_METRICS_STARTUP_TIMING_H
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/metrics/trajectory_accounting.h"
+
+#include <time.h>
+
+#include <map>
+#include <string>
+
+#include "absl/synchronization/mutex.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+namespace metrics {
+
+namespace carto = ::cartographer;
+
+namespace {
+
+struct AccountingRegistry {
+  absl::Mutex mutex;
+  // The factory owning the families, they are reset when it is destroyed.
+  const FamilyFactory* factory GUARDED_BY(mutex) = nullptr;
+  carto::metrics::Family<carto::metrics::Gauge>* local_slam_data_bytes
+      GUARDED_BY(mutex) = nullptr;
+  carto::metrics::Family<carto::metrics::Gauge>* num_pending_range_data
+      GUARDED_BY(mutex) = nullptr;
+  carto::metrics::Family<carto::metrics::Gauge>* submap_texture_bytes
+      GUARDED_BY(mutex) = nullptr;
+  carto::metrics::Family<carto::metrics::Gauge>* cpu_seconds
+      GUARDED_BY(mutex) = nullptr;
+  // Families create a new gauge for each call of 'Add()'.
+  std::map<int, TrajectoryAccounting> trajectories GUARDED_BY(mutex);
+};
+
+AccountingRegistry* GetAccountingRegistry() {
+  static AccountingRegistry* const registry = new AccountingRegistry;
+  return registry;
+}
+
+}  // namespace
+
+void RegisterTrajectoryAccountingMetrics(FamilyFactory* const factory) {
+  AccountingRegistry* const registry = GetAccountingRegistry();
+  absl::MutexLock lock(&registry->mutex);
+  registry->trajectories.clear();
+  registry->factory = factory;
+  factory->AddDestructionCallback([registry, factory]() {
+    absl::MutexLock lock(&registry->mutex);
+    if (registry->factory != factory) {
+      return;
+    }
+    registry->factory = nullptr;
+    registry->local_slam_data_bytes = nullptr;
+    registry->num_pending_range_data = nullptr;
+    registry->submap_texture_bytes = nullptr;
+    registry->cpu_seconds = nullptr;
+    registry->trajectories.clear();
+  });
+  registry->local_slam_data_bytes = factory->NewGaugeFamily(
+      "cartographer_ros_trajectory_local_slam_data_bytes",
+      "Bytes of the latest local SLAM result of a trajectory kept for "
+      "publishing");
+  registry->num_pending_range_data = factory->NewGaugeFamily(
+      "cartographer_ros_trajectory_pending_range_data",
+      "Range data of a trajectory handed to the map builder but not yet "
+      "optimized");
+  registry->submap_texture_bytes = factory->NewGaugeFamily(
+      "cartographer_ros_trajectory_submap_texture_bytes",
+      "Bytes of the cached submap textures of a trajectory");
+  registry->cpu_seconds = factory->NewGaugeFamily(
+      "cartographer_ros_trajectory_cpu_seconds",
+      "CPU time in seconds spent on the sensor data of a trajectory by stage");
+}
+
+TrajectoryAccounting GetTrajectoryAccounting(const int trajectory_id) {
+  AccountingRegistry* const registry = GetAccountingRegistry();
+  absl::MutexLock lock(&registry->mutex);
+  if (registry->cpu_seconds == nullptr) {
+    return TrajectoryAccounting();
+  }
+  const auto it = registry->trajectories.find(trajectory_id);
+  if (it != registry->trajectories.end()) {
+    return it->second;
+  }
+  const std::string label = std::to_string(trajectory_id);
+  TrajectoryAccounting accounting;
+  accounting.local_slam_data_bytes =
+      registry->local_slam_data_bytes->Add({{"trajectory_id", label}});
+  accounting.num_pending_range_data =
+      registry->num_pending_range_data->Add({{"trajectory_id", label}});
+  accounting.submap_texture_bytes =
+      registry->submap_texture_bytes->Add({{"trajectory_id", label}});
+  accounting.conversion_cpu_seconds = registry->cpu_seconds->Add(
+      {{"trajectory_id", label}, {"stage", "conversion"}});
+  accounting.tf_lookup_cpu_seconds = registry->cpu_seconds->Add(
+      {{"trajectory_id", label}, {"stage", "tf_lookup"}});
+  registry->trajectories.emplace(trajectory_id, accounting);
+  return accounting;
+}
+
+double GetThreadCpuSeconds() {
+  timespec cpu_timespec = {};
+  CHECK_EQ(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_timespec), 0);
+  return cpu_timespec.tv_sec + 1e-9 * cpu_timespec.tv_nsec;
+}
+
+ThreadCpuTimer::ThreadCpuTimer(carto::metrics::Gauge* const gauge)
+    : gauge_(gauge) {
+  if (gauge_ != nullptr) {
+    start_cpu_seconds_ = GetThreadCpuSeconds();
+  }
+}
+
+ThreadCpuTimer::~ThreadCpuTimer() { Stop(); }
+
+void ThreadCpuTimer::Stop() {
+  if (gauge_ != nullptr) {
+    gauge_->Increment(GetThreadCpuSeconds() - start_cpu_seconds_);
+    gauge_ = nullptr;
+  }
+}
+
+}  // namespace metrics
+}  // namespace cartographer_ros
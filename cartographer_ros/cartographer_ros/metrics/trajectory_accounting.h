@@ -0,0 +1,81 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_METRICS_TRAJECTORY_ACCOUNTING_H
+#define CARTOGRAPHER_ROS_METRICS_TRAJECTORY_ACCOUNTING_H
+
+#include "cartographer/metrics/gauge.h"
+#include "cartographer_ros/metrics/family_factory.h"
+
+namespace cartographer_ros {
+namespace metrics {
+
+// Gauges of the resources used for one trajectory, labeled by
+// "trajectory_id". They are lock-free to update, so that they can be kept up
+// to date from the threads handling the trajectory without taking any lock of
+// the node.
+struct TrajectoryAccounting {
+  // Bytes of the latest local SLAM result kept for publishing.
+  ::cartographer::metrics::Gauge* local_slam_data_bytes =
+      ::cartographer::metrics::Gauge::Null();
+  // Range data handed to the map builder, but not yet part of the optimized
+  // map.
+  ::cartographer::metrics::Gauge* num_pending_range_data =
+      ::cartographer::metrics::Gauge::Null();
+  // Bytes of the cached textures of the submaps of the trajectory.
+  ::cartographer::metrics::Gauge* submap_texture_bytes =
+      ::cartographer::metrics::Gauge::Null();
+  // CPU time in seconds spent converting sensor messages, including the tf
+  // lookups for them, and in tf lookups. These are 'nullptr' until the metrics
+  // are registered, so that the CPU clock is only read when it is recorded.
+  ::cartographer::metrics::Gauge* conversion_cpu_seconds = nullptr;
+  ::cartographer::metrics::Gauge* tf_lookup_cpu_seconds = nullptr;
+};
+
+// Registers the trajectory accounting gauges. Until this is called, and after
+// 'factory' is destroyed, all trajectories get null gauges.
+void RegisterTrajectoryAccountingMetrics(FamilyFactory* factory);
+
+// Returns the gauges of 'trajectory_id'. Thread-safe, but takes a lock, so
+// callers should keep the result instead of looking it up for each update.
+// The gauges are owned by the registered factory and must not be used after
+// it is destroyed.
+TrajectoryAccounting GetTrajectoryAccounting(int trajectory_id);
+
+// Returns the CPU time in seconds used by the calling thread.
+double GetThreadCpuSeconds();
+
+// Adds the CPU time the calling thread spends from construction until
+// destruction or 'Stop()' to 'gauge'. Does nothing if 'gauge' is 'nullptr'.
+class ThreadCpuTimer {
+ public:
+  explicit ThreadCpuTimer(::cartographer::metrics::Gauge* gauge);
+  ~ThreadCpuTimer();
+
+  ThreadCpuTimer(const ThreadCpuTimer&) = delete;
+  ThreadCpuTimer& operator=(const ThreadCpuTimer&) = delete;
+
+  void Stop();
+
+ private:
+  ::cartographer::metrics::Gauge* gauge_;
+  double start_cpu_seconds_ = 0.;
+};
+
+}  // namespace metrics
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_METRICS_TRAJECTORY_ACCOUNTING_H
@@ -16,7 +16,10 @@
 
 #include "cartographer_ros/msg_conversion.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <limits>
 
 #include "cartographer/common/math.h"
 #include "cartographer/common/port.h"
@@ -32,43 +35,13 @@
 #include "geometry_msgs/Vector3.h"
 #include "glog/logging.h"
 #include "nav_msgs/OccupancyGrid.h"
-#include "pcl/point_cloud.h"
-#include "pcl/point_types.h"
-#include "pcl_conversions/pcl_conversions.h"
 #include "ros/ros.h"
 #include "ros/serialization.h"
 #include "sensor_msgs/Imu.h"
 #include "sensor_msgs/LaserScan.h"
 #include "sensor_msgs/MultiEchoLaserScan.h"
 #include "sensor_msgs/PointCloud2.h"
-
-namespace {
-
-// Sizes of PCL point types have to be 4n floats for alignment, as described in
-// http://pointclouds.org/documentation/tutorials/adding_custom_ptype.php
-struct PointXYZT {
-  float x;
-  float y;
-  float z;
-  float time;
-};
-
-struct PointXYZIT {
-  PCL_ADD_POINT4D;
-  float intensity;
-  float time;
-  float unused_padding[2];
-};
-
-}  // namespace
-
-POINT_CLOUD_REGISTER_POINT_STRUCT(
-    PointXYZT, (float, x, x)(float, y, y)(float, z, z)(float, time, time))
-
-POINT_CLOUD_REGISTER_POINT_STRUCT(
-    PointXYZIT,
-    (float, x, x)(float, y, y)(float, z, z)(float, intensity,
-                                            intensity)(float, time, time))
+#include "sensor_msgs/PointField.h"
 
 namespace cartographer_ros {
 namespace {
@@ -85,33 +58,33 @@ using ::cartographer::transform::Rigid3d;
 using ::cartographer_ros_msgs::LandmarkEntry;
 using ::cartographer_ros_msgs::LandmarkList;
 
-sensor_msgs::PointCloud2 PreparePointCloud2Message(const int64_t timestamp,
-                                                   const std::string& frame_id,
-                                                   const int num_points) {
-  sensor_msgs::PointCloud2 msg;
-  msg.header.stamp = ToRos(::cartographer::common::FromUniversal(timestamp));
-  msg.header.frame_id = frame_id;
-  msg.height = 1;
-  msg.width = num_points;
-  msg.fields.resize(3);
-  msg.fields[0].name = "x";
-  msg.fields[0].offset = 0;
-  msg.fields[0].datatype = sensor_msgs::PointField::FLOAT32;
-  msg.fields[0].count = 1;
-  msg.fields[1].name = "y";
-  msg.fields[1].offset = 4;
-  msg.fields[1].datatype = sensor_msgs::PointField::FLOAT32;
-  msg.fields[1].count = 1;
-  msg.fields[2].name = "z";
-  msg.fields[2].offset = 8;
-  msg.fields[2].datatype = sensor_msgs::PointField::FLOAT32;
-  msg.fields[2].count = 1;
-  msg.is_bigendian = false;
-  msg.point_step = 16;
-  msg.row_step = 16 * msg.width;
-  msg.is_dense = true;
-  msg.data.resize(16 * num_points);
-  return msg;
+// Assigning to the members of 'msg' reuses their memory.
+void PreparePointCloud2Message(const int64_t timestamp,
+                               const std::string& frame_id,
+                               const int num_points,
+                               sensor_msgs::PointCloud2* const msg) {
+  msg->header.stamp = ToRos(::cartographer::common::FromUniversal(timestamp));
+  msg->header.frame_id = frame_id;
+  msg->height = 1;
+  msg->width = num_points;
+  msg->fields.resize(3);
+  msg->fields[0].name = "x";
+  msg->fields[0].offset = 0;
+  msg->fields[0].datatype = sensor_msgs::PointField::FLOAT32;
+  msg->fields[0].count = 1;
+  msg->fields[1].name = "y";
+  msg->fields[1].offset = 4;
+  msg->fields[1].datatype = sensor_msgs::PointField::FLOAT32;
+  msg->fields[1].count = 1;
+  msg->fields[2].name = "z";
+  msg->fields[2].offset = 8;
+  msg->fields[2].datatype = sensor_msgs::PointField::FLOAT32;
+  msg->fields[2].count = 1;
+  msg->is_bigendian = false;
+  msg->point_step = 16;
+  msg->row_step = 16 * msg->width;
+  msg->is_dense = true;
+  msg->data.resize(16 * num_points);
 }
 
 // For sensor_msgs::LaserScan.
@@ -129,9 +102,35 @@ float GetFirstEcho(const sensor_msgs::LaserEcho& echo) {
 }
 
 // For sensor_msgs::LaserScan and sensor_msgs::MultiEchoLaserScan.
+template <typename LaserMessageType>
+LaserScanAngleTable ComputeAngleTable(const LaserMessageType& msg) {
+  LaserScanAngleTable table;
+  table.angle_min = msg.angle_min;
+  table.angle_increment = msg.angle_increment;
+  table.cos.reserve(msg.ranges.size());
+  table.sin.reserve(msg.ranges.size());
+  // Accumulated like in the original per-beam rotation to get the same angles.
+  float angle = msg.angle_min;
+  for (size_t i = 0; i < msg.ranges.size(); ++i) {
+    table.cos.push_back(std::cos(angle));
+    table.sin.push_back(std::sin(angle));
+    angle += msg.angle_increment;
+  }
+  return table;
+}
+
+template <typename LaserMessageType>
+bool HasAngleTable(const LaserMessageType& msg,
+                   const LaserScanAngleTable& table) {
+  return msg.angle_min == table.angle_min &&
+         msg.angle_increment == table.angle_increment &&
+         msg.ranges.size() == table.cos.size();
+}
+
 template <typename LaserMessageType>
 std::tuple<PointCloudWithIntensities, ::cartographer::common::Time>
-LaserScanToPointCloudWithIntensities(const LaserMessageType& msg) {
+LaserScanToPointCloudWithIntensities(const LaserMessageType& msg,
+                                     const LaserScanAngleTable& table) {
   CHECK_GE(msg.range_min, 0.f);
   CHECK_GE(msg.range_max, msg.range_min);
   if (msg.angle_increment > 0.f) {
@@ -139,30 +138,41 @@ LaserScanToPointCloudWithIntensities(const LaserMessageType& msg) {
   } else {
     CHECK_GT(msg.angle_min, msg.angle_max);
   }
+  CHECK(HasAngleTable(msg, table));
+  const bool has_intensities = !msg.intensities.empty();
+  if (has_intensities) {
+    CHECK_EQ(msg.intensities.size(), msg.ranges.size());
+  }
+  const size_t num_beams = msg.ranges.size();
   PointCloudWithIntensities point_cloud;
-  float angle = msg.angle_min;
-  for (size_t i = 0; i < msg.ranges.size(); ++i) {
+  point_cloud.points.resize(num_beams);
+  point_cloud.intensities.resize(num_beams);
+  size_t num_points = 0;
+  for (size_t i = 0; i < num_beams; ++i) {
     const auto& echoes = msg.ranges[i];
-    if (HasEcho(echoes)) {
-      const float first_echo = GetFirstEcho(echoes);
-      if (msg.range_min <= first_echo && first_echo <= msg.range_max) {
-        const Eigen::AngleAxisf rotation(angle, Eigen::Vector3f::UnitZ());
-        const cartographer::sensor::TimedRangefinderPoint point{
-            rotation * (first_echo * Eigen::Vector3f::UnitX()),
-            i * msg.time_increment};
-        point_cloud.points.push_back(point);
-        if (msg.intensities.size() > 0) {
-          CHECK_EQ(msg.intensities.size(), msg.ranges.size());
-          const auto& echo_intensities = msg.intensities[i];
-          CHECK(HasEcho(echo_intensities));
-          point_cloud.intensities.push_back(GetFirstEcho(echo_intensities));
-        } else {
-          point_cloud.intensities.push_back(0.f);
-        }
-      }
+    const float first_echo = HasEcho(echoes)
+                                 ? GetFirstEcho(echoes)
+                                 : std::numeric_limits<float>::quiet_NaN();
+    // Every beam is written and only kept if it is valid, so that the loop has
+    // no data-dependent branches and can be vectorized by the compiler.
+    const bool valid =
+        msg.range_min <= first_echo && first_echo <= msg.range_max;
+    point_cloud.points[num_points] = {
+        Eigen::Vector3f(first_echo * table.cos[i], first_echo * table.sin[i],
+                        0.f),
+        i * msg.time_increment};
+    if (has_intensities) {
+      const auto& echo_intensities = msg.intensities[i];
+      CHECK(!valid || HasEcho(echo_intensities));
+      point_cloud.intensities[num_points] =
+          HasEcho(echo_intensities) ? GetFirstEcho(echo_intensities) : 0.f;
+    } else {
+      point_cloud.intensities[num_points] = 0.f;
     }
-    angle += msg.angle_increment;
+    num_points += valid;
   }
+  point_cloud.points.resize(num_points);
+  point_cloud.intensities.resize(num_points);
   ::cartographer::common::Time timestamp = FromRos(msg.header.stamp);
   if (!point_cloud.points.empty()) {
     const double duration = point_cloud.points.back().time;
@@ -174,14 +184,103 @@ LaserScanToPointCloudWithIntensities(const LaserMessageType& msg) {
   return std::make_tuple(point_cloud, timestamp);
 }
 
-bool PointCloud2HasField(const sensor_msgs::PointCloud2& pc2,
-                         const std::string& field_name) {
-  for (const auto& field : pc2.fields) {
-    if (field.name == field_name) {
-      return true;
+size_t PointFieldSize(const uint8_t datatype) {
+  switch (datatype) {
+    case sensor_msgs::PointField::INT8:
+    case sensor_msgs::PointField::UINT8:
+      return 1;
+    case sensor_msgs::PointField::INT16:
+    case sensor_msgs::PointField::UINT16:
+      return 2;
+    case sensor_msgs::PointField::INT32:
+    case sensor_msgs::PointField::UINT32:
+    case sensor_msgs::PointField::FLOAT32:
+      return 4;
+    case sensor_msgs::PointField::FLOAT64:
+      return 8;
+  }
+  LOG(FATAL) << "Unknown PointField datatype " << static_cast<int>(datatype);
+  return 0;
+}
+
+template <typename T>
+float ReadAs(const uint8_t* const data) {
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return static_cast<float>(value);
+}
+
+// Reads a field of any datatype. 'field' must be present.
+float ReadPointField(const uint8_t* const point,
+                     const PointCloud2Layout::Field& field) {
+  const uint8_t* const data = point + field.offset;
+  switch (field.datatype) {
+    case sensor_msgs::PointField::INT8:
+      return ReadAs<int8_t>(data);
+    case sensor_msgs::PointField::UINT8:
+      return ReadAs<uint8_t>(data);
+    case sensor_msgs::PointField::INT16:
+      return ReadAs<int16_t>(data);
+    case sensor_msgs::PointField::UINT16:
+      return ReadAs<uint16_t>(data);
+    case sensor_msgs::PointField::INT32:
+      return ReadAs<int32_t>(data);
+    case sensor_msgs::PointField::UINT32:
+      return ReadAs<uint32_t>(data);
+    case sensor_msgs::PointField::FLOAT32:
+      return ReadAs<float>(data);
+    case sensor_msgs::PointField::FLOAT64:
+      return ReadAs<double>(data);
+  }
+  LOG(FATAL) << "Unknown PointField datatype "
+             << static_cast<int>(field.datatype);
+  return 0.f;
+}
+
+// Fast path for the common layouts in which every field we read is a float.
+float ReadFloat32PointField(const uint8_t* const point,
+                            const PointCloud2Layout::Field& field) {
+  return ReadAs<float>(point + field.offset);
+}
+
+// Decodes all points of 'msg' in a single pass over its data. 'ReadFunction'
+// is a function of the point data and a present field returning its value.
+template <typename ReadFunction>
+void DecodePointCloud2(const sensor_msgs::PointCloud2& msg,
+                       const PointCloud2Layout& layout,
+                       const ReadFunction& read,
+                       PointCloudWithIntensities* const point_cloud) {
+  const size_t num_points = static_cast<size_t>(msg.width) * msg.height;
+  point_cloud->points.reserve(num_points);
+  point_cloud->intensities.reserve(num_points);
+  const bool has_intensity = layout.intensity.present();
+  const bool has_time = layout.time.present();
+  for (uint32_t row = 0; row < msg.height; ++row) {
+    const uint8_t* point = msg.data.data() + row * msg.row_step;
+    for (uint32_t column = 0; column < msg.width;
+         ++column, point += msg.point_step) {
+      point_cloud->points.push_back(
+          {Eigen::Vector3f{read(point, layout.x), read(point, layout.y),
+                           read(point, layout.z)},
+           has_time ? read(point, layout.time) * layout.time_scale : 0.f});
+      point_cloud->intensities.push_back(
+          has_intensity ? read(point, layout.intensity) : 1.f);
     }
   }
-  return false;
+}
+
+// Converts a pixel painted by '::cartographer::io::PaintSubmapSlices()' to an
+// occupancy probability in percent, or -1 if unknown.
+int8_t ToOccupancyValue(const uint32_t packed) {
+  const unsigned char color = packed >> 16;
+  const unsigned char observed = packed >> 8;
+  const int value =
+      observed == 0
+          ? -1
+          : ::cartographer::common::RoundToInt((1. - color / 255.) * 100.);
+  CHECK_LE(-1, value);
+  CHECK_GE(100, value);
+  return value;
 }
 
 }  // namespace
@@ -189,7 +288,8 @@ bool PointCloud2HasField(const sensor_msgs::PointCloud2& pc2,
 sensor_msgs::PointCloud2 ToPointCloud2Message(
     const int64_t timestamp, const std::string& frame_id,
     const ::cartographer::sensor::TimedPointCloud& point_cloud) {
-  auto msg = PreparePointCloud2Message(timestamp, frame_id, point_cloud.size());
+  sensor_msgs::PointCloud2 msg;
+  PreparePointCloud2Message(timestamp, frame_id, point_cloud.size(), &msg);
   ::ros::serialization::OStream stream(msg.data.data(), msg.data.size());
   for (const cartographer::sensor::TimedRangefinderPoint& point : point_cloud) {
     stream.next(point.position.x());
@@ -200,70 +300,206 @@ sensor_msgs::PointCloud2 ToPointCloud2Message(
   return msg;
 }
 
+void ToPointCloud2Message(
+    const int64_t timestamp, const std::string& frame_id,
+    const ::cartographer::sensor::PointCloud& point_cloud,
+    const ::cartographer::transform::Rigid3f& transform,
+    sensor_msgs::PointCloud2* const msg) {
+  PreparePointCloud2Message(timestamp, frame_id, point_cloud.size(), msg);
+  // Rotating with the matrix instead of the quaternion is cheaper per point.
+  const Eigen::Matrix3f rotation = transform.rotation().toRotationMatrix();
+  const Eigen::Vector3f& translation = transform.translation();
+  ::ros::serialization::OStream stream(msg->data.data(), msg->data.size());
+  for (const cartographer::sensor::RangefinderPoint& point : point_cloud) {
+    const Eigen::Vector3f position = rotation * point.position + translation;
+    stream.next(position.x());
+    stream.next(position.y());
+    stream.next(position.z());
+    stream.next(kPointCloudComponentFourMagic);
+  }
+}
+
+void ToCompactPointCloudMessage(
+    const int64_t timestamp, const std::string& frame_id,
+    const ::cartographer::sensor::PointCloud& point_cloud,
+    const ::cartographer::transform::Rigid3f& transform,
+    const Eigen::Vector3d& origin, const double resolution,
+    cartographer_ros_msgs::CompactPointCloud* const msg) {
+  CHECK_GT(resolution, 0.);
+  msg->header.stamp = ToRos(::cartographer::common::FromUniversal(timestamp));
+  msg->header.frame_id = frame_id;
+  msg->origin = ToGeometryMsgPoint(origin);
+  msg->resolution = resolution;
+  msg->coordinates.clear();
+  msg->coordinates.reserve(3 * point_cloud.size());
+  // Moves the origin into the transform and scales it, so that each point
+  // only needs a single affine map before rounding.
+  const float scale = static_cast<float>(1. / resolution);
+  const Eigen::Matrix3f rotation =
+      scale * transform.rotation().toRotationMatrix();
+  const Eigen::Vector3f translation =
+      scale * (transform.translation() - origin.cast<float>());
+  constexpr float kMaxCoordinate = std::numeric_limits<int16_t>::max();
+  constexpr float kMinCoordinate = std::numeric_limits<int16_t>::min();
+  for (const cartographer::sensor::RangefinderPoint& point : point_cloud) {
+    const Eigen::Vector3f coordinates = rotation * point.position + translation;
+    if ((coordinates.array() > kMaxCoordinate).any() ||
+        (coordinates.array() < kMinCoordinate).any()) {
+      continue;
+    }
+    msg->coordinates.push_back(std::lround(coordinates.x()));
+    msg->coordinates.push_back(std::lround(coordinates.y()));
+    msg->coordinates.push_back(std::lround(coordinates.z()));
+  }
+}
+
+std::vector<Eigen::Vector3f> FromCompactPointCloudMessage(
+    const cartographer_ros_msgs::CompactPointCloud& msg) {
+  CHECK_EQ(msg.coordinates.size() % 3, 0);
+  const Eigen::Vector3f origin(msg.origin.x, msg.origin.y, msg.origin.z);
+  const float resolution = static_cast<float>(msg.resolution);
+  std::vector<Eigen::Vector3f> points;
+  points.reserve(msg.coordinates.size() / 3);
+  for (size_t i = 0; i < msg.coordinates.size(); i += 3) {
+    points.push_back(origin + resolution * Eigen::Vector3f(
+                                               msg.coordinates[i],
+                                               msg.coordinates[i + 1],
+                                               msg.coordinates[i + 2]));
+  }
+  return points;
+}
+
 std::tuple<::cartographer::sensor::PointCloudWithIntensities,
            ::cartographer::common::Time>
 ToPointCloudWithIntensities(const sensor_msgs::LaserScan& msg) {
-  return LaserScanToPointCloudWithIntensities(msg);
+  return LaserScanToPointCloudWithIntensities(msg, ComputeAngleTable(msg));
 }
 
 std::tuple<::cartographer::sensor::PointCloudWithIntensities,
            ::cartographer::common::Time>
 ToPointCloudWithIntensities(const sensor_msgs::MultiEchoLaserScan& msg) {
-  return LaserScanToPointCloudWithIntensities(msg);
+  return LaserScanToPointCloudWithIntensities(msg, ComputeAngleTable(msg));
+}
+
+LaserScanAngleTable ComputeLaserScanAngleTable(
+    const sensor_msgs::LaserScan& msg) {
+  return ComputeAngleTable(msg);
+}
+
+LaserScanAngleTable ComputeLaserScanAngleTable(
+    const sensor_msgs::MultiEchoLaserScan& msg) {
+  return ComputeAngleTable(msg);
+}
+
+bool HasLaserScanAngleTable(const sensor_msgs::LaserScan& msg,
+                            const LaserScanAngleTable& table) {
+  return HasAngleTable(msg, table);
+}
+
+bool HasLaserScanAngleTable(const sensor_msgs::MultiEchoLaserScan& msg,
+                            const LaserScanAngleTable& table) {
+  return HasAngleTable(msg, table);
+}
+
+std::tuple<::cartographer::sensor::PointCloudWithIntensities,
+           ::cartographer::common::Time>
+ToPointCloudWithIntensities(const sensor_msgs::LaserScan& msg,
+                            const LaserScanAngleTable& table) {
+  return LaserScanToPointCloudWithIntensities(msg, table);
+}
+
+std::tuple<::cartographer::sensor::PointCloudWithIntensities,
+           ::cartographer::common::Time>
+ToPointCloudWithIntensities(const sensor_msgs::MultiEchoLaserScan& msg,
+                            const LaserScanAngleTable& table) {
+  return LaserScanToPointCloudWithIntensities(msg, table);
 }
 
 std::tuple<::cartographer::sensor::PointCloudWithIntensities,
            ::cartographer::common::Time>
 ToPointCloudWithIntensities(const sensor_msgs::PointCloud2& msg) {
-  PointCloudWithIntensities point_cloud;
-  // We check for intensity field here to avoid run-time warnings if we pass in
-  // a PointCloud2 without intensity.
-  if (PointCloud2HasField(msg, "intensity")) {
-    if (PointCloud2HasField(msg, "time")) {
-      pcl::PointCloud<PointXYZIT> pcl_point_cloud;
-      pcl::fromROSMsg(msg, pcl_point_cloud);
-      point_cloud.points.reserve(pcl_point_cloud.size());
-      point_cloud.intensities.reserve(pcl_point_cloud.size());
-      for (const auto& point : pcl_point_cloud) {
-        point_cloud.points.push_back(
-            {Eigen::Vector3f{point.x, point.y, point.z}, point.time});
-        point_cloud.intensities.push_back(point.intensity);
-      }
+  return ToPointCloudWithIntensities(msg, ComputePointCloud2Layout(msg));
+}
+
+PointCloud2Layout ComputePointCloud2Layout(
+    const sensor_msgs::PointCloud2& msg) {
+  PointCloud2Layout layout;
+  layout.point_step = msg.point_step;
+  layout.fields = msg.fields;
+  // Ouster drivers publish the point time in nanoseconds as 't'.
+  const sensor_msgs::PointField* nanoseconds_time_field = nullptr;
+  for (const sensor_msgs::PointField& field : msg.fields) {
+    PointCloud2Layout::Field* layout_field = nullptr;
+    if (field.name == "x") {
+      layout_field = &layout.x;
+    } else if (field.name == "y") {
+      layout_field = &layout.y;
+    } else if (field.name == "z") {
+      layout_field = &layout.z;
+    } else if (field.name == "intensity") {
+      layout_field = &layout.intensity;
+    } else if (field.name == "time") {
+      layout_field = &layout.time;
+    } else if (field.name == "t" &&
+               field.datatype == sensor_msgs::PointField::UINT32) {
+      nanoseconds_time_field = &field;
+      continue;
     } else {
-      pcl::PointCloud<pcl::PointXYZI> pcl_point_cloud;
-      pcl::fromROSMsg(msg, pcl_point_cloud);
-      point_cloud.points.reserve(pcl_point_cloud.size());
-      point_cloud.intensities.reserve(pcl_point_cloud.size());
-      for (const auto& point : pcl_point_cloud) {
-        point_cloud.points.push_back(
-            {Eigen::Vector3f{point.x, point.y, point.z}, 0.f});
-        point_cloud.intensities.push_back(point.intensity);
-      }
+      continue;
     }
-  } else {
-    // If we don't have an intensity field, just copy XYZ and fill in 1.0f.
-    if (PointCloud2HasField(msg, "time")) {
-      pcl::PointCloud<PointXYZT> pcl_point_cloud;
-      pcl::fromROSMsg(msg, pcl_point_cloud);
-      point_cloud.points.reserve(pcl_point_cloud.size());
-      point_cloud.intensities.reserve(pcl_point_cloud.size());
-      for (const auto& point : pcl_point_cloud) {
-        point_cloud.points.push_back(
-            {Eigen::Vector3f{point.x, point.y, point.z}, point.time});
-        point_cloud.intensities.push_back(1.0f);
-      }
-    } else {
-      pcl::PointCloud<pcl::PointXYZ> pcl_point_cloud;
-      pcl::fromROSMsg(msg, pcl_point_cloud);
-      point_cloud.points.reserve(pcl_point_cloud.size());
-      point_cloud.intensities.reserve(pcl_point_cloud.size());
-      for (const auto& point : pcl_point_cloud) {
-        point_cloud.points.push_back(
-            {Eigen::Vector3f{point.x, point.y, point.z}, 0.f});
-        point_cloud.intensities.push_back(1.0f);
-      }
+    CHECK_LE(field.offset + PointFieldSize(field.datatype), msg.point_step)
+        << "PointCloud2 field '" << field.name << "' exceeds the point step.";
+    layout_field->offset = field.offset;
+    layout_field->datatype = field.datatype;
+  }
+  if (!layout.time.present() && nanoseconds_time_field != nullptr) {
+    CHECK_LE(nanoseconds_time_field->offset + sizeof(uint32_t), msg.point_step)
+        << "PointCloud2 field 't' exceeds the point step.";
+    layout.time.offset = nanoseconds_time_field->offset;
+    layout.time.datatype = nanoseconds_time_field->datatype;
+    layout.time_scale = 1e-9f;
+  }
+  CHECK(layout.x.present() && layout.y.present() && layout.z.present())
+      << "PointCloud2 is missing one of the fields 'x', 'y' and 'z'.";
+  const auto is_float32 = [](const PointCloud2Layout::Field& field) {
+    return !field.present() ||
+           field.datatype == sensor_msgs::PointField::FLOAT32;
+  };
+  layout.all_float32 = is_float32(layout.x) && is_float32(layout.y) &&
+                       is_float32(layout.z) && is_float32(layout.intensity) &&
+                       is_float32(layout.time);
+  return layout;
+}
+
+bool HasPointCloud2Layout(const sensor_msgs::PointCloud2& msg,
+                          const PointCloud2Layout& layout) {
+  if (msg.point_step != layout.point_step ||
+      msg.fields.size() != layout.fields.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < msg.fields.size(); ++i) {
+    const sensor_msgs::PointField& lhs = msg.fields[i];
+    const sensor_msgs::PointField& rhs = layout.fields[i];
+    if (lhs.offset != rhs.offset || lhs.datatype != rhs.datatype ||
+        lhs.count != rhs.count || lhs.name != rhs.name) {
+      return false;
     }
   }
+  return true;
+}
+
+std::tuple<::cartographer::sensor::PointCloudWithIntensities,
+           ::cartographer::common::Time>
+ToPointCloudWithIntensities(const sensor_msgs::PointCloud2& msg,
+                            const PointCloud2Layout& layout) {
+  CHECK_GE(msg.row_step, static_cast<uint64_t>(msg.width) * msg.point_step);
+  CHECK_GE(msg.data.size(), static_cast<uint64_t>(msg.height) * msg.row_step);
+  PointCloudWithIntensities point_cloud;
+  if (layout.all_float32) {
+    DecodePointCloud2(msg, layout, ReadFloat32PointField, &point_cloud);
+  } else {
+    DecodePointCloud2(msg, layout, ReadPointField, &point_cloud);
+  }
   ::cartographer::common::Time timestamp = FromRos(msg.header.stamp);
   if (!point_cloud.points.empty()) {
     const double duration = point_cloud.points.back().time;
@@ -330,6 +566,18 @@ geometry_msgs::Pose ToGeometryMsgPose(const Rigid3d& rigid3d) {
   return pose;
 }
 
+cartographer_ros_msgs::SubmapEntry ToSubmapEntry(
+    const ::cartographer::mapping::SubmapId& submap_id, const int version,
+    const Rigid3d& pose, const bool is_frozen) {
+  cartographer_ros_msgs::SubmapEntry submap_entry;
+  submap_entry.is_frozen = is_frozen;
+  submap_entry.trajectory_id = submap_id.trajectory_id;
+  submap_entry.submap_index = submap_id.submap_index;
+  submap_entry.submap_version = version;
+  submap_entry.pose = ToGeometryMsgPose(pose);
+  return submap_entry;
+}
+
 geometry_msgs::Point ToGeometryMsgPoint(const Eigen::Vector3d& vector3d) {
   geometry_msgs::Point point;
   point.x = vector3d.x();
@@ -374,47 +622,137 @@ std::unique_ptr<nav_msgs::OccupancyGrid> CreateOccupancyGridMsg(
     const cartographer::io::PaintSubmapSlicesResult& painted_slices,
     const double resolution, const std::string& frame_id,
     const ros::Time& time) {
-  auto occupancy_grid = absl::make_unique<nav_msgs::OccupancyGrid>();
-
   const int width = cairo_image_surface_get_width(painted_slices.surface.get());
   const int height =
       cairo_image_surface_get_height(painted_slices.surface.get());
+  auto occupancy_grid = CreateOccupancyGridMsg(
+      width, height, painted_slices.origin, resolution, frame_id, time);
+  FillOccupancyGridRows(
+      reinterpret_cast<uint32_t*>(
+          cairo_image_surface_get_data(painted_slices.surface.get())),
+      0, height, occupancy_grid.get());
+  return occupancy_grid;
+}
 
+std::unique_ptr<nav_msgs::OccupancyGrid> CreateOccupancyGridMsg(
+    const int width, const int height, const Eigen::Array2f& origin,
+    const double resolution, const std::string& frame_id,
+    const ros::Time& time) {
+  auto occupancy_grid = absl::make_unique<nav_msgs::OccupancyGrid>();
   occupancy_grid->header.stamp = time;
   occupancy_grid->header.frame_id = frame_id;
   occupancy_grid->info.map_load_time = time;
   occupancy_grid->info.resolution = resolution;
   occupancy_grid->info.width = width;
   occupancy_grid->info.height = height;
-  occupancy_grid->info.origin.position.x =
-      -painted_slices.origin.x() * resolution;
-  occupancy_grid->info.origin.position.y =
-      (-height + painted_slices.origin.y()) * resolution;
+  occupancy_grid->info.origin.position.x = -origin.x() * resolution;
+  occupancy_grid->info.origin.position.y = (-height + origin.y()) * resolution;
   occupancy_grid->info.origin.position.z = 0.;
   occupancy_grid->info.origin.orientation.w = 1.;
   occupancy_grid->info.origin.orientation.x = 0.;
   occupancy_grid->info.origin.orientation.y = 0.;
   occupancy_grid->info.origin.orientation.z = 0.;
+  occupancy_grid->data.assign(static_cast<size_t>(width) * height, -1);
+  return occupancy_grid;
+}
+
+void FillOccupancyGridRows(const uint32_t* pixels, const int y,
+                           const int num_rows,
+                           nav_msgs::OccupancyGrid* occupancy_grid) {
+  const int width = occupancy_grid->info.width;
+  const int height = occupancy_grid->info.height;
+  CHECK_LE(0, y);
+  CHECK_LE(y + num_rows, height);
+  for (int row = 0; row < num_rows; ++row) {
+    // Rows of the occupancy grid are ordered bottom to top.
+    int8_t* const cells =
+        occupancy_grid->data.data() +
+        static_cast<size_t>(height - 1 - (y + row)) * width;
+    for (int x = 0; x < width; ++x) {
+      cells[x] = ToOccupancyValue(pixels[row * width + x]);
+    }
+  }
+}
+
+std::unique_ptr<map_msgs::OccupancyGridUpdate> CreateOccupancyGridUpdateMsg(
+    const cartographer::io::PaintSubmapSlicesResult& painted_slices,
+    const int x, const int y, const int width, const int height,
+    const std::string& frame_id, const ros::Time& time) {
+  const int surface_width =
+      cairo_image_surface_get_width(painted_slices.surface.get());
+  const int surface_height =
+      cairo_image_surface_get_height(painted_slices.surface.get());
+  CHECK_LE(0, x);
+  CHECK_LE(0, y);
+  CHECK_LE(x + width, surface_width);
+  CHECK_LE(y + height, surface_height);
+
+  auto occupancy_grid_update =
+      absl::make_unique<map_msgs::OccupancyGridUpdate>();
+  occupancy_grid_update->header.stamp = time;
+  occupancy_grid_update->header.frame_id = frame_id;
+  // Rows of the occupancy grid are ordered bottom to top.
+  occupancy_grid_update->x = x;
+  occupancy_grid_update->y = surface_height - (y + height);
+  occupancy_grid_update->width = width;
+  occupancy_grid_update->height = height;
 
   const uint32_t* pixel_data = reinterpret_cast<uint32_t*>(
       cairo_image_surface_get_data(painted_slices.surface.get()));
-  occupancy_grid->data.reserve(width * height);
-  for (int y = height - 1; y >= 0; --y) {
+  occupancy_grid_update->data.reserve(width * height);
+  for (int row = y + height - 1; row >= y; --row) {
+    for (int column = x; column < x + width; ++column) {
+      occupancy_grid_update->data.push_back(
+          ToOccupancyValue(pixel_data[row * surface_width + column]));
+    }
+  }
+
+  return occupancy_grid_update;
+}
+
+std::unique_ptr<nav_msgs::OccupancyGrid> DownsampleOccupancyGrid(
+    const nav_msgs::OccupancyGrid& occupancy_grid, const int factor) {
+  CHECK_GT(factor, 0);
+  const int width = occupancy_grid.info.width;
+  const int height = occupancy_grid.info.height;
+  auto downsampled = absl::make_unique<nav_msgs::OccupancyGrid>();
+  downsampled->header = occupancy_grid.header;
+  downsampled->info = occupancy_grid.info;
+  downsampled->info.resolution = occupancy_grid.info.resolution * factor;
+  downsampled->info.width = (width + factor - 1) / factor;
+  downsampled->info.height = (height + factor - 1) / factor;
+  const int downsampled_width = downsampled->info.width;
+  downsampled->data.assign(
+      static_cast<size_t>(downsampled_width) * downsampled->info.height, -1);
+  // Both grids have the same origin and rows ordered bottom to top, so each
+  // cell goes to the downsampled cell at its coordinates divided by 'factor'.
+  for (int y = 0; y < height; ++y) {
+    const int8_t* const cells =
+        occupancy_grid.data.data() + static_cast<size_t>(y) * width;
+    int8_t* const downsampled_cells =
+        downsampled->data.data() +
+        static_cast<size_t>(y / factor) * downsampled_width;
     for (int x = 0; x < width; ++x) {
-      const uint32_t packed = pixel_data[y * width + x];
-      const unsigned char color = packed >> 16;
-      const unsigned char observed = packed >> 8;
-      const int value =
-          observed == 0
-              ? -1
-              : ::cartographer::common::RoundToInt((1. - color / 255.) * 100.);
-      CHECK_LE(-1, value);
-      CHECK_GE(100, value);
-      occupancy_grid->data.push_back(value);
+      int8_t& downsampled_cell = downsampled_cells[x / factor];
+      downsampled_cell = std::max(downsampled_cell, cells[x]);
     }
   }
+  return downsampled;
+}
 
-  return occupancy_grid;
+std::vector<int> ComputeDownsamplingFactors(
+    const double resolution, const std::vector<double>& coarser_resolutions) {
+  std::vector<int> factors;
+  for (const double coarser_resolution : coarser_resolutions) {
+    const int factor = std::lround(coarser_resolution / resolution);
+    CHECK_GT(factor, 1) << "Resolution " << coarser_resolution
+                        << " is not coarser than " << resolution << ".";
+    CHECK_NEAR(factor * resolution, coarser_resolution, 1e-3 * resolution)
+        << "Resolution " << coarser_resolution
+        << " is not a multiple of " << resolution << ".";
+    factors.push_back(factor);
+  }
+  return factors;
 }
 
 }  // namespace cartographer_ros
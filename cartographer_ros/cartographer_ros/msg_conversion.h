@@ -19,13 +19,17 @@
 
 #include "cartographer/common/time.h"
 #include "cartographer/io/submap_painter.h"
+#include "cartographer/mapping/id.h"
 #include "cartographer/sensor/landmark_data.h"
 #include "cartographer/sensor/point_cloud.h"
 #include "cartographer/transform/rigid_transform.h"
+#include "cartographer_ros_msgs/CompactPointCloud.h"
 #include "cartographer_ros_msgs/LandmarkList.h"
+#include "cartographer_ros_msgs/SubmapEntry.h"
 #include "geometry_msgs/Pose.h"
 #include "geometry_msgs/Transform.h"
 #include "geometry_msgs/TransformStamped.h"
+#include "map_msgs/OccupancyGridUpdate.h"
 #include "nav_msgs/OccupancyGrid.h"
 #include "sensor_msgs/Imu.h"
 #include "sensor_msgs/LaserScan.h"
@@ -38,6 +42,29 @@ sensor_msgs::PointCloud2 ToPointCloud2Message(
     int64_t timestamp, const std::string& frame_id,
     const ::cartographer::sensor::TimedPointCloud& point_cloud);
 
+// Like the overload above, but writes 'point_cloud' transformed by 'transform'
+// into 'msg' in a single pass. The memory of 'msg' is reused, so converting a
+// stream of point clouds into the same message rarely allocates.
+void ToPointCloud2Message(int64_t timestamp, const std::string& frame_id,
+                          const ::cartographer::sensor::PointCloud& point_cloud,
+                          const ::cartographer::transform::Rigid3f& transform,
+                          sensor_msgs::PointCloud2* msg);
+
+// Writes 'point_cloud' transformed by 'transform' into 'msg' with coordinates
+// quantized to 'resolution' around 'origin', in the frame of the transformed
+// points. Points too far from 'origin' to be represented are dropped. Like for
+// 'ToPointCloud2Message()', the memory of 'msg' is reused.
+void ToCompactPointCloudMessage(
+    int64_t timestamp, const std::string& frame_id,
+    const ::cartographer::sensor::PointCloud& point_cloud,
+    const ::cartographer::transform::Rigid3f& transform,
+    const Eigen::Vector3d& origin, double resolution,
+    cartographer_ros_msgs::CompactPointCloud* msg);
+
+// Returns the positions of the points in 'msg', in its frame.
+std::vector<Eigen::Vector3f> FromCompactPointCloudMessage(
+    const cartographer_ros_msgs::CompactPointCloud& msg);
+
 geometry_msgs::Transform ToGeometryMsgTransform(
     const ::cartographer::transform::Rigid3d& rigid3d);
 
@@ -46,6 +73,10 @@ geometry_msgs::Pose ToGeometryMsgPose(
 
 geometry_msgs::Point ToGeometryMsgPoint(const Eigen::Vector3d& vector3d);
 
+cartographer_ros_msgs::SubmapEntry ToSubmapEntry(
+    const ::cartographer::mapping::SubmapId& submap_id, int version,
+    const ::cartographer::transform::Rigid3d& pose, bool is_frozen);
+
 // Converts ROS message to point cloud. Returns the time when the last point
 // was acquired (different from the ROS timestamp). Timing of points is given in
 // the fourth component of each point relative to `Time`.
@@ -57,10 +88,82 @@ std::tuple<::cartographer::sensor::PointCloudWithIntensities,
            ::cartographer::common::Time>
 ToPointCloudWithIntensities(const sensor_msgs::MultiEchoLaserScan& msg);
 
+// Directions of the beams of a LaserScan or MultiEchoLaserScan. They only
+// depend on the scan geometry, so callers converting a stream of scans should
+// keep the table around while 'HasLaserScanAngleTable()' holds.
+struct LaserScanAngleTable {
+  float angle_min = 0.f;
+  float angle_increment = 0.f;
+  std::vector<float> cos;
+  std::vector<float> sin;
+};
+
+LaserScanAngleTable ComputeLaserScanAngleTable(
+    const sensor_msgs::LaserScan& msg);
+
+LaserScanAngleTable ComputeLaserScanAngleTable(
+    const sensor_msgs::MultiEchoLaserScan& msg);
+
+bool HasLaserScanAngleTable(const sensor_msgs::LaserScan& msg,
+                            const LaserScanAngleTable& table);
+
+bool HasLaserScanAngleTable(const sensor_msgs::MultiEchoLaserScan& msg,
+                            const LaserScanAngleTable& table);
+
+// Like the overloads above, but uses a previously computed 'table' matching
+// 'msg' instead of evaluating sin and cos for every beam.
+std::tuple<::cartographer::sensor::PointCloudWithIntensities,
+           ::cartographer::common::Time>
+ToPointCloudWithIntensities(const sensor_msgs::LaserScan& msg,
+                            const LaserScanAngleTable& table);
+
+std::tuple<::cartographer::sensor::PointCloudWithIntensities,
+           ::cartographer::common::Time>
+ToPointCloudWithIntensities(const sensor_msgs::MultiEchoLaserScan& msg,
+                            const LaserScanAngleTable& table);
+
 std::tuple<::cartographer::sensor::PointCloudWithIntensities,
            ::cartographer::common::Time>
 ToPointCloudWithIntensities(const sensor_msgs::PointCloud2& msg);
 
+// Where the fields we read are located in the points of a PointCloud2 message.
+// Computing it scans the field descriptions, so callers converting a stream of
+// messages should keep it around while 'HasPointCloud2Layout()' holds.
+struct PointCloud2Layout {
+  struct Field {
+    bool present() const { return datatype != 0; }
+
+    uint32_t offset = 0;
+    // One of the 'sensor_msgs::PointField' datatypes, 0 if not present.
+    uint8_t datatype = 0;
+  };
+
+  Field x;
+  Field y;
+  Field z;
+  Field intensity;
+  Field time;
+  // Converts 'time' to seconds.
+  float time_scale = 1.f;
+  // True if all present fields are float32, which is decoded faster.
+  bool all_float32 = false;
+
+  uint32_t point_step = 0;
+  std::vector<sensor_msgs::PointField> fields;
+};
+
+PointCloud2Layout ComputePointCloud2Layout(const sensor_msgs::PointCloud2& msg);
+
+bool HasPointCloud2Layout(const sensor_msgs::PointCloud2& msg,
+                          const PointCloud2Layout& layout);
+
+// Like the overload above, but decodes 'msg' with a previously computed
+// 'layout' matching it.
+std::tuple<::cartographer::sensor::PointCloudWithIntensities,
+           ::cartographer::common::Time>
+ToPointCloudWithIntensities(const sensor_msgs::PointCloud2& msg,
+                            const PointCloud2Layout& layout);
+
 ::cartographer::sensor::LandmarkData ToLandmarkData(
     const cartographer_ros_msgs::LandmarkList& landmark_list);
 
@@ -89,6 +192,40 @@ std::unique_ptr<nav_msgs::OccupancyGrid> CreateOccupancyGridMsg(
     const double resolution, const std::string& frame_id,
     const ros::Time& time);
 
+// Like above, but for an image of 'width' x 'height' pixels with the map frame
+// origin at the pixel 'origin'. All cells are unknown until filled in by
+// 'FillOccupancyGridRows()'.
+std::unique_ptr<nav_msgs::OccupancyGrid> CreateOccupancyGridMsg(
+    int width, int height, const Eigen::Array2f& origin, double resolution,
+    const std::string& frame_id, const ros::Time& time);
+
+// Converts 'num_rows' rows of painted pixels in
+// '::cartographer::io::kCairoFormat' and sets the cells of 'occupancy_grid'
+// for the image rows starting at 'y', counted from the top.
+void FillOccupancyGridRows(const uint32_t* pixels, int y, int num_rows,
+                           nav_msgs::OccupancyGrid* occupancy_grid);
+
+// Points to a patch of the occupancy grid created by
+// 'CreateOccupancyGridMsg()' from the same 'painted_slices'. The patch covers
+// 'width' x 'height' pixels of 'painted_slices.surface' starting at the pixel
+// ('x', 'y') in its top left corner.
+std::unique_ptr<map_msgs::OccupancyGridUpdate> CreateOccupancyGridUpdateMsg(
+    const cartographer::io::PaintSubmapSlicesResult& painted_slices, int x,
+    int y, int width, int height, const std::string& frame_id,
+    const ros::Time& time);
+
+// Returns 'occupancy_grid' at a 'factor' times coarser resolution with the
+// same origin, covering at least the same area. Each cell has the highest
+// occupancy of the known cells it covers, so that thin obstacles stay
+// visible, and is unknown if none of them is known.
+std::unique_ptr<nav_msgs::OccupancyGrid> DownsampleOccupancyGrid(
+    const nav_msgs::OccupancyGrid& occupancy_grid, int factor);
+
+// Returns the factors by which each of 'coarser_resolutions' is coarser than
+// 'resolution'. They have to be integer multiples of it.
+std::vector<int> ComputeDownsamplingFactors(
+    double resolution, const std::vector<double>& coarser_resolutions);
+
 }  // namespace cartographer_ros
 
 #endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_MSG_CONVERSION_H
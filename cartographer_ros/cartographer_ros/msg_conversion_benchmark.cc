@@ -0,0 +1,379 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Microbenchmarks of converting sensor messages, on synthetic messages shaped
+// like those of common sensors. Besides the time per message, they report the
+// time per point as 'time_per_point' and the heap allocations per message as
+// 'allocations'.
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <random>
+
+#include "benchmark/benchmark.h"
+#include "boost/make_shared.hpp"
+#include "cartographer/mapping/trajectory_builder_interface.h"
+#include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/offline_transform_store.h"
+#include "cartographer_ros/sensor_bridge.h"
+#include "cartographer_ros/tf_bridge.h"
+#include "cartographer_ros/time_conversion.h"
+#include "sensor_msgs/point_cloud2_iterator.h"
+
+namespace {
+
+std::atomic<int64_t> g_num_allocations{0};
+
+}  // namespace
+
+void* operator new(const std::size_t size) {
+  g_num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* const pointer = std::malloc(size == 0 ? 1 : size);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void operator delete(void* const pointer) noexcept { std::free(pointer); }
+
+namespace cartographer_ros {
+namespace {
+
+namespace carto = ::cartographer;
+
+constexpr char kTrackingFrame[] = "base_link";
+constexpr char kOdomFrame[] = "odom";
+constexpr char kLaserFrame[] = "laser";
+constexpr char kImuFrame[] = "imu_link";
+const ::ros::Time kStartTime(1000.);
+
+// Counts the allocations from construction to 'Stop()' and reports them and
+// the time per point for 'num_points_per_message' points per iteration.
+class Counters {
+ public:
+  explicit Counters(benchmark::State* state)
+      : state_(state), start_num_allocations_(g_num_allocations.load()) {}
+
+  void Stop(const int64_t num_points_per_message) {
+    const int64_t num_allocations =
+        g_num_allocations.load() - start_num_allocations_;
+    state_->counters["allocations"] = benchmark::Counter(
+        num_allocations, benchmark::Counter::kAvgIterations);
+    if (num_points_per_message > 0) {
+      state_->SetItemsProcessed(state_->iterations() * num_points_per_message);
+      state_->counters["time_per_point"] = benchmark::Counter(
+          state_->iterations() * num_points_per_message,
+          benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    }
+  }
+
+ private:
+  benchmark::State* const state_;
+  const int64_t start_num_allocations_;
+};
+
+float RandomRange(std::mt19937* prng) {
+  return std::uniform_real_distribution<float>(0.1f, 30.f)(*prng);
+}
+
+// A Hokuyo UTM-30LX: 1081 beams over 270 degrees at 40 Hz.
+template <typename LaserScanType>
+void SetHokuyoGeometry(LaserScanType* msg) {
+  msg->header.stamp = kStartTime;
+  msg->header.frame_id = kLaserFrame;
+  msg->angle_min = -3. * M_PI / 4.;
+  msg->angle_max = 3. * M_PI / 4.;
+  msg->angle_increment = (msg->angle_max - msg->angle_min) / 1080.;
+  msg->scan_time = 1. / 40.;
+  msg->time_increment = msg->scan_time / 1440.;
+  msg->range_min = 0.1;
+  msg->range_max = 30.;
+}
+
+sensor_msgs::LaserScan::Ptr CreateHokuyoLaserScan() {
+  std::mt19937 prng(42);
+  auto msg = boost::make_shared<sensor_msgs::LaserScan>();
+  SetHokuyoGeometry(msg.get());
+  for (int i = 0; i < 1081; ++i) {
+    msg->ranges.push_back(RandomRange(&prng));
+    msg->intensities.push_back(1000.f);
+  }
+  return msg;
+}
+
+sensor_msgs::MultiEchoLaserScan CreateHokuyoMultiEchoLaserScan() {
+  std::mt19937 prng(42);
+  sensor_msgs::MultiEchoLaserScan msg;
+  SetHokuyoGeometry(&msg);
+  for (int i = 0; i < 1081; ++i) {
+    sensor_msgs::LaserEcho ranges;
+    sensor_msgs::LaserEcho intensities;
+    for (int echo = 0; echo < 3; ++echo) {
+      ranges.echoes.push_back(RandomRange(&prng));
+      intensities.echoes.push_back(1000.f);
+    }
+    msg.ranges.push_back(ranges);
+    msg.intensities.push_back(intensities);
+  }
+  return msg;
+}
+
+// A spinning lidar with 'num_beams' beams at 10 Hz, as published by the
+// Velodyne and Ouster drivers, with per-point time.
+sensor_msgs::PointCloud2 CreateLidarPointCloud2(const int num_beams) {
+  const int num_columns = num_beams <= 16 ? 1800 : 131072 / num_beams;
+  std::mt19937 prng(42);
+  sensor_msgs::PointCloud2 msg;
+  msg.header.stamp = kStartTime;
+  msg.header.frame_id = kLaserFrame;
+  sensor_msgs::PointCloud2Modifier modifier(msg);
+  modifier.setPointCloud2Fields(
+      5, "x", 1, sensor_msgs::PointField::FLOAT32, "y", 1,
+      sensor_msgs::PointField::FLOAT32, "z", 1,
+      sensor_msgs::PointField::FLOAT32, "intensity", 1,
+      sensor_msgs::PointField::FLOAT32, "time", 1,
+      sensor_msgs::PointField::FLOAT32);
+  modifier.resize(num_beams * num_columns);
+  sensor_msgs::PointCloud2Iterator<float> iter_x(msg, "x");
+  sensor_msgs::PointCloud2Iterator<float> iter_intensity(msg, "intensity");
+  sensor_msgs::PointCloud2Iterator<float> iter_time(msg, "time");
+  for (int column = 0; column < num_columns; ++column) {
+    const float azimuth = 2.f * M_PI * column / num_columns;
+    for (int beam = 0; beam < num_beams; ++beam) {
+      const float elevation = 0.4f * beam / num_beams - 0.2f;
+      const float range = RandomRange(&prng);
+      iter_x[0] = range * std::cos(elevation) * std::cos(azimuth);
+      iter_x[1] = range * std::cos(elevation) * std::sin(azimuth);
+      iter_x[2] = range * std::sin(elevation);
+      *iter_intensity = 100.f;
+      *iter_time = 0.1f * (column - num_columns) / num_columns;
+      ++iter_x;
+      ++iter_intensity;
+      ++iter_time;
+    }
+  }
+  return msg;
+}
+
+// An IMU at 400 Hz.
+sensor_msgs::Imu::Ptr CreateImu() {
+  auto msg = boost::make_shared<sensor_msgs::Imu>();
+  msg->header.stamp = kStartTime;
+  msg->header.frame_id = kImuFrame;
+  msg->orientation.w = 1.;
+  msg->linear_acceleration.z = 9.81;
+  msg->angular_velocity.z = 0.1;
+  return msg;
+}
+
+geometry_msgs::TransformStamped CreateTransform(const std::string& parent,
+                                                const std::string& child,
+                                                const ::ros::Time& stamp,
+                                                const double x) {
+  geometry_msgs::TransformStamped transform;
+  transform.header.frame_id = parent;
+  transform.header.stamp = stamp;
+  transform.child_frame_id = child;
+  transform.transform = ToGeometryMsgTransform(
+      carto::transform::Rigid3d::Translation(Eigen::Vector3d(x, 0., 0.)));
+  return transform;
+}
+
+// Static laser and IMU frames, and odometry at 100 Hz over 100 s.
+void AddTransforms(OfflineTransformStore* store) {
+  store->SetTransform(
+      CreateTransform(kTrackingFrame, kLaserFrame, ::ros::Time(0.), 0.2),
+      true /* is_static */);
+  store->SetTransform(
+      CreateTransform(kTrackingFrame, kImuFrame, ::ros::Time(0.), 0.1),
+      true /* is_static */);
+  for (int i = 0; i <= 10000; ++i) {
+    store->SetTransform(
+        CreateTransform(kOdomFrame, kTrackingFrame,
+                        kStartTime + ::ros::Duration(0.01 * i), 0.01 * i),
+        false /* is_static */);
+  }
+}
+
+// Discards the sensor data after touching it.
+class NullTrajectoryBuilder
+    : public carto::mapping::TrajectoryBuilderInterface {
+ public:
+  void AddSensorData(
+      const std::string& sensor_id,
+      const carto::sensor::TimedPointCloudData& timed_point_cloud_data)
+      override {
+    benchmark::DoNotOptimize(timed_point_cloud_data.ranges.data());
+  }
+  void AddSensorData(const std::string& sensor_id,
+                     const carto::sensor::ImuData& imu_data) override {
+    benchmark::DoNotOptimize(imu_data.time);
+  }
+  void AddSensorData(
+      const std::string& sensor_id,
+      const carto::sensor::OdometryData& odometry_data) override {}
+  void AddSensorData(
+      const std::string& sensor_id,
+      const carto::sensor::FixedFramePoseData& fixed_frame_pose) override {}
+  void AddSensorData(
+      const std::string& sensor_id,
+      const carto::sensor::LandmarkData& landmark_data) override {}
+  void AddLocalSlamResultData(
+      std::unique_ptr<carto::mapping::LocalSlamResultData>
+          local_slam_result_data) override {}
+};
+
+void BM_LaserScanToPointCloud(benchmark::State& state) {
+  const sensor_msgs::LaserScan::Ptr msg = CreateHokuyoLaserScan();
+  Counters counters(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ToPointCloudWithIntensities(*msg));
+  }
+  counters.Stop(msg->ranges.size());
+}
+BENCHMARK(BM_LaserScanToPointCloud);
+
+void BM_LaserScanToPointCloudWithAngleTable(benchmark::State& state) {
+  const sensor_msgs::LaserScan::Ptr msg = CreateHokuyoLaserScan();
+  const LaserScanAngleTable table = ComputeLaserScanAngleTable(*msg);
+  Counters counters(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ToPointCloudWithIntensities(*msg, table));
+  }
+  counters.Stop(msg->ranges.size());
+}
+BENCHMARK(BM_LaserScanToPointCloudWithAngleTable);
+
+void BM_MultiEchoLaserScanToPointCloud(benchmark::State& state) {
+  const sensor_msgs::MultiEchoLaserScan msg = CreateHokuyoMultiEchoLaserScan();
+  const LaserScanAngleTable table = ComputeLaserScanAngleTable(msg);
+  Counters counters(&state);
+  for (auto _ : state) {
+    if (state.range(0)) {
+      benchmark::DoNotOptimize(ToPointCloudWithIntensities(msg, table));
+    } else {
+      benchmark::DoNotOptimize(ToPointCloudWithIntensities(msg));
+    }
+  }
+  counters.Stop(msg.ranges.size());
+}
+BENCHMARK(BM_MultiEchoLaserScanToPointCloud)
+    ->ArgName("with_angle_table")
+    ->Arg(0)
+    ->Arg(1);
+
+void BM_PointCloud2ToPointCloud(benchmark::State& state) {
+  const sensor_msgs::PointCloud2 msg = CreateLidarPointCloud2(state.range(0));
+  const PointCloud2Layout layout = ComputePointCloud2Layout(msg);
+  Counters counters(&state);
+  for (auto _ : state) {
+    if (state.range(1)) {
+      benchmark::DoNotOptimize(ToPointCloudWithIntensities(msg, layout));
+    } else {
+      benchmark::DoNotOptimize(ToPointCloudWithIntensities(msg));
+    }
+  }
+  counters.Stop(msg.width * msg.height);
+}
+BENCHMARK(BM_PointCloud2ToPointCloud)
+    ->ArgNames({"beams", "with_layout"})
+    ->Args({16, 0})
+    ->Args({16, 1})
+    ->Args({64, 0})
+    ->Args({64, 1})
+    ->Args({128, 0})
+    ->Args({128, 1});
+
+void BM_ToPointCloud2Message(benchmark::State& state) {
+  const carto::sensor::PointCloudWithIntensities point_cloud =
+      std::get<0>(ToPointCloudWithIntensities(
+          CreateLidarPointCloud2(state.range(0))));
+  const int64_t timestamp = carto::common::ToUniversal(FromRos(kStartTime));
+  Counters counters(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        ToPointCloud2Message(timestamp, kTrackingFrame, point_cloud.points));
+  }
+  counters.Stop(point_cloud.points.size());
+}
+BENCHMARK(BM_ToPointCloud2Message)
+    ->ArgName("beams")
+    ->Arg(16)
+    ->Arg(64)
+    ->Arg(128);
+
+void BM_ToImuData(benchmark::State& state) {
+  OfflineTransformStore store;
+  AddTransforms(&store);
+  NullTrajectoryBuilder trajectory_builder;
+  SensorBridge sensor_bridge(1, kTrackingFrame, 0. /* timeout */, &store,
+                             &trajectory_builder, nullptr /* thread_pool */);
+  const sensor_msgs::Imu::Ptr msg = CreateImu();
+  Counters counters(&state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sensor_bridge.ToImuData(msg));
+  }
+  counters.Stop(0);
+}
+BENCHMARK(BM_ToImuData);
+
+void BM_HandleLaserScanMessage(benchmark::State& state) {
+  OfflineTransformStore store;
+  AddTransforms(&store);
+  NullTrajectoryBuilder trajectory_builder;
+  SensorBridge sensor_bridge(state.range(0), kTrackingFrame, 0. /* timeout */,
+                             &store, &trajectory_builder,
+                             nullptr /* thread_pool */);
+  const sensor_msgs::LaserScan::Ptr msg = CreateHokuyoLaserScan();
+  Counters counters(&state);
+  for (auto _ : state) {
+    // Subdivisions must not go back in time.
+    msg->header.stamp += ::ros::Duration(msg->scan_time);
+    sensor_bridge.HandleLaserScanMessage("scan", msg);
+  }
+  counters.Stop(msg->ranges.size());
+}
+BENCHMARK(BM_HandleLaserScanMessage)
+    ->ArgName("subdivisions")
+    ->Arg(1)
+    ->Arg(10);
+
+void BM_LookupToTracking(benchmark::State& state) {
+  OfflineTransformStore store;
+  AddTransforms(&store);
+  // Static frames are cached, dynamic ones are interpolated for every new
+  // time.
+  const bool dynamic = state.range(0);
+  const TfBridge tf_bridge(dynamic ? kOdomFrame : kTrackingFrame,
+                           0. /* timeout */, &store);
+  int64_t i = 0;
+  Counters counters(&state);
+  for (auto _ : state) {
+    const carto::common::Time time = FromRos(
+        kStartTime + ::ros::Duration(1e-3 * (++i % 100000)));
+    benchmark::DoNotOptimize(tf_bridge.LookupToTracking(time, kLaserFrame));
+  }
+  counters.Stop(0);
+}
+BENCHMARK(BM_LookupToTracking)->ArgName("dynamic")->Arg(0)->Arg(1);
+
+}  // namespace
+}  // namespace cartographer_ros
+
+BENCHMARK_MAIN();
@@ -17,6 +17,7 @@
 #include "cartographer_ros/msg_conversion.h"
 
 #include <cmath>
+#include <cstring>
 #include <random>
 
 #include "cartographer/transform/rigid_transform_test_helpers.h"
@@ -24,6 +25,9 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "sensor_msgs/LaserScan.h"
+#include "sensor_msgs/MultiEchoLaserScan.h"
+#include "sensor_msgs/PointCloud2.h"
+#include "sensor_msgs/PointField.h"
 
 namespace cartographer_ros {
 namespace {
@@ -96,6 +100,174 @@ TEST(MsgConversion, LaserScanToPointCloudWithInfinityAndNaN) {
   EXPECT_NEAR(point_cloud[1].time, 0.f, kEps);
 }
 
+TEST(MsgConversion, MultiEchoLaserScanToPointCloudWithAngleTable) {
+  sensor_msgs::MultiEchoLaserScan laser_scan;
+  for (int i = 0; i < 4; ++i) {
+    sensor_msgs::LaserEcho echo;
+    if (i != 1) {
+      echo.echoes.push_back(1.f + i);
+    }
+    laser_scan.ranges.push_back(echo);
+  }
+  laser_scan.angle_min = 0.f;
+  laser_scan.angle_max = 3.f * static_cast<float>(M_PI_2);
+  laser_scan.angle_increment = static_cast<float>(M_PI_2);
+  laser_scan.time_increment = 0.1f;
+  laser_scan.range_min = 0.f;
+  laser_scan.range_max = 10.f;
+
+  const LaserScanAngleTable table = ComputeLaserScanAngleTable(laser_scan);
+  EXPECT_TRUE(HasLaserScanAngleTable(laser_scan, table));
+  const auto point_cloud =
+      std::get<0>(ToPointCloudWithIntensities(laser_scan, table)).points;
+  ASSERT_EQ(3, point_cloud.size());
+  EXPECT_TRUE(
+      point_cloud[0].position.isApprox(Eigen::Vector3f(1.f, 0.f, 0.f), kEps));
+  EXPECT_TRUE(
+      point_cloud[1].position.isApprox(Eigen::Vector3f(-3.f, 0.f, 0.f), kEps));
+  EXPECT_TRUE(
+      point_cloud[2].position.isApprox(Eigen::Vector3f(0.f, -4.f, 0.f), kEps));
+  EXPECT_NEAR(point_cloud[0].time, -0.3f, kEps);
+  EXPECT_NEAR(point_cloud[1].time, -0.1f, kEps);
+  EXPECT_NEAR(point_cloud[2].time, 0.f, kEps);
+
+  laser_scan.angle_increment = static_cast<float>(M_PI_4);
+  EXPECT_FALSE(HasLaserScanAngleTable(laser_scan, table));
+}
+
+sensor_msgs::PointField MakePointField(const std::string& name,
+                                       const uint32_t offset,
+                                       const uint8_t datatype) {
+  sensor_msgs::PointField field;
+  field.name = name;
+  field.offset = offset;
+  field.datatype = datatype;
+  field.count = 1;
+  return field;
+}
+
+template <typename T>
+void WriteAt(const T value, const size_t offset,
+             sensor_msgs::PointCloud2* const msg) {
+  std::memcpy(msg->data.data() + offset, &value, sizeof(T));
+}
+
+TEST(MsgConversion, PointCloud2WithFloat32Fields) {
+  sensor_msgs::PointCloud2 msg;
+  msg.header.stamp.fromSec(10);
+  msg.height = 1;
+  msg.width = 2;
+  msg.point_step = 32;
+  msg.row_step = msg.width * msg.point_step;
+  msg.fields = {MakePointField("x", 0, sensor_msgs::PointField::FLOAT32),
+                MakePointField("y", 4, sensor_msgs::PointField::FLOAT32),
+                MakePointField("z", 8, sensor_msgs::PointField::FLOAT32),
+                MakePointField("intensity", 16,
+                               sensor_msgs::PointField::FLOAT32),
+                MakePointField("time", 20, sensor_msgs::PointField::FLOAT32)};
+  msg.data.resize(msg.row_step);
+  for (int i = 0; i < 2; ++i) {
+    const size_t point = i * msg.point_step;
+    WriteAt(1.f + i, point + 0, &msg);
+    WriteAt(2.f + i, point + 4, &msg);
+    WriteAt(3.f + i, point + 8, &msg);
+    WriteAt(10.f * i, point + 16, &msg);
+    WriteAt(0.5f * i, point + 20, &msg);
+  }
+
+  const PointCloud2Layout layout = ComputePointCloud2Layout(msg);
+  EXPECT_TRUE(layout.all_float32);
+  EXPECT_TRUE(HasPointCloud2Layout(msg, layout));
+  const auto result = ToPointCloudWithIntensities(msg, layout);
+  const auto& point_cloud = std::get<0>(result);
+  ASSERT_EQ(2, point_cloud.points.size());
+  EXPECT_TRUE(point_cloud.points[0].position.isApprox(
+      Eigen::Vector3f(1.f, 2.f, 3.f), kEps));
+  EXPECT_TRUE(point_cloud.points[1].position.isApprox(
+      Eigen::Vector3f(2.f, 3.f, 4.f), kEps));
+  EXPECT_NEAR(point_cloud.points[0].time, -0.5f, kEps);
+  EXPECT_NEAR(point_cloud.points[1].time, 0.f, kEps);
+  EXPECT_THAT(point_cloud.intensities, ElementsAre(0.f, 10.f));
+  EXPECT_EQ(std::get<1>(result),
+            FromRos(msg.header.stamp) +
+                ::cartographer::common::FromSeconds(0.5));
+
+  msg.fields.pop_back();
+  EXPECT_FALSE(HasPointCloud2Layout(msg, layout));
+}
+
+TEST(MsgConversion, PointCloud2WithMixedFields) {
+  sensor_msgs::PointCloud2 msg;
+  msg.height = 1;
+  msg.width = 2;
+  msg.point_step = 24;
+  msg.row_step = msg.width * msg.point_step;
+  msg.fields = {MakePointField("x", 0, sensor_msgs::PointField::FLOAT32),
+                MakePointField("y", 4, sensor_msgs::PointField::FLOAT32),
+                MakePointField("z", 8, sensor_msgs::PointField::FLOAT32),
+                MakePointField("t", 12, sensor_msgs::PointField::UINT32),
+                MakePointField("intensity", 16,
+                               sensor_msgs::PointField::UINT16)};
+  msg.data.resize(msg.row_step);
+  for (int i = 0; i < 2; ++i) {
+    const size_t point = i * msg.point_step;
+    WriteAt(1.f, point + 0, &msg);
+    WriteAt(0.f, point + 4, &msg);
+    WriteAt(0.f, point + 8, &msg);
+    WriteAt(static_cast<uint32_t>(i * 100000000), point + 12, &msg);
+    WriteAt(static_cast<uint16_t>(7 + i), point + 16, &msg);
+  }
+
+  const PointCloud2Layout layout = ComputePointCloud2Layout(msg);
+  EXPECT_FALSE(layout.all_float32);
+  const auto point_cloud = std::get<0>(ToPointCloudWithIntensities(msg));
+  ASSERT_EQ(2, point_cloud.points.size());
+  EXPECT_NEAR(point_cloud.points[0].time, -0.1f, kEps);
+  EXPECT_NEAR(point_cloud.points[1].time, 0.f, kEps);
+  EXPECT_THAT(point_cloud.intensities, ElementsAre(7.f, 8.f));
+}
+
+TEST(MsgConversion, TransformedPointCloudToReusedPointCloud2Message) {
+  const ::cartographer::sensor::PointCloud point_cloud(
+      {{Eigen::Vector3f(1.f, 0.f, 0.f)}, {Eigen::Vector3f(0.f, 2.f, 0.f)}});
+  const ::cartographer::transform::Rigid3f transform(
+      Eigen::Vector3f(1.f, 2.f, 3.f),
+      Eigen::Quaternionf(Eigen::AngleAxisf(M_PI_2, Eigen::Vector3f::UnitZ())));
+  sensor_msgs::PointCloud2 msg;
+  msg.data.resize(1000);
+  ToPointCloud2Message(0, "map", point_cloud, transform, &msg);
+  EXPECT_EQ("map", msg.header.frame_id);
+  EXPECT_EQ(2 * msg.point_step, msg.data.size());
+
+  const auto result = std::get<0>(ToPointCloudWithIntensities(msg));
+  ASSERT_EQ(2, result.points.size());
+  EXPECT_TRUE(result.points[0].position.isApprox(
+      Eigen::Vector3f(1.f, 3.f, 3.f), kEps));
+  EXPECT_TRUE(result.points[1].position.isApprox(
+      Eigen::Vector3f(-1.f, 2.f, 3.f), kEps));
+}
+
+TEST(MsgConversion, TransformedPointCloudToCompactPointCloudMessage) {
+  const ::cartographer::sensor::PointCloud point_cloud(
+      {{Eigen::Vector3f(1.f, 0.f, 0.f)},
+       {Eigen::Vector3f(0.f, 2.f, 0.f)},
+       {Eigen::Vector3f(1000.f, 0.f, 0.f)}});
+  const ::cartographer::transform::Rigid3f transform(
+      Eigen::Vector3f(1.f, 2.f, 3.f),
+      Eigen::Quaternionf(Eigen::AngleAxisf(M_PI_2, Eigen::Vector3f::UnitZ())));
+  cartographer_ros_msgs::CompactPointCloud msg;
+  ToCompactPointCloudMessage(0, "map", point_cloud, transform,
+                             Eigen::Vector3d(1., 2., 0.), 0.01, &msg);
+  EXPECT_EQ("map", msg.header.frame_id);
+  // The last point is too far from the origin and dropped.
+  EXPECT_THAT(msg.coordinates, ElementsAre(0, 100, 300, -200, 0, 300));
+
+  const auto points = FromCompactPointCloudMessage(msg);
+  ASSERT_EQ(2, points.size());
+  EXPECT_TRUE(points[0].isApprox(Eigen::Vector3f(1.f, 3.f, 3.f), kEps));
+  EXPECT_TRUE(points[1].isApprox(Eigen::Vector3f(-1.f, 2.f, 3.f), kEps));
+}
+
 ::testing::Matcher<const LandmarkObservation&> EqualsLandmark(
     const LandmarkObservation& expected) {
   return ::testing::AllOf(
@@ -209,5 +381,24 @@ TEST(MsgConversion, ComputeLocalFrameFromLatLong) {
   }
 }
 
+TEST(MsgConversion, DownsampleOccupancyGrid) {
+  nav_msgs::OccupancyGrid occupancy_grid;
+  occupancy_grid.info.resolution = 0.05;
+  occupancy_grid.info.width = 3;
+  occupancy_grid.info.height = 2;
+  occupancy_grid.info.origin.position.x = 1.;
+  occupancy_grid.data = {0, 70, -1, 20, -1, -1};
+  const auto downsampled = DownsampleOccupancyGrid(occupancy_grid, 2);
+  EXPECT_NEAR(0.1, downsampled->info.resolution, kEps);
+  EXPECT_EQ(2u, downsampled->info.width);
+  EXPECT_EQ(1u, downsampled->info.height);
+  EXPECT_EQ(1., downsampled->info.origin.position.x);
+  EXPECT_THAT(downsampled->data, ElementsAre(70, -1));
+}
+
+TEST(MsgConversion, ComputeDownsamplingFactors) {
+  EXPECT_THAT(ComputeDownsamplingFactors(0.05, {0.2, 1.}), ElementsAre(4, 20));
+}
+
 }  // namespace
 }  // namespace cartographer_ros
@@ -29,11 +29,17 @@
 #include "cartographer/common/time.h"
 #include "cartographer/mapping/pose_graph_interface.h"
 #include "cartographer/mapping/proto/submap_visualization.pb.h"
+#include "cartographer/metrics/counter.h"
+#include "cartographer/metrics/gauge.h"
+#include "cartographer/metrics/histogram.h"
 #include "cartographer/metrics/register.h"
 #include "cartographer/sensor/point_cloud.h"
 #include "cartographer/transform/rigid_transform.h"
 #include "cartographer/transform/transform.h"
 #include "cartographer_ros/metrics/family_factory.h"
+#include "cartographer_ros/metrics/latency.h"
+#include "cartographer_ros/metrics/startup_timing.h"
+#include "cartographer_ros/metrics/trajectory_accounting.h"
 #include "cartographer_ros/msg_conversion.h"
 #include "cartographer_ros/sensor_bridge.h"
 #include "cartographer_ros/tf_bridge.h"
@@ -57,21 +63,95 @@ using TrajectoryState =
     ::cartographer::mapping::PoseGraphInterface::TrajectoryState;
 
 namespace {
+
+// How often the pose to warm start from is written, if enabled.
+constexpr double kWarmStartPoseWritePeriodSec = 1.;
+
+// Every this many messages on the metrics topic contain all metric families.
+constexpr int kFullMetricsMessagePeriod = 10;
+
+// Quantization of the compact scan matched point clouds. Points up to about
+// 327 m away from the tracking frame can be represented.
+constexpr double kCompactPointCloudResolution = 0.01;
+
+// Registered in the constructor if metrics are collected.
+carto::metrics::Histogram* kPosePublishJitterMetric =
+    carto::metrics::Histogram::Null();
+carto::metrics::Histogram* kPosePublishLatencyMetric =
+    carto::metrics::Histogram::Null();
+carto::metrics::Counter* kPosePublishSkippedMetric =
+    carto::metrics::Counter::Null();
+carto::metrics::Family<carto::metrics::Gauge>* kSensorSamplingRatioMetric =
+    nullptr;
+
+void RegisterPosePublisherMetrics(carto::metrics::FamilyFactory* factory) {
+  // From 0.1 ms to about 1 s.
+  const auto boundaries =
+      carto::metrics::Histogram::ScaledPowersOf(2, 1e-4, 1.);
+  kPosePublishJitterMetric =
+      factory
+          ->NewHistogramFamily(
+              "cartographer_ros_pose_publish_jitter",
+              "Delay in seconds of pose publishing behind its schedule",
+              boundaries)
+          ->Add({});
+  kPosePublishLatencyMetric =
+      factory
+          ->NewHistogramFamily(
+              "cartographer_ros_pose_publish_latency",
+              "Wall time in seconds it takes to publish the poses", boundaries)
+          ->Add({});
+  kPosePublishSkippedMetric =
+      factory
+          ->NewCounterFamily("cartographer_ros_pose_publish_skipped",
+                             "Pose publishing skipped while the set of "
+                             "trajectories was changing")
+          ->Add({});
+}
+
+void RegisterSensorSamplingMetrics(carto::metrics::FamilyFactory* factory) {
+  kSensorSamplingRatioMetric = factory->NewGaugeFamily(
+      "cartographer_ros_sensor_sampling_ratio",
+      "Ratio of the sensor messages of a trajectory handed to SLAM");
+}
+
 // Subscribes to the 'topic' for 'trajectory_id' using the 'node_handle' and
-// calls 'handler' on the 'node' to handle messages. Returns the subscriber.
+// calls 'handler' on the 'node' to handle messages from the 'callback_queue'.
+// Returns the subscriber.
 template <typename MessageType>
 ::ros::Subscriber SubscribeWithHandler(
     void (Node::*handler)(int, const std::string&,
                           const typename MessageType::ConstPtr&),
     const int trajectory_id, const std::string& topic,
+    ::ros::CallbackQueue* const callback_queue,
     ::ros::NodeHandle* const node_handle, Node* const node) {
-  return node_handle->subscribe<MessageType>(
+  ::ros::SubscribeOptions options;
+  options.init<MessageType>(
       topic, kInfiniteSubscriberQueueSize,
       boost::function<void(const typename MessageType::ConstPtr&)>(
           [node, handler, trajectory_id,
            topic](const typename MessageType::ConstPtr& msg) {
             (node->*handler)(trajectory_id, topic, msg);
           }));
+  options.callback_queue = callback_queue;
+  return node_handle->subscribe(options);
+}
+
+// Advertises the 'service' using the 'node_handle' and calls 'handler' on the
+// 'node' to handle requests from the 'callback_queue'. Returns the server.
+template <typename Request, typename Response>
+::ros::ServiceServer AdvertiseServiceWithHandler(
+    bool (Node::*handler)(Request&, Response&), const std::string& service,
+    ::ros::CallbackQueue* const callback_queue,
+    ::ros::NodeHandle* const node_handle, Node* const node) {
+  ::ros::AdvertiseServiceOptions options;
+  options.init<Request, Response>(
+      service, boost::function<bool(Request&, Response&)>(
+                   [node, handler](Request& request, Response& response) {
+                     return (node->*handler)(request, response);
+                   }));
+  options.callback_queue = callback_queue;
+  return node_handle->advertiseService(options);
 }
 
 std::string TrajectoryStateToString(const TrajectoryState trajectory_state) {
@@ -93,24 +173,57 @@ std::string TrajectoryStateToString(const TrajectoryState trajectory_state) {
 Node::Node(
     const NodeOptions& node_options,
     std::unique_ptr<cartographer::mapping::MapBuilderInterface> map_builder,
-    tf2_ros::Buffer* const tf_buffer, const bool collect_metrics)
+    tf2_ros::BufferInterface* const tf_buffer, const bool collect_metrics,
+    ThreadGroups* const thread_groups, const ::ros::NodeHandle& node_handle)
     : node_options_(node_options),
-      map_builder_bridge_(node_options_, std::move(map_builder), tf_buffer) {
+      thread_groups_(thread_groups),
+      map_builder_bridge_(node_options_, std::move(map_builder), tf_buffer),
+      node_handle_(node_handle),
+      async_state_writer_(
+          [this](const cartographer_ros_msgs::WriteStateStatus& status) {
+            write_state_status_publisher_.publish(status);
+          }),
+      flight_recorder_(node_options_.flight_recorder_num_messages,
+                       [this](const std::string& topic) {
+                         return node_handle_.resolveName(topic, false);
+                       }) {
   absl::MutexLock lock(&mutex_);
   if (collect_metrics) {
     metrics_registry_ = absl::make_unique<metrics::FamilyFactory>();
     carto::metrics::RegisterAllMetrics(metrics_registry_.get());
+    RegisterPosePublisherMetrics(metrics_registry_.get());
+    RegisterSensorSamplingMetrics(metrics_registry_.get());
+    metrics::RegisterLatencyMetrics(metrics_registry_.get());
+    metrics::RegisterTrajectoryAccountingMetrics(metrics_registry_.get());
+    metrics::RegisterStartupTimingMetrics(metrics_registry_.get());
+    thread_groups_->RegisterMetrics(metrics_registry_.get());
+    RegisterSensorDataBatcherMetrics(metrics_registry_.get());
   }
 
   submap_list_publisher_ =
       node_handle_.advertise<::cartographer_ros_msgs::SubmapList>(
           kSubmapListTopic, kLatestOnlyPublisherQueueSize);
+  submap_list_update_publisher_ =
+      node_handle_.advertise<::cartographer_ros_msgs::SubmapListUpdate>(
+          kSubmapListUpdatesTopic, kSubmapListUpdatesQueueSize,
+          [this](const ::ros::SingleSubscriberPublisher&) {
+            // New subscribers need all submaps.
+            publish_full_submap_list_ = true;
+          });
   trajectory_node_list_publisher_ =
       node_handle_.advertise<::visualization_msgs::MarkerArray>(
-          kTrajectoryNodeListTopic, kLatestOnlyPublisherQueueSize);
+          kTrajectoryNodeListTopic, kLatestOnlyPublisherQueueSize,
+          [this](const ::ros::SingleSubscriberPublisher&) {
+            // New subscribers need all markers.
+            publish_full_trajectory_node_list_ = true;
+          });
   landmark_poses_list_publisher_ =
       node_handle_.advertise<::visualization_msgs::MarkerArray>(
-          kLandmarkPosesListTopic, kLatestOnlyPublisherQueueSize);
+          kLandmarkPosesListTopic, kLatestOnlyPublisherQueueSize,
+          [this](const ::ros::SingleSubscriberPublisher&) {
+            // New subscribers need all markers.
+            publish_full_landmark_poses_list_ = true;
+          });
   constraint_list_publisher_ =
       node_handle_.advertise<::visualization_msgs::MarkerArray>(
           kConstraintListTopic, kLatestOnlyPublisherQueueSize);
@@ -119,60 +232,174 @@ Node::Node(
         node_handle_.advertise<::geometry_msgs::PoseStamped>(
             kTrackedPoseTopic, kLatestOnlyPublisherQueueSize);
   }
-  service_servers_.push_back(node_handle_.advertiseService(
-      kSubmapQueryServiceName, &Node::HandleSubmapQuery, this));
-  service_servers_.push_back(node_handle_.advertiseService(
-      kTrajectoryQueryServiceName, &Node::HandleTrajectoryQuery, this));
-  service_servers_.push_back(node_handle_.advertiseService(
-      kStartTrajectoryServiceName, &Node::HandleStartTrajectory, this));
-  service_servers_.push_back(node_handle_.advertiseService(
-      kFinishTrajectoryServiceName, &Node::HandleFinishTrajectory, this));
-  service_servers_.push_back(node_handle_.advertiseService(
-      kWriteStateServiceName, &Node::HandleWriteState, this));
-  service_servers_.push_back(node_handle_.advertiseService(
-      kGetTrajectoryStatesServiceName, &Node::HandleGetTrajectoryStates, this));
-  service_servers_.push_back(node_handle_.advertiseService(
-      kReadMetricsServiceName, &Node::HandleReadMetrics, this));
+  if (metrics_registry_ && node_options_.metrics_publish_period_sec > 0) {
+    metrics_publisher_ =
+        node_handle_.advertise<::cartographer_ros_msgs::MetricFamilies>(
+            kMetricsTopic, kMetricsQueueSize,
+            [this](const ::ros::SingleSubscriberPublisher&) {
+              // New subscribers need all metric families.
+              publish_all_metrics_ = true;
+            });
+  }
+  write_state_status_publisher_ =
+      node_handle_.advertise<::cartographer_ros_msgs::WriteStateStatus>(
+          kWriteStateStatusTopic, kLatestOnlyPublisherQueueSize,
+          true /* latch */);
+  range_data_callback_queue_ =
+      StartCallbackQueue(node_options_.num_range_data_callback_threads,
+                         kSensorIngestionThreadGroup);
+  sensor_callback_queue_ =
+      StartCallbackQueue(node_options_.num_sensor_callback_threads,
+                         kSensorIngestionThreadGroup);
+  service_callback_queue_ =
+      StartCallbackQueue(node_options_.num_service_callback_threads,
+                         kVisualizationThreadGroup);
+  service_servers_.push_back(AdvertiseServiceWithHandler(
+      &Node::HandleSubmapQuery, kSubmapQueryServiceName,
+      service_callback_queue_, &node_handle_, this));
+  service_servers_.push_back(AdvertiseServiceWithHandler(
+      &Node::HandleBatchSubmapQuery, kBatchSubmapQueryServiceName,
+      service_callback_queue_, &node_handle_, this));
+  service_servers_.push_back(AdvertiseServiceWithHandler(
+      &Node::HandleTrajectoryQuery, kTrajectoryQueryServiceName,
+      service_callback_queue_, &node_handle_, this));
+  service_servers_.push_back(AdvertiseServiceWithHandler(
+      &Node::HandleStartTrajectory, kStartTrajectoryServiceName,
+      service_callback_queue_, &node_handle_, this));
+  service_servers_.push_back(AdvertiseServiceWithHandler(
+      &Node::HandleFinishTrajectory, kFinishTrajectoryServiceName,
+      service_callback_queue_, &node_handle_, this));
+  service_servers_.push_back(AdvertiseServiceWithHandler(
+      &Node::HandleWriteState, kWriteStateServiceName,
+      service_callback_queue_, &node_handle_, this));
+  service_servers_.push_back(AdvertiseServiceWithHandler(
+      &Node::HandleWriteStateAsync, kWriteStateAsyncServiceName,
+      service_callback_queue_, &node_handle_, this));
+  if (flight_recorder_.enabled()) {
+    service_servers_.push_back(AdvertiseServiceWithHandler(
+        &Node::HandleWriteFlightRecording, kWriteFlightRecordingServiceName,
+        service_callback_queue_, &node_handle_, this));
+  }
+  service_servers_.push_back(AdvertiseServiceWithHandler(
+      &Node::HandleGetTrajectoryStates, kGetTrajectoryStatesServiceName,
+      service_callback_queue_, &node_handle_, this));
+  service_servers_.push_back(AdvertiseServiceWithHandler(
+      &Node::HandleReadMetrics, kReadMetricsServiceName,
+      service_callback_queue_, &node_handle_, this));
+  service_servers_.push_back(AdvertiseServiceWithHandler(
+      &Node::HandleResyncSubmapList, kResyncSubmapListServiceName,
+      service_callback_queue_, &node_handle_, this));
 
   scan_matched_point_cloud_publisher_ =
       node_handle_.advertise<sensor_msgs::PointCloud2>(
           kScanMatchedPointCloudTopic, kLatestOnlyPublisherQueueSize);
+  scan_matched_compact_point_cloud_publisher_ =
+      node_handle_.advertise<cartographer_ros_msgs::CompactPointCloud>(
+          kScanMatchedCompactPointCloudTopic, kLatestOnlyPublisherQueueSize);
 
-  wall_timers_.push_back(node_handle_.createWallTimer(
-      ::ros::WallDuration(node_options_.submap_publish_period_sec),
-      &Node::PublishSubmapList, this));
   if (node_options_.pose_publish_period_sec > 0) {
-    publish_local_trajectory_data_timer_ = node_handle_.createTimer(
-        ::ros::Duration(node_options_.pose_publish_period_sec),
-        &Node::PublishLocalTrajectoryData, this);
+    publish_local_trajectory_data_timer_ =
+        node_handle_.createTimer(::ros::TimerOptions(
+            ::ros::Duration(node_options_.pose_publish_period_sec),
+            boost::bind(&Node::PublishLocalTrajectoryData, this, _1),
+            &pose_publisher_queue_));
+    pose_publisher_spinner_ =
+        absl::make_unique<::ros::AsyncSpinner>(1, &pose_publisher_queue_);
+    thread_groups_->Capture(kPosePublishingThreadGroup,
+                            [this]() { pose_publisher_spinner_->start(); });
   }
-  wall_timers_.push_back(node_handle_.createWallTimer(
-      ::ros::WallDuration(node_options_.trajectory_publish_period_sec),
-      &Node::PublishTrajectoryNodeList, this));
-  wall_timers_.push_back(node_handle_.createWallTimer(
-      ::ros::WallDuration(node_options_.trajectory_publish_period_sec),
-      &Node::PublishLandmarkPosesList, this));
-  wall_timers_.push_back(node_handle_.createWallTimer(
-      ::ros::WallDuration(kConstraintPublishPeriodSec),
-      &Node::PublishConstraintList, this));
+
+  const auto has_subscribers = [](const ::ros::Publisher& publisher) {
+    return [&publisher]() { return publisher.getNumSubscribers() > 0; };
+  };
+  publishing_scheduler_.AddTask(
+      kSubmapListTopic, node_options_.submap_publish_period_sec,
+      has_subscribers(submap_list_publisher_),
+      [this]() { PublishSubmapList(); });
+  publishing_scheduler_.AddTask(
+      kSubmapListUpdatesTopic, node_options_.submap_publish_period_sec,
+      has_subscribers(submap_list_update_publisher_),
+      [this]() { PublishSubmapListUpdate(); });
+  publishing_scheduler_.AddTask(
+      kTrajectoryNodeListTopic, node_options_.trajectory_publish_period_sec,
+      has_subscribers(trajectory_node_list_publisher_),
+      [this]() { PublishTrajectoryNodeList(); });
+  publishing_scheduler_.AddTask(
+      kLandmarkPosesListTopic, node_options_.trajectory_publish_period_sec,
+      has_subscribers(landmark_poses_list_publisher_),
+      [this]() { PublishLandmarkPosesList(); });
+  publishing_scheduler_.AddTask(
+      kConstraintListTopic, kConstraintPublishPeriodSec,
+      has_subscribers(constraint_list_publisher_),
+      [this]() { PublishConstraintList(); });
+  if (metrics_publisher_) {
+    publishing_scheduler_.AddTask(
+        kMetricsTopic, node_options_.metrics_publish_period_sec,
+        has_subscribers(metrics_publisher_), [this]() { PublishMetrics(); });
+  }
+  thread_groups_->Capture(kVisualizationThreadGroup,
+                          [this]() { publishing_scheduler_.Start(); });
 }
 
-Node::~Node() { FinishAllTrajectories(); }
+Node::~Node() {
+  // No callbacks may run while the node is destroyed.
+  for (auto& spinner : callback_spinners_) {
+    spinner->stop();
+  }
+  FinishAllTrajectories();
+}
 
 ::ros::NodeHandle* Node::node_handle() { return &node_handle_; }
 
+::ros::CallbackQueue* Node::StartCallbackQueue(
+    const int num_threads, const std::string& thread_group) {
+  if (num_threads == 0) {
+    return nullptr;
+  }
+  callback_queues_.push_back(absl::make_unique<::ros::CallbackQueue>());
+  callback_spinners_.push_back(absl::make_unique<::ros::AsyncSpinner>(
+      num_threads, callback_queues_.back().get()));
+  thread_groups_->Capture(thread_group,
+                          [this]() { callback_spinners_.back()->start(); });
+  return callback_queues_.back().get();
+}
+
+std::vector<cartographer_ros_msgs::MetricFamily> Node::ReadMetrics() {
+  if (!metrics_registry_) {
+    return {};
+  }
+  thread_groups_->UpdateMetrics();
+  ::cartographer_ros_msgs::ReadMetrics::Response response;
+  metrics_registry_->ReadMetrics(&response);
+  return response.metric_families;
+}
+
+RangeDataBackpressure* Node::EnableRangeDataBackpressure() {
+  absl::MutexLock lock(&mutex_);
+  range_data_backpressure_enabled_ = true;
+  return map_builder_bridge_.range_data_backpressure();
+}
+
 bool Node::HandleSubmapQuery(
     ::cartographer_ros_msgs::SubmapQuery::Request& request,
     ::cartographer_ros_msgs::SubmapQuery::Response& response) {
-  absl::MutexLock lock(&mutex_);
+  absl::ReaderMutexLock lock(&mutex_);
   map_builder_bridge_.HandleSubmapQuery(request, response);
   return true;
 }
 
+bool Node::HandleBatchSubmapQuery(
+    ::cartographer_ros_msgs::BatchSubmapQuery::Request& request,
+    ::cartographer_ros_msgs::BatchSubmapQuery::Response& response) {
+  absl::ReaderMutexLock lock(&mutex_);
+  map_builder_bridge_.HandleBatchSubmapQuery(request, response);
+  return true;
+}
+
 bool Node::HandleTrajectoryQuery(
     ::cartographer_ros_msgs::TrajectoryQuery::Request& request,
     ::cartographer_ros_msgs::TrajectoryQuery::Response& response) {
-  absl::MutexLock lock(&mutex_);
+  absl::ReaderMutexLock lock(&mutex_);
   response.status = TrajectoryStateToStatus(
       request.trajectory_id,
       {TrajectoryState::ACTIVE, TrajectoryState::FINISHED,
@@ -186,77 +413,232 @@ bool Node::HandleTrajectoryQuery(
   return true;
 }
 
-void Node::PublishSubmapList(const ::ros::WallTimerEvent& unused_timer_event) {
-  absl::MutexLock lock(&mutex_);
-  submap_list_publisher_.publish(map_builder_bridge_.GetSubmapList());
+void Node::PublishSubmapList() {
+  cartographer_ros_msgs::SubmapList submap_list;
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    submap_list = map_builder_bridge_.GetSubmapList();
+  }
+  submap_list_publisher_.publish(submap_list);
+}
+
+void Node::PublishSubmapListUpdate() {
+  const bool full = publish_full_submap_list_.exchange(false);
+  cartographer_ros_msgs::SubmapListUpdate submap_list_update;
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    submap_list_update = map_builder_bridge_.GetSubmapListUpdate(full);
+  }
+  submap_list_update_publisher_.publish(submap_list_update);
 }
 
-void Node::AddExtrapolator(const int trajectory_id,
-                           const TrajectoryOptions& options) {
+void Node::AddTrajectoryIngestion(const int trajectory_id,
+                                  const TrajectoryOptions& options) {
   constexpr double kExtrapolationEstimationTimeSec = 0.001;  // 1 ms
-  CHECK(extrapolators_.count(trajectory_id) == 0);
+  CHECK(trajectory_ingestions_.count(trajectory_id) == 0);
   const double gravity_time_constant =
       node_options_.map_builder_options.use_trajectory_builder_3d()
           ? options.trajectory_builder_options.trajectory_builder_3d_options()
                 .imu_gravity_time_constant()
           : options.trajectory_builder_options.trajectory_builder_2d_options()
                 .imu_gravity_time_constant();
-  extrapolators_.emplace(
-      std::piecewise_construct, std::forward_as_tuple(trajectory_id),
-      std::forward_as_tuple(
-          ::cartographer::common::FromSeconds(kExtrapolationEstimationTimeSec),
-          gravity_time_constant));
+  auto ingestion = absl::make_unique<TrajectoryIngestion>(
+      ::cartographer::common::FromSeconds(kExtrapolationEstimationTimeSec),
+      gravity_time_constant, options,
+      map_builder_bridge_.sensor_bridge(trajectory_id));
+  if (kSensorSamplingRatioMetric != nullptr) {
+    const std::string trajectory_label = std::to_string(trajectory_id);
+    const auto add_metric = [&trajectory_label](const std::string& sensor,
+                                                const double ratio) {
+      auto* const metric = kSensorSamplingRatioMetric->Add(
+          {{"trajectory_id", trajectory_label}, {"sensor", sensor}});
+      metric->Set(ratio);
+      return metric;
+    };
+    absl::MutexLock lock(&ingestion->mutex);
+    ingestion->rangefinder_sampling_ratio_metric =
+        add_metric("rangefinder", options.rangefinder_sampling_ratio);
+    add_metric("odometry", options.odometry_sampling_ratio);
+    add_metric("fixed_frame_pose", options.fixed_frame_pose_sampling_ratio);
+    add_metric("imu", options.imu_sampling_ratio);
+    add_metric("landmark", options.landmarks_sampling_ratio);
+  }
+  trajectory_ingestions_.emplace(trajectory_id, std::move(ingestion));
 }
 
-void Node::AddSensorSamplers(const int trajectory_id,
-                             const TrajectoryOptions& options) {
-  CHECK(sensor_samplers_.count(trajectory_id) == 0);
-  sensor_samplers_.emplace(
-      std::piecewise_construct, std::forward_as_tuple(trajectory_id),
-      std::forward_as_tuple(
-          options.rangefinder_sampling_ratio, options.odometry_sampling_ratio,
-          options.fixed_frame_pose_sampling_ratio, options.imu_sampling_ratio,
-          options.landmarks_sampling_ratio));
+Node::TrajectoryIngestion* Node::GetTrajectoryIngestion(
+    const int trajectory_id) {
+  return trajectory_ingestions_.at(trajectory_id).get();
+}
+
+template <typename MessageType>
+bool Node::AddToSensorBatch(const std::string& sensor_id,
+                            const typename MessageType::ConstPtr& msg,
+                            const carto::common::Duration batch_duration,
+                            SensorBatch<MessageType>* const batch) {
+  // There is only one topic per trajectory for each batched sensor type.
+  CHECK(batch->messages.empty() || batch->sensor_id == sensor_id);
+  batch->sensor_id = sensor_id;
+  batch->messages.push_back(msg);
+  return FromRos(msg->header.stamp) -
+             FromRos(batch->messages.front()->header.stamp) >=
+         batch_duration;
+}
+
+void Node::FlushImuBatch(TrajectoryIngestion* const ingestion) {
+  SensorBatch<sensor_msgs::Imu>& batch = ingestion->imu_batch;
+  if (batch.messages.empty()) {
+    return;
+  }
+  const std::vector<carto::sensor::ImuData> imu_data =
+      ingestion->sensor_bridge->ToImuData(batch.messages);
+  batch.messages.clear();
+  {
+    absl::MutexLock extrapolator_lock(&ingestion->extrapolator_mutex);
+    for (const carto::sensor::ImuData& data : imu_data) {
+      ingestion->extrapolator.AddImuData(data);
+    }
+  }
+  metrics::LatencyTimer mutex_wait_timer(metrics::LatencyStage::kMutexWait,
+                                         batch.sensor_id);
+  absl::MutexLockMaybe collator_lock(SharedCollatorMutex());
+  mutex_wait_timer.Stop();
+  ingestion->sensor_bridge->HandleImuData(batch.sensor_id, imu_data);
+}
+
+void Node::FlushOdometryBatch(TrajectoryIngestion* const ingestion) {
+  SensorBatch<nav_msgs::Odometry>& batch = ingestion->odometry_batch;
+  if (batch.messages.empty()) {
+    return;
+  }
+  const std::vector<carto::sensor::OdometryData> odometry_data =
+      ingestion->sensor_bridge->ToOdometryData(batch.messages);
+  batch.messages.clear();
+  {
+    absl::MutexLock extrapolator_lock(&ingestion->extrapolator_mutex);
+    for (const carto::sensor::OdometryData& data : odometry_data) {
+      ingestion->extrapolator.AddOdometryData(data);
+    }
+  }
+  metrics::LatencyTimer mutex_wait_timer(metrics::LatencyStage::kMutexWait,
+                                         batch.sensor_id);
+  absl::MutexLockMaybe collator_lock(SharedCollatorMutex());
+  mutex_wait_timer.Stop();
+  ingestion->sensor_bridge->HandleOdometryData(batch.sensor_id,
+                                               odometry_data);
+}
+
+bool Node::SampleRangeData(const int trajectory_id, const ::ros::Time& time,
+                           TrajectoryIngestion* const ingestion) {
+  RangeDataBackpressure* const backpressure =
+      map_builder_bridge_.range_data_backpressure();
+  AdaptiveSampler& sampler = ingestion->sensor_samplers.rangefinder_sampler;
+  if (ingestion->adapt_rangefinder_sampling &&
+      sampler.Adapt(backpressure->GetNumQueued(trajectory_id),
+                    std::chrono::steady_clock::now())) {
+    LOG(INFO) << "Sampling range data of trajectory " << trajectory_id
+              << " at a ratio of " << sampler.ratio() << ".";
+    ingestion->rangefinder_sampling_ratio_metric->Set(sampler.ratio());
+  }
+  if (!sampler.Pulse()) {
+    return false;
+  }
+  // Nothing drains the queue of data which is never optimized, e.g. with a
+  // remote map builder, so it is only kept if it is used.
+  if (range_data_backpressure_enabled_ ||
+      ingestion->adapt_rangefinder_sampling) {
+    backpressure->AddRangeData(trajectory_id, FromRos(time));
+  }
+  return true;
+}
+
+absl::Mutex* Node::SharedCollatorMutex() {
+  return node_options_.map_builder_options.collate_by_trajectory()
+             ? nullptr
+             : &shared_collator_mutex_;
 }
 
 void Node::PublishLocalTrajectoryData(const ::ros::TimerEvent& timer_event) {
-  absl::MutexLock lock(&mutex_);
+  const auto start_time = std::chrono::steady_clock::now();
+  kPosePublishJitterMetric->Observe(std::max(
+      0., (timer_event.current_real - timer_event.current_expected).toSec()));
+  // Waiting for a writer, e.g. while state is loaded or written, would hold
+  // up pose publishing for an unbounded time. Skip this period instead.
+  if (!mutex_.ReaderTryLock()) {
+    kPosePublishSkippedMetric->Increment();
+    PublishWarmStartPose();
+    return;
+  }
+  PublishLocalTrajectoryDataUnderLock();
+  mutex_.ReaderUnlock();
+  kPosePublishLatencyMetric->Observe(
+      std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                    start_time)
+          .count());
+}
+
+void Node::PublishLocalTrajectoryDataUnderLock() {
+  // The pose of the latest trajectory is the one to warm start from.
+  int latest_trajectory_id = -1;
+  absl::optional<WarmStartPose> latest_pose;
   for (const auto& entry : map_builder_bridge_.GetLocalTrajectoryData()) {
     const auto& trajectory_data = entry.second;
 
-    auto& extrapolator = extrapolators_.at(entry.first);
+    // Take a snapshot of the extrapolated pose, so that the extrapolator is
+    // locked only briefly.
+    TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(entry.first);
+    bool has_new_local_slam_data;
+    ::cartographer::common::Time now;
+    Rigid3d tracking_to_local_3d;
+    {
+      absl::MutexLock extrapolator_lock(&ingestion->extrapolator_mutex);
+      auto& extrapolator = ingestion->extrapolator;
+      has_new_local_slam_data = trajectory_data.local_slam_data->time !=
+                                extrapolator.GetLastPoseTime();
+      if (has_new_local_slam_data) {
+        extrapolator.AddPose(trajectory_data.local_slam_data->time,
+                             trajectory_data.local_slam_data->local_pose);
+      }
+      // If we do not publish a new point cloud, we still allow time of the
+      // published poses to advance. If we already know a newer pose, we use
+      // its time instead. Since tf knows how to interpolate, providing newer
+      // information is better.
+      now = std::max(FromRos(ros::Time::now()),
+                     extrapolator.GetLastExtrapolatedTime());
+      tracking_to_local_3d = node_options_.use_pose_extrapolator
+                                 ? extrapolator.ExtrapolatePose(now)
+                                 : trajectory_data.local_slam_data->local_pose;
+    }
+
     // We only publish a point cloud if it has changed. It is not needed at high
     // frequency, and republishing it would be computationally wasteful.
-    if (trajectory_data.local_slam_data->time !=
-        extrapolator.GetLastPoseTime()) {
+    if (has_new_local_slam_data) {
       if (scan_matched_point_cloud_publisher_.getNumSubscribers() > 0) {
-        // TODO(gaschler): Consider using other message without time
-        // information.
-        carto::sensor::TimedPointCloud point_cloud;
-        point_cloud.reserve(trajectory_data.local_slam_data->range_data_in_local
-                                .returns.size());
-        for (const cartographer::sensor::RangefinderPoint point :
-             trajectory_data.local_slam_data->range_data_in_local.returns) {
-          point_cloud.push_back(cartographer::sensor::ToTimedRangefinderPoint(
-              point, 0.f /* time */));
-        }
-        scan_matched_point_cloud_publisher_.publish(ToPointCloud2Message(
+        ToPointCloud2Message(
+            carto::common::ToUniversal(trajectory_data.local_slam_data->time),
+            node_options_.map_frame,
+            trajectory_data.local_slam_data->range_data_in_local.returns,
+            trajectory_data.local_to_map.cast<float>(),
+            &scan_matched_point_cloud_);
+        // Publishing serializes the message, so it can be reused right away.
+        scan_matched_point_cloud_publisher_.publish(scan_matched_point_cloud_);
+      }
+      if (scan_matched_compact_point_cloud_publisher_.getNumSubscribers() >
+          0) {
+        ToCompactPointCloudMessage(
             carto::common::ToUniversal(trajectory_data.local_slam_data->time),
             node_options_.map_frame,
-            carto::sensor::TransformTimedPointCloud(
-                point_cloud, trajectory_data.local_to_map.cast<float>())));
+            trajectory_data.local_slam_data->range_data_in_local.returns,
+            trajectory_data.local_to_map.cast<float>(),
+            trajectory_data.local_to_map *
+                trajectory_data.local_slam_data->local_pose.translation(),
+            kCompactPointCloudResolution, &scan_matched_compact_point_cloud_);
+        scan_matched_compact_point_cloud_publisher_.publish(
+            scan_matched_compact_point_cloud_);
       }
-      extrapolator.AddPose(trajectory_data.local_slam_data->time,
-                           trajectory_data.local_slam_data->local_pose);
     }
 
     geometry_msgs::TransformStamped stamped_transform;
-    // If we do not publish a new point cloud, we still allow time of the
-    // published poses to advance. If we already know a newer pose, we use its
-    // time instead. Since tf knows how to interpolate, providing newer
-    // information is better.
-    const ::cartographer::common::Time now = std::max(
-        FromRos(ros::Time::now()), extrapolator.GetLastExtrapolatedTime());
     stamped_transform.header.stamp =
         node_options_.use_pose_extrapolator
             ? ToRos(now)
@@ -270,10 +652,6 @@ void Node::PublishLocalTrajectoryData(const ::ros::TimerEvent& timer_event) {
       continue;
     last_published_tf_stamps_[entry.first] = stamped_transform.header.stamp;
 
-    const Rigid3d tracking_to_local_3d =
-        node_options_.use_pose_extrapolator
-            ? extrapolator.ExtrapolatePose(now)
-            : trajectory_data.local_slam_data->local_pose;
     const Rigid3d tracking_to_local = [&] {
       if (trajectory_data.trajectory_options.publish_frame_projected_to_2d) {
         return carto::transform::Embed3D(
@@ -286,6 +664,11 @@ void Node::PublishLocalTrajectoryData(const ::ros::TimerEvent& timer_event) {
         trajectory_data.local_to_map * tracking_to_local;
 
     if (trajectory_data.published_to_tracking != nullptr) {
+      if (entry.first > latest_trajectory_id) {
+        latest_trajectory_id = entry.first;
+        latest_pose = WarmStartPose{tracking_to_map,
+                                    *trajectory_data.published_to_tracking};
+      }
       if (node_options_.publish_to_tf) {
         if (trajectory_data.trajectory_options.provide_odom_frame) {
           std::vector<geometry_msgs::TransformStamped> stamped_transforms;
@@ -324,32 +707,132 @@ void Node::PublishLocalTrajectoryData(const ::ros::TimerEvent& timer_event) {
       }
     }
   }
+  if (latest_pose.has_value()) {
+    HandlePublishedPose(latest_pose.value());
+  } else {
+    PublishWarmStartPose();
+  }
 }
 
-void Node::PublishTrajectoryNodeList(
-    const ::ros::WallTimerEvent& unused_timer_event) {
-  if (trajectory_node_list_publisher_.getNumSubscribers() > 0) {
-    absl::MutexLock lock(&mutex_);
-    trajectory_node_list_publisher_.publish(
-        map_builder_bridge_.GetTrajectoryNodeList());
+void Node::HandlePublishedPose(const WarmStartPose& pose) {
+  absl::MutexLock lock(&startup_mutex_);
+  if (!first_pose_published_) {
+    first_pose_published_ = true;
+    // From now on the trajectory publishes the poses.
+    warm_start_pose_.reset();
+    if (startup_time_.has_value()) {
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() -
+                                 startup_time_.value())
+                                 .count();
+      LOG(INFO) << "Published the first pose " << seconds
+                << " s after starting.";
+      metrics::RecordStartupPhase("first_pose", seconds);
+    }
+  }
+  if (warm_start_pose_writer_ == nullptr) {
+    return;
   }
+  const auto now = std::chrono::steady_clock::now();
+  if (now - last_warm_start_pose_write_time_ <
+      std::chrono::duration<double>(kWarmStartPoseWritePeriodSec)) {
+    return;
+  }
+  last_warm_start_pose_write_time_ = now;
+  warm_start_pose_writer_->Write(pose);
 }
 
-void Node::PublishLandmarkPosesList(
-    const ::ros::WallTimerEvent& unused_timer_event) {
-  if (landmark_poses_list_publisher_.getNumSubscribers() > 0) {
-    absl::MutexLock lock(&mutex_);
-    landmark_poses_list_publisher_.publish(
-        map_builder_bridge_.GetLandmarkPosesList());
+void Node::PublishWarmStartPose() {
+  absl::MutexLock lock(&startup_mutex_);
+  if (!warm_start_pose_.has_value()) {
+    return;
+  }
+  // Until the first trajectory has data, the robot is assumed to be where it
+  // was last, and the trajectory starts there relative to the loaded state.
+  const WarmStartPose& pose = warm_start_pose_.value();
+  const TrajectoryOptions& options = warm_start_trajectory_options_;
+  geometry_msgs::TransformStamped stamped_transform;
+  stamped_transform.header.stamp = ::ros::Time::now();
+  if (node_options_.publish_to_tf) {
+    stamped_transform.header.frame_id = node_options_.map_frame;
+    if (options.provide_odom_frame) {
+      std::vector<geometry_msgs::TransformStamped> stamped_transforms;
+      stamped_transform.child_frame_id = options.odom_frame;
+      stamped_transform.transform =
+          ToGeometryMsgTransform(pose.tracking_to_map);
+      stamped_transforms.push_back(stamped_transform);
+      stamped_transform.header.frame_id = options.odom_frame;
+      stamped_transform.child_frame_id = options.published_frame;
+      stamped_transform.transform =
+          ToGeometryMsgTransform(pose.published_to_tracking);
+      stamped_transforms.push_back(stamped_transform);
+      tf_broadcaster_.sendTransform(stamped_transforms);
+    } else {
+      stamped_transform.child_frame_id = options.published_frame;
+      stamped_transform.transform = ToGeometryMsgTransform(
+          pose.tracking_to_map * pose.published_to_tracking);
+      tf_broadcaster_.sendTransform(stamped_transform);
+    }
+  }
+  if (node_options_.publish_tracked_pose) {
+    ::geometry_msgs::PoseStamped pose_msg;
+    pose_msg.header.frame_id = node_options_.map_frame;
+    pose_msg.header.stamp = stamped_transform.header.stamp;
+    pose_msg.pose = ToGeometryMsgPose(pose.tracking_to_map);
+    tracked_pose_publisher_.publish(pose_msg);
   }
 }
 
-void Node::PublishConstraintList(
-    const ::ros::WallTimerEvent& unused_timer_event) {
-  if (constraint_list_publisher_.getNumSubscribers() > 0) {
-    absl::MutexLock lock(&mutex_);
-    constraint_list_publisher_.publish(map_builder_bridge_.GetConstraintList());
+void Node::PublishTrajectoryNodeList() {
+  const bool changed_only =
+      node_options_.publish_trajectory_node_list_incrementally &&
+      !publish_full_trajectory_node_list_.exchange(false);
+  visualization_msgs::MarkerArray trajectory_node_list;
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    trajectory_node_list =
+        map_builder_bridge_.GetTrajectoryNodeList(changed_only);
+  }
+  trajectory_node_list_publisher_.publish(trajectory_node_list);
+}
+
+void Node::PublishLandmarkPosesList() {
+  const bool changed_only =
+      node_options_.publish_landmark_poses_list_incrementally &&
+      !publish_full_landmark_poses_list_.exchange(false);
+  visualization_msgs::MarkerArray landmark_poses_list;
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    landmark_poses_list =
+        map_builder_bridge_.GetLandmarkPosesList(changed_only);
+  }
+  if (changed_only && landmark_poses_list.markers.empty()) {
+    return;
   }
+  landmark_poses_list_publisher_.publish(landmark_poses_list);
+}
+
+void Node::PublishConstraintList() {
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    map_builder_bridge_.GetConstraintList(&constraint_list_);
+  }
+  constraint_list_publisher_.publish(constraint_list_);
+}
+
+void Node::PublishMetrics() {
+  ::cartographer_ros_msgs::MetricFamilies metric_families;
+  metric_families.timestamp = ros::Time::now();
+  thread_groups_->UpdateMetrics();
+  metric_families.full = publish_all_metrics_.exchange(false) ||
+                         ++num_metrics_messages_since_full_ >=
+                             kFullMetricsMessagePeriod;
+  if (metric_families.full) {
+    num_metrics_messages_since_full_ = 0;
+  }
+  metrics_registry_->ReadChangedMetrics(!metric_families.full,
+                                        &metric_families.metric_families);
+  metrics_publisher_.publish(metric_families);
 }
 
 std::set<cartographer::mapping::TrajectoryBuilderInterface::SensorId>
@@ -399,12 +882,13 @@ int Node::AddTrajectory(const TrajectoryOptions& options) {
       expected_sensor_ids = ComputeExpectedSensorIds(options);
   const int trajectory_id =
       map_builder_bridge_.AddTrajectory(expected_sensor_ids, options);
-  AddExtrapolator(trajectory_id, options);
-  AddSensorSamplers(trajectory_id, options);
+  AddTrajectoryIngestion(trajectory_id, options);
   LaunchSubscribers(options, trajectory_id);
-  wall_timers_.push_back(node_handle_.createWallTimer(
+  // Run with the services, which also change the subscribers.
+  wall_timers_.push_back(node_handle_.createWallTimer(::ros::WallTimerOptions(
       ::ros::WallDuration(kTopicMismatchCheckDelaySec),
-      &Node::MaybeWarnAboutTopicMismatch, this, /*oneshot=*/true));
+      boost::bind(&Node::MaybeWarnAboutTopicMismatch, this, _1),
+      service_callback_queue_, /*oneshot=*/true)));
   for (const auto& sensor_id : expected_sensor_ids) {
     subscribed_topics_.insert(sensor_id.id);
   }
@@ -417,8 +901,8 @@ void Node::LaunchSubscribers(const TrajectoryOptions& options,
        ComputeRepeatedTopicNames(kLaserScanTopic, options.num_laser_scans)) {
     subscribers_[trajectory_id].push_back(
         {SubscribeWithHandler<sensor_msgs::LaserScan>(
-             &Node::HandleLaserScanMessage, trajectory_id, topic, &node_handle_,
-             this),
+             &Node::HandleLaserScanMessage, trajectory_id, topic,
+             range_data_callback_queue_, &node_handle_, this),
          topic});
   }
   for (const std::string& topic : ComputeRepeatedTopicNames(
@@ -426,7 +910,7 @@ void Node::LaunchSubscribers(const TrajectoryOptions& options,
     subscribers_[trajectory_id].push_back(
         {SubscribeWithHandler<sensor_msgs::MultiEchoLaserScan>(
              &Node::HandleMultiEchoLaserScanMessage, trajectory_id, topic,
-             &node_handle_, this),
+             range_data_callback_queue_, &node_handle_, this),
          topic});
   }
   for (const std::string& topic :
@@ -434,7 +918,7 @@ void Node::LaunchSubscribers(const TrajectoryOptions& options,
     subscribers_[trajectory_id].push_back(
         {SubscribeWithHandler<sensor_msgs::PointCloud2>(
              &Node::HandlePointCloud2Message, trajectory_id, topic,
-             &node_handle_, this),
+             range_data_callback_queue_, &node_handle_, this),
          topic});
   }
 
@@ -445,31 +929,31 @@ void Node::LaunchSubscribers(const TrajectoryOptions& options,
        options.trajectory_builder_options.trajectory_builder_2d_options()
            .use_imu_data())) {
     subscribers_[trajectory_id].push_back(
-        {SubscribeWithHandler<sensor_msgs::Imu>(&Node::HandleImuMessage,
-                                                trajectory_id, kImuTopic,
-                                                &node_handle_, this),
+        {SubscribeWithHandler<sensor_msgs::Imu>(
+             &Node::HandleImuMessage, trajectory_id, kImuTopic,
+             sensor_callback_queue_, &node_handle_, this),
          kImuTopic});
   }
 
   if (options.use_odometry) {
     subscribers_[trajectory_id].push_back(
-        {SubscribeWithHandler<nav_msgs::Odometry>(&Node::HandleOdometryMessage,
-                                                  trajectory_id, kOdometryTopic,
-                                                  &node_handle_, this),
+        {SubscribeWithHandler<nav_msgs::Odometry>(
+             &Node::HandleOdometryMessage, trajectory_id, kOdometryTopic,
+             sensor_callback_queue_, &node_handle_, this),
          kOdometryTopic});
   }
   if (options.use_nav_sat) {
     subscribers_[trajectory_id].push_back(
         {SubscribeWithHandler<sensor_msgs::NavSatFix>(
              &Node::HandleNavSatFixMessage, trajectory_id, kNavSatFixTopic,
-             &node_handle_, this),
+             sensor_callback_queue_, &node_handle_, this),
          kNavSatFixTopic});
   }
   if (options.use_landmarks) {
     subscribers_[trajectory_id].push_back(
         {SubscribeWithHandler<cartographer_ros_msgs::LandmarkList>(
              &Node::HandleLandmarkMessage, trajectory_id, kLandmarkTopic,
-             &node_handle_, this),
+             sensor_callback_queue_, &node_handle_, this),
          kLandmarkTopic});
   }
 }
@@ -549,6 +1033,18 @@ cartographer_ros_msgs::StatusResponse Node::FinishTrajectoryUnderLock(
     }
     CHECK_EQ(subscribers_.erase(trajectory_id), 1);
   }
+  // Already queued messages of this trajectory are dropped from now on, since
+  // its sensor bridge is destroyed below. Batched messages are still added.
+  const auto ingestion_it = trajectory_ingestions_.find(trajectory_id);
+  if (ingestion_it != trajectory_ingestions_.end()) {
+    TrajectoryIngestion* const ingestion = ingestion_it->second.get();
+    absl::MutexLock ingestion_lock(&ingestion->mutex);
+    if (ingestion->sensor_bridge != nullptr) {
+      FlushImuBatch(ingestion);
+      FlushOdometryBatch(ingestion);
+    }
+    ingestion->sensor_bridge = nullptr;
+  }
   map_builder_bridge_.FinishTrajectory(trajectory_id);
   trajectories_scheduled_for_finish_.emplace(trajectory_id);
   status_response.message =
@@ -561,9 +1057,11 @@ bool Node::HandleStartTrajectory(
     ::cartographer_ros_msgs::StartTrajectory::Request& request,
     ::cartographer_ros_msgs::StartTrajectory::Response& response) {
   TrajectoryOptions trajectory_options;
-  std::tie(std::ignore, trajectory_options) = LoadOptions(
+  std::tie(std::ignore, trajectory_options) = options_cache_.GetOrLoad(
       request.configuration_directory, request.configuration_basename);
 
+  absl::MutexLock lock(&mutex_);
+
   if (request.use_initial_pose) {
     const auto pose = ToRigid3d(request.initial_pose);
     if (!pose.IsValid()) {
@@ -614,10 +1112,54 @@ bool Node::HandleStartTrajectory(
   return true;
 }
 
+void Node::PreloadConfigurations(
+    const std::string& configuration_directory,
+    const std::vector<std::string>& configuration_basenames) {
+  for (const std::string& configuration_basename : configuration_basenames) {
+    options_cache_.GetOrLoad(configuration_directory, configuration_basename);
+  }
+}
+
 void Node::StartTrajectoryWithDefaultTopics(const TrajectoryOptions& options) {
   absl::MutexLock lock(&mutex_);
   CHECK(ValidateTrajectoryOptions(options));
-  AddTrajectory(options);
+  TrajectoryOptions trajectory_options = options;
+  {
+    absl::MutexLock startup_lock(&startup_mutex_);
+    ::cartographer::mapping::proto::InitialTrajectoryPose
+        initial_trajectory_pose;
+    if (warm_start_pose_.has_value() &&
+        !options.trajectory_builder_options.has_initial_trajectory_pose() &&
+        map_builder_bridge_.ComputeInitialTrajectoryPose(
+            warm_start_pose_->tracking_to_map, &initial_trajectory_pose)) {
+      LOG(INFO) << "Warm starting relative to trajectory "
+                << initial_trajectory_pose.to_trajectory_id() << ".";
+      *trajectory_options.trajectory_builder_options
+           .mutable_initial_trajectory_pose() = initial_trajectory_pose;
+    }
+  }
+  AddTrajectory(trajectory_options);
+}
+
+void Node::StartWarmStart(const std::string& filename,
+                          const double max_age_sec,
+                          const TrajectoryOptions& options) {
+  absl::optional<WarmStartPose> pose =
+      ReadWarmStartPose(filename, max_age_sec);
+  absl::MutexLock lock(&startup_mutex_);
+  warm_start_pose_writer_ = absl::make_unique<WarmStartPoseWriter>(filename);
+  if (pose.has_value() && !first_pose_published_) {
+    LOG(INFO) << "Publishing the warm start pose from " << filename
+              << " until the first trajectory has data.";
+    warm_start_pose_ = std::move(pose);
+    warm_start_trajectory_options_ = options;
+  }
+}
+
+void Node::SetStartupTime(
+    const std::chrono::steady_clock::time_point startup_time) {
+  absl::MutexLock lock(&startup_mutex_);
+  startup_time_ = startup_time;
 }
 
 std::vector<
@@ -647,8 +1189,7 @@ int Node::AddOfflineTrajectory(
   absl::MutexLock lock(&mutex_);
   const int trajectory_id =
       map_builder_bridge_.AddTrajectory(expected_sensor_ids, options);
-  AddExtrapolator(trajectory_id, options);
-  AddSensorSamplers(trajectory_id, options);
+  AddTrajectoryIngestion(trajectory_id, options);
   return trajectory_id;
 }
 
@@ -657,7 +1198,7 @@ bool Node::HandleGetTrajectoryStates(
     ::cartographer_ros_msgs::GetTrajectoryStates::Response& response) {
   using TrajectoryState =
       ::cartographer::mapping::PoseGraphInterface::TrajectoryState;
-  absl::MutexLock lock(&mutex_);
+  absl::ReaderMutexLock lock(&mutex_);
   response.status.code = ::cartographer_ros_msgs::StatusCode::OK;
   response.trajectory_states.header.stamp = ros::Time::now();
   for (const auto& entry : map_builder_bridge_.GetTrajectoryStates()) {
@@ -709,22 +1250,68 @@ bool Node::HandleWriteState(
   return true;
 }
 
+bool Node::HandleWriteStateAsync(
+    ::cartographer_ros_msgs::WriteState::Request& request,
+    ::cartographer_ros_msgs::WriteState::Response& response) {
+  if (!async_state_writer_.IsWriting()) {
+    auto snapshot = absl::make_unique<AsyncStateWriter::Snapshot>();
+    {
+      absl::MutexLock lock(&mutex_);
+      map_builder_bridge_.SerializeState(request.include_unfinished_submaps,
+                                         snapshot.get());
+    }
+    if (async_state_writer_.Write(request.filename, std::move(snapshot))) {
+      response.status.code = cartographer_ros_msgs::StatusCode::OK;
+      response.status.message =
+          absl::StrCat("Writing state to '", request.filename, "', see '",
+                       kWriteStateStatusTopic, "'.");
+      return true;
+    }
+  }
+  response.status.code = cartographer_ros_msgs::StatusCode::UNAVAILABLE;
+  response.status.message = "Another state is still being written.";
+  return true;
+}
+
+bool Node::HandleWriteFlightRecording(
+    ::cartographer_ros_msgs::WriteFlightRecording::Request& request,
+    ::cartographer_ros_msgs::WriteFlightRecording::Response& response) {
+  if (flight_recorder_.Write(request.filename)) {
+    response.status.code = cartographer_ros_msgs::StatusCode::OK;
+    response.status.message = absl::StrCat(
+        "Writing the recorded messages to '", request.filename, "'.");
+  } else {
+    response.status.code = cartographer_ros_msgs::StatusCode::UNAVAILABLE;
+    response.status.message = "Another recording is still being written.";
+  }
+  return true;
+}
+
 bool Node::HandleReadMetrics(
     ::cartographer_ros_msgs::ReadMetrics::Request& request,
     ::cartographer_ros_msgs::ReadMetrics::Response& response) {
-  absl::MutexLock lock(&mutex_);
   response.timestamp = ros::Time::now();
   if (!metrics_registry_) {
     response.status.code = cartographer_ros_msgs::StatusCode::UNAVAILABLE;
     response.status.message = "Collection of runtime metrics is not activated.";
     return true;
   }
+  thread_groups_->UpdateMetrics();
   metrics_registry_->ReadMetrics(&response);
   response.status.code = cartographer_ros_msgs::StatusCode::OK;
   response.status.message = "Successfully read metrics.";
   return true;
 }
 
+bool Node::HandleResyncSubmapList(
+    ::cartographer_ros_msgs::ResyncSubmapList::Request& request,
+    ::cartographer_ros_msgs::ResyncSubmapList::Response& response) {
+  publish_full_submap_list_ = true;
+  response.status.code = cartographer_ros_msgs::StatusCode::OK;
+  response.status.message = "The next submap list update is full.";
+  return true;
+}
+
 void Node::FinishAllTrajectories() {
   absl::MutexLock lock(&mutex_);
   for (const auto& entry : map_builder_bridge_.GetTrajectoryStates()) {
@@ -762,89 +1349,177 @@ void Node::RunFinalOptimization() {
   map_builder_bridge_.RunFinalOptimization();
 }
 
+void Node::SearchCrossTrajectoryConstraints() {
+  // Like the final optimization, this runs without holding the mutex.
+  map_builder_bridge_.SearchCrossTrajectoryConstraints();
+}
+
 void Node::HandleOdometryMessage(const int trajectory_id,
                                  const std::string& sensor_id,
                                  const nav_msgs::Odometry::ConstPtr& msg) {
-  absl::MutexLock lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).odometry_sampler.Pulse()) {
+  flight_recorder_.Record(sensor_id, msg);
+  metrics::LatencyTimer mutex_wait_timer(metrics::LatencyStage::kMutexWait,
+                                         sensor_id);
+  absl::ReaderMutexLock lock(&mutex_);
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  absl::MutexLock ingestion_lock(&ingestion->mutex);
+  mutex_wait_timer.Stop();
+  if (ingestion->sensor_bridge == nullptr ||
+      !ingestion->sensor_samplers.odometry_sampler.Pulse()) {
+    return;
+  }
+  if (ingestion->imu_and_odometry_batch_duration >
+      carto::common::Duration::zero()) {
+    if (AddToSensorBatch(sensor_id, msg,
+                         ingestion->imu_and_odometry_batch_duration,
+                         &ingestion->odometry_batch)) {
+      FlushOdometryBatch(ingestion);
+    }
     return;
   }
-  auto sensor_bridge_ptr = map_builder_bridge_.sensor_bridge(trajectory_id);
-  auto odometry_data_ptr = sensor_bridge_ptr->ToOdometryData(msg);
+  auto odometry_data_ptr = ingestion->sensor_bridge->ToOdometryData(msg);
   if (odometry_data_ptr != nullptr) {
-    extrapolators_.at(trajectory_id).AddOdometryData(*odometry_data_ptr);
+    absl::MutexLock extrapolator_lock(&ingestion->extrapolator_mutex);
+    ingestion->extrapolator.AddOdometryData(*odometry_data_ptr);
   }
-  sensor_bridge_ptr->HandleOdometryMessage(sensor_id, msg);
+  mutex_wait_timer.Start();
+  absl::MutexLockMaybe collator_lock(SharedCollatorMutex());
+  mutex_wait_timer.Stop();
+  ingestion->sensor_bridge->HandleOdometryMessage(sensor_id, msg);
 }
 
 void Node::HandleNavSatFixMessage(const int trajectory_id,
                                   const std::string& sensor_id,
                                   const sensor_msgs::NavSatFix::ConstPtr& msg) {
-  absl::MutexLock lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).fixed_frame_pose_sampler.Pulse()) {
+  flight_recorder_.Record(sensor_id, msg);
+  metrics::LatencyTimer mutex_wait_timer(metrics::LatencyStage::kMutexWait,
+                                         sensor_id);
+  absl::ReaderMutexLock lock(&mutex_);
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  absl::MutexLock ingestion_lock(&ingestion->mutex);
+  mutex_wait_timer.Stop();
+  if (ingestion->sensor_bridge == nullptr ||
+      !ingestion->sensor_samplers.fixed_frame_pose_sampler.Pulse()) {
     return;
   }
-  map_builder_bridge_.sensor_bridge(trajectory_id)
-      ->HandleNavSatFixMessage(sensor_id, msg);
+  mutex_wait_timer.Start();
+  absl::MutexLockMaybe collator_lock(SharedCollatorMutex());
+  mutex_wait_timer.Stop();
+  ingestion->sensor_bridge->HandleNavSatFixMessage(sensor_id, msg);
 }
 
 void Node::HandleLandmarkMessage(
     const int trajectory_id, const std::string& sensor_id,
     const cartographer_ros_msgs::LandmarkList::ConstPtr& msg) {
-  absl::MutexLock lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).landmark_sampler.Pulse()) {
+  flight_recorder_.Record(sensor_id, msg);
+  metrics::LatencyTimer mutex_wait_timer(metrics::LatencyStage::kMutexWait,
+                                         sensor_id);
+  absl::ReaderMutexLock lock(&mutex_);
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  absl::MutexLock ingestion_lock(&ingestion->mutex);
+  mutex_wait_timer.Stop();
+  if (ingestion->sensor_bridge == nullptr ||
+      !ingestion->sensor_samplers.landmark_sampler.Pulse()) {
     return;
   }
-  map_builder_bridge_.sensor_bridge(trajectory_id)
-      ->HandleLandmarkMessage(sensor_id, msg);
+  mutex_wait_timer.Start();
+  absl::MutexLockMaybe collator_lock(SharedCollatorMutex());
+  mutex_wait_timer.Stop();
+  ingestion->sensor_bridge->HandleLandmarkMessage(sensor_id, msg);
 }
 
 void Node::HandleImuMessage(const int trajectory_id,
                             const std::string& sensor_id,
                             const sensor_msgs::Imu::ConstPtr& msg) {
-  absl::MutexLock lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).imu_sampler.Pulse()) {
+  flight_recorder_.Record(sensor_id, msg);
+  metrics::LatencyTimer mutex_wait_timer(metrics::LatencyStage::kMutexWait,
+                                         sensor_id);
+  absl::ReaderMutexLock lock(&mutex_);
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  absl::MutexLock ingestion_lock(&ingestion->mutex);
+  mutex_wait_timer.Stop();
+  if (ingestion->sensor_bridge == nullptr ||
+      !ingestion->sensor_samplers.imu_sampler.Pulse()) {
+    return;
+  }
+  if (ingestion->imu_and_odometry_batch_duration >
+      carto::common::Duration::zero()) {
+    if (AddToSensorBatch(sensor_id, msg,
+                         ingestion->imu_and_odometry_batch_duration,
+                         &ingestion->imu_batch)) {
+      FlushImuBatch(ingestion);
+    }
     return;
   }
-  auto sensor_bridge_ptr = map_builder_bridge_.sensor_bridge(trajectory_id);
-  auto imu_data_ptr = sensor_bridge_ptr->ToImuData(msg);
+  auto imu_data_ptr = ingestion->sensor_bridge->ToImuData(msg);
   if (imu_data_ptr != nullptr) {
-    extrapolators_.at(trajectory_id).AddImuData(*imu_data_ptr);
+    absl::MutexLock extrapolator_lock(&ingestion->extrapolator_mutex);
+    ingestion->extrapolator.AddImuData(*imu_data_ptr);
   }
-  sensor_bridge_ptr->HandleImuMessage(sensor_id, msg);
+  mutex_wait_timer.Start();
+  absl::MutexLockMaybe collator_lock(SharedCollatorMutex());
+  mutex_wait_timer.Stop();
+  ingestion->sensor_bridge->HandleImuMessage(sensor_id, msg);
 }
 
 void Node::HandleLaserScanMessage(const int trajectory_id,
                                   const std::string& sensor_id,
                                   const sensor_msgs::LaserScan::ConstPtr& msg) {
-  absl::MutexLock lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).rangefinder_sampler.Pulse()) {
+  flight_recorder_.Record(sensor_id, msg);
+  metrics::LatencyTimer mutex_wait_timer(metrics::LatencyStage::kMutexWait,
+                                         sensor_id);
+  absl::ReaderMutexLock lock(&mutex_);
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  absl::MutexLock ingestion_lock(&ingestion->mutex);
+  mutex_wait_timer.Stop();
+  if (ingestion->sensor_bridge == nullptr ||
+      !SampleRangeData(trajectory_id, msg->header.stamp, ingestion)) {
     return;
   }
-  map_builder_bridge_.sensor_bridge(trajectory_id)
-      ->HandleLaserScanMessage(sensor_id, msg);
+  mutex_wait_timer.Start();
+  absl::MutexLockMaybe collator_lock(SharedCollatorMutex());
+  mutex_wait_timer.Stop();
+  ingestion->sensor_bridge->HandleLaserScanMessage(sensor_id, msg);
 }
 
 void Node::HandleMultiEchoLaserScanMessage(
     const int trajectory_id, const std::string& sensor_id,
     const sensor_msgs::MultiEchoLaserScan::ConstPtr& msg) {
-  absl::MutexLock lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).rangefinder_sampler.Pulse()) {
+  flight_recorder_.Record(sensor_id, msg);
+  metrics::LatencyTimer mutex_wait_timer(metrics::LatencyStage::kMutexWait,
+                                         sensor_id);
+  absl::ReaderMutexLock lock(&mutex_);
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  absl::MutexLock ingestion_lock(&ingestion->mutex);
+  mutex_wait_timer.Stop();
+  if (ingestion->sensor_bridge == nullptr ||
+      !SampleRangeData(trajectory_id, msg->header.stamp, ingestion)) {
     return;
   }
-  map_builder_bridge_.sensor_bridge(trajectory_id)
-      ->HandleMultiEchoLaserScanMessage(sensor_id, msg);
+  mutex_wait_timer.Start();
+  absl::MutexLockMaybe collator_lock(SharedCollatorMutex());
+  mutex_wait_timer.Stop();
+  ingestion->sensor_bridge->HandleMultiEchoLaserScanMessage(sensor_id, msg);
 }
 
 void Node::HandlePointCloud2Message(
     const int trajectory_id, const std::string& sensor_id,
     const sensor_msgs::PointCloud2::ConstPtr& msg) {
-  absl::MutexLock lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).rangefinder_sampler.Pulse()) {
+  flight_recorder_.Record(sensor_id, msg);
+  metrics::LatencyTimer mutex_wait_timer(metrics::LatencyStage::kMutexWait,
+                                         sensor_id);
+  absl::ReaderMutexLock lock(&mutex_);
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  absl::MutexLock ingestion_lock(&ingestion->mutex);
+  mutex_wait_timer.Stop();
+  if (ingestion->sensor_bridge == nullptr ||
+      !SampleRangeData(trajectory_id, msg->header.stamp, ingestion)) {
     return;
   }
-  map_builder_bridge_.sensor_bridge(trajectory_id)
-      ->HandlePointCloud2Message(sensor_id, msg);
+  mutex_wait_timer.Start();
+  absl::MutexLockMaybe collator_lock(SharedCollatorMutex());
+  mutex_wait_timer.Stop();
+  ingestion->sensor_bridge->HandlePointCloud2Message(sensor_id, msg);
 }
 
 void Node::SerializeState(const std::string& filename,
@@ -873,6 +1548,7 @@ void Node::MaybeWarnAboutTopicMismatch(
     published_topics_string << resolved_topic << ",";
   }
   bool print_topics = false;
+  absl::ReaderMutexLock lock(&mutex_);
   for (const auto& entry : subscribers_) {
     int trajectory_id = entry.first;
     for (const auto& subscriber : entry.second) {
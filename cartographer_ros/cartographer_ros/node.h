@@ -17,32 +17,51 @@
 #ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_NODE_H
 #define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_NODE_H
 
+#include <atomic>
+#include <chrono>
 #include <map>
 #include <memory>
 #include <set>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
 #include "cartographer/common/fixed_ratio_sampler.h"
 #include "cartographer/mapping/map_builder_interface.h"
 #include "cartographer/mapping/pose_extrapolator.h"
+#include "cartographer/metrics/gauge.h"
+#include "cartographer_ros/adaptive_sampler.h"
+#include "cartographer_ros/async_state_writer.h"
+#include "cartographer_ros/flight_recorder.h"
 #include "cartographer_ros/map_builder_bridge.h"
 #include "cartographer_ros/metrics/family_factory.h"
 #include "cartographer_ros/node_constants.h"
 #include "cartographer_ros/node_options.h"
+#include "cartographer_ros/options_cache.h"
+#include "cartographer_ros/publishing_scheduler.h"
+#include "cartographer_ros/thread_groups.h"
 #include "cartographer_ros/trajectory_options.h"
+#include "cartographer_ros/warm_start.h"
+#include "cartographer_ros_msgs/BatchSubmapQuery.h"
+#include "cartographer_ros_msgs/CompactPointCloud.h"
 #include "cartographer_ros_msgs/FinishTrajectory.h"
 #include "cartographer_ros_msgs/GetTrajectoryStates.h"
+#include "cartographer_ros_msgs/MetricFamilies.h"
 #include "cartographer_ros_msgs/ReadMetrics.h"
+#include "cartographer_ros_msgs/ResyncSubmapList.h"
 #include "cartographer_ros_msgs/StartTrajectory.h"
 #include "cartographer_ros_msgs/StatusResponse.h"
 #include "cartographer_ros_msgs/SubmapEntry.h"
 #include "cartographer_ros_msgs/SubmapList.h"
+#include "cartographer_ros_msgs/SubmapListUpdate.h"
 #include "cartographer_ros_msgs/SubmapQuery.h"
+#include "cartographer_ros_msgs/WriteFlightRecording.h"
 #include "cartographer_ros_msgs/WriteState.h"
 #include "nav_msgs/Odometry.h"
+#include "ros/callback_queue.h"
 #include "ros/ros.h"
 #include "sensor_msgs/Imu.h"
 #include "sensor_msgs/LaserScan.h"
@@ -56,9 +75,13 @@ namespace cartographer_ros {
 // Wires up ROS topics to SLAM.
 class Node {
  public:
+  // Topics and services are resolved relative to 'node_handle'. The threads
+  // started by the node are added to 'thread_groups', which has to outlive it.
   Node(const NodeOptions& node_options,
        std::unique_ptr<cartographer::mapping::MapBuilderInterface> map_builder,
-       tf2_ros::Buffer* tf_buffer, bool collect_metrics);
+       tf2_ros::BufferInterface* tf_buffer, bool collect_metrics,
+       ThreadGroups* thread_groups,
+       const ::ros::NodeHandle& node_handle = ::ros::NodeHandle());
   ~Node();
 
   Node(const Node&) = delete;
@@ -73,9 +96,33 @@ class Node {
   // Runs final optimization. All trajectories have to be finished when calling.
   void RunFinalOptimization();
 
-  // Starts the first trajectory with the default topics.
+  // Searches constraints between trajectories which are not connected yet, see
+  // 'AddCrossTrajectoryConstraints()'. Call it before the final optimization,
+  // which takes the constraints into account.
+  void SearchCrossTrajectoryConstraints();
+
+  // Starts the first trajectory with the default topics. When warm starting
+  // after loading a state, it starts at the warm start pose.
   void StartTrajectoryWithDefaultTopics(const TrajectoryOptions& options);
 
+  // Publishes the pose in 'filename' as the one of a trajectory with
+  // 'options' until a trajectory publishes its own, if the pose was written
+  // at most 'max_age_sec' seconds ago. Poses are published meanwhile even
+  // while a state is loaded. The latest published pose is written to
+  // 'filename' from then on. Call it before starting trajectories.
+  void StartWarmStart(const std::string& filename, double max_age_sec,
+                      const TrajectoryOptions& options);
+
+  // Logs and records the time from 'startup_time' to the first pose
+  // published by a trajectory.
+  void SetStartupTime(std::chrono::steady_clock::time_point startup_time);
+
+  // Loads the options of configurations into the cache used for the start
+  // trajectory service, so that later requests for them are fast.
+  void PreloadConfigurations(
+      const std::string& configuration_directory,
+      const std::vector<std::string>& configuration_basenames);
+
   // Returns unique SensorIds for multiple input bag files based on
   // their TrajectoryOptions.
   // 'SensorId::id' is the expected ROS topic name.
@@ -118,6 +165,13 @@ class Node {
 
   ::ros::NodeHandle* node_handle();
 
+  // Returns the runtime metrics, which are empty unless they are collected.
+  std::vector<cartographer_ros_msgs::MetricFamily> ReadMetrics();
+
+  // Lets offline processing wait for SLAM to catch up with the range data,
+  // which is only counted from then on.
+  RangeDataBackpressure* EnableRangeDataBackpressure() LOCKS_EXCLUDED(mutex_);
+
  private:
   struct Subscriber {
     ::ros::Subscriber subscriber;
@@ -132,6 +186,9 @@ class Node {
   bool HandleSubmapQuery(
       cartographer_ros_msgs::SubmapQuery::Request& request,
       cartographer_ros_msgs::SubmapQuery::Response& response);
+  bool HandleBatchSubmapQuery(
+      cartographer_ros_msgs::BatchSubmapQuery::Request& request,
+      cartographer_ros_msgs::BatchSubmapQuery::Response& response);
   bool HandleTrajectoryQuery(
       ::cartographer_ros_msgs::TrajectoryQuery::Request& request,
       ::cartographer_ros_msgs::TrajectoryQuery::Response& response);
@@ -143,31 +200,60 @@ class Node {
       cartographer_ros_msgs::FinishTrajectory::Response& response);
   bool HandleWriteState(cartographer_ros_msgs::WriteState::Request& request,
                         cartographer_ros_msgs::WriteState::Response& response);
+  // Only holds 'mutex_' while serializing the state into memory, it is
+  // written to disk by the 'async_state_writer_'.
+  bool HandleWriteStateAsync(
+      cartographer_ros_msgs::WriteState::Request& request,
+      cartographer_ros_msgs::WriteState::Response& response);
+  bool HandleWriteFlightRecording(
+      cartographer_ros_msgs::WriteFlightRecording::Request& request,
+      cartographer_ros_msgs::WriteFlightRecording::Response& response);
   bool HandleGetTrajectoryStates(
       ::cartographer_ros_msgs::GetTrajectoryStates::Request& request,
       ::cartographer_ros_msgs::GetTrajectoryStates::Response& response);
   bool HandleReadMetrics(
       cartographer_ros_msgs::ReadMetrics::Request& request,
       cartographer_ros_msgs::ReadMetrics::Response& response);
+  bool HandleResyncSubmapList(
+      cartographer_ros_msgs::ResyncSubmapList::Request& request,
+      cartographer_ros_msgs::ResyncSubmapList::Response& response);
 
   // Returns the set of SensorIds expected for a trajectory.
   // 'SensorId::id' is the expected ROS topic name.
   std::set<::cartographer::mapping::TrajectoryBuilderInterface::SensorId>
   ComputeExpectedSensorIds(const TrajectoryOptions& options) const;
-  int AddTrajectory(const TrajectoryOptions& options);
+  int AddTrajectory(const TrajectoryOptions& options)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void LaunchSubscribers(const TrajectoryOptions& options, int trajectory_id);
-  void PublishSubmapList(const ::ros::WallTimerEvent& timer_event);
-  void AddExtrapolator(int trajectory_id, const TrajectoryOptions& options);
-  void AddSensorSamplers(int trajectory_id, const TrajectoryOptions& options);
-  void PublishLocalTrajectoryData(const ::ros::TimerEvent& timer_event);
-  void PublishTrajectoryNodeList(const ::ros::WallTimerEvent& timer_event);
-  void PublishLandmarkPosesList(const ::ros::WallTimerEvent& timer_event);
-  void PublishConstraintList(const ::ros::WallTimerEvent& timer_event);
+  // Run on the 'publishing_scheduler_' thread.
+  void PublishSubmapList() LOCKS_EXCLUDED(mutex_);
+  void PublishSubmapListUpdate() LOCKS_EXCLUDED(mutex_);
+  void AddTrajectoryIngestion(int trajectory_id,
+                              const TrajectoryOptions& options)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Run on the 'pose_publisher_spinner_' thread.
+  void PublishLocalTrajectoryData(const ::ros::TimerEvent& timer_event)
+      LOCKS_EXCLUDED(mutex_);
+  void PublishLocalTrajectoryDataUnderLock() SHARED_LOCKS_REQUIRED(mutex_);
+  // Called with the pose of the latest trajectory after it was published.
+  void HandlePublishedPose(const WarmStartPose& pose)
+      LOCKS_EXCLUDED(startup_mutex_);
+  // Publishes the warm start pose, if the node is warm starting.
+  void PublishWarmStartPose() LOCKS_EXCLUDED(startup_mutex_);
+  void PublishTrajectoryNodeList() LOCKS_EXCLUDED(mutex_);
+  void PublishLandmarkPosesList() LOCKS_EXCLUDED(mutex_);
+  void PublishConstraintList() LOCKS_EXCLUDED(mutex_);
+  void PublishMetrics();
   bool ValidateTrajectoryOptions(const TrajectoryOptions& options);
   bool ValidateTopicNames(const TrajectoryOptions& options);
   cartographer_ros_msgs::StatusResponse FinishTrajectoryUnderLock(
       int trajectory_id) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
-  void MaybeWarnAboutTopicMismatch(const ::ros::WallTimerEvent&);
+  void MaybeWarnAboutTopicMismatch(const ::ros::WallTimerEvent&)
+      LOCKS_EXCLUDED(mutex_);
+  // Returns a new callback queue spun by 'num_threads' threads of the
+  // 'thread_group', or 'nullptr' if 'num_threads' is 0.
+  ::ros::CallbackQueue* StartCallbackQueue(int num_threads,
+                                           const std::string& thread_group);
 
   // Helper function for service handlers that need to check trajectory states.
   cartographer_ros_msgs::StatusResponse TrajectoryStateToStatus(
@@ -179,47 +265,182 @@ class Node {
 
   tf2_ros::TransformBroadcaster tf_broadcaster_;
 
+  // Held exclusively only while the set of trajectories changes, i.e. when
+  // trajectories are added or finished and when state is loaded or written.
+  // Sensor ingestion, publishing and queries hold it shared and additionally
+  // lock only the trajectory they are working on.
   absl::Mutex mutex_;
+  // Serializes handing sensor data to the map builder if all trajectories
+  // share a single sensor collator, see 'SharedCollatorMutex()'.
+  absl::Mutex shared_collator_mutex_;
+  // Set in the constructor only, so it is used without holding 'mutex_'.
   std::unique_ptr<cartographer_ros::metrics::FamilyFactory> metrics_registry_;
+  ThreadGroups* const thread_groups_;
   MapBuilderBridge map_builder_bridge_ GUARDED_BY(mutex_);
 
   ::ros::NodeHandle node_handle_;
+  // Queues with their own spinners for the callbacks configured to run on
+  // separate threads, so that large point clouds do not delay high-rate
+  // sensor data and slow queries do not delay either. 'nullptr' if the
+  // callbacks are run on the queue of 'node_handle_'. Declared before the
+  // subscribers, services and timers, which leave the queues when destroyed.
+  std::vector<std::unique_ptr<::ros::CallbackQueue>> callback_queues_;
+  std::vector<std::unique_ptr<::ros::AsyncSpinner>> callback_spinners_;
+  ::ros::CallbackQueue* range_data_callback_queue_ = nullptr;
+  ::ros::CallbackQueue* sensor_callback_queue_ = nullptr;
+  ::ros::CallbackQueue* service_callback_queue_ = nullptr;
   ::ros::Publisher submap_list_publisher_;
+  ::ros::Publisher submap_list_update_publisher_;
+  // Set when a subscriber connects or asks for a resync.
+  std::atomic<bool> publish_full_submap_list_{true};
   ::ros::Publisher trajectory_node_list_publisher_;
+  std::atomic<bool> publish_full_trajectory_node_list_{true};
   ::ros::Publisher landmark_poses_list_publisher_;
+  std::atomic<bool> publish_full_landmark_poses_list_{true};
   ::ros::Publisher constraint_list_publisher_;
+  // Only used by 'PublishConstraintList()', kept to reuse its memory.
+  visualization_msgs::MarkerArray constraint_list_;
   ::ros::Publisher tracked_pose_publisher_;
+  ::ros::Publisher metrics_publisher_;
+  std::atomic<bool> publish_all_metrics_{true};
+  // Only used by 'PublishMetrics()'.
+  int num_metrics_messages_since_full_ = 0;
+  ::ros::Publisher write_state_status_publisher_;
+  AsyncStateWriter async_state_writer_;
+  OptionsCache options_cache_;
+  // Records the messages given to the 'Handle*Message()' functions.
+  FlightRecorder flight_recorder_;
   // These ros::ServiceServers need to live for the lifetime of the node.
   std::vector<::ros::ServiceServer> service_servers_;
   ::ros::Publisher scan_matched_point_cloud_publisher_;
+  ::ros::Publisher scan_matched_compact_point_cloud_publisher_;
+  // Only used when publishing local trajectory data, on the pose publishing
+  // thread. Reused to avoid allocating for every point cloud.
+  sensor_msgs::PointCloud2 scan_matched_point_cloud_;
+  cartographer_ros_msgs::CompactPointCloud scan_matched_compact_point_cloud_;
 
   struct TrajectorySensorSamplers {
-    TrajectorySensorSamplers(const double rangefinder_sampling_ratio,
-                             const double odometry_sampling_ratio,
-                             const double fixed_frame_pose_sampling_ratio,
-                             const double imu_sampling_ratio,
-                             const double landmark_sampling_ratio)
-        : rangefinder_sampler(rangefinder_sampling_ratio),
+    TrajectorySensorSamplers(
+        const double rangefinder_sampling_ratio,
+        const AdaptiveSamplingOptions& adaptive_rangefinder_sampling,
+        const double odometry_sampling_ratio,
+        const double fixed_frame_pose_sampling_ratio,
+        const double imu_sampling_ratio, const double landmark_sampling_ratio)
+        : rangefinder_sampler(rangefinder_sampling_ratio,
+                              adaptive_rangefinder_sampling),
           odometry_sampler(odometry_sampling_ratio),
           fixed_frame_pose_sampler(fixed_frame_pose_sampling_ratio),
           imu_sampler(imu_sampling_ratio),
           landmark_sampler(landmark_sampling_ratio) {}
 
-    ::cartographer::common::FixedRatioSampler rangefinder_sampler;
+    // Only adapted if 'use_adaptive_rangefinder_sampling' is set.
+    AdaptiveSampler rangefinder_sampler;
     ::cartographer::common::FixedRatioSampler odometry_sampler;
     ::cartographer::common::FixedRatioSampler fixed_frame_pose_sampler;
     ::cartographer::common::FixedRatioSampler imu_sampler;
     ::cartographer::common::FixedRatioSampler landmark_sampler;
   };
 
+  // Messages of one high-rate sensor which are handed to SLAM together.
+  template <typename MessageType>
+  struct SensorBatch {
+    std::string sensor_id;
+    std::vector<typename MessageType::ConstPtr> messages;
+  };
+
+  // Everything the sensor callbacks of one trajectory touch. Each trajectory
+  // has its own lock, so that the callbacks of different trajectories do not
+  // block each other.
+  struct TrajectoryIngestion {
+    TrajectoryIngestion(
+        const ::cartographer::common::Duration pose_queue_duration,
+        const double imu_gravity_time_constant,
+        const TrajectoryOptions& options, SensorBridge* const sensor_bridge)
+        : extrapolator(pose_queue_duration, imu_gravity_time_constant),
+          adapt_rangefinder_sampling(options.use_adaptive_rangefinder_sampling),
+          imu_and_odometry_batch_duration(::cartographer::common::FromSeconds(
+              options.imu_and_odometry_batch_duration_sec)),
+          sensor_samplers(options.rangefinder_sampling_ratio,
+                          options.adaptive_rangefinder_sampling,
+                          options.odometry_sampling_ratio,
+                          options.fixed_frame_pose_sampling_ratio,
+                          options.imu_sampling_ratio,
+                          options.landmarks_sampling_ratio),
+          sensor_bridge(sensor_bridge) {}
+
+    absl::Mutex mutex;
+    // Locked after 'mutex' by the sensor callbacks, but only for as long as
+    // the extrapolator is updated. Pose publishing only takes this lock, so
+    // it is not held up while the sensor data is handed to local SLAM.
+    absl::Mutex extrapolator_mutex ACQUIRED_AFTER(mutex);
+    ::cartographer::mapping::PoseExtrapolator extrapolator
+        GUARDED_BY(extrapolator_mutex);
+    const bool adapt_rangefinder_sampling;
+    // IMU and odometry messages are batched if positive.
+    const ::cartographer::common::Duration imu_and_odometry_batch_duration;
+    TrajectorySensorSamplers sensor_samplers GUARDED_BY(mutex);
+    // Follows the ratio of 'sensor_samplers.rangefinder_sampler'.
+    ::cartographer::metrics::Gauge* rangefinder_sampling_ratio_metric
+        GUARDED_BY(mutex) = ::cartographer::metrics::Gauge::Null();
+    // Owned by 'map_builder_bridge_'. Reset to 'nullptr' when the trajectory
+    // is finished, after which incoming messages are dropped.
+    SensorBridge* sensor_bridge GUARDED_BY(mutex);
+    SensorBatch<sensor_msgs::Imu> imu_batch GUARDED_BY(mutex);
+    SensorBatch<nav_msgs::Odometry> odometry_batch GUARDED_BY(mutex);
+  };
+
+  TrajectoryIngestion* GetTrajectoryIngestion(int trajectory_id)
+      SHARED_LOCKS_REQUIRED(mutex_);
+  // Returns true if range data at 'time' should be handed to the map builder,
+  // which is then counted as queued for the backpressure if it is enabled or
+  // sampling adapts. Adapts the sampling ratio to the range data not yet
+  // matched by local SLAM or optimized by global SLAM first, if enabled.
+  bool SampleRangeData(int trajectory_id, const ::ros::Time& time,
+                       TrajectoryIngestion* ingestion)
+      SHARED_LOCKS_REQUIRED(mutex_) EXCLUSIVE_LOCKS_REQUIRED(ingestion->mutex);
+  // Adds 'msg' to 'batch'. Returns true once the batch spans
+  // 'batch_duration' and should be flushed.
+  template <typename MessageType>
+  static bool AddToSensorBatch(const std::string& sensor_id,
+                               const typename MessageType::ConstPtr& msg,
+                               ::cartographer::common::Duration batch_duration,
+                               SensorBatch<MessageType>* batch);
+  // Hand the batched messages to the extrapolator and the map builder, each
+  // in one locked section, and clear the batch.
+  void FlushImuBatch(TrajectoryIngestion* ingestion)
+      SHARED_LOCKS_REQUIRED(mutex_) EXCLUSIVE_LOCKS_REQUIRED(ingestion->mutex);
+  void FlushOdometryBatch(TrajectoryIngestion* ingestion)
+      SHARED_LOCKS_REQUIRED(mutex_) EXCLUSIVE_LOCKS_REQUIRED(ingestion->mutex);
+  // Returns the mutex to hold while handing sensor data to the map builder,
+  // or 'nullptr' if the map builder has a sensor collator per trajectory and
+  // trajectories can be fed concurrently.
+  absl::Mutex* SharedCollatorMutex();
+
   // These are keyed with 'trajectory_id'.
-  std::map<int, ::cartographer::mapping::PoseExtrapolator> extrapolators_;
+  std::map<int, std::unique_ptr<TrajectoryIngestion>> trajectory_ingestions_
+      GUARDED_BY(mutex_);
+  // Otherwise, range data is only counted for adaptive sampling.
+  bool range_data_backpressure_enabled_ GUARDED_BY(mutex_) = false;
   std::map<int, ::ros::Time> last_published_tf_stamps_;
-  std::unordered_map<int, TrajectorySensorSamplers> sensor_samplers_;
   std::unordered_map<int, std::vector<Subscriber>> subscribers_;
   std::unordered_set<std::string> subscribed_topics_;
   std::unordered_set<int> trajectories_scheduled_for_finish_;
 
+  // Guards the state of warm starting and of the startup timing, which is also
+  // used on the pose publishing thread while 'mutex_' is held by a writer.
+  absl::Mutex startup_mutex_ ACQUIRED_AFTER(mutex_);
+  // Only set if warm starting.
+  std::unique_ptr<WarmStartPoseWriter> warm_start_pose_writer_
+      GUARDED_BY(startup_mutex_);
+  // Only set until the first pose is published by a trajectory.
+  absl::optional<WarmStartPose> warm_start_pose_ GUARDED_BY(startup_mutex_);
+  TrajectoryOptions warm_start_trajectory_options_ GUARDED_BY(startup_mutex_);
+  std::chrono::steady_clock::time_point last_warm_start_pose_write_time_
+      GUARDED_BY(startup_mutex_);
+  absl::optional<std::chrono::steady_clock::time_point> startup_time_
+      GUARDED_BY(startup_mutex_);
+  bool first_pose_published_ GUARDED_BY(startup_mutex_) = false;
+
   // We have to keep the timer handles of ::ros::WallTimers around, otherwise
   // they do not fire.
   std::vector<::ros::WallTimer> wall_timers_;
@@ -228,7 +449,15 @@ class Node {
   // range data point clouds) is a regular timer which is not triggered when
   // simulation time is standing still. This prevents overflowing the transform
   // listener buffer by publishing the same transforms over and over again.
+  // It is run on its own callback queue and thread, so that other callbacks
+  // do not delay the published poses.
+  ::ros::CallbackQueue pose_publisher_queue_;
   ::ros::Timer publish_local_trajectory_data_timer_;
+  std::unique_ptr<::ros::AsyncSpinner> pose_publisher_spinner_;
+
+  // Publishes the submap list and visualizations. Declared last, so that its
+  // thread is stopped before anything it uses is destroyed.
+  PublishingScheduler publishing_scheduler_;
 };
 
 }  // namespace cartographer_ros
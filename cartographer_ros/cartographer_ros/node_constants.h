@@ -30,25 +30,43 @@ constexpr char kImuTopic[] = "imu";
 constexpr char kOdometryTopic[] = "odom";
 constexpr char kNavSatFixTopic[] = "fix";
 constexpr char kLandmarkTopic[] = "landmark";
+// Range data of the topics given by 'rangefinder_merge' is added to the map
+// builder as this sensor.
+constexpr char kMergedRangefinderSensorId[] = "merged_rangefinders";
 constexpr char kFinishTrajectoryServiceName[] = "finish_trajectory";
 constexpr char kOccupancyGridTopic[] = "map";
+constexpr char kRoiOccupancyGridTopic[] = "roi_map";
 constexpr char kScanMatchedPointCloudTopic[] = "scan_matched_points2";
+constexpr char kScanMatchedCompactPointCloudTopic[] =
+    "scan_matched_points_compact";
 constexpr char kSubmapListTopic[] = "submap_list";
+constexpr char kSubmapListUpdatesTopic[] = "submap_list_updates";
+constexpr char kResyncSubmapListServiceName[] = "resync_submap_list";
 constexpr char kTrackedPoseTopic[] = "tracked_pose";
 constexpr char kSubmapQueryServiceName[] = "submap_query";
+constexpr char kBatchSubmapQueryServiceName[] = "batch_submap_query";
 constexpr char kTrajectoryQueryServiceName[] = "trajectory_query";
 constexpr char kStartTrajectoryServiceName[] = "start_trajectory";
 constexpr char kWriteStateServiceName[] = "write_state";
+constexpr char kWriteStateAsyncServiceName[] = "write_state_async";
+constexpr char kWriteStateStatusTopic[] = "write_state_status";
+constexpr char kWriteFlightRecordingServiceName[] = "write_flight_recording";
 constexpr char kGetTrajectoryStatesServiceName[] = "get_trajectory_states";
 constexpr char kReadMetricsServiceName[] = "read_metrics";
 constexpr char kTrajectoryNodeListTopic[] = "trajectory_node_list";
 constexpr char kLandmarkPosesListTopic[] = "landmark_poses_list";
 constexpr char kConstraintListTopic[] = "constraint_list";
+constexpr char kMetricsTopic[] = "metrics";
+constexpr char kTfStaticTopic[] = "/tf_static";
 constexpr double kConstraintPublishPeriodSec = 0.5;
 constexpr double kTopicMismatchCheckDelaySec = 3.0;
 
 constexpr int kInfiniteSubscriberQueueSize = 0;
 constexpr int kLatestOnlyPublisherQueueSize = 1;
+// Submap list updates build on each other, so they should not be dropped.
+constexpr int kSubmapListUpdatesQueueSize = 10;
+// Metrics mostly contain only the changed families, the same applies.
+constexpr int kMetricsQueueSize = 10;
 
 // For multiple topics adds numbers to the topic name and returns the list.
 std::vector<std::string> ComputeRepeatedTopicNames(const std::string& topic,
@@ -15,7 +15,9 @@
  */
 
 #include "absl/memory/memory.h"
+#include "absl/strings/str_split.h"
 #include "cartographer/mapping/map_builder.h"
+#include "cartographer_ros/metrics/startup_timing.h"
 #include "cartographer_ros/node.h"
 #include "cartographer_ros/node_options.h"
 #include "cartographer_ros/ros_log_sink.h"
@@ -40,14 +42,26 @@ DEFINE_bool(load_frozen_state, true,
 DEFINE_bool(
     start_trajectory_with_default_topics, true,
     "Enable to immediately start the first trajectory with default topics.");
+DEFINE_string(preload_configuration_basenames, "",
+              "Comma-separated basenames of configuration files in "
+              "-configuration_directory, which are loaded at startup so that "
+              "starting trajectories with them is fast.");
 DEFINE_string(
     save_state_filename, "",
     "If non-empty, serialize state and write it to disk before shutting down.");
+DEFINE_string(warm_start_filename, "",
+              "If non-empty, the latest pose is regularly written to this "
+              "file. When starting, a recent pose in it is published until the "
+              "first trajectory has data, and that trajectory starts there "
+              "relative to the loaded state.");
+DEFINE_double(warm_start_max_age_sec, 300.,
+              "Poses in -warm_start_filename which were written longer ago "
+              "are not used.");
 
 namespace cartographer_ros {
 namespace {
 
-void Run() {
+void Run(metrics::StartupTiming* const startup_timing) {
   constexpr double kTfBufferCacheTimeInSeconds = 10.;
   tf2_ros::Buffer tf_buffer{::ros::Duration(kTfBufferCacheTimeInSeconds)};
   tf2_ros::TransformListener tf(tf_buffer);
@@ -55,18 +69,40 @@ void Run() {
   TrajectoryOptions trajectory_options;
   std::tie(node_options, trajectory_options) =
       LoadOptions(FLAGS_configuration_directory, FLAGS_configuration_basename);
+  startup_timing->EndPhase("load_options");
 
-  auto map_builder =
-      cartographer::mapping::CreateMapBuilder(node_options.map_builder_options);
+  ThreadGroups thread_groups(node_options.thread_groups);
+  std::unique_ptr<cartographer::mapping::MapBuilderInterface> map_builder;
+  thread_groups.Capture(kBackgroundOptimizationThreadGroup, [&]() {
+    map_builder = cartographer::mapping::CreateMapBuilder(
+        node_options.map_builder_options);
+  });
+  startup_timing->EndPhase("create_map_builder");
   Node node(node_options, std::move(map_builder), &tf_buffer,
-            FLAGS_collect_metrics);
+            FLAGS_collect_metrics, &thread_groups);
+  node.SetStartupTime(startup_timing->start_time());
+  if (!FLAGS_warm_start_filename.empty()) {
+    node.StartWarmStart(FLAGS_warm_start_filename,
+                        FLAGS_warm_start_max_age_sec, trajectory_options);
+  }
+  startup_timing->EndPhase("create_node");
   if (!FLAGS_load_state_filename.empty()) {
     node.LoadState(FLAGS_load_state_filename, FLAGS_load_frozen_state);
+    startup_timing->EndPhase("load_state");
+  }
+  if (!FLAGS_preload_configuration_basenames.empty()) {
+    node.PreloadConfigurations(
+        FLAGS_configuration_directory,
+        absl::StrSplit(FLAGS_preload_configuration_basenames, ',',
+                       absl::SkipEmpty()));
+    startup_timing->EndPhase("preload_configurations");
   }
 
   if (FLAGS_start_trajectory_with_default_topics) {
     node.StartTrajectoryWithDefaultTopics(trajectory_options);
+    startup_timing->EndPhase("start_trajectory");
   }
+  startup_timing->Report();
 
   ::ros::spin();
 
@@ -91,10 +127,12 @@ int main(int argc, char** argv) {
   CHECK(!FLAGS_configuration_basename.empty())
       << "-configuration_basename is missing.";
 
+  cartographer_ros::metrics::StartupTiming startup_timing;
   ::ros::init(argc, argv, "cartographer_node");
   ::ros::start();
+  startup_timing.EndPhase("ros_init");
 
   cartographer_ros::ScopedRosLogSink ros_log_sink;
-  cartographer_ros::Run();
+  cartographer_ros::Run(&startup_timing);
   ::ros::shutdown();
 }
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_split.h"
+#include "cartographer/mapping/map_builder.h"
+#include "cartographer_ros/metrics/startup_timing.h"
+#include "cartographer_ros/node.h"
+#include "cartographer_ros/node_options.h"
+#include "cartographer_ros/ros_log_sink.h"
+#include "glog/logging.h"
+#include "nodelet/nodelet.h"
+#include "pluginlib/class_list_macros.h"
+#include "tf2_ros/buffer.h"
+#include "tf2_ros/transform_listener.h"
+
+namespace cartographer_ros {
+
+// Runs the 'cartographer_node' inside a nodelet manager. Sensor data published
+// by driver nodelets in the same manager is then handed over as shared
+// pointers instead of being serialized and copied. The command-line flags of
+// the 'cartographer_node' are read as private parameters instead.
+class NodeNodelet : public ::nodelet::Nodelet {
+ public:
+  NodeNodelet() = default;
+  ~NodeNodelet() override;
+
+  NodeNodelet(const NodeNodelet&) = delete;
+  NodeNodelet& operator=(const NodeNodelet&) = delete;
+
+ private:
+  void onInit() override;
+
+  std::string save_state_filename_;
+  ScopedRosLogSink ros_log_sink_;
+  std::unique_ptr<tf2_ros::Buffer> tf_buffer_;
+  std::unique_ptr<tf2_ros::TransformListener> tf_listener_;
+  // Declared before 'node_', which uses it until destroyed.
+  std::unique_ptr<ThreadGroups> thread_groups_;
+  std::unique_ptr<Node> node_;
+};
+
+NodeNodelet::~NodeNodelet() {
+  if (node_ == nullptr) {
+    return;
+  }
+  node_->FinishAllTrajectories();
+  node_->RunFinalOptimization();
+
+  if (!save_state_filename_.empty()) {
+    node_->SerializeState(save_state_filename_,
+                          true /* include_unfinished_submaps */);
+  }
+  // The node uses the buffer and must be destroyed first.
+  node_.reset();
+}
+
+void NodeNodelet::onInit() {
+  // Callbacks of the single-threaded node handle are never called
+  // concurrently, like they are not in the 'cartographer_node'.
+  ::ros::NodeHandle& node_handle = getNodeHandle();
+  ::ros::NodeHandle& private_node_handle = getPrivateNodeHandle();
+  metrics::StartupTiming startup_timing;
+
+  std::string configuration_directory;
+  std::string configuration_basename;
+  CHECK(private_node_handle.getParam("configuration_directory",
+                                     configuration_directory))
+      << "~configuration_directory is missing.";
+  CHECK(private_node_handle.getParam("configuration_basename",
+                                     configuration_basename))
+      << "~configuration_basename is missing.";
+  const bool collect_metrics =
+      private_node_handle.param("collect_metrics", false);
+  const std::string load_state_filename =
+      private_node_handle.param("load_state_filename", std::string());
+  const bool load_frozen_state =
+      private_node_handle.param("load_frozen_state", true);
+  const bool start_trajectory_with_default_topics =
+      private_node_handle.param("start_trajectory_with_default_topics", true);
+  save_state_filename_ =
+      private_node_handle.param("save_state_filename", std::string());
+  const std::string preload_configuration_basenames = private_node_handle.param(
+      "preload_configuration_basenames", std::string());
+  const std::string warm_start_filename =
+      private_node_handle.param("warm_start_filename", std::string());
+  const double warm_start_max_age_sec =
+      private_node_handle.param("warm_start_max_age_sec", 300.);
+
+  constexpr double kTfBufferCacheTimeInSeconds = 10.;
+  tf_buffer_ = absl::make_unique<tf2_ros::Buffer>(
+      ::ros::Duration(kTfBufferCacheTimeInSeconds));
+  tf_listener_ =
+      absl::make_unique<tf2_ros::TransformListener>(*tf_buffer_, node_handle);
+  NodeOptions node_options;
+  TrajectoryOptions trajectory_options;
+  std::tie(node_options, trajectory_options) =
+      LoadOptions(configuration_directory, configuration_basename);
+  startup_timing.EndPhase("load_options");
+
+  thread_groups_ = absl::make_unique<ThreadGroups>(node_options.thread_groups);
+  std::unique_ptr<cartographer::mapping::MapBuilderInterface> map_builder;
+  thread_groups_->Capture(kBackgroundOptimizationThreadGroup, [&]() {
+    map_builder = cartographer::mapping::CreateMapBuilder(
+        node_options.map_builder_options);
+  });
+  startup_timing.EndPhase("create_map_builder");
+  node_ = absl::make_unique<Node>(node_options, std::move(map_builder),
+                                  tf_buffer_.get(), collect_metrics,
+                                  thread_groups_.get(), node_handle);
+  node_->SetStartupTime(startup_timing.start_time());
+  if (!warm_start_filename.empty()) {
+    node_->StartWarmStart(warm_start_filename, warm_start_max_age_sec,
+                          trajectory_options);
+  }
+  startup_timing.EndPhase("create_node");
+  if (!load_state_filename.empty()) {
+    node_->LoadState(load_state_filename, load_frozen_state);
+    startup_timing.EndPhase("load_state");
+  }
+  if (!preload_configuration_basenames.empty()) {
+    node_->PreloadConfigurations(
+        configuration_directory,
+        absl::StrSplit(preload_configuration_basenames, ',',
+                       absl::SkipEmpty()));
+    startup_timing.EndPhase("preload_configurations");
+  }
+
+  if (start_trajectory_with_default_topics) {
+    node_->StartTrajectoryWithDefaultTopics(trajectory_options);
+    startup_timing.EndPhase("start_trajectory");
+  }
+  startup_timing.Report();
+}
+
+}  // namespace cartographer_ros
+
+PLUGINLIB_EXPORT_CLASS(cartographer_ros::NodeNodelet, ::nodelet::Nodelet)
@@ -52,6 +52,77 @@ NodeOptions CreateNodeOptions(
     options.use_pose_extrapolator =
         lua_parameter_dictionary->GetBool("use_pose_extrapolator");
   }
+  if (lua_parameter_dictionary->HasKey("num_rangefinder_transform_threads")) {
+    options.num_rangefinder_transform_threads =
+        lua_parameter_dictionary->GetInt("num_rangefinder_transform_threads");
+    CHECK_GE(options.num_rangefinder_transform_threads, 0);
+  }
+  if (lua_parameter_dictionary->HasKey("submap_texture_cache_size_mb")) {
+    options.submap_texture_cache_size_mb =
+        lua_parameter_dictionary->GetInt("submap_texture_cache_size_mb");
+    CHECK_GE(options.submap_texture_cache_size_mb, 0);
+  }
+  if (lua_parameter_dictionary->HasKey("pose_graph_refresh_period_sec")) {
+    options.pose_graph_refresh_period_sec =
+        lua_parameter_dictionary->GetDouble("pose_graph_refresh_period_sec");
+    CHECK_GE(options.pose_graph_refresh_period_sec, 0.);
+  }
+  if (lua_parameter_dictionary->HasKey(
+          "publish_trajectory_node_list_incrementally")) {
+    options.publish_trajectory_node_list_incrementally =
+        lua_parameter_dictionary->GetBool(
+            "publish_trajectory_node_list_incrementally");
+  }
+  if (lua_parameter_dictionary->HasKey(
+          "publish_landmark_poses_list_incrementally")) {
+    options.publish_landmark_poses_list_incrementally =
+        lua_parameter_dictionary->GetBool(
+            "publish_landmark_poses_list_incrementally");
+  }
+  if (lua_parameter_dictionary->HasKey(
+          "max_published_intra_submap_constraints")) {
+    options.max_published_intra_submap_constraints =
+        lua_parameter_dictionary->GetInt(
+            "max_published_intra_submap_constraints");
+    CHECK_GE(options.max_published_intra_submap_constraints, 0);
+  }
+  if (lua_parameter_dictionary->HasKey("metrics_publish_period_sec")) {
+    options.metrics_publish_period_sec =
+        lua_parameter_dictionary->GetDouble("metrics_publish_period_sec");
+  }
+  if (lua_parameter_dictionary->HasKey("num_range_data_callback_threads")) {
+    options.num_range_data_callback_threads =
+        lua_parameter_dictionary->GetInt("num_range_data_callback_threads");
+    CHECK_GE(options.num_range_data_callback_threads, 0);
+  }
+  if (lua_parameter_dictionary->HasKey("num_sensor_callback_threads")) {
+    options.num_sensor_callback_threads =
+        lua_parameter_dictionary->GetInt("num_sensor_callback_threads");
+    CHECK_GE(options.num_sensor_callback_threads, 0);
+  }
+  if (lua_parameter_dictionary->HasKey("num_service_callback_threads")) {
+    options.num_service_callback_threads =
+        lua_parameter_dictionary->GetInt("num_service_callback_threads");
+    CHECK_GE(options.num_service_callback_threads, 0);
+  }
+  if (lua_parameter_dictionary->HasKey("num_load_state_threads")) {
+    options.num_load_state_threads =
+        lua_parameter_dictionary->GetInt("num_load_state_threads");
+    CHECK_GE(options.num_load_state_threads, 0);
+  }
+  if (lua_parameter_dictionary->HasKey("flight_recorder_num_messages")) {
+    options.flight_recorder_num_messages =
+        lua_parameter_dictionary->GetInt("flight_recorder_num_messages");
+    CHECK_GE(options.flight_recorder_num_messages, 0);
+  }
+  if (lua_parameter_dictionary->HasKey("thread_groups")) {
+    options.thread_groups = CreateThreadGroupsOptions(
+        lua_parameter_dictionary->GetDictionary("thread_groups").get());
+  }
+  if (lua_parameter_dictionary->HasKey("sensor_data_batching")) {
+    options.sensor_data_batching = CreateSensorDataBatchingOptions(
+        lua_parameter_dictionary->GetDictionary("sensor_data_batching").get());
+  }
   return options;
 }
 
@@ -17,12 +17,15 @@
 #ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_NODE_OPTIONS_H
 #define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_NODE_OPTIONS_H
 
+#include <map>
 #include <string>
 #include <tuple>
 
 #include "cartographer/common/lua_parameter_dictionary.h"
 #include "cartographer/common/port.h"
 #include "cartographer/mapping/proto/map_builder_options.pb.h"
+#include "cartographer_ros/sensor_data_batcher.h"
+#include "cartographer_ros/thread_groups.h"
 #include "cartographer_ros/trajectory_options.h"
 
 namespace cartographer_ros {
@@ -38,6 +41,31 @@ struct NodeOptions {
   bool publish_to_tf = true;
   bool publish_tracked_pose = false;
   bool use_pose_extrapolator = true;
+  int num_rangefinder_transform_threads = 0;
+  int submap_texture_cache_size_mb = 64;
+  // If positive, the pose graph data used for publishing and queries is
+  // refreshed in the background at this period instead of when it is read.
+  double pose_graph_refresh_period_sec = 0.;
+  bool publish_trajectory_node_list_incrementally = false;
+  bool publish_landmark_poses_list_incrementally = false;
+  int max_published_intra_submap_constraints = 0;
+  double metrics_publish_period_sec = 1.;
+  // Threads for the callbacks of range data subscriptions, of the other sensor
+  // data subscriptions and of services. 0 runs them on the callback queue of
+  // the node handle instead.
+  int num_range_data_callback_threads = 0;
+  int num_sensor_callback_threads = 0;
+  int num_service_callback_threads = 0;
+  // Threads decompressing a state while it is loaded, 0 decompresses it on
+  // the loading thread.
+  int num_load_state_threads = 4;
+  // Sensor messages kept for the flight recorder, 0 disables it.
+  int flight_recorder_num_messages = 0;
+  // Scheduling of the named thread groups, keyed with the group name.
+  std::map<std::string, ThreadGroupOptions> thread_groups;
+  // Batching of the sensor data handed to the map builder, meant for
+  // streaming it to a Cartographer server.
+  SensorDataBatchingOptions sensor_data_batching;
 };
 
 NodeOptions CreateNodeOptions(
@@ -14,12 +14,20 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cmath>
+#include <deque>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "Eigen/Core"
 #include "Eigen/Geometry"
+#include "absl/memory/memory.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
 #include "absl/synchronization/mutex.h"
 #include "cairo/cairo.h"
 #include "cartographer/common/port.h"
@@ -31,11 +39,17 @@
 #include "cartographer_ros/node_constants.h"
 #include "cartographer_ros/ros_log_sink.h"
 #include "cartographer_ros/submap.h"
-#include "cartographer_ros_msgs/SubmapList.h"
+#include "cartographer_ros/submap_canvas.h"
+#include "cartographer_ros_msgs/BatchSubmapQuery.h"
+#include "cartographer_ros_msgs/ResyncSubmapList.h"
+#include "cartographer_ros_msgs/SubmapListUpdate.h"
 #include "cartographer_ros_msgs/SubmapQuery.h"
 #include "gflags/gflags.h"
+#include "map_msgs/OccupancyGridUpdate.h"
 #include "nav_msgs/OccupancyGrid.h"
 #include "ros/ros.h"
+#include "tf2_ros/buffer.h"
+#include "tf2_ros/transform_listener.h"
 
 DEFINE_double(resolution, 0.05,
               "Resolution of a grid cell in the published occupancy grid.");
@@ -46,78 +60,304 @@ DEFINE_bool(include_unfrozen_submaps, true,
             "Include unfrozen submaps in the occupancy grid.");
 DEFINE_string(occupancy_grid_topic, cartographer_ros::kOccupancyGridTopic,
               "Name of the topic on which the occupancy grid is published.");
+DEFINE_bool(publish_map_updates, false,
+            "If true, the parts of the occupancy grid that changed are "
+            "published on '<occupancy_grid_topic>_updates' and the full "
+            "occupancy grid only when subscribers connect or every "
+            "'full_map_period_sec'.");
+DEFINE_double(full_map_period_sec, 30.,
+              "Period of publishing the full occupancy grid if "
+              "'publish_map_updates' is true.");
+DEFINE_string(pyramid_resolutions, "",
+              "Comma-separated list of coarser resolutions, multiples of "
+              "'resolution', at which the occupancy grid is additionally "
+              "published on '<occupancy_grid_topic>_level_<i>', starting at "
+              "1. The levels are downsampled from the painted grid.");
+DEFINE_string(roi_frame, "",
+              "If set, the occupancy grid of a region of interest centered "
+              "at this tf frame is additionally published on "
+              "'roi_occupancy_grid_topic', painting only the submaps in it.");
+DEFINE_double(roi_size, 50.,
+              "Side length in meters of the square region of interest. It is "
+              "grown to whole tiles of 256 cells.");
+DEFINE_double(roi_publish_period_sec, 0.2,
+              "Region of interest OccupancyGrid publishing period.");
+DEFINE_string(roi_occupancy_grid_topic,
+              cartographer_ros::kRoiOccupancyGridTopic,
+              "Name of the topic on which the occupancy grid of the region of "
+              "interest is published.");
+DEFINE_int32(num_texture_fetch_threads, 4,
+             "Number of threads fetching and decoding submap textures, i.e. "
+             "the maximum number of batch submap queries in flight.");
+DEFINE_bool(fetch_lz4_submap_cells, true,
+            "Asks for LZ4 instead of gzip compressed submap cells, which are "
+            "larger but much faster to decode.");
 
 namespace cartographer_ros {
 namespace {
 
+constexpr size_t kMaxSubmapsPerBatchQuery = 32;
+// A full submap list update is requested at most this often.
+constexpr double kSubmapListResyncPeriodSec = 1.;
+
 using ::cartographer::io::PaintSubmapSlicesResult;
 using ::cartographer::io::SubmapSlice;
 using ::cartographer::mapping::SubmapId;
 
 class Node {
  public:
-  explicit Node(double resolution, double publish_period_sec);
-  ~Node() {}
+  explicit Node(double resolution, double publish_period_sec,
+                int num_texture_fetch_threads);
+  ~Node();
 
   Node(const Node&) = delete;
   Node& operator=(const Node&) = delete;
 
  private:
-  void HandleSubmapList(const cartographer_ros_msgs::SubmapList::ConstPtr& msg);
+  void HandleSubmapListUpdate(
+      const cartographer_ros_msgs::SubmapListUpdate::ConstPtr& msg)
+      LOCKS_EXCLUDED(mutex_);
+  // Applies 'msg', which is either full or follows the last applied update.
+  void ApplySubmapListUpdate(const cartographer_ros_msgs::SubmapListUpdate& msg)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void ResyncSubmapList(const ::ros::WallTimerEvent& timer_event)
+      LOCKS_EXCLUDED(mutex_);
   void DrawAndPublish(const ::ros::WallTimerEvent& timer_event);
+  void DrawAndPublishRoi(const ::ros::WallTimerEvent& timer_event);
+  void HandleOccupancyGridSubscriberConnected();
+  // Publishes the part of the canvas that changed with the last update and
+  // applies it to 'occupancy_grid_'.
+  void PublishOccupancyGridUpdate() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Publishes the pyramid levels which are subscribed to, downsampling them
+  // again from 'occupancy_grid_' if 'changed'.
+  void PublishPyramidLevels(bool changed) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Whether the map, its updates or a pyramid level is subscribed to.
+  bool MapHasSubscribers() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Queues fetching the texture of 'id' unless it is already queued or being
+  // fetched.
+  void ScheduleTextureFetch(const SubmapId& id) LOCKS_EXCLUDED(fetch_mutex_);
+  // Runs on each of the 'fetch_threads_' until the node is destroyed. The
+  // submap query 'client' is only used if 'batch_client' is not available.
+  void FetchTextures(::ros::ServiceClient batch_client,
+                     ::ros::ServiceClient client)
+      LOCKS_EXCLUDED(mutex_, fetch_mutex_);
 
   ::ros::NodeHandle node_handle_;
   const double resolution_;
 
   absl::Mutex mutex_;
-  ::ros::ServiceClient client_ GUARDED_BY(mutex_);
   ::ros::Subscriber submap_list_subscriber_ GUARDED_BY(mutex_);
+  ::ros::ServiceClient resync_submap_list_client_;
+  // Whether 'submap_slices_' reflects all updates up to
+  // 'submap_list_sequence_number_'. Otherwise, non-full updates are ignored.
+  bool submap_list_synced_ GUARDED_BY(mutex_) = false;
+  uint64_t submap_list_sequence_number_ GUARDED_BY(mutex_) = 0;
+  // Set when an update was ignored, until 'submap_list_resync_timer_'
+  // requests a full update.
+  bool submap_list_resync_needed_ GUARDED_BY(mutex_) = false;
+  ::ros::WallTimer submap_list_resync_timer_;
   ::ros::Publisher occupancy_grid_publisher_ GUARDED_BY(mutex_);
+  ::ros::Publisher occupancy_grid_update_publisher_ GUARDED_BY(mutex_);
   std::map<SubmapId, SubmapSlice> submap_slices_ GUARDED_BY(mutex_);
+  SubmapCanvas submap_canvas_ GUARDED_BY(mutex_);
+  // Last published grid, converted again only when the canvas changed.
+  std::unique_ptr<nav_msgs::OccupancyGrid> occupancy_grid_ GUARDED_BY(mutex_);
+  bool full_occupancy_grid_requested_ GUARDED_BY(mutex_) = false;
+  ::ros::WallTime next_full_occupancy_grid_time_ GUARDED_BY(mutex_);
   ::ros::WallTimer occupancy_grid_publisher_timer_;
+  struct PyramidLevel {
+    int factor;
+    ::ros::Publisher publisher;
+    // Last published grid, downsampled again only when the map changed.
+    std::unique_ptr<nav_msgs::OccupancyGrid> occupancy_grid;
+  };
+  std::vector<PyramidLevel> pyramid_levels_ GUARDED_BY(mutex_);
   std::string last_frame_id_;
   ros::Time last_timestamp_;
+
+  // Only used if 'FLAGS_roi_frame' is set. The region of interest is painted
+  // on its own canvas which follows 'FLAGS_roi_frame'.
+  ::tf2_ros::Buffer tf_buffer_;
+  std::unique_ptr<::tf2_ros::TransformListener> tf_listener_;
+  ::ros::Publisher roi_occupancy_grid_publisher_ GUARDED_BY(mutex_);
+  SubmapCanvas roi_canvas_ GUARDED_BY(mutex_);
+  std::unique_ptr<nav_msgs::OccupancyGrid> roi_occupancy_grid_
+      GUARDED_BY(mutex_);
+  ::ros::WallTimer roi_occupancy_grid_publisher_timer_;
+
+  // Taken after 'mutex_' if both are needed. The fetch threads never hold
+  // 'mutex_' while fetching, so painting does not wait on the network.
+  absl::Mutex fetch_mutex_;
+  std::deque<SubmapId> texture_fetch_queue_ GUARDED_BY(fetch_mutex_);
+  // Queued submaps and submaps being fetched.
+  std::set<SubmapId> pending_texture_fetches_ GUARDED_BY(fetch_mutex_);
+  bool shutting_down_ GUARDED_BY(fetch_mutex_) = false;
+  std::vector<std::thread> fetch_threads_;
 };
 
-Node::Node(const double resolution, const double publish_period_sec)
+Node::Node(const double resolution, const double publish_period_sec,
+           const int num_texture_fetch_threads)
     : resolution_(resolution),
-      client_(node_handle_.serviceClient<::cartographer_ros_msgs::SubmapQuery>(
-          kSubmapQueryServiceName)),
+      submap_canvas_(resolution),
       submap_list_subscriber_(node_handle_.subscribe(
-          kSubmapListTopic, kLatestOnlyPublisherQueueSize,
+          kSubmapListUpdatesTopic, kSubmapListUpdatesQueueSize,
           boost::function<void(
-              const cartographer_ros_msgs::SubmapList::ConstPtr&)>(
-              [this](const cartographer_ros_msgs::SubmapList::ConstPtr& msg) {
-                HandleSubmapList(msg);
-              }))),
+              const cartographer_ros_msgs::SubmapListUpdate::ConstPtr&)>(
+              [this](const cartographer_ros_msgs::SubmapListUpdate::ConstPtr&
+                         msg) { HandleSubmapListUpdate(msg); }))),
+      resync_submap_list_client_(
+          node_handle_.serviceClient<::cartographer_ros_msgs::ResyncSubmapList>(
+              kResyncSubmapListServiceName)),
+      submap_list_resync_timer_(node_handle_.createWallTimer(
+          ::ros::WallDuration(kSubmapListResyncPeriodSec),
+          &Node::ResyncSubmapList, this)),
       occupancy_grid_publisher_(
           node_handle_.advertise<::nav_msgs::OccupancyGrid>(
               FLAGS_occupancy_grid_topic, kLatestOnlyPublisherQueueSize,
+              [this](const ::ros::SingleSubscriberPublisher&) {
+                HandleOccupancyGridSubscriberConnected();
+              },
+              ::ros::SubscriberStatusCallback(), ::ros::VoidConstPtr(),
               true /* latched */)),
       occupancy_grid_publisher_timer_(
           node_handle_.createWallTimer(::ros::WallDuration(publish_period_sec),
-                                       &Node::DrawAndPublish, this)) {}
+                                       &Node::DrawAndPublish, this)),
+      roi_canvas_(resolution) {
+  if (FLAGS_publish_map_updates) {
+    absl::MutexLock locker(&mutex_);
+    occupancy_grid_update_publisher_ =
+        node_handle_.advertise<::map_msgs::OccupancyGridUpdate>(
+            FLAGS_occupancy_grid_topic + "_updates",
+            kLatestOnlyPublisherQueueSize);
+  }
+  {
+    std::vector<double> pyramid_resolutions;
+    for (const std::string& pyramid_resolution :
+         absl::StrSplit(FLAGS_pyramid_resolutions, ',', absl::SkipEmpty())) {
+      double value;
+      CHECK(absl::SimpleAtod(pyramid_resolution, &value))
+          << "Invalid resolution '" << pyramid_resolution << "'.";
+      pyramid_resolutions.push_back(value);
+    }
+    absl::MutexLock locker(&mutex_);
+    for (const int factor :
+         ComputeDownsamplingFactors(resolution, pyramid_resolutions)) {
+      pyramid_levels_.push_back(PyramidLevel{
+          factor,
+          node_handle_.advertise<::nav_msgs::OccupancyGrid>(
+              absl::StrCat(FLAGS_occupancy_grid_topic, "_level_",
+                           pyramid_levels_.size() + 1),
+              kLatestOnlyPublisherQueueSize, true /* latch */),
+          nullptr});
+    }
+  }
+  if (!FLAGS_roi_frame.empty()) {
+    tf_listener_ = absl::make_unique<::tf2_ros::TransformListener>(tf_buffer_);
+    {
+      absl::MutexLock locker(&mutex_);
+      roi_occupancy_grid_publisher_ =
+          node_handle_.advertise<::nav_msgs::OccupancyGrid>(
+              FLAGS_roi_occupancy_grid_topic, kLatestOnlyPublisherQueueSize);
+    }
+    roi_occupancy_grid_publisher_timer_ = node_handle_.createWallTimer(
+        ::ros::WallDuration(FLAGS_roi_publish_period_sec),
+        &Node::DrawAndPublishRoi, this);
+  }
+  CHECK_GT(num_texture_fetch_threads, 0);
+  for (int i = 0; i != num_texture_fetch_threads; ++i) {
+    // Each thread uses its own clients, so that queries run concurrently.
+    fetch_threads_.emplace_back(
+        &Node::FetchTextures, this,
+        node_handle_
+            .serviceClient<::cartographer_ros_msgs::BatchSubmapQuery>(
+                kBatchSubmapQueryServiceName),
+        node_handle_.serviceClient<::cartographer_ros_msgs::SubmapQuery>(
+            kSubmapQueryServiceName));
+  }
+}
+
+Node::~Node() {
+  {
+    absl::MutexLock locker(&fetch_mutex_);
+    shutting_down_ = true;
+  }
+  for (std::thread& thread : fetch_threads_) {
+    thread.join();
+  }
+}
 
-void Node::HandleSubmapList(
-    const cartographer_ros_msgs::SubmapList::ConstPtr& msg) {
+void Node::HandleSubmapListUpdate(
+    const cartographer_ros_msgs::SubmapListUpdate::ConstPtr& msg) {
   absl::MutexLock locker(&mutex_);
 
-  // We do not do any work if nobody listens.
-  if (occupancy_grid_publisher_.getNumSubscribers() == 0) {
+  // We do not do any work if nobody listens. Since updates are missed
+  // meanwhile, a full update is needed afterwards.
+  if (!MapHasSubscribers() &&
+      roi_occupancy_grid_publisher_.getNumSubscribers() == 0) {
+    submap_list_synced_ = false;
     return;
   }
 
-  // Keep track of submap IDs that don't appear in the message anymore.
-  std::set<SubmapId> submap_ids_to_delete;
-  for (const auto& pair : submap_slices_) {
-    submap_ids_to_delete.insert(pair.first);
+  const bool follows_last_update =
+      submap_list_synced_ &&
+      msg->sequence_number == submap_list_sequence_number_ + 1;
+  if (msg->full || follows_last_update) {
+    ApplySubmapListUpdate(*msg);
+    last_timestamp_ = msg->header.stamp;
+    last_frame_id_ = msg->header.frame_id;
+    return;
   }
+  submap_list_synced_ = false;
+  // An update was missed, so the next full update is requested. The
+  // service is not called here, which would happen for each update until
+  // the full one arrives.
+  submap_list_resync_needed_ = true;
+}
 
-  for (const auto& submap_msg : msg->submap) {
+void Node::ResyncSubmapList(const ::ros::WallTimerEvent& unused_timer_event) {
+  {
+    absl::MutexLock locker(&mutex_);
+    if (!submap_list_resync_needed_) {
+      return;
+    }
+    submap_list_resync_needed_ = false;
+  }
+  // Called without holding 'mutex_' to not delay painting.
+  ::cartographer_ros_msgs::ResyncSubmapList srv;
+  if (!resync_submap_list_client_.call(srv)) {
+    LOG(WARNING) << "Failed to request a full submap list update.";
+  }
+}
+
+void Node::ApplySubmapListUpdate(
+    const cartographer_ros_msgs::SubmapListUpdate& msg) {
+  submap_list_synced_ = true;
+  submap_list_sequence_number_ = msg.sequence_number;
+  if (msg.full) {
+    // Delete all submaps that don't appear in the message.
+    std::set<SubmapId> listed_submap_ids;
+    for (const auto& submap_msg : msg.submap) {
+      listed_submap_ids.insert(
+          SubmapId{submap_msg.trajectory_id, submap_msg.submap_index});
+    }
+    for (auto it = submap_slices_.begin(); it != submap_slices_.end();) {
+      if (listed_submap_ids.count(it->first) == 0) {
+        it = submap_slices_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  for (const auto& removed_submap_msg : msg.removed_submap) {
+    submap_slices_.erase(SubmapId{removed_submap_msg.trajectory_id,
+                                  removed_submap_msg.submap_index});
+  }
+
+  for (const auto& submap_msg : msg.submap) {
     const SubmapId id{submap_msg.trajectory_id, submap_msg.submap_index};
-    submap_ids_to_delete.erase(id);
     if ((submap_msg.is_frozen && !FLAGS_include_frozen_submaps) ||
         (!submap_msg.is_frozen && !FLAGS_include_unfrozen_submaps)) {
+      submap_slices_.erase(id);
       continue;
     }
     SubmapSlice& submap_slice = submap_slices_[id];
@@ -127,37 +367,88 @@ void Node::HandleSubmapList(
         submap_slice.version == submap_msg.submap_version) {
       continue;
     }
+    ScheduleTextureFetch(id);
+  }
+}
 
-    auto fetched_textures =
-        ::cartographer_ros::FetchSubmapTextures(id, &client_);
-    if (fetched_textures == nullptr) {
-      continue;
+void Node::ScheduleTextureFetch(const SubmapId& id) {
+  absl::MutexLock locker(&fetch_mutex_);
+  if (pending_texture_fetches_.insert(id).second) {
+    texture_fetch_queue_.push_back(id);
+  }
+}
+
+void Node::FetchTextures(::ros::ServiceClient batch_client,
+                         ::ros::ServiceClient client) {
+  for (;;) {
+    std::vector<SubmapId> ids;
+    {
+      absl::MutexLock locker(&fetch_mutex_);
+      fetch_mutex_.Await(absl::Condition(
+          +[](Node* node) EXCLUSIVE_LOCKS_REQUIRED(node->fetch_mutex_) {
+            return node->shutting_down_ ||
+                   !node->texture_fetch_queue_.empty();
+          },
+          this));
+      if (shutting_down_) {
+        return;
+      }
+      while (!texture_fetch_queue_.empty() &&
+             ids.size() < kMaxSubmapsPerBatchQuery) {
+        ids.push_back(texture_fetch_queue_.front());
+        texture_fetch_queue_.pop_front();
+      }
     }
-    CHECK(!fetched_textures->textures.empty());
-    submap_slice.version = fetched_textures->version;
 
-    // We use the first texture only. By convention this is the highest
-    // resolution texture and that is the one we want to use to construct the
-    // map for ROS.
-    const auto fetched_texture = fetched_textures->textures.begin();
-    submap_slice.width = fetched_texture->width;
-    submap_slice.height = fetched_texture->height;
-    submap_slice.slice_pose = fetched_texture->slice_pose;
-    submap_slice.resolution = fetched_texture->resolution;
-    submap_slice.cairo_data.clear();
-    submap_slice.surface = ::cartographer::io::DrawTexture(
-        fetched_texture->pixels.intensity, fetched_texture->pixels.alpha,
-        fetched_texture->width, fetched_texture->height,
-        &submap_slice.cairo_data);
-  }
+    std::map<SubmapId, int> known_submap_versions;
+    {
+      absl::MutexLock locker(&mutex_);
+      for (const SubmapId& id : ids) {
+        const auto it = submap_slices_.find(id);
+        if (it != submap_slices_.end()) {
+          known_submap_versions[id] =
+              it->second.surface != nullptr ? it->second.version : -1;
+        }
+      }
+    }
+    const auto fetched_textures =
+        ::cartographer_ros::FetchSubmapTextures(
+            known_submap_versions, &batch_client, &client,
+            FLAGS_fetch_lz4_submap_cells
+                ? cartographer_ros_msgs::SubmapTexture::CELLS_ENCODING_LZ4
+                : cartographer_ros_msgs::SubmapTexture::CELLS_ENCODING_GZIP);
+    for (const auto& entry : fetched_textures) {
+      CHECK(!entry.second->textures.empty());
+      // We use the first texture only. By convention this is the highest
+      // resolution texture and that is the one we want to use to construct
+      // the map for ROS.
+      const auto fetched_texture = entry.second->textures.begin();
+      std::vector<uint32_t> cairo_data;
+      auto surface = ::cartographer::io::DrawTexture(
+          fetched_texture->pixels.intensity, fetched_texture->pixels.alpha,
+          fetched_texture->width, fetched_texture->height, &cairo_data);
 
-  // Delete all submaps that didn't appear in the message.
-  for (const auto& id : submap_ids_to_delete) {
-    submap_slices_.erase(id);
-  }
+      absl::MutexLock locker(&mutex_);
+      // The submap may have been deleted while it was fetched.
+      auto it = submap_slices_.find(entry.first);
+      if (it != submap_slices_.end()) {
+        SubmapSlice& submap_slice = it->second;
+        submap_slice.version = entry.second->version;
+        submap_slice.width = fetched_texture->width;
+        submap_slice.height = fetched_texture->height;
+        submap_slice.slice_pose = fetched_texture->slice_pose;
+        submap_slice.resolution = fetched_texture->resolution;
+        // Moving keeps the pixels referenced by 'surface' in place.
+        submap_slice.cairo_data = std::move(cairo_data);
+        submap_slice.surface = std::move(surface);
+      }
+    }
 
-  last_timestamp_ = msg->header.stamp;
-  last_frame_id_ = msg->header.frame_id;
+    absl::MutexLock locker(&fetch_mutex_);
+    for (const SubmapId& id : ids) {
+      pending_texture_fetches_.erase(id);
+    }
+  }
 }
 
 void Node::DrawAndPublish(const ::ros::WallTimerEvent& unused_timer_event) {
@@ -165,10 +456,127 @@ void Node::DrawAndPublish(const ::ros::WallTimerEvent& unused_timer_event) {
   if (submap_slices_.empty() || last_frame_id_.empty()) {
     return;
   }
-  auto painted_slices = PaintSubmapSlices(submap_slices_, resolution_);
-  std::unique_ptr<nav_msgs::OccupancyGrid> msg_ptr = CreateOccupancyGridMsg(
-      painted_slices, resolution_, last_frame_id_, last_timestamp_);
-  occupancy_grid_publisher_.publish(*msg_ptr);
+  // The whole map is not painted if only the region of interest is listened
+  // to.
+  if (!MapHasSubscribers()) {
+    return;
+  }
+  const bool changed = submap_canvas_.Update(submap_slices_);
+  const ::ros::WallTime now = ::ros::WallTime::now();
+  if (FLAGS_publish_map_updates && occupancy_grid_ != nullptr &&
+      !submap_canvas_.reallocated() && !full_occupancy_grid_requested_ &&
+      now < next_full_occupancy_grid_time_) {
+    if (changed) {
+      PublishOccupancyGridUpdate();
+    }
+    PublishPyramidLevels(changed);
+    return;
+  }
+
+  if (occupancy_grid_ == nullptr || submap_canvas_.reallocated()) {
+    occupancy_grid_ =
+        CreateOccupancyGridMsg(submap_canvas_.GetResult(), resolution_,
+                               last_frame_id_, last_timestamp_);
+  } else {
+    if (changed) {
+      PublishOccupancyGridUpdate();
+    }
+    occupancy_grid_->header.frame_id = last_frame_id_;
+    occupancy_grid_->header.stamp = last_timestamp_;
+  }
+  occupancy_grid_publisher_.publish(*occupancy_grid_);
+  PublishPyramidLevels(changed);
+  full_occupancy_grid_requested_ = false;
+  next_full_occupancy_grid_time_ =
+      now + ::ros::WallDuration(FLAGS_full_map_period_sec);
+}
+
+void Node::PublishPyramidLevels(const bool changed) {
+  for (PyramidLevel& level : pyramid_levels_) {
+    if (level.publisher.getNumSubscribers() == 0) {
+      // Downsampled again when subscribed to.
+      level.occupancy_grid.reset();
+      continue;
+    }
+    if (changed || level.occupancy_grid == nullptr) {
+      level.occupancy_grid =
+          DownsampleOccupancyGrid(*occupancy_grid_, level.factor);
+    }
+    level.occupancy_grid->header.frame_id = last_frame_id_;
+    level.occupancy_grid->header.stamp = last_timestamp_;
+    level.publisher.publish(*level.occupancy_grid);
+  }
+}
+
+bool Node::MapHasSubscribers() {
+  if (occupancy_grid_publisher_.getNumSubscribers() != 0 ||
+      occupancy_grid_update_publisher_.getNumSubscribers() != 0) {
+    return true;
+  }
+  for (const PyramidLevel& level : pyramid_levels_) {
+    if (level.publisher.getNumSubscribers() != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Node::DrawAndPublishRoi(const ::ros::WallTimerEvent& unused_timer_event) {
+  absl::MutexLock locker(&mutex_);
+  if (submap_slices_.empty() || last_frame_id_.empty() ||
+      roi_occupancy_grid_publisher_.getNumSubscribers() == 0) {
+    return;
+  }
+  geometry_msgs::TransformStamped roi_transform;
+  try {
+    roi_transform = tf_buffer_.lookupTransform(last_frame_id_, FLAGS_roi_frame,
+                                               ::ros::Time(0.));
+  } catch (const tf2::TransformException& ex) {
+    LOG(WARNING) << "Cannot place the region of interest: " << ex.what();
+    return;
+  }
+  const auto& translation = roi_transform.transform.translation;
+  const bool changed = roi_canvas_.Update(
+      submap_slices_,
+      ComputeWindow(resolution_, Eigen::Vector2d(translation.x, translation.y),
+                    FLAGS_roi_size));
+  if (changed || roi_occupancy_grid_ == nullptr) {
+    roi_occupancy_grid_ =
+        CreateOccupancyGridMsg(roi_canvas_.GetResult(), resolution_,
+                               last_frame_id_, roi_transform.header.stamp);
+  } else {
+    roi_occupancy_grid_->header.frame_id = last_frame_id_;
+    roi_occupancy_grid_->header.stamp = roi_transform.header.stamp;
+  }
+  roi_occupancy_grid_publisher_.publish(*roi_occupancy_grid_);
+}
+
+void Node::HandleOccupancyGridSubscriberConnected() {
+  absl::MutexLock locker(&mutex_);
+  full_occupancy_grid_requested_ = true;
+}
+
+void Node::PublishOccupancyGridUpdate() {
+  const SubmapCanvas::PixelBox box = submap_canvas_.changed_box();
+  if (box.isEmpty()) {
+    return;
+  }
+  const Eigen::Vector2i sizes = box.sizes();
+  const std::unique_ptr<map_msgs::OccupancyGridUpdate> update =
+      CreateOccupancyGridUpdateMsg(submap_canvas_.GetResult(), box.min().x(),
+                                   box.min().y(), sizes.x(), sizes.y(),
+                                   last_frame_id_, last_timestamp_);
+  // Keep the full grid up to date so that it never has to be converted again
+  // unless the canvas is reallocated.
+  const size_t width = occupancy_grid_->info.width;
+  for (size_t row = 0; row < update->height; ++row) {
+    std::copy_n(update->data.begin() + row * update->width, update->width,
+                occupancy_grid_->data.begin() + (update->y + row) * width +
+                    update->x);
+  }
+  if (occupancy_grid_update_publisher_) {
+    occupancy_grid_update_publisher_.publish(*update);
+  }
 }
 
 }  // namespace
@@ -185,7 +593,8 @@ int main(int argc, char** argv) {
   ::ros::start();
 
   cartographer_ros::ScopedRosLogSink ros_log_sink;
-  ::cartographer_ros::Node node(FLAGS_resolution, FLAGS_publish_period_sec);
+  ::cartographer_ros::Node node(FLAGS_resolution, FLAGS_publish_period_sec,
+                                FLAGS_num_texture_fetch_threads);
 
   ::ros::spin();
   ::ros::shutdown();
@@ -0,0 +1,241 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Runs the offline node on a set of bags and configurations and writes the
+// timings of its stages to a report, to compare builds.
+
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_replace.h"
+#include "absl/strings/str_split.h"
+#include "cartographer/mapping/map_builder.h"
+#include "cartographer_ros/offline_node.h"
+#include "cartographer_ros/ros_log_sink.h"
+#include "gflags/gflags.h"
+#include "ros/ros.h"
+
+DECLARE_string(configuration_basenames);
+DECLARE_string(bag_filenames);
+DECLARE_bool(collect_metrics);
+DECLARE_bool(keep_running);
+
+DEFINE_string(benchmark_runs, "",
+              "Semicolon-separated list of runs, each given as "
+              "'<configuration_basenames>:<bag_filenames>' with the "
+              "comma-separated lists of -configuration_basenames and "
+              "-bag_filenames.");
+DEFINE_int32(benchmark_repetitions, 1, "Number of times each run is done.");
+DEFINE_string(benchmark_report_filename, "",
+              "File the report is written to, as CSV if the name ends in "
+              "'.csv' and as JSON otherwise.");
+
+namespace cartographer_ros {
+namespace {
+
+struct BenchmarkRun {
+  std::string configuration_basenames;
+  std::string bag_filenames;
+  int repetition;
+  OfflineNodeReport report;
+};
+
+// The stages of 'OfflineNodeReport' in report order.
+std::vector<std::pair<std::string, double>> GetStages(
+    const OfflineNodeReport& report) {
+  return {{"bag_read_sec", report.bag_read_sec},
+          {"sensor_data_sec", report.sensor_data_sec},
+          {"conversion_sec", report.conversion_sec},
+          {"local_slam_sec", report.local_slam_sec},
+          {"range_data_wait_sec", report.range_data_wait_sec},
+          {"final_optimization_sec", report.final_optimization_sec},
+          {"serialization_sec", report.serialization_sec},
+          {"total_sec", report.total_sec},
+          {"cpu_sec", report.cpu_sec},
+          {"bag_duration_sec", report.bag_duration_sec}};
+}
+
+std::string Quote(const std::string& value) {
+  std::string quoted = "\"";
+  for (const char c : value) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+std::string CsvQuote(const std::string& value) {
+  return absl::StrCat(
+      "\"", absl::StrReplaceAll(value, {{"\"", "\"\""}}), "\"");
+}
+
+// JSON has no infinity, the last histogram bucket boundary is written as null.
+void WriteJsonNumber(const double value, std::ostream* out) {
+  if (std::isfinite(value)) {
+    *out << value;
+  } else {
+    *out << "null";
+  }
+}
+
+void WriteJsonMetricFamilies(
+    const std::vector<cartographer_ros_msgs::MetricFamily>& metric_families,
+    std::ostream* out) {
+  *out << "[";
+  for (size_t i = 0; i < metric_families.size(); ++i) {
+    const auto& metric_family = metric_families[i];
+    *out << (i == 0 ? "" : ",") << "\n      {\"name\": "
+         << Quote(metric_family.name) << ", \"metrics\": [";
+    for (size_t j = 0; j < metric_family.metrics.size(); ++j) {
+      const auto& metric = metric_family.metrics[j];
+      *out << (j == 0 ? "" : ", ") << "{\"labels\": {";
+      for (size_t k = 0; k < metric.labels.size(); ++k) {
+        *out << (k == 0 ? "" : ", ") << Quote(metric.labels[k].key) << ": "
+             << Quote(metric.labels[k].value);
+      }
+      *out << "}, \"value\": ";
+      WriteJsonNumber(metric.value, out);
+      if (metric.type == cartographer_ros_msgs::Metric::TYPE_HISTOGRAM) {
+        *out << ", \"buckets\": [";
+        for (size_t k = 0; k < metric.counts_by_bucket.size(); ++k) {
+          *out << (k == 0 ? "[" : ", [");
+          WriteJsonNumber(metric.counts_by_bucket[k].bucket_boundary, out);
+          *out << ", " << metric.counts_by_bucket[k].count << "]";
+        }
+        *out << "]";
+      }
+      *out << "}";
+    }
+    *out << "]}";
+  }
+  *out << "]";
+}
+
+void WriteJsonReport(const std::vector<BenchmarkRun>& runs,
+                     std::ostream* out) {
+  *out << "{\"hardware_concurrency\": " << std::thread::hardware_concurrency()
+       << ",\n \"runs\": [";
+  for (size_t i = 0; i < runs.size(); ++i) {
+    const BenchmarkRun& run = runs[i];
+    *out << (i == 0 ? "" : ",") << "\n  {\"configuration_basenames\": "
+         << Quote(run.configuration_basenames)
+         << ",\n   \"bag_filenames\": " << Quote(run.bag_filenames)
+         << ",\n   \"repetition\": " << run.repetition
+         << ",\n   \"num_sensor_messages\": " << run.report.num_sensor_messages
+         << ",\n   \"peak_memory_kib\": " << run.report.peak_memory_kib;
+    for (const auto& stage : GetStages(run.report)) {
+      *out << ",\n   " << Quote(stage.first) << ": " << stage.second;
+    }
+    *out << ",\n   \"metric_families\": ";
+    WriteJsonMetricFamilies(run.report.metric_families, out);
+    *out << "}";
+  }
+  *out << "]}\n";
+}
+
+// Metrics are left out of the CSV report, it only has a row per run.
+void WriteCsvReport(const std::vector<BenchmarkRun>& runs, std::ostream* out) {
+  *out << "configuration_basenames,bag_filenames,repetition,"
+          "num_sensor_messages,peak_memory_kib";
+  for (const auto& stage : GetStages(OfflineNodeReport())) {
+    *out << "," << stage.first;
+  }
+  *out << "\n";
+  for (const BenchmarkRun& run : runs) {
+    *out << CsvQuote(run.configuration_basenames) << ","
+         << CsvQuote(run.bag_filenames) << "," << run.repetition << ","
+         << run.report.num_sensor_messages << ","
+         << run.report.peak_memory_kib;
+    for (const auto& stage : GetStages(run.report)) {
+      *out << "," << stage.second;
+    }
+    *out << "\n";
+  }
+}
+
+void Run() {
+  const cartographer_ros::MapBuilderFactory map_builder_factory =
+      [](const ::cartographer::mapping::proto::MapBuilderOptions&
+             map_builder_options) {
+        return ::cartographer::mapping::CreateMapBuilder(map_builder_options);
+      };
+
+  std::vector<BenchmarkRun> runs;
+  for (const std::string& run_flag :
+       absl::StrSplit(FLAGS_benchmark_runs, ';', absl::SkipEmpty())) {
+    const std::vector<std::string> parts = absl::StrSplit(run_flag, ':');
+    CHECK_EQ(parts.size(), 2) << "Invalid run '" << run_flag << "'.";
+    for (int repetition = 0; repetition < FLAGS_benchmark_repetitions;
+         ++repetition) {
+      if (!::ros::ok()) {
+        return;
+      }
+      BenchmarkRun run{parts[0], parts[1], repetition, OfflineNodeReport()};
+      LOG(INFO) << "Running " << run.configuration_basenames << " on "
+                << run.bag_filenames << ", repetition " << repetition << ".";
+      FLAGS_configuration_basenames = run.configuration_basenames;
+      FLAGS_bag_filenames = run.bag_filenames;
+      RunOfflineNode(map_builder_factory, &run.report);
+      runs.push_back(std::move(run));
+    }
+  }
+
+  std::ofstream report_file(FLAGS_benchmark_report_filename);
+  CHECK(report_file) << "Cannot write '" << FLAGS_benchmark_report_filename
+                     << "'.";
+  report_file << std::setprecision(9);
+  if (absl::EndsWith(FLAGS_benchmark_report_filename, ".csv")) {
+    WriteCsvReport(runs, &report_file);
+  } else {
+    WriteJsonReport(runs, &report_file);
+  }
+  LOG(INFO) << "Wrote the report of " << runs.size() << " runs to '"
+            << FLAGS_benchmark_report_filename << "'.";
+}
+
+}  // namespace
+}  // namespace cartographer_ros
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  CHECK(!FLAGS_benchmark_runs.empty()) << "-benchmark_runs is missing.";
+  CHECK(!FLAGS_benchmark_report_filename.empty())
+      << "-benchmark_report_filename is missing.";
+  CHECK_GT(FLAGS_benchmark_repetitions, 0);
+  CHECK(!FLAGS_keep_running) << "-keep_running cannot be used for benchmarks.";
+  // The conversion time is estimated from the metrics.
+  FLAGS_collect_metrics = true;
+
+  ::ros::init(argc, argv, "cartographer_offline_benchmark");
+  ::ros::start();
+
+  cartographer_ros::ScopedRosLogSink ros_log_sink;
+  cartographer_ros::Run();
+
+  ::ros::shutdown();
+}
@@ -23,11 +23,20 @@
 #endif
 #include <time.h>
 
+#include <algorithm>
 #include <chrono>
 
+#include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "absl/time/time.h"
+#include "cartographer_ros/metrics/latency.h"
 #include "cartographer_ros/node.h"
+#include "cartographer_ros/offline_transform_store.h"
 #include "cartographer_ros/playable_bag.h"
+#include "cartographer_ros/range_data_backpressure.h"
 #include "cartographer_ros/urdf_reader.h"
 #include "gflags/gflags.h"
 #include "ros/callback_queue.h"
@@ -58,27 +67,44 @@ DEFINE_string(urdf_filenames, "",
               "static links for the sensor configuration(s).");
 DEFINE_bool(use_bag_transforms, true,
             "Whether to read, use and republish transforms from bags.");
+DEFINE_bool(publish_bag_transforms, true,
+            "Whether to republish the transforms read from bags, if anybody "
+            "subscribed to them.");
 DEFINE_string(load_state_filename, "",
-              "If non-empty, filename of a .pbstream file to load, containing "
-              "a saved SLAM state.");
+              "If non-empty, comma-separated list of .pbstream files to load, "
+              "containing saved SLAM states.");
 DEFINE_bool(load_frozen_state, true,
             "Load the saved state as frozen (non-optimized) trajectories.");
 DEFINE_string(save_state_filename, "",
               "Explicit name of the file to which the serialized state will be "
               "written before shutdown. If left empty, the filename will be "
               "inferred from the first bagfile's name as: "
-              "<bag_filenames[0]>.pbstream");
+              "<bag_filenames[0]>.pbstream. With -num_shards, the shard index "
+              "is added, e.g. 'state_1.pbstream' for 'state.pbstream'.");
+DEFINE_int32(num_shards, 1,
+             "Splits -bag_filenames into this many groups of consecutive bags, "
+             "of which only the one given by -shard_index is processed. Each "
+             "shard can run in its own process and the states they write can "
+             "be merged with -search_cross_trajectory_constraints.");
+DEFINE_int32(shard_index, 0, "Index of the shard to process, see -num_shards.");
+DEFINE_bool(search_cross_trajectory_constraints, false,
+            "Before the final optimization, search constraints between the "
+            "trajectories which are not connected yet, e.g. those of the "
+            "states of several shards loaded with -load_frozen_state=false.");
 DEFINE_bool(keep_running, false,
             "Keep running the offline node after all messages from the bag "
             "have been processed.");
 DEFINE_double(skip_seconds, 0,
               "Optional amount of seconds to skip from the beginning "
               "(i.e. when the earliest bag starts.). ");
+DEFINE_int32(max_queued_range_data, 1000,
+             "Maximum number of range data messages per trajectory which are "
+             "not yet part of the optimized map. Reading the bags waits for "
+             "SLAM above it. Non-positive values disable waiting.");
 
 namespace cartographer_ros {
 
 constexpr char kClockTopic[] = "clock";
-constexpr char kTfStaticTopic[] = "/tf_static";
 constexpr char kTfTopic[] = "tf";
 constexpr double kClockPublishFrequencySec = 1. / 30.;
 constexpr int kSingleThreaded = 1;
@@ -86,15 +112,113 @@ constexpr int kSingleThreaded = 1;
 // the assumption of higher frequency tf this should ensure that tf can
 // always interpolate.
 const ::ros::Duration kDelay = ::ros::Duration(1.0);
+// Transforms older than this behind playback are dropped, like in a
+// 'tf2_ros::Buffer' with its default cache time.
+const ::ros::Duration kTransformCacheDuration = ::ros::Duration(10.0);
+// Waiting for global SLAM stops if it does not optimize for this long, e.g.
+// because periodic optimization is disabled.
+const absl::Duration kBackpressureStallTimeout = absl::Seconds(10.);
+
+// Waits for SLAM to catch up if needed, before range data is handed to the
+// node, which counts it as queued. Returns the time spent waiting.
+absl::Duration WaitForRangeDataCapacity(
+    const int trajectory_id, RangeDataBackpressure* const backpressure) {
+  if (FLAGS_max_queued_range_data <= 0) {
+    return absl::ZeroDuration();
+  }
+  return backpressure->WaitForCapacity(
+      trajectory_id, FLAGS_max_queued_range_data, kBackpressureStallTimeout);
+}
+
+// Estimates the total conversion time of 'num_messages' from the sampled
+// conversion latencies in 'metric_families'.
+double EstimateConversionSeconds(
+    const std::vector<cartographer_ros_msgs::MetricFamily>& metric_families,
+    const int64_t num_messages) {
+  for (const auto& metric_family : metric_families) {
+    if (metric_family.name !=
+        metrics::GetLatencyMetricName(metrics::LatencyStage::kConversion)) {
+      continue;
+    }
+    double sampled_seconds = 0.;
+    double num_samples = 0.;
+    for (const auto& metric : metric_family.metrics) {
+      sampled_seconds += metric.value;
+      for (const auto& bucket : metric.counts_by_bucket) {
+        num_samples += bucket.count;
+      }
+    }
+    return num_samples > 0. ? sampled_seconds * num_messages / num_samples
+                            : 0.;
+  }
+  return 0.;
+}
+
+#ifdef __linux__
+// The CPU time of all threads of the process.
+double GetProcessCpuSeconds() {
+  timespec cpu_timespec = {};
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_timespec);
+  return cpu_timespec.tv_sec + 1e-9 * cpu_timespec.tv_nsec;
+}
+#endif
+
+// Keeps only the bags of the shard given by '-shard_index' and their
+// trajectory options.
+void SelectShard(std::vector<std::string>* const bag_filenames,
+                 std::vector<TrajectoryOptions>* const bag_trajectory_options) {
+  CHECK_GE(FLAGS_num_shards, 1) << "-num_shards has to be positive.";
+  CHECK_GE(FLAGS_shard_index, 0);
+  CHECK_LT(FLAGS_shard_index, FLAGS_num_shards)
+      << "-shard_index has to be smaller than -num_shards.";
+  if (FLAGS_num_shards == 1) {
+    return;
+  }
+  const int num_bags = static_cast<int>(bag_filenames->size());
+  CHECK_LE(FLAGS_num_shards, num_bags)
+      << "There are fewer bags than -num_shards.";
+  int begin;
+  int end;
+  std::tie(begin, end) =
+      GetShardBagRange(num_bags, FLAGS_num_shards, FLAGS_shard_index);
+  *bag_filenames = std::vector<std::string>(bag_filenames->begin() + begin,
+                                            bag_filenames->begin() + end);
+  *bag_trajectory_options = std::vector<TrajectoryOptions>(
+      bag_trajectory_options->begin() + begin,
+      bag_trajectory_options->begin() + end);
+  LOG(INFO) << "Processing shard " << FLAGS_shard_index << " of "
+            << FLAGS_num_shards << " with bags " << begin << " to " << end - 1
+            << ".";
+}
+
+std::string GetShardStateFilename(const std::string& filename,
+                                  const int num_shards, const int shard_index) {
+  if (num_shards == 1) {
+    return filename;
+  }
+  constexpr char kExtension[] = ".pbstream";
+  if (absl::EndsWith(filename, kExtension)) {
+    return absl::StrCat(absl::StripSuffix(filename, kExtension), "_",
+                        shard_index, kExtension);
+  }
+  return absl::StrCat(filename, "_", shard_index);
+}
+
+std::pair<int, int> GetShardBagRange(const int num_bags, const int num_shards,
+                                     const int shard_index) {
+  return {num_bags * shard_index / num_shards,
+          num_bags * (shard_index + 1) / num_shards};
+}
 
-void RunOfflineNode(const MapBuilderFactory& map_builder_factory) {
+void RunOfflineNode(const MapBuilderFactory& map_builder_factory,
+                    OfflineNodeReport* const report) {
   CHECK(!FLAGS_configuration_directory.empty())
       << "-configuration_directory is missing.";
   CHECK(!FLAGS_configuration_basenames.empty())
       << "-configuration_basenames is missing.";
   CHECK(!(FLAGS_bag_filenames.empty() && FLAGS_load_state_filename.empty()))
       << "-bag_filenames and -load_state_filename cannot both be unspecified.";
-  const std::vector<std::string> bag_filenames =
+  std::vector<std::string> bag_filenames =
       absl::StrSplit(FLAGS_bag_filenames, ',', absl::SkipEmpty());
   cartographer_ros::NodeOptions node_options;
   const std::vector<std::string> configuration_basenames =
@@ -116,36 +240,47 @@ void RunOfflineNode(const MapBuilderFactory& map_builder_factory) {
   if (bag_filenames.size() > 0) {
     CHECK_EQ(bag_trajectory_options.size(), bag_filenames.size());
   }
+  SelectShard(&bag_filenames, &bag_trajectory_options);
 
   // Since we preload the transform buffer, we should never have to wait for a
   // transform. When we finish processing the bag, we will simply drop any
   // remaining sensor data that cannot be transformed due to missing transforms.
   node_options.lookup_transform_timeout_sec = 0.;
 
-  auto map_builder = map_builder_factory(node_options.map_builder_options);
+  ThreadGroups thread_groups(node_options.thread_groups);
+  std::unique_ptr<cartographer::mapping::MapBuilderInterface> map_builder;
+  thread_groups.Capture(kBackgroundOptimizationThreadGroup, [&]() {
+    map_builder = map_builder_factory(node_options.map_builder_options);
+  });
 
   const std::chrono::time_point<std::chrono::steady_clock> start_time =
       std::chrono::steady_clock::now();
+#ifdef __linux__
+  // Taken before the run, since a benchmark does several in one process.
+  const double start_cpu_seconds = GetProcessCpuSeconds();
+#endif
 
-  tf2_ros::Buffer tf_buffer;
+  OfflineTransformStore tf_buffer;
 
   std::vector<geometry_msgs::TransformStamped> urdf_transforms;
   const std::vector<std::string> urdf_filenames =
       absl::StrSplit(FLAGS_urdf_filenames, ',', absl::SkipEmpty());
   for (const auto& urdf_filename : urdf_filenames) {
     const auto current_urdf_transforms =
-        ReadStaticTransformsFromUrdf(urdf_filename, &tf_buffer);
+        ReadStaticTransformsFromUrdf(urdf_filename, nullptr /* tf_buffer */);
+    for (const auto& transform : current_urdf_transforms) {
+      tf_buffer.SetTransform(transform, true /* is_static */);
+    }
     urdf_transforms.insert(urdf_transforms.end(),
                            current_urdf_transforms.begin(),
                            current_urdf_transforms.end());
   }
 
-  tf_buffer.setUsingDedicatedThread(true);
-
   Node node(node_options, std::move(map_builder), &tf_buffer,
-            FLAGS_collect_metrics);
-  if (!FLAGS_load_state_filename.empty()) {
-    node.LoadState(FLAGS_load_state_filename, FLAGS_load_frozen_state);
+            FLAGS_collect_metrics, &thread_groups);
+  for (const std::string& load_state_filename :
+       absl::StrSplit(FLAGS_load_state_filename, ',', absl::SkipEmpty())) {
+    node.LoadState(load_state_filename, FLAGS_load_frozen_state);
   }
 
   ::ros::Publisher tf_publisher =
@@ -187,6 +322,19 @@ void RunOfflineNode(const MapBuilderFactory& map_builder_factory) {
   }
   CHECK_EQ(bag_expected_sensor_ids.size(), bag_filenames.size());
 
+  // Bags are read from 'bag_start_time' on, seeking over the skipped seconds
+  // instead of reading them.
+  ros::Time bag_start_time = ros::TIME_MIN;
+  if (FLAGS_skip_seconds > 0. && !bag_filenames.empty()) {
+    ros::Time earliest_begin_time = ros::TIME_MAX;
+    for (const std::string& bag_filename : bag_filenames) {
+      rosbag::Bag bag(bag_filename, rosbag::bagmode::Read);
+      earliest_begin_time =
+          std::min(earliest_begin_time, rosbag::View(bag).getBeginTime());
+    }
+    bag_start_time = earliest_begin_time + ros::Duration(FLAGS_skip_seconds);
+  }
+
   std::map<std::pair<int /* bag_index */, std::string>,
            cartographer::mapping::TrajectoryBuilderInterface::SensorId>
       bag_topic_to_sensor_id;
@@ -212,30 +360,27 @@ void RunOfflineNode(const MapBuilderFactory& map_builder_factory) {
       bag_topic_to_sensor_id[bag_resolved_topic] = expected_sensor_id;
     }
 
-    playable_bag_multiplexer.AddPlayableBag(PlayableBag(
-        bag_filename, current_bag_index, ros::TIME_MIN, ros::TIME_MAX, kDelay,
+    playable_bag_multiplexer.AddPlayableBag(absl::make_unique<PlayableBag>(
+        bag_filename, current_bag_index, bag_start_time, ros::TIME_MAX, kDelay,
         // PlayableBag::FilteringEarlyMessageHandler is used to get an early
         // peek at the tf messages in the bag and insert them into 'tf_buffer'.
         // When a message is retrieved by GetNextMessage() further below,
         // we will have already inserted further 'kDelay' seconds worth of
         // transforms into 'tf_buffer' via this lambda.
-        [&tf_publisher, &tf_buffer](const rosbag::MessageInstance& msg) {
-          if (msg.isType<tf2_msgs::TFMessage>()) {
+        [&tf_publisher, &tf_buffer](const PlayableBag::Message& msg) {
+          if (msg.type() == BagMessageType::kTfMessage) {
             if (FLAGS_use_bag_transforms) {
               const auto tf_message = msg.instantiate<tf2_msgs::TFMessage>();
-              tf_publisher.publish(tf_message);
+              if (FLAGS_publish_bag_transforms &&
+                  tf_publisher.getNumSubscribers() > 0) {
+                tf_publisher.publish(tf_message);
+              }
 
+              // We make sure that tf_messages are inserted before any data
+              // messages, so that tf lookups always work.
               for (const auto& transform : tf_message->transforms) {
-                try {
-                  // We need to keep 'tf_buffer' small because it becomes very
-                  // inefficient otherwise. We make sure that tf_messages are
-                  // published before any data messages, so that tf lookups
-                  // always work.
-                  tf_buffer.setTransform(transform, "unused_authority",
-                                         msg.getTopic() == kTfStaticTopic);
-                } catch (const tf2::TransformException& ex) {
-                  LOG(WARNING) << ex.what();
-                }
+                tf_buffer.SetTransform(transform,
+                                       msg.getTopic() == kTfStaticTopic);
               }
             }
             // Tell 'PlayableBag' to filter the tf message since there is no
@@ -244,6 +389,18 @@ void RunOfflineNode(const MapBuilderFactory& map_builder_factory) {
           } else {
             return true;
           }
+        },
+        // Connections of topics without a sensor are not read at all.
+        [&node, &bag_topic_to_sensor_id,
+         current_bag_index](const rosbag::ConnectionInfo& connection_info) {
+          if (GetBagMessageType(connection_info) ==
+              BagMessageType::kTfMessage) {
+            return FLAGS_use_bag_transforms;
+          }
+          return bag_topic_to_sensor_id.count(std::make_pair(
+                     static_cast<int>(current_bag_index),
+                     node.node_handle()->resolveName(
+                         connection_info.topic, false /* resolve */))) != 0;
         }));
   }
 
@@ -269,24 +426,37 @@ void RunOfflineNode(const MapBuilderFactory& map_builder_factory) {
   }
 
   std::unordered_map<int, int> bag_index_to_trajectory_id;
-  const ros::Time begin_time =
-      // If no bags were loaded, we cannot peek the time of first message.
-      playable_bag_multiplexer.IsMessageAvailable()
-          ? playable_bag_multiplexer.PeekMessageTime()
-          : ros::Time();
+  RangeDataBackpressure* const range_data_backpressure =
+      FLAGS_max_queued_range_data > 0 ? node.EnableRangeDataBackpressure()
+                                      : nullptr;
+  absl::Duration range_data_wait_duration;
+  absl::Duration bag_read_duration;
+  absl::Duration sensor_data_duration;
+  int64_t num_sensor_messages = 0;
+  ros::Time first_message_time;
+  ros::Time last_message_time;
+  ros::Time next_trim_time = ros::TIME_MIN;
   while (playable_bag_multiplexer.IsMessageAvailable()) {
     if (!::ros::ok()) {
       return;
     }
 
+    const absl::Time bag_read_start_time = absl::Now();
     const auto next_msg_tuple = playable_bag_multiplexer.GetNextMessage();
-    const rosbag::MessageInstance& msg = std::get<0>(next_msg_tuple);
+    bag_read_duration += absl::Now() - bag_read_start_time;
+    const PlayableBag::Message& msg = std::get<0>(next_msg_tuple);
     const int bag_index = std::get<1>(next_msg_tuple);
     const bool is_last_message_in_bag = std::get<2>(next_msg_tuple);
 
-    if (msg.getTime() < (begin_time + ros::Duration(FLAGS_skip_seconds))) {
+    if (msg.getTime() < bag_start_time) {
       continue;
     }
+    if (msg.getTime() >= next_trim_time) {
+      if (msg.getTime() > ros::Time(0.) + kTransformCacheDuration) {
+        tf_buffer.TrimBefore(msg.getTime() - kTransformCacheDuration);
+      }
+      next_trim_time = msg.getTime() + kDelay;
+    }
 
     int trajectory_id;
     // Lazily add trajectories only when the first message arrives in order
@@ -312,37 +482,62 @@ void RunOfflineNode(const MapBuilderFactory& map_builder_factory) {
     auto it = bag_topic_to_sensor_id.find(bag_topic);
     if (it != bag_topic_to_sensor_id.end()) {
       const std::string& sensor_id = it->second.id;
-      if (msg.isType<sensor_msgs::LaserScan>()) {
-        node.HandleLaserScanMessage(trajectory_id, sensor_id,
-                                    msg.instantiate<sensor_msgs::LaserScan>());
+      const absl::Time sensor_data_start_time = absl::Now();
+      const absl::Duration range_data_wait_start = range_data_wait_duration;
+      switch (msg.type()) {
+        case BagMessageType::kLaserScan: {
+          const auto laser_scan = msg.instantiate<sensor_msgs::LaserScan>();
+          range_data_wait_duration +=
+              WaitForRangeDataCapacity(trajectory_id, range_data_backpressure);
+          node.HandleLaserScanMessage(trajectory_id, sensor_id, laser_scan);
+          break;
+        }
+        case BagMessageType::kMultiEchoLaserScan: {
+          const auto multi_echo_laser_scan =
+              msg.instantiate<sensor_msgs::MultiEchoLaserScan>();
+          range_data_wait_duration +=
+              WaitForRangeDataCapacity(trajectory_id, range_data_backpressure);
+          node.HandleMultiEchoLaserScanMessage(trajectory_id, sensor_id,
+                                               multi_echo_laser_scan);
+          break;
+        }
+        case BagMessageType::kPointCloud2: {
+          const auto point_cloud = msg.instantiate<sensor_msgs::PointCloud2>();
+          range_data_wait_duration +=
+              WaitForRangeDataCapacity(trajectory_id, range_data_backpressure);
+          node.HandlePointCloud2Message(trajectory_id, sensor_id, point_cloud);
+          break;
+        }
+        case BagMessageType::kImu:
+          node.HandleImuMessage(trajectory_id, sensor_id,
+                                msg.instantiate<sensor_msgs::Imu>());
+          break;
+        case BagMessageType::kOdometry:
+          node.HandleOdometryMessage(trajectory_id, sensor_id,
+                                     msg.instantiate<nav_msgs::Odometry>());
+          break;
+        case BagMessageType::kNavSatFix:
+          node.HandleNavSatFixMessage(
+              trajectory_id, sensor_id,
+              msg.instantiate<sensor_msgs::NavSatFix>());
+          break;
+        case BagMessageType::kLandmarkList:
+          node.HandleLandmarkMessage(
+              trajectory_id, sensor_id,
+              msg.instantiate<cartographer_ros_msgs::LandmarkList>());
+          break;
+        case BagMessageType::kTfMessage:
+        case BagMessageType::kUnknown:
+          break;
       }
-      if (msg.isType<sensor_msgs::MultiEchoLaserScan>()) {
-        node.HandleMultiEchoLaserScanMessage(
-            trajectory_id, sensor_id,
-            msg.instantiate<sensor_msgs::MultiEchoLaserScan>());
-      }
-      if (msg.isType<sensor_msgs::PointCloud2>()) {
-        node.HandlePointCloud2Message(
-            trajectory_id, sensor_id,
-            msg.instantiate<sensor_msgs::PointCloud2>());
-      }
-      if (msg.isType<sensor_msgs::Imu>()) {
-        node.HandleImuMessage(trajectory_id, sensor_id,
-                              msg.instantiate<sensor_msgs::Imu>());
-      }
-      if (msg.isType<nav_msgs::Odometry>()) {
-        node.HandleOdometryMessage(trajectory_id, sensor_id,
-                                   msg.instantiate<nav_msgs::Odometry>());
-      }
-      if (msg.isType<sensor_msgs::NavSatFix>()) {
-        node.HandleNavSatFixMessage(trajectory_id, sensor_id,
-                                    msg.instantiate<sensor_msgs::NavSatFix>());
-      }
-      if (msg.isType<cartographer_ros_msgs::LandmarkList>()) {
-        node.HandleLandmarkMessage(
-            trajectory_id, sensor_id,
-            msg.instantiate<cartographer_ros_msgs::LandmarkList>());
+      sensor_data_duration +=
+          absl::Now() - sensor_data_start_time -
+          (range_data_wait_duration - range_data_wait_start);
+      ++num_sensor_messages;
+      if (first_message_time.isZero()) {
+        first_message_time = msg.getTime();
       }
+      last_message_time = msg.getTime();
     }
     clock.clock = msg.getTime();
     clock_publisher.publish(clock);
@@ -356,7 +551,13 @@ void RunOfflineNode(const MapBuilderFactory& map_builder_factory) {
   // final optimization, serialization, and optional indefinite spinning at the
   // end.
   clock_republish_timer.start();
+  if (FLAGS_search_cross_trajectory_constraints) {
+    node.SearchCrossTrajectoryConstraints();
+  }
+  const absl::Time final_optimization_start_time = absl::Now();
   node.RunFinalOptimization();
+  const absl::Duration final_optimization_duration =
+      absl::Now() - final_optimization_start_time;
 
   const std::chrono::time_point<std::chrono::steady_clock> end_time =
       std::chrono::steady_clock::now();
@@ -366,14 +567,35 @@ void RunOfflineNode(const MapBuilderFactory& map_builder_factory) {
           .count();
 
   LOG(INFO) << "Elapsed wall clock time: " << wall_clock_seconds << " s";
+  LOG(INFO) << "Waited for SLAM to catch up: "
+            << absl::ToDoubleSeconds(range_data_wait_duration) << " s";
+  if (report != nullptr) {
+    report->bag_read_sec = absl::ToDoubleSeconds(bag_read_duration);
+    report->sensor_data_sec = absl::ToDoubleSeconds(sensor_data_duration);
+    report->range_data_wait_sec =
+        absl::ToDoubleSeconds(range_data_wait_duration);
+    report->final_optimization_sec =
+        absl::ToDoubleSeconds(final_optimization_duration);
+    report->total_sec = wall_clock_seconds;
+    report->bag_duration_sec = (last_message_time - first_message_time).toSec();
+    report->num_sensor_messages = num_sensor_messages;
+    report->metric_families = node.ReadMetrics();
+    report->conversion_sec = std::min(
+        report->sensor_data_sec,
+        EstimateConversionSeconds(report->metric_families,
+                                  num_sensor_messages));
+    report->local_slam_sec = report->sensor_data_sec - report->conversion_sec;
+  }
 #ifdef __linux__
-  timespec cpu_timespec = {};
-  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_timespec);
-  LOG(INFO) << "Elapsed CPU time: "
-            << (cpu_timespec.tv_sec + 1e-9 * cpu_timespec.tv_nsec) << " s";
+  const double cpu_seconds = GetProcessCpuSeconds() - start_cpu_seconds;
+  LOG(INFO) << "Elapsed CPU time: " << cpu_seconds << " s";
   rusage usage;
   CHECK_EQ(getrusage(RUSAGE_SELF, &usage), 0) << strerror(errno);
   LOG(INFO) << "Peak memory usage: " << usage.ru_maxrss << " KiB";
+  if (report != nullptr) {
+    report->cpu_sec = cpu_seconds;
+    report->peak_memory_kib = usage.ru_maxrss;
+  }
 #endif
 
   // Serialize unless we have neither a bagfile nor an explicit state filename.
@@ -382,10 +604,16 @@ void RunOfflineNode(const MapBuilderFactory& map_builder_factory) {
     const std::string state_output_filename =
         FLAGS_save_state_filename.empty()
             ? absl::StrCat(bag_filenames.front(), ".pbstream")
-            : FLAGS_save_state_filename;
+            : GetShardStateFilename(FLAGS_save_state_filename,
+                                    FLAGS_num_shards, FLAGS_shard_index);
     LOG(INFO) << "Writing state to '" << state_output_filename << "'...";
+    const absl::Time serialization_start_time = absl::Now();
     node.SerializeState(state_output_filename,
                         true /* include_unfinished_submaps */);
+    if (report != nullptr) {
+      report->serialization_sec =
+          absl::ToDoubleSeconds(absl::Now() - serialization_start_time);
+    }
   }
   if (FLAGS_keep_running) {
     LOG(INFO) << "Finished processing and waiting for shutdown.";
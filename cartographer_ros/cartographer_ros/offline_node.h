@@ -20,10 +20,12 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "cartographer/mapping/map_builder_interface.h"
 #include "cartographer_ros/node_options.h"
+#include "cartographer_ros_msgs/MetricFamily.h"
 
 namespace cartographer_ros {
 
@@ -31,7 +33,53 @@ using MapBuilderFactory =
     std::function<std::unique_ptr<::cartographer::mapping::MapBuilderInterface>(
         const ::cartographer::mapping::proto::MapBuilderOptions&)>;
 
-void RunOfflineNode(const MapBuilderFactory& map_builder_factory);
+// Timings of a run of 'RunOfflineNode()', in wall clock seconds unless noted
+// otherwise.
+struct OfflineNodeReport {
+  // Getting the next message from the bags.
+  double bag_read_sec = 0.;
+  // Handing messages to the node, i.e. their deserialization, conversion and
+  // local SLAM, excluding the time spent waiting for global SLAM.
+  double sensor_data_sec = 0.;
+  // The part of 'sensor_data_sec' spent converting messages into sensor data,
+  // estimated from the sampled conversion latencies.
+  double conversion_sec = 0.;
+  // 'sensor_data_sec' without 'conversion_sec'.
+  double local_slam_sec = 0.;
+  // Waiting for global SLAM to catch up, see '-max_queued_range_data'.
+  double range_data_wait_sec = 0.;
+  double final_optimization_sec = 0.;
+  double serialization_sec = 0.;
+  double total_sec = 0.;
+  // CPU time of all threads of the process during the run.
+  double cpu_sec = 0.;
+  // The peak resident set size of the process so far, not of the run: after
+  // an earlier run in the same process, it only shows growth beyond its peak.
+  int64_t peak_memory_kib = 0;
+  // Span of the processed messages in bag time.
+  double bag_duration_sec = 0.;
+  int64_t num_sensor_messages = 0;
+  // Empty unless '-collect_metrics' is set.
+  std::vector<cartographer_ros_msgs::MetricFamily> metric_families;
+};
+
+// Returns the first and one past the last index of the 'num_bags' bags
+// processed by shard 'shard_index' of 'num_shards'. The shards are consecutive
+// groups whose sizes differ by at most one.
+std::pair<int, int> GetShardBagRange(int num_bags, int num_shards,
+                                     int shard_index);
+
+// Returns the name of the state written by shard 'shard_index' for an
+// explicit 'filename', which is shared by all shards. With more than one
+// shard, '_<shard_index>' is inserted before its '.pbstream' extension, or
+// appended if it has none, so that the shards do not overwrite each other.
+std::string GetShardStateFilename(const std::string& filename, int num_shards,
+                                  int shard_index);
+
+// Processes the bags given by the command line flags. If 'report' is not
+// nullptr, it is filled for benchmarking.
+void RunOfflineNode(const MapBuilderFactory& map_builder_factory,
+                    OfflineNodeReport* report = nullptr);
 
 }  // namespace cartographer_ros
 
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/offline_node.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+TEST(GetShardBagRangeTest, SingleShardProcessesAllBags) {
+  EXPECT_EQ(GetShardBagRange(5, 1, 0), std::make_pair(0, 5));
+}
+
+TEST(GetShardBagRangeTest, ShardsAreConsecutiveAndBalanced) {
+  for (int num_bags = 1; num_bags <= 10; ++num_bags) {
+    for (int num_shards = 1; num_shards <= num_bags; ++num_shards) {
+      std::vector<int> num_bags_per_shard;
+      int next_bag = 0;
+      for (int shard_index = 0; shard_index < num_shards; ++shard_index) {
+        const std::pair<int, int> range =
+            GetShardBagRange(num_bags, num_shards, shard_index);
+        EXPECT_EQ(range.first, next_bag);
+        EXPECT_LT(range.first, range.second);
+        num_bags_per_shard.push_back(range.second - range.first);
+        next_bag = range.second;
+      }
+      EXPECT_EQ(next_bag, num_bags);
+      const auto minmax = std::minmax_element(num_bags_per_shard.begin(),
+                                              num_bags_per_shard.end());
+      EXPECT_LE(*minmax.second - *minmax.first, 1);
+    }
+  }
+}
+
+TEST(GetShardBagRangeTest, SplitsUnevenNumberOfBags) {
+  EXPECT_EQ(GetShardBagRange(5, 2, 0), std::make_pair(0, 2));
+  EXPECT_EQ(GetShardBagRange(5, 2, 1), std::make_pair(2, 5));
+  EXPECT_EQ(GetShardBagRange(7, 3, 0), std::make_pair(0, 2));
+  EXPECT_EQ(GetShardBagRange(7, 3, 1), std::make_pair(2, 4));
+  EXPECT_EQ(GetShardBagRange(7, 3, 2), std::make_pair(4, 7));
+}
+
+TEST(GetShardStateFilenameTest, AddsShardIndex) {
+  EXPECT_EQ(GetShardStateFilename("state.pbstream", 1, 0), "state.pbstream");
+  EXPECT_EQ(GetShardStateFilename("state.pbstream", 4, 0), "state_0.pbstream");
+  EXPECT_EQ(GetShardStateFilename("dir/state.pbstream", 4, 3),
+            "dir/state_3.pbstream");
+  EXPECT_EQ(GetShardStateFilename("state", 2, 1), "state_1");
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -0,0 +1,266 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/offline_transform_store.h"
+
+#include <algorithm>
+
+#include "absl/strings/str_cat.h"
+#include "absl/types/optional.h"
+#include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/time_conversion.h"
+#include "glog/logging.h"
+#include "tf2/exceptions.h"
+
+namespace cartographer_ros {
+
+namespace carto = ::cartographer;
+
+namespace {
+
+// Guards against loops in the transform tree.
+constexpr size_t kMaxFrameDepth = 1000;
+
+// Like tf2, frame IDs are used without a leading slash.
+std::string StripLeadingSlash(const std::string& frame_id) {
+  if (!frame_id.empty() && frame_id[0] == '/') {
+    return frame_id.substr(1);
+  }
+  return frame_id;
+}
+
+bool IsBefore(const carto::transform::TimestampedTransform& lhs,
+              const carto::common::Time time) {
+  return lhs.time < time;
+}
+
+}  // namespace
+
+void OfflineTransformStore::SetTransform(
+    const geometry_msgs::TransformStamped& transform, const bool is_static) {
+  const std::string frame_id = StripLeadingSlash(transform.child_frame_id);
+  const std::string parent_frame = StripLeadingSlash(transform.header.frame_id);
+  if (frame_id.empty() || frame_id == parent_frame) {
+    LOG(WARNING) << "Ignoring transform from '" << parent_frame << "' to '"
+                 << frame_id << "'.";
+    return;
+  }
+  const carto::transform::TimestampedTransform parent_from_frame{
+      FromRos(transform.header.stamp), ToRigid3d(transform)};
+
+  absl::MutexLock lock(&mutex_);
+  Frame& frame = frames_[frame_id];
+  if (frame.parent_frame != parent_frame || frame.is_static != is_static) {
+    frame.parent_frame = parent_frame;
+    frame.is_static = is_static;
+    frame.parent_from_frame.clear();
+  }
+  auto& transforms = frame.parent_from_frame;
+  if (is_static) {
+    transforms.assign(1, parent_from_frame);
+    return;
+  }
+  // Transforms almost always arrive in order.
+  if (transforms.empty() || transforms.back().time < parent_from_frame.time) {
+    transforms.push_back(parent_from_frame);
+    return;
+  }
+  const auto it = std::lower_bound(transforms.begin(), transforms.end(),
+                                   parent_from_frame.time, IsBefore);
+  if (it != transforms.end() && it->time == parent_from_frame.time) {
+    *it = parent_from_frame;
+  } else {
+    transforms.insert(it, parent_from_frame);
+  }
+}
+
+void OfflineTransformStore::TrimBefore(const ros::Time& time) {
+  const carto::common::Time trim_time = FromRos(time);
+  absl::MutexLock lock(&mutex_);
+  for (auto& entry : frames_) {
+    auto& transforms = entry.second.parent_from_frame;
+    while (transforms.size() > 1 && transforms[1].time <= trim_time) {
+      transforms.pop_front();
+    }
+  }
+}
+
+geometry_msgs::TransformStamped OfflineTransformStore::lookupTransform(
+    const std::string& target_frame, const std::string& source_frame,
+    const ros::Time& time, const ros::Duration /* timeout */) const {
+  absl::ReaderMutexLock lock(&mutex_);
+  return LookupTransformLocked(StripLeadingSlash(target_frame),
+                               StripLeadingSlash(source_frame), time);
+}
+
+geometry_msgs::TransformStamped OfflineTransformStore::lookupTransform(
+    const std::string& target_frame, const ros::Time& target_time,
+    const std::string& source_frame, const ros::Time& source_time,
+    const std::string& fixed_frame, const ros::Duration /* timeout */) const {
+  absl::ReaderMutexLock lock(&mutex_);
+  const geometry_msgs::TransformStamped fixed_from_source =
+      LookupTransformLocked(StripLeadingSlash(fixed_frame),
+                            StripLeadingSlash(source_frame), source_time);
+  geometry_msgs::TransformStamped target_from_fixed =
+      LookupTransformLocked(StripLeadingSlash(target_frame),
+                            StripLeadingSlash(fixed_frame), target_time);
+  target_from_fixed.child_frame_id = fixed_from_source.child_frame_id;
+  target_from_fixed.transform = ToGeometryMsgTransform(
+      ToRigid3d(target_from_fixed) * ToRigid3d(fixed_from_source));
+  return target_from_fixed;
+}
+
+bool OfflineTransformStore::canTransform(const std::string& target_frame,
+                                         const std::string& source_frame,
+                                         const ros::Time& time,
+                                         const ros::Duration timeout,
+                                         std::string* const errstr) const {
+  try {
+    lookupTransform(target_frame, source_frame, time, timeout);
+  } catch (const tf2::TransformException& ex) {
+    if (errstr != nullptr) {
+      *errstr = ex.what();
+    }
+    return false;
+  }
+  return true;
+}
+
+bool OfflineTransformStore::canTransform(
+    const std::string& target_frame, const ros::Time& target_time,
+    const std::string& source_frame, const ros::Time& source_time,
+    const std::string& fixed_frame, const ros::Duration timeout,
+    std::string* const errstr) const {
+  try {
+    lookupTransform(target_frame, target_time, source_frame, source_time,
+                    fixed_frame, timeout);
+  } catch (const tf2::TransformException& ex) {
+    if (errstr != nullptr) {
+      *errstr = ex.what();
+    }
+    return false;
+  }
+  return true;
+}
+
+std::vector<std::string> OfflineTransformStore::GetAncestors(
+    const std::string& frame_id) const {
+  std::vector<std::string> ancestors = {frame_id};
+  for (auto it = frames_.find(frame_id); it != frames_.end();
+       it = frames_.find(ancestors.back())) {
+    if (ancestors.size() > kMaxFrameDepth) {
+      throw tf2::LookupException(
+          absl::StrCat("The transforms above '", frame_id, "' form a loop."));
+    }
+    ancestors.push_back(it->second.parent_frame);
+  }
+  return ancestors;
+}
+
+ros::Time OfflineTransformStore::GetLatestCommonTime(
+    const std::string& frame_id, const std::string& ancestor_frame_id) const {
+  absl::optional<carto::common::Time> latest_common_time;
+  for (std::string current = frame_id; current != ancestor_frame_id;) {
+    const Frame& frame = frames_.at(current);
+    if (!frame.is_static) {
+      const carto::common::Time time = frame.parent_from_frame.back().time;
+      latest_common_time = latest_common_time.has_value()
+                               ? std::min(latest_common_time.value(), time)
+                               : time;
+    }
+    current = frame.parent_frame;
+  }
+  return latest_common_time.has_value() ? ToRos(latest_common_time.value())
+                                        : ros::Time(0.);
+}
+
+carto::transform::Rigid3d OfflineTransformStore::LookupToAncestor(
+    const std::string& frame_id, const std::string& ancestor_frame_id,
+    const ros::Time& time) const {
+  const carto::common::Time lookup_time = FromRos(time);
+  carto::transform::Rigid3d ancestor_from_frame =
+      carto::transform::Rigid3d::Identity();
+  for (std::string current = frame_id; current != ancestor_frame_id;) {
+    const Frame& frame = frames_.at(current);
+    const auto& transforms = frame.parent_from_frame;
+    carto::transform::Rigid3d parent_from_current;
+    if (frame.is_static) {
+      parent_from_current = transforms.front().transform;
+    } else {
+      if (lookup_time < transforms.front().time ||
+          lookup_time > transforms.back().time) {
+        throw tf2::ExtrapolationException(absl::StrCat(
+            "Lookup of '", current, "' in '", frame.parent_frame, "' at ",
+            time.toSec(), " is outside of the known transforms from ",
+            ToRos(transforms.front().time).toSec(), " to ",
+            ToRos(transforms.back().time).toSec(), "."));
+      }
+      const auto end = std::lower_bound(transforms.begin(), transforms.end(),
+                                        lookup_time, IsBefore);
+      if (end->time == lookup_time) {
+        parent_from_current = end->transform;
+      } else {
+        parent_from_current =
+            carto::transform::Interpolate(*(end - 1), *end, lookup_time)
+                .transform;
+      }
+    }
+    ancestor_from_frame = parent_from_current * ancestor_from_frame;
+    current = frame.parent_frame;
+  }
+  return ancestor_from_frame;
+}
+
+geometry_msgs::TransformStamped OfflineTransformStore::LookupTransformLocked(
+    const std::string& target_frame, const std::string& source_frame,
+    const ros::Time& time) const {
+  const std::vector<std::string> source_ancestors = GetAncestors(source_frame);
+  const std::vector<std::string> target_ancestors = GetAncestors(target_frame);
+  // Both chains end in the root of their tree, the first frame of the source
+  // chain which is also in the target chain is their closest common ancestor.
+  const auto common_ancestor = std::find_first_of(
+      source_ancestors.begin(), source_ancestors.end(),
+      target_ancestors.begin(), target_ancestors.end());
+  if (common_ancestor == source_ancestors.end()) {
+    throw tf2::LookupException(absl::StrCat("'", source_frame, "' and '",
+                                            target_frame,
+                                            "' are not connected."));
+  }
+
+  ros::Time lookup_time = time;
+  if (lookup_time.isZero()) {
+    const ros::Time source_latest_time =
+        GetLatestCommonTime(source_frame, *common_ancestor);
+    const ros::Time target_latest_time =
+        GetLatestCommonTime(target_frame, *common_ancestor);
+    if (source_latest_time.isZero() || target_latest_time.isZero()) {
+      lookup_time = std::max(source_latest_time, target_latest_time);
+    } else {
+      lookup_time = std::min(source_latest_time, target_latest_time);
+    }
+  }
+
+  geometry_msgs::TransformStamped transform;
+  transform.header.frame_id = target_frame;
+  transform.header.stamp = lookup_time;
+  transform.child_frame_id = source_frame;
+  transform.transform = ToGeometryMsgTransform(
+      LookupToAncestor(target_frame, *common_ancestor, lookup_time).inverse() *
+      LookupToAncestor(source_frame, *common_ancestor, lookup_time));
+  return transform;
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_OFFLINE_TRANSFORM_STORE_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_OFFLINE_TRANSFORM_STORE_H
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "cartographer/transform/rigid_transform.h"
+#include "cartographer/transform/timestamped_transform.h"
+#include "geometry_msgs/TransformStamped.h"
+#include "tf2_ros/buffer_interface.h"
+
+namespace cartographer_ros {
+
+// Holds the transforms of a bag for offline processing, in place of a
+// 'tf2_ros::Buffer'. Every frame keeps the transforms from its parent in a
+// time-sorted array, so lookups interpolate after a binary search. Nothing is
+// evicted implicitly, the caller trims the transforms behind playback using
+// 'TrimBefore()'.
+//
+// Transforms are assumed to be added ahead of the lookups, so lookups never
+// wait and ignore their timeout. Thread-safe.
+class OfflineTransformStore : public tf2_ros::BufferInterface {
+ public:
+  OfflineTransformStore() = default;
+
+  OfflineTransformStore(const OfflineTransformStore&) = delete;
+  OfflineTransformStore& operator=(const OfflineTransformStore&) = delete;
+
+  void SetTransform(const geometry_msgs::TransformStamped& transform,
+                    bool is_static) LOCKS_EXCLUDED(mutex_);
+
+  // Drops the dynamic transforms before 'time', except for the last one of
+  // every frame, so that lookups at or after 'time' still work.
+  void TrimBefore(const ros::Time& time) LOCKS_EXCLUDED(mutex_);
+
+  // Like 'tf2_ros::Buffer', looking up at 'ros::Time(0)' returns the latest
+  // transform. Its stamp is zero if only static transforms are involved.
+  geometry_msgs::TransformStamped lookupTransform(
+      const std::string& target_frame, const std::string& source_frame,
+      const ros::Time& time,
+      ros::Duration timeout = ros::Duration(0.)) const override
+      LOCKS_EXCLUDED(mutex_);
+  geometry_msgs::TransformStamped lookupTransform(
+      const std::string& target_frame, const ros::Time& target_time,
+      const std::string& source_frame, const ros::Time& source_time,
+      const std::string& fixed_frame,
+      ros::Duration timeout = ros::Duration(0.)) const override
+      LOCKS_EXCLUDED(mutex_);
+  bool canTransform(const std::string& target_frame,
+                    const std::string& source_frame, const ros::Time& time,
+                    ros::Duration timeout,
+                    std::string* errstr = nullptr) const override
+      LOCKS_EXCLUDED(mutex_);
+  bool canTransform(const std::string& target_frame,
+                    const ros::Time& target_time,
+                    const std::string& source_frame,
+                    const ros::Time& source_time,
+                    const std::string& fixed_frame, ros::Duration timeout,
+                    std::string* errstr = nullptr) const override
+      LOCKS_EXCLUDED(mutex_);
+
+ private:
+  struct Frame {
+    std::string parent_frame;
+    bool is_static = false;
+    // Sorted by time. Static frames have a single transform.
+    std::deque<::cartographer::transform::TimestampedTransform>
+        parent_from_frame;
+  };
+
+  // Returns 'frame_id' followed by its ancestors.
+  std::vector<std::string> GetAncestors(const std::string& frame_id) const
+      SHARED_LOCKS_REQUIRED(mutex_);
+  // Returns the latest time at which all transforms from 'frame_id' up to
+  // 'ancestor_frame_id' are known, or 'ros::Time(0)' if all are static.
+  ros::Time GetLatestCommonTime(const std::string& frame_id,
+                                const std::string& ancestor_frame_id) const
+      SHARED_LOCKS_REQUIRED(mutex_);
+  // Returns the transform from 'frame_id' into 'ancestor_frame_id' at 'time'.
+  ::cartographer::transform::Rigid3d LookupToAncestor(
+      const std::string& frame_id, const std::string& ancestor_frame_id,
+      const ros::Time& time) const SHARED_LOCKS_REQUIRED(mutex_);
+  geometry_msgs::TransformStamped LookupTransformLocked(
+      const std::string& target_frame, const std::string& source_frame,
+      const ros::Time& time) const SHARED_LOCKS_REQUIRED(mutex_);
+
+  mutable absl::Mutex mutex_;
+  std::unordered_map<std::string, Frame> frames_ GUARDED_BY(mutex_);
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_OFFLINE_TRANSFORM_STORE_H
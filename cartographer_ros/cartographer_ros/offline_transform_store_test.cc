@@ -0,0 +1,128 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/offline_transform_store.h"
+
+#include "cartographer/transform/rigid_transform_test_helpers.h"
+#include "cartographer_ros/msg_conversion.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "tf2/exceptions.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::transform::IsNearly;
+using ::cartographer::transform::Rigid3d;
+
+geometry_msgs::TransformStamped CreateTransform(const std::string& parent,
+                                                const std::string& child,
+                                                const double time_sec,
+                                                const Eigen::Vector3d& t) {
+  geometry_msgs::TransformStamped transform;
+  transform.header.frame_id = parent;
+  transform.header.stamp = ros::Time(time_sec);
+  transform.child_frame_id = child;
+  transform.transform = ToGeometryMsgTransform(Rigid3d::Translation(t));
+  return transform;
+}
+
+TEST(OfflineTransformStoreTest, InterpolatesAlongChain) {
+  OfflineTransformStore store;
+  store.SetTransform(
+      CreateTransform("odom", "base_link", 11., Eigen::Vector3d(2., 0., 0.)),
+      false /* is_static */);
+  store.SetTransform(
+      CreateTransform("odom", "base_link", 10., Eigen::Vector3d(0., 0., 0.)),
+      false /* is_static */);
+  store.SetTransform(
+      CreateTransform("/base_link", "/laser", 0., Eigen::Vector3d(0., 1., 0.)),
+      true /* is_static */);
+
+  const geometry_msgs::TransformStamped odom_from_laser =
+      store.lookupTransform("odom", "laser", ros::Time(10.5));
+  EXPECT_EQ(ros::Time(10.5), odom_from_laser.header.stamp);
+  EXPECT_THAT(ToRigid3d(odom_from_laser),
+              IsNearly(Rigid3d::Translation(Eigen::Vector3d(1., 1., 0.)),
+                       1e-9));
+  EXPECT_THAT(
+      ToRigid3d(store.lookupTransform("laser", "odom", ros::Time(10.5))),
+      IsNearly(Rigid3d::Translation(Eigen::Vector3d(-1., -1., 0.)), 1e-9));
+
+  const geometry_msgs::TransformStamped latest =
+      store.lookupTransform("odom", "laser", ros::Time(0.));
+  EXPECT_EQ(ros::Time(11.), latest.header.stamp);
+  EXPECT_THAT(ToRigid3d(latest),
+              IsNearly(Rigid3d::Translation(Eigen::Vector3d(2., 1., 0.)),
+                       1e-9));
+}
+
+TEST(OfflineTransformStoreTest, StaticLookupAtTimeZero) {
+  OfflineTransformStore store;
+  store.SetTransform(CreateTransform("base_link", "imu", 0.,
+                                     Eigen::Vector3d(0., 0., 1.)),
+                     true /* is_static */);
+  store.SetTransform(CreateTransform("base_link", "laser", 0.,
+                                     Eigen::Vector3d(1., 0., 0.)),
+                     true /* is_static */);
+  const geometry_msgs::TransformStamped imu_from_laser =
+      store.lookupTransform("imu", "laser", ros::Time(0.));
+  EXPECT_TRUE(imu_from_laser.header.stamp.isZero());
+  EXPECT_THAT(ToRigid3d(imu_from_laser),
+              IsNearly(Rigid3d::Translation(Eigen::Vector3d(1., 0., -1.)),
+                       1e-9));
+  EXPECT_TRUE(store.canTransform("laser", "laser", ros::Time(5.),
+                                 ros::Duration(0.)));
+}
+
+TEST(OfflineTransformStoreTest, FailsOutsideOfKnownTransforms) {
+  OfflineTransformStore store;
+  store.SetTransform(
+      CreateTransform("odom", "base_link", 10., Eigen::Vector3d(0., 0., 0.)),
+      false /* is_static */);
+  store.SetTransform(
+      CreateTransform("odom", "base_link", 11., Eigen::Vector3d(1., 0., 0.)),
+      false /* is_static */);
+  EXPECT_THROW(store.lookupTransform("odom", "base_link", ros::Time(11.5)),
+               tf2::ExtrapolationException);
+  EXPECT_THROW(store.lookupTransform("odom", "laser", ros::Time(10.5)),
+               tf2::LookupException);
+  std::string error;
+  EXPECT_FALSE(store.canTransform("odom", "base_link", ros::Time(9.),
+                                  ros::Duration(0.), &error));
+  EXPECT_FALSE(error.empty());
+}
+
+TEST(OfflineTransformStoreTest, TrimKeepsLatestTransform) {
+  OfflineTransformStore store;
+  for (int i = 0; i < 10; ++i) {
+    store.SetTransform(CreateTransform("odom", "base_link", 10. + i,
+                                       Eigen::Vector3d(i, 0., 0.)),
+                       false /* is_static */);
+  }
+  store.TrimBefore(ros::Time(15.5));
+  EXPECT_FALSE(store.canTransform("odom", "base_link", ros::Time(14.5),
+                                  ros::Duration(0.)));
+  EXPECT_THAT(
+      ToRigid3d(store.lookupTransform("odom", "base_link", ros::Time(15.5))),
+      IsNearly(Rigid3d::Translation(Eigen::Vector3d(5.5, 0., 0.)), 1e-9));
+  store.TrimBefore(ros::Time(100.));
+  EXPECT_TRUE(store.canTransform("odom", "base_link", ros::Time(19.),
+                                 ros::Duration(0.)));
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/options_cache.h"
+
+#include <sys/stat.h>
+
+#include <memory>
+
+#include "absl/memory/memory.h"
+#include "cartographer/common/configuration_file_resolver.h"
+#include "cartographer/common/lua_parameter_dictionary.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+// Resolves files like '::cartographer::common::ConfigurationFileResolver' and
+// records the full path of each file read.
+class RecordingFileResolver : public ::cartographer::common::FileResolver {
+ public:
+  RecordingFileResolver(const std::string& configuration_directory,
+                        std::vector<std::string>* const paths)
+      : resolver_({configuration_directory}), paths_(paths) {}
+
+  std::string GetFullPathOrDie(const std::string& basename) override {
+    return resolver_.GetFullPathOrDie(basename);
+  }
+
+  std::string GetFileContentOrDie(const std::string& basename) override {
+    paths_->push_back(resolver_.GetFullPathOrDie(basename));
+    return resolver_.GetFileContentOrDie(basename);
+  }
+
+ private:
+  ::cartographer::common::ConfigurationFileResolver resolver_;
+  std::vector<std::string>* const paths_;
+};
+
+// Returns false if the file at 'path' cannot be accessed.
+bool GetModificationTimeAndSize(const std::string& path,
+                                int64_t* const modification_time_ns,
+                                int64_t* const size) {
+  struct stat file_status;
+  if (stat(path.c_str(), &file_status) != 0) {
+    return false;
+  }
+  *modification_time_ns =
+      static_cast<int64_t>(file_status.st_mtim.tv_sec) * 1000000000 +
+      file_status.st_mtim.tv_nsec;
+  *size = static_cast<int64_t>(file_status.st_size);
+  return true;
+}
+
+}  // namespace
+
+std::tuple<NodeOptions, TrajectoryOptions> OptionsCache::GetOrLoad(
+    const std::string& configuration_directory,
+    const std::string& configuration_basename) {
+  // Loading happens under the lock, so that concurrent requests for the same
+  // configuration load it only once.
+  absl::MutexLock lock(&mutex_);
+  Entry& entry =
+      entries_[std::make_pair(configuration_directory, configuration_basename)];
+  if (entry.file_stamps.empty() || !IsUpToDate(entry)) {
+    std::vector<std::string> paths;
+    auto file_resolver = absl::make_unique<RecordingFileResolver>(
+        configuration_directory, &paths);
+    const std::string code =
+        file_resolver->GetFileContentOrDie(configuration_basename);
+    ::cartographer::common::LuaParameterDictionary lua_parameter_dictionary(
+        code, std::move(file_resolver));
+    entry.node_options = CreateNodeOptions(&lua_parameter_dictionary);
+    entry.trajectory_options =
+        CreateTrajectoryOptions(&lua_parameter_dictionary);
+    entry.file_stamps.clear();
+    for (const std::string& path : paths) {
+      FileStamp file_stamp{path, 0, 0};
+      // Files which cannot be accessed are never up to date, so the options
+      // are loaded again next time.
+      if (!GetModificationTimeAndSize(path, &file_stamp.modification_time_ns,
+                                      &file_stamp.size)) {
+        file_stamp.modification_time_ns = -1;
+      }
+      entry.file_stamps.push_back(file_stamp);
+    }
+    ++num_loads_;
+    LOG(INFO) << "Loaded options of '" << configuration_basename << "' from "
+              << entry.file_stamps.size() << " files.";
+  }
+  return std::make_tuple(entry.node_options, entry.trajectory_options);
+}
+
+int OptionsCache::num_loads() const {
+  absl::MutexLock lock(&mutex_);
+  return num_loads_;
+}
+
+bool OptionsCache::IsUpToDate(const Entry& entry) {
+  for (const FileStamp& file_stamp : entry.file_stamps) {
+    int64_t modification_time_ns;
+    int64_t size;
+    if (!GetModificationTimeAndSize(file_stamp.path, &modification_time_ns,
+                                    &size) ||
+        modification_time_ns != file_stamp.modification_time_ns ||
+        size != file_stamp.size) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace cartographer_ros
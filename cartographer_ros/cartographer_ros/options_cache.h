@@ -0,0 +1,75 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_OPTIONS_CACHE_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_OPTIONS_CACHE_H
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "cartographer_ros/node_options.h"
+#include "cartographer_ros/trajectory_options.h"
+
+namespace cartographer_ros {
+
+// Caches the options loaded by 'LoadOptions()', so that starting a trajectory
+// does not need to run its Lua configuration again. Options are loaded again
+// once any of the files read for them changed, as told by their modification
+// times and sizes. Thread-safe.
+class OptionsCache {
+ public:
+  OptionsCache() = default;
+
+  OptionsCache(const OptionsCache&) = delete;
+  OptionsCache& operator=(const OptionsCache&) = delete;
+
+  std::tuple<NodeOptions, TrajectoryOptions> GetOrLoad(
+      const std::string& configuration_directory,
+      const std::string& configuration_basename) LOCKS_EXCLUDED(mutex_);
+
+  // Number of times options were loaded instead of returned from the cache.
+  int num_loads() const LOCKS_EXCLUDED(mutex_);
+
+ private:
+  struct FileStamp {
+    std::string path;
+    int64_t modification_time_ns;
+    int64_t size;
+  };
+
+  struct Entry {
+    NodeOptions node_options;
+    TrajectoryOptions trajectory_options;
+    // All files read for the options, including those included.
+    std::vector<FileStamp> file_stamps;
+  };
+
+  static bool IsUpToDate(const Entry& entry);
+
+  mutable absl::Mutex mutex_;
+  // Keyed by configuration directory and basename.
+  std::map<std::pair<std::string, std::string>, Entry> entries_
+      GUARDED_BY(mutex_);
+  int num_loads_ GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_OPTIONS_CACHE_H
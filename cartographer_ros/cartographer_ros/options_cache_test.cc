@@ -0,0 +1,105 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/options_cache.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "cartographer_ros/temporary_file_test_helpers.h"
+#include "gtest/gtest.h"
+#include "ros/package.h"
+
+namespace cartographer_ros {
+namespace {
+
+class OptionsCacheReloadTest : public TemporaryFileTest {
+ protected:
+  OptionsCacheReloadTest() : TemporaryFileTest("test.lua") {}
+
+  // Writes 'backpack_2d.lua' with 'tracking_frame' replaced to 'filename_'.
+  void WriteConfiguration(const std::string& tracking_frame) {
+    std::ifstream original(::ros::package::getPath("cartographer_ros") +
+                           "/configuration_files/backpack_2d.lua");
+    std::stringstream code;
+    code << original.rdbuf();
+    std::string configuration = code.str();
+    const std::string original_line = "tracking_frame = \"base_link\"";
+    const size_t position = configuration.find(original_line);
+    ASSERT_NE(position, std::string::npos);
+    configuration.replace(position, original_line.size(),
+                          "tracking_frame = \"" + tracking_frame + "\"");
+    std::ofstream(filename_) << configuration;
+  }
+
+  std::string GetTrackingFrame(OptionsCache* options_cache) {
+    TrajectoryOptions trajectory_options;
+    std::tie(std::ignore, trajectory_options) =
+        options_cache->GetOrLoad(test_directory_, "test.lua");
+    return trajectory_options.tracking_frame;
+  }
+};
+
+TEST(OptionsCache, LoadsOnlyOnce) {
+  const std::string configuration_directory =
+      ::ros::package::getPath("cartographer_ros") + "/configuration_files";
+  OptionsCache options_cache;
+  TrajectoryOptions trajectory_options;
+  std::tie(std::ignore, trajectory_options) =
+      options_cache.GetOrLoad(configuration_directory, "backpack_2d.lua");
+  EXPECT_EQ(1, options_cache.num_loads());
+  TrajectoryOptions cached_trajectory_options;
+  std::tie(std::ignore, cached_trajectory_options) =
+      options_cache.GetOrLoad(configuration_directory, "backpack_2d.lua");
+  EXPECT_EQ(1, options_cache.num_loads());
+  EXPECT_EQ(trajectory_options.tracking_frame,
+            cached_trajectory_options.tracking_frame);
+  options_cache.GetOrLoad(configuration_directory, "backpack_3d.lua");
+  EXPECT_EQ(2, options_cache.num_loads());
+}
+
+TEST_F(OptionsCacheReloadTest, ReloadsChangedFile) {
+  OptionsCache options_cache;
+  WriteConfiguration("base_link");
+  EXPECT_EQ("base_link", GetTrackingFrame(&options_cache));
+  EXPECT_EQ("base_link", GetTrackingFrame(&options_cache));
+  EXPECT_EQ(1, options_cache.num_loads());
+
+  // A change of size is noticed even within the resolution of the timestamp.
+  WriteConfiguration("imu_link");
+  EXPECT_EQ("imu_link", GetTrackingFrame(&options_cache));
+  EXPECT_EQ(2, options_cache.num_loads());
+
+  // A change keeping the size is noticed by the modification time, which is
+  // moved ahead in case the file system's timestamps are coarse.
+  WriteConfiguration("imu_lank");
+  struct stat file_status;
+  ASSERT_EQ(stat(filename_.c_str(), &file_status), 0);
+  struct timespec times[2] = {file_status.st_atim, file_status.st_mtim};
+  times[1].tv_sec += 10;
+  ASSERT_EQ(utimensat(AT_FDCWD, filename_.c_str(), times, 0), 0);
+  EXPECT_EQ("imu_lank", GetTrackingFrame(&options_cache));
+  EXPECT_EQ(3, options_cache.num_loads());
+  EXPECT_EQ("imu_lank", GetTrackingFrame(&options_cache));
+  EXPECT_EQ(3, options_cache.num_loads());
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/parallel_proto_stream_reader.h"
+
+#include "absl/memory/memory.h"
+#include "cartographer/common/port.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+// As written by '::cartographer::io::ProtoStreamWriter'.
+constexpr uint64_t kMagic = 0x7b1d1f7b5bf501db;
+
+// Messages queued per decompression thread.
+constexpr int kQueuedMessagesPerThread = 4;
+
+bool ReadSizeAsLittleEndian(std::istream* const in, uint64_t* const size) {
+  *size = 0;
+  for (int i = 0; i != 8; ++i) {
+    *size >>= 8;
+    *size += static_cast<uint64_t>(in->get()) << 56;
+  }
+  return !in->fail();
+}
+
+}  // namespace
+
+ParallelProtoStreamReader::ParallelProtoStreamReader(
+    const std::string& filename, const int num_threads)
+    : max_queued_messages_(kQueuedMessagesPerThread * num_threads),
+      in_(filename, std::ios::in | std::ios::binary) {
+  CHECK_GT(num_threads, 0);
+  uint64_t magic;
+  if (!ReadSizeAsLittleEndian(&in_, &magic) || magic != kMagic) {
+    in_.setstate(std::ios::failbit);
+  }
+  CHECK(in_.good()) << "Failed to open proto stream '" << filename << "'.";
+  file_thread_ = std::thread(&ParallelProtoStreamReader::ReadFile, this);
+  for (int i = 0; i != num_threads; ++i) {
+    decompression_threads_.emplace_back(
+        &ParallelProtoStreamReader::DecompressMessages, this);
+  }
+}
+
+ParallelProtoStreamReader::~ParallelProtoStreamReader() {
+  {
+    absl::MutexLock lock(&mutex_);
+    shutting_down_ = true;
+  }
+  file_thread_.join();
+  for (std::thread& thread : decompression_threads_) {
+    thread.join();
+  }
+}
+
+bool ParallelProtoStreamReader::ReadProto(
+    google::protobuf::Message* const proto) {
+  std::unique_ptr<Message> message;
+  {
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(this, &ParallelProtoStreamReader::CanRead));
+    if (messages_.empty()) {
+      return false;
+    }
+    message = std::move(messages_.front());
+    messages_.pop_front();
+  }
+  return proto->ParseFromString(message->data);
+}
+
+bool ParallelProtoStreamReader::eof() const {
+  absl::MutexLock lock(&mutex_);
+  return end_of_file_ && messages_.empty();
+}
+
+void ParallelProtoStreamReader::ReadFile() {
+  for (;;) {
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(
+          absl::Condition(this, &ParallelProtoStreamReader::CanQueue));
+      if (shutting_down_) {
+        return;
+      }
+    }
+    auto message = absl::make_unique<Message>();
+    uint64_t compressed_size;
+    bool success = ReadSizeAsLittleEndian(&in_, &compressed_size);
+    if (success) {
+      message->data.resize(compressed_size);
+      success = static_cast<bool>(
+          in_.read(&message->data.front(), compressed_size));
+    }
+    absl::MutexLock lock(&mutex_);
+    if (!success) {
+      end_of_file_ = true;
+      return;
+    }
+    messages_.push_back(std::move(message));
+  }
+}
+
+bool ParallelProtoStreamReader::CanRead() const {
+  return messages_.empty() ? end_of_file_ : messages_.front()->decompressed;
+}
+
+bool ParallelProtoStreamReader::CanQueue() const {
+  return shutting_down_ || messages_.size() < max_queued_messages_;
+}
+
+bool ParallelProtoStreamReader::CanDecompress() const {
+  return shutting_down_ || end_of_file_ || NextCompressedMessage() != nullptr;
+}
+
+ParallelProtoStreamReader::Message*
+ParallelProtoStreamReader::NextCompressedMessage() const {
+  for (const std::unique_ptr<Message>& message : messages_) {
+    if (!message->decompressing) {
+      return message.get();
+    }
+  }
+  return nullptr;
+}
+
+void ParallelProtoStreamReader::DecompressMessages() {
+  for (;;) {
+    Message* message;
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(
+          absl::Condition(this, &ParallelProtoStreamReader::CanDecompress));
+      message = NextCompressedMessage();
+      if (shutting_down_ || message == nullptr) {
+        return;
+      }
+      message->decompressing = true;
+    }
+    // The message stays queued until it is decompressed, so it can be used
+    // without holding the lock.
+    std::string decompressed_data;
+    ::cartographer::common::FastGunzipString(message->data,
+                                             &decompressed_data);
+    message->data.swap(decompressed_data);
+    absl::MutexLock lock(&mutex_);
+    message->decompressed = true;
+  }
+}
+
+}  // namespace cartographer_ros
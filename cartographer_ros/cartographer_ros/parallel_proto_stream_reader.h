@@ -0,0 +1,80 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_PARALLEL_PROTO_STREAM_READER_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_PARALLEL_PROTO_STREAM_READER_H
+
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "cartographer/io/proto_stream_interface.h"
+#include "google/protobuf/message.h"
+
+namespace cartographer_ros {
+
+// Reads the same format as '::cartographer::io::ProtoStreamReader', but
+// decompresses the messages ahead of time on 'num_threads' threads while the
+// file is read on another one. Only parsing the protos is left to the thread
+// calling 'ReadProto()', which makes loading large states several times
+// faster.
+class ParallelProtoStreamReader
+    : public ::cartographer::io::ProtoStreamReaderInterface {
+ public:
+  ParallelProtoStreamReader(const std::string& filename, int num_threads);
+  ~ParallelProtoStreamReader() override;
+
+  ParallelProtoStreamReader(const ParallelProtoStreamReader&) = delete;
+  ParallelProtoStreamReader& operator=(const ParallelProtoStreamReader&) =
+      delete;
+
+  bool ReadProto(google::protobuf::Message* proto) override
+      LOCKS_EXCLUDED(mutex_);
+  bool eof() const override LOCKS_EXCLUDED(mutex_);
+
+ private:
+  struct Message {
+    std::string data;
+    bool decompressing = false;
+    bool decompressed = false;
+  };
+
+  void ReadFile() LOCKS_EXCLUDED(mutex_);
+  void DecompressMessages() LOCKS_EXCLUDED(mutex_);
+  bool CanRead() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool CanQueue() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool CanDecompress() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Message* NextCompressedMessage() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const size_t max_queued_messages_;
+  // Only used by the thread running 'ReadFile()'.
+  std::ifstream in_;
+  mutable absl::Mutex mutex_;
+  // Messages in the order of the file which were not yet read.
+  std::deque<std::unique_ptr<Message>> messages_ GUARDED_BY(mutex_);
+  bool end_of_file_ GUARDED_BY(mutex_) = false;
+  bool shutting_down_ GUARDED_BY(mutex_) = false;
+  std::thread file_thread_;
+  std::vector<std::thread> decompression_threads_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_PARALLEL_PROTO_STREAM_READER_H
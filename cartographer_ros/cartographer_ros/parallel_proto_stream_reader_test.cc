@@ -0,0 +1,69 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/parallel_proto_stream_reader.h"
+
+#include "cartographer/io/proto_stream.h"
+#include "cartographer/transform/proto/transform.pb.h"
+#include "cartographer_ros/temporary_file_test_helpers.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+class ParallelProtoStreamReaderTest : public TemporaryFileTest {
+ protected:
+  ParallelProtoStreamReaderTest() : TemporaryFileTest("test.pbstream") {}
+};
+
+TEST_F(ParallelProtoStreamReaderTest, ReadsProtosInOrder) {
+  constexpr int kNumProtos = 100;
+  ::cartographer::io::ProtoStreamWriter writer(filename_);
+  for (int i = 0; i != kNumProtos; ++i) {
+    ::cartographer::transform::proto::Vector3d proto;
+    proto.set_x(i);
+    proto.set_y(2 * i);
+    writer.WriteProto(proto);
+  }
+  ASSERT_TRUE(writer.Close());
+
+  ParallelProtoStreamReader reader(filename_, 3 /* num_threads */);
+  for (int i = 0; i != kNumProtos; ++i) {
+    EXPECT_FALSE(reader.eof());
+    ::cartographer::transform::proto::Vector3d proto;
+    ASSERT_TRUE(reader.ReadProto(&proto));
+    EXPECT_EQ(i, proto.x());
+    EXPECT_EQ(2 * i, proto.y());
+  }
+  ::cartographer::transform::proto::Vector3d proto;
+  EXPECT_FALSE(reader.ReadProto(&proto));
+  EXPECT_TRUE(reader.eof());
+}
+
+TEST_F(ParallelProtoStreamReaderTest, StopsEarly) {
+  ::cartographer::io::ProtoStreamWriter writer(filename_);
+  for (int i = 0; i != 100; ++i) {
+    writer.WriteProto(::cartographer::transform::proto::Vector3d());
+  }
+  ASSERT_TRUE(writer.Close());
+
+  ParallelProtoStreamReader reader(filename_, 2 /* num_threads */);
+  ::cartographer::transform::proto::Vector3d proto;
+  EXPECT_TRUE(reader.ReadProto(&proto));
+}
+
+}  // namespace
+}  // namespace cartographer_ros
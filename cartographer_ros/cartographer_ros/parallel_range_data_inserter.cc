@@ -0,0 +1,127 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/parallel_range_data_inserter.h"
+
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+// Range data queued per ray casting thread.
+constexpr int kQueuedRangeDataPerThread = 4;
+
+}  // namespace
+
+ParallelRangeDataInserter::ParallelRangeDataInserter(
+    const int num_threads, TiledProbabilityGrid* const grid)
+    : max_queued_range_data_(kQueuedRangeDataPerThread * num_threads),
+      grid_(grid) {
+  CHECK_GT(num_threads, 0);
+  for (int i = 0; i != num_threads; ++i) {
+    threads_.emplace_back(&ParallelRangeDataInserter::ComputeUpdates, this);
+  }
+}
+
+ParallelRangeDataInserter::~ParallelRangeDataInserter() {
+  {
+    absl::MutexLock lock(&mutex_);
+    shutting_down_ = true;
+  }
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ParallelRangeDataInserter::Insert(
+    ::cartographer::sensor::RangeData range_data) {
+  {
+    absl::MutexLock lock(&mutex_);
+    queued_range_data_.push_back(absl::make_unique<RangeData>());
+    queued_range_data_.back()->range_data = std::move(range_data);
+  }
+  while (ApplyOldestUpdates(max_queued_range_data_)) {
+  }
+}
+
+void ParallelRangeDataInserter::Flush() {
+  while (ApplyOldestUpdates(0)) {
+  }
+}
+
+bool ParallelRangeDataInserter::ApplyOldestUpdates(const size_t max_queued) {
+  std::unique_ptr<RangeData> range_data;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (queued_range_data_.size() > max_queued) {
+      mutex_.Await(
+          absl::Condition(this, &ParallelRangeDataInserter::OldestComputed));
+    } else if (!OldestComputed()) {
+      return false;
+    }
+    range_data = std::move(queued_range_data_.front());
+    queued_range_data_.pop_front();
+  }
+  grid_->ApplyUpdates(range_data->updates);
+  return true;
+}
+
+void ParallelRangeDataInserter::ComputeUpdates() {
+  for (;;) {
+    RangeData* range_data;
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(
+          absl::Condition(this, &ParallelRangeDataInserter::CanCompute));
+      if (shutting_down_) {
+        return;
+      }
+      range_data = NextRangeDataToCompute();
+      range_data->computing = true;
+    }
+    // The range data is only accessed by this thread until it is computed.
+    TiledProbabilityGrid::Updates updates =
+        grid_->ComputeUpdates(range_data->range_data);
+    range_data->range_data = ::cartographer::sensor::RangeData();
+    absl::MutexLock lock(&mutex_);
+    range_data->updates = std::move(updates);
+    range_data->computed = true;
+  }
+}
+
+bool ParallelRangeDataInserter::OldestComputed() const {
+  return !queued_range_data_.empty() && queued_range_data_.front()->computed;
+}
+
+bool ParallelRangeDataInserter::CanCompute() const {
+  return shutting_down_ || NextRangeDataToCompute() != nullptr;
+}
+
+ParallelRangeDataInserter::RangeData*
+ParallelRangeDataInserter::NextRangeDataToCompute() const {
+  for (const std::unique_ptr<RangeData>& range_data : queued_range_data_) {
+    if (!range_data->computing) {
+      return range_data.get();
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace cartographer_ros
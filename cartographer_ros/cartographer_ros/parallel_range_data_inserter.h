@@ -0,0 +1,81 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_PARALLEL_RANGE_DATA_INSERTER_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_PARALLEL_RANGE_DATA_INSERTER_H
+
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "cartographer/sensor/range_data.h"
+#include "cartographer_ros/tiled_probability_grid.h"
+
+namespace cartographer_ros {
+
+// Inserts range data into a 'TiledProbabilityGrid', ray casting it on
+// 'num_threads' threads. The updates are applied by the thread calling
+// 'Insert()' and 'Flush()' in the order the range data was inserted, so the
+// grid ends up the same as when inserting serially.
+class ParallelRangeDataInserter {
+ public:
+  // 'grid' must outlive this object.
+  ParallelRangeDataInserter(int num_threads, TiledProbabilityGrid* grid);
+  ~ParallelRangeDataInserter();
+
+  ParallelRangeDataInserter(const ParallelRangeDataInserter&) = delete;
+  ParallelRangeDataInserter& operator=(const ParallelRangeDataInserter&) =
+      delete;
+
+  // Queues 'range_data' and applies the updates which are ready. Blocks while
+  // too much range data is queued.
+  void Insert(::cartographer::sensor::RangeData range_data)
+      LOCKS_EXCLUDED(mutex_);
+
+  // Blocks until all inserted range data was applied to the grid.
+  void Flush() LOCKS_EXCLUDED(mutex_);
+
+ private:
+  struct RangeData {
+    ::cartographer::sensor::RangeData range_data;
+    TiledProbabilityGrid::Updates updates;
+    bool computing = false;
+    bool computed = false;
+  };
+
+  // Applies the updates of the oldest range data if they are computed. If
+  // more than 'max_queued' are queued, waits for them. Returns true if
+  // updates were applied.
+  bool ApplyOldestUpdates(size_t max_queued) LOCKS_EXCLUDED(mutex_);
+  void ComputeUpdates() LOCKS_EXCLUDED(mutex_);
+  bool OldestComputed() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool CanCompute() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  RangeData* NextRangeDataToCompute() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const size_t max_queued_range_data_;
+  TiledProbabilityGrid* const grid_;
+  absl::Mutex mutex_;
+  // In the order of insertion, until the updates are applied.
+  std::deque<std::unique_ptr<RangeData>> queued_range_data_ GUARDED_BY(mutex_);
+  bool shutting_down_ GUARDED_BY(mutex_) = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_PARALLEL_RANGE_DATA_INSERTER_H
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/parallel_range_data_inserter.h"
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "cartographer/mapping/proto/probability_grid_range_data_inserter_options_2d.pb.h"
+#include "cartographer_ros/tiled_probability_grid.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+namespace carto = ::cartographer;
+
+constexpr double kResolution = 0.05;
+
+TEST(ParallelRangeDataInserterTest, MatchesSerialInsertion) {
+  carto::mapping::proto::ProbabilityGridRangeDataInserterOptions2D options;
+  options.set_insert_free_space(true);
+  options.set_hit_probability(0.55);
+  options.set_miss_probability(0.49);
+  TiledProbabilityGrid serial_grid(kResolution, options,
+                                   4 /* max_tiles_in_memory */);
+  TiledProbabilityGrid parallel_grid(kResolution, options,
+                                     4 /* max_tiles_in_memory */);
+  {
+    ParallelRangeDataInserter inserter(4 /* num_threads */, &parallel_grid);
+    // Overlapping range data, so that the result depends on the order in
+    // which hits and misses are applied to the same cells.
+    for (int i = 0; i < 50; ++i) {
+      carto::sensor::RangeData range_data;
+      range_data.origin =
+          Eigen::Vector3f(0.37f * i - 9.f, 4.f * std::sin(0.3f * i), 0.f);
+      for (int j = 0; j < 72; ++j) {
+        const float angle = j * 0.0873f + 0.011f * i;
+        const float range = 8.f + 6.f * std::sin(0.7f * j + i);
+        range_data.returns.push_back(
+            {range_data.origin + Eigen::Vector3f(range * std::cos(angle),
+                                                 range * std::sin(angle),
+                                                 0.f)});
+      }
+      serial_grid.Insert(range_data);
+      inserter.Insert(std::move(range_data));
+    }
+    inserter.Flush();
+  }
+
+  const Eigen::AlignedBox2i box = serial_grid.known_cells_box();
+  ASSERT_FALSE(box.isEmpty());
+  ASSERT_EQ(box.min(), parallel_grid.known_cells_box().min());
+  ASSERT_EQ(box.max(), parallel_grid.known_cells_box().max());
+  EXPECT_EQ(serial_grid.GetCorrespondenceCostValues(box),
+            parallel_grid.GetCorrespondenceCostValues(box));
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -18,17 +18,22 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
-#include "cartographer/io/proto_stream.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
 #include "cartographer/io/proto_stream_deserializer.h"
 #include "cartographer/io/submap_painter.h"
 #include "cartographer/mapping/2d/probability_grid.h"
 #include "cartographer/mapping/2d/submap_2d.h"
 #include "cartographer/mapping/3d/submap_3d.h"
+#include "cartographer_ros/mapped_proto_stream_reader.h"
 #include "cartographer_ros/msg_conversion.h"
 #include "cartographer_ros/node_constants.h"
 #include "cartographer_ros/ros_log_sink.h"
 #include "cartographer_ros/ros_map.h"
+#include "cartographer_ros/submap_canvas.h"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "nav_msgs/OccupancyGrid.h"
@@ -39,13 +44,19 @@ DEFINE_string(pbstream_filename, "",
 DEFINE_string(map_topic, "map", "Name of the published map topic.");
 DEFINE_string(map_frame_id, "map", "Frame ID of the published map.");
 DEFINE_double(resolution, 0.05, "Resolution of a grid cell in the drawn map.");
+DEFINE_int32(num_threads, 4, "Number of threads painting the map.");
+DEFINE_string(pyramid_resolutions, "",
+              "Comma-separated list of coarser resolutions, multiples of "
+              "'resolution', at which the map is additionally published on "
+              "'<map_topic>_level_<i>', starting at 1. The levels are "
+              "downsampled from the painted map.");
 
 namespace cartographer_ros {
 namespace {
 
 std::unique_ptr<nav_msgs::OccupancyGrid> LoadOccupancyGridMsg(
     const std::string& pbstream_filename, const double resolution) {
-  ::cartographer::io::ProtoStreamReader reader(pbstream_filename);
+  MappedProtoStreamReader reader(pbstream_filename);
   ::cartographer::io::ProtoStreamDeserializer deserializer(&reader);
 
   LOG(INFO) << "Loading submap slices from serialized data.";
@@ -57,14 +68,35 @@ std::unique_ptr<nav_msgs::OccupancyGrid> LoadOccupancyGridMsg(
   CHECK(reader.eof());
 
   LOG(INFO) << "Generating combined map image from submap slices.";
-  const auto painted_slices =
-      ::cartographer::io::PaintSubmapSlices(submap_slices, resolution);
-  return CreateOccupancyGridMsg(painted_slices, resolution, FLAGS_map_frame_id,
-                                ros::Time::now());
+  const TiledSubmapPainter painter(submap_slices, resolution);
+  auto occupancy_grid = CreateOccupancyGridMsg(
+      painter.width(), painter.height(), painter.origin(), resolution,
+      FLAGS_map_frame_id, ros::Time::now());
+  painter.Paint(FLAGS_num_threads,
+                [&occupancy_grid](const TiledSubmapPainter::Band& band) {
+                  FillOccupancyGridRows(band.pixels, band.y, band.height,
+                                        occupancy_grid.get());
+                });
+  return occupancy_grid;
+}
+
+std::vector<double> ParseResolutions(const std::string& resolutions) {
+  std::vector<double> result;
+  for (const std::string& resolution :
+       absl::StrSplit(resolutions, ',', absl::SkipEmpty())) {
+    double value;
+    CHECK(absl::SimpleAtod(resolution, &value))
+        << "Invalid resolution '" << resolution << "'.";
+    result.push_back(value);
+  }
+  return result;
 }
 
 void Run(const std::string& pbstream_filename, const std::string& map_topic,
-         const std::string& map_frame_id, const double resolution) {
+         const std::string& map_frame_id, const double resolution,
+         const std::vector<double>& pyramid_resolutions) {
+  const std::vector<int> factors =
+      ComputeDownsamplingFactors(resolution, pyramid_resolutions);
   std::unique_ptr<nav_msgs::OccupancyGrid> msg_ptr =
       LoadOccupancyGridMsg(pbstream_filename, resolution);
 
@@ -76,6 +108,19 @@ void Run(const std::string& pbstream_filename, const std::string& map_topic,
             << " (frame_id: " << map_frame_id
             << ", resolution:" << std::to_string(resolution) << ").";
   pub.publish(*msg_ptr);
+
+  std::vector<::ros::Publisher> pyramid_publishers;
+  for (size_t i = 0; i != factors.size(); ++i) {
+    const std::string topic = absl::StrCat(map_topic, "_level_", i + 1);
+    pyramid_publishers.push_back(
+        node_handle.advertise<nav_msgs::OccupancyGrid>(
+            topic, kLatestOnlyPublisherQueueSize, true /*latched */));
+    LOG(INFO) << "Publishing occupancy grid topic " << topic
+              << " (resolution:" << std::to_string(pyramid_resolutions[i])
+              << ").";
+    pyramid_publishers.back().publish(
+        *DownsampleOccupancyGrid(*msg_ptr, factors[i]));
+  }
   ::ros::spin();
   ::ros::shutdown();
 }
@@ -94,6 +139,8 @@ int main(int argc, char** argv) {
 
   cartographer_ros::ScopedRosLogSink ros_log_sink;
 
-  ::cartographer_ros::Run(FLAGS_pbstream_filename, FLAGS_map_topic,
-                          FLAGS_map_frame_id, FLAGS_resolution);
+  ::cartographer_ros::Run(
+      FLAGS_pbstream_filename, FLAGS_map_topic, FLAGS_map_frame_id,
+      FLAGS_resolution,
+      ::cartographer_ros::ParseResolutions(FLAGS_pyramid_resolutions));
 }
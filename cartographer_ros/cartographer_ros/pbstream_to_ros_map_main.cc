@@ -17,13 +17,14 @@
 #include <map>
 #include <string>
 
-#include "cartographer/io/proto_stream.h"
 #include "cartographer/io/proto_stream_deserializer.h"
 #include "cartographer/io/submap_painter.h"
 #include "cartographer/mapping/2d/probability_grid.h"
 #include "cartographer/mapping/2d/submap_2d.h"
 #include "cartographer/mapping/3d/submap_3d.h"
+#include "cartographer_ros/mapped_proto_stream_reader.h"
 #include "cartographer_ros/ros_map.h"
+#include "cartographer_ros/submap_canvas.h"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
@@ -31,13 +32,14 @@ DEFINE_string(pbstream_filename, "",
               "Filename of a pbstream to draw a map from.");
 DEFINE_string(map_filestem, "map", "Stem of the output files.");
 DEFINE_double(resolution, 0.05, "Resolution of a grid cell in the drawn map.");
+DEFINE_int32(num_threads, 4, "Number of threads painting the map.");
 
 namespace cartographer_ros {
 namespace {
 
 void Run(const std::string& pbstream_filename, const std::string& map_filestem,
-         const double resolution) {
-  ::cartographer::io::ProtoStreamReader reader(pbstream_filename);
+         const double resolution, const int num_threads) {
+  MappedProtoStreamReader reader(pbstream_filename);
   ::cartographer::io::ProtoStreamDeserializer deserializer(&reader);
 
   LOG(INFO) << "Loading submap slices from serialized data.";
@@ -49,17 +51,24 @@ void Run(const std::string& pbstream_filename, const std::string& map_filestem,
   CHECK(reader.eof());
 
   LOG(INFO) << "Generating combined map image from submap slices.";
-  auto result =
-      ::cartographer::io::PaintSubmapSlices(submap_slices, resolution);
+  const TiledSubmapPainter painter(submap_slices, resolution);
 
   ::cartographer::io::StreamFileWriter pgm_writer(map_filestem + ".pgm");
-
-  ::cartographer::io::Image image(std::move(result.surface));
-  WritePgm(image, resolution, &pgm_writer);
+  WritePgmHeader(painter.width(), painter.height(), resolution, &pgm_writer);
+  std::string rows;
+  painter.Paint(num_threads, [&rows, &pgm_writer](
+                                 const TiledSubmapPainter::Band& band) {
+    rows.resize(static_cast<size_t>(band.width) * band.height);
+    for (size_t i = 0; i < rows.size(); ++i) {
+      // The red channel, like '::cartographer::io::Image::GetPixel()'.
+      rows[i] = static_cast<char>(band.pixels[i] >> 16);
+    }
+    pgm_writer.Write(rows.data(), rows.size());
+  });
 
   const Eigen::Vector2d origin(
-      -result.origin.x() * resolution,
-      (result.origin.y() - image.height()) * resolution);
+      -painter.origin().x() * resolution,
+      (painter.origin().y() - painter.height()) * resolution);
 
   ::cartographer::io::StreamFileWriter yaml_writer(map_filestem + ".yaml");
   WriteYaml(resolution, origin, pgm_writer.GetFilename(), &yaml_writer);
@@ -77,5 +86,5 @@ int main(int argc, char** argv) {
   CHECK(!FLAGS_map_filestem.empty()) << "-map_filestem is missing.";
 
   ::cartographer_ros::Run(FLAGS_pbstream_filename, FLAGS_map_filestem,
-                          FLAGS_resolution);
+                          FLAGS_resolution, FLAGS_num_threads);
 }
@@ -16,6 +16,8 @@
 
 #include "cartographer_ros/playable_bag.h"
 
+#include <algorithm>
+
 #include "absl/memory/memory.h"
 #include "cartographer_ros/node_constants.h"
 #include "glog/logging.h"
@@ -23,27 +25,58 @@
 
 namespace cartographer_ros {
 
+namespace {
+
+// Limits for how far the read-ahead thread may get ahead of playback.
+constexpr size_t kMaxReadAheadBytes = 256 << 20;
+constexpr size_t kMaxReadAheadMessages = 100000;
+
+std::unique_ptr<rosbag::View> CreateView(
+    const rosbag::Bag& bag, const ros::Time start_time,
+    const ros::Time end_time, const BagConnectionFilter& connection_filter) {
+  auto view = absl::make_unique<rosbag::View>();
+  AddBagTimeWindowQueries(bag, start_time, end_time, connection_filter,
+                          view.get());
+  return view;
+}
+
+}  // namespace
+
 PlayableBag::PlayableBag(
     const std::string& bag_filename, const int bag_id,
     const ros::Time start_time, const ros::Time end_time,
     const ros::Duration buffer_delay,
-    FilteringEarlyMessageHandler filtering_early_message_handler)
+    FilteringEarlyMessageHandler filtering_early_message_handler,
+    const BagConnectionFilter& connection_filter)
     : bag_(absl::make_unique<rosbag::Bag>(bag_filename, rosbag::bagmode::Read)),
-      view_(absl::make_unique<rosbag::View>(*bag_, start_time, end_time)),
-      view_iterator_(view_->begin()),
+      view_(CreateView(*bag_, start_time, end_time, connection_filter)),
+      message_types_(view_->getConnections()),
       finished_(false),
       bag_id_(bag_id),
       bag_filename_(bag_filename),
-      duration_in_seconds_(
-          (view_->getEndTime() - view_->getBeginTime()).toSec()),
+      // Static transforms read from before 'start_time' do not count.
+      begin_time_(std::max(view_->getBeginTime(), start_time)),
+      end_time_(view_->getEndTime()),
+      duration_in_seconds_((end_time_ - begin_time_).toSec()),
+      total_messages_(view_->size()),
       message_counter_(0),
       buffer_delay_(buffer_delay),
       filtering_early_message_handler_(
           std::move(filtering_early_message_handler)) {
-  AdvanceUntilMessageAvailable();
-  for (const auto* connection_info : view_->getConnections()) {
+  for (const auto* connection_info : rosbag::View(*bag_).getConnections()) {
     topics_.insert(connection_info->topic);
   }
+  // From here on, only the read-ahead thread accesses 'bag_' and 'view_'.
+  read_ahead_thread_ = std::thread(&PlayableBag::ReadAhead, this);
+  AdvanceUntilMessageAvailable();
+}
+
+PlayableBag::~PlayableBag() {
+  {
+    absl::MutexLock lock(&read_ahead_mutex_);
+    stop_read_ahead_ = true;
+  }
+  read_ahead_thread_.join();
 }
 
 ros::Time PlayableBag::PeekMessageTime() const {
@@ -52,16 +85,20 @@ ros::Time PlayableBag::PeekMessageTime() const {
 }
 
 std::tuple<ros::Time, ros::Time> PlayableBag::GetBeginEndTime() const {
-  return std::make_tuple(view_->getBeginTime(), view_->getEndTime());
+  return std::make_tuple(begin_time_, end_time_);
 }
 
-rosbag::MessageInstance PlayableBag::GetNextMessage(
+PlayableBag::Message PlayableBag::GetNextMessage(
     cartographer_ros_msgs::BagfileProgress* progress) {
   CHECK(IsMessageAvailable());
-  const rosbag::MessageInstance msg = buffered_messages_.front();
+  const Message msg = buffered_messages_.front();
   buffered_messages_.pop_front();
   AdvanceUntilMessageAvailable();
-  double processed_seconds = (msg.getTime() - view_->getBeginTime()).toSec();
+  double processed_seconds = (msg.getTime() - begin_time_).toSec();
+  const ros::WallTime now = ros::WallTime::now();
+  if (first_message_wall_time_.isZero()) {
+    first_message_wall_time_ = now;
+  }
   if ((message_counter_ % 10000) == 0) {
     LOG(INFO) << "Processed " << processed_seconds << " of "
               << duration_in_seconds_ << " seconds of bag " << bag_filename_;
@@ -70,10 +107,13 @@ rosbag::MessageInstance PlayableBag::GetNextMessage(
   if (progress) {
     progress->current_bagfile_name = bag_filename_;
     progress->current_bagfile_id = bag_id_;
-    progress->total_messages = view_->size();
+    progress->total_messages = total_messages_;
     progress->processed_messages = message_counter_;
     progress->total_seconds = duration_in_seconds_;
     progress->processed_seconds = processed_seconds;
+    const double wall_seconds = (now - first_message_wall_time_).toSec();
+    progress->speedup =
+        wall_seconds > 0. ? processed_seconds / wall_seconds : 0.;
   }
 
   return msg;
@@ -87,18 +127,62 @@ bool PlayableBag::IsMessageAvailable() const {
 
 int PlayableBag::bag_id() const { return bag_id_; }
 
+void PlayableBag::ReadAhead() {
+  for (const rosbag::MessageInstance& instance : *view_) {
+    auto serialized_message =
+        std::make_shared<std::vector<uint8_t>>(instance.size());
+    ros::serialization::OStream stream(serialized_message->data(),
+                                       serialized_message->size());
+    instance.write(stream);
+    Message msg(instance.getTime(), instance.getTopic(),
+                message_types_.Get(instance), std::move(serialized_message));
+    absl::MutexLock lock(&read_ahead_mutex_);
+    read_ahead_mutex_.Await(
+        absl::Condition(this, &PlayableBag::ReadAheadBufferHasSpace));
+    if (stop_read_ahead_) {
+      return;
+    }
+    read_ahead_bytes_ += msg.size();
+    read_ahead_messages_.push_back(std::move(msg));
+  }
+  absl::MutexLock lock(&read_ahead_mutex_);
+  read_ahead_finished_ = true;
+}
+
+bool PlayableBag::ReadAheadBufferHasSpace() const {
+  return stop_read_ahead_ || read_ahead_messages_.empty() ||
+         (read_ahead_bytes_ < kMaxReadAheadBytes &&
+          read_ahead_messages_.size() < kMaxReadAheadMessages);
+}
+
+bool PlayableBag::ReadAheadMessageAvailable() const {
+  return read_ahead_finished_ || !read_ahead_messages_.empty();
+}
+
+absl::optional<PlayableBag::Message> PlayableBag::TakeReadAheadMessage() {
+  absl::MutexLock lock(&read_ahead_mutex_);
+  read_ahead_mutex_.Await(
+      absl::Condition(this, &PlayableBag::ReadAheadMessageAvailable));
+  if (read_ahead_messages_.empty()) {
+    return absl::nullopt;
+  }
+  Message msg = std::move(read_ahead_messages_.front());
+  read_ahead_messages_.pop_front();
+  read_ahead_bytes_ -= msg.size();
+  return msg;
+}
+
 void PlayableBag::AdvanceOneMessage() {
   CHECK(!finished_);
-  if (view_iterator_ == view_->end()) {
+  absl::optional<Message> msg = TakeReadAheadMessage();
+  if (!msg.has_value()) {
     finished_ = true;
     return;
   }
-  rosbag::MessageInstance& msg = *view_iterator_;
   if (!filtering_early_message_handler_ ||
-      filtering_early_message_handler_(msg)) {
-    buffered_messages_.push_back(msg);
+      filtering_early_message_handler_(msg.value())) {
+    buffered_messages_.push_back(std::move(msg.value()));
   }
-  ++view_iterator_;
   ++message_counter_;
 }
 
@@ -117,29 +201,30 @@ PlayableBagMultiplexer::PlayableBagMultiplexer() : pnh_("~") {
   progress_pub_interval_ = pnh_.param("bagfile_progress_pub_interval", 10.0);
 }
 
-void PlayableBagMultiplexer::AddPlayableBag(PlayableBag playable_bag) {
-  for (const auto& topic : playable_bag.topics()) {
+void PlayableBagMultiplexer::AddPlayableBag(
+    std::unique_ptr<PlayableBag> playable_bag) {
+  for (const auto& topic : playable_bag->topics()) {
     topics_.insert(topic);
   }
-  playable_bags_.push_back(std::move(playable_bag));
-  CHECK(playable_bags_.back().IsMessageAvailable());
+  CHECK(playable_bag->IsMessageAvailable());
   next_message_queue_.emplace(
-      BagMessageItem{playable_bags_.back().PeekMessageTime(),
-                     static_cast<int>(playable_bags_.size() - 1)});
-  bag_progress_time_map_[playable_bag.bag_id()] = ros::Time::now();
+      BagMessageItem{playable_bag->PeekMessageTime(),
+                     static_cast<int>(playable_bags_.size())});
+  bag_progress_time_map_[playable_bag->bag_id()] = ros::Time::now();
+  playable_bags_.push_back(std::move(playable_bag));
 }
 
 bool PlayableBagMultiplexer::IsMessageAvailable() const {
   return !next_message_queue_.empty();
 }
 
-std::tuple<rosbag::MessageInstance, int, bool>
+std::tuple<PlayableBag::Message, int, bool>
 PlayableBagMultiplexer::GetNextMessage() {
   CHECK(IsMessageAvailable());
   const int current_bag_index = next_message_queue_.top().bag_index;
-  PlayableBag& current_bag = playable_bags_.at(current_bag_index);
+  PlayableBag& current_bag = *playable_bags_.at(current_bag_index);
   cartographer_ros_msgs::BagfileProgress progress;
-  rosbag::MessageInstance msg = current_bag.GetNextMessage(&progress);
+  PlayableBag::Message msg = current_bag.GetNextMessage(&progress);
   const bool publish_progress =
       current_bag.finished() ||
       ros::Time::now() - bag_progress_time_map_[current_bag.bag_id()] >=
@@ -17,67 +17,146 @@
 #ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_PLAYABLE_BAG_H
 #define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_PLAYABLE_BAG_H
 
+#include <deque>
 #include <functional>
+#include <memory>
 #include <queue>
+#include <thread>
 
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "boost/make_shared.hpp"
+#include "cartographer_ros/bag_message_type.h"
 #include "cartographer_ros_msgs/BagfileProgress.h"
 #include "ros/node_handle.h"
+#include "ros/serialization.h"
 #include "rosbag/bag.h"
 #include "rosbag/view.h"
 #include "tf2_ros/buffer.h"
 
 namespace cartographer_ros {
 
+// Plays back a bag in order. A background thread reads and decompresses
+// messages ahead of playback, so that reading overlaps with processing.
 class PlayableBag {
  public:
+  // A message of the bag that has already been read into memory. Offers the
+  // accessors of 'rosbag::MessageInstance', but does not touch the bag.
+  class Message {
+   public:
+    Message(const ros::Time& time, const std::string& topic,
+            const BagMessageType type,
+            std::shared_ptr<const std::vector<uint8_t>> serialized_message)
+        : time_(time),
+          topic_(topic),
+          type_(type),
+          serialized_message_(std::move(serialized_message)) {}
+
+    const ros::Time& getTime() const { return time_; }
+    const std::string& getTopic() const { return topic_; }
+    // Resolved once per bag connection, dispatching on it is cheap.
+    BagMessageType type() const { return type_; }
+
+    // Deserializes the message. 'T' has to match 'type()'.
+    template <typename T>
+    boost::shared_ptr<T> instantiate() const {
+      auto msg = boost::make_shared<T>();
+      ros::serialization::IStream stream(
+          const_cast<uint8_t*>(serialized_message_->data()),
+          serialized_message_->size());
+      ros::serialization::deserialize(stream, *msg);
+      return msg;
+    }
+
+    size_t size() const { return serialized_message_->size(); }
+
+   private:
+    ros::Time time_;
+    std::string topic_;
+    BagMessageType type_;
+    std::shared_ptr<const std::vector<uint8_t>> serialized_message_;
+  };
+
   // Handles messages early, i.e. when they are about to enter the buffer.
   // Returns a boolean indicating whether the message should enter the buffer.
   using FilteringEarlyMessageHandler =
-      std::function<bool /* forward_message_to_buffer */ (
-          const rosbag::MessageInstance&)>;
+      std::function<bool /* forward_message_to_buffer */ (const Message&)>;
 
+  // Only the messages in ['start_time', 'end_time'] on the connections
+  // accepted by 'connection_filter' are read, see
+  // 'AddBagTimeWindowQueries()'. The bag is not read before 'start_time'
+  // except for static transforms.
   PlayableBag(const std::string& bag_filename, int bag_id, ros::Time start_time,
               ros::Time end_time, ros::Duration buffer_delay,
-              FilteringEarlyMessageHandler filtering_early_message_handler);
+              FilteringEarlyMessageHandler filtering_early_message_handler,
+              const BagConnectionFilter& connection_filter);
+  ~PlayableBag();
+
+  PlayableBag(const PlayableBag&) = delete;
+  PlayableBag& operator=(const PlayableBag&) = delete;
 
   ros::Time PeekMessageTime() const;
-  rosbag::MessageInstance GetNextMessage(
-      cartographer_ros_msgs::BagfileProgress* progress);
+  Message GetNextMessage(cartographer_ros_msgs::BagfileProgress* progress);
   bool IsMessageAvailable() const;
   std::tuple<ros::Time, ros::Time> GetBeginEndTime() const;
 
   int bag_id() const;
+  // All topics of the bag, including those which are not read.
   std::set<std::string> topics() const { return topics_; }
   double duration_in_seconds() const { return duration_in_seconds_; }
   bool finished() const { return finished_; }
 
  private:
+  // Runs on 'read_ahead_thread_'.
+  void ReadAhead() LOCKS_EXCLUDED(read_ahead_mutex_);
+  bool ReadAheadBufferHasSpace() const
+      EXCLUSIVE_LOCKS_REQUIRED(read_ahead_mutex_);
+  bool ReadAheadMessageAvailable() const
+      EXCLUSIVE_LOCKS_REQUIRED(read_ahead_mutex_);
+  // Blocks until the read-ahead thread has the next message, returns
+  // 'absl::nullopt' at the end of the bag.
+  absl::optional<Message> TakeReadAheadMessage()
+      LOCKS_EXCLUDED(read_ahead_mutex_);
+
   void AdvanceOneMessage();
   void AdvanceUntilMessageAvailable();
 
   std::unique_ptr<rosbag::Bag> bag_;
   std::unique_ptr<rosbag::View> view_;
-  rosbag::View::const_iterator view_iterator_;
+  const BagMessageTypes message_types_;
   bool finished_;
   const int bag_id_;
   const std::string bag_filename_;
+  ros::Time begin_time_;
+  ros::Time end_time_;
   const double duration_in_seconds_;
+  const uint32_t total_messages_;
   int message_counter_;
-  std::deque<rosbag::MessageInstance> buffered_messages_;
+  // When the first message was taken, to compute the speedup over bag time.
+  ros::WallTime first_message_wall_time_;
+  std::deque<Message> buffered_messages_;
   const ::ros::Duration buffer_delay_;
   FilteringEarlyMessageHandler filtering_early_message_handler_;
   std::set<std::string> topics_;
+
+  absl::Mutex read_ahead_mutex_;
+  std::deque<Message> read_ahead_messages_ GUARDED_BY(read_ahead_mutex_);
+  size_t read_ahead_bytes_ GUARDED_BY(read_ahead_mutex_) = 0;
+  bool read_ahead_finished_ GUARDED_BY(read_ahead_mutex_) = false;
+  bool stop_read_ahead_ GUARDED_BY(read_ahead_mutex_) = false;
+  // Started last, since it uses the members above.
+  std::thread read_ahead_thread_;
 };
 
 class PlayableBagMultiplexer {
  public:
   PlayableBagMultiplexer();
-  void AddPlayableBag(PlayableBag playable_bag);
+  void AddPlayableBag(std::unique_ptr<PlayableBag> playable_bag);
 
   // Returns the next message from the multiplexed (merge-sorted) message
   // stream, along with the bag id corresponding to the message, and whether
   // this was the last message in that bag.
-  std::tuple<rosbag::MessageInstance, int /* bag_id */,
+  std::tuple<PlayableBag::Message, int /* bag_id */,
              bool /* is_last_message_in_bag */>
   GetNextMessage();
 
@@ -105,7 +184,7 @@ class PlayableBagMultiplexer {
   // The time interval of publishing bag-file(s) processing in seconds
   double progress_pub_interval_;
 
-  std::vector<PlayableBag> playable_bags_;
+  std::vector<std::unique_ptr<PlayableBag>> playable_bags_;
   std::priority_queue<BagMessageItem, std::vector<BagMessageItem>,
                       BagMessageItem::TimestampIsGreater>
       next_message_queue_;
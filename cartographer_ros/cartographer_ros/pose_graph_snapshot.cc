@@ -0,0 +1,69 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/pose_graph_snapshot.h"
+
+namespace cartographer_ros {
+
+bool PoseGraphSnapshot::IsTrajectoryFrozen(const int trajectory_id) const {
+  const auto it = trajectory_states.find(trajectory_id);
+  return it != trajectory_states.end() &&
+         it->second == ::cartographer::mapping::PoseGraphInterface::
+                           TrajectoryState::FROZEN;
+}
+
+std::shared_ptr<const PoseGraphSnapshot> TakePoseGraphSnapshot(
+    ::cartographer::mapping::PoseGraphInterface* const pose_graph,
+    const int num_global_optimizations,
+    const PoseGraphSnapshot* const previous_snapshot,
+    const std::chrono::steady_clock::duration max_constraints_age,
+    const bool include_local_to_global_transforms) {
+  auto snapshot = std::make_shared<PoseGraphSnapshot>();
+  snapshot->num_global_optimizations = num_global_optimizations;
+  snapshot->time = std::chrono::steady_clock::now();
+  snapshot->trajectory_node_poses = pose_graph->GetTrajectoryNodePoses();
+  snapshot->submap_poses = pose_graph->GetAllSubmapPoses();
+  snapshot->trajectory_states = pose_graph->GetTrajectoryStates();
+  if (include_local_to_global_transforms) {
+    for (const auto& entry : snapshot->trajectory_states) {
+      if (entry.second == ::cartographer::mapping::PoseGraphInterface::
+                              TrajectoryState::ACTIVE) {
+        snapshot->local_to_global_transforms.emplace(
+            entry.first, pose_graph->GetLocalToGlobalTransform(entry.first));
+      }
+    }
+  }
+  if (previous_snapshot != nullptr &&
+      previous_snapshot->num_global_optimizations ==
+          num_global_optimizations &&
+      snapshot->time - previous_snapshot->constraints_time <
+          max_constraints_age) {
+    snapshot->constraints = previous_snapshot->constraints;
+    snapshot->landmark_poses = previous_snapshot->landmark_poses;
+    snapshot->constraints_time = previous_snapshot->constraints_time;
+  } else {
+    snapshot->constraints =
+        std::make_shared<const PoseGraphSnapshot::Constraints>(
+            pose_graph->constraints());
+    snapshot->landmark_poses =
+        std::make_shared<const PoseGraphSnapshot::LandmarkPoses>(
+            pose_graph->GetLandmarkPoses());
+    snapshot->constraints_time = snapshot->time;
+  }
+  return snapshot;
+}
+
+}  // namespace cartographer_ros
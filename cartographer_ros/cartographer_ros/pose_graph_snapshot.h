@@ -0,0 +1,77 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_POSE_GRAPH_SNAPSHOT_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_POSE_GRAPH_SNAPSHOT_H
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cartographer/mapping/id.h"
+#include "cartographer/mapping/pose_graph_interface.h"
+#include "cartographer/transform/rigid_transform.h"
+
+namespace cartographer_ros {
+
+// An immutable copy of the parts of the pose graph which are published and
+// queried by the node. It is shared by all readers, so that the pose graph is
+// copied once for all of them instead of in every read path.
+struct PoseGraphSnapshot {
+  using Constraints =
+      std::vector<::cartographer::mapping::PoseGraphInterface::Constraint>;
+  using LandmarkPoses =
+      std::map<std::string, ::cartographer::transform::Rigid3d>;
+
+  bool IsTrajectoryFrozen(int trajectory_id) const;
+
+  // Global optimizations which had finished before the snapshot was taken.
+  int num_global_optimizations;
+  std::chrono::steady_clock::time_point time;
+  ::cartographer::mapping::MapById<::cartographer::mapping::NodeId,
+                                   ::cartographer::mapping::TrajectoryNodePose>
+      trajectory_node_poses;
+  ::cartographer::mapping::MapById<
+      ::cartographer::mapping::SubmapId,
+      ::cartographer::mapping::PoseGraphInterface::SubmapPose>
+      submap_poses;
+  std::map<int, ::cartographer::mapping::PoseGraphInterface::TrajectoryState>
+      trajectory_states;
+  // Of the active trajectories, only if they were requested.
+  std::map<int, ::cartographer::transform::Rigid3d> local_to_global_transforms;
+  // These are the largest parts, so they may be shared with earlier
+  // snapshots, see TakePoseGraphSnapshot().
+  std::shared_ptr<const Constraints> constraints;
+  std::shared_ptr<const LandmarkPoses> landmark_poses;
+  std::chrono::steady_clock::time_point constraints_time;
+};
+
+// Takes a snapshot of 'pose_graph' after 'num_global_optimizations'
+// optimizations had finished. The constraints and landmark poses of
+// 'previous_snapshot' are reused if it was taken after as many optimizations
+// and its constraints are younger than 'max_constraints_age'. The local to
+// global transforms are only included if 'include_local_to_global_transforms'.
+std::shared_ptr<const PoseGraphSnapshot> TakePoseGraphSnapshot(
+    ::cartographer::mapping::PoseGraphInterface* pose_graph,
+    int num_global_optimizations, const PoseGraphSnapshot* previous_snapshot,
+    std::chrono::steady_clock::duration max_constraints_age,
+    bool include_local_to_global_transforms);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_POSE_GRAPH_SNAPSHOT_H
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/publishing_scheduler.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cartographer_ros {
+
+namespace {
+
+// Nice value of the publishing thread, relative to the rest of the process.
+constexpr int kPublishingThreadNiceIncrement = 10;
+
+void LowerThreadPriority() {
+#ifdef __linux__
+  // On Linux, the nice value is per thread.
+  const pid_t thread_id = static_cast<pid_t>(syscall(SYS_gettid));
+  const int priority = getpriority(PRIO_PROCESS, thread_id);
+  if (setpriority(PRIO_PROCESS, thread_id,
+                  priority + kPublishingThreadNiceIncrement) != 0) {
+    LOG(WARNING) << "Could not lower the priority of the publishing thread.";
+  }
+#endif
+}
+
+}  // namespace
+
+PublishingScheduler::~PublishingScheduler() {
+  {
+    absl::MutexLock lock(&mutex_);
+    shutting_down_ = true;
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void PublishingScheduler::AddTask(const std::string& name,
+                                  const double period_sec,
+                                  std::function<bool()> has_subscribers,
+                                  std::function<void()> publish) {
+  CHECK(!thread_.joinable()) << "Tasks must be added before starting.";
+  CHECK_GT(period_sec, 0.) << name;
+  tasks_.push_back(Task{name, absl::Seconds(period_sec),
+                        std::move(has_subscribers), std::move(publish),
+                        absl::InfinitePast()});
+}
+
+void PublishingScheduler::Start() {
+  CHECK(!thread_.joinable());
+  thread_ = std::thread(&PublishingScheduler::Run, this);
+}
+
+void PublishingScheduler::Run() {
+  LowerThreadPriority();
+  for (;;) {
+    absl::Time next_run_time = absl::InfiniteFuture();
+    for (const Task& task : tasks_) {
+      next_run_time = std::min(next_run_time, task.next_run_time);
+    }
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.AwaitWithDeadline(absl::Condition(&shutting_down_),
+                               next_run_time);
+      if (shutting_down_) {
+        return;
+      }
+    }
+    for (Task& task : tasks_) {
+      const absl::Time start_time = absl::Now();
+      if (task.next_run_time > start_time) {
+        continue;
+      }
+      if (!task.has_subscribers()) {
+        task.next_run_time = start_time + task.period;
+        continue;
+      }
+      task.publish();
+      const absl::Time end_time = absl::Now();
+      const absl::Duration duration = end_time - start_time;
+      if (duration > task.period) {
+        VLOG(1) << "Publishing " << task.name << " took "
+                << absl::FormatDuration(duration) << ", more than its period.";
+      }
+      task.next_run_time = end_time + std::max(task.period, duration);
+    }
+  }
+}
+
+}  // namespace cartographer_ros
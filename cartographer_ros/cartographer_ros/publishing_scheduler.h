@@ -0,0 +1,71 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_PUBLISHING_SCHEDULER_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_PUBLISHING_SCHEDULER_H
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace cartographer_ros {
+
+// Runs periodic publishing tasks on a single low-priority thread, so that
+// creating visualizations never delays the threads handling sensor data.
+//
+// A task is skipped while its 'has_subscribers' returns false. If publishing
+// takes longer than the period of a task, its next run is postponed by the
+// time it took, so that at most half of the thread's time goes to it.
+class PublishingScheduler {
+ public:
+  PublishingScheduler() = default;
+  ~PublishingScheduler();
+
+  PublishingScheduler(const PublishingScheduler&) = delete;
+  PublishingScheduler& operator=(const PublishingScheduler&) = delete;
+
+  // Must be called before 'Start()'.
+  void AddTask(const std::string& name, double period_sec,
+               std::function<bool()> has_subscribers,
+               std::function<void()> publish);
+
+  // Starts running the tasks until this object is destroyed.
+  void Start();
+
+ private:
+  struct Task {
+    std::string name;
+    absl::Duration period;
+    std::function<bool()> has_subscribers;
+    std::function<void()> publish;
+    absl::Time next_run_time;
+  };
+
+  void Run() LOCKS_EXCLUDED(mutex_);
+
+  std::vector<Task> tasks_;
+  absl::Mutex mutex_;
+  bool shutting_down_ GUARDED_BY(mutex_) = false;
+  std::thread thread_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_PUBLISHING_SCHEDULER_H
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/publishing_scheduler.h"
+
+#include <string>
+#include <vector>
+
+#include "absl/time/clock.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+// The scheduler is destroyed before the recorded runs are inspected, so they
+// are only ever accessed from one thread at a time.
+TEST(PublishingSchedulerTest, RunsDueTasksInOrderOfAdding) {
+  std::vector<std::string> runs;
+  {
+    PublishingScheduler scheduler;
+    for (const std::string name : {"a", "b", "c"}) {
+      scheduler.AddTask(
+          name, 10., []() { return true; },
+          [&runs, name]() { runs.push_back(name); });
+    }
+    scheduler.Start();
+    absl::SleepFor(absl::Milliseconds(50));
+  }
+  EXPECT_EQ(runs, (std::vector<std::string>{"a", "b", "c"}));
+}
+
+TEST(PublishingSchedulerTest, SkipsTasksWithoutSubscribers) {
+  int num_runs = 0;
+  int num_subscriber_checks = 0;
+  {
+    PublishingScheduler scheduler;
+    scheduler.AddTask(
+        "task", 0.01,
+        [&num_subscriber_checks]() {
+          ++num_subscriber_checks;
+          return false;
+        },
+        [&num_runs]() { ++num_runs; });
+    scheduler.Start();
+    absl::SleepFor(absl::Milliseconds(100));
+  }
+  EXPECT_EQ(num_runs, 0);
+  // Subscribers are checked again each period.
+  EXPECT_GT(num_subscriber_checks, 1);
+}
+
+TEST(PublishingSchedulerTest, RunsTasksByTheirPeriods) {
+  int num_fast_runs = 0;
+  int num_slow_runs = 0;
+  {
+    PublishingScheduler scheduler;
+    scheduler.AddTask(
+        "slow", 0.1, []() { return true; },
+        [&num_slow_runs]() { ++num_slow_runs; });
+    scheduler.AddTask(
+        "fast", 0.01, []() { return true; },
+        [&num_fast_runs]() { ++num_fast_runs; });
+    scheduler.Start();
+    absl::SleepFor(absl::Milliseconds(250));
+  }
+  EXPECT_GE(num_slow_runs, 1);
+  EXPECT_LE(num_slow_runs, 3);
+  EXPECT_GT(num_fast_runs, 2 * num_slow_runs);
+}
+
+TEST(PublishingSchedulerTest, PostponesTasksTakingLongerThanTheirPeriod) {
+  const absl::Duration publish_duration = absl::Milliseconds(30);
+  std::vector<absl::Time> run_times;
+  {
+    PublishingScheduler scheduler;
+    scheduler.AddTask(
+        "task", 0.01, []() { return true; },
+        [&run_times, publish_duration]() {
+          run_times.push_back(absl::Now());
+          absl::SleepFor(publish_duration);
+        });
+    scheduler.Start();
+    absl::SleepFor(absl::Milliseconds(300));
+  }
+  ASSERT_GE(run_times.size(), 2u);
+  // The next run waits as long as the previous one took, so that at most half
+  // of the time is spent publishing.
+  for (size_t i = 1; i < run_times.size(); ++i) {
+    EXPECT_GE(run_times[i] - run_times[i - 1],
+              2 * publish_duration - absl::Milliseconds(5));
+  }
+}
+
+}  // namespace
+}  // namespace cartographer_ros
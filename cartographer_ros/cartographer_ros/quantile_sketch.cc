@@ -0,0 +1,115 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/quantile_sketch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+// Magnitudes below are counted as zero. This bounds the number of buckets.
+constexpr double kMinMagnitude = 1e-12;
+
+}  // namespace
+
+QuantileSketch::QuantileSketch(const double relative_accuracy)
+    : gamma_((1. + relative_accuracy) / (1. - relative_accuracy)),
+      log_gamma_(std::log(gamma_)) {
+  CHECK_GT(relative_accuracy, 0.);
+  CHECK_LT(relative_accuracy, 1.);
+}
+
+void QuantileSketch::Add(const double value) {
+  if (std::isnan(value)) {
+    return;
+  }
+  if (count_ == 0) {
+    min_ = value;
+    max_ = value;
+  } else {
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+  ++count_;
+  sum_ += value;
+  if (std::abs(value) < kMinMagnitude) {
+    ++zero_count_;
+  } else if (value > 0.) {
+    ++positive_counts_[BucketIndex(value)];
+  } else {
+    ++negative_counts_[BucketIndex(-value)];
+  }
+}
+
+double QuantileSketch::Quantile(const double q) const {
+  CHECK_GT(count_, 0);
+  CHECK_GE(q, 0.);
+  CHECK_LE(q, 1.);
+  const double rank = q * (count_ - 1);
+  uint64_t num_values_below = 0;
+  const auto clamp = [this](const double value) {
+    return std::min(max_, std::max(min_, value));
+  };
+  for (auto it = negative_counts_.rbegin(); it != negative_counts_.rend();
+       ++it) {
+    num_values_below += it->second;
+    if (num_values_below > rank) {
+      return clamp(-BucketValue(it->first));
+    }
+  }
+  num_values_below += zero_count_;
+  if (num_values_below > rank) {
+    return clamp(0.);
+  }
+  for (const auto& entry : positive_counts_) {
+    num_values_below += entry.second;
+    if (num_values_below > rank) {
+      return clamp(BucketValue(entry.first));
+    }
+  }
+  return max_;
+}
+
+std::string QuantileSketch::ToString() const {
+  std::ostringstream result;
+  result << "Count: " << count_;
+  if (count_ == 0) {
+    return result.str();
+  }
+  result << "  Min: " << min_ << "  Max: " << max_ << "  Mean: " << mean();
+  for (const double q : {0.01, 0.1, 0.5, 0.9, 0.99, 0.999}) {
+    result << "\n" << 100. * q << "%: " << Quantile(q);
+  }
+  return result.str();
+}
+
+int QuantileSketch::BucketIndex(const double magnitude) const {
+  return static_cast<int>(std::ceil(std::log(magnitude) / log_gamma_));
+}
+
+double QuantileSketch::BucketValue(const int index) const {
+  // Bucket 'index' holds the magnitudes in (gamma^(index - 1), gamma^index],
+  // all of which are within the relative accuracy of this value.
+  return 2. * std::pow(gamma_, index) / (gamma_ + 1.);
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_QUANTILE_SKETCH_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_QUANTILE_SKETCH_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace cartographer_ros {
+
+// Summarizes a stream of values in memory which only grows with the
+// logarithm of their range instead of their number. Values are counted in
+// buckets whose bounds grow geometrically, so quantiles are known up to a
+// relative error of 'relative_accuracy'. Count, minimum, maximum and mean are
+// exact.
+class QuantileSketch {
+ public:
+  explicit QuantileSketch(double relative_accuracy = 0.01);
+
+  void Add(double value);
+
+  uint64_t count() const { return count_; }
+  double min() const { return min_; }
+  double max() const { return max_; }
+  double mean() const { return count_ == 0 ? 0. : sum_ / count_; }
+
+  // Returns the value below which a fraction 'q' in [0, 1] of the values
+  // lie. Must not be called before a value was added.
+  double Quantile(double q) const;
+
+  // Returns the count, minimum, maximum, mean and a few quantiles in a human
+  // readable format.
+  std::string ToString() const;
+
+ private:
+  int BucketIndex(double magnitude) const;
+  double BucketValue(int index) const;
+
+  const double gamma_;
+  const double log_gamma_;
+  uint64_t count_ = 0;
+  double sum_ = 0.;
+  double min_ = 0.;
+  double max_ = 0.;
+  // Values too close to zero to be bucketed.
+  uint64_t zero_count_ = 0;
+  // Counts by bucket index of the magnitude, for positive and negative
+  // values.
+  std::map<int, uint64_t> positive_counts_;
+  std::map<int, uint64_t> negative_counts_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_QUANTILE_SKETCH_H
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/quantile_sketch.h"
+
+#include <cmath>
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+TEST(QuantileSketch, ComputesExactStatistics) {
+  QuantileSketch sketch;
+  for (const double value : {0.5, -0.25, 2., 0.}) {
+    sketch.Add(value);
+  }
+  EXPECT_EQ(4u, sketch.count());
+  EXPECT_EQ(-0.25, sketch.min());
+  EXPECT_EQ(2., sketch.max());
+  EXPECT_NEAR(0.5625, sketch.mean(), 1e-12);
+}
+
+TEST(QuantileSketch, QuantilesAreWithinRelativeAccuracy) {
+  constexpr double kRelativeAccuracy = 0.01;
+  constexpr int kNumValues = 100000;
+  QuantileSketch sketch(kRelativeAccuracy);
+  // Spreads the values over several orders of magnitude.
+  for (int i = 1; i <= kNumValues; ++i) {
+    sketch.Add(std::pow(10., 6. * i / kNumValues - 5.));
+  }
+  for (const double q : {0., 0.1, 0.5, 0.9, 0.99, 1.}) {
+    const double expected = std::pow(
+        10., 6. * (1. + q * (kNumValues - 1)) / kNumValues - 5.);
+    EXPECT_NEAR(expected, sketch.Quantile(q), kRelativeAccuracy * expected)
+        << q;
+  }
+}
+
+TEST(QuantileSketch, OrdersNegativeValuesBeforePositiveOnes) {
+  QuantileSketch sketch;
+  sketch.Add(-1.);
+  sketch.Add(0.);
+  sketch.Add(1.);
+  EXPECT_NEAR(-1., sketch.Quantile(0.), 0.01);
+  EXPECT_EQ(0., sketch.Quantile(0.5));
+  EXPECT_NEAR(1., sketch.Quantile(1.), 0.01);
+}
+
+}  // namespace
+}  // namespace cartographer_ros
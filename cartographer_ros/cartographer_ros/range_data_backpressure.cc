@@ -0,0 +1,151 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/range_data_backpressure.h"
+
+#include "cartographer_ros/metrics/trajectory_accounting.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+absl::Duration RangeDataBackpressure::WaitForCapacity(
+    const int trajectory_id, const int max_queued,
+    const absl::Duration stall_timeout) {
+  const absl::Time start_time = absl::Now();
+  absl::MutexLock lock(&mutex_);
+  int num_optimizations = -1;
+  absl::Time deadline;
+  for (;;) {
+    // Looked up again after waiting, the trajectory might have finished.
+    const auto it = queues_.find(trajectory_id);
+    if (it == queues_.end()) {
+      break;
+    }
+    TrajectoryQueue& queue = it->second;
+    if (queue.stalled || queue.num_queued() < max_queued ||
+        queue.num_unoptimized_range_data == 0) {
+      break;
+    }
+    if (queue.num_optimizations != num_optimizations) {
+      num_optimizations = queue.num_optimizations;
+      deadline = absl::Now() + stall_timeout;
+    } else if (absl::Now() >= deadline) {
+      LOG(WARNING) << "Global SLAM of trajectory " << trajectory_id
+                   << " did not optimize for "
+                   << absl::FormatDuration(stall_timeout)
+                   << ", not waiting for it until it does.";
+      queue.stalled = true;
+      break;
+    }
+    queue_changed_.WaitWithDeadline(&mutex_, deadline);
+  }
+  return absl::Now() - start_time;
+}
+
+int RangeDataBackpressure::GetNumQueued(const int trajectory_id) const {
+  absl::MutexLock lock(&mutex_);
+  const auto it = queues_.find(trajectory_id);
+  return it == queues_.end() ? 0 : it->second.num_queued();
+}
+
+int RangeDataBackpressure::GetNumUnmatched(const int trajectory_id) const {
+  absl::MutexLock lock(&mutex_);
+  const auto it = queues_.find(trajectory_id);
+  return it == queues_.end()
+             ? 0
+             : static_cast<int>(it->second.unmatched_range_data.size());
+}
+
+void RangeDataBackpressure::AddRangeData(
+    const int trajectory_id, const ::cartographer::common::Time time) {
+  absl::MutexLock lock(&mutex_);
+  TrajectoryQueue& queue = queues_[trajectory_id];
+  if (queue.num_queued_metric == nullptr) {
+    queue.num_queued_metric =
+        metrics::GetTrajectoryAccounting(trajectory_id).num_pending_range_data;
+  }
+  queue.unmatched_range_data.push_back(time);
+  UpdateMetric(queue);
+}
+
+void RangeDataBackpressure::AddLocalSlamResult(
+    const int trajectory_id, const ::cartographer::common::Time time,
+    const absl::optional<int> node_index) {
+  absl::MutexLock lock(&mutex_);
+  const auto it = queues_.find(trajectory_id);
+  if (it == queues_.end()) {
+    return;
+  }
+  TrajectoryQueue& queue = it->second;
+  // Range data not matched up to the result was dropped or accumulated into
+  // it, both of which are fine to count as matched.
+  int num_matched = 0;
+  while (!queue.unmatched_range_data.empty() &&
+         queue.unmatched_range_data.front() <= time) {
+    queue.unmatched_range_data.pop_front();
+    ++num_matched;
+  }
+  if (node_index.has_value() && num_matched > 0) {
+    queue.unoptimized_nodes.push_back(
+        UnoptimizedNode{node_index.value(), num_matched});
+    queue.num_unoptimized_range_data += num_matched;
+  }
+  UpdateMetric(queue);
+}
+
+void RangeDataBackpressure::AddOptimizationResult(
+    const std::map<int, ::cartographer::mapping::NodeId>&
+        last_optimized_node_ids) {
+  absl::MutexLock lock(&mutex_);
+  for (const auto& entry : last_optimized_node_ids) {
+    const auto it = queues_.find(entry.first);
+    if (it == queues_.end()) {
+      continue;
+    }
+    TrajectoryQueue& queue = it->second;
+    while (!queue.unoptimized_nodes.empty() &&
+           queue.unoptimized_nodes.front().node_index <=
+               entry.second.node_index) {
+      queue.num_unoptimized_range_data -=
+          queue.unoptimized_nodes.front().num_range_data;
+      queue.unoptimized_nodes.pop_front();
+    }
+    ++queue.num_optimizations;
+    queue.stalled = false;
+    UpdateMetric(queue);
+  }
+  queue_changed_.SignalAll();
+}
+
+void RangeDataBackpressure::FinishTrajectory(const int trajectory_id) {
+  absl::MutexLock lock(&mutex_);
+  const auto it = queues_.find(trajectory_id);
+  if (it != queues_.end()) {
+    if (it->second.num_queued_metric != nullptr) {
+      it->second.num_queued_metric->Set(0.);
+    }
+    queues_.erase(it);
+  }
+  queue_changed_.SignalAll();
+}
+
+void RangeDataBackpressure::UpdateMetric(const TrajectoryQueue& queue) {
+  if (queue.num_queued_metric != nullptr) {
+    queue.num_queued_metric->Set(queue.num_queued());
+  }
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_RANGE_DATA_BACKPRESSURE_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_RANGE_DATA_BACKPRESSURE_H
+
+#include <deque>
+#include <map>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "cartographer/common/time.h"
+#include "cartographer/mapping/id.h"
+#include "cartographer/metrics/gauge.h"
+
+namespace cartographer_ros {
+
+// Counts the range data of each trajectory which was handed to the map builder
+// but is not yet part of the optimized map, so that offline processing can
+// wait for SLAM instead of queueing data without bound.
+//
+// Range data first waits to be matched by local SLAM, which runs on the thread
+// adding the data. If it becomes part of a trajectory node, it then waits for
+// the global optimization covering that node, which runs in the background.
+// Thread-safe.
+class RangeDataBackpressure {
+ public:
+  RangeDataBackpressure() = default;
+
+  RangeDataBackpressure(const RangeDataBackpressure&) = delete;
+  RangeDataBackpressure& operator=(const RangeDataBackpressure&) = delete;
+
+  // Blocks until fewer than 'max_queued' range data of 'trajectory_id' are
+  // queued. Since only global SLAM drains the queue in the background, this
+  // returns right away if none of the queued data waits for it. If global SLAM
+  // does not optimize for 'stall_timeout', this stops waiting for the
+  // trajectory until the next optimization. Returns the time spent waiting.
+  absl::Duration WaitForCapacity(int trajectory_id, int max_queued,
+                                 absl::Duration stall_timeout)
+      LOCKS_EXCLUDED(mutex_);
+
+  int GetNumQueued(int trajectory_id) const LOCKS_EXCLUDED(mutex_);
+  // Only counts the range data waiting for local SLAM, which does not include
+  // any delay of global SLAM.
+  int GetNumUnmatched(int trajectory_id) const LOCKS_EXCLUDED(mutex_);
+
+  // Called before range data at 'time' is handed to the map builder.
+  void AddRangeData(int trajectory_id, ::cartographer::common::Time time)
+      LOCKS_EXCLUDED(mutex_);
+  // Called with each local SLAM result. 'node_index' is set if a trajectory
+  // node was inserted into the pose graph.
+  void AddLocalSlamResult(int trajectory_id, ::cartographer::common::Time time,
+                          absl::optional<int> node_index)
+      LOCKS_EXCLUDED(mutex_);
+  // Called with the last nodes covered by each global optimization.
+  void AddOptimizationResult(
+      const std::map<int, ::cartographer::mapping::NodeId>&
+          last_optimized_node_ids) LOCKS_EXCLUDED(mutex_);
+  void FinishTrajectory(int trajectory_id) LOCKS_EXCLUDED(mutex_);
+
+ private:
+  struct UnoptimizedNode {
+    int node_index;
+    int num_range_data;
+  };
+
+  struct TrajectoryQueue {
+    // Times of the range data not yet matched by local SLAM.
+    std::deque<::cartographer::common::Time> unmatched_range_data;
+    std::deque<UnoptimizedNode> unoptimized_nodes;
+    int num_unoptimized_range_data = 0;
+    int num_optimizations = 0;
+    // Set when global SLAM stopped optimizing while waited for.
+    bool stalled = false;
+    // Looked up when the first range data is added.
+    ::cartographer::metrics::Gauge* num_queued_metric = nullptr;
+
+    int num_queued() const {
+      return static_cast<int>(unmatched_range_data.size()) +
+             num_unoptimized_range_data;
+    }
+  };
+
+  static void UpdateMetric(const TrajectoryQueue& queue);
+
+  mutable absl::Mutex mutex_;
+  absl::CondVar queue_changed_;
+  std::map<int, TrajectoryQueue> queues_ GUARDED_BY(mutex_);
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_RANGE_DATA_BACKPRESSURE_H
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/range_data_backpressure.h"
+
+#include <atomic>
+#include <map>
+#include <thread>
+
+#include "absl/time/clock.h"
+#include "cartographer_ros/adaptive_sampler.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::common::FromUniversal;
+using ::cartographer::mapping::NodeId;
+
+constexpr int kTrajectoryId = 0;
+
+std::map<int, NodeId> LastOptimizedNodeIds(const int node_index) {
+  return {{kTrajectoryId, NodeId{kTrajectoryId, node_index}}};
+}
+
+TEST(RangeDataBackpressureTest, CountsRangeDataUntilOptimized) {
+  RangeDataBackpressure backpressure;
+  for (int i = 0; i != 3; ++i) {
+    backpressure.AddRangeData(kTrajectoryId, FromUniversal(100 + i));
+  }
+  EXPECT_EQ(backpressure.GetNumQueued(kTrajectoryId), 3);
+  EXPECT_EQ(backpressure.GetNumUnmatched(kTrajectoryId), 3);
+
+  // The first two range data become part of node 0.
+  backpressure.AddLocalSlamResult(kTrajectoryId, FromUniversal(101), 0);
+  EXPECT_EQ(backpressure.GetNumQueued(kTrajectoryId), 3);
+  EXPECT_EQ(backpressure.GetNumUnmatched(kTrajectoryId), 1);
+  backpressure.AddOptimizationResult(LastOptimizedNodeIds(0));
+  EXPECT_EQ(backpressure.GetNumQueued(kTrajectoryId), 1);
+
+  // Range data not inserted as a node is done once matched.
+  backpressure.AddLocalSlamResult(kTrajectoryId, FromUniversal(102),
+                                  absl::nullopt);
+  EXPECT_EQ(backpressure.GetNumQueued(kTrajectoryId), 0);
+
+  backpressure.AddRangeData(kTrajectoryId, FromUniversal(103));
+  backpressure.FinishTrajectory(kTrajectoryId);
+  EXPECT_EQ(backpressure.GetNumQueued(kTrajectoryId), 0);
+}
+
+TEST(RangeDataBackpressureTest, AdaptsSamplingToOptimizationBacklog) {
+  AdaptiveSamplingOptions options;
+  options.min_sampling_ratio = 0.1;
+  options.max_queued_range_data = 5;
+  options.min_queued_range_data = 1;
+  AdaptiveSampler sampler(1., options);
+  RangeDataBackpressure backpressure;
+  auto now = std::chrono::steady_clock::now();
+  // Local SLAM matches each range data right away, as it does online, while
+  // global SLAM never optimizes.
+  for (int i = 0; i != 10; ++i) {
+    backpressure.AddRangeData(kTrajectoryId, FromUniversal(100 + i));
+    backpressure.AddLocalSlamResult(kTrajectoryId, FromUniversal(100 + i), i);
+    EXPECT_EQ(backpressure.GetNumUnmatched(kTrajectoryId), 0);
+    sampler.Adapt(backpressure.GetNumQueued(kTrajectoryId), now);
+    now += AdaptiveSampler::kAdaptationPeriod;
+  }
+  EXPECT_EQ(backpressure.GetNumQueued(kTrajectoryId), 10);
+  EXPECT_LT(sampler.ratio(), 1.);
+
+  backpressure.AddOptimizationResult(LastOptimizedNodeIds(9));
+  for (int i = 0; i != 20; ++i) {
+    sampler.Adapt(backpressure.GetNumQueued(kTrajectoryId), now);
+    now += AdaptiveSampler::kAdaptationPeriod;
+  }
+  EXPECT_DOUBLE_EQ(sampler.ratio(), 1.);
+}
+
+TEST(RangeDataBackpressureTest, DoesNotWaitForLocalSlam) {
+  RangeDataBackpressure backpressure;
+  for (int i = 0; i != 3; ++i) {
+    backpressure.AddRangeData(kTrajectoryId, FromUniversal(100 + i));
+  }
+  // Only local SLAM, which runs on the calling thread, could drain the queue.
+  EXPECT_LT(backpressure.WaitForCapacity(kTrajectoryId, 1 /* max_queued */,
+                                         absl::Seconds(10)),
+            absl::Seconds(10));
+}
+
+TEST(RangeDataBackpressureTest, BlocksUntilOptimized) {
+  RangeDataBackpressure backpressure;
+  for (int i = 0; i != 3; ++i) {
+    backpressure.AddRangeData(kTrajectoryId, FromUniversal(100 + i));
+    backpressure.AddLocalSlamResult(kTrajectoryId, FromUniversal(100 + i), i);
+  }
+  std::atomic<bool> optimized(false);
+  std::thread waiting_thread([&backpressure, &optimized]() {
+    backpressure.WaitForCapacity(kTrajectoryId, 2 /* max_queued */,
+                                 absl::Seconds(10));
+    EXPECT_TRUE(optimized);
+    EXPECT_LT(backpressure.GetNumQueued(kTrajectoryId), 2);
+  });
+  absl::SleepFor(absl::Milliseconds(20));
+  // An optimization which does not free enough capacity keeps it waiting.
+  backpressure.AddOptimizationResult(LastOptimizedNodeIds(0));
+  absl::SleepFor(absl::Milliseconds(20));
+  optimized = true;
+  backpressure.AddOptimizationResult(LastOptimizedNodeIds(1));
+  waiting_thread.join();
+}
+
+TEST(RangeDataBackpressureTest, StopsWaitingWhenStalled) {
+  RangeDataBackpressure backpressure;
+  for (int i = 0; i != 3; ++i) {
+    backpressure.AddRangeData(kTrajectoryId, FromUniversal(100 + i));
+    backpressure.AddLocalSlamResult(kTrajectoryId, FromUniversal(100 + i), i);
+  }
+  const absl::Duration stall_timeout = absl::Milliseconds(20);
+  EXPECT_GE(backpressure.WaitForCapacity(kTrajectoryId, 1 /* max_queued */,
+                                         stall_timeout),
+            stall_timeout);
+  // Stalled trajectories are not waited for until the next optimization.
+  EXPECT_LT(backpressure.WaitForCapacity(kTrajectoryId, 1 /* max_queued */,
+                                         absl::Seconds(10)),
+            absl::Seconds(10));
+  backpressure.AddOptimizationResult(LastOptimizedNodeIds(0));
+  EXPECT_GE(backpressure.WaitForCapacity(kTrajectoryId, 1 /* max_queued */,
+                                         stall_timeout),
+            stall_timeout);
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/rangefinder_merger.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace carto = ::cartographer;
+
+RangefinderMergeOptions CreateRangefinderMergeOptions(
+    carto::common::LuaParameterDictionary* const lua_parameter_dictionary) {
+  RangefinderMergeOptions options;
+  for (const std::string& sensor_id :
+       lua_parameter_dictionary->GetDictionary("topics")
+           ->GetArrayValuesAsStrings()) {
+    CHECK(options.sensor_ids.insert(sensor_id).second)
+        << "Topic '" << sensor_id << "' is merged more than once.";
+  }
+  options.max_wait_sec = lua_parameter_dictionary->GetDouble("max_wait_sec");
+  CHECK_GE(options.sensor_ids.size(), 2u)
+      << "At least two rangefinder topics are needed to merge them.";
+  CHECK_GE(options.max_wait_sec, 0.);
+  return options;
+}
+
+RangefinderMerger::RangefinderMerger(const RangefinderMergeOptions& options)
+    : max_wait_(carto::common::FromSeconds(options.max_wait_sec)) {
+  for (const std::string& sensor_id : options.sensor_ids) {
+    sensor_to_pending_data_[sensor_id];
+  }
+}
+
+bool RangefinderMerger::IsMerged(const std::string& sensor_id) const {
+  return sensor_to_pending_data_.count(sensor_id) != 0;
+}
+
+std::vector<carto::sensor::TimedPointCloudData>
+RangefinderMerger::AddRangefinderData(
+    const std::string& sensor_id, carto::sensor::TimedPointCloudData data) {
+  std::vector<carto::sensor::TimedPointCloudData> merged_rounds;
+  auto& pending_data = sensor_to_pending_data_.at(sensor_id);
+  bool merge_pending_round = pending_data.has_value();
+  for (const auto& entry : sensor_to_pending_data_) {
+    if (entry.second.has_value() &&
+        data.time - entry.second->time > max_wait_) {
+      merge_pending_round = true;
+    }
+  }
+  if (merge_pending_round) {
+    merged_rounds.push_back(MergeRound());
+  }
+  if (last_merged_time_.has_value() && data.time <= last_merged_time_.value()) {
+    LOG(WARNING) << "Dropped range data of sensor " << sensor_id
+                 << " at time " << data.time
+                 << ", which is not after the merged range data at time "
+                 << last_merged_time_.value() << ".";
+    return merged_rounds;
+  }
+  pending_data = std::move(data);
+  ++num_pending_;
+  if (num_pending_ == static_cast<int>(sensor_to_pending_data_.size())) {
+    merged_rounds.push_back(MergeRound());
+  }
+  return merged_rounds;
+}
+
+std::vector<carto::sensor::TimedPointCloudData> RangefinderMerger::Flush() {
+  std::vector<carto::sensor::TimedPointCloudData> merged_rounds;
+  if (num_pending_ > 0) {
+    merged_rounds.push_back(MergeRound());
+  }
+  return merged_rounds;
+}
+
+carto::sensor::TimedPointCloudData RangefinderMerger::MergeRound() {
+  CHECK_GT(num_pending_, 0);
+  carto::sensor::TimedPointCloudData merged;
+  merged.time = carto::common::Time::min();
+  size_t num_points = 0;
+  for (const auto& entry : sensor_to_pending_data_) {
+    if (entry.second.has_value()) {
+      merged.time = std::max(merged.time, entry.second->time);
+      num_points += entry.second->ranges.size();
+    }
+  }
+  merged.origin = Eigen::Vector3f::Zero();
+  merged.ranges.reserve(num_points);
+  for (auto& entry : sensor_to_pending_data_) {
+    if (!entry.second.has_value()) {
+      continue;
+    }
+    merged.origin += entry.second->origin / static_cast<float>(num_pending_);
+    // Point times are relative to the time of their point cloud.
+    const float time_offset = static_cast<float>(
+        carto::common::ToSeconds(entry.second->time - merged.time));
+    const size_t merged_size = merged.ranges.size();
+    for (const auto& range : entry.second->ranges) {
+      merged.ranges.push_back({range.position, range.time + time_offset});
+    }
+    // Each point cloud is ordered by time, which the trajectory builder also
+    // expects of the merged one.
+    std::inplace_merge(
+        merged.ranges.begin(), merged.ranges.begin() + merged_size,
+        merged.ranges.end(),
+        [](const carto::sensor::TimedRangefinderPoint& lhs,
+           const carto::sensor::TimedRangefinderPoint& rhs) {
+          return lhs.time < rhs.time;
+        });
+    entry.second.reset();
+  }
+  num_pending_ = 0;
+  last_merged_time_ = merged.time;
+  return merged;
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_RANGEFINDER_MERGER_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_RANGEFINDER_MERGER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "absl/types/optional.h"
+#include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/time.h"
+#include "cartographer/sensor/timed_point_cloud_data.h"
+
+namespace cartographer_ros {
+
+struct RangefinderMergeOptions {
+  // Range data of these sensors is merged. Disabled if empty.
+  std::set<std::string> sensor_ids;
+  // Merged range data waits at most this long in sensor time for range data
+  // of the other sensors.
+  double max_wait_sec = 0.;
+};
+
+RangefinderMergeOptions CreateRangefinderMergeOptions(
+    ::cartographer::common::LuaParameterDictionary* lua_parameter_dictionary);
+
+// Merges the range data of several sensors in the tracking frame into one
+// point cloud per round of measurements, so that the trajectory builder gets
+// fewer, larger point clouds and does not have to wait for the slowest sensor
+// to order them. A round is merged as soon as each sensor contributed to it.
+// It is merged without the new range data, which starts the next round, if a
+// sensor contributes a second time or the range data is more than
+// 'max_wait_sec' after the oldest of the round. Range data older than the
+// last merged round is dropped.
+//
+// The merged point cloud only has a single origin, the mean of the origins
+// of the round, so only sensors close to each other should be merged.
+// Not thread-safe.
+class RangefinderMerger {
+ public:
+  explicit RangefinderMerger(const RangefinderMergeOptions& options);
+
+  RangefinderMerger(const RangefinderMerger&) = delete;
+  RangefinderMerger& operator=(const RangefinderMerger&) = delete;
+
+  bool IsMerged(const std::string& sensor_id) const;
+
+  // Returns the rounds merged by adding 'data' of the merged 'sensor_id', in
+  // the order of their time.
+  std::vector<::cartographer::sensor::TimedPointCloudData> AddRangefinderData(
+      const std::string& sensor_id,
+      ::cartographer::sensor::TimedPointCloudData data);
+
+  // Returns the round still waiting for other sensors, if any, merged as it
+  // is. Called once no more range data is added.
+  std::vector<::cartographer::sensor::TimedPointCloudData> Flush();
+
+ private:
+  ::cartographer::sensor::TimedPointCloudData MergeRound();
+
+  const ::cartographer::common::Duration max_wait_;
+  std::map<std::string,
+           absl::optional<::cartographer::sensor::TimedPointCloudData>>
+      sensor_to_pending_data_;
+  int num_pending_ = 0;
+  absl::optional<::cartographer::common::Time> last_merged_time_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_RANGEFINDER_MERGER_H
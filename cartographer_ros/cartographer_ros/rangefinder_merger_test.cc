@@ -0,0 +1,107 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/rangefinder_merger.h"
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+namespace carto = ::cartographer;
+
+RangefinderMergeOptions MakeOptions() {
+  RangefinderMergeOptions options;
+  options.sensor_ids = {"points2_1", "points2_2", "points2_3"};
+  options.max_wait_sec = 0.1;
+  return options;
+}
+
+carto::sensor::TimedPointCloudData MakeData(const double time,
+                                            const float origin_x) {
+  carto::sensor::TimedPointCloudData data;
+  data.time =
+      carto::common::FromUniversal(0) + carto::common::FromSeconds(time);
+  data.origin = Eigen::Vector3f(origin_x, 0.f, 0.f);
+  data.ranges = {{Eigen::Vector3f::Zero(), -0.02f},
+                 {Eigen::Vector3f::Zero(), 0.f}};
+  return data;
+}
+
+TEST(RangefinderMerger, MergesRoundInTimeOrder) {
+  RangefinderMerger merger(MakeOptions());
+  EXPECT_TRUE(merger.IsMerged("points2_1"));
+  EXPECT_FALSE(merger.IsMerged("scan"));
+  EXPECT_TRUE(
+      merger.AddRangefinderData("points2_1", MakeData(1., 0.f)).empty());
+  EXPECT_TRUE(
+      merger.AddRangefinderData("points2_3", MakeData(1.005, 1.f)).empty());
+  const auto merged =
+      merger.AddRangefinderData("points2_2", MakeData(1.01, 2.f));
+  ASSERT_EQ(1u, merged.size());
+  EXPECT_EQ(MakeData(1.01, 0.f).time, merged[0].time);
+  EXPECT_FLOAT_EQ(1.f, merged[0].origin.x());
+  ASSERT_EQ(6u, merged[0].ranges.size());
+  EXPECT_NEAR(-0.03f, merged[0].ranges[0].time, 1e-6);
+  EXPECT_NEAR(-0.025f, merged[0].ranges[1].time, 1e-6);
+  EXPECT_NEAR(-0.02f, merged[0].ranges[2].time, 1e-6);
+  EXPECT_NEAR(-0.01f, merged[0].ranges[3].time, 1e-6);
+  EXPECT_NEAR(-0.005f, merged[0].ranges[4].time, 1e-6);
+  EXPECT_NEAR(0.f, merged[0].ranges[5].time, 1e-6);
+}
+
+TEST(RangefinderMerger, FlushesPendingRound) {
+  RangefinderMerger merger(MakeOptions());
+  EXPECT_TRUE(merger.Flush().empty());
+  EXPECT_TRUE(
+      merger.AddRangefinderData("points2_1", MakeData(1., 0.f)).empty());
+  EXPECT_TRUE(
+      merger.AddRangefinderData("points2_2", MakeData(1.01, 2.f)).empty());
+  const auto merged = merger.Flush();
+  ASSERT_EQ(1u, merged.size());
+  EXPECT_EQ(MakeData(1.01, 0.f).time, merged[0].time);
+  EXPECT_FLOAT_EQ(1.f, merged[0].origin.x());
+  EXPECT_EQ(4u, merged[0].ranges.size());
+  EXPECT_TRUE(merger.Flush().empty());
+}
+
+TEST(RangefinderMerger, MergesIncompleteRounds) {
+  RangefinderMerger merger(MakeOptions());
+  EXPECT_TRUE(
+      merger.AddRangefinderData("points2_1", MakeData(1., 0.f)).empty());
+  // A second contribution of the same sensor starts the next round.
+  auto merged = merger.AddRangefinderData("points2_1", MakeData(1.05, 0.f));
+  ASSERT_EQ(1u, merged.size());
+  EXPECT_EQ(2u, merged[0].ranges.size());
+  // Data older than the merged round is dropped.
+  EXPECT_TRUE(
+      merger.AddRangefinderData("points2_2", MakeData(0.9, 0.f)).empty());
+  // Waiting for the other sensors ends with range data more than
+  // 'max_wait_sec' later, which starts the next round.
+  merged = merger.AddRangefinderData("points2_2", MakeData(1.2, 0.f));
+  ASSERT_EQ(1u, merged.size());
+  EXPECT_EQ(MakeData(1.05, 0.f).time, merged[0].time);
+  EXPECT_EQ(2u, merged[0].ranges.size());
+  EXPECT_TRUE(
+      merger.AddRangefinderData("points2_3", MakeData(1.22, 0.f)).empty());
+  merged = merger.AddRangefinderData("points2_1", MakeData(1.25, 0.f));
+  ASSERT_EQ(1u, merged.size());
+  EXPECT_EQ(MakeData(1.25, 0.f).time, merged[0].time);
+  EXPECT_EQ(6u, merged[0].ranges.size());
+}
+
+}  // namespace
+}  // namespace cartographer_ros
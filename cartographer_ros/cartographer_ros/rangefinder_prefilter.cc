@@ -0,0 +1,111 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/rangefinder_prefilter.h"
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+Eigen::Vector3f ToVector3f(const std::vector<double>& values) {
+  CHECK_EQ(values.size(), 3u);
+  return Eigen::Vector3d(values[0], values[1], values[2]).cast<float>();
+}
+
+}  // namespace
+
+uint64_t GetVoxelKey(const Eigen::Vector3f& position,
+                     const float inverse_voxel_size) {
+  constexpr uint64_t kMask = (uint64_t{1} << 21) - 1;
+  const auto index = [inverse_voxel_size](const float value) {
+    return static_cast<uint64_t>(
+               static_cast<int64_t>(std::floor(value * inverse_voxel_size))) &
+           kMask;
+  };
+  return (index(position.x()) << 42) | (index(position.y()) << 21) |
+         index(position.z());
+}
+
+RangefinderPrefilterOptions CreateRangefinderPrefilterOptions(
+    ::cartographer::common::LuaParameterDictionary* const
+        lua_parameter_dictionary) {
+  RangefinderPrefilterOptions options;
+  if (lua_parameter_dictionary->HasKey("min_range")) {
+    options.min_range = lua_parameter_dictionary->GetDouble("min_range");
+  }
+  if (lua_parameter_dictionary->HasKey("max_range")) {
+    options.max_range = lua_parameter_dictionary->GetDouble("max_range");
+  }
+  if (lua_parameter_dictionary->HasKey("voxel_size")) {
+    options.voxel_size = lua_parameter_dictionary->GetDouble("voxel_size");
+  }
+  if (lua_parameter_dictionary->HasKey("body_box")) {
+    const auto body_box = lua_parameter_dictionary->GetDictionary("body_box");
+    options.body_box = Eigen::AlignedBox3f(
+        ToVector3f(body_box->GetDictionary("min")->GetArrayValuesAsDoubles()),
+        ToVector3f(body_box->GetDictionary("max")->GetArrayValuesAsDoubles()));
+  }
+  CHECK_GE(options.min_range, 0.f);
+  CHECK_LT(options.min_range, options.max_range);
+  CHECK_GE(options.voxel_size, 0.f);
+  return options;
+}
+
+size_t TransformAndPrefilterRanges(
+    const absl::Span<const ::cartographer::sensor::TimedRangefinderPoint>
+        ranges,
+    const Eigen::Matrix3f& rotation, const Eigen::Vector3f& translation,
+    const float time_offset, const RangefinderPrefilterOptions& options,
+    ::cartographer::sensor::TimedRangefinderPoint* const result) {
+  const float min_range_squared = options.min_range * options.min_range;
+  const float max_range_squared = options.max_range * options.max_range;
+  const bool use_voxels = options.voxel_size > 0.f;
+  const float inverse_voxel_size = use_voxels ? 1.f / options.voxel_size : 0.f;
+  std::unordered_set<uint64_t> occupied_voxels;
+  if (use_voxels) {
+    occupied_voxels.reserve(ranges.size());
+  }
+  size_t num_kept = 0;
+  for (const auto& range : ranges) {
+    const float range_squared = range.position.squaredNorm();
+    if (range_squared < min_range_squared ||
+        range_squared > max_range_squared) {
+      continue;
+    }
+    const Eigen::Vector3f position = rotation * range.position + translation;
+    if (options.body_box.contains(position)) {
+      continue;
+    }
+    if (use_voxels &&
+        !occupied_voxels.insert(GetVoxelKey(position, inverse_voxel_size))
+             .second) {
+      continue;
+    }
+    result[num_kept].position = position;
+    result[num_kept].time = range.time + time_offset;
+    ++num_kept;
+  }
+  return num_kept;
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_RANGEFINDER_PREFILTER_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_RANGEFINDER_PREFILTER_H
+
+#include <cstdint>
+#include <limits>
+
+#include "Eigen/Core"
+#include "Eigen/Geometry"
+#include "absl/types/span.h"
+#include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/sensor/rangefinder_point.h"
+
+namespace cartographer_ros {
+
+// Filters range data of one sensor in the sensor bridge, before it is queued
+// for the trajectory builder.
+struct RangefinderPrefilterOptions {
+  // Points closer to or farther from the sensor are dropped.
+  float min_range = 0.f;
+  float max_range = std::numeric_limits<float>::infinity();
+  // Only the first point of each voxel of this edge length in the tracking
+  // frame is kept, 0 keeps all.
+  float voxel_size = 0.f;
+  // Points inside this box in the tracking frame are dropped, e.g. those
+  // hitting the robot itself. Disabled if empty.
+  Eigen::AlignedBox3f body_box;
+};
+
+RangefinderPrefilterOptions CreateRangefinderPrefilterOptions(
+    ::cartographer::common::LuaParameterDictionary* lua_parameter_dictionary);
+
+// Packs the voxel index of 'position' into 64 bits, 21 bits per axis. Indices
+// wrap around beyond about 1 million voxels, which may merge far apart voxels
+// but is harmless for a coarse filter.
+uint64_t GetVoxelKey(const Eigen::Vector3f& position, float inverse_voxel_size);
+
+// Transforms 'ranges' like the sensor bridge does without a prefilter, but
+// only writes the points passing 'options' to 'result', which has to hold as
+// many as 'ranges'. Returns the number of points written, which keep the order
+// of 'ranges'. Range cropping and the body box are exact, but voxels are only
+// filtered within 'ranges', not across calls.
+size_t TransformAndPrefilterRanges(
+    absl::Span<const ::cartographer::sensor::TimedRangefinderPoint> ranges,
+    const Eigen::Matrix3f& rotation, const Eigen::Vector3f& translation,
+    float time_offset, const RangefinderPrefilterOptions& options,
+    ::cartographer::sensor::TimedRangefinderPoint* result);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_RANGEFINDER_PREFILTER_H
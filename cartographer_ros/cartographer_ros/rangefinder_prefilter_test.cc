@@ -0,0 +1,88 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/rangefinder_prefilter.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::sensor::TimedRangefinderPoint;
+
+std::vector<TimedRangefinderPoint> Prefilter(
+    const std::vector<TimedRangefinderPoint>& ranges,
+    const RangefinderPrefilterOptions& options) {
+  std::vector<TimedRangefinderPoint> result(ranges.size());
+  result.resize(TransformAndPrefilterRanges(
+      ranges, Eigen::Matrix3f::Identity(), Eigen::Vector3f(1.f, 0.f, 0.f),
+      -1.f, options, result.data()));
+  return result;
+}
+
+TEST(RangefinderPrefilter, TransformsAllPointsByDefault) {
+  const std::vector<TimedRangefinderPoint> ranges = {
+      {Eigen::Vector3f(0.f, 0.f, 0.f), 0.f},
+      {Eigen::Vector3f(0.f, 2.f, 0.f), 0.5f}};
+  const auto result = Prefilter(ranges, RangefinderPrefilterOptions());
+  ASSERT_EQ(2u, result.size());
+  EXPECT_TRUE(result[1].position.isApprox(Eigen::Vector3f(1.f, 2.f, 0.f)));
+  EXPECT_FLOAT_EQ(-0.5f, result[1].time);
+}
+
+TEST(RangefinderPrefilter, CropsRangesInTheSensorFrame) {
+  RangefinderPrefilterOptions options;
+  options.min_range = 1.f;
+  options.max_range = 3.f;
+  const std::vector<TimedRangefinderPoint> ranges = {
+      {Eigen::Vector3f(0.5f, 0.f, 0.f), 0.f},
+      {Eigen::Vector3f(2.f, 0.f, 0.f), 0.f},
+      {Eigen::Vector3f(0.f, 0.f, 4.f), 0.f}};
+  const auto result = Prefilter(ranges, options);
+  ASSERT_EQ(1u, result.size());
+  EXPECT_TRUE(result[0].position.isApprox(Eigen::Vector3f(3.f, 0.f, 0.f)));
+}
+
+TEST(RangefinderPrefilter, MasksBodyBoxInTheTrackingFrame) {
+  RangefinderPrefilterOptions options;
+  options.body_box = Eigen::AlignedBox3f(Eigen::Vector3f(0.f, -1.f, -1.f),
+                                         Eigen::Vector3f(2.f, 1.f, 1.f));
+  const std::vector<TimedRangefinderPoint> ranges = {
+      {Eigen::Vector3f(0.5f, 0.f, 0.f), 0.f},
+      {Eigen::Vector3f(-2.f, 0.f, 0.f), 0.f}};
+  const auto result = Prefilter(ranges, options);
+  ASSERT_EQ(1u, result.size());
+  EXPECT_TRUE(result[0].position.isApprox(Eigen::Vector3f(-1.f, 0.f, 0.f)));
+}
+
+TEST(RangefinderPrefilter, KeepsFirstPointPerVoxel) {
+  RangefinderPrefilterOptions options;
+  options.voxel_size = 1.f;
+  const std::vector<TimedRangefinderPoint> ranges = {
+      {Eigen::Vector3f(0.1f, 0.1f, 0.1f), 0.f},
+      {Eigen::Vector3f(0.2f, 0.9f, 0.5f), 0.1f},
+      {Eigen::Vector3f(-0.1f, 0.1f, 0.1f), 0.2f},
+      {Eigen::Vector3f(-0.9f, 0.5f, 0.5f), 0.3f}};
+  const auto result = Prefilter(ranges, options);
+  ASSERT_EQ(2u, result.size());
+  EXPECT_FLOAT_EQ(-1.f, result[0].time);
+  EXPECT_FLOAT_EQ(-0.8f, result[1].time);
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -18,6 +18,7 @@
 
 #include <chrono>
 #include <cstring>
+#include <functional>
 #include <string>
 #include <thread>
 
@@ -28,24 +29,29 @@ namespace cartographer_ros {
 
 namespace {
 
+// Power of two, so that positions map to entries with a mask.
+constexpr uint64_t kBufferSize = ScopedRosLogSink::kMaxBufferedMessages;
+static_assert((kBufferSize & (kBufferSize - 1)) == 0,
+              "The buffer size must be a power of two.");
+// Entries keep the memory of messages up to this length for reuse.
+constexpr size_t kMaxRetainedMessageCapacity = 1024;
+constexpr int kNumCallSites = 256;
+constexpr std::chrono::milliseconds kDrainPeriod(10);
+constexpr std::chrono::seconds kDroppedMessagesReportPeriod(5);
+
 const char* GetBasename(const char* filepath) {
   const char* base = std::strrchr(filepath, '/');
   return base ? (base + 1) : filepath;
 }
 
-}  // namespace
-
-ScopedRosLogSink::ScopedRosLogSink() : will_die_(false) { AddLogSink(this); }
-ScopedRosLogSink::~ScopedRosLogSink() { RemoveLogSink(this); }
+int64_t SteadyNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
 
-void ScopedRosLogSink::send(const ::google::LogSeverity severity,
-                            const char* const filename,
-                            const char* const base_filename, const int line,
-                            const struct std::tm* const tm_time,
-                            const char* const message,
-                            const size_t message_len) {
-  const std::string message_string = ::google::LogSink::ToString(
-      severity, GetBasename(filename), line, tm_time, message, message_len);
+void LogToRos(const ::google::LogSeverity severity,
+              const std::string& message_string) {
   switch (severity) {
     case ::google::GLOG_INFO:
       ROS_INFO_STREAM(message_string);
@@ -61,11 +67,71 @@ void ScopedRosLogSink::send(const ::google::LogSeverity severity,
 
     case ::google::GLOG_FATAL:
       ROS_FATAL_STREAM(message_string);
-      will_die_ = true;
       break;
   }
 }
 
+}  // namespace
+
+constexpr int ScopedRosLogSink::kMaxMessagesPerCallSitePerSecond;
+constexpr uint64_t ScopedRosLogSink::kMaxBufferedMessages;
+constexpr uint64_t ScopedRosLogSink::kMaxBufferedBytes;
+
+struct ScopedRosLogSink::Entry {
+  std::atomic<uint64_t> sequence{0};
+  ::google::LogSeverity severity;
+  // Points to the string literal '__FILE__' of the call site.
+  const char* filename;
+  int line;
+  struct std::tm tm_time;
+  std::string message;
+};
+
+struct ScopedRosLogSink::CallSite {
+  std::atomic<int64_t> window_start_ns{0};
+  std::atomic<int> num_messages{0};
+};
+
+ScopedRosLogSink::ScopedRosLogSink()
+    : entries_(new Entry[kBufferSize]),
+      call_sites_(new CallSite[kNumCallSites]) {
+  for (uint64_t i = 0; i < kBufferSize; ++i) {
+    entries_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  thread_ = std::thread(&ScopedRosLogSink::Run, this);
+  AddLogSink(this);
+}
+
+ScopedRosLogSink::~ScopedRosLogSink() {
+  RemoveLogSink(this);
+  shutting_down_ = true;
+  thread_.join();
+  Drain();
+  ReportDroppedMessages();
+}
+
+void ScopedRosLogSink::send(const ::google::LogSeverity severity,
+                            const char* const filename,
+                            const char* const base_filename, const int line,
+                            const struct std::tm* const tm_time,
+                            const char* const message,
+                            const size_t message_len) {
+  if (severity == ::google::GLOG_FATAL) {
+    // The buffered messages come first, they likely tell what went wrong.
+    Drain();
+    LogToRos(severity,
+             ::google::LogSink::ToString(severity, GetBasename(filename), line,
+                                         tm_time, message, message_len));
+    will_die_ = true;
+    return;
+  }
+  if (!CheckRateLimit(filename, line) ||
+      !Push(severity, filename, line, tm_time, message, message_len)) {
+    ++num_dropped_messages_;
+    ++num_unreported_dropped_messages_;
+  }
+}
+
 void ScopedRosLogSink::WaitTillSent() {
   if (will_die_) {
     // Give ROS some time to actually publish our message.
@@ -73,4 +139,106 @@ void ScopedRosLogSink::WaitTillSent() {
   }
 }
 
+bool ScopedRosLogSink::CheckRateLimit(const char* const filename,
+                                      const int line) {
+  CallSite& call_site =
+      call_sites_[(std::hash<const void*>()(filename) ^
+                   std::hash<int>()(line)) %
+                  kNumCallSites];
+  const int64_t now_ns = SteadyNowNs();
+  int64_t window_start_ns = call_site.window_start_ns.load();
+  if (now_ns - window_start_ns >= 1000000000 &&
+      call_site.window_start_ns.compare_exchange_strong(window_start_ns,
+                                                        now_ns)) {
+    // Messages counted concurrently with resetting the window may be lost,
+    // which only lets a few more messages through.
+    call_site.num_messages = 0;
+  }
+  return call_site.num_messages.fetch_add(1) <
+         kMaxMessagesPerCallSitePerSecond;
+}
+
+bool ScopedRosLogSink::Push(const ::google::LogSeverity severity,
+                            const char* const filename, const int line,
+                            const struct std::tm* const tm_time,
+                            const char* const message,
+                            const size_t message_len) {
+  if (num_buffered_bytes_.fetch_add(message_len) + message_len >
+      kMaxBufferedBytes) {
+    num_buffered_bytes_ -= message_len;
+    return false;
+  }
+  uint64_t position = push_position_.load(std::memory_order_relaxed);
+  Entry* entry;
+  while (true) {
+    entry = &entries_[position & (kBufferSize - 1)];
+    const uint64_t sequence = entry->sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      if (push_position_.compare_exchange_weak(position, position + 1,
+                                               std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < position) {
+      // The entry has not been drained since the previous round.
+      num_buffered_bytes_ -= message_len;
+      return false;
+    } else {
+      position = push_position_.load(std::memory_order_relaxed);
+    }
+  }
+  entry->severity = severity;
+  entry->filename = filename;
+  entry->line = line;
+  entry->tm_time = *tm_time;
+  entry->message.assign(message, message_len);
+  entry->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+void ScopedRosLogSink::Drain() {
+  absl::MutexLock lock(&drain_mutex_);
+  while (true) {
+    Entry& entry = entries_[pop_position_ & (kBufferSize - 1)];
+    if (entry.sequence.load(std::memory_order_acquire) != pop_position_ + 1) {
+      break;
+    }
+    LogToRos(entry.severity,
+             ::google::LogSink::ToString(
+                 entry.severity, GetBasename(entry.filename), entry.line,
+                 &entry.tm_time, entry.message.data(), entry.message.size()));
+    num_buffered_bytes_ -= entry.message.size();
+    if (entry.message.capacity() > kMaxRetainedMessageCapacity) {
+      std::string().swap(entry.message);
+    } else {
+      entry.message.clear();
+    }
+    entry.sequence.store(pop_position_ + kBufferSize,
+                         std::memory_order_release);
+    ++pop_position_;
+  }
+}
+
+void ScopedRosLogSink::ReportDroppedMessages() {
+  const uint64_t num_dropped_messages =
+      num_unreported_dropped_messages_.exchange(0);
+  if (num_dropped_messages > 0) {
+    ROS_WARN_STREAM("Dropped " << num_dropped_messages
+                               << " log messages which were logged too often "
+                                  "or while the log buffer was full.");
+  }
+}
+
+void ScopedRosLogSink::Run() {
+  auto next_report_time =
+      std::chrono::steady_clock::now() + kDroppedMessagesReportPeriod;
+  while (!shutting_down_) {
+    Drain();
+    if (std::chrono::steady_clock::now() >= next_report_time) {
+      ReportDroppedMessages();
+      next_report_time += kDroppedMessagesReportPeriod;
+    }
+    std::this_thread::sleep_for(kDrainPeriod);
+  }
+}
+
 }  // namespace cartographer_ros
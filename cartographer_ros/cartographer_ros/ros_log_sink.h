@@ -17,27 +17,84 @@
 #ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ROS_LOG_SINK_H
 #define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ROS_LOG_SINK_H
 
+#include <atomic>
+#include <cstdint>
 #include <ctime>
+#include <memory>
+#include <thread>
 
+#include "absl/synchronization/mutex.h"
 #include "glog/logging.h"
 
 namespace cartographer_ros {
 
 // Makes Google logging use ROS logging for output while an instance of this
 // class exists.
+//
+// Messages are copied into a lock-free ring buffer and handed to ROS logging
+// on a background thread, so that threads handling sensor data never wait for
+// it. Messages are dropped if the buffer is full, i.e. holds
+// 'kMaxBufferedMessages' or 'kMaxBufferedBytes' of messages, or if more than
+// 'kMaxMessagesPerCallSitePerSecond' are logged from the same line of code in
+// a second, e.g. when warnings are logged for every message during a tf
+// hiccup. The number of dropped messages is logged regularly. Fatal messages
+// are never dropped, they are logged synchronously after the buffered ones.
 class ScopedRosLogSink : public ::google::LogSink {
  public:
+  static constexpr int kMaxMessagesPerCallSitePerSecond = 10;
+  static constexpr uint64_t kMaxBufferedMessages = 1024;
+  static constexpr uint64_t kMaxBufferedBytes = 1 << 20;
+
   ScopedRosLogSink();
+  // Logs the buffered messages before returning.
   ~ScopedRosLogSink() override;
 
+  ScopedRosLogSink(const ScopedRosLogSink&) = delete;
+  ScopedRosLogSink& operator=(const ScopedRosLogSink&) = delete;
+
   void send(::google::LogSeverity severity, const char* filename,
             const char* base_filename, int line, const struct std::tm* tm_time,
             const char* message, size_t message_len) override;
 
   void WaitTillSent() override;
 
+  // Number of messages dropped so far.
+  uint64_t num_dropped_messages() const { return num_dropped_messages_; }
+
  private:
-  bool will_die_;
+  struct Entry;
+  struct CallSite;
+
+  // Returns false if the message from 'filename' and 'line' exceeds the rate
+  // limit of its call site.
+  bool CheckRateLimit(const char* filename, int line);
+  // Returns false if the buffer is full.
+  bool Push(::google::LogSeverity severity, const char* filename, int line,
+            const struct std::tm* tm_time, const char* message,
+            size_t message_len);
+  // Logs the buffered messages.
+  void Drain() LOCKS_EXCLUDED(drain_mutex_);
+  void ReportDroppedMessages();
+  void Run();
+
+  std::atomic<bool> will_die_{false};
+  std::atomic<bool> shutting_down_{false};
+  std::atomic<uint64_t> num_dropped_messages_{0};
+  // Dropped messages which have not been reported yet.
+  std::atomic<uint64_t> num_unreported_dropped_messages_{0};
+  // Bounded multi-producer queue of 'kMaxBufferedMessages' entries: the
+  // sequence number of each entry tells whether it is free to be written for,
+  // or has been written at, a position.
+  std::unique_ptr<Entry[]> entries_;
+  std::atomic<uint64_t> push_position_{0};
+  // Reserved by producers before they claim an entry.
+  std::atomic<uint64_t> num_buffered_bytes_{0};
+  // Only held while draining, producers never wait for it.
+  absl::Mutex drain_mutex_;
+  uint64_t pop_position_ GUARDED_BY(drain_mutex_) = 0;
+  // Hashed by call site, call sites which collide share their limit.
+  std::unique_ptr<CallSite[]> call_sites_;
+  std::thread thread_;
 };
 
 }  // namespace cartographer_ros
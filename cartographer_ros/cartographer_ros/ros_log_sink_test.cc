@@ -0,0 +1,63 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/ros_log_sink.h"
+
+#include <ctime>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+TEST(ScopedRosLogSinkTest, RateLimitsCallSites) {
+  ScopedRosLogSink sink;
+  const std::time_t now = std::time(nullptr);
+  const std::string message = "Ignored subdivision.";
+  constexpr int kNumMessages =
+      3 * ScopedRosLogSink::kMaxMessagesPerCallSitePerSecond;
+  for (int i = 0; i < kNumMessages; ++i) {
+    sink.send(::google::GLOG_WARNING, __FILE__, "ros_log_sink_test.cc",
+              __LINE__, std::localtime(&now), message.data(), message.size());
+  }
+  EXPECT_EQ(kNumMessages - ScopedRosLogSink::kMaxMessagesPerCallSitePerSecond,
+            sink.num_dropped_messages());
+  // Another call site has its own limit.
+  sink.send(::google::GLOG_WARNING, __FILE__, "ros_log_sink_test.cc", __LINE__,
+            std::localtime(&now), message.data(), message.size());
+  EXPECT_EQ(kNumMessages - ScopedRosLogSink::kMaxMessagesPerCallSitePerSecond,
+            sink.num_dropped_messages());
+}
+
+TEST(ScopedRosLogSinkTest, BuffersLongMessagesWithinBudget) {
+  ScopedRosLogSink sink;
+  const std::time_t now = std::time(nullptr);
+  // E.g. the multi-line histograms of the pose graph.
+  const std::string long_message(10000, 'x');
+  sink.send(::google::GLOG_INFO, __FILE__, "ros_log_sink_test.cc", __LINE__,
+            std::localtime(&now), long_message.data(), long_message.size());
+  EXPECT_EQ(0, sink.num_dropped_messages());
+  const std::string too_long_message(ScopedRosLogSink::kMaxBufferedBytes + 1,
+                                     'x');
+  sink.send(::google::GLOG_INFO, __FILE__, "ros_log_sink_test.cc", __LINE__,
+            std::localtime(&now), too_long_message.data(),
+            too_long_message.size());
+  EXPECT_EQ(1, sink.num_dropped_messages());
+}
+
+}  // namespace
+}  // namespace cartographer_ros
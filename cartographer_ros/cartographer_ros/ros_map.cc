@@ -16,16 +16,16 @@
 
 #include "cartographer_ros/ros_map.h"
 
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "cartographer/common/math.h"
+#include "glog/logging.h"
 
 namespace cartographer_ros {
 
 void WritePgm(const ::cartographer::io::Image& image, const double resolution,
               ::cartographer::io::FileWriter* file_writer) {
-  const std::string header =
-      absl::StrCat("P5\n# Cartographer map; ", resolution, " m/pixel\n",
-                   image.width(), " ", image.height(), "\n255\n");
-  file_writer->Write(header.data(), header.size());
+  WritePgmHeader(image.width(), image.height(), resolution, file_writer);
   for (int y = 0; y < image.height(); ++y) {
     for (int x = 0; x < image.width(); ++x) {
       const char color = image.GetPixel(x, y)[0];
@@ -34,6 +34,14 @@ void WritePgm(const ::cartographer::io::Image& image, const double resolution,
   }
 }
 
+void WritePgmHeader(const int width, const int height, const double resolution,
+                    ::cartographer::io::FileWriter* file_writer) {
+  const std::string header =
+      absl::StrCat("P5\n# Cartographer map; ", resolution, " m/pixel\n",
+                   width, " ", height, "\n255\n");
+  file_writer->Write(header.data(), header.size());
+}
+
 void WriteYaml(const double resolution, const Eigen::Vector2d& origin,
                const std::string& pgm_filename,
                ::cartographer::io::FileWriter* file_writer) {
@@ -46,4 +54,74 @@ void WriteYaml(const double resolution, const Eigen::Vector2d& origin,
   file_writer->Write(output.data(), output.size());
 }
 
+PgmPyramidWriter::PgmPyramidWriter(
+    const ::cartographer::io::FileWriterFactory& file_writer_factory,
+    const std::string& filestem, const int level, const int num_levels,
+    const int width, const int height, const double resolution,
+    const Eigen::Vector2d& origin)
+    : file_writer_factory_(file_writer_factory),
+      filestem_(level == 0 ? filestem : absl::StrCat(filestem, "_", level)),
+      width_(width),
+      height_(height),
+      resolution_(resolution),
+      origin_(origin),
+      pgm_writer_(file_writer_factory_(filestem_ + ".pgm")) {
+  WritePgmHeader(width_, height_, resolution_, pgm_writer_.get());
+  if (level < num_levels) {
+    const int coarser_height = (height_ + 1) / 2;
+    // The upper left corner stays where it is.
+    coarser_level_ = absl::make_unique<PgmPyramidWriter>(
+        file_writer_factory_, filestem, level + 1, num_levels,
+        (width_ + 1) / 2, coarser_height, 2. * resolution_,
+        Eigen::Vector2d(origin_.x(), origin_.y() + height_ * resolution_ -
+                                         coarser_height * 2. * resolution_));
+    sums_.resize((width_ + 1) / 2, 0);
+    num_known_pixels_.resize((width_ + 1) / 2, 0);
+  }
+}
+
+void PgmPyramidWriter::WriteRow(const std::string& row) {
+  CHECK_EQ(static_cast<int>(row.size()), width_);
+  CHECK_LT(num_rows_, height_);
+  pgm_writer_->Write(row.data(), row.size());
+  ++num_rows_;
+  if (coarser_level_ == nullptr) {
+    return;
+  }
+  for (int x = 0; x < width_; ++x) {
+    if (row[x] != kUnknownPgmValue) {
+      sums_[x / 2] += static_cast<unsigned char>(row[x]);
+      ++num_known_pixels_[x / 2];
+    }
+  }
+  if (num_rows_ % 2 == 0 || num_rows_ == height_) {
+    std::string coarser_row(sums_.size(), kUnknownPgmValue);
+    for (size_t x = 0; x < sums_.size(); ++x) {
+      if (num_known_pixels_[x] > 0) {
+        const int average = ::cartographer::common::RoundToInt(
+            static_cast<double>(sums_[x]) / num_known_pixels_[x]);
+        // Known pixels stay known in all levels.
+        coarser_row[x] = average == static_cast<unsigned char>(kUnknownPgmValue)
+                             ? static_cast<char>(average - 1)
+                             : static_cast<char>(average);
+      }
+      sums_[x] = 0;
+      num_known_pixels_[x] = 0;
+    }
+    coarser_level_->WriteRow(coarser_row);
+  }
+}
+
+void PgmPyramidWriter::Close() {
+  CHECK_EQ(num_rows_, height_);
+  const std::string pgm_filename = pgm_writer_->GetFilename();
+  CHECK(pgm_writer_->Close());
+  auto yaml_writer = file_writer_factory_(filestem_ + ".yaml");
+  WriteYaml(resolution_, origin_, pgm_filename, yaml_writer.get());
+  CHECK(yaml_writer->Close());
+  if (coarser_level_ != nullptr) {
+    coarser_level_->Close();
+  }
+}
+
 }  // namespace cartographer_ros
@@ -17,7 +17,9 @@
 #ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ROS_MAP_H
 #define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ROS_MAP_H
 
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "Eigen/Core"
 #include "cartographer/io/file_writer.h"
@@ -26,16 +28,62 @@
 
 namespace cartographer_ros {
 
+// Value of unknown pixels, as in '::cartographer::io::DrawProbabilityGrid()'.
+constexpr char kUnknownPgmValue = static_cast<char>(128);
+
 // Write 'image' as a pgm into 'file_writer'. The resolution is used in the
 // comment only'
 void WritePgm(const ::cartographer::io::Image& image, const double resolution,
               ::cartographer::io::FileWriter* file_writer);
 
+// Write the header of a pgm of 'width' x 'height' pixels into 'file_writer',
+// to be followed by the pixels row by row, one byte each.
+void WritePgmHeader(int width, int height, double resolution,
+                    ::cartographer::io::FileWriter* file_writer);
+
 // Write the corresponding yaml into 'file_writer'.
 void WriteYaml(const double resolution, const Eigen::Vector2d& origin,
                const std::string& pgm_filename,
                ::cartographer::io::FileWriter* file_writer);
 
+// Writes a PGM and its YAML row by row. Unless this is the last level of the
+// pyramid, each pair of rows is also downsampled over 2x2 pixels into a row of
+// the next level. Only the known pixels of each 2x2 block are averaged, the
+// coarser pixel is unknown if all of them are.
+class PgmPyramidWriter {
+ public:
+  // 'origin' is the lower left corner of the 'width' x 'height' image. Levels
+  // after the first are written to '<filestem>_<level>'.
+  PgmPyramidWriter(
+      const ::cartographer::io::FileWriterFactory& file_writer_factory,
+      const std::string& filestem, int level, int num_levels, int width,
+      int height, double resolution, const Eigen::Vector2d& origin);
+
+  PgmPyramidWriter(const PgmPyramidWriter&) = delete;
+  PgmPyramidWriter& operator=(const PgmPyramidWriter&) = delete;
+
+  // Rows are written from the top, 'row' has one byte per pixel.
+  void WriteRow(const std::string& row);
+
+  // Must be called once all rows are written.
+  void Close();
+
+ private:
+  const ::cartographer::io::FileWriterFactory file_writer_factory_;
+  const std::string filestem_;
+  const int width_;
+  const int height_;
+  const double resolution_;
+  const Eigen::Vector2d origin_;
+  std::unique_ptr<::cartographer::io::FileWriter> pgm_writer_;
+  int num_rows_ = 0;
+  std::unique_ptr<PgmPyramidWriter> coarser_level_;
+  // Sums and numbers of the known pixels of the current pair of rows for
+  // 'coarser_level_'.
+  std::vector<int> sums_;
+  std::vector<int> num_known_pixels_;
+};
+
 }  // namespace cartographer_ros
 
 #endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ROS_MAP_H
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/ros_map.h"
+
+#include <map>
+#include <string>
+
+#include "absl/memory/memory.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+// Keeps what is written in 'files', keyed by filename.
+class InMemoryFileWriter : public ::cartographer::io::FileWriter {
+ public:
+  InMemoryFileWriter(const std::string& filename,
+                     std::map<std::string, std::string>* const files)
+      : filename_(filename), files_(files) {}
+
+  bool WriteHeader(const char* const data, const size_t len) override {
+    (*files_)[filename_].insert(0, data, len);
+    return true;
+  }
+  bool Write(const char* const data, const size_t len) override {
+    (*files_)[filename_].append(data, len);
+    return true;
+  }
+  bool Close() override { return true; }
+  std::string GetFilename() override { return filename_; }
+
+ private:
+  const std::string filename_;
+  std::map<std::string, std::string>* const files_;
+};
+
+// Returns the last 'num_pixels' bytes of a PGM, i.e. its pixels.
+std::string GetPixels(const std::string& pgm, const int num_pixels) {
+  return pgm.substr(pgm.size() - num_pixels);
+}
+
+TEST(PgmPyramidWriterTest, AveragesOnlyKnownPixels) {
+  std::map<std::string, std::string> files;
+  PgmPyramidWriter writer(
+      [&files](const std::string& filename) {
+        return absl::make_unique<InMemoryFileWriter>(filename, &files);
+      },
+      "map", 0 /* level */, 1 /* num_levels */, 6 /* width */, 2 /* height */,
+      0.05 /* resolution */, Eigen::Vector2d::Zero());
+  const char u = kUnknownPgmValue;
+  // The 2x2 blocks are mixed, unknown, and known pixels averaging to the
+  // unknown value.
+  writer.WriteRow(std::string{'\0', u, u, u, static_cast<char>(100), u});
+  writer.WriteRow(std::string{u, u, u, u, static_cast<char>(156), u});
+  writer.Close();
+
+  ASSERT_EQ(4, files.size());
+  EXPECT_EQ((std::string{'\0', u, static_cast<char>(127)}),
+            GetPixels(files.at("map_1.pgm"), 3));
+  EXPECT_EQ(1, files.count("map_1.yaml"));
+}
+
+}  // namespace
+}  // namespace cartographer_ros
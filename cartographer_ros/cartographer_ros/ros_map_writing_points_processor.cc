@@ -16,26 +16,65 @@
 
 #include "cartographer_ros/ros_map_writing_points_processor.h"
 
+#include <algorithm>
+#include <limits>
+#include <vector>
+
 #include "absl/memory/memory.h"
+#include "cartographer/common/math.h"
 #include "cartographer/io/image.h"
 #include "cartographer/io/probability_grid_points_processor.h"
+#include "cartographer/mapping/probability_values.h"
 #include "cartographer_ros/ros_map.h"
 
 namespace cartographer_ros {
 
+namespace {
+
+char ToPgmValue(const uint16_t correspondence_cost_value) {
+  if (correspondence_cost_value ==
+      ::cartographer::mapping::kUnknownCorrespondenceValue) {
+    return kUnknownPgmValue;
+  }
+  const float probability =
+      ::cartographer::mapping::CorrespondenceCostToProbability(
+          ::cartographer::mapping::ValueToCorrespondenceCost(
+              correspondence_cost_value));
+  return static_cast<char>(
+      ::cartographer::common::RoundToInt((1. - probability) * 255));
+}
+
+}  // namespace
+
 RosMapWritingPointsProcessor::RosMapWritingPointsProcessor(
     const double resolution,
     const ::cartographer::mapping::proto::
         ProbabilityGridRangeDataInserterOptions2D& range_data_inserter_options,
     ::cartographer::io::FileWriterFactory file_writer_factory,
-    const std::string& filestem,
+    const std::string& filestem, const int max_tiles_in_memory,
+    const int num_pyramid_levels, const int num_insertion_threads,
     ::cartographer::io::PointsProcessor* const next)
     : filestem_(filestem),
+      num_pyramid_levels_(num_pyramid_levels),
       next_(next),
       file_writer_factory_(file_writer_factory),
       range_data_inserter_(range_data_inserter_options),
       probability_grid_(::cartographer::io::CreateProbabilityGrid(
-          resolution, &conversion_tables_)) {}
+          resolution, &conversion_tables_)) {
+  CHECK_GE(num_pyramid_levels_, 0);
+  CHECK_GE(num_insertion_threads, 0);
+  if (max_tiles_in_memory > 0 || num_insertion_threads > 0) {
+    tiled_probability_grid_ = absl::make_unique<TiledProbabilityGrid>(
+        resolution, range_data_inserter_options,
+        max_tiles_in_memory > 0 ? max_tiles_in_memory
+                                : std::numeric_limits<int>::max());
+  }
+  if (num_insertion_threads > 0) {
+    parallel_range_data_inserter_ =
+        absl::make_unique<ParallelRangeDataInserter>(
+            num_insertion_threads, tiled_probability_grid_.get());
+  }
+}
 
 std::unique_ptr<RosMapWritingPointsProcessor>
 RosMapWritingPointsProcessor::FromDictionary(
@@ -46,38 +85,42 @@ RosMapWritingPointsProcessor::FromDictionary(
       dictionary->GetDouble("resolution"),
       ::cartographer::mapping::CreateProbabilityGridRangeDataInserterOptions2D(
           dictionary->GetDictionary("range_data_inserter").get()),
-      file_writer_factory, dictionary->GetString("filestem"), next);
+      file_writer_factory, dictionary->GetString("filestem"),
+      dictionary->HasKey("max_tiles_in_memory")
+          ? dictionary->GetInt("max_tiles_in_memory")
+          : 0,
+      dictionary->HasKey("num_pyramid_levels")
+          ? dictionary->GetInt("num_pyramid_levels")
+          : 0,
+      dictionary->HasKey("num_insertion_threads")
+          ? dictionary->GetInt("num_insertion_threads")
+          : 0,
+      next);
 }
 
 void RosMapWritingPointsProcessor::Process(
     std::unique_ptr<::cartographer::io::PointsBatch> batch) {
-  range_data_inserter_.Insert(
-      {batch->origin, ::cartographer::sensor::PointCloud(batch->points), {}},
-      &probability_grid_);
+  const ::cartographer::sensor::RangeData range_data{
+      batch->origin, ::cartographer::sensor::PointCloud(batch->points), {}};
+  if (parallel_range_data_inserter_ != nullptr) {
+    parallel_range_data_inserter_->Insert(range_data);
+  } else if (tiled_probability_grid_ != nullptr) {
+    tiled_probability_grid_->Insert(range_data);
+  } else {
+    range_data_inserter_.Insert(range_data, &probability_grid_);
+  }
   next_->Process(std::move(batch));
 }
 
 ::cartographer::io::PointsProcessor::FlushResult
 RosMapWritingPointsProcessor::Flush() {
-  Eigen::Array2i offset;
-  std::unique_ptr<::cartographer::io::Image> image =
-      ::cartographer::io::DrawProbabilityGrid(probability_grid_, &offset);
-  if (image != nullptr) {
-    auto pgm_writer = file_writer_factory_(filestem_ + ".pgm");
-    const std::string pgm_filename = pgm_writer->GetFilename();
-    const auto& limits = probability_grid_.limits();
-    image->Rotate90DegreesClockwise();
-
-    WritePgm(*image, limits.resolution(), pgm_writer.get());
-    CHECK(pgm_writer->Close());
-
-    const Eigen::Vector2d origin(
-        limits.max().x() - (offset.y() + image->width()) * limits.resolution(),
-        limits.max().y() -
-            (offset.x() + image->height()) * limits.resolution());
-    auto yaml_writer = file_writer_factory_(filestem_ + ".yaml");
-    WriteYaml(limits.resolution(), origin, pgm_filename, yaml_writer.get());
-    CHECK(yaml_writer->Close());
+  if (parallel_range_data_inserter_ != nullptr) {
+    parallel_range_data_inserter_->Flush();
+  }
+  if (tiled_probability_grid_ != nullptr) {
+    WriteTiledProbabilityGrid();
+  } else {
+    WriteProbabilityGrid();
   }
 
   switch (next_->Flush()) {
@@ -94,4 +137,68 @@ RosMapWritingPointsProcessor::Flush() {
   return FlushResult::kFinished;
 }
 
+void RosMapWritingPointsProcessor::WriteProbabilityGrid() {
+  Eigen::Array2i offset;
+  std::unique_ptr<::cartographer::io::Image> image =
+      ::cartographer::io::DrawProbabilityGrid(probability_grid_, &offset);
+  if (image == nullptr) {
+    return;
+  }
+  const auto& limits = probability_grid_.limits();
+  image->Rotate90DegreesClockwise();
+
+  const Eigen::Vector2d origin(
+      limits.max().x() - (offset.y() + image->width()) * limits.resolution(),
+      limits.max().y() - (offset.x() + image->height()) * limits.resolution());
+  PgmPyramidWriter writer(file_writer_factory_, filestem_, 0 /* level */,
+                          num_pyramid_levels_, image->width(), image->height(),
+                          limits.resolution(), origin);
+  std::string row(image->width(), '\0');
+  for (int y = 0; y < image->height(); ++y) {
+    for (int x = 0; x < image->width(); ++x) {
+      row[x] = image->GetPixel(x, y)[0];
+    }
+    writer.WriteRow(row);
+  }
+  writer.Close();
+}
+
+void RosMapWritingPointsProcessor::WriteTiledProbabilityGrid() {
+  const Eigen::AlignedBox2i& cells =
+      tiled_probability_grid_->known_cells_box();
+  if (cells.isEmpty()) {
+    return;
+  }
+  const double resolution = tiled_probability_grid_->resolution();
+  // Rows of the map go along the x index, columns towards decreasing y
+  // indices, like after rotating the image of a 'ProbabilityGrid'.
+  const int width = cells.max().y() - cells.min().y() + 1;
+  const int height = cells.max().x() - cells.min().x() + 1;
+  const Eigen::Vector2d origin(-(cells.max().y() + 1) * resolution,
+                               -(cells.max().x() + 1) * resolution);
+  PgmPyramidWriter writer(file_writer_factory_, filestem_, 0 /* level */,
+                          num_pyramid_levels_, width, height, resolution,
+                          origin);
+  std::string row(width, '\0');
+  for (int min_x = cells.min().x(); min_x <= cells.max().x();
+       min_x += TiledProbabilityGrid::kTileSizeCells) {
+    const Eigen::AlignedBox2i band(
+        Eigen::Vector2i(min_x, cells.min().y()),
+        Eigen::Vector2i(
+            std::min(min_x + TiledProbabilityGrid::kTileSizeCells - 1,
+                     cells.max().x()),
+            cells.max().y()));
+    const std::vector<uint16_t> values =
+        tiled_probability_grid_->GetCorrespondenceCostValues(band);
+    for (int x = 0; x <= band.max().x() - min_x; ++x) {
+      const uint16_t* const band_row = values.data() + x * width;
+      for (int column = 0; column < width; ++column) {
+        row[column] = ToPgmValue(band_row[width - 1 - column]);
+      }
+      writer.WriteRow(row);
+    }
+  }
+  writer.Close();
+}
+
 }  // namespace cartographer_ros
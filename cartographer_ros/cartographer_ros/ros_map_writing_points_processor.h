@@ -17,6 +17,9 @@
 #ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ROS_MAP_WRITING_POINTS_PROCESSOR_H
 #define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_ROS_MAP_WRITING_POINTS_PROCESSOR_H
 
+#include <memory>
+#include <string>
+
 #include "cartographer/common/lua_parameter_dictionary.h"
 #include "cartographer/io/file_writer.h"
 #include "cartographer/io/points_processor.h"
@@ -24,11 +27,23 @@
 #include "cartographer/mapping/2d/probability_grid_range_data_inserter_2d.h"
 #include "cartographer/mapping/proto/probability_grid_range_data_inserter_options_2d.pb.h"
 #include "cartographer/mapping/value_conversion_tables.h"
+#include "cartographer_ros/parallel_range_data_inserter.h"
+#include "cartographer_ros/tiled_probability_grid.h"
 
 namespace cartographer_ros {
 
 // Very similar to Cartographer's ProbabilityGridPointsProcessor, but writes
 // out a PGM and YAML suitable for ROS map server to consume.
+//
+// If 'max_tiles_in_memory' is positive, the grid is a 'TiledProbabilityGrid'
+// keeping at most that many tiles in memory, and the PGM is written band by
+// band. With 'num_pyramid_levels' > 0, maps at 2, 4, ... times the resolution
+// are also written, named after 'filestem' with '_1', '_2', ... appended.
+//
+// If 'num_insertion_threads' is positive, batches are ray cast on that many
+// threads into a 'TiledProbabilityGrid', which keeps all its tiles in memory
+// unless 'max_tiles_in_memory' is set. The map is the same as when inserting
+// serially.
 class RosMapWritingPointsProcessor
     : public ::cartographer::io::PointsProcessor {
  public:
@@ -39,7 +54,9 @@ class RosMapWritingPointsProcessor
           ProbabilityGridRangeDataInserterOptions2D&
               range_data_inserter_options,
       ::cartographer::io::FileWriterFactory file_writer_factory,
-      const std::string& filestem, PointsProcessor* next);
+      const std::string& filestem, int max_tiles_in_memory,
+      int num_pyramid_levels, int num_insertion_threads,
+      PointsProcessor* next);
   RosMapWritingPointsProcessor(const RosMapWritingPointsProcessor&) = delete;
   RosMapWritingPointsProcessor& operator=(const RosMapWritingPointsProcessor&) =
       delete;
@@ -55,13 +72,21 @@ class RosMapWritingPointsProcessor
   FlushResult Flush() override;
 
  private:
+  void WriteProbabilityGrid();
+  void WriteTiledProbabilityGrid();
+
   const std::string filestem_;
+  const int num_pyramid_levels_;
   PointsProcessor* const next_;
   ::cartographer::io::FileWriterFactory file_writer_factory_;
   ::cartographer::mapping::ProbabilityGridRangeDataInserter2D
       range_data_inserter_;
   ::cartographer::mapping::ValueConversionTables conversion_tables_;
   ::cartographer::mapping::ProbabilityGrid probability_grid_;
+  // If not null, used instead of 'probability_grid_'.
+  std::unique_ptr<TiledProbabilityGrid> tiled_probability_grid_;
+  // If not null, inserts into 'tiled_probability_grid_'.
+  std::unique_ptr<ParallelRangeDataInserter> parallel_range_data_inserter_;
 };
 
 }  // namespace cartographer_ros
@@ -14,15 +14,22 @@
  * limitations under the License.
  */
 
+#include <cstdint>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <set>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "absl/memory/memory.h"
-#include "cartographer/common/histogram.h"
+#include "absl/synchronization/mutex.h"
 #include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/quantile_sketch.h"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "nav_msgs/Odometry.h"
@@ -41,17 +48,137 @@
 
 DEFINE_string(bag_filename, "", "Bag to process.");
 DEFINE_bool(dump_timing, false,
-            "Dump per-sensor timing information in files called "
-            "timing_<frame_id>.csv in the current directory.");
+            "Dump per-sensor timing information in binary files called "
+            "timing_<frame_id>.bin in the current directory.");
+DEFINE_int32(num_point_data_threads, 4,
+             "Number of threads checking point data. All messages of a "
+             "frame_id are checked by the same thread.");
 
 namespace cartographer_ros {
 namespace {
 
+constexpr char kTimingFileMagic[] = "CARTOTIM";
+constexpr size_t kTimingFileBufferSize = 1 << 20;
+// Checks queued per worker before the reader blocks. This bounds the memory
+// used for messages.
+constexpr size_t kMaxQueuedChecks = 256;
+
+// Writes the timing information of a sensor into a file which starts with
+// the 8 bytes "CARTOTIM" followed by a row of three little-endian uint64 per
+// packet:
+// - packet index of the packet in the bag, first packet is 1
+// - timestamp when rosbag wrote the packet, i.e.
+//   rosbag::MessageInstance::getTime().toNSec()
+// - timestamp when data was acquired, i.e. message.header.stamp.toNSec()
+//
+// The data can be read in python using
+// import numpy
+// numpy.fromfile(<filename>, dtype='<u8', offset=8).reshape(-1, 3)
+class TimingFileWriter {
+ public:
+  explicit TimingFileWriter(const std::string& frame_id)
+      : frame_id_(frame_id),
+        file_(std::string("timing_") + frame_id + ".bin",
+              std::ios_base::out | std::ios_base::binary) {
+    buffer_.reserve(kTimingFileBufferSize);
+    buffer_.append(kTimingFileMagic, sizeof(kTimingFileMagic) - 1);
+  }
+
+  void Write(const uint64_t packet_index, const uint64_t serialization_time,
+             const uint64_t sensor_time) {
+    for (const uint64_t value :
+         {packet_index, serialization_time, sensor_time}) {
+      for (int i = 0; i != 8; ++i) {
+        buffer_.push_back(static_cast<char>(value >> (8 * i)));
+      }
+    }
+    if (buffer_.size() >= kTimingFileBufferSize) {
+      Flush();
+    }
+  }
+
+  void Close() {
+    Flush();
+    file_.close();
+    CHECK(file_) << "Could not write timing information for \"" << frame_id_
+                 << "\"";
+  }
+
+ private:
+  void Flush() {
+    file_.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+  }
+
+  const std::string frame_id_;
+  std::ofstream file_;
+  std::string buffer_;
+};
+
+// Runs queued checks on its own thread in the order they were queued, so
+// checks sharing state need no further synchronization.
+class CheckWorker {
+ public:
+  CheckWorker() { thread_ = std::thread(&CheckWorker::Run, this); }
+  ~CheckWorker() { Finish(); }
+
+  CheckWorker(const CheckWorker&) = delete;
+  CheckWorker& operator=(const CheckWorker&) = delete;
+
+  // Blocks while too many checks are queued.
+  void Queue(std::function<void()> check) LOCKS_EXCLUDED(mutex_) {
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(this, &CheckWorker::CanQueue));
+    checks_.push_back(std::move(check));
+  }
+
+  // Blocks until all queued checks ran.
+  void Finish() LOCKS_EXCLUDED(mutex_) {
+    {
+      absl::MutexLock lock(&mutex_);
+      finishing_ = true;
+    }
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+ private:
+  void Run() LOCKS_EXCLUDED(mutex_) {
+    for (;;) {
+      std::function<void()> check;
+      {
+        absl::MutexLock lock(&mutex_);
+        mutex_.Await(absl::Condition(this, &CheckWorker::CanRun));
+        if (checks_.empty()) {
+          return;
+        }
+        check = std::move(checks_.front());
+        checks_.pop_front();
+      }
+      check();
+    }
+  }
+
+  bool CanQueue() const EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return checks_.size() < kMaxQueuedChecks;
+  }
+
+  bool CanRun() const EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return finishing_ || !checks_.empty();
+  }
+
+  absl::Mutex mutex_;
+  std::deque<std::function<void()>> checks_ GUARDED_BY(mutex_);
+  bool finishing_ GUARDED_BY(mutex_) = false;
+  std::thread thread_;
+};
+
 struct FrameProperties {
   ros::Time last_timestamp;
   std::string topic;
-  std::vector<float> time_deltas;
-  std::unique_ptr<std::ofstream> timing_file;
+  QuantileSketch time_deltas;
+  std::unique_ptr<TimingFileWriter> timing_file;
   std::string data_type;
 };
 
@@ -71,30 +198,6 @@ const std::set<std::string> kPointDataTypes = {
     std::string(
         ros::message_traits::DataType<sensor_msgs::LaserScan>::value())};
 
-std::unique_ptr<std::ofstream> CreateTimingFile(const std::string& frame_id) {
-  auto timing_file = absl::make_unique<std::ofstream>(
-      std::string("timing_") + frame_id + ".csv", std::ios_base::out);
-
-  (*timing_file)
-      << "# Timing information for sensor with frame id: " << frame_id
-      << std::endl
-      << "# Columns are in order" << std::endl
-      << "# - packet index of the packet in the bag, first packet is 1"
-      << std::endl
-      << "# - timestamp when rosbag wrote the packet, i.e. "
-         "rosbag::MessageInstance::getTime().toNSec()"
-      << std::endl
-      << "# - timestamp when data was acquired, i.e. "
-         "message.header.stamp.toNSec()"
-      << std::endl
-      << "#" << std::endl
-      << "# The data can be read in python using" << std::endl
-      << "# import numpy" << std::endl
-      << "# np.loadtxt(<filename>, dtype='uint64')" << std::endl;
-
-  return timing_file;
-}
-
 void CheckImuMessage(const sensor_msgs::Imu& imu_message) {
   auto linear_acceleration = ToEigen(imu_message.linear_acceleration);
   if (std::isnan(linear_acceleration.norm()) ||
@@ -250,7 +353,49 @@ class RangeDataChecker {
   std::map<std::string, double> frame_id_to_max_overlap_duration_;
 };
 
-void Run(const std::string& bag_filename, const bool dump_timing) {
+// Checks point data on 'num_threads' threads. The messages of each frame_id
+// are checked by the same thread in the order they were queued.
+class ParallelRangeDataChecker {
+ public:
+  explicit ParallelRangeDataChecker(const int num_threads) {
+    CHECK_GT(num_threads, 0);
+    for (int i = 0; i != num_threads; ++i) {
+      checkers_.push_back(absl::make_unique<RangeDataChecker>());
+      workers_.push_back(absl::make_unique<CheckWorker>());
+    }
+  }
+
+  template <typename MessageType>
+  void QueueMessage(const boost::shared_ptr<MessageType>& message) {
+    const size_t index =
+        std::hash<std::string>()(message->header.frame_id) % checkers_.size();
+    RangeDataChecker* const checker = checkers_[index].get();
+    workers_[index]->Queue(
+        [checker, message]() { checker->CheckMessage(*message); });
+  }
+
+  // Waits for all queued checks before printing the report.
+  void PrintReport() {
+    for (const auto& worker : workers_) {
+      worker->Finish();
+    }
+    for (const auto& checker : checkers_) {
+      checker->PrintReport();
+    }
+  }
+
+ private:
+  std::vector<std::unique_ptr<RangeDataChecker>> checkers_;
+  // Declared last, so the threads are joined before the checkers they use
+  // are destroyed.
+  std::vector<std::unique_ptr<CheckWorker>> workers_;
+};
+
+// Reads the bag on the calling thread which also keeps track of the timing
+// of each frame_id. The contents of the messages are checked on worker
+// threads.
+void Run(const std::string& bag_filename, const bool dump_timing,
+         const int num_point_data_threads) {
   rosbag::Bag bag;
   bag.open(bag_filename, rosbag::bagmode::Read);
   rosbag::View view(bag);
@@ -259,7 +404,12 @@ void Run(const std::string& bag_filename, const bool dump_timing) {
   size_t message_index = 0;
   int num_imu_messages = 0;
   double sum_imu_acceleration = 0.;
-  RangeDataChecker range_data_checker;
+  ParallelRangeDataChecker range_data_checker(num_point_data_threads);
+  // 'num_imu_messages' and 'sum_imu_acceleration' are only accessed from
+  // 'imu_worker' until it is finished.
+  CheckWorker imu_worker;
+  CheckWorker odometry_worker;
+  CheckWorker tf_worker;
   for (const rosbag::MessageInstance& message : view) {
     ++message_index;
     std::string frame_id;
@@ -268,32 +418,34 @@ void Run(const std::string& bag_filename, const bool dump_timing) {
       auto msg = message.instantiate<sensor_msgs::PointCloud2>();
       time = msg->header.stamp;
       frame_id = msg->header.frame_id;
-      range_data_checker.CheckMessage(*msg);
+      range_data_checker.QueueMessage(msg);
     } else if (message.isType<sensor_msgs::MultiEchoLaserScan>()) {
       auto msg = message.instantiate<sensor_msgs::MultiEchoLaserScan>();
       time = msg->header.stamp;
       frame_id = msg->header.frame_id;
-      range_data_checker.CheckMessage(*msg);
+      range_data_checker.QueueMessage(msg);
     } else if (message.isType<sensor_msgs::LaserScan>()) {
       auto msg = message.instantiate<sensor_msgs::LaserScan>();
       time = msg->header.stamp;
       frame_id = msg->header.frame_id;
-      range_data_checker.CheckMessage(*msg);
+      range_data_checker.QueueMessage(msg);
     } else if (message.isType<sensor_msgs::Imu>()) {
       auto msg = message.instantiate<sensor_msgs::Imu>();
       time = msg->header.stamp;
       frame_id = msg->header.frame_id;
-      CheckImuMessage(*msg);
-      num_imu_messages++;
-      sum_imu_acceleration += ToEigen(msg->linear_acceleration).norm();
+      imu_worker.Queue([msg, &num_imu_messages, &sum_imu_acceleration]() {
+        CheckImuMessage(*msg);
+        num_imu_messages++;
+        sum_imu_acceleration += ToEigen(msg->linear_acceleration).norm();
+      });
     } else if (message.isType<nav_msgs::Odometry>()) {
       auto msg = message.instantiate<nav_msgs::Odometry>();
       time = msg->header.stamp;
       frame_id = msg->header.frame_id;
-      CheckOdometryMessage(*msg);
+      odometry_worker.Queue([msg]() { CheckOdometryMessage(*msg); });
     } else if (message.isType<tf2_msgs::TFMessage>()) {
       auto msg = message.instantiate<tf2_msgs::TFMessage>();
-      CheckTfMessage(*msg);
+      tf_worker.Queue([msg]() { CheckTfMessage(*msg); });
       continue;
     } else {
       continue;
@@ -303,9 +455,11 @@ void Run(const std::string& bag_filename, const bool dump_timing) {
     if (!frame_id_to_properties.count(frame_id)) {
       frame_id_to_properties.emplace(
           frame_id,
-          FrameProperties{time, message.getTopic(), std::vector<float>(),
-                          dump_timing ? CreateTimingFile(frame_id) : nullptr,
-                          message.getDataType()});
+          FrameProperties{
+              time, message.getTopic(), QuantileSketch(),
+              dump_timing ? absl::make_unique<TimingFileWriter>(frame_id)
+                          : nullptr,
+              message.getDataType()});
       first_packet = true;
     }
 
@@ -320,7 +474,7 @@ void Run(const std::string& bag_filename, const bool dump_timing) {
                "frame_id sorted by header.stamp, i.e. the order in which they "
                "were acquired from the sensor.";
       }
-      entry.time_deltas.push_back(delta_t_sec);
+      entry.time_deltas.Add(delta_t_sec);
     }
 
     if (entry.topic != message.getTopic()) {
@@ -333,9 +487,8 @@ void Run(const std::string& bag_filename, const bool dump_timing) {
 
     if (dump_timing) {
       CHECK(entry.timing_file != nullptr);
-      (*entry.timing_file) << message_index << "\t"
-                           << message.getTime().toNSec() << "\t"
-                           << time.toNSec() << std::endl;
+      entry.timing_file->Write(message_index, message.getTime().toNSec(),
+                               time.toNSec());
     }
 
     double duration_serialization_sensor = (time - message.getTime()).toSec();
@@ -355,6 +508,9 @@ void Run(const std::string& bag_filename, const bool dump_timing) {
     }
   }
   bag.close();
+  imu_worker.Finish();
+  odometry_worker.Finish();
+  tf_worker.Finish();
 
   range_data_checker.PrintReport();
 
@@ -372,12 +528,12 @@ void Run(const std::string& bag_filename, const bool dump_timing) {
     }
   }
 
-  constexpr int kNumBucketsForHistogram = 10;
   for (const auto& entry_pair : frame_id_to_properties) {
     const FrameProperties& frame_properties = entry_pair.second;
-    float max_time_delta =
-        *std::max_element(frame_properties.time_deltas.begin(),
-                          frame_properties.time_deltas.end());
+    if (frame_properties.time_deltas.count() == 0) {
+      continue;
+    }
+    const double max_time_delta = frame_properties.time_deltas.max();
     if (IsPointDataType(frame_properties.data_type) &&
         max_time_delta > kMaxGapPointsData) {
       LOG(ERROR) << "Point data (frame_id: \"" << entry_pair.first
@@ -392,22 +548,15 @@ void Run(const std::string& bag_filename, const bool dump_timing) {
                  << " s, recommended is [0.0005, 0.005] s with no jitter.";
     }
 
-    cartographer::common::Histogram histogram;
-    for (float time_delta : frame_properties.time_deltas) {
-      histogram.Add(time_delta);
-    }
-    LOG(INFO) << "Time delta histogram for consecutive messages on topic \""
+    LOG(INFO) << "Time delta quantiles for consecutive messages on topic \""
               << frame_properties.topic << "\" (frame_id: \""
               << entry_pair.first << "\"):\n"
-              << histogram.ToString(kNumBucketsForHistogram);
+              << frame_properties.time_deltas.ToString();
   }
 
   if (dump_timing) {
     for (const auto& entry_pair : frame_id_to_properties) {
-      entry_pair.second.timing_file->close();
-      CHECK(*entry_pair.second.timing_file)
-          << "Could not write timing information for \"" << entry_pair.first
-          << "\"";
+      entry_pair.second.timing_file->Close();
     }
   }
 }
@@ -421,5 +570,6 @@ int main(int argc, char** argv) {
   google::ParseCommandLineFlags(&argc, &argv, true);
 
   CHECK(!FLAGS_bag_filename.empty()) << "-bag_filename is missing.";
-  ::cartographer_ros::Run(FLAGS_bag_filename, FLAGS_dump_timing);
+  ::cartographer_ros::Run(FLAGS_bag_filename, FLAGS_dump_timing,
+                          FLAGS_num_point_data_threads);
 }
@@ -16,8 +16,16 @@
 
 #include "cartographer_ros/sensor_bridge.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "absl/memory/memory.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "cartographer/common/task.h"
+#include "cartographer_ros/metrics/latency.h"
+#include "cartographer_ros/metrics/trajectory_accounting.h"
 #include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/node_constants.h"
 #include "cartographer_ros/time_conversion.h"
 
 namespace cartographer_ros {
@@ -28,6 +36,29 @@ using carto::transform::Rigid3d;
 
 namespace {
 
+// Point clouds are only split for transformation into parts of at least this
+// many points, smaller clouds are not worth the scheduling overhead.
+constexpr size_t kMinPointsPerTransformPart = 16384;
+
+// Transforms 'ranges' into 'result', which holds as many points. Only keeps
+// the points passing 'prefilter' if it is not 'nullptr'. Returns the number of
+// points written.
+size_t TransformRangesPart(
+    absl::Span<const carto::sensor::TimedRangefinderPoint> ranges,
+    const Eigen::Matrix3f& rotation, const Eigen::Vector3f& translation,
+    const float time_offset, const RangefinderPrefilterOptions* const prefilter,
+    carto::sensor::TimedRangefinderPoint* result) {
+  if (prefilter != nullptr) {
+    return TransformAndPrefilterRanges(ranges, rotation, translation,
+                                       time_offset, *prefilter, result);
+  }
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    result[i].position = rotation * ranges[i].position + translation;
+    result[i].time = ranges[i].time + time_offset;
+  }
+  return ranges.size();
+}
+
 const std::string& CheckNoLeadingSlash(const std::string& frame_id) {
   if (frame_id.size() > 0) {
     CHECK_NE(frame_id[0], '/') << "The frame_id " << frame_id
@@ -37,34 +68,133 @@ const std::string& CheckNoLeadingSlash(const std::string& frame_id) {
   return frame_id;
 }
 
+carto::sensor::ImuData ConvertImuMessage(const sensor_msgs::Imu& msg,
+                                         const Rigid3d& sensor_to_tracking) {
+  CHECK_NE(msg.linear_acceleration_covariance[0], -1)
+      << "Your IMU data claims to not contain linear acceleration measurements "
+         "by setting linear_acceleration_covariance[0] to -1. Cartographer "
+         "requires this data to work. See "
+         "http://docs.ros.org/api/sensor_msgs/html/msg/Imu.html.";
+  CHECK_NE(msg.angular_velocity_covariance[0], -1)
+      << "Your IMU data claims to not contain angular velocity measurements "
+         "by setting angular_velocity_covariance[0] to -1. Cartographer "
+         "requires this data to work. See "
+         "http://docs.ros.org/api/sensor_msgs/html/msg/Imu.html.";
+  CHECK(sensor_to_tracking.translation().norm() < 1e-5)
+      << "The IMU frame must be colocated with the tracking frame. "
+         "Transforming linear acceleration into the tracking frame will "
+         "otherwise be imprecise.";
+  return carto::sensor::ImuData{
+      FromRos(msg.header.stamp),
+      sensor_to_tracking.rotation() * ToEigen(msg.linear_acceleration),
+      sensor_to_tracking.rotation() * ToEigen(msg.angular_velocity)};
+}
+
+carto::sensor::OdometryData ConvertOdometryMessage(
+    const nav_msgs::Odometry& msg, const Rigid3d& sensor_to_tracking) {
+  return carto::sensor::OdometryData{
+      FromRos(msg.header.stamp),
+      ToRigid3d(msg.pose.pose) * sensor_to_tracking.inverse()};
+}
+
+template <typename LaserMessageType>
+const LaserScanAngleTable& GetLaserScanAngleTable(
+    const std::string& sensor_id, const LaserMessageType& msg,
+    std::map<std::string, LaserScanAngleTable>* const sensor_to_angle_table) {
+  auto it = sensor_to_angle_table->find(sensor_id);
+  if (it == sensor_to_angle_table->end()) {
+    it = sensor_to_angle_table
+             ->emplace(sensor_id, ComputeLaserScanAngleTable(msg))
+             .first;
+  } else if (!HasLaserScanAngleTable(msg, it->second)) {
+    it->second = ComputeLaserScanAngleTable(msg);
+  }
+  return it->second;
+}
+
 }  // namespace
 
 SensorBridge::SensorBridge(
     const int num_subdivisions_per_laser_scan,
     const std::string& tracking_frame,
-    const double lookup_transform_timeout_sec, tf2_ros::Buffer* const tf_buffer,
-    carto::mapping::TrajectoryBuilderInterface* const trajectory_builder)
+    const double lookup_transform_timeout_sec,
+    tf2_ros::BufferInterface* const tf_buffer,
+    carto::mapping::TrajectoryBuilderInterface* const trajectory_builder,
+    carto::common::ThreadPoolInterface* const thread_pool,
+    const std::map<std::string, RangefinderPrefilterOptions>&
+        rangefinder_prefilters,
+    const RangefinderMergeOptions& rangefinder_merge,
+    const metrics::TrajectoryAccounting& accounting)
     : num_subdivisions_per_laser_scan_(num_subdivisions_per_laser_scan),
-      tf_bridge_(tracking_frame, lookup_transform_timeout_sec, tf_buffer),
-      trajectory_builder_(trajectory_builder) {}
+      rangefinder_prefilters_(rangefinder_prefilters),
+      rangefinder_merger_(
+          rangefinder_merge.sensor_ids.empty()
+              ? nullptr
+              : absl::make_unique<RangefinderMerger>(rangefinder_merge)),
+      tf_bridge_(tracking_frame, lookup_transform_timeout_sec, tf_buffer,
+                 accounting.tf_lookup_cpu_seconds),
+      trajectory_builder_(trajectory_builder),
+      thread_pool_(thread_pool),
+      accounting_(accounting) {}
 
 std::unique_ptr<carto::sensor::OdometryData> SensorBridge::ToOdometryData(
     const nav_msgs::Odometry::ConstPtr& msg) {
-  const carto::common::Time time = FromRos(msg->header.stamp);
   const auto sensor_to_tracking = tf_bridge_.LookupToTracking(
-      time, CheckNoLeadingSlash(msg->child_frame_id));
+      FromRos(msg->header.stamp), CheckNoLeadingSlash(msg->child_frame_id));
   if (sensor_to_tracking == nullptr) {
     return nullptr;
   }
   return absl::make_unique<carto::sensor::OdometryData>(
-      carto::sensor::OdometryData{
-          time, ToRigid3d(msg->pose.pose) * sensor_to_tracking->inverse()});
+      ConvertOdometryMessage(*msg, *sensor_to_tracking));
+}
+
+std::vector<carto::sensor::OdometryData> SensorBridge::ToOdometryData(
+    const absl::Span<const nav_msgs::Odometry::ConstPtr> msgs) {
+  std::vector<carto::sensor::OdometryData> odometry_data;
+  odometry_data.reserve(msgs.size());
+  // Like for IMU data, the transform is looked up once per child frame at the
+  // time of the newest message, since it is static on virtually all robots.
+  const std::string* child_frame_id = nullptr;
+  std::unique_ptr<Rigid3d> sensor_to_tracking;
+  for (const nav_msgs::Odometry::ConstPtr& msg : msgs) {
+    if (child_frame_id == nullptr || *child_frame_id != msg->child_frame_id) {
+      child_frame_id = &msg->child_frame_id;
+      sensor_to_tracking =
+          tf_bridge_.LookupToTracking(FromRos(msgs.back()->header.stamp),
+                                      CheckNoLeadingSlash(*child_frame_id));
+    }
+    if (sensor_to_tracking != nullptr) {
+      odometry_data.push_back(
+          ConvertOdometryMessage(*msg, *sensor_to_tracking));
+      continue;
+    }
+    std::unique_ptr<carto::sensor::OdometryData> single_odometry_data =
+        ToOdometryData(msg);
+    if (single_odometry_data != nullptr) {
+      odometry_data.push_back(*single_odometry_data);
+    }
+  }
+  return odometry_data;
+}
+
+void SensorBridge::HandleOdometryData(
+    const std::string& sensor_id,
+    const absl::Span<const carto::sensor::OdometryData> odometry_data) {
+  for (const carto::sensor::OdometryData& data : odometry_data) {
+    trajectory_builder_->AddSensorData(sensor_id, data);
+  }
 }
 
 void SensorBridge::HandleOdometryMessage(
     const std::string& sensor_id, const nav_msgs::Odometry::ConstPtr& msg) {
+  metrics::LatencyTimer conversion_timer(metrics::LatencyStage::kConversion,
+                                         sensor_id);
+  metrics::ThreadCpuTimer conversion_cpu_timer(
+      accounting_.conversion_cpu_seconds);
   std::unique_ptr<carto::sensor::OdometryData> odometry_data =
       ToOdometryData(msg);
+  conversion_timer.Stop();
+  conversion_cpu_timer.Stop();
   if (odometry_data != nullptr) {
     trajectory_builder_->AddSensorData(
         sensor_id,
@@ -100,10 +230,19 @@ void SensorBridge::HandleNavSatFixMessage(
 void SensorBridge::HandleLandmarkMessage(
     const std::string& sensor_id,
     const cartographer_ros_msgs::LandmarkList::ConstPtr& msg) {
+  metrics::LatencyTimer conversion_timer(metrics::LatencyStage::kConversion,
+                                         sensor_id);
+  metrics::ThreadCpuTimer conversion_cpu_timer(
+      accounting_.conversion_cpu_seconds);
   auto landmark_data = ToLandmarkData(*msg);
 
-  auto tracking_from_landmark_sensor = tf_bridge_.LookupToTracking(
-      landmark_data.time, CheckNoLeadingSlash(msg->header.frame_id));
+  // Lists without observations are still added for their time, but need no
+  // transform.
+  auto tracking_from_landmark_sensor =
+      landmark_data.landmark_observations.empty()
+          ? nullptr
+          : tf_bridge_.LookupToTracking(
+                landmark_data.time, CheckNoLeadingSlash(msg->header.frame_id));
   if (tracking_from_landmark_sensor != nullptr) {
     for (auto& observation : landmark_data.landmark_observations) {
       observation.landmark_to_tracking_transform =
@@ -111,40 +250,66 @@ void SensorBridge::HandleLandmarkMessage(
           observation.landmark_to_tracking_transform;
     }
   }
+  conversion_timer.Stop();
+  conversion_cpu_timer.Stop();
   trajectory_builder_->AddSensorData(sensor_id, landmark_data);
 }
 
 std::unique_ptr<carto::sensor::ImuData> SensorBridge::ToImuData(
     const sensor_msgs::Imu::ConstPtr& msg) {
-  CHECK_NE(msg->linear_acceleration_covariance[0], -1)
-      << "Your IMU data claims to not contain linear acceleration measurements "
-         "by setting linear_acceleration_covariance[0] to -1. Cartographer "
-         "requires this data to work. See "
-         "http://docs.ros.org/api/sensor_msgs/html/msg/Imu.html.";
-  CHECK_NE(msg->angular_velocity_covariance[0], -1)
-      << "Your IMU data claims to not contain angular velocity measurements "
-         "by setting angular_velocity_covariance[0] to -1. Cartographer "
-         "requires this data to work. See "
-         "http://docs.ros.org/api/sensor_msgs/html/msg/Imu.html.";
-
-  const carto::common::Time time = FromRos(msg->header.stamp);
   const auto sensor_to_tracking = tf_bridge_.LookupToTracking(
-      time, CheckNoLeadingSlash(msg->header.frame_id));
+      FromRos(msg->header.stamp), CheckNoLeadingSlash(msg->header.frame_id));
   if (sensor_to_tracking == nullptr) {
     return nullptr;
   }
-  CHECK(sensor_to_tracking->translation().norm() < 1e-5)
-      << "The IMU frame must be colocated with the tracking frame. "
-         "Transforming linear acceleration into the tracking frame will "
-         "otherwise be imprecise.";
-  return absl::make_unique<carto::sensor::ImuData>(carto::sensor::ImuData{
-      time, sensor_to_tracking->rotation() * ToEigen(msg->linear_acceleration),
-      sensor_to_tracking->rotation() * ToEigen(msg->angular_velocity)});
+  return absl::make_unique<carto::sensor::ImuData>(
+      ConvertImuMessage(*msg, *sensor_to_tracking));
+}
+
+std::vector<carto::sensor::ImuData> SensorBridge::ToImuData(
+    const absl::Span<const sensor_msgs::Imu::ConstPtr> msgs) {
+  std::vector<carto::sensor::ImuData> imu_data;
+  imu_data.reserve(msgs.size());
+  // The IMU frame is colocated with the tracking frame, so for all messages of
+  // a frame, its rotation is looked up once at the time of the newest message.
+  const std::string* frame_id = nullptr;
+  std::unique_ptr<Rigid3d> sensor_to_tracking;
+  for (const sensor_msgs::Imu::ConstPtr& msg : msgs) {
+    if (frame_id == nullptr || *frame_id != msg->header.frame_id) {
+      frame_id = &msg->header.frame_id;
+      sensor_to_tracking = tf_bridge_.LookupToTracking(
+          FromRos(msgs.back()->header.stamp), CheckNoLeadingSlash(*frame_id));
+    }
+    if (sensor_to_tracking != nullptr) {
+      imu_data.push_back(ConvertImuMessage(*msg, *sensor_to_tracking));
+      continue;
+    }
+    // Falls back to looking up the transform at the time of each message.
+    std::unique_ptr<carto::sensor::ImuData> single_imu_data = ToImuData(msg);
+    if (single_imu_data != nullptr) {
+      imu_data.push_back(*single_imu_data);
+    }
+  }
+  return imu_data;
+}
+
+void SensorBridge::HandleImuData(
+    const std::string& sensor_id,
+    const absl::Span<const carto::sensor::ImuData> imu_data) {
+  for (const carto::sensor::ImuData& data : imu_data) {
+    trajectory_builder_->AddSensorData(sensor_id, data);
+  }
 }
 
 void SensorBridge::HandleImuMessage(const std::string& sensor_id,
                                     const sensor_msgs::Imu::ConstPtr& msg) {
+  metrics::LatencyTimer conversion_timer(metrics::LatencyStage::kConversion,
+                                         sensor_id);
+  metrics::ThreadCpuTimer conversion_cpu_timer(
+      accounting_.conversion_cpu_seconds);
   std::unique_ptr<carto::sensor::ImuData> imu_data = ToImuData(msg);
+  conversion_timer.Stop();
+  conversion_cpu_timer.Stop();
   if (imu_data != nullptr) {
     trajectory_builder_->AddSensorData(
         sensor_id,
@@ -155,28 +320,59 @@ void SensorBridge::HandleImuMessage(const std::string& sensor_id,
 
 void SensorBridge::HandleLaserScanMessage(
     const std::string& sensor_id, const sensor_msgs::LaserScan::ConstPtr& msg) {
+  metrics::LatencyTimer conversion_timer(metrics::LatencyStage::kConversion,
+                                         sensor_id);
+  metrics::ThreadCpuTimer conversion_cpu_timer(
+      accounting_.conversion_cpu_seconds);
   carto::sensor::PointCloudWithIntensities point_cloud;
   carto::common::Time time;
-  std::tie(point_cloud, time) = ToPointCloudWithIntensities(*msg);
+  std::tie(point_cloud, time) = ToPointCloudWithIntensities(
+      *msg, GetLaserScanAngleTable(sensor_id, *msg,
+                                   &sensor_to_laser_scan_angle_table_));
+  conversion_timer.Stop();
+  conversion_cpu_timer.Stop();
   HandleLaserScan(sensor_id, time, msg->header.frame_id, point_cloud);
 }
 
 void SensorBridge::HandleMultiEchoLaserScanMessage(
     const std::string& sensor_id,
     const sensor_msgs::MultiEchoLaserScan::ConstPtr& msg) {
+  metrics::LatencyTimer conversion_timer(metrics::LatencyStage::kConversion,
+                                         sensor_id);
+  metrics::ThreadCpuTimer conversion_cpu_timer(
+      accounting_.conversion_cpu_seconds);
   carto::sensor::PointCloudWithIntensities point_cloud;
   carto::common::Time time;
-  std::tie(point_cloud, time) = ToPointCloudWithIntensities(*msg);
+  std::tie(point_cloud, time) = ToPointCloudWithIntensities(
+      *msg, GetLaserScanAngleTable(sensor_id, *msg,
+                                   &sensor_to_laser_scan_angle_table_));
+  conversion_timer.Stop();
+  conversion_cpu_timer.Stop();
   HandleLaserScan(sensor_id, time, msg->header.frame_id, point_cloud);
 }
 
 void SensorBridge::HandlePointCloud2Message(
     const std::string& sensor_id,
     const sensor_msgs::PointCloud2::ConstPtr& msg) {
+  metrics::LatencyTimer conversion_timer(metrics::LatencyStage::kConversion,
+                                         sensor_id);
+  metrics::ThreadCpuTimer conversion_cpu_timer(
+      accounting_.conversion_cpu_seconds);
   carto::sensor::PointCloudWithIntensities point_cloud;
   carto::common::Time time;
-  std::tie(point_cloud, time) = ToPointCloudWithIntensities(*msg);
-  HandleRangefinder(sensor_id, time, msg->header.frame_id, point_cloud.points);
+  auto it = sensor_to_point_cloud2_layout_.find(sensor_id);
+  if (it == sensor_to_point_cloud2_layout_.end()) {
+    it = sensor_to_point_cloud2_layout_
+             .emplace(sensor_id, ComputePointCloud2Layout(*msg))
+             .first;
+  } else if (!HasPointCloud2Layout(*msg, it->second)) {
+    it->second = ComputePointCloud2Layout(*msg);
+  }
+  std::tie(point_cloud, time) = ToPointCloudWithIntensities(*msg, it->second);
+  conversion_timer.Stop();
+  conversion_cpu_timer.Stop();
+  HandleRangefinder(sensor_id, time, msg->header.frame_id, point_cloud.points,
+                    0.f);
 }
 
 const TfBridge& SensorBridge::tf_bridge() const { return tf_bridge_; }
@@ -189,18 +385,20 @@ void SensorBridge::HandleLaserScan(
     return;
   }
   CHECK_LE(points.points.back().time, 0.f);
-  // TODO(gaschler): Use per-point time instead of subdivisions.
+  // With a single subdivision the whole scan is added at once and unwarped by
+  // the trajectory builder using the time of each point.
   for (int i = 0; i != num_subdivisions_per_laser_scan_; ++i) {
     const size_t start_index =
         points.points.size() * i / num_subdivisions_per_laser_scan_;
     const size_t end_index =
         points.points.size() * (i + 1) / num_subdivisions_per_laser_scan_;
-    carto::sensor::TimedPointCloud subdivision(
-        points.points.begin() + start_index, points.points.begin() + end_index);
     if (start_index == end_index) {
       continue;
     }
-    const double time_to_subdivision_end = subdivision.back().time;
+    const absl::Span<const carto::sensor::TimedRangefinderPoint> subdivision =
+        absl::MakeConstSpan(points.points)
+            .subspan(start_index, end_index - start_index);
+    const float time_to_subdivision_end = subdivision.back().time;
     // `subdivision_time` is the end of the measurement so sensor::Collator will
     // send all other sensor data first.
     const carto::common::Time subdivision_time =
@@ -215,29 +413,106 @@ void SensorBridge::HandleLaserScan(
       continue;
     }
     sensor_to_previous_subdivision_time_[sensor_id] = subdivision_time;
-    for (auto& point : subdivision) {
-      point.time -= time_to_subdivision_end;
-    }
-    CHECK_EQ(subdivision.back().time, 0.f);
-    HandleRangefinder(sensor_id, subdivision_time, frame_id, subdivision);
+    HandleRangefinder(sensor_id, subdivision_time, frame_id, subdivision,
+                      -time_to_subdivision_end);
+  }
+}
+
+void SensorBridge::Flush() {
+  if (rangefinder_merger_ == nullptr) {
+    return;
+  }
+  for (const auto& merged_data : rangefinder_merger_->Flush()) {
+    trajectory_builder_->AddSensorData(kMergedRangefinderSensorId,
+                                       merged_data);
   }
 }
 
 void SensorBridge::HandleRangefinder(
     const std::string& sensor_id, const carto::common::Time time,
-    const std::string& frame_id, const carto::sensor::TimedPointCloud& ranges) {
+    const std::string& frame_id,
+    const absl::Span<const carto::sensor::TimedRangefinderPoint> ranges,
+    const float time_offset) {
   if (!ranges.empty()) {
-    CHECK_LE(ranges.back().time, 0.f);
+    CHECK_LE(ranges.back().time + time_offset, 0.f);
   }
   const auto sensor_to_tracking =
       tf_bridge_.LookupToTracking(time, CheckNoLeadingSlash(frame_id));
   if (sensor_to_tracking != nullptr) {
-    trajectory_builder_->AddSensorData(
-        sensor_id, carto::sensor::TimedPointCloudData{
-                       time, sensor_to_tracking->translation().cast<float>(),
-                       carto::sensor::TransformTimedPointCloud(
-                           ranges, sensor_to_tracking->cast<float>())});
+    const auto prefilter_it = rangefinder_prefilters_.find(sensor_id);
+    carto::sensor::TimedPointCloudData data{
+        time, sensor_to_tracking->translation().cast<float>(),
+        TransformRanges(ranges, sensor_to_tracking->cast<float>(), time_offset,
+                        prefilter_it == rangefinder_prefilters_.end()
+                            ? nullptr
+                            : &prefilter_it->second)};
+    if (rangefinder_merger_ != nullptr &&
+        rangefinder_merger_->IsMerged(sensor_id)) {
+      for (const auto& merged_data :
+           rangefinder_merger_->AddRangefinderData(sensor_id,
+                                                   std::move(data))) {
+        trajectory_builder_->AddSensorData(kMergedRangefinderSensorId,
+                                           merged_data);
+      }
+      return;
+    }
+    trajectory_builder_->AddSensorData(sensor_id, data);
+  }
+}
+
+carto::sensor::TimedPointCloud SensorBridge::TransformRanges(
+    const absl::Span<const carto::sensor::TimedRangefinderPoint> ranges,
+    const carto::transform::Rigid3f& sensor_to_tracking,
+    const float time_offset,
+    const RangefinderPrefilterOptions* const prefilter) {
+  // Rotating with the matrix instead of the quaternion is cheaper per point.
+  const Eigen::Matrix3f rotation =
+      sensor_to_tracking.rotation().toRotationMatrix();
+  const Eigen::Vector3f& translation = sensor_to_tracking.translation();
+  carto::sensor::TimedPointCloud result(ranges.size());
+  const size_t num_parts =
+      thread_pool_ == nullptr
+          ? 1
+          : std::max<size_t>(1, ranges.size() / kMinPointsPerTransformPart);
+  if (num_parts == 1) {
+    result.resize(TransformRangesPart(ranges, rotation, translation,
+                                      time_offset, prefilter, result.data()));
+    return result;
+  }
+  // The calling thread transforms the first part while the thread pool
+  // transforms the others. Each part is written to where its points start in
+  // 'ranges', followed by a gap if the prefilter dropped any.
+  std::vector<size_t> part_sizes(num_parts);
+  absl::BlockingCounter pending_parts(num_parts - 1);
+  for (size_t i = 1; i < num_parts; ++i) {
+    const size_t start_index = ranges.size() * i / num_parts;
+    const size_t end_index = ranges.size() * (i + 1) / num_parts;
+    auto task = absl::make_unique<carto::common::Task>();
+    task->SetWorkItem([&, i, start_index, end_index]() {
+      part_sizes[i] = TransformRangesPart(
+          ranges.subspan(start_index, end_index - start_index), rotation,
+          translation, time_offset, prefilter, result.data() + start_index);
+      pending_parts.DecrementCount();
+    });
+    thread_pool_->Schedule(std::move(task));
+  }
+  part_sizes[0] =
+      TransformRangesPart(ranges.subspan(0, ranges.size() / num_parts),
+                          rotation, translation, time_offset, prefilter,
+                          result.data());
+  pending_parts.Wait();
+  if (prefilter != nullptr) {
+    size_t num_points = part_sizes[0];
+    for (size_t i = 1; i < num_parts; ++i) {
+      const size_t start_index = ranges.size() * i / num_parts;
+      std::move(result.begin() + start_index,
+                result.begin() + start_index + part_sizes[i],
+                result.begin() + num_points);
+      num_points += part_sizes[i];
+    }
+    result.resize(num_points);
   }
+  return result;
 }
 
 }  // namespace cartographer_ros
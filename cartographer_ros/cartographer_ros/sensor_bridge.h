@@ -17,14 +17,23 @@
 #ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SENSOR_BRIDGE_H
 #define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SENSOR_BRIDGE_H
 
+#include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/mapping/trajectory_builder_interface.h"
 #include "cartographer/sensor/imu_data.h"
 #include "cartographer/sensor/odometry_data.h"
 #include "cartographer/transform/rigid_transform.h"
 #include "cartographer/transform/transform.h"
+#include "cartographer_ros/metrics/trajectory_accounting.h"
+#include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/rangefinder_merger.h"
+#include "cartographer_ros/rangefinder_prefilter.h"
 #include "cartographer_ros/tf_bridge.h"
 #include "cartographer_ros_msgs/LandmarkList.h"
 #include "geometry_msgs/Transform.h"
@@ -42,16 +51,32 @@ namespace cartographer_ros {
 // Converts ROS messages into SensorData in tracking frame for the MapBuilder.
 class SensorBridge {
  public:
+  // Range data of the sensors in 'rangefinder_prefilters' is filtered while
+  // it is transformed into the tracking frame. Range data of the sensors in
+  // 'rangefinder_merge' is added as 'kMergedRangefinderSensorId'. The CPU time
+  // spent converting messages is recorded in 'accounting'.
   explicit SensorBridge(
       int num_subdivisions_per_laser_scan, const std::string& tracking_frame,
-      double lookup_transform_timeout_sec, tf2_ros::Buffer* tf_buffer,
-      ::cartographer::mapping::TrajectoryBuilderInterface* trajectory_builder);
+      double lookup_transform_timeout_sec, tf2_ros::BufferInterface* tf_buffer,
+      ::cartographer::mapping::TrajectoryBuilderInterface* trajectory_builder,
+      ::cartographer::common::ThreadPoolInterface* thread_pool,
+      const std::map<std::string, RangefinderPrefilterOptions>&
+          rangefinder_prefilters,
+      const RangefinderMergeOptions& rangefinder_merge,
+      const metrics::TrajectoryAccounting& accounting);
 
   SensorBridge(const SensorBridge&) = delete;
   SensorBridge& operator=(const SensorBridge&) = delete;
 
   std::unique_ptr<::cartographer::sensor::OdometryData> ToOdometryData(
       const nav_msgs::Odometry::ConstPtr& msg);
+  // Converts a batch of messages, looking up the transform to the tracking
+  // frame only once per frame. Messages without a transform are dropped.
+  std::vector<::cartographer::sensor::OdometryData> ToOdometryData(
+      absl::Span<const nav_msgs::Odometry::ConstPtr> msgs);
+  void HandleOdometryData(
+      const std::string& sensor_id,
+      absl::Span<const ::cartographer::sensor::OdometryData> odometry_data);
   void HandleOdometryMessage(const std::string& sensor_id,
                              const nav_msgs::Odometry::ConstPtr& msg);
   void HandleNavSatFixMessage(const std::string& sensor_id,
@@ -62,6 +87,12 @@ class SensorBridge {
 
   std::unique_ptr<::cartographer::sensor::ImuData> ToImuData(
       const sensor_msgs::Imu::ConstPtr& msg);
+  // Like the batched 'ToOdometryData()'.
+  std::vector<::cartographer::sensor::ImuData> ToImuData(
+      absl::Span<const sensor_msgs::Imu::ConstPtr> msgs);
+  void HandleImuData(
+      const std::string& sensor_id,
+      absl::Span<const ::cartographer::sensor::ImuData> imu_data);
   void HandleImuMessage(const std::string& sensor_id,
                         const sensor_msgs::Imu::ConstPtr& msg);
   void HandleLaserScanMessage(const std::string& sensor_id,
@@ -72,6 +103,10 @@ class SensorBridge {
   void HandlePointCloud2Message(const std::string& sensor_id,
                                 const sensor_msgs::PointCloud2::ConstPtr& msg);
 
+  // Hands the range data still waiting to be merged to the trajectory
+  // builder. Called before the trajectory is finished.
+  void Flush();
+
   const TfBridge& tf_bridge() const;
 
  private:
@@ -79,17 +114,35 @@ class SensorBridge {
       const std::string& sensor_id, ::cartographer::common::Time start_time,
       const std::string& frame_id,
       const ::cartographer::sensor::PointCloudWithIntensities& points);
-  void HandleRangefinder(const std::string& sensor_id,
-                         ::cartographer::common::Time time,
-                         const std::string& frame_id,
-                         const ::cartographer::sensor::TimedPointCloud& ranges);
+  // Adds 'time_offset' to the time of all 'ranges' while transforming them.
+  void HandleRangefinder(
+      const std::string& sensor_id, ::cartographer::common::Time time,
+      const std::string& frame_id,
+      absl::Span<const ::cartographer::sensor::TimedRangefinderPoint> ranges,
+      float time_offset);
+  // Only keeps the points passing 'prefilter', unless it is 'nullptr'.
+  ::cartographer::sensor::TimedPointCloud TransformRanges(
+      absl::Span<const ::cartographer::sensor::TimedRangefinderPoint> ranges,
+      const ::cartographer::transform::Rigid3f& sensor_to_tracking,
+      float time_offset, const RangefinderPrefilterOptions* prefilter);
 
   const int num_subdivisions_per_laser_scan_;
   std::map<std::string, cartographer::common::Time>
       sensor_to_previous_subdivision_time_;
+  // Beam directions of the laser scan topics, recomputed when they change.
+  std::map<std::string, LaserScanAngleTable> sensor_to_laser_scan_angle_table_;
+  // Field layouts of the PointCloud2 topics, recomputed when they change.
+  std::map<std::string, PointCloud2Layout> sensor_to_point_cloud2_layout_;
+  const std::map<std::string, RangefinderPrefilterOptions>
+      rangefinder_prefilters_;
+  // 'nullptr' unless range data is merged.
+  std::unique_ptr<RangefinderMerger> rangefinder_merger_;
   const TfBridge tf_bridge_;
   ::cartographer::mapping::TrajectoryBuilderInterface* const
       trajectory_builder_;
+  // Splits transforming large point clouds if not 'nullptr'.
+  ::cartographer::common::ThreadPoolInterface* const thread_pool_;
+  const metrics::TrajectoryAccounting accounting_;
 
   absl::optional<::cartographer::transform::Rigid3d> ecef_to_local_frame_;
 };
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/sensor_bridge.h"
+
+#include <string>
+#include <vector>
+
+#include "boost/make_shared.hpp"
+#include "cartographer/mapping/local_slam_result_data.h"
+#include "cartographer_ros/node_constants.h"
+#include "gtest/gtest.h"
+#include "tf2_ros/buffer.h"
+
+namespace cartographer_ros {
+namespace {
+
+namespace carto = ::cartographer;
+
+// Records the sensor IDs and sizes of the range data it is given.
+class FakeTrajectoryBuilder
+    : public carto::mapping::TrajectoryBuilderInterface {
+ public:
+  void AddSensorData(
+      const std::string& sensor_id,
+      const carto::sensor::TimedPointCloudData& timed_point_cloud_data)
+      override {
+    sensor_ids.push_back(sensor_id);
+    num_points.push_back(timed_point_cloud_data.ranges.size());
+  }
+  void AddSensorData(const std::string& sensor_id,
+                     const carto::sensor::ImuData& imu_data) override {}
+  void AddSensorData(
+      const std::string& sensor_id,
+      const carto::sensor::OdometryData& odometry_data) override {}
+  void AddSensorData(const std::string& sensor_id,
+                     const carto::sensor::FixedFramePoseData& fixed_frame_pose)
+      override {}
+  void AddSensorData(
+      const std::string& sensor_id,
+      const carto::sensor::LandmarkData& landmark_data) override {}
+  void AddLocalSlamResultData(
+      std::unique_ptr<carto::mapping::LocalSlamResultData>
+          local_slam_result_data) override {}
+
+  std::vector<std::string> sensor_ids;
+  std::vector<size_t> num_points;
+};
+
+sensor_msgs::LaserScan::ConstPtr CreateLaserScan(const double time_sec) {
+  auto scan = boost::make_shared<sensor_msgs::LaserScan>();
+  scan->header.stamp = ::ros::Time(time_sec);
+  scan->header.frame_id = "laser";
+  scan->angle_min = 0.f;
+  scan->angle_max = 0.2f;
+  scan->angle_increment = 0.1f;
+  scan->range_min = 0.1f;
+  scan->range_max = 10.f;
+  scan->ranges = {1.f, 2.f, 3.f};
+  return scan;
+}
+
+TEST(SensorBridgeTest, FlushesPendingMergedRound) {
+  ::ros::Time::init();
+  tf2_ros::Buffer tf_buffer;
+  geometry_msgs::TransformStamped laser_to_tracking;
+  laser_to_tracking.header.frame_id = "base_link";
+  laser_to_tracking.child_frame_id = "laser";
+  laser_to_tracking.transform.rotation.w = 1.;
+  ASSERT_TRUE(tf_buffer.setTransform(laser_to_tracking, "test",
+                                     true /* is_static */));
+  FakeTrajectoryBuilder trajectory_builder;
+  RangefinderMergeOptions rangefinder_merge;
+  rangefinder_merge.sensor_ids = {"scan_1", "scan_2"};
+  rangefinder_merge.max_wait_sec = 0.1;
+  SensorBridge sensor_bridge(
+      1 /* num_subdivisions_per_laser_scan */, "base_link",
+      0. /* lookup_transform_timeout_sec */, &tf_buffer, &trajectory_builder,
+      nullptr /* thread_pool */, {} /* rangefinder_prefilters */,
+      rangefinder_merge, metrics::TrajectoryAccounting());
+
+  // The last round only has range data of one of the merged sensors.
+  sensor_bridge.HandleLaserScanMessage("scan_1", CreateLaserScan(1.));
+  sensor_bridge.HandleLaserScanMessage("scan_2", CreateLaserScan(1.01));
+  sensor_bridge.HandleLaserScanMessage("scan_1", CreateLaserScan(1.05));
+  ASSERT_EQ(1, trajectory_builder.sensor_ids.size());
+  sensor_bridge.Flush();
+  ASSERT_EQ(2, trajectory_builder.sensor_ids.size());
+  EXPECT_EQ(kMergedRangefinderSensorId, trajectory_builder.sensor_ids.back());
+  EXPECT_EQ(3, trajectory_builder.num_points.back());
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/sensor_data_batcher.h"
+
+#include <unordered_set>
+#include <utility>
+
+#include "absl/time/clock.h"
+#include "cartographer/metrics/counter.h"
+#include "cartographer/metrics/histogram.h"
+#include "cartographer_ros/rangefinder_prefilter.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace carto = ::cartographer;
+
+namespace {
+
+// Estimated sizes in bytes of the protos of the data, as sent to a
+// Cartographer server.
+constexpr int kTimedPointCloudDataBytes = 32;
+constexpr int kTimedRangefinderPointBytes = 22;
+constexpr int kIntensityBytes = 4;
+constexpr int kImuDataBytes = 70;
+constexpr int kOdometryDataBytes = 80;
+
+// Registered if metrics are collected.
+carto::metrics::Counter* kRangeDataBytesMetric =
+    carto::metrics::Counter::Null();
+carto::metrics::Counter* kImuDataBytesMetric = carto::metrics::Counter::Null();
+carto::metrics::Counter* kOdometryDataBytesMetric =
+    carto::metrics::Counter::Null();
+carto::metrics::Counter* kDroppedPointsMetric = carto::metrics::Counter::Null();
+carto::metrics::Histogram* kBatchLatencyMetric =
+    carto::metrics::Histogram::Null();
+
+// Hands on any of the batched data types, counting its bytes.
+class DataAdder : public boost::static_visitor<void> {
+ public:
+  DataAdder(
+      const std::string& sensor_id,
+      carto::mapping::TrajectoryBuilderInterface* const trajectory_builder)
+      : sensor_id_(sensor_id), trajectory_builder_(trajectory_builder) {}
+
+  void operator()(const carto::sensor::TimedPointCloudData& data) const {
+    kRangeDataBytesMetric->Increment(
+        kTimedPointCloudDataBytes +
+        kTimedRangefinderPointBytes * data.ranges.size() +
+        kIntensityBytes * data.intensities.size());
+    trajectory_builder_->AddSensorData(sensor_id_, data);
+  }
+
+  void operator()(const carto::sensor::ImuData& data) const {
+    kImuDataBytesMetric->Increment(kImuDataBytes);
+    trajectory_builder_->AddSensorData(sensor_id_, data);
+  }
+
+  void operator()(const carto::sensor::OdometryData& data) const {
+    kOdometryDataBytesMetric->Increment(kOdometryDataBytes);
+    trajectory_builder_->AddSensorData(sensor_id_, data);
+  }
+
+ private:
+  const std::string& sensor_id_;
+  carto::mapping::TrajectoryBuilderInterface* const trajectory_builder_;
+};
+
+// Keeps the first point of each voxel and its intensity.
+carto::sensor::TimedPointCloudData VoxelFilter(
+    const carto::sensor::TimedPointCloudData& data, const float voxel_size) {
+  const float inverse_voxel_size = 1.f / voxel_size;
+  const bool has_intensities = data.intensities.size() == data.ranges.size();
+  carto::sensor::TimedPointCloudData result{data.time, data.origin, {}, {}};
+  result.ranges.reserve(data.ranges.size());
+  if (has_intensities) {
+    result.intensities.reserve(data.ranges.size());
+  }
+  std::unordered_set<uint64_t> occupied_voxels;
+  occupied_voxels.reserve(data.ranges.size());
+  for (size_t i = 0; i < data.ranges.size(); ++i) {
+    if (!occupied_voxels
+             .insert(GetVoxelKey(data.ranges[i].position, inverse_voxel_size))
+             .second) {
+      continue;
+    }
+    result.ranges.push_back(data.ranges[i]);
+    if (has_intensities) {
+      result.intensities.push_back(data.intensities[i]);
+    }
+  }
+  kDroppedPointsMetric->Increment(data.ranges.size() - result.ranges.size());
+  return result;
+}
+
+}  // namespace
+
+SensorDataBatchingOptions CreateSensorDataBatchingOptions(
+    carto::common::LuaParameterDictionary* const lua_parameter_dictionary) {
+  SensorDataBatchingOptions options;
+  if (lua_parameter_dictionary->HasKey("max_batch_duration_sec")) {
+    options.max_batch_duration_sec =
+        lua_parameter_dictionary->GetDouble("max_batch_duration_sec");
+  }
+  if (lua_parameter_dictionary->HasKey("point_cloud_voxel_size")) {
+    options.point_cloud_voxel_size =
+        lua_parameter_dictionary->GetDouble("point_cloud_voxel_size");
+  }
+  CHECK_GE(options.max_batch_duration_sec, 0.);
+  CHECK_GE(options.point_cloud_voxel_size, 0.f);
+  return options;
+}
+
+bool IsSensorDataBatchingEnabled(const SensorDataBatchingOptions& options) {
+  return options.max_batch_duration_sec > 0. ||
+         options.point_cloud_voxel_size > 0.f;
+}
+
+void RegisterSensorDataBatcherMetrics(
+    carto::metrics::FamilyFactory* const factory) {
+  auto* const bytes = factory->NewCounterFamily(
+      "cartographer_ros_batched_sensor_data_bytes",
+      "Estimated bytes of the sensor data handed on by the batchers");
+  kRangeDataBytesMetric = bytes->Add({{"kind", "range"}});
+  kImuDataBytesMetric = bytes->Add({{"kind", "imu"}});
+  kOdometryDataBytesMetric = bytes->Add({{"kind", "odometry"}});
+  kDroppedPointsMetric =
+      factory
+          ->NewCounterFamily(
+              "cartographer_ros_batched_sensor_data_dropped_points",
+              "Points dropped by the voxel filter of the batchers")
+          ->Add({});
+  // From 1 ms to about 4 s.
+  kBatchLatencyMetric =
+      factory
+          ->NewHistogramFamily(
+              "cartographer_ros_sensor_data_batch_latency",
+              "Wall time in seconds the first data of a batch is held back",
+              carto::metrics::Histogram::ScaledPowersOf(2, 1e-3, 4.))
+          ->Add({});
+}
+
+SensorDataBatcher::SensorDataBatcher(
+    const SensorDataBatchingOptions& options,
+    carto::mapping::TrajectoryBuilderInterface* const trajectory_builder)
+    : options_(options),
+      max_batch_duration_(
+          carto::common::FromSeconds(options.max_batch_duration_sec)),
+      trajectory_builder_(trajectory_builder) {}
+
+SensorDataBatcher::~SensorDataBatcher() { Flush(); }
+
+void SensorDataBatcher::AddSensorData(
+    const std::string& sensor_id,
+    const carto::sensor::TimedPointCloudData& timed_point_cloud_data) {
+  if (options_.point_cloud_voxel_size > 0.f) {
+    Add(sensor_id, timed_point_cloud_data.time,
+        VoxelFilter(timed_point_cloud_data, options_.point_cloud_voxel_size));
+  } else {
+    Add(sensor_id, timed_point_cloud_data.time, timed_point_cloud_data);
+  }
+}
+
+void SensorDataBatcher::AddSensorData(const std::string& sensor_id,
+                                      const carto::sensor::ImuData& imu_data) {
+  Add(sensor_id, imu_data.time, imu_data);
+}
+
+void SensorDataBatcher::AddSensorData(
+    const std::string& sensor_id,
+    const carto::sensor::OdometryData& odometry_data) {
+  Add(sensor_id, odometry_data.time, odometry_data);
+}
+
+void SensorDataBatcher::AddSensorData(
+    const std::string& sensor_id,
+    const carto::sensor::FixedFramePoseData& fixed_frame_pose) {
+  absl::MutexLock lock(&mutex_);
+  FlushUnderLock();
+  trajectory_builder_->AddSensorData(sensor_id, fixed_frame_pose);
+}
+
+void SensorDataBatcher::AddSensorData(
+    const std::string& sensor_id,
+    const carto::sensor::LandmarkData& landmark_data) {
+  absl::MutexLock lock(&mutex_);
+  FlushUnderLock();
+  trajectory_builder_->AddSensorData(sensor_id, landmark_data);
+}
+
+void SensorDataBatcher::AddLocalSlamResultData(
+    std::unique_ptr<carto::mapping::LocalSlamResultData>
+        local_slam_result_data) {
+  absl::MutexLock lock(&mutex_);
+  FlushUnderLock();
+  trajectory_builder_->AddLocalSlamResultData(
+      std::move(local_slam_result_data));
+}
+
+void SensorDataBatcher::Flush() {
+  absl::MutexLock lock(&mutex_);
+  FlushUnderLock();
+}
+
+void SensorDataBatcher::Add(const std::string& sensor_id,
+                            const carto::common::Time time, Data data) {
+  absl::MutexLock lock(&mutex_);
+  if (batch_.empty()) {
+    batch_start_time_ = time;
+    batch_start_wall_time_ = absl::Now();
+  }
+  batch_.push_back(Entry{sensor_id, std::move(data)});
+  if (time - batch_start_time_ >= max_batch_duration_) {
+    FlushUnderLock();
+  }
+}
+
+void SensorDataBatcher::FlushUnderLock() {
+  if (batch_.empty()) {
+    return;
+  }
+  kBatchLatencyMetric->Observe(
+      absl::ToDoubleSeconds(absl::Now() - batch_start_wall_time_));
+  for (const Entry& entry : batch_) {
+    boost::apply_visitor(DataAdder(entry.sensor_id, trajectory_builder_),
+                         entry.data);
+  }
+  batch_.clear();
+}
+
+}  // namespace cartographer_ros
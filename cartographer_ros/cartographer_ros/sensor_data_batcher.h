@@ -0,0 +1,122 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SENSOR_DATA_BATCHER_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SENSOR_DATA_BATCHER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "boost/variant.hpp"
+#include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/time.h"
+#include "cartographer/mapping/trajectory_builder_interface.h"
+#include "cartographer/metrics/family_factory.h"
+#include "cartographer/sensor/imu_data.h"
+#include "cartographer/sensor/odometry_data.h"
+#include "cartographer/sensor/timed_point_cloud_data.h"
+
+namespace cartographer_ros {
+
+// How sensor data is handed to a trajectory builder which sends it elsewhere,
+// e.g. to a Cartographer server through gRPC.
+struct SensorDataBatchingOptions {
+  // Range, IMU and odometry data is held back until it spans this duration
+  // and then handed on at once, so that sending it can be coalesced. 0 hands
+  // on all data right away.
+  double max_batch_duration_sec = 0.;
+  // If positive, only the first point of each voxel of this edge length in the
+  // tracking frame is handed on.
+  float point_cloud_voxel_size = 0.f;
+};
+
+SensorDataBatchingOptions CreateSensorDataBatchingOptions(
+    ::cartographer::common::LuaParameterDictionary* lua_parameter_dictionary);
+
+bool IsSensorDataBatchingEnabled(const SensorDataBatchingOptions& options);
+
+// Registers the metrics of the estimated bytes handed on and of the time data
+// is held back.
+void RegisterSensorDataBatcherMetrics(
+    ::cartographer::metrics::FamilyFactory* factory);
+
+// Hands sensor data to 'trajectory_builder' in time-bounded batches, keeping
+// the order in which it was added. Other data flushes the batch before it is
+// handed on. The batch is flushed when this object is destroyed. Thread-safe.
+class SensorDataBatcher
+    : public ::cartographer::mapping::TrajectoryBuilderInterface {
+ public:
+  SensorDataBatcher(
+      const SensorDataBatchingOptions& options,
+      ::cartographer::mapping::TrajectoryBuilderInterface* trajectory_builder);
+  ~SensorDataBatcher() override;
+
+  SensorDataBatcher(const SensorDataBatcher&) = delete;
+  SensorDataBatcher& operator=(const SensorDataBatcher&) = delete;
+
+  void AddSensorData(const std::string& sensor_id,
+                     const ::cartographer::sensor::TimedPointCloudData&
+                         timed_point_cloud_data) override;
+  void AddSensorData(const std::string& sensor_id,
+                     const ::cartographer::sensor::ImuData& imu_data) override;
+  void AddSensorData(
+      const std::string& sensor_id,
+      const ::cartographer::sensor::OdometryData& odometry_data) override;
+  void AddSensorData(const std::string& sensor_id,
+                     const ::cartographer::sensor::FixedFramePoseData&
+                         fixed_frame_pose) override;
+  void AddSensorData(
+      const std::string& sensor_id,
+      const ::cartographer::sensor::LandmarkData& landmark_data) override;
+  void AddLocalSlamResultData(
+      std::unique_ptr<::cartographer::mapping::LocalSlamResultData>
+          local_slam_result_data) override;
+
+  // Hands on the batch.
+  void Flush() LOCKS_EXCLUDED(mutex_);
+
+ private:
+  using Data = boost::variant<::cartographer::sensor::TimedPointCloudData,
+                              ::cartographer::sensor::ImuData,
+                              ::cartographer::sensor::OdometryData>;
+
+  struct Entry {
+    std::string sensor_id;
+    Data data;
+  };
+
+  void Add(const std::string& sensor_id, ::cartographer::common::Time time,
+           Data data) LOCKS_EXCLUDED(mutex_);
+  void FlushUnderLock() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const SensorDataBatchingOptions options_;
+  const ::cartographer::common::Duration max_batch_duration_;
+  ::cartographer::mapping::TrajectoryBuilderInterface* const
+      trajectory_builder_;
+
+  // Held while handing on data, so that its order is kept.
+  absl::Mutex mutex_;
+  std::vector<Entry> batch_ GUARDED_BY(mutex_);
+  ::cartographer::common::Time batch_start_time_ GUARDED_BY(mutex_);
+  absl::Time batch_start_wall_time_ GUARDED_BY(mutex_);
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SENSOR_DATA_BATCHER_H
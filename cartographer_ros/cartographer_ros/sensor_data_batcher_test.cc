@@ -0,0 +1,105 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/sensor_data_batcher.h"
+
+#include <string>
+#include <vector>
+
+#include "cartographer/mapping/local_slam_result_data.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+namespace carto = ::cartographer;
+
+// Records the times of the range and IMU data it is given.
+class FakeTrajectoryBuilder
+    : public carto::mapping::TrajectoryBuilderInterface {
+ public:
+  void AddSensorData(
+      const std::string& sensor_id,
+      const carto::sensor::TimedPointCloudData& timed_point_cloud_data)
+      override {
+    times.push_back(timed_point_cloud_data.time);
+    num_points.push_back(timed_point_cloud_data.ranges.size());
+  }
+  void AddSensorData(const std::string& sensor_id,
+                     const carto::sensor::ImuData& imu_data) override {
+    times.push_back(imu_data.time);
+  }
+  void AddSensorData(
+      const std::string& sensor_id,
+      const carto::sensor::OdometryData& odometry_data) override {}
+  void AddSensorData(const std::string& sensor_id,
+                     const carto::sensor::FixedFramePoseData& fixed_frame_pose)
+      override {}
+  void AddSensorData(
+      const std::string& sensor_id,
+      const carto::sensor::LandmarkData& landmark_data) override {}
+  void AddLocalSlamResultData(
+      std::unique_ptr<carto::mapping::LocalSlamResultData>
+          local_slam_result_data) override {}
+
+  std::vector<carto::common::Time> times;
+  std::vector<size_t> num_points;
+};
+
+carto::sensor::ImuData CreateImuData(const double time_sec) {
+  return carto::sensor::ImuData{carto::common::FromUniversal(0) +
+                                    carto::common::FromSeconds(time_sec),
+                                Eigen::Vector3d::UnitZ(),
+                                Eigen::Vector3d::Zero()};
+}
+
+TEST(SensorDataBatcherTest, HandsOnBatchesInOrder) {
+  FakeTrajectoryBuilder trajectory_builder;
+  SensorDataBatchingOptions options;
+  options.max_batch_duration_sec = 0.1;
+  {
+    SensorDataBatcher batcher(options, &trajectory_builder);
+    batcher.AddSensorData("imu", CreateImuData(0.));
+    batcher.AddSensorData("imu", CreateImuData(0.05));
+    EXPECT_TRUE(trajectory_builder.times.empty());
+    batcher.AddSensorData("imu", CreateImuData(0.1));
+    ASSERT_EQ(3, trajectory_builder.times.size());
+    EXPECT_EQ(CreateImuData(0.05).time, trajectory_builder.times[1]);
+    batcher.AddSensorData("imu", CreateImuData(0.15));
+    EXPECT_EQ(3, trajectory_builder.times.size());
+  }
+  EXPECT_EQ(4, trajectory_builder.times.size());
+}
+
+TEST(SensorDataBatcherTest, FiltersPointClouds) {
+  FakeTrajectoryBuilder trajectory_builder;
+  SensorDataBatchingOptions options;
+  options.point_cloud_voxel_size = 0.1f;
+  SensorDataBatcher batcher(options, &trajectory_builder);
+  carto::sensor::TimedPointCloudData data{
+      carto::common::FromUniversal(0),
+      Eigen::Vector3f::Zero(),
+      {{Eigen::Vector3f(1.f, 1.f, 0.f), 0.f},
+       {Eigen::Vector3f(1.01f, 1.01f, 0.f), 0.f},
+       {Eigen::Vector3f(2.f, 1.f, 0.f), 0.f}},
+      {}};
+  batcher.AddSensorData("points2", data);
+  ASSERT_EQ(1, trajectory_builder.num_points.size());
+  EXPECT_EQ(2, trajectory_builder.num_points.front());
+}
+
+}  // namespace
+}  // namespace cartographer_ros
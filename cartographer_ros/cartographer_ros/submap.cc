@@ -16,21 +16,49 @@
 
 #include "cartographer_ros/submap.h"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "absl/memory/memory.h"
 #include "cartographer/common/port.h"
 #include "cartographer/transform/transform.h"
 #include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/submap_texture_codec.h"
+#include "cartographer_ros_msgs/BatchSubmapQuery.h"
 #include "cartographer_ros_msgs/StatusCode.h"
 #include "cartographer_ros_msgs/SubmapQuery.h"
 
 namespace cartographer_ros {
+namespace {
+
+// Without the batch query, this many submap queries are in flight at once.
+constexpr size_t kMaxConcurrentSubmapQueries = 6;
+
+std::unique_ptr<::cartographer::io::SubmapTextures> ToSubmapTextures(
+    const int submap_version,
+    const std::vector<::cartographer_ros_msgs::SubmapTexture>& textures) {
+  auto response = absl::make_unique<::cartographer::io::SubmapTextures>();
+  response->version = submap_version;
+  for (const auto& texture : textures) {
+    response->textures.emplace_back(::cartographer::io::SubmapTexture{
+        DecodeSubmapTextureCells(texture), texture.width, texture.height,
+        texture.resolution, ToRigid3d(texture.slice_pose)});
+  }
+  return response;
+}
+
+}  // namespace
 
 std::unique_ptr<::cartographer::io::SubmapTextures> FetchSubmapTextures(
     const ::cartographer::mapping::SubmapId& submap_id,
-    ros::ServiceClient* client) {
+    ros::ServiceClient* client, const uint8_t cells_encoding) {
   ::cartographer_ros_msgs::SubmapQuery srv;
   srv.request.trajectory_id = submap_id.trajectory_id;
   srv.request.submap_index = submap_id.submap_index;
+  srv.request.cells_encoding = cells_encoding;
   if (!client->call(srv) ||
       srv.response.status.code != ::cartographer_ros_msgs::StatusCode::OK) {
     return nullptr;
@@ -38,18 +66,74 @@ std::unique_ptr<::cartographer::io::SubmapTextures> FetchSubmapTextures(
   if (srv.response.textures.empty()) {
     return nullptr;
   }
-  auto response = absl::make_unique<::cartographer::io::SubmapTextures>();
-  response->version = srv.response.submap_version;
-  for (const auto& texture : srv.response.textures) {
-    const std::string compressed_cells(texture.cells.begin(),
-                                       texture.cells.end());
-    response->textures.emplace_back(::cartographer::io::SubmapTexture{
-        ::cartographer::io::UnpackTextureData(compressed_cells, texture.width,
-                                              texture.height),
-        texture.width, texture.height, texture.resolution,
-        ToRigid3d(texture.slice_pose)});
+  return ToSubmapTextures(srv.response.submap_version, srv.response.textures);
+}
+
+std::map<::cartographer::mapping::SubmapId,
+         std::unique_ptr<::cartographer::io::SubmapTextures>>
+FetchSubmapTextures(
+    const std::map<::cartographer::mapping::SubmapId, int>&
+        known_submap_versions,
+    ros::ServiceClient* batch_client, ros::ServiceClient* client,
+    const uint8_t cells_encoding) {
+  std::map<::cartographer::mapping::SubmapId,
+           std::unique_ptr<::cartographer::io::SubmapTextures>>
+      fetched_textures;
+  ::cartographer_ros_msgs::BatchSubmapQuery srv;
+  srv.request.cells_encoding = cells_encoding;
+  for (const auto& entry : known_submap_versions) {
+    srv.request.submaps.emplace_back();
+    auto& submap = srv.request.submaps.back();
+    submap.trajectory_id = entry.first.trajectory_id;
+    submap.submap_index = entry.first.submap_index;
+    submap.known_submap_version = entry.second;
   }
-  return response;
+  if (!batch_client->call(srv)) {
+    // Only checked after a failed call, so that the batch query costs no
+    // extra round trip while it is available.
+    if (batch_client->exists()) {
+      return fetched_textures;
+    }
+    const std::vector<std::pair<::cartographer::mapping::SubmapId, int>>
+        entries(known_submap_versions.begin(), known_submap_versions.end());
+    std::vector<std::unique_ptr<::cartographer::io::SubmapTextures>> textures(
+        entries.size());
+    // Each thread takes the next submap until all are fetched.
+    std::atomic<size_t> next_entry(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0;
+         i != std::min(entries.size(), kMaxConcurrentSubmapQueries); ++i) {
+      threads.emplace_back([&]() {
+        for (size_t j = next_entry++; j < entries.size(); j = next_entry++) {
+          textures[j] =
+              FetchSubmapTextures(entries[j].first, client, cells_encoding);
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    for (size_t i = 0; i != entries.size(); ++i) {
+      if (textures[i] != nullptr && textures[i]->version != entries[i].second) {
+        fetched_textures.emplace(entries[i].first, std::move(textures[i]));
+      }
+    }
+    return fetched_textures;
+  }
+  if (srv.response.status.code != ::cartographer_ros_msgs::StatusCode::OK) {
+    return fetched_textures;
+  }
+  for (const auto& result : srv.response.results) {
+    if (result.status.code != ::cartographer_ros_msgs::StatusCode::OK ||
+        result.textures.empty()) {
+      continue;
+    }
+    fetched_textures.emplace(
+        ::cartographer::mapping::SubmapId{result.trajectory_id,
+                                          result.submap_index},
+        ToSubmapTextures(result.submap_version, result.textures));
+  }
+  return fetched_textures;
 }
 
 }  // namespace cartographer_ros
@@ -17,6 +17,7 @@
 #ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_H
 #define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_H
 
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -25,15 +26,34 @@
 #include "cartographer/io/submap_painter.h"
 #include "cartographer/mapping/id.h"
 #include "cartographer/transform/rigid_transform.h"
+#include "cartographer_ros_msgs/SubmapTexture.h"
 #include "ros/ros.h"
 
 namespace cartographer_ros {
 
 // Fetch 'submap_id' using the 'client' and returning the response or 'nullptr'
-// on error.
+// on error. The cells are preferably transferred with 'cells_encoding', one of
+// the 'cartographer_ros_msgs::SubmapTexture' cells encodings.
 std::unique_ptr<::cartographer::io::SubmapTextures> FetchSubmapTextures(
     const ::cartographer::mapping::SubmapId& submap_id,
-    ros::ServiceClient* client);
+    ros::ServiceClient* client,
+    uint8_t cells_encoding =
+        ::cartographer_ros_msgs::SubmapTexture::CELLS_ENCODING_GZIP);
+
+// Fetches all submaps in 'known_submap_versions' whose version differs from
+// the given one, which is -1 if the caller has none, in a single call of the
+// batch query 'batch_client'. If the batch query service does not exist, e.g.
+// for an older node, each submap is fetched by a call of the submap query
+// 'client' instead, with several calls in flight at once. Submaps that are
+// unchanged or could not be fetched are missing in the returned map.
+std::map<::cartographer::mapping::SubmapId,
+         std::unique_ptr<::cartographer::io::SubmapTextures>>
+FetchSubmapTextures(
+    const std::map<::cartographer::mapping::SubmapId, int>&
+        known_submap_versions,
+    ros::ServiceClient* batch_client, ros::ServiceClient* client,
+    uint8_t cells_encoding =
+        ::cartographer_ros_msgs::SubmapTexture::CELLS_ENCODING_GZIP);
 
 }  // namespace cartographer_ros
 
@@ -0,0 +1,458 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_canvas.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+#include "cairo/cairo.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+using ::cartographer::io::SubmapSlice;
+using ::cartographer::mapping::SubmapId;
+
+// The canvas grows in steps of this many pixels in each direction. Also the
+// size of the tiles of 'TiledSubmapPainter'.
+constexpr int kTileSizePixels = 256;
+// Extra pixels around the area of each slice that its bilinear filtering can
+// touch.
+constexpr int kSliceMarginPixels = 2;
+// Border around all slices, as in '::cartographer::io::PaintSubmapSlices()'.
+constexpr int kPaddingPixels = 5;
+// If more than this fraction of the canvas changed, it is repainted at once.
+constexpr double kMaxDirtyFractionForPartialRepaint = 0.25;
+
+int FloorToTile(const int value) {
+  return static_cast<int>(
+             std::floor(static_cast<double>(value) / kTileSizePixels)) *
+         kTileSizePixels;
+}
+
+int CeilToTile(const int value) {
+  return static_cast<int>(
+             std::ceil(static_cast<double>(value) / kTileSizePixels)) *
+         kTileSizePixels;
+}
+
+Eigen::AlignedBox2i GrowToTiles(const Eigen::AlignedBox2i& box) {
+  return Eigen::AlignedBox2i(
+      Eigen::Vector2i(FloorToTile(box.min().x()), FloorToTile(box.min().y())),
+      Eigen::Vector2i(CeilToTile(box.max().x()), CeilToTile(box.max().y())));
+}
+
+int64_t Area(const Eigen::AlignedBox2i& box) {
+  if (box.isEmpty()) {
+    return 0;
+  }
+  const Eigen::Vector2i sizes = box.sizes();
+  return static_cast<int64_t>(sizes.x()) * sizes.y();
+}
+
+// Sets up 'cr' to paint 'submap_slice' at its pose onto a surface whose
+// origin is at the map frame origin, in the same way as
+// '::cartographer::io::PaintSubmapSlices()'.
+void TransformToSlice(const double scale, const SubmapSlice& submap_slice,
+                      cairo_t* cr) {
+  const ::cartographer::transform::Rigid3d pose =
+      submap_slice.pose * submap_slice.slice_pose;
+  const Eigen::Matrix4d homo =
+      (Eigen::Translation3d(pose.translation()) * pose.rotation()).matrix();
+  cairo_scale(cr, scale, scale);
+  cairo_matrix_t matrix;
+  cairo_matrix_init(&matrix, homo(1, 0), homo(0, 0), -homo(1, 1), -homo(0, 1),
+                    homo(0, 3), -homo(1, 3));
+  cairo_transform(cr, &matrix);
+  cairo_scale(cr, submap_slice.resolution, submap_slice.resolution);
+}
+
+void PaintBackground(cairo_t* cr) {
+  cairo_set_source_rgba(cr, 0.5, 0.0, 0.0, 1.);
+  cairo_paint(cr);
+}
+
+// Returns the pixels of the map frame that painting 'submap_slice' can touch.
+Eigen::AlignedBox2i ComputeBox(const double resolution,
+                               const SubmapSlice& submap_slice) {
+  auto surface = ::cartographer::io::MakeUniqueCairoSurfacePtr(
+      cairo_image_surface_create(::cartographer::io::kCairoFormat, 1, 1));
+  auto cr = ::cartographer::io::MakeUniqueCairoPtr(cairo_create(surface.get()));
+  TransformToSlice(1. / resolution, submap_slice, cr.get());
+  Eigen::AlignedBox2d box;
+  for (const Eigen::Vector2d& corner :
+       {Eigen::Vector2d(0., 0.), Eigen::Vector2d(submap_slice.width, 0.),
+        Eigen::Vector2d(0., submap_slice.height),
+        Eigen::Vector2d(submap_slice.width, submap_slice.height)}) {
+    double x = corner.x();
+    double y = corner.y();
+    cairo_user_to_device(cr.get(), &x, &y);
+    box.extend(Eigen::Vector2d(x, y));
+  }
+  return Eigen::AlignedBox2i(
+      Eigen::Vector2i(static_cast<int>(std::floor(box.min().x())),
+                      static_cast<int>(std::floor(box.min().y()))) -
+          Eigen::Vector2i::Constant(kSliceMarginPixels),
+      Eigen::Vector2i(static_cast<int>(std::ceil(box.max().x())),
+                      static_cast<int>(std::ceil(box.max().y()))) +
+          Eigen::Vector2i::Constant(kSliceMarginPixels));
+}
+
+}  // namespace
+
+SubmapCanvas::SubmapCanvas(const double resolution)
+    : resolution_(resolution),
+      canvas_(::cartographer::io::MakeUniqueCairoSurfacePtr(nullptr)) {}
+
+bool SubmapCanvas::Update(
+    const std::map<SubmapId, SubmapSlice>& submap_slices) {
+  return UpdateCanvas(submap_slices, nullptr);
+}
+
+bool SubmapCanvas::Update(const std::map<SubmapId, SubmapSlice>& submap_slices,
+                          const PixelBox& window) {
+  return UpdateCanvas(submap_slices, &window);
+}
+
+bool SubmapCanvas::UpdateCanvas(
+    const std::map<SubmapId, SubmapSlice>& submap_slices,
+    const PixelBox* const window) {
+  std::vector<PixelBox> dirty_boxes;
+  std::map<SubmapId, PaintedSlice> new_painted_slices;
+  PixelBox needed_box;
+  for (const auto& entry : submap_slices) {
+    const SubmapSlice& submap_slice = entry.second;
+    if (submap_slice.surface == nullptr) {
+      continue;
+    }
+    auto it = painted_slices_.find(entry.first);
+    if (it != painted_slices_.end() &&
+        it->second.version == submap_slice.version &&
+        it->second.pose.translation() == submap_slice.pose.translation() &&
+        it->second.pose.rotation().coeffs() ==
+            submap_slice.pose.rotation().coeffs()) {
+      needed_box.extend(it->second.box);
+      new_painted_slices.emplace(entry.first, it->second);
+      painted_slices_.erase(it);
+      continue;
+    }
+    if (it != painted_slices_.end()) {
+      dirty_boxes.push_back(it->second.box);
+      painted_slices_.erase(it);
+    }
+    const PixelBox box = ComputeBox(resolution_, submap_slice);
+    dirty_boxes.push_back(box);
+    needed_box.extend(box);
+    new_painted_slices.emplace(
+        entry.first,
+        PaintedSlice{submap_slice.pose, submap_slice.version, box});
+  }
+  // What is left in 'painted_slices_' has been removed.
+  for (const auto& entry : painted_slices_) {
+    dirty_boxes.push_back(entry.second.box);
+  }
+  painted_slices_ = std::move(new_painted_slices);
+  changed_box_.setEmpty();
+  reallocated_ = false;
+  bool repaint_all = false;
+  if (window == nullptr) {
+    if (dirty_boxes.empty() && canvas_ != nullptr) {
+      return false;
+    }
+    if (!needed_box.isEmpty()) {
+      needed_box.min() -= Eigen::Vector2i::Constant(kPaddingPixels);
+      needed_box.max() += Eigen::Vector2i::Constant(kPaddingPixels);
+    }
+    reallocated_ = GrowCanvas(needed_box);
+    repaint_all = reallocated_;
+  } else {
+    reallocated_ = MoveCanvas(*window, &dirty_boxes);
+    // Changes outside of the window need no repainting.
+    dirty_boxes.erase(
+        std::remove_if(dirty_boxes.begin(), dirty_boxes.end(),
+                       [this](const PixelBox& box) {
+                         return Area(box.intersection(canvas_box_)) == 0;
+                       }),
+        dirty_boxes.end());
+    if (dirty_boxes.empty()) {
+      return false;
+    }
+  }
+  int64_t dirty_area = 0;
+  for (const PixelBox& box : dirty_boxes) {
+    dirty_area += Area(box.intersection(canvas_box_));
+  }
+  if (repaint_all ||
+      dirty_area > kMaxDirtyFractionForPartialRepaint *
+                       static_cast<double>(Area(canvas_box_))) {
+    Repaint(canvas_box_, submap_slices);
+    changed_box_ = canvas_box_;
+  } else {
+    for (const PixelBox& box : dirty_boxes) {
+      const PixelBox clipped_box = box.intersection(canvas_box_);
+      Repaint(clipped_box, submap_slices);
+      if (!clipped_box.isEmpty()) {
+        changed_box_.extend(clipped_box);
+      }
+    }
+  }
+  cairo_surface_flush(canvas_.get());
+  return true;
+}
+
+::cartographer::io::PaintSubmapSlicesResult SubmapCanvas::GetResult() const {
+  CHECK(canvas_ != nullptr);
+  return ::cartographer::io::PaintSubmapSlicesResult(
+      ::cartographer::io::MakeUniqueCairoSurfacePtr(
+          cairo_surface_reference(canvas_.get())),
+      -canvas_box_.min().cast<float>().array());
+}
+
+SubmapCanvas::PixelBox SubmapCanvas::changed_box() const {
+  if (changed_box_.isEmpty()) {
+    return changed_box_;
+  }
+  return PixelBox(changed_box_.min() - canvas_box_.min(),
+                  changed_box_.max() - canvas_box_.min());
+}
+
+bool SubmapCanvas::GrowCanvas(const PixelBox& needed_box) {
+  if (canvas_ != nullptr &&
+      (needed_box.isEmpty() || canvas_box_.contains(needed_box))) {
+    return false;
+  }
+  PixelBox new_box = canvas_box_;
+  if (needed_box.isEmpty()) {
+    new_box.extend(Eigen::Vector2i::Zero());
+  } else {
+    new_box.extend(needed_box);
+  }
+  new_box = GrowToTiles(new_box);
+  if (new_box.isEmpty() || Area(new_box) == 0) {
+    new_box.max() = new_box.min() + Eigen::Vector2i::Constant(kTileSizePixels);
+  }
+  const Eigen::Vector2i sizes = new_box.sizes();
+  canvas_ = ::cartographer::io::MakeUniqueCairoSurfacePtr(
+      cairo_image_surface_create(::cartographer::io::kCairoFormat, sizes.x(),
+                                 sizes.y()));
+  canvas_box_ = new_box;
+  return true;
+}
+
+bool SubmapCanvas::MoveCanvas(const PixelBox& window,
+                              std::vector<PixelBox>* const dirty_boxes) {
+  PixelBox new_box = GrowToTiles(window);
+  if (Area(new_box) == 0) {
+    new_box.max() = new_box.min() + Eigen::Vector2i::Constant(kTileSizePixels);
+  }
+  if (canvas_ != nullptr && new_box.min() == canvas_box_.min() &&
+      new_box.max() == canvas_box_.max()) {
+    return false;
+  }
+  const Eigen::Vector2i sizes = new_box.sizes();
+  auto new_canvas = ::cartographer::io::MakeUniqueCairoSurfacePtr(
+      cairo_image_surface_create(::cartographer::io::kCairoFormat, sizes.x(),
+                                 sizes.y()));
+  PixelBox overlap;
+  if (canvas_ != nullptr) {
+    overlap = new_box.intersection(canvas_box_);
+  }
+  if (Area(overlap) == 0) {
+    dirty_boxes->push_back(new_box);
+  } else {
+    auto cr =
+        ::cartographer::io::MakeUniqueCairoPtr(cairo_create(new_canvas.get()));
+    const Eigen::Vector2i offset = canvas_box_.min() - new_box.min();
+    const Eigen::Vector2i min = overlap.min() - new_box.min();
+    const Eigen::Vector2i overlap_sizes = overlap.sizes();
+    cairo_set_operator(cr.get(), CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(cr.get(), canvas_.get(), offset.x(), offset.y());
+    cairo_rectangle(cr.get(), min.x(), min.y(), overlap_sizes.x(),
+                    overlap_sizes.y());
+    cairo_fill(cr.get());
+    // The parts of the new canvas around the overlap: above, below, left and
+    // right of it.
+    for (const PixelBox& box :
+         {PixelBox(new_box.min(),
+                   Eigen::Vector2i(new_box.max().x(), overlap.min().y())),
+          PixelBox(Eigen::Vector2i(new_box.min().x(), overlap.max().y()),
+                   new_box.max()),
+          PixelBox(Eigen::Vector2i(new_box.min().x(), overlap.min().y()),
+                   Eigen::Vector2i(overlap.min().x(), overlap.max().y())),
+          PixelBox(Eigen::Vector2i(overlap.max().x(), overlap.min().y()),
+                   Eigen::Vector2i(new_box.max().x(), overlap.max().y()))}) {
+      if (Area(box) != 0) {
+        dirty_boxes->push_back(box);
+      }
+    }
+  }
+  canvas_ = std::move(new_canvas);
+  canvas_box_ = new_box;
+  return true;
+}
+
+void SubmapCanvas::Repaint(
+    const PixelBox& box, const std::map<SubmapId, SubmapSlice>& submap_slices) {
+  if (box.isEmpty()) {
+    return;
+  }
+  auto cr = ::cartographer::io::MakeUniqueCairoPtr(cairo_create(canvas_.get()));
+  const Eigen::Vector2i min = box.min() - canvas_box_.min();
+  const Eigen::Vector2i sizes = box.sizes();
+  cairo_rectangle(cr.get(), min.x(), min.y(), sizes.x(), sizes.y());
+  cairo_clip(cr.get());
+  PaintBackground(cr.get());
+  cairo_translate(cr.get(), -canvas_box_.min().x(), -canvas_box_.min().y());
+  // Slices are painted over each other in the same order as by
+  // '::cartographer::io::PaintSubmapSlices()'.
+  for (const auto& entry : submap_slices) {
+    const auto it = painted_slices_.find(entry.first);
+    if (it == painted_slices_.end() || !it->second.box.intersects(box)) {
+      continue;
+    }
+    cairo_save(cr.get());
+    TransformToSlice(1. / resolution_, entry.second, cr.get());
+    cairo_set_source_surface(cr.get(), entry.second.surface.get(), 0., 0.);
+    cairo_paint(cr.get());
+    cairo_restore(cr.get());
+  }
+}
+
+SubmapCanvas::PixelBox ComputeWindow(const double resolution,
+                                     const Eigen::Vector2d& center,
+                                     const double size) {
+  // Pixels of the map frame grow with x and shrink with y, as set up by
+  // 'TransformToSlice()'.
+  const double half_size = 0.5 * size;
+  return SubmapCanvas::PixelBox(
+      Eigen::Vector2i(
+          static_cast<int>(std::floor((center.x() - half_size) / resolution)),
+          static_cast<int>(std::floor(-(center.y() + half_size) / resolution))),
+      Eigen::Vector2i(
+          static_cast<int>(std::ceil((center.x() + half_size) / resolution)),
+          static_cast<int>(std::ceil(-(center.y() - half_size) / resolution))));
+}
+
+TiledSubmapPainter::TiledSubmapPainter(
+    const std::map<SubmapId, SubmapSlice>& submap_slices,
+    const double resolution)
+    : resolution_(resolution) {
+  for (const auto& entry : submap_slices) {
+    // Slices without a texture yet are skipped like by 'SubmapCanvas'.
+    if (entry.second.surface == nullptr) {
+      continue;
+    }
+    slices_.push_back(
+        Slice{&entry.second, ComputeBox(resolution, entry.second)});
+    box_.extend(slices_.back().box);
+  }
+  if (box_.isEmpty()) {
+    box_.extend(Eigen::Vector2i::Zero());
+  }
+  box_.min() -= Eigen::Vector2i::Constant(kPaddingPixels);
+  box_.max() += Eigen::Vector2i::Constant(kPaddingPixels);
+}
+
+Eigen::Array2f TiledSubmapPainter::origin() const {
+  return -box_.min().cast<float>().array();
+}
+
+void TiledSubmapPainter::Paint(
+    const int num_threads,
+    const std::function<void(const Band&)>& handle_band) const {
+  CHECK_GT(num_threads, 0);
+  const int width = this->width();
+  const int num_tiles = (width + kTileSizePixels - 1) / kTileSizePixels;
+  std::vector<uint32_t> pixels(static_cast<size_t>(width) * kTileSizePixels);
+  for (int min_y = box_.min().y(); min_y < box_.max().y();
+       min_y += kTileSizePixels) {
+    const SubmapCanvas::PixelBox band_box(
+        Eigen::Vector2i(box_.min().x(), min_y),
+        Eigen::Vector2i(box_.max().x(),
+                        std::min(min_y + kTileSizePixels, box_.max().y())));
+    std::vector<const Slice*> band_slices;
+    for (const Slice& slice : slices_) {
+      if (slice.box.intersects(band_box)) {
+        band_slices.push_back(&slice);
+      }
+    }
+    std::atomic<int> next_tile(0);
+    const auto paint_tiles = [&]() {
+      for (int tile = next_tile++; tile < num_tiles; tile = next_tile++) {
+        const int min_x = box_.min().x() + tile * kTileSizePixels;
+        const SubmapCanvas::PixelBox tile_box(
+            Eigen::Vector2i(min_x, min_y),
+            Eigen::Vector2i(std::min(min_x + kTileSizePixels, box_.max().x()),
+                            band_box.max().y()));
+        PaintTile(tile_box, band_slices, width,
+                  pixels.data() + tile * kTileSizePixels);
+      }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < std::min(num_threads, num_tiles); ++i) {
+      threads.emplace_back(paint_tiles);
+    }
+    paint_tiles();
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    handle_band(Band{min_y - box_.min().y(), width, band_box.sizes().y(),
+                     pixels.data()});
+  }
+}
+
+void TiledSubmapPainter::PaintTile(const SubmapCanvas::PixelBox& tile_box,
+                                   const std::vector<const Slice*>& slices,
+                                   const int stride_pixels,
+                                   uint32_t* pixels) const {
+  const Eigen::Vector2i sizes = tile_box.sizes();
+  auto surface = ::cartographer::io::MakeUniqueCairoSurfacePtr(
+      cairo_image_surface_create_for_data(
+          reinterpret_cast<unsigned char*>(pixels),
+          ::cartographer::io::kCairoFormat, sizes.x(), sizes.y(),
+          stride_pixels * sizeof(uint32_t)));
+  auto cr = ::cartographer::io::MakeUniqueCairoPtr(cairo_create(surface.get()));
+  PaintBackground(cr.get());
+  cairo_translate(cr.get(), -tile_box.min().x(), -tile_box.min().y());
+  for (const Slice* slice : slices) {
+    if (!slice->box.intersects(tile_box)) {
+      continue;
+    }
+    // Other threads paint the same slice, so each tile gets its own surface
+    // sharing the pixels of the slice, which cairo only reads.
+    cairo_surface_t* const slice_surface = slice->submap_slice->surface.get();
+    auto source = ::cartographer::io::MakeUniqueCairoSurfacePtr(
+        cairo_image_surface_create_for_data(
+            cairo_image_surface_get_data(slice_surface),
+            cairo_image_surface_get_format(slice_surface),
+            cairo_image_surface_get_width(slice_surface),
+            cairo_image_surface_get_height(slice_surface),
+            cairo_image_surface_get_stride(slice_surface)));
+    cairo_save(cr.get());
+    TransformToSlice(1. / resolution_, *slice->submap_slice, cr.get());
+    cairo_set_source_surface(cr.get(), source.get(), 0., 0.);
+    cairo_paint(cr.get());
+    cairo_restore(cr.get());
+  }
+  cairo_surface_flush(surface.get());
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_CANVAS_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_CANVAS_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "Eigen/Core"
+#include "Eigen/Geometry"
+#include "cartographer/io/image.h"
+#include "cartographer/io/submap_painter.h"
+#include "cartographer/mapping/id.h"
+#include "cartographer/transform/rigid_transform.h"
+
+namespace cartographer_ros {
+
+// Paints submap slices like '::cartographer::io::PaintSubmapSlices()', but
+// keeps the painted canvas between calls to 'Update()'. Only the regions
+// covered by submaps that were added, removed, moved or changed their version
+// since the last update are repainted. The canvas grows by whole tiles as the
+// map expands and keeps its pixel grid fixed in the map frame.
+class SubmapCanvas {
+ public:
+  explicit SubmapCanvas(double resolution);
+
+  SubmapCanvas(const SubmapCanvas&) = delete;
+  SubmapCanvas& operator=(const SubmapCanvas&) = delete;
+
+  // A rectangle of pixels, 'max' is exclusive.
+  using PixelBox = Eigen::AlignedBox2i;
+
+  // Brings the canvas up to date with 'submap_slices'. Returns false if
+  // nothing had to be repainted.
+  bool Update(const std::map<::cartographer::mapping::SubmapId,
+                             ::cartographer::io::SubmapSlice>& submap_slices);
+
+  // Like 'Update()', but the canvas only covers 'window', given in pixels of
+  // the map frame and grown to whole tiles, and only slices intersecting it
+  // are painted. When the window moves to other tiles, the pixels still
+  // covered are kept and only the newly covered ones are painted. The canvas
+  // counts as reallocated then.
+  bool Update(const std::map<::cartographer::mapping::SubmapId,
+                             ::cartographer::io::SubmapSlice>& submap_slices,
+              const PixelBox& window);
+
+  // The current canvas, sharing its pixels with this object until the next
+  // 'Update()'. Must not be called before the first 'Update()'.
+  ::cartographer::io::PaintSubmapSlicesResult GetResult() const;
+
+  // Pixels of the surface returned by 'GetResult()' that were repainted by
+  // the last 'Update()'. If 'reallocated()' is true, the surface changed size
+  // or position and all its pixels should be considered changed.
+  PixelBox changed_box() const;
+  bool reallocated() const { return reallocated_; }
+
+ private:
+  struct PaintedSlice {
+    ::cartographer::transform::Rigid3d pose;
+    int version;
+    PixelBox box;
+  };
+
+  // Updates the whole map if 'window' is nullptr.
+  bool UpdateCanvas(
+      const std::map<::cartographer::mapping::SubmapId,
+                     ::cartographer::io::SubmapSlice>& submap_slices,
+      const PixelBox* window);
+  // Returns true if the canvas was reallocated, its contents are undefined
+  // then.
+  bool GrowCanvas(const PixelBox& needed_box);
+  // Returns true if the canvas was moved to cover 'window'. The pixels it
+  // covered before are kept, the boxes of the others are added to
+  // 'dirty_boxes'.
+  bool MoveCanvas(const PixelBox& window, std::vector<PixelBox>* dirty_boxes);
+  void Repaint(const PixelBox& box,
+               const std::map<::cartographer::mapping::SubmapId,
+                              ::cartographer::io::SubmapSlice>& submap_slices);
+
+  const double resolution_;
+  std::map<::cartographer::mapping::SubmapId, PaintedSlice> painted_slices_;
+  // Unless stated otherwise, 'PixelBox'es are in pixels of the map frame,
+  // i.e. independent of the canvas position. This is what 'canvas_' covers.
+  PixelBox canvas_box_;
+  PixelBox changed_box_;
+  bool reallocated_ = false;
+  ::cartographer::io::UniqueCairoSurfacePtr canvas_;
+};
+
+// Paints submap slices like '::cartographer::io::PaintSubmapSlices()', but in
+// bands of rows from top to bottom, so that only one band is in memory at a
+// time. Each band is split into tiles which are painted on several threads,
+// each tile only painting the slices overlapping it. The image covers the
+// areas of all slices plus a border; it can be a few pixels larger than the
+// one of '::cartographer::io::PaintSubmapSlices()'.
+class TiledSubmapPainter {
+ public:
+  // Rows of 'width' pixels in '::cartographer::io::kCairoFormat', starting at
+  // row 'y' of the image.
+  struct Band {
+    int y;
+    int width;
+    int height;
+    const uint32_t* pixels;
+  };
+
+  // 'submap_slices' must outlive this object.
+  TiledSubmapPainter(
+      const std::map<::cartographer::mapping::SubmapId,
+                     ::cartographer::io::SubmapSlice>& submap_slices,
+      double resolution);
+
+  TiledSubmapPainter(const TiledSubmapPainter&) = delete;
+  TiledSubmapPainter& operator=(const TiledSubmapPainter&) = delete;
+
+  int width() const { return box_.sizes().x(); }
+  int height() const { return box_.sizes().y(); }
+  // Pixel of the map frame origin, like 'PaintSubmapSlicesResult::origin'.
+  Eigen::Array2f origin() const;
+
+  // Paints the image using 'num_threads' threads and calls 'handle_band' for
+  // each band in order. The pixels are only valid during the call.
+  void Paint(int num_threads,
+             const std::function<void(const Band&)>& handle_band) const;
+
+ private:
+  struct Slice {
+    const ::cartographer::io::SubmapSlice* submap_slice;
+    SubmapCanvas::PixelBox box;
+  };
+
+  void PaintTile(const SubmapCanvas::PixelBox& tile_box,
+                 const std::vector<const Slice*>& slices, int stride_pixels,
+                 uint32_t* pixels) const;
+
+  const double resolution_;
+  // In the order they are painted over each other.
+  std::vector<Slice> slices_;
+  SubmapCanvas::PixelBox box_;
+};
+
+// Returns the pixels of the map frame at 'resolution' within the square of
+// 'size' meters centered at 'center' in the map frame.
+SubmapCanvas::PixelBox ComputeWindow(double resolution,
+                                     const Eigen::Vector2d& center,
+                                     double size);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_CANVAS_H
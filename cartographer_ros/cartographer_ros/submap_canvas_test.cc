@@ -0,0 +1,245 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_canvas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "cairo/cairo.h"
+#include "cartographer/io/image.h"
+#include "cartographer/io/submap_painter.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::io::PaintSubmapSlices;
+using ::cartographer::io::PaintSubmapSlicesResult;
+using ::cartographer::io::SubmapSlice;
+using ::cartographer::mapping::SubmapId;
+using ::cartographer::transform::Rigid3d;
+
+// Slices are at the painted resolution and at multiples of it, so that their
+// pixels line up with the ones of '::cartographer::io::PaintSubmapSlices()'.
+constexpr double kResolution = 0.25;
+constexpr int kSliceSizePixels = 64;
+
+// Returns an opaque slice with transparent cells in between, whose pixels
+// depend on 'pattern'.
+SubmapSlice CreateSlice(const Eigen::Vector2d& translation, const int version,
+                        const int pattern) {
+  SubmapSlice slice;
+  slice.width = kSliceSizePixels;
+  slice.height = kSliceSizePixels;
+  slice.version = version;
+  slice.metadata_version = version;
+  slice.resolution = kResolution;
+  slice.slice_pose = Rigid3d::Identity();
+  slice.pose = Rigid3d::Translation(
+      Eigen::Vector3d(translation.x(), translation.y(), 0.));
+  slice.cairo_data.resize(kSliceSizePixels * kSliceSizePixels);
+  for (int y = 0; y != kSliceSizePixels; ++y) {
+    for (int x = 0; x != kSliceSizePixels; ++x) {
+      uint32_t& pixel = slice.cairo_data[y * kSliceSizePixels + x];
+      if ((x + y + pattern) % 7 == 0) {
+        pixel = 0;
+        continue;
+      }
+      pixel = 0xff000000u | (static_cast<uint32_t>(pattern * 40) & 0xff) << 16 |
+              (static_cast<uint32_t>(x * 4) & 0xff) << 8 |
+              (static_cast<uint32_t>(y * 4) & 0xff);
+    }
+  }
+  slice.surface = ::cartographer::io::MakeUniqueCairoSurfacePtr(
+      cairo_image_surface_create_for_data(
+          reinterpret_cast<unsigned char*>(slice.cairo_data.data()),
+          ::cartographer::io::kCairoFormat, kSliceSizePixels, kSliceSizePixels,
+          cairo_format_stride_for_width(::cartographer::io::kCairoFormat,
+                                        kSliceSizePixels)));
+  return slice;
+}
+
+std::map<SubmapId, SubmapSlice> CreateSlices() {
+  std::map<SubmapId, SubmapSlice> submap_slices;
+  // Overlapping slices, then ones far apart.
+  submap_slices[SubmapId{0, 0}] = CreateSlice({0., 0.}, 1, 0);
+  submap_slices[SubmapId{0, 1}] = CreateSlice({10., 5.}, 1, 1);
+  submap_slices[SubmapId{0, 2}] = CreateSlice({40., -20.}, 1, 2);
+  submap_slices[SubmapId{1, 0}] = CreateSlice({80., 10.}, 1, 3);
+  submap_slices[SubmapId{1, 1}] = CreateSlice({120., 0.}, 1, 4);
+  return submap_slices;
+}
+
+uint32_t GetPixel(cairo_surface_t* const surface, const int x, const int y) {
+  const unsigned char* const row = cairo_image_surface_get_data(surface) +
+                                   y * cairo_image_surface_get_stride(surface);
+  return reinterpret_cast<const uint32_t*>(row)[x];
+}
+
+// Compares the pixels of the map frame covered by both images. Channels may
+// differ by one from rounding.
+void ExpectSamePixels(const PaintSubmapSlicesResult& expected,
+                      const PaintSubmapSlicesResult& actual) {
+  cairo_surface_t* const expected_surface = expected.surface.get();
+  cairo_surface_t* const actual_surface = actual.surface.get();
+  const Eigen::Vector2i offset(
+      std::lround(actual.origin.x() - expected.origin.x()),
+      std::lround(actual.origin.y() - expected.origin.y()));
+  int num_compared = 0;
+  int num_different = 0;
+  for (int y = 0; y != cairo_image_surface_get_height(expected_surface); ++y) {
+    for (int x = 0; x != cairo_image_surface_get_width(expected_surface);
+         ++x) {
+      const Eigen::Vector2i actual_pixel = Eigen::Vector2i(x, y) + offset;
+      if (actual_pixel.x() < 0 || actual_pixel.y() < 0 ||
+          actual_pixel.x() >= cairo_image_surface_get_width(actual_surface) ||
+          actual_pixel.y() >= cairo_image_surface_get_height(actual_surface)) {
+        continue;
+      }
+      ++num_compared;
+      const uint32_t expected_value = GetPixel(expected_surface, x, y);
+      const uint32_t actual_value =
+          GetPixel(actual_surface, actual_pixel.x(), actual_pixel.y());
+      for (int shift = 0; shift != 32; shift += 8) {
+        if (std::abs(static_cast<int>((expected_value >> shift) & 0xff) -
+                     static_cast<int>((actual_value >> shift) & 0xff)) > 1) {
+          ++num_different;
+          break;
+        }
+      }
+    }
+  }
+  EXPECT_GT(num_compared, 0);
+  EXPECT_EQ(num_different, 0);
+}
+
+TEST(SubmapCanvasTest, UpdateMatchesPaintSubmapSlices) {
+  const std::map<SubmapId, SubmapSlice> submap_slices = CreateSlices();
+  SubmapCanvas canvas(kResolution);
+  EXPECT_TRUE(canvas.Update(submap_slices));
+  EXPECT_TRUE(canvas.reallocated());
+  ExpectSamePixels(PaintSubmapSlices(submap_slices, kResolution),
+                   canvas.GetResult());
+  EXPECT_FALSE(canvas.Update(submap_slices));
+}
+
+TEST(SubmapCanvasTest, IncrementalUpdateMatchesPaintSubmapSlices) {
+  std::map<SubmapId, SubmapSlice> submap_slices = CreateSlices();
+  SubmapCanvas canvas(kResolution);
+  ASSERT_TRUE(canvas.Update(submap_slices));
+
+  // A new version of an overlapped slice, a moved slice, a removed slice and
+  // a new one within the canvas.
+  submap_slices[SubmapId{0, 0}] = CreateSlice({0., 0.}, 2, 5);
+  submap_slices[SubmapId{0, 2}].pose =
+      Rigid3d::Translation(Eigen::Vector3d(42., -19., 0.));
+  submap_slices.erase(SubmapId{1, 0});
+  submap_slices[SubmapId{1, 2}] = CreateSlice({100., -10.}, 1, 6);
+  EXPECT_TRUE(canvas.Update(submap_slices));
+  EXPECT_FALSE(canvas.reallocated());
+  EXPECT_FALSE(canvas.changed_box().isEmpty());
+  ExpectSamePixels(PaintSubmapSlices(submap_slices, kResolution),
+                   canvas.GetResult());
+
+  // A slice far outside of the canvas makes it grow.
+  submap_slices[SubmapId{2, 0}] = CreateSlice({-200., 150.}, 1, 7);
+  EXPECT_TRUE(canvas.Update(submap_slices));
+  EXPECT_TRUE(canvas.reallocated());
+  ExpectSamePixels(PaintSubmapSlices(submap_slices, kResolution),
+                   canvas.GetResult());
+}
+
+TEST(SubmapCanvasTest, ComputeWindow) {
+  const SubmapCanvas::PixelBox window =
+      ComputeWindow(kResolution, Eigen::Vector2d(1., 2.), 2.);
+  // The y axis of the pixels points down in the map frame.
+  EXPECT_EQ(window.min(), Eigen::Vector2i(0, -12));
+  EXPECT_EQ(window.max(), Eigen::Vector2i(12, -4));
+}
+
+TEST(SubmapCanvasTest, WindowedUpdateMatchesPaintSubmapSlices) {
+  std::map<SubmapId, SubmapSlice> submap_slices = CreateSlices();
+  const PaintSubmapSlicesResult expected =
+      PaintSubmapSlices(submap_slices, kResolution);
+  SubmapCanvas canvas(kResolution);
+  EXPECT_TRUE(canvas.Update(
+      submap_slices,
+      ComputeWindow(kResolution, Eigen::Vector2d(20., 0.), 40.)));
+  EXPECT_TRUE(canvas.reallocated());
+  ExpectSamePixels(expected, canvas.GetResult());
+  // The same tiles are covered, so nothing needs to be repainted.
+  EXPECT_FALSE(canvas.Update(
+      submap_slices,
+      ComputeWindow(kResolution, Eigen::Vector2d(21., 1.), 40.)));
+
+  // Moving the window keeps the pixels still covered and paints the others.
+  for (const double center_x : {60., 130.}) {
+    EXPECT_TRUE(canvas.Update(
+        submap_slices,
+        ComputeWindow(kResolution, Eigen::Vector2d(center_x, 0.), 40.)));
+    EXPECT_TRUE(canvas.reallocated());
+    ExpectSamePixels(expected, canvas.GetResult());
+  }
+
+  // Changes within the window are repainted, ones outside of it are not.
+  submap_slices[SubmapId{1, 1}] = CreateSlice({120., 0.}, 2, 5);
+  const SubmapCanvas::PixelBox window =
+      ComputeWindow(kResolution, Eigen::Vector2d(130., 0.), 40.);
+  EXPECT_TRUE(canvas.Update(submap_slices, window));
+  EXPECT_FALSE(canvas.reallocated());
+  ExpectSamePixels(PaintSubmapSlices(submap_slices, kResolution),
+                   canvas.GetResult());
+  submap_slices[SubmapId{0, 0}] = CreateSlice({0., 0.}, 2, 6);
+  EXPECT_FALSE(canvas.Update(submap_slices, window));
+}
+
+TEST(TiledSubmapPainterTest, MatchesPaintSubmapSlices) {
+  std::map<SubmapId, SubmapSlice> submap_slices = CreateSlices();
+  const PaintSubmapSlicesResult expected =
+      PaintSubmapSlices(submap_slices, kResolution);
+  // A slice whose texture was not received yet is not painted.
+  submap_slices[SubmapId{2, 0}] = SubmapSlice();
+  const TiledSubmapPainter painter(submap_slices, kResolution);
+  std::vector<uint32_t> pixels(static_cast<size_t>(painter.width()) *
+                               painter.height());
+  int next_y = 0;
+  painter.Paint(3 /* num_threads */, [&](const TiledSubmapPainter::Band& band) {
+    EXPECT_EQ(band.y, next_y);
+    EXPECT_EQ(band.width, painter.width());
+    std::copy(band.pixels, band.pixels + band.width * band.height,
+              pixels.begin() + band.y * band.width);
+    next_y += band.height;
+  });
+  ASSERT_EQ(next_y, painter.height());
+
+  const PaintSubmapSlicesResult actual(
+      ::cartographer::io::MakeUniqueCairoSurfacePtr(
+          cairo_image_surface_create_for_data(
+              reinterpret_cast<unsigned char*>(pixels.data()),
+              ::cartographer::io::kCairoFormat, painter.width(),
+              painter.height(),
+              painter.width() * static_cast<int>(sizeof(uint32_t)))),
+      painter.origin());
+  ExpectSamePixels(expected, actual);
+}
+
+}  // namespace
+}  // namespace cartographer_ros
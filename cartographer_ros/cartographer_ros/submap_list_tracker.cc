@@ -0,0 +1,85 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_list_tracker.h"
+
+#include "cartographer_ros/msg_conversion.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+using ::cartographer::transform::Rigid3d;
+
+bool IsSamePose(const Rigid3d& lhs, const Rigid3d& rhs) {
+  return lhs.translation() == rhs.translation() &&
+         lhs.rotation().coeffs() == rhs.rotation().coeffs();
+}
+
+}  // namespace
+
+cartographer_ros_msgs::SubmapListUpdate SubmapListTracker::GetUpdate(
+    const PoseGraphSnapshot& snapshot, const bool full) {
+  cartographer_ros_msgs::SubmapListUpdate submap_list_update;
+  submap_list_update.full = full;
+  submap_list_update.sequence_number = ++sequence_number_;
+  const auto& submap_poses = snapshot.submap_poses;
+  // Both are ordered by submap ID, so they are merged in one pass.
+  auto listed_it = listed_submaps_.begin();
+  const auto remove_listed_submaps_before =
+      [&](const ::cartographer::mapping::SubmapId* const submap_id) {
+        while (listed_it != listed_submaps_.end() &&
+               (submap_id == nullptr || listed_it->first < *submap_id)) {
+          cartographer_ros_msgs::SubmapId removed_submap;
+          removed_submap.trajectory_id = listed_it->first.trajectory_id;
+          removed_submap.submap_index = listed_it->first.submap_index;
+          submap_list_update.removed_submap.push_back(removed_submap);
+          listed_it = listed_submaps_.erase(listed_it);
+        }
+      };
+  for (const int trajectory_id : submap_poses.trajectory_ids()) {
+    const bool is_frozen = snapshot.IsTrajectoryFrozen(trajectory_id);
+    for (const auto& submap_id_pose : submap_poses.trajectory(trajectory_id)) {
+      const ::cartographer::mapping::SubmapId& submap_id = submap_id_pose.id;
+      remove_listed_submaps_before(&submap_id);
+      const ListedSubmap submap{submap_id_pose.data.version,
+                                submap_id_pose.data.pose, is_frozen};
+      bool changed = true;
+      if (listed_it != listed_submaps_.end() &&
+          listed_it->first == submap_id) {
+        const ListedSubmap& listed = listed_it->second;
+        changed = full || listed.version != submap.version ||
+                  listed.is_frozen != submap.is_frozen ||
+                  !IsSamePose(listed.pose, submap.pose);
+        listed_it->second = submap;
+      } else {
+        listed_it = listed_submaps_.emplace_hint(listed_it, submap_id, submap);
+      }
+      ++listed_it;
+      if (changed) {
+        submap_list_update.submap.push_back(ToSubmapEntry(
+            submap_id, submap.version, submap.pose, submap.is_frozen));
+      }
+    }
+  }
+  remove_listed_submaps_before(nullptr);
+  if (full) {
+    submap_list_update.removed_submap.clear();
+  }
+  return submap_list_update;
+}
+
+}  // namespace cartographer_ros
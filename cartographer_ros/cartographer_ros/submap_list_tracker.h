@@ -0,0 +1,59 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_LIST_TRACKER_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_LIST_TRACKER_H
+
+#include <cstdint>
+#include <map>
+
+#include "cartographer/mapping/id.h"
+#include "cartographer/transform/rigid_transform.h"
+#include "cartographer_ros/pose_graph_snapshot.h"
+#include "cartographer_ros_msgs/SubmapListUpdate.h"
+
+namespace cartographer_ros {
+
+// Keeps the submaps as they were last listed by 'GetUpdate()', so that an
+// update only has to list what changed since. Not thread-safe.
+class SubmapListTracker {
+ public:
+  SubmapListTracker() = default;
+
+  SubmapListTracker(const SubmapListTracker&) = delete;
+  SubmapListTracker& operator=(const SubmapListTracker&) = delete;
+
+  // Returns the next update to the submaps of 'snapshot'. It lists the
+  // submaps which were added or whose version, pose or frozen state changed,
+  // and the IDs of removed submaps. If 'full', it lists all submaps and no
+  // removed ones. The header is left to the caller.
+  cartographer_ros_msgs::SubmapListUpdate GetUpdate(
+      const PoseGraphSnapshot& snapshot, bool full);
+
+ private:
+  struct ListedSubmap {
+    int version;
+    ::cartographer::transform::Rigid3d pose;
+    bool is_frozen;
+  };
+
+  std::map<::cartographer::mapping::SubmapId, ListedSubmap> listed_submaps_;
+  uint64_t sequence_number_ = 0;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_LIST_TRACKER_H
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_list_tracker.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::mapping::PoseGraphInterface;
+using ::cartographer::mapping::SubmapId;
+using ::cartographer::transform::Rigid3d;
+
+void AddSubmap(const SubmapId& id, const int version, const double x,
+               PoseGraphSnapshot* const snapshot) {
+  snapshot->submap_poses.Insert(
+      id, PoseGraphInterface::SubmapPose{
+              version, Rigid3d::Translation(Eigen::Vector3d(x, 0., 0.))});
+}
+
+std::vector<SubmapId> GetListedIds(
+    const cartographer_ros_msgs::SubmapListUpdate& update) {
+  std::vector<SubmapId> ids;
+  for (const auto& submap : update.submap) {
+    ids.push_back(SubmapId{submap.trajectory_id, submap.submap_index});
+  }
+  return ids;
+}
+
+std::vector<SubmapId> GetRemovedIds(
+    const cartographer_ros_msgs::SubmapListUpdate& update) {
+  std::vector<SubmapId> ids;
+  for (const auto& submap : update.removed_submap) {
+    ids.push_back(SubmapId{submap.trajectory_id, submap.submap_index});
+  }
+  return ids;
+}
+
+TEST(SubmapListTrackerTest, ListsOnlyChangedSubmaps) {
+  SubmapListTracker tracker;
+  PoseGraphSnapshot snapshot;
+  AddSubmap({0, 0}, 1, 0., &snapshot);
+  AddSubmap({0, 1}, 1, 1., &snapshot);
+  AddSubmap({1, 0}, 1, 2., &snapshot);
+  auto update = tracker.GetUpdate(snapshot, false /* full */);
+  EXPECT_EQ(1u, update.sequence_number);
+  EXPECT_EQ(GetListedIds(update),
+            (std::vector<SubmapId>{{0, 0}, {0, 1}, {1, 0}}));
+  EXPECT_TRUE(update.removed_submap.empty());
+
+  update = tracker.GetUpdate(snapshot, false /* full */);
+  EXPECT_EQ(2u, update.sequence_number);
+  EXPECT_TRUE(update.submap.empty());
+  EXPECT_TRUE(update.removed_submap.empty());
+
+  // Changes the version of one submap, the pose of another and adds one.
+  PoseGraphSnapshot changed_snapshot;
+  AddSubmap({0, 0}, 2, 0., &changed_snapshot);
+  AddSubmap({0, 1}, 1, 1., &changed_snapshot);
+  AddSubmap({0, 2}, 1, 1.5, &changed_snapshot);
+  AddSubmap({1, 0}, 1, 2.5, &changed_snapshot);
+  update = tracker.GetUpdate(changed_snapshot, false /* full */);
+  EXPECT_EQ(GetListedIds(update),
+            (std::vector<SubmapId>{{0, 0}, {0, 2}, {1, 0}}));
+  EXPECT_EQ(2, update.submap[0].submap_version);
+  EXPECT_EQ(2.5, update.submap[2].pose.position.x);
+  EXPECT_TRUE(update.removed_submap.empty());
+}
+
+TEST(SubmapListTrackerTest, ListsFrozenStateChanges) {
+  SubmapListTracker tracker;
+  PoseGraphSnapshot snapshot;
+  AddSubmap({0, 0}, 1, 0., &snapshot);
+  AddSubmap({1, 0}, 1, 0., &snapshot);
+  tracker.GetUpdate(snapshot, false /* full */);
+  snapshot.trajectory_states[1] = PoseGraphInterface::TrajectoryState::FROZEN;
+  const auto update = tracker.GetUpdate(snapshot, false /* full */);
+  EXPECT_EQ(GetListedIds(update), (std::vector<SubmapId>{{1, 0}}));
+  EXPECT_TRUE(update.submap[0].is_frozen);
+}
+
+TEST(SubmapListTrackerTest, ListsRemovedSubmaps) {
+  SubmapListTracker tracker;
+  PoseGraphSnapshot snapshot;
+  AddSubmap({0, 0}, 1, 0., &snapshot);
+  AddSubmap({0, 1}, 1, 0., &snapshot);
+  AddSubmap({1, 0}, 1, 0., &snapshot);
+  AddSubmap({2, 0}, 1, 0., &snapshot);
+  tracker.GetUpdate(snapshot, false /* full */);
+
+  // Removes submaps before, between and after the remaining ones.
+  PoseGraphSnapshot trimmed_snapshot;
+  AddSubmap({0, 1}, 1, 0., &trimmed_snapshot);
+  AddSubmap({2, 0}, 1, 0., &trimmed_snapshot);
+  auto update = tracker.GetUpdate(trimmed_snapshot, false /* full */);
+  EXPECT_TRUE(update.submap.empty());
+  EXPECT_EQ(GetRemovedIds(update), (std::vector<SubmapId>{{0, 0}, {1, 0}}));
+
+  update = tracker.GetUpdate(PoseGraphSnapshot(), false /* full */);
+  EXPECT_EQ(GetRemovedIds(update), (std::vector<SubmapId>{{0, 1}, {2, 0}}));
+  update = tracker.GetUpdate(PoseGraphSnapshot(), false /* full */);
+  EXPECT_TRUE(update.removed_submap.empty());
+}
+
+TEST(SubmapListTrackerTest, FullUpdateListsAllSubmaps) {
+  SubmapListTracker tracker;
+  PoseGraphSnapshot snapshot;
+  AddSubmap({0, 0}, 1, 0., &snapshot);
+  AddSubmap({0, 1}, 1, 0., &snapshot);
+  tracker.GetUpdate(snapshot, false /* full */);
+
+  PoseGraphSnapshot trimmed_snapshot;
+  AddSubmap({0, 1}, 1, 0., &trimmed_snapshot);
+  auto update = tracker.GetUpdate(trimmed_snapshot, true /* full */);
+  EXPECT_TRUE(update.full);
+  EXPECT_EQ(GetListedIds(update), (std::vector<SubmapId>{{0, 1}}));
+  // Subscribers drop all submaps not in a full update.
+  EXPECT_TRUE(update.removed_submap.empty());
+  // The removed submap is not reported again by the next delta.
+  update = tracker.GetUpdate(trimmed_snapshot, false /* full */);
+  EXPECT_TRUE(update.submap.empty());
+  EXPECT_TRUE(update.removed_submap.empty());
+}
+
+}  // namespace
+}  // namespace cartographer_ros
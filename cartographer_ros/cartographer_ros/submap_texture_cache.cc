@@ -0,0 +1,113 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_texture_cache.h"
+
+#include <iterator>
+
+#include "cartographer_ros/metrics/trajectory_accounting.h"
+
+namespace cartographer_ros {
+
+SubmapTextureCache::SubmapTextureCache(const size_t max_num_bytes)
+    : max_num_bytes_(max_num_bytes) {}
+
+std::shared_ptr<const SubmapTextureCache::Textures> SubmapTextureCache::Get(
+    const ::cartographer::mapping::SubmapId& submap_id,
+    const int submap_version) {
+  absl::MutexLock lock(&mutex_);
+  const auto it = submap_id_to_entry_.find(submap_id);
+  if (it == submap_id_to_entry_.end() ||
+      it->second->submap_version != submap_version) {
+    return nullptr;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->textures;
+}
+
+std::shared_ptr<const SubmapTextureCache::Textures>
+SubmapTextureCache::GetAnyVersion(
+    const ::cartographer::mapping::SubmapId& submap_id,
+    int* const submap_version) {
+  absl::MutexLock lock(&mutex_);
+  const auto it = submap_id_to_entry_.find(submap_id);
+  if (it == submap_id_to_entry_.end()) {
+    return nullptr;
+  }
+  entries_.splice(entries_.begin(), entries_, it->second);
+  *submap_version = it->second->submap_version;
+  return it->second->textures;
+}
+
+std::map<::cartographer::mapping::SubmapId, int>
+SubmapTextureCache::GetVersions() const {
+  absl::MutexLock lock(&mutex_);
+  std::map<::cartographer::mapping::SubmapId, int> versions;
+  for (const Entry& entry : entries_) {
+    versions.emplace(entry.submap_id, entry.submap_version);
+  }
+  return versions;
+}
+
+void SubmapTextureCache::Insert(
+    const ::cartographer::mapping::SubmapId& submap_id,
+    const int submap_version, std::shared_ptr<const Textures> textures) {
+  size_t num_bytes = 0;
+  for (const auto& texture : *textures) {
+    num_bytes += texture.cells.size();
+  }
+  absl::MutexLock lock(&mutex_);
+  const auto it = submap_id_to_entry_.find(submap_id);
+  if (it != submap_id_to_entry_.end()) {
+    Erase(it->second);
+  }
+  if (num_bytes > max_num_bytes_) {
+    return;
+  }
+  while (num_bytes_ + num_bytes > max_num_bytes_) {
+    Erase(std::prev(entries_.end()));
+  }
+  entries_.push_front(
+      Entry{submap_id, submap_version, std::move(textures), num_bytes});
+  submap_id_to_entry_[submap_id] = entries_.begin();
+  num_bytes_ += num_bytes;
+  GetTrajectoryBytesMetric(submap_id.trajectory_id)->Increment(num_bytes);
+}
+
+size_t SubmapTextureCache::num_bytes() const {
+  absl::MutexLock lock(&mutex_);
+  return num_bytes_;
+}
+
+void SubmapTextureCache::Erase(const std::list<Entry>::iterator it) {
+  num_bytes_ -= it->num_bytes;
+  GetTrajectoryBytesMetric(it->submap_id.trajectory_id)
+      ->Decrement(it->num_bytes);
+  submap_id_to_entry_.erase(it->submap_id);
+  entries_.erase(it);
+}
+
+::cartographer::metrics::Gauge* SubmapTextureCache::GetTrajectoryBytesMetric(
+    const int trajectory_id) {
+  auto& metric = trajectory_bytes_metrics_[trajectory_id];
+  if (metric == nullptr) {
+    metric =
+        metrics::GetTrajectoryAccounting(trajectory_id).submap_texture_bytes;
+  }
+  return metric;
+}
+
+}  // namespace cartographer_ros
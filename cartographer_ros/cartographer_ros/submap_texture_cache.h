@@ -0,0 +1,97 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_TEXTURE_CACHE_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_TEXTURE_CACHE_H
+
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "cartographer/mapping/id.h"
+#include "cartographer/metrics/gauge.h"
+#include "cartographer_ros_msgs/SubmapTexture.h"
+
+namespace cartographer_ros {
+
+// Keeps the compressed textures of recently queried submaps, so that queries
+// for submaps that did not change do not have to create them again. Only the
+// latest known version of each submap is kept. When the cache holds more than
+// 'max_num_bytes' of cells, the least recently used submaps are evicted.
+//
+// This class is thread-safe.
+class SubmapTextureCache {
+ public:
+  using Textures = std::vector<cartographer_ros_msgs::SubmapTexture>;
+
+  explicit SubmapTextureCache(size_t max_num_bytes);
+
+  SubmapTextureCache(const SubmapTextureCache&) = delete;
+  SubmapTextureCache& operator=(const SubmapTextureCache&) = delete;
+
+  // Returns the textures of 'submap_id' at 'submap_version' or 'nullptr' if
+  // they are not cached.
+  std::shared_ptr<const Textures> Get(
+      const ::cartographer::mapping::SubmapId& submap_id, int submap_version)
+      LOCKS_EXCLUDED(mutex_);
+
+  // Returns the cached textures of 'submap_id' at whichever version they have
+  // and sets 'submap_version' to it, or 'nullptr' if they are not cached.
+  std::shared_ptr<const Textures> GetAnyVersion(
+      const ::cartographer::mapping::SubmapId& submap_id, int* submap_version)
+      LOCKS_EXCLUDED(mutex_);
+
+  // Returns the versions of the cached submaps.
+  std::map<::cartographer::mapping::SubmapId, int> GetVersions() const
+      LOCKS_EXCLUDED(mutex_);
+
+  // Replaces any cached textures of 'submap_id' by 'textures'.
+  void Insert(const ::cartographer::mapping::SubmapId& submap_id,
+              int submap_version, std::shared_ptr<const Textures> textures)
+      LOCKS_EXCLUDED(mutex_);
+
+  size_t num_bytes() const LOCKS_EXCLUDED(mutex_);
+
+ private:
+  struct Entry {
+    ::cartographer::mapping::SubmapId submap_id;
+    int submap_version;
+    std::shared_ptr<const Textures> textures;
+    size_t num_bytes;
+  };
+
+  void Erase(std::list<Entry>::iterator it) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Returns the gauge of the cached bytes of 'trajectory_id', which caches of
+  // several encodings add to.
+  ::cartographer::metrics::Gauge* GetTrajectoryBytesMetric(int trajectory_id)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const size_t max_num_bytes_;
+  mutable absl::Mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_ GUARDED_BY(mutex_);
+  std::map<::cartographer::mapping::SubmapId, std::list<Entry>::iterator>
+      submap_id_to_entry_ GUARDED_BY(mutex_);
+  size_t num_bytes_ GUARDED_BY(mutex_) = 0;
+  std::map<int, ::cartographer::metrics::Gauge*> trajectory_bytes_metrics_
+      GUARDED_BY(mutex_);
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_TEXTURE_CACHE_H
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_texture_cache.h"
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::mapping::SubmapId;
+
+std::shared_ptr<const SubmapTextureCache::Textures> MakeTextures(
+    const size_t num_bytes) {
+  auto textures = std::make_shared<SubmapTextureCache::Textures>(1);
+  textures->front().cells.resize(num_bytes);
+  return textures;
+}
+
+TEST(SubmapTextureCache, ReturnsOnlyCachedVersion) {
+  SubmapTextureCache cache(100);
+  const auto textures = MakeTextures(10);
+  cache.Insert(SubmapId{0, 1}, 3, textures);
+  EXPECT_EQ(textures, cache.Get(SubmapId{0, 1}, 3));
+  EXPECT_EQ(nullptr, cache.Get(SubmapId{0, 1}, 4));
+  EXPECT_EQ(nullptr, cache.Get(SubmapId{0, 2}, 3));
+  cache.Insert(SubmapId{0, 1}, 4, MakeTextures(20));
+  EXPECT_EQ(nullptr, cache.Get(SubmapId{0, 1}, 3));
+  EXPECT_NE(nullptr, cache.Get(SubmapId{0, 1}, 4));
+  EXPECT_EQ(20u, cache.num_bytes());
+}
+
+TEST(SubmapTextureCache, EvictsLeastRecentlyUsed) {
+  SubmapTextureCache cache(100);
+  cache.Insert(SubmapId{0, 0}, 1, MakeTextures(40));
+  cache.Insert(SubmapId{0, 1}, 1, MakeTextures(40));
+  EXPECT_NE(nullptr, cache.Get(SubmapId{0, 0}, 1));
+  cache.Insert(SubmapId{0, 2}, 1, MakeTextures(40));
+  EXPECT_NE(nullptr, cache.Get(SubmapId{0, 0}, 1));
+  EXPECT_EQ(nullptr, cache.Get(SubmapId{0, 1}, 1));
+  EXPECT_NE(nullptr, cache.Get(SubmapId{0, 2}, 1));
+  EXPECT_EQ(80u, cache.num_bytes());
+  // Textures larger than the whole cache are not kept.
+  cache.Insert(SubmapId{0, 3}, 1, MakeTextures(101));
+  EXPECT_EQ(nullptr, cache.Get(SubmapId{0, 3}, 1));
+  EXPECT_EQ(80u, cache.num_bytes());
+}
+
+TEST(SubmapTextureCache, ReturnsAnyVersion) {
+  SubmapTextureCache cache(100);
+  const auto textures = MakeTextures(10);
+  cache.Insert(SubmapId{0, 1}, 3, textures);
+  cache.Insert(SubmapId{0, 2}, 5, MakeTextures(10));
+  int submap_version = 0;
+  EXPECT_EQ(textures, cache.GetAnyVersion(SubmapId{0, 1}, &submap_version));
+  EXPECT_EQ(3, submap_version);
+  EXPECT_EQ(nullptr, cache.GetAnyVersion(SubmapId{0, 3}, &submap_version));
+  EXPECT_EQ((std::map<SubmapId, int>{{SubmapId{0, 1}, 3}, {SubmapId{0, 2}, 5}}),
+            cache.GetVersions());
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_texture_codec.h"
+
+#include <string>
+#include <vector>
+
+#include "boost/iostreams/device/array.hpp"
+#include "boost/iostreams/filter/gzip.hpp"
+#include "boost/iostreams/filtering_stream.hpp"
+#include "cartographer/common/port.h"
+#include "glog/logging.h"
+#include "roslz4/lz4s.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+using cartographer_ros_msgs::SubmapTexture;
+
+// LZ4 frames with blocks of up to 1 MiB, like rosbag uses.
+constexpr int kLz4BlockSizeId = 6;
+
+size_t GetNumCellBytes(const SubmapTexture& texture) {
+  CHECK_GE(texture.width, 0);
+  CHECK_GE(texture.height, 0);
+  // An intensity and an alpha byte per pixel.
+  return 2 * static_cast<size_t>(texture.width) * texture.height;
+}
+
+// Decompresses the cells of 'texture' into 'num_bytes' bytes at 'cells'.
+void DecompressCells(const SubmapTexture& texture, char* const cells,
+                     const size_t num_bytes) {
+  switch (texture.cells_encoding) {
+    case SubmapTexture::CELLS_ENCODING_GZIP: {
+      boost::iostreams::filtering_istream in;
+      in.push(boost::iostreams::gzip_decompressor());
+      in.push(boost::iostreams::array_source(
+          reinterpret_cast<const char*>(texture.cells.data()),
+          texture.cells.size()));
+      in.read(cells, num_bytes);
+      CHECK_EQ(static_cast<size_t>(in.gcount()), num_bytes)
+          << "Truncated submap cells.";
+      return;
+    }
+    case SubmapTexture::CELLS_ENCODING_LZ4: {
+      unsigned int decompressed_size = num_bytes;
+      // roslz4 only takes mutable input, but does not modify it.
+      CHECK_EQ(roslz4_buffToBuffDecompress(
+                   reinterpret_cast<char*>(
+                       const_cast<uint8_t*>(texture.cells.data())),
+                   texture.cells.size(), cells, &decompressed_size),
+               ROSLZ4_OK)
+          << "Invalid LZ4 submap cells.";
+      CHECK_EQ(decompressed_size, num_bytes) << "Truncated submap cells.";
+      return;
+    }
+  }
+  LOG(FATAL) << "Unknown submap cells encoding "
+             << static_cast<int>(texture.cells_encoding);
+}
+
+void CompressLz4(const std::string& input, std::vector<uint8_t>* const output) {
+  // Starts from the worst case of LZ4 blocks and grows if the frame overhead
+  // does not fit.
+  size_t capacity = input.size() + input.size() / 255 + 1024;
+  while (true) {
+    output->resize(capacity);
+    unsigned int output_size = capacity;
+    const int result = roslz4_buffToBuffCompress(
+        const_cast<char*>(input.data()), input.size(),
+        reinterpret_cast<char*>(output->data()), &output_size,
+        kLz4BlockSizeId);
+    if (result == ROSLZ4_OK) {
+      output->resize(output_size);
+      return;
+    }
+    CHECK_EQ(result, ROSLZ4_OUTPUT_SMALL) << "Failed to compress with LZ4.";
+    capacity *= 2;
+  }
+}
+
+}  // namespace
+
+bool IsSupportedCellsEncoding(const uint8_t cells_encoding) {
+  return cells_encoding == SubmapTexture::CELLS_ENCODING_GZIP ||
+         cells_encoding == SubmapTexture::CELLS_ENCODING_LZ4;
+}
+
+SubmapTexture EncodeSubmapTextureCells(const SubmapTexture& texture,
+                                       const uint8_t cells_encoding) {
+  CHECK(IsSupportedCellsEncoding(cells_encoding));
+  if (texture.cells_encoding == cells_encoding) {
+    return texture;
+  }
+  SubmapTexture result;
+  result.width = texture.width;
+  result.height = texture.height;
+  result.resolution = texture.resolution;
+  result.slice_pose = texture.slice_pose;
+  result.cells_encoding = cells_encoding;
+  std::string cells(GetNumCellBytes(texture), '\0');
+  DecompressCells(texture, &cells[0], cells.size());
+  switch (cells_encoding) {
+    case SubmapTexture::CELLS_ENCODING_GZIP: {
+      std::string compressed_cells;
+      ::cartographer::common::FastGzipString(cells, &compressed_cells);
+      result.cells.assign(compressed_cells.begin(), compressed_cells.end());
+      break;
+    }
+    case SubmapTexture::CELLS_ENCODING_LZ4:
+      CompressLz4(cells, &result.cells);
+      break;
+  }
+  return result;
+}
+
+::cartographer::io::SubmapTexture::Pixels DecodeSubmapTextureCells(
+    const SubmapTexture& texture) {
+  const size_t num_bytes = GetNumCellBytes(texture);
+  std::vector<char> cells(num_bytes);
+  DecompressCells(texture, cells.data(), num_bytes);
+  ::cartographer::io::SubmapTexture::Pixels pixels;
+  const size_t num_pixels = num_bytes / 2;
+  pixels.intensity.resize(num_pixels);
+  pixels.alpha.resize(num_pixels);
+  for (size_t i = 0; i < num_pixels; ++i) {
+    pixels.intensity[i] = cells[2 * i];
+    pixels.alpha[i] = cells[2 * i + 1];
+  }
+  return pixels;
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_TEXTURE_CODEC_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_TEXTURE_CODEC_H
+
+#include <cstdint>
+
+#include "cartographer/io/submap_painter.h"
+#include "cartographer_ros_msgs/SubmapTexture.h"
+
+namespace cartographer_ros {
+
+// Returns whether 'cells_encoding' is one of the supported
+// 'cartographer_ros_msgs::SubmapTexture::CELLS_ENCODING_*' constants.
+bool IsSupportedCellsEncoding(uint8_t cells_encoding);
+
+// Returns a copy of 'texture' with its cells in 'cells_encoding', which has
+// to be supported. LZ4 compresses submap cells less than gzip, but decodes
+// several times faster.
+cartographer_ros_msgs::SubmapTexture EncodeSubmapTextureCells(
+    const cartographer_ros_msgs::SubmapTexture& texture,
+    uint8_t cells_encoding);
+
+// Decompresses the cells of 'texture' straight from the message, in whichever
+// encoding they are.
+::cartographer::io::SubmapTexture::Pixels DecodeSubmapTextureCells(
+    const cartographer_ros_msgs::SubmapTexture& texture);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_SUBMAP_TEXTURE_CODEC_H
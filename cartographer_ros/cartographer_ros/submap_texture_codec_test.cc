@@ -0,0 +1,87 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_texture_codec.h"
+
+#include <string>
+#include <vector>
+
+#include "cartographer/common/port.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using cartographer_ros_msgs::SubmapTexture;
+
+constexpr int kWidth = 40;
+constexpr int kHeight = 30;
+
+// Returns a gzip texture as created from the submap protos.
+SubmapTexture MakeTexture(std::vector<char>* const intensity,
+                          std::vector<char>* const alpha) {
+  std::string cells;
+  for (int i = 0; i < kWidth * kHeight; ++i) {
+    intensity->push_back(static_cast<char>(i % 7 == 0 ? i : 0));
+    alpha->push_back(static_cast<char>(i % 13));
+    cells.push_back(intensity->back());
+    cells.push_back(alpha->back());
+  }
+  std::string compressed_cells;
+  ::cartographer::common::FastGzipString(cells, &compressed_cells);
+  SubmapTexture texture;
+  texture.cells.assign(compressed_cells.begin(), compressed_cells.end());
+  texture.width = kWidth;
+  texture.height = kHeight;
+  texture.resolution = 0.05;
+  texture.cells_encoding = SubmapTexture::CELLS_ENCODING_GZIP;
+  return texture;
+}
+
+TEST(SubmapTextureCodec, DecodesAllEncodings) {
+  std::vector<char> intensity;
+  std::vector<char> alpha;
+  const SubmapTexture gzip_texture = MakeTexture(&intensity, &alpha);
+  const SubmapTexture lz4_texture = EncodeSubmapTextureCells(
+      gzip_texture, SubmapTexture::CELLS_ENCODING_LZ4);
+  EXPECT_EQ(lz4_texture.cells_encoding, SubmapTexture::CELLS_ENCODING_LZ4);
+  EXPECT_EQ(lz4_texture.width, kWidth);
+  EXPECT_EQ(lz4_texture.height, kHeight);
+  EXPECT_EQ(lz4_texture.resolution, 0.05);
+  const SubmapTexture reencoded_texture = EncodeSubmapTextureCells(
+      lz4_texture, SubmapTexture::CELLS_ENCODING_GZIP);
+  for (const SubmapTexture& texture :
+       {gzip_texture, lz4_texture, reencoded_texture}) {
+    const auto pixels = DecodeSubmapTextureCells(texture);
+    EXPECT_EQ(pixels.intensity, intensity);
+    EXPECT_EQ(pixels.alpha, alpha);
+  }
+}
+
+TEST(SubmapTextureCodec, KeepsTexturesInRequestedEncoding) {
+  std::vector<char> intensity;
+  std::vector<char> alpha;
+  const SubmapTexture texture = MakeTexture(&intensity, &alpha);
+  EXPECT_EQ(
+      EncodeSubmapTextureCells(texture, SubmapTexture::CELLS_ENCODING_GZIP)
+          .cells,
+      texture.cells);
+  EXPECT_TRUE(IsSupportedCellsEncoding(SubmapTexture::CELLS_ENCODING_LZ4));
+  EXPECT_FALSE(IsSupportedCellsEncoding(17));
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_TEMPORARY_FILE_TEST_HELPERS_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_TEMPORARY_FILE_TEST_HELPERS_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+
+// Fixture for tests writing a single file, 'filename_', which lives in a
+// fresh directory that is removed with it after the test.
+class TemporaryFileTest : public ::testing::Test {
+ protected:
+  explicit TemporaryFileTest(const std::string& basename)
+      : basename_(basename) {}
+
+  void SetUp() override {
+    test_directory_ = std::string(P_tmpdir) + "/cartographer_ros_XXXXXX";
+    ASSERT_NE(mkdtemp(&test_directory_[0]), nullptr);
+    filename_ = test_directory_ + "/" + basename_;
+  }
+
+  void TearDown() override {
+    if (filename_.empty()) return;
+    std::remove(filename_.c_str());
+    std::remove(test_directory_.c_str());
+  }
+
+  std::string test_directory_;
+  std::string filename_;
+
+ private:
+  const std::string basename_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_TEMPORARY_FILE_TEST_HELPERS_H
@@ -16,38 +16,97 @@
 
 #include "cartographer_ros/tf_bridge.h"
 
+#include <algorithm>
+
 #include "absl/memory/memory.h"
+#include "cartographer_ros/metrics/latency.h"
+#include "cartographer_ros/metrics/trajectory_accounting.h"
 #include "cartographer_ros/msg_conversion.h"
 
 namespace cartographer_ros {
 
+namespace {
+
+// How long in sensor time a static transform is used before checking whether
+// it is still static.
+constexpr double kStaticTransformRevalidationPeriodSec = 1.;
+constexpr size_t kNumRecentTransforms = 8;
+
+}  // namespace
+
 TfBridge::TfBridge(const std::string& tracking_frame,
                    const double lookup_transform_timeout_sec,
-                   const tf2_ros::Buffer* buffer)
+                   const tf2_ros::BufferInterface* buffer,
+                   ::cartographer::metrics::Gauge* const lookup_cpu_seconds)
     : tracking_frame_(tracking_frame),
       lookup_transform_timeout_sec_(lookup_transform_timeout_sec),
-      buffer_(buffer) {}
+      buffer_(buffer),
+      lookup_cpu_seconds_(lookup_cpu_seconds) {}
 
 std::unique_ptr<::cartographer::transform::Rigid3d> TfBridge::LookupToTracking(
     const ::cartographer::common::Time time,
     const std::string& frame_id) const {
+  metrics::LatencyTimer latency_timer(metrics::LatencyStage::kTfLookup,
+                                      frame_id);
+  metrics::ThreadCpuTimer cpu_timer(lookup_cpu_seconds_);
+  const ::ros::Time requested_time = ToRos(time);
+  ::ros::Time latest_tf_time;
+  {
+    absl::MutexLock lock(&mutex_);
+    const FrameCache& frame_cache = frame_caches_[frame_id];
+    if (frame_cache.static_frame_id_to_tracking.has_value() &&
+        requested_time < frame_cache.static_valid_until) {
+      return absl::make_unique<::cartographer::transform::Rigid3d>(
+          frame_cache.static_frame_id_to_tracking.value());
+    }
+    for (const auto& entry : frame_cache.recent_frame_id_to_tracking) {
+      if (entry.first == requested_time) {
+        return absl::make_unique<::cartographer::transform::Rigid3d>(
+            entry.second);
+      }
+    }
+    latest_tf_time = frame_cache.latest_tf_time;
+  }
+
   ::ros::Duration timeout(lookup_transform_timeout_sec_);
-  std::unique_ptr<::cartographer::transform::Rigid3d> frame_id_to_tracking;
   try {
-    const ::ros::Time latest_tf_time =
-        buffer_
-            ->lookupTransform(tracking_frame_, frame_id, ::ros::Time(0.),
-                              timeout)
-            .header.stamp;
-    const ::ros::Time requested_time = ToRos(time);
+    if (latest_tf_time < requested_time) {
+      const geometry_msgs::TransformStamped latest_transform =
+          buffer_->lookupTransform(tracking_frame_, frame_id, ::ros::Time(0.),
+                                   timeout);
+      latest_tf_time = latest_transform.header.stamp;
+      absl::MutexLock lock(&mutex_);
+      FrameCache& frame_cache = frame_caches_[frame_id];
+      if (latest_tf_time.isZero()) {
+        // tf2 only reports no stamp if all transforms involved are static.
+        frame_cache.static_frame_id_to_tracking =
+            ToRigid3d(latest_transform);
+        frame_cache.static_valid_until =
+            requested_time +
+            ::ros::Duration(kStaticTransformRevalidationPeriodSec);
+        return absl::make_unique<::cartographer::transform::Rigid3d>(
+            frame_cache.static_frame_id_to_tracking.value());
+      }
+      frame_cache.static_frame_id_to_tracking.reset();
+      frame_cache.latest_tf_time =
+          std::max(frame_cache.latest_tf_time, latest_tf_time);
+    }
     if (latest_tf_time >= requested_time) {
       // We already have newer data, so we do not wait. Otherwise, we would wait
       // for the full 'timeout' even if we ask for data that is too old.
       timeout = ::ros::Duration(0.);
     }
-    return absl::make_unique<::cartographer::transform::Rigid3d>(
+    const ::cartographer::transform::Rigid3d frame_id_to_tracking =
         ToRigid3d(buffer_->lookupTransform(tracking_frame_, frame_id,
-                                           requested_time, timeout)));
+                                           requested_time, timeout));
+    absl::MutexLock lock(&mutex_);
+    auto& recent = frame_caches_[frame_id].recent_frame_id_to_tracking;
+    recent.emplace_back(requested_time, frame_id_to_tracking);
+    if (recent.size() > kNumRecentTransforms) {
+      recent.pop_front();
+    }
+    return absl::make_unique<::cartographer::transform::Rigid3d>(
+        frame_id_to_tracking);
   } catch (const tf2::TransformException& ex) {
     LOG(WARNING) << ex.what();
   }
@@ -17,32 +17,62 @@
 #ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_TF_BRIDGE_H
 #define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_TF_BRIDGE_H
 
+#include <deque>
+#include <map>
 #include <memory>
 
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "cartographer/metrics/gauge.h"
 #include "cartographer/transform/rigid_transform.h"
 #include "cartographer_ros/time_conversion.h"
-#include "tf2_ros/buffer.h"
+#include "tf2_ros/buffer_interface.h"
 
 namespace cartographer_ros {
 
 class TfBridge {
  public:
+  // The CPU time spent in lookups is added to 'lookup_cpu_seconds' unless it
+  // is 'nullptr'.
   TfBridge(const std::string& tracking_frame,
-           double lookup_transform_timeout_sec, const tf2_ros::Buffer* buffer);
+           double lookup_transform_timeout_sec,
+           const tf2_ros::BufferInterface* buffer,
+           ::cartographer::metrics::Gauge* lookup_cpu_seconds = nullptr);
   ~TfBridge() {}
 
   TfBridge(const TfBridge&) = delete;
   TfBridge& operator=(const TfBridge&) = delete;
 
   // Returns the transform for 'frame_id' to 'tracking_frame_' if it exists at
-  // 'time'.
+  // 'time'. Thread-safe.
   std::unique_ptr<::cartographer::transform::Rigid3d> LookupToTracking(
-      ::cartographer::common::Time time, const std::string& frame_id) const;
+      ::cartographer::common::Time time, const std::string& frame_id) const
+      LOCKS_EXCLUDED(mutex_);
 
  private:
+  struct FrameCache {
+    // Set if the transform to 'tracking_frame_' only consists of static
+    // transforms. It is looked up again once 'time' reaches
+    // 'static_valid_until', in case the frame became dynamic.
+    absl::optional<::cartographer::transform::Rigid3d>
+        static_frame_id_to_tracking;
+    ::ros::Time static_valid_until;
+    // Stamp of the latest transform seen, requests up to this time do not need
+    // to wait for data.
+    ::ros::Time latest_tf_time;
+    // The most recent results, since the same time is often requested for
+    // several sensors.
+    std::deque<std::pair<::ros::Time, ::cartographer::transform::Rigid3d>>
+        recent_frame_id_to_tracking;
+  };
+
   const std::string tracking_frame_;
   const double lookup_transform_timeout_sec_;
-  const tf2_ros::Buffer* const buffer_;
+  const tf2_ros::BufferInterface* const buffer_;
+  ::cartographer::metrics::Gauge* const lookup_cpu_seconds_;
+
+  mutable absl::Mutex mutex_;
+  mutable std::map<std::string, FrameCache> frame_caches_ GUARDED_BY(mutex_);
 };
 
 }  // namespace cartographer_ros
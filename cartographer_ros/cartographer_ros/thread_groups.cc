@@ -0,0 +1,196 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/thread_groups.h"
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+const std::vector<std::string>& GroupNames() {
+  static const std::vector<std::string> kGroupNames = {
+      kSensorIngestionThreadGroup, kPosePublishingThreadGroup,
+      kVisualizationThreadGroup, kBackgroundOptimizationThreadGroup};
+  return kGroupNames;
+}
+
+// Returns the sorted IDs of the threads of this process.
+std::vector<pid_t> ListThreadIds() {
+  std::vector<pid_t> thread_ids;
+  DIR* const directory = opendir("/proc/self/task");
+  if (directory == nullptr) {
+    LOG(WARNING) << "Cannot list the threads: " << std::strerror(errno);
+    return thread_ids;
+  }
+  while (const dirent* const entry = readdir(directory)) {
+    int thread_id;
+    if (absl::SimpleAtoi(entry->d_name, &thread_id)) {
+      thread_ids.push_back(thread_id);
+    }
+  }
+  closedir(directory);
+  std::sort(thread_ids.begin(), thread_ids.end());
+  return thread_ids;
+}
+
+void ApplyOptions(const std::string& group, const ThreadGroupOptions& options,
+                  const pid_t thread_id) {
+  if (!options.cpus.empty()) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (const int cpu : options.cpus) {
+      CPU_SET(cpu, &cpu_set);
+    }
+    if (sched_setaffinity(thread_id, sizeof(cpu_set), &cpu_set) != 0) {
+      LOG(WARNING) << "Cannot set the CPU affinity of thread " << thread_id
+                   << " of group '" << group << "': " << std::strerror(errno);
+    }
+  }
+  if (options.set_niceness &&
+      setpriority(PRIO_PROCESS, thread_id, options.niceness) != 0) {
+    LOG(WARNING) << "Cannot set the nice value of thread " << thread_id
+                 << " of group '" << group << "': " << std::strerror(errno);
+  }
+}
+
+// Returns the user and system CPU time in seconds used by the thread, or 0 if
+// it is not running anymore.
+double ReadCpuTimeSec(const pid_t thread_id) {
+  std::ifstream stat_file(absl::StrCat("/proc/self/task/", thread_id, "/stat"));
+  const std::string stat((std::istreambuf_iterator<char>(stat_file)),
+                         std::istreambuf_iterator<char>());
+  // The thread name in parentheses may contain spaces, the fields after it
+  // start with the state, the third field of the file.
+  const size_t name_end = stat.rfind(')');
+  if (name_end == std::string::npos) {
+    return 0.;
+  }
+  std::istringstream fields(stat.substr(name_end + 1));
+  std::string field;
+  for (int i = 3; i < 14; ++i) {
+    fields >> field;
+  }
+  unsigned long user_ticks = 0;
+  unsigned long system_ticks = 0;
+  fields >> user_ticks >> system_ticks;
+  return static_cast<double>(user_ticks + system_ticks) /
+         sysconf(_SC_CLK_TCK);
+}
+
+}  // namespace
+
+ThreadGroupOptions CreateThreadGroupOptions(
+    ::cartographer::common::LuaParameterDictionary* const
+        lua_parameter_dictionary) {
+  ThreadGroupOptions options;
+  if (lua_parameter_dictionary->HasKey("cpus")) {
+    const int num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    for (const double cpu : lua_parameter_dictionary->GetDictionary("cpus")
+                                ->GetArrayValuesAsDoubles()) {
+      CHECK_GE(cpu, 0);
+      CHECK_LT(cpu, std::min(num_cpus, CPU_SETSIZE));
+      options.cpus.push_back(static_cast<int>(cpu));
+    }
+  }
+  if (lua_parameter_dictionary->HasKey("niceness")) {
+    options.set_niceness = true;
+    options.niceness = lua_parameter_dictionary->GetInt("niceness");
+    CHECK_GE(options.niceness, -20);
+    CHECK_LE(options.niceness, 19);
+  }
+  return options;
+}
+
+std::map<std::string, ThreadGroupOptions> CreateThreadGroupsOptions(
+    ::cartographer::common::LuaParameterDictionary* const
+        lua_parameter_dictionary) {
+  std::map<std::string, ThreadGroupOptions> options;
+  for (const std::string& group : lua_parameter_dictionary->GetKeys()) {
+    CHECK(std::find(GroupNames().begin(), GroupNames().end(), group) !=
+          GroupNames().end())
+        << "Unknown thread group '" << group << "'.";
+    options.emplace(group, CreateThreadGroupOptions(
+                               lua_parameter_dictionary->GetDictionary(group)
+                                   .get()));
+  }
+  return options;
+}
+
+ThreadGroups::ThreadGroups(
+    const std::map<std::string, ThreadGroupOptions>& options)
+    : options_(options) {}
+
+void ThreadGroups::Capture(const std::string& group,
+                           const std::function<void()>& start_threads) {
+  absl::MutexLock lock(&mutex_);
+  const std::vector<pid_t> thread_ids_before = ListThreadIds();
+  start_threads();
+  const std::vector<pid_t> thread_ids_after = ListThreadIds();
+  std::vector<pid_t> started_thread_ids;
+  std::set_difference(thread_ids_after.begin(), thread_ids_after.end(),
+                      thread_ids_before.begin(), thread_ids_before.end(),
+                      std::back_inserter(started_thread_ids));
+  const auto it = options_.find(group);
+  for (const pid_t thread_id : started_thread_ids) {
+    if (it != options_.end()) {
+      ApplyOptions(group, it->second, thread_id);
+    }
+    thread_ids_[group].push_back(thread_id);
+  }
+}
+
+void ThreadGroups::RegisterMetrics(
+    ::cartographer::metrics::FamilyFactory* const factory) {
+  auto* const family = factory->NewGaugeFamily(
+      "cartographer_ros_thread_group_cpu_seconds",
+      "CPU time in seconds used by the running threads of a group");
+  absl::MutexLock lock(&mutex_);
+  for (const std::string& group : GroupNames()) {
+    cpu_time_metrics_[group] = family->Add({{"group", group}});
+  }
+}
+
+void ThreadGroups::UpdateMetrics() {
+  absl::MutexLock lock(&mutex_);
+  for (const auto& entry : cpu_time_metrics_) {
+    double cpu_time_sec = 0.;
+    const auto it = thread_ids_.find(entry.first);
+    if (it != thread_ids_.end()) {
+      for (const pid_t thread_id : it->second) {
+        cpu_time_sec += ReadCpuTimeSec(thread_id);
+      }
+    }
+    entry.second->Set(cpu_time_sec);
+  }
+}
+
+}  // namespace cartographer_ros
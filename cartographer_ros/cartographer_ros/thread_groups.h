@@ -0,0 +1,101 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_THREAD_GROUPS_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_THREAD_GROUPS_H
+
+#include <sys/types.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/metrics/family_factory.h"
+#include "cartographer/metrics/gauge.h"
+
+namespace cartographer_ros {
+
+// Names of the thread groups of the node.
+// Threads spinning the range data and sensor callback queues.
+constexpr char kSensorIngestionThreadGroup[] = "sensor_ingestion";
+// The thread publishing the poses and tf.
+constexpr char kPosePublishingThreadGroup[] = "pose_publishing";
+// Threads publishing the submap list, markers and metrics and spinning the
+// service callback queue.
+constexpr char kVisualizationThreadGroup[] = "visualization";
+// The thread pool of the map builder, e.g. running the optimization.
+constexpr char kBackgroundOptimizationThreadGroup[] =
+    "background_optimization";
+
+// How the threads of a group are scheduled.
+struct ThreadGroupOptions {
+  // CPUs the threads may run on, all if empty.
+  std::vector<int> cpus;
+  // Nice value set for the threads if 'set_niceness'. Negative values usually
+  // need CAP_SYS_NICE.
+  bool set_niceness = false;
+  int niceness = 0;
+};
+
+ThreadGroupOptions CreateThreadGroupOptions(
+    ::cartographer::common::LuaParameterDictionary* lua_parameter_dictionary);
+
+// Reads the options of the named groups from 'lua_parameter_dictionary', only
+// the group names above are valid.
+std::map<std::string, ThreadGroupOptions> CreateThreadGroupsOptions(
+    ::cartographer::common::LuaParameterDictionary* lua_parameter_dictionary);
+
+// Assigns the threads of the process to named groups, schedules them according
+// to the options of their group and reports the CPU time they used.
+//
+// Threads are found by comparing the threads of the process before and after
+// they are started, so threads started at the same time by other code are
+// assigned to the group as well.
+class ThreadGroups {
+ public:
+  explicit ThreadGroups(
+      const std::map<std::string, ThreadGroupOptions>& options);
+
+  ThreadGroups(const ThreadGroups&) = delete;
+  ThreadGroups& operator=(const ThreadGroups&) = delete;
+
+  // Calls 'start_threads' and adds the threads it started to 'group'.
+  void Capture(const std::string& group,
+               const std::function<void()>& start_threads)
+      LOCKS_EXCLUDED(mutex_);
+
+  // Adds a gauge of the CPU time of each group to 'factory'.
+  void RegisterMetrics(::cartographer::metrics::FamilyFactory* factory)
+      LOCKS_EXCLUDED(mutex_);
+  // Sets the gauges to the CPU time in seconds used by the threads of each
+  // group which are still running.
+  void UpdateMetrics() LOCKS_EXCLUDED(mutex_);
+
+ private:
+  const std::map<std::string, ThreadGroupOptions> options_;
+  absl::Mutex mutex_;
+  // Keyed with the group name.
+  std::map<std::string, std::vector<pid_t>> thread_ids_ GUARDED_BY(mutex_);
+  std::map<std::string, ::cartographer::metrics::Gauge*> cpu_time_metrics_
+      GUARDED_BY(mutex_);
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_THREAD_GROUPS_H
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/thread_groups.h"
+
+#include <sched.h>
+
+#include <thread>
+
+#include "absl/synchronization/notification.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+TEST(ThreadGroupsTest, AppliesOptionsToStartedThreads) {
+  ThreadGroupOptions options;
+  options.cpus = {0};
+  ThreadGroups thread_groups({{kVisualizationThreadGroup, options}});
+  absl::Notification captured;
+  bool pinned = false;
+  std::thread thread;
+  thread_groups.Capture(kVisualizationThreadGroup, [&]() {
+    thread = std::thread([&]() {
+      captured.WaitForNotification();
+      cpu_set_t cpu_set;
+      ASSERT_EQ(0, sched_getaffinity(0, sizeof(cpu_set), &cpu_set));
+      pinned = CPU_COUNT(&cpu_set) == 1 && CPU_ISSET(0, &cpu_set);
+    });
+  });
+  captured.Notify();
+  thread.join();
+  EXPECT_TRUE(pinned);
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/tiled_probability_grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include "absl/memory/memory.h"
+#include "cartographer/mapping/2d/probability_grid.h"
+#include "cartographer/mapping/probability_values.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace carto = ::cartographer;
+
+namespace {
+
+// Cells around the range data that are part of the grid each batch is first
+// inserted into, so that it does not need to grow.
+constexpr int kMarginCells = 2;
+
+int FloorDiv(const int value, const int divisor) {
+  return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+}  // namespace
+
+constexpr int TiledProbabilityGrid::kTileSizeCells;
+
+TiledProbabilityGrid::TiledProbabilityGrid(
+    const double resolution,
+    const carto::mapping::proto::ProbabilityGridRangeDataInserterOptions2D&
+        range_data_inserter_options,
+    const int max_tiles_in_memory)
+    : resolution_(resolution),
+      max_tiles_in_memory_(max_tiles_in_memory),
+      hit_table_(
+          carto::mapping::ComputeLookupTableToApplyCorrespondenceCostOdds(
+              carto::mapping::Odds(
+                  range_data_inserter_options.hit_probability()))),
+      miss_table_(
+          carto::mapping::ComputeLookupTableToApplyCorrespondenceCostOdds(
+              carto::mapping::Odds(
+                  range_data_inserter_options.miss_probability()))),
+      range_data_inserter_(range_data_inserter_options) {
+  CHECK_GT(resolution_, 0.);
+  CHECK_GT(max_tiles_in_memory_, 0);
+}
+
+TiledProbabilityGrid::~TiledProbabilityGrid() {
+  if (file_ != nullptr) {
+    std::fclose(file_);
+  }
+}
+
+TiledProbabilityGrid::Updates TiledProbabilityGrid::ComputeUpdates(
+    const carto::sensor::RangeData& range_data) const {
+  Eigen::AlignedBox2f bounding_box(range_data.origin.head<2>());
+  for (const carto::sensor::RangefinderPoint& hit : range_data.returns) {
+    bounding_box.extend(hit.position.head<2>());
+  }
+  for (const carto::sensor::RangefinderPoint& miss : range_data.misses) {
+    bounding_box.extend(miss.position.head<2>());
+  }
+
+  // The range data is first inserted into a grid only covering it. Its limits
+  // are at multiples of the resolution, so that its cells are cells of the
+  // tiles. Since each cell is updated at most once per insertion, the updates
+  // can then be replayed onto the tiles.
+  const int max_x = static_cast<int>(
+                        std::ceil(bounding_box.max().x() / resolution_)) +
+                    kMarginCells;
+  const int max_y = static_cast<int>(
+                        std::ceil(bounding_box.max().y() / resolution_)) +
+                    kMarginCells;
+  const int min_x = static_cast<int>(
+                        std::floor(bounding_box.min().x() / resolution_)) -
+                    kMarginCells;
+  const int min_y = static_cast<int>(
+                        std::floor(bounding_box.min().y() / resolution_)) -
+                    kMarginCells;
+  const carto::mapping::MapLimits limits(
+      resolution_, Eigen::Vector2d(max_x, max_y) * resolution_,
+      carto::mapping::CellLimits(max_y - min_y, max_x - min_x));
+  std::unique_ptr<carto::mapping::ProbabilityGrid> grid;
+  {
+    absl::MutexLock lock(&conversion_tables_mutex_);
+    grid = absl::make_unique<carto::mapping::ProbabilityGrid>(
+        limits, &conversion_tables_);
+  }
+  range_data_inserter_.Insert(range_data, grid.get());
+
+  // The grid may still have grown, which moves its maximum by whole cells.
+  const Eigen::Array2i grid_max =
+      (grid->limits().max() / resolution_).array().round().cast<int>();
+  const Eigen::Array2i grid_to_tiles(-grid_max.y(), -grid_max.x());
+  Eigen::Array2i offset;
+  carto::mapping::CellLimits cell_limits;
+  grid->ComputeCroppedLimits(&offset, &cell_limits);
+  const Eigen::Array2i min = offset + grid_to_tiles;
+  const Eigen::Array2i max =
+      min + Eigen::Array2i(cell_limits.num_x_cells, cell_limits.num_y_cells) -
+      1;
+
+  const float hit_correspondence_cost =
+      carto::mapping::ValueToCorrespondenceCost(
+          hit_table_[carto::mapping::kUnknownCorrespondenceValue] -
+          carto::mapping::kUpdateMarker);
+  Updates updates;
+  for (int tile_x = FloorDiv(min.x(), kTileSizeCells);
+       tile_x <= FloorDiv(max.x(), kTileSizeCells); ++tile_x) {
+    for (int tile_y = FloorDiv(min.y(), kTileSizeCells);
+         tile_y <= FloorDiv(max.y(), kTileSizeCells); ++tile_y) {
+      const int tile_min_x = tile_x * kTileSizeCells;
+      const int tile_min_y = tile_y * kTileSizeCells;
+      for (int x = std::max(min.x(), tile_min_x);
+           x <= std::min(max.x(), tile_min_x + kTileSizeCells - 1); ++x) {
+        for (int y = std::max(min.y(), tile_min_y);
+             y <= std::min(max.y(), tile_min_y + kTileSizeCells - 1); ++y) {
+          const Eigen::Array2i grid_cell = Eigen::Array2i(x, y) - grid_to_tiles;
+          if (!grid->IsKnown(grid_cell)) {
+            continue;
+          }
+          updates.cells.emplace_back(x, y);
+          updates.hits.push_back(grid->GetCorrespondenceCost(grid_cell) ==
+                                 hit_correspondence_cost);
+        }
+      }
+    }
+  }
+  return updates;
+}
+
+void TiledProbabilityGrid::ApplyUpdates(const Updates& updates) {
+  CHECK_EQ(updates.cells.size(), updates.hits.size());
+  Tile* tile = nullptr;
+  TileIndex tile_index;
+  for (size_t i = 0; i < updates.cells.size(); ++i) {
+    const Eigen::Array2i& cell = updates.cells[i];
+    const TileIndex cell_tile_index(FloorDiv(cell.x(), kTileSizeCells),
+                                    FloorDiv(cell.y(), kTileSizeCells));
+    // Cells are ordered by tile, so each tile is only looked up once.
+    if (tile == nullptr || cell_tile_index != tile_index) {
+      tile_index = cell_tile_index;
+      tile = GetTile(tile_index, true /* create */);
+    }
+    const std::vector<uint16_t>& table =
+        updates.hits[i] ? hit_table_ : miss_table_;
+    uint16_t& value =
+        tile->cells[(cell.x() - tile_index.first * kTileSizeCells) *
+                        kTileSizeCells +
+                    (cell.y() - tile_index.second * kTileSizeCells)];
+    value = table[value] - carto::mapping::kUpdateMarker;
+    known_cells_box_.extend(cell.matrix());
+  }
+}
+
+std::vector<uint16_t> TiledProbabilityGrid::GetCorrespondenceCostValues(
+    const Eigen::AlignedBox2i& cells) {
+  if (cells.isEmpty()) {
+    return {};
+  }
+  const Eigen::Vector2i sizes = cells.sizes() + Eigen::Vector2i::Ones();
+  std::vector<uint16_t> values(static_cast<size_t>(sizes.x()) * sizes.y(),
+                               carto::mapping::kUnknownCorrespondenceValue);
+  for (int tile_x = FloorDiv(cells.min().x(), kTileSizeCells);
+       tile_x <= FloorDiv(cells.max().x(), kTileSizeCells); ++tile_x) {
+    for (int tile_y = FloorDiv(cells.min().y(), kTileSizeCells);
+         tile_y <= FloorDiv(cells.max().y(), kTileSizeCells); ++tile_y) {
+      const Tile* const tile =
+          GetTile(TileIndex(tile_x, tile_y), false /* create */);
+      if (tile == nullptr) {
+        continue;
+      }
+      const int tile_min_x = tile_x * kTileSizeCells;
+      const int tile_min_y = tile_y * kTileSizeCells;
+      const int begin_y = std::max(cells.min().y(), tile_min_y);
+      const int end_y =
+          std::min(cells.max().y(), tile_min_y + kTileSizeCells - 1) + 1;
+      for (int x = std::max(cells.min().x(), tile_min_x);
+           x <= std::min(cells.max().x(), tile_min_x + kTileSizeCells - 1);
+           ++x) {
+        const uint16_t* const row =
+            tile->cells.data() + (x - tile_min_x) * kTileSizeCells;
+        std::copy(row + (begin_y - tile_min_y), row + (end_y - tile_min_y),
+                  values.begin() +
+                      static_cast<size_t>(x - cells.min().x()) * sizes.y() +
+                      (begin_y - cells.min().y()));
+      }
+    }
+  }
+  return values;
+}
+
+TiledProbabilityGrid::Tile* TiledProbabilityGrid::GetTile(
+    const TileIndex& tile_index, const bool create) {
+  auto it = tiles_.find(tile_index);
+  if (it == tiles_.end()) {
+    if (!create) {
+      return nullptr;
+    }
+    it = tiles_.emplace(tile_index, Tile()).first;
+    it->second.cells.assign(kTileSizeCells * kTileSizeCells,
+                            carto::mapping::kUnknownCorrespondenceValue);
+    lru_tiles_.push_front(tile_index);
+  } else if (it->second.cells.empty()) {
+    Tile& tile = it->second;
+    tile.cells.resize(kTileSizeCells * kTileSizeCells);
+    CHECK_EQ(fseeko(file_, tile.file_offset, SEEK_SET), 0);
+    CHECK_EQ(std::fread(tile.cells.data(), sizeof(uint16_t), tile.cells.size(),
+                        file_),
+             tile.cells.size())
+        << "Could not read back a tile.";
+    lru_tiles_.push_front(tile_index);
+  } else {
+    lru_tiles_.splice(lru_tiles_.begin(), lru_tiles_, it->second.lru_position);
+  }
+  it->second.lru_position = lru_tiles_.begin();
+  while (static_cast<int>(lru_tiles_.size()) > max_tiles_in_memory_) {
+    EvictLeastRecentlyUsedTile();
+  }
+  return &it->second;
+}
+
+void TiledProbabilityGrid::EvictLeastRecentlyUsedTile() {
+  Tile& tile = tiles_.at(lru_tiles_.back());
+  if (file_ == nullptr) {
+    file_ = std::tmpfile();
+    CHECK(file_ != nullptr) << "Could not create a temporary file for tiles.";
+  }
+  if (tile.file_offset == -1) {
+    tile.file_offset = file_size_;
+    file_size_ += tile.cells.size() * sizeof(uint16_t);
+  }
+  CHECK_EQ(fseeko(file_, tile.file_offset, SEEK_SET), 0);
+  CHECK_EQ(std::fwrite(tile.cells.data(), sizeof(uint16_t), tile.cells.size(),
+                       file_),
+           tile.cells.size())
+      << "Could not write a tile to the temporary file.";
+  // Releases the memory of the cells.
+  std::vector<uint16_t>().swap(tile.cells);
+  lru_tiles_.pop_back();
+}
+
+}  // namespace cartographer_ros
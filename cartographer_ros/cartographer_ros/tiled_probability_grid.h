@@ -0,0 +1,132 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_TILED_PROBABILITY_GRID_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_TILED_PROBABILITY_GRID_H
+
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "Eigen/Core"
+#include "Eigen/Geometry"
+#include "absl/synchronization/mutex.h"
+#include "cartographer/mapping/2d/probability_grid_range_data_inserter_2d.h"
+#include "cartographer/mapping/proto/probability_grid_range_data_inserter_options_2d.pb.h"
+#include "cartographer/mapping/value_conversion_tables.h"
+#include "cartographer/sensor/range_data.h"
+
+namespace cartographer_ros {
+
+// A 2D probability grid stored in square tiles which are created as range
+// data is inserted into them. Only 'max_tiles_in_memory' tiles are kept in
+// memory, the least recently used ones are kept in a temporary file.
+//
+// Range data is inserted exactly like by
+// '::cartographer::mapping::ProbabilityGridRangeDataInserter2D' into a
+// '::cartographer::mapping::ProbabilityGrid'. Cells are indexed like in such a
+// grid whose limits have their maximum at the origin, i.e. the x index grows
+// towards -y and the y index towards -x.
+class TiledProbabilityGrid {
+ public:
+  // Number of cells along each side of a tile.
+  static constexpr int kTileSizeCells = 256;
+
+  TiledProbabilityGrid(
+      double resolution,
+      const ::cartographer::mapping::proto::
+          ProbabilityGridRangeDataInserterOptions2D&
+              range_data_inserter_options,
+      int max_tiles_in_memory);
+  ~TiledProbabilityGrid();
+
+  TiledProbabilityGrid(const TiledProbabilityGrid&) = delete;
+  TiledProbabilityGrid& operator=(const TiledProbabilityGrid&) = delete;
+
+  double resolution() const { return resolution_; }
+
+  // The cells updated by inserting range data, in the order of their tiles.
+  struct Updates {
+    std::vector<Eigen::Array2i> cells;
+    // Whether each of 'cells' was hit, otherwise it was passed by a ray.
+    std::vector<bool> hits;
+  };
+
+  // Ray casts 'range_data' without changing the grid. Thread-safe, also
+  // while updates are applied.
+  Updates ComputeUpdates(
+      const ::cartographer::sensor::RangeData& range_data) const;
+  // Updates must be applied in the order of their range data to get the
+  // same result as by inserting it.
+  void ApplyUpdates(const Updates& updates);
+
+  void Insert(const ::cartographer::sensor::RangeData& range_data) {
+    ApplyUpdates(ComputeUpdates(range_data));
+  }
+
+  // Cell indices of all cells that were updated, 'max' is inclusive. Empty if
+  // nothing was inserted.
+  const Eigen::AlignedBox2i& known_cells_box() const {
+    return known_cells_box_;
+  }
+
+  // Returns the correspondence cost values of the cells in 'cells' with the y
+  // index changing fastest. Unknown cells are
+  // '::cartographer::mapping::kUnknownCorrespondenceValue'.
+  std::vector<uint16_t> GetCorrespondenceCostValues(
+      const Eigen::AlignedBox2i& cells);
+
+ private:
+  using TileIndex = std::pair<int, int>;
+
+  struct Tile {
+    // Empty while the tile is only in the file.
+    std::vector<uint16_t> cells;
+    // Where the tile is stored in the file, -1 until it was evicted once.
+    int64_t file_offset = -1;
+    std::list<TileIndex>::iterator lru_position;
+  };
+
+  // Returns the tile, creating or reading it back as needed. The pointer is
+  // valid until the next call.
+  Tile* GetTile(const TileIndex& tile_index, bool create);
+  void EvictLeastRecentlyUsedTile();
+
+  const double resolution_;
+  const int max_tiles_in_memory_;
+  // The same tables as used by 'range_data_inserter_'.
+  const std::vector<uint16_t> hit_table_;
+  const std::vector<uint16_t> miss_table_;
+  ::cartographer::mapping::ProbabilityGridRangeDataInserter2D
+      range_data_inserter_;
+  mutable absl::Mutex conversion_tables_mutex_;
+  mutable ::cartographer::mapping::ValueConversionTables conversion_tables_
+      GUARDED_BY(conversion_tables_mutex_);
+
+  std::map<TileIndex, Tile> tiles_;
+  // Tiles in memory, most recently used first.
+  std::list<TileIndex> lru_tiles_;
+  std::FILE* file_ = nullptr;
+  int64_t file_size_ = 0;
+  Eigen::AlignedBox2i known_cells_box_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_TILED_PROBABILITY_GRID_H
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/tiled_probability_grid.h"
+
+#include <cmath>
+#include <vector>
+
+#include "cartographer/common/math.h"
+#include "cartographer/mapping/2d/probability_grid.h"
+#include "cartographer/mapping/2d/probability_grid_range_data_inserter_2d.h"
+#include "cartographer/mapping/probability_values.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+namespace carto = ::cartographer;
+
+constexpr double kResolution = 0.05;
+// Grid size of the reference grid, its maximum is at a multiple of the
+// resolution like the one of the tiled grid.
+constexpr int kReferenceGridSize = 100;
+
+TEST(TiledProbabilityGridTest, MatchesProbabilityGrid) {
+  carto::mapping::proto::ProbabilityGridRangeDataInserterOptions2D options;
+  options.set_insert_free_space(true);
+  options.set_hit_probability(0.55);
+  options.set_miss_probability(0.49);
+  // Only one tile in memory, so the others are read back from the file.
+  TiledProbabilityGrid tiled_grid(kResolution, options,
+                                  1 /* max_tiles_in_memory */);
+  carto::mapping::ValueConversionTables conversion_tables;
+  carto::mapping::ProbabilityGrid reference_grid(
+      carto::mapping::MapLimits(
+          kResolution,
+          Eigen::Vector2d::Constant(kReferenceGridSize / 2 * kResolution),
+          carto::mapping::CellLimits(kReferenceGridSize, kReferenceGridSize)),
+      &conversion_tables);
+  carto::mapping::ProbabilityGridRangeDataInserter2D inserter(options);
+
+  // Rays crossing the tile borders at the origin from several poses.
+  for (const Eigen::Vector3f& origin : {Eigen::Vector3f(0.21f, 0.33f, 0.f),
+                                        Eigen::Vector3f(-13.07f, 2.11f, 0.f),
+                                        Eigen::Vector3f(4.43f, -15.59f, 0.f)}) {
+    carto::sensor::RangeData range_data;
+    range_data.origin = origin;
+    for (int i = 0; i < 36; ++i) {
+      const float angle = i * 0.1745f + 0.013f;
+      range_data.returns.push_back(
+          {origin + Eigen::Vector3f(20.17f * std::cos(angle),
+                                    17.31f * std::sin(angle), 0.f)});
+    }
+    tiled_grid.Insert(range_data);
+    inserter.Insert(range_data, &reference_grid);
+  }
+  reference_grid.FinishUpdate();
+
+  Eigen::Array2i offset;
+  carto::mapping::CellLimits cell_limits;
+  reference_grid.ComputeCroppedLimits(&offset, &cell_limits);
+  // Cell indices of the tiled grid are relative to a maximum at the origin.
+  const Eigen::Vector2d max = reference_grid.limits().max();
+  const Eigen::Vector2i min =
+      offset.matrix() -
+      Eigen::Vector2i(carto::common::RoundToInt(max.y() / kResolution),
+                      carto::common::RoundToInt(max.x() / kResolution));
+  const Eigen::AlignedBox2i box(
+      min, min + Eigen::Vector2i(cell_limits.num_x_cells - 1,
+                                 cell_limits.num_y_cells - 1));
+  ASSERT_EQ(box.min(), tiled_grid.known_cells_box().min());
+  ASSERT_EQ(box.max(), tiled_grid.known_cells_box().max());
+
+  const std::vector<uint16_t> values =
+      tiled_grid.GetCorrespondenceCostValues(box);
+  ASSERT_EQ(values.size(), static_cast<size_t>(cell_limits.num_x_cells) *
+                               cell_limits.num_y_cells);
+  for (int x = 0; x < cell_limits.num_x_cells; ++x) {
+    for (int y = 0; y < cell_limits.num_y_cells; ++y) {
+      const Eigen::Array2i cell = offset + Eigen::Array2i(x, y);
+      const uint16_t value = values[x * cell_limits.num_y_cells + y];
+      if (!reference_grid.IsKnown(cell)) {
+        EXPECT_EQ(value, carto::mapping::kUnknownCorrespondenceValue);
+        continue;
+      }
+      EXPECT_EQ(carto::mapping::ValueToCorrespondenceCost(value),
+                reference_grid.GetCorrespondenceCost(cell));
+    }
+  }
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -28,12 +28,23 @@ namespace {
 
 void CheckTrajectoryOptions(const TrajectoryOptions& options) {
   CHECK_GE(options.num_subdivisions_per_laser_scan, 1);
+  CHECK_GE(options.imu_and_odometry_batch_duration_sec, 0.);
+  LOG_IF(WARNING, options.use_laser_scan_point_time &&
+                      options.num_subdivisions_per_laser_scan != 1)
+      << "'num_subdivisions_per_laser_scan' is ignored since "
+         "'use_laser_scan_point_time' is enabled.";
   CHECK_GE(options.num_laser_scans + options.num_multi_echo_laser_scans +
                options.num_point_clouds,
            1)
       << "Configuration error: 'num_laser_scans', "
          "'num_multi_echo_laser_scans' and 'num_point_clouds' are "
          "all zero, but at least one is required.";
+  LOG_IF(WARNING,
+         options.use_adaptive_rangefinder_sampling &&
+             options.adaptive_rangefinder_sampling.min_sampling_ratio >=
+                 options.rangefinder_sampling_ratio)
+      << "Adaptive rangefinder sampling has no effect, since its "
+         "'min_sampling_ratio' is not below 'rangefinder_sampling_ratio'.";
 }
 
 }  // namespace
@@ -64,10 +75,33 @@ TrajectoryOptions CreateTrajectoryOptions(
   options.num_subdivisions_per_laser_scan =
       lua_parameter_dictionary->GetNonNegativeInt(
           "num_subdivisions_per_laser_scan");
+  if (lua_parameter_dictionary->HasKey("use_laser_scan_point_time")) {
+    options.use_laser_scan_point_time =
+        lua_parameter_dictionary->GetBool("use_laser_scan_point_time");
+  }
   options.num_point_clouds =
       lua_parameter_dictionary->GetNonNegativeInt("num_point_clouds");
+  if (lua_parameter_dictionary->HasKey("rangefinder_prefilters")) {
+    const auto prefilters =
+        lua_parameter_dictionary->GetDictionary("rangefinder_prefilters");
+    for (const std::string& sensor_id : prefilters->GetKeys()) {
+      options.rangefinder_prefilters.emplace(
+          sensor_id, CreateRangefinderPrefilterOptions(
+                         prefilters->GetDictionary(sensor_id).get()));
+    }
+  }
+  if (lua_parameter_dictionary->HasKey("rangefinder_merge")) {
+    options.rangefinder_merge = CreateRangefinderMergeOptions(
+        lua_parameter_dictionary->GetDictionary("rangefinder_merge").get());
+  }
   options.rangefinder_sampling_ratio =
       lua_parameter_dictionary->GetDouble("rangefinder_sampling_ratio");
+  if (lua_parameter_dictionary->HasKey("adaptive_rangefinder_sampling")) {
+    options.use_adaptive_rangefinder_sampling = true;
+    options.adaptive_rangefinder_sampling = CreateAdaptiveSamplingOptions(
+        lua_parameter_dictionary->GetDictionary("adaptive_rangefinder_sampling")
+            .get());
+  }
   options.odometry_sampling_ratio =
       lua_parameter_dictionary->GetDouble("odometry_sampling_ratio");
   options.fixed_frame_pose_sampling_ratio =
@@ -76,6 +110,11 @@ TrajectoryOptions CreateTrajectoryOptions(
       lua_parameter_dictionary->GetDouble("imu_sampling_ratio");
   options.landmarks_sampling_ratio =
       lua_parameter_dictionary->GetDouble("landmarks_sampling_ratio");
+  if (lua_parameter_dictionary->HasKey("imu_and_odometry_batch_duration_sec")) {
+    options.imu_and_odometry_batch_duration_sec =
+        lua_parameter_dictionary->GetDouble(
+            "imu_and_odometry_batch_duration_sec");
+  }
   CheckTrajectoryOptions(options);
   return options;
 }
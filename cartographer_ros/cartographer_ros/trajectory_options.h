@@ -17,11 +17,15 @@
 #ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_TRAJECTORY_OPTIONS_H
 #define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_TRAJECTORY_OPTIONS_H
 
+#include <map>
 #include <string>
 
 #include "cartographer/common/lua_parameter_dictionary.h"
 #include "cartographer/common/port.h"
 #include "cartographer/mapping/proto/trajectory_builder_options.pb.h"
+#include "cartographer_ros/adaptive_sampler.h"
+#include "cartographer_ros/rangefinder_merger.h"
+#include "cartographer_ros/rangefinder_prefilter.h"
 
 namespace cartographer_ros {
 
@@ -39,12 +43,22 @@ struct TrajectoryOptions {
   int num_laser_scans;
   int num_multi_echo_laser_scans;
   int num_subdivisions_per_laser_scan;
+  bool use_laser_scan_point_time = false;
   int num_point_clouds;
+  // Prefilters of the range data by sensor ID, e.g. "points2_1".
+  std::map<std::string, RangefinderPrefilterOptions> rangefinder_prefilters;
+  RangefinderMergeOptions rangefinder_merge;
   double rangefinder_sampling_ratio;
+  // If set, the rangefinder sampling ratio is lowered while SLAM falls behind.
+  bool use_adaptive_rangefinder_sampling = false;
+  AdaptiveSamplingOptions adaptive_rangefinder_sampling;
   double odometry_sampling_ratio;
   double fixed_frame_pose_sampling_ratio;
   double imu_sampling_ratio;
   double landmarks_sampling_ratio;
+  // IMU and odometry messages are handed to SLAM in batches spanning this
+  // duration, if positive.
+  double imu_and_odometry_batch_duration_sec = 0.;
 };
 
 TrajectoryOptions CreateTrajectoryOptions(
@@ -50,7 +50,9 @@ std::vector<geometry_msgs::TransformStamped> ReadStaticTransformsFromUrdf(
                                pose.rotation.y, pose.rotation.z)));
     transform.child_frame_id = link->name;
     transform.header.frame_id = link->getParent()->name;
-    tf_buffer->setTransform(transform, "urdf", true /* is_static */);
+    if (tf_buffer != nullptr) {
+      tf_buffer->setTransform(transform, "urdf", true /* is_static */);
+    }
     transforms.push_back(transform);
   }
   return transforms;
@@ -24,6 +24,8 @@
 
 namespace cartographer_ros {
 
+// Returns the fixed joints of the URDF as static transforms. They are also
+// added to 'tf_buffer', unless it is nullptr.
 std::vector<geometry_msgs::TransformStamped> ReadStaticTransformsFromUrdf(
     const std::string& urdf_filename, tf2_ros::Buffer* tf_buffer);
 
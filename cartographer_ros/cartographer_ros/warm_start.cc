@@ -0,0 +1,162 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/warm_start.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::transform::Rigid3d;
+
+constexpr double kMaxQuaternionNormError = 1e-3;
+
+void WriteRigid3d(const Rigid3d& rigid3d, std::ostream* const stream) {
+  *stream << rigid3d.translation().x() << " " << rigid3d.translation().y()
+          << " " << rigid3d.translation().z() << " " << rigid3d.rotation().w()
+          << " " << rigid3d.rotation().x() << " " << rigid3d.rotation().y()
+          << " " << rigid3d.rotation().z() << "\n";
+}
+
+bool ReadRigid3d(std::istream* const stream, Rigid3d* const rigid3d) {
+  double x, y, z, qw, qx, qy, qz;
+  if (!(*stream >> x >> y >> z >> qw >> qx >> qy >> qz)) {
+    return false;
+  }
+  const Eigen::Quaterniond rotation(qw, qx, qy, qz);
+  if (std::abs(rotation.norm() - 1.) > kMaxQuaternionNormError) {
+    return false;
+  }
+  *rigid3d = Rigid3d(Eigen::Vector3d(x, y, z), rotation.normalized());
+  return true;
+}
+
+// Writes 'contents' to a new file 'filename' and syncs it to disk.
+bool WriteSyncedFile(const std::string& filename,
+                     const std::string& contents) {
+  const int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  size_t num_written = 0;
+  while (num_written < contents.size()) {
+    const ssize_t result = write(fd, contents.data() + num_written,
+                                 contents.size() - num_written);
+    if (result < 0) {
+      close(fd);
+      return false;
+    }
+    num_written += result;
+  }
+  const bool synced = fsync(fd) == 0;
+  return close(fd) == 0 && synced;
+}
+
+}  // namespace
+
+bool WriteWarmStartPose(const std::string& filename,
+                        const WarmStartPose& pose) {
+  const std::string temporary_filename = filename + ".tmp";
+  std::ostringstream contents;
+  contents.precision(std::numeric_limits<double>::max_digits10);
+  WriteRigid3d(pose.tracking_to_map, &contents);
+  WriteRigid3d(pose.published_to_tracking, &contents);
+  if (!WriteSyncedFile(temporary_filename, contents.str())) {
+    LOG(WARNING) << "Could not write warm start pose to "
+                 << temporary_filename;
+    return false;
+  }
+  if (std::rename(temporary_filename.c_str(), filename.c_str()) != 0) {
+    LOG(WARNING) << "Could not replace warm start pose " << filename;
+    return false;
+  }
+  return true;
+}
+
+absl::optional<WarmStartPose> ReadWarmStartPose(const std::string& filename,
+                                                const double max_age_sec) {
+  struct stat file_status;
+  if (stat(filename.c_str(), &file_status) != 0) {
+    return absl::nullopt;
+  }
+  const double age_sec =
+      std::difftime(std::time(nullptr), file_status.st_mtime);
+  if (age_sec > max_age_sec) {
+    LOG(INFO) << "Not warm starting, the pose in " << filename << " is "
+              << age_sec << " s old.";
+    return absl::nullopt;
+  }
+  std::ifstream file(filename);
+  WarmStartPose pose;
+  if (!ReadRigid3d(&file, &pose.tracking_to_map) ||
+      !ReadRigid3d(&file, &pose.published_to_tracking)) {
+    LOG(WARNING) << "Could not read warm start pose from " << filename;
+    return absl::nullopt;
+  }
+  return pose;
+}
+
+WarmStartPoseWriter::WarmStartPoseWriter(const std::string& filename)
+    : filename_(filename) {
+  thread_ = std::thread(&WarmStartPoseWriter::Run, this);
+}
+
+WarmStartPoseWriter::~WarmStartPoseWriter() {
+  {
+    absl::MutexLock lock(&mutex_);
+    shutting_down_ = true;
+  }
+  thread_.join();
+}
+
+void WarmStartPoseWriter::Write(const WarmStartPose& pose) {
+  absl::MutexLock lock(&mutex_);
+  pending_pose_ = pose;
+}
+
+bool WarmStartPoseWriter::CanRun() const {
+  return pending_pose_.has_value() || shutting_down_;
+}
+
+void WarmStartPoseWriter::Run() {
+  for (;;) {
+    WarmStartPose pose;
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(absl::Condition(this, &WarmStartPoseWriter::CanRun));
+      if (!pending_pose_.has_value()) {
+        return;
+      }
+      pose = pending_pose_.value();
+      pending_pose_.reset();
+    }
+    WriteWarmStartPose(filename_, pose);
+  }
+}
+
+}  // namespace cartographer_ros
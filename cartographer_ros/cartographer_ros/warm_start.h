@@ -0,0 +1,74 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_WARM_START_H
+#define CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_WARM_START_H
+
+#include <string>
+#include <thread>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "cartographer/transform/rigid_transform.h"
+
+namespace cartographer_ros {
+
+// The pose a node last published, from which a restarted node can publish
+// before its state is loaded and its trajectory has data.
+struct WarmStartPose {
+  ::cartographer::transform::Rigid3d tracking_to_map;
+  ::cartographer::transform::Rigid3d published_to_tracking;
+};
+
+// Writes 'pose' to 'filename'. The file is synced to disk and then replaces
+// the previous one at once, so that a crash while writing keeps the previous
+// pose. Returns false on error.
+bool WriteWarmStartPose(const std::string& filename,
+                        const WarmStartPose& pose);
+
+// Writes the poses handed to it to a file on a background thread, so that the
+// pose publishing thread never waits for the disk. If poses are handed faster
+// than they are written, only the latest one is written.
+class WarmStartPoseWriter {
+ public:
+  explicit WarmStartPoseWriter(const std::string& filename);
+  // Writes the pending pose, if any, before returning.
+  ~WarmStartPoseWriter();
+
+  WarmStartPoseWriter(const WarmStartPoseWriter&) = delete;
+  WarmStartPoseWriter& operator=(const WarmStartPoseWriter&) = delete;
+
+  void Write(const WarmStartPose& pose) LOCKS_EXCLUDED(mutex_);
+
+ private:
+  bool CanRun() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void Run() LOCKS_EXCLUDED(mutex_);
+
+  const std::string filename_;
+  absl::Mutex mutex_;
+  absl::optional<WarmStartPose> pending_pose_ GUARDED_BY(mutex_);
+  bool shutting_down_ GUARDED_BY(mutex_) = false;
+  std::thread thread_;
+};
+
+// Returns the pose in 'filename' if it was written at most 'max_age_sec'
+// seconds ago.
+absl::optional<WarmStartPose> ReadWarmStartPose(const std::string& filename,
+                                                double max_age_sec);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_CARTOGRAPHER_ROS_WARM_START_H
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/warm_start.h"
+
+#include <fstream>
+
+#include "cartographer/transform/rigid_transform_test_helpers.h"
+#include "cartographer_ros/temporary_file_test_helpers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::transform::IsNearly;
+using ::cartographer::transform::Rigid3d;
+
+class WarmStartTest : public TemporaryFileTest {
+ protected:
+  WarmStartTest() : TemporaryFileTest("pose") {}
+};
+
+TEST_F(WarmStartTest, ReadsWrittenPose) {
+  EXPECT_FALSE(ReadWarmStartPose(filename_, 60.).has_value());
+
+  WarmStartPose pose;
+  pose.tracking_to_map = Rigid3d(Eigen::Vector3d(1., -2., 0.5),
+                                 Eigen::Quaterniond(Eigen::AngleAxisd(
+                                     0.3, Eigen::Vector3d::UnitZ())));
+  pose.published_to_tracking =
+      Rigid3d::Translation(Eigen::Vector3d(0.1, 0., 0.));
+  ASSERT_TRUE(WriteWarmStartPose(filename_, pose));
+
+  const auto read_pose = ReadWarmStartPose(filename_, 60.);
+  ASSERT_TRUE(read_pose.has_value());
+  EXPECT_THAT(read_pose->tracking_to_map, IsNearly(pose.tracking_to_map, 1e-9));
+  EXPECT_THAT(read_pose->published_to_tracking,
+              IsNearly(pose.published_to_tracking, 1e-9));
+  EXPECT_FALSE(ReadWarmStartPose(filename_, -1.).has_value());
+}
+
+TEST_F(WarmStartTest, WriterWritesLatestPose) {
+  {
+    WarmStartPoseWriter writer(filename_);
+    for (int i = 0; i != 10; ++i) {
+      WarmStartPose pose;
+      pose.tracking_to_map = Rigid3d::Translation(Eigen::Vector3d(i, 0., 0.));
+      writer.Write(pose);
+    }
+  }
+  const auto read_pose = ReadWarmStartPose(filename_, 60.);
+  ASSERT_TRUE(read_pose.has_value());
+  EXPECT_THAT(read_pose->tracking_to_map,
+              IsNearly(Rigid3d::Translation(Eigen::Vector3d(9., 0., 0.)),
+                       1e-9));
+}
+
+TEST_F(WarmStartTest, RejectsMalformedPose) {
+  {
+    std::ofstream file(filename_);
+    file << "1 2 3 0 0 0 0\n1 2 3 1 0 0 0\n";
+  }
+  EXPECT_FALSE(ReadWarmStartPose(filename_, 60.).has_value());
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -16,8 +16,9 @@
 
 #include "cartographer_rviz/drawable_submap.h"
 
+#include <algorithm>
 #include <chrono>
-#include <future>
+#include <cmath>
 #include <sstream>
 #include <string>
 
@@ -26,7 +27,6 @@
 #include "absl/memory/memory.h"
 #include "cartographer/common/port.h"
 #include "cartographer_ros/msg_conversion.h"
-#include "cartographer_ros_msgs/SubmapQuery.h"
 #include "ros/ros.h"
 
 namespace cartographer_rviz {
@@ -39,7 +39,8 @@ constexpr float kAlphaUpdateThreshold = 0.2f;
 const Ogre::ColourValue kSubmapIdColor(Ogre::ColourValue::Red);
 const Eigen::Vector3d kSubmapIdPosition(0.0, 0.0, 0.3);
 constexpr float kSubmapIdCharHeight = 0.2f;
-constexpr int kNumberOfSlicesPerSubmap = 2;
+// Radius of the bounding sphere of submaps without a texture yet.
+constexpr double kDefaultBoundingSphereRadius = 30.;
 
 }  // namespace
 
@@ -49,11 +50,16 @@ DrawableSubmap::DrawableSubmap(const ::cartographer::mapping::SubmapId& id,
                                ::rviz::Property* const submap_category,
                                const bool visible, const bool pose_axes_visible,
                                const float pose_axes_length,
-                               const float pose_axes_radius)
+                               const float pose_axes_radius,
+                               const std::vector<OgreSubmapAtlas*>& atlases)
     : id_(id),
       display_context_(display_context),
       submap_node_(map_node->createChildSceneNode()),
       submap_id_text_node_(submap_node_->createChildSceneNode()),
+      atlases_(atlases),
+      ogre_slices_(kNumberOfSlicesPerSubmap),
+      slice_in_atlas_(kNumberOfSlicesPerSubmap, false),
+      slice_visibility_(kNumberOfSlicesPerSubmap, true),
       pose_axes_(display_context->getSceneManager(), submap_node_,
                  pose_axes_length, pose_axes_radius),
       pose_axes_visible_(pose_axes_visible),
@@ -61,12 +67,11 @@ DrawableSubmap::DrawableSubmap(const ::cartographer::mapping::SubmapId& id,
                           .arg(id.trajectory_id)
                           .arg(id.submap_index)
                           .toStdString()),
-      last_query_timestamp_(0) {
-  for (int slice_index = 0; slice_index < kNumberOfSlicesPerSubmap;
-       ++slice_index) {
-    ogre_slices_.emplace_back(absl::make_unique<OgreSlice>(
-        id, slice_index, display_context->getSceneManager(), submap_node_));
-  }
+      last_query_timestamp_(0),
+      hidden_(!visible),
+      bounding_sphere_radius_(kDefaultBoundingSphereRadius) {
+  CHECK(atlases_.empty() ||
+        atlases_.size() == static_cast<size_t>(kNumberOfSlicesPerSubmap));
   // DrawableSubmap creates and manages its visibility property object
   // (a unique_ptr is needed because the Qt parent of the visibility
   // property is the submap_category object - the BoolProperty needs
@@ -74,6 +79,12 @@ DrawableSubmap::DrawableSubmap(const ::cartographer::mapping::SubmapId& id,
   visibility_ = absl::make_unique<::rviz::BoolProperty>(
       "" /* title */, visible, "" /* description */, submap_category,
       SLOT(ToggleVisibility()), this);
+  if (atlases_.empty()) {
+    for (int slice_index = 0; slice_index < kNumberOfSlicesPerSubmap;
+         ++slice_index) {
+      GetOgreSlice(slice_index);
+    }
+  }
   submap_id_text_.setCharacterHeight(kSubmapIdCharHeight);
   submap_id_text_.setColor(kSubmapIdColor);
   submap_id_text_.setTextAlignment(::rviz::MovableText::H_CENTER,
@@ -81,15 +92,14 @@ DrawableSubmap::DrawableSubmap(const ::cartographer::mapping::SubmapId& id,
   submap_id_text_node_->setPosition(ToOgre(kSubmapIdPosition));
   submap_id_text_node_->attachObject(&submap_id_text_);
   TogglePoseMarkerVisibility();
-  connect(this, SIGNAL(RequestSucceeded()), this, SLOT(UpdateSceneNode()));
 }
 
 DrawableSubmap::~DrawableSubmap() {
-  // 'query_in_progress_' must be true until the Q_EMIT has happened. Qt then
-  // makes sure that 'RequestSucceeded' is not called after our destruction.
-  if (QueryInProgress()) {
-    rpc_request_future_.wait();
+  // The owner makes sure that FinishFetchingTexture() is not running anymore.
+  for (OgreSubmapAtlas* const atlas : atlases_) {
+    atlas->Remove(id_);
   }
+  ogre_slices_.clear();
   display_context_->getSceneManager()->destroySceneNode(submap_node_);
   display_context_->getSceneManager()->destroySceneNode(submap_id_text_node_);
 }
@@ -102,6 +112,9 @@ void DrawableSubmap::Update(
   pose_ = ::cartographer_ros::ToRigid3d(metadata.pose);
   submap_node_->setPosition(ToOgre(pose_.translation()));
   submap_node_->setOrientation(ToOgre(pose_.rotation()));
+  for (OgreSubmapAtlas* const atlas : atlases_) {
+    atlas->SetPose(id_, pose_);
+  }
   display_context_->queueRender();
   visibility_->setName(
       QString("%1.%2").arg(id_.submap_index).arg(metadata_version_));
@@ -113,43 +126,68 @@ void DrawableSubmap::Update(
           .arg(metadata_version_));
 }
 
-bool DrawableSubmap::MaybeFetchTexture(ros::ServiceClient* const client) {
+bool DrawableSubmap::StartFetchingTexture(int* const known_version) {
   absl::MutexLock locker(&mutex_);
   // Received metadata version can also be lower if we restarted Cartographer.
   const bool newer_version_available =
-      submap_textures_ == nullptr ||
-      submap_textures_->version != metadata_version_;
+      slice_textures_ == nullptr ||
+      slice_textures_->version != metadata_version_;
   const std::chrono::milliseconds now =
       std::chrono::duration_cast<std::chrono::milliseconds>(
           std::chrono::system_clock::now().time_since_epoch());
   const bool recently_queried =
       last_query_timestamp_ + kMinQueryDelayInMs > now;
-  if (!newer_version_available || recently_queried || query_in_progress_) {
+  if (!newer_version_available || recently_queried || query_in_progress_ ||
+      culled_) {
     return false;
   }
   query_in_progress_ = true;
   last_query_timestamp_ = now;
-  rpc_request_future_ = std::async(std::launch::async, [this, client]() {
-    std::unique_ptr<::cartographer::io::SubmapTextures> submap_textures =
-        ::cartographer_ros::FetchSubmapTextures(id_, client);
-    absl::MutexLock locker(&mutex_);
-    query_in_progress_ = false;
-    if (submap_textures != nullptr) {
-      // We emit a signal to update in the right thread, and pass via the
-      // 'submap_texture_' member to simplify the signal-slot connection
-      // slightly.
-      submap_textures_ = std::move(submap_textures);
-      Q_EMIT RequestSucceeded();
-    }
-  });
+  *known_version = slice_textures_ == nullptr ? -1 : slice_textures_->version;
   return true;
 }
 
+void DrawableSubmap::FinishFetchingTexture(
+    std::unique_ptr<SliceTextures> slice_textures) {
+  absl::MutexLock locker(&mutex_);
+  query_in_progress_ = false;
+  if (hidden_) {
+    // Allow fetching again as soon as the submap is shown.
+    last_query_timestamp_ = std::chrono::milliseconds(0);
+    return;
+  }
+  if (slice_textures != nullptr) {
+    slice_textures_ = std::move(slice_textures);
+    texture_upload_pending_ = true;
+  }
+}
+
+bool DrawableSubmap::texture_upload_pending() {
+  absl::MutexLock locker(&mutex_);
+  return texture_upload_pending_;
+}
+
 bool DrawableSubmap::QueryInProgress() {
   absl::MutexLock locker(&mutex_);
   return query_in_progress_;
 }
 
+int DrawableSubmap::NumMissingVersions() {
+  absl::MutexLock locker(&mutex_);
+  if (slice_textures_ == nullptr) {
+    return metadata_version_ + 1;
+  }
+  if (slice_textures_->version == metadata_version_) {
+    return 0;
+  }
+  return std::max(1, metadata_version_ - slice_textures_->version);
+}
+
+bool DrawableSubmap::hidden() {
+  absl::MutexLock locker(&mutex_);
+  return hidden_;
+}
+
 void DrawableSubmap::SetAlpha(const double current_tracking_z,
                               const float fade_out_start_distance_in_meters) {
   const float fade_out_distance_in_meters =
@@ -165,34 +203,130 @@ void DrawableSubmap::SetAlpha(const double current_tracking_z,
       target_alpha == 0.f || target_alpha == 1.f) {
     current_alpha_ = target_alpha;
   }
-  for (auto& slice : ogre_slices_) {
-    slice->SetAlpha(current_alpha_);
+  for (size_t slice_index = 0; slice_index < ogre_slices_.size();
+       ++slice_index) {
+    if (slice_in_atlas_[slice_index]) {
+      atlases_[slice_index]->SetAlpha(id_, current_alpha_);
+    } else if (ogre_slices_[slice_index] != nullptr) {
+      ogre_slices_[slice_index]->SetAlpha(current_alpha_);
+    }
   }
   display_context_->queueRender();
 }
 
 void DrawableSubmap::SetSliceVisibility(size_t slice_index, bool visible) {
-  ogre_slices_.at(slice_index)->SetVisibility(visible);
+  slice_visibility_.at(slice_index) = visible;
+  ToggleVisibility();
+}
+
+void DrawableSubmap::SetCulled(const bool culled) {
+  if (culled == culled_) {
+    return;
+  }
+  culled_ = culled;
   ToggleVisibility();
 }
 
-void DrawableSubmap::UpdateSceneNode() {
+Ogre::Sphere DrawableSubmap::GetBoundingSphere() const {
+  return Ogre::Sphere(
+      submap_node_->convertLocalToWorldPosition(
+          ToOgre(bounding_sphere_center_)),
+      bounding_sphere_radius_);
+}
+
+void DrawableSubmap::EvictTextures() {
+  absl::MutexLock locker(&mutex_);
+  if (query_in_progress_) {
+    return;
+  }
+  for (size_t slice_index = 0; slice_index < ogre_slices_.size();
+       ++slice_index) {
+    if (slice_in_atlas_[slice_index]) {
+      atlases_[slice_index]->Remove(id_);
+      slice_in_atlas_[slice_index] = false;
+    }
+    ogre_slices_[slice_index].reset();
+  }
+  slice_textures_.reset();
+  texture_upload_pending_ = false;
+  texture_bytes_ = 0;
+  display_context_->queueRender();
+}
+
+void DrawableSubmap::UploadTextures() {
   absl::MutexLock locker(&mutex_);
+  if (!texture_upload_pending_) {
+    return;
+  }
+  texture_upload_pending_ = false;
+  texture_bytes_ = 0;
   for (size_t slice_index = 0; slice_index < ogre_slices_.size() &&
-                               slice_index < submap_textures_->textures.size();
+                               slice_index < slice_textures_->textures.size();
        ++slice_index) {
-    ogre_slices_[slice_index]->Update(submap_textures_->textures[slice_index]);
+    const SliceTexture& slice_texture = slice_textures_->textures[slice_index];
+    slice_in_atlas_[slice_index] =
+        !atlases_.empty() &&
+        atlases_[slice_index]->Update(id_, pose_, slice_texture);
+    if (slice_in_atlas_[slice_index]) {
+      atlases_[slice_index]->SetAlpha(id_, current_alpha_);
+      ogre_slices_[slice_index].reset();
+    } else {
+      GetOgreSlice(slice_index)->Update(slice_texture);
+      ogre_slices_[slice_index]->SetAlpha(current_alpha_);
+    }
+    UpdateSliceVisibility(slice_index);
+    // Textures are uploaded as RGB.
+    texture_bytes_ += 3 * slice_texture.width * slice_texture.height;
+  }
+  if (!slice_textures_->textures.empty()) {
+    const SliceTexture& slice_texture = slice_textures_->textures.front();
+    const double metric_width = slice_texture.resolution * slice_texture.width;
+    const double metric_height =
+        slice_texture.resolution * slice_texture.height;
+    bounding_sphere_center_ =
+        slice_texture.slice_pose *
+        Eigen::Vector3d(-0.5 * metric_height, -0.5 * metric_width, 0.);
+    bounding_sphere_radius_ = 0.5 * std::hypot(metric_width, metric_height);
+  }
+  // The texels are only needed for uploading.
+  for (SliceTexture& slice_texture : slice_textures_->textures) {
+    std::vector<char>().swap(slice_texture.rgb);
   }
   display_context_->queueRender();
 }
 
 void DrawableSubmap::ToggleVisibility() {
-  for (auto& ogre_slice : ogre_slices_) {
-    ogre_slice->UpdateOgreNodeVisibility(visibility_->getBool());
+  {
+    absl::MutexLock locker(&mutex_);
+    hidden_ = !visibility_->getBool() || culled_;
+  }
+  for (size_t slice_index = 0; slice_index < ogre_slices_.size();
+       ++slice_index) {
+    UpdateSliceVisibility(slice_index);
   }
   display_context_->queueRender();
 }
 
+OgreSlice* DrawableSubmap::GetOgreSlice(const size_t slice_index) {
+  if (ogre_slices_[slice_index] == nullptr) {
+    ogre_slices_[slice_index] = absl::make_unique<OgreSlice>(
+        id_, slice_index, display_context_->getSceneManager(), submap_node_);
+    UpdateSliceVisibility(slice_index);
+  }
+  return ogre_slices_[slice_index].get();
+}
+
+void DrawableSubmap::UpdateSliceVisibility(const size_t slice_index) {
+  const bool submap_visibility = visibility_->getBool() && !culled_;
+  if (slice_in_atlas_[slice_index]) {
+    atlases_[slice_index]->SetVisibility(
+        id_, submap_visibility && slice_visibility_[slice_index]);
+  } else if (ogre_slices_[slice_index] != nullptr) {
+    ogre_slices_[slice_index]->SetVisibility(slice_visibility_[slice_index]);
+    ogre_slices_[slice_index]->UpdateOgreNodeVisibility(submap_visibility);
+  }
+}
+
 void DrawableSubmap::TogglePoseMarkerVisibility() {
   submap_id_text_node_->setVisible(pose_axes_visible_);
   pose_axes_.getSceneNode()->setVisible(pose_axes_visible_);
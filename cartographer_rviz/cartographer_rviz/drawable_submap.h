@@ -17,21 +17,22 @@
 #ifndef CARTOGRAPHER_RVIZ_SRC_DRAWABLE_SUBMAP_H_
 #define CARTOGRAPHER_RVIZ_SRC_DRAWABLE_SUBMAP_H_
 
-#include <future>
 #include <memory>
+#include <vector>
 
 #include "Eigen/Core"
 #include "Eigen/Geometry"
 #include "OgreSceneManager.h"
 #include "OgreSceneNode.h"
+#include "OgreSphere.h"
 #include "absl/synchronization/mutex.h"
 #include "cartographer/io/submap_painter.h"
 #include "cartographer/mapping/id.h"
 #include "cartographer/transform/rigid_transform.h"
 #include "cartographer_ros/submap.h"
 #include "cartographer_ros_msgs/SubmapEntry.h"
-#include "cartographer_ros_msgs/SubmapQuery.h"
 #include "cartographer_rviz/ogre_slice.h"
+#include "cartographer_rviz/ogre_submap_atlas.h"
 #include "ros/ros.h"
 #include "rviz/display_context.h"
 #include "rviz/frame_manager.h"
@@ -41,33 +42,62 @@
 
 namespace cartographer_rviz {
 
+constexpr int kNumberOfSlicesPerSubmap = 2;
+
 // Contains all the information needed to render a submap onto the final
 // texture representing the whole map.
 class DrawableSubmap : public QObject {
   Q_OBJECT
 
  public:
+  // If 'atlases' is not empty, it has an atlas for each slice which is used
+  // to draw the slice if its texture fits. The atlases must outlive this
+  // object.
   DrawableSubmap(const ::cartographer::mapping::SubmapId& submap_id,
                  ::rviz::DisplayContext* display_context,
                  Ogre::SceneNode* map_node, ::rviz::Property* submap_category,
                  bool visible, const bool pose_axes_visible,
-                 float pose_axes_length, float pose_axes_radius);
+                 float pose_axes_length, float pose_axes_radius,
+                 const std::vector<OgreSubmapAtlas*>& atlases = {});
   ~DrawableSubmap() override;
   DrawableSubmap(const DrawableSubmap&) = delete;
   DrawableSubmap& operator=(const DrawableSubmap&) = delete;
 
   // Updates the 'metadata' for this submap. If necessary, the next call to
-  // MaybeFetchTexture() will fetch a new submap texture.
+  // StartFetchingTexture() will request a new submap texture.
   void Update(const ::std_msgs::Header& header,
               const ::cartographer_ros_msgs::SubmapEntry& metadata);
 
-  // If an update is needed, it will send an RPC using 'client' to request the
-  // new data for the submap and returns true.
-  bool MaybeFetchTexture(ros::ServiceClient* client);
+  // If an update is needed, marks a query as in progress, sets
+  // 'known_version' to the version of the current texture or -1 and returns
+  // true. The caller then queries the new data for the submap and passes it
+  // to FinishFetchingTexture().
+  bool StartFetchingTexture(int* known_version);
+
+  // Ends the query started by StartFetchingTexture(). 'slice_textures' is
+  // 'nullptr' if the query failed or the submap did not change. Otherwise,
+  // they wait for UploadTextures(). If the submap was hidden meanwhile, the
+  // textures are dropped and fetched again once it is shown.
+  void FinishFetchingTexture(std::unique_ptr<SliceTextures> slice_textures);
+
+  // Returns whether fetched textures wait for UploadTextures().
+  bool texture_upload_pending();
+
+  // Uploads the fetched textures to Ogre. Must be called from the Ogre
+  // thread.
+  void UploadTextures();
 
   // Returns whether an RPC is in progress.
   bool QueryInProgress();
 
+  // Returns by how many versions the texture lags behind the metadata, 0 if
+  // it is current. Without a texture, all versions are missing.
+  int NumMissingVersions();
+
+  // Returns whether the submap is hidden or culled, so that fetching its
+  // texture can wait.
+  bool hidden();
+
   // Sets the alpha of the submap taking into account its slice height and the
   // 'current_tracking_z'. 'fade_out_start_distance_in_meters' defines the
   // distance in z direction in meters, before which the submap will be shown
@@ -77,6 +107,24 @@ class DrawableSubmap : public QObject {
   // Sets the visibility of a slice. It will be drawn if the parent submap
   // is also visible.
   void SetSliceVisibility(size_t slice_index, bool visible);
+  bool slice_visibility(size_t slice_index) const {
+    return slice_visibility_.at(slice_index);
+  }
+
+  // A culled submap is hidden and does not fetch textures.
+  void SetCulled(bool culled);
+  bool culled() const { return culled_; }
+
+  // Returns a sphere containing the submap in the world frame. Until a
+  // texture was received, a typical size is assumed.
+  Ogre::Sphere GetBoundingSphere() const;
+
+  // Size of the textures uploaded for this submap.
+  size_t texture_bytes() const { return texture_bytes_; }
+
+  // Releases the textures, unless a query is in progress. They are fetched
+  // again once the submap is not culled.
+  void EvictTextures();
 
   ::cartographer::mapping::SubmapId id() const { return id_; }
   int version() const { return metadata_version_; }
@@ -89,35 +137,43 @@ class DrawableSubmap : public QObject {
     TogglePoseMarkerVisibility();
   }
 
- Q_SIGNALS:
-  // RPC request succeeded.
-  void RequestSucceeded();
-
  private Q_SLOTS:
-  // Callback when an rpc request succeeded.
-  void UpdateSceneNode();
   void ToggleVisibility();
   void TogglePoseMarkerVisibility();
 
  private:
+  // Returns the 'OgreSlice' of 'slice_index', creating it if needed.
+  OgreSlice* GetOgreSlice(size_t slice_index);
+  void UpdateSliceVisibility(size_t slice_index);
+
   const ::cartographer::mapping::SubmapId id_;
 
   absl::Mutex mutex_;
   ::rviz::DisplayContext* const display_context_;
   Ogre::SceneNode* const submap_node_;
   Ogre::SceneNode* const submap_id_text_node_;
+  const std::vector<OgreSubmapAtlas*> atlases_;
+  // Slices drawn by an atlas have no 'OgreSlice', which is only created for
+  // slices that do not fit into their atlas.
   std::vector<std::unique_ptr<OgreSlice>> ogre_slices_;
+  std::vector<bool> slice_in_atlas_;
+  std::vector<bool> slice_visibility_;
   ::cartographer::transform::Rigid3d pose_ GUARDED_BY(mutex_);
   ::rviz::Axes pose_axes_;
   bool pose_axes_visible_;
   ::rviz::MovableText submap_id_text_;
   std::chrono::milliseconds last_query_timestamp_ GUARDED_BY(mutex_);
   bool query_in_progress_ GUARDED_BY(mutex_) = false;
+  bool hidden_ GUARDED_BY(mutex_);
   int metadata_version_ GUARDED_BY(mutex_) = -1;
-  std::future<void> rpc_request_future_;
-  std::unique_ptr<::cartographer::io::SubmapTextures> submap_textures_
-      GUARDED_BY(mutex_);
+  std::unique_ptr<SliceTextures> slice_textures_ GUARDED_BY(mutex_);
+  bool texture_upload_pending_ GUARDED_BY(mutex_) = false;
   float current_alpha_ = 0.f;
+  bool culled_ = false;
+  size_t texture_bytes_ = 0;
+  // The bounding sphere in the submap frame.
+  Eigen::Vector3d bounding_sphere_center_ = Eigen::Vector3d::Zero();
+  double bounding_sphere_radius_;
   std::unique_ptr<::rviz::BoolProperty> visibility_;
 };
 
@@ -20,10 +20,12 @@
 #include <vector>
 
 #include "OgreGpuProgramParams.h"
+#include "OgreHardwarePixelBuffer.h"
 #include "OgreImage.h"
 #include "OgreMaterialManager.h"
 #include "OgreTechnique.h"
 #include "OgreTextureManager.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "cartographer/common/port.h"
 
@@ -52,6 +54,28 @@ Ogre::Quaternion ToOgre(const Eigen::Quaterniond& q) {
   return Ogre::Quaternion(q.w(), q.x(), q.y(), q.z());
 }
 
+std::unique_ptr<SliceTextures> ToSliceTextures(
+    const ::cartographer::io::SubmapTextures& submap_textures) {
+  auto slice_textures = absl::make_unique<SliceTextures>();
+  slice_textures->version = submap_textures.version;
+  for (const ::cartographer::io::SubmapTexture& submap_texture :
+       submap_textures.textures) {
+    CHECK_EQ(submap_texture.pixels.intensity.size(),
+             submap_texture.pixels.alpha.size());
+    std::vector<char> rgb;
+    rgb.reserve(3 * submap_texture.pixels.intensity.size());
+    for (size_t i = 0; i < submap_texture.pixels.intensity.size(); ++i) {
+      rgb.push_back(submap_texture.pixels.intensity[i]);
+      rgb.push_back(submap_texture.pixels.alpha[i]);
+      rgb.push_back(0);
+    }
+    slice_textures->textures.push_back(SliceTexture{
+        std::move(rgb), submap_texture.width, submap_texture.height,
+        submap_texture.resolution, submap_texture.slice_pose});
+  }
+  return slice_textures;
+}
+
 OgreSlice::OgreSlice(const ::cartographer::mapping::SubmapId& id, int slice_id,
                      Ogre::SceneManager* const scene_manager,
                      Ogre::SceneNode* const submap_node)
@@ -84,24 +108,15 @@ OgreSlice::~OgreSlice() {
   scene_manager_->destroyManualObject(manual_object_);
 }
 
-void OgreSlice::Update(
-    const ::cartographer::io::SubmapTexture& submap_texture) {
-  slice_node_->setPosition(ToOgre(submap_texture.slice_pose.translation()));
-  slice_node_->setOrientation(ToOgre(submap_texture.slice_pose.rotation()));
-  // The call to Ogre's loadRawData below does not work with an RG texture,
-  // therefore we create an RGB one whose blue channel is always 0.
-  std::vector<char> rgb;
-  CHECK_EQ(submap_texture.pixels.intensity.size(),
-           submap_texture.pixels.alpha.size());
-  for (size_t i = 0; i < submap_texture.pixels.intensity.size(); ++i) {
-    rgb.push_back(submap_texture.pixels.intensity[i]);
-    rgb.push_back(submap_texture.pixels.alpha[i]);
-    rgb.push_back(0);
-  }
+void OgreSlice::Update(const SliceTexture& slice_texture) {
+  slice_node_->setPosition(ToOgre(slice_texture.slice_pose.translation()));
+  slice_node_->setOrientation(ToOgre(slice_texture.slice_pose.rotation()));
+  CHECK_EQ(slice_texture.rgb.size(),
+           3 * slice_texture.width * slice_texture.height);
 
   manual_object_->clear();
-  const float metric_width = submap_texture.resolution * submap_texture.width;
-  const float metric_height = submap_texture.resolution * submap_texture.height;
+  const float metric_width = slice_texture.resolution * slice_texture.width;
+  const float metric_height = slice_texture.resolution * slice_texture.height;
   manual_object_->begin(material_->getName(),
                         Ogre::RenderOperation::OT_TRIANGLE_STRIP);
   // Bottom left
@@ -118,28 +133,33 @@ void OgreSlice::Update(
   manual_object_->textureCoord(1.0f, 0.0f);
   manual_object_->end();
 
-  Ogre::DataStreamPtr pixel_stream;
-  pixel_stream.bind(new Ogre::MemoryDataStream(rgb.data(), rgb.size()));
-
-  if (!texture_.isNull()) {
-    Ogre::TextureManager::getSingleton().remove(texture_->getHandle());
-    texture_.setNull();
+  if (texture_.isNull() ||
+      texture_->getWidth() != static_cast<size_t>(slice_texture.width) ||
+      texture_->getHeight() != static_cast<size_t>(slice_texture.height)) {
+    if (!texture_.isNull()) {
+      Ogre::TextureManager::getSingleton().remove(texture_->getHandle());
+      texture_.setNull();
+    }
+    const std::string texture_name =
+        absl::StrCat(kSubmapTexturePrefix, GetSliceIdentifier(id_, slice_id_));
+    texture_ = Ogre::TextureManager::getSingleton().createManual(
+        texture_name, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
+        Ogre::TEX_TYPE_2D, slice_texture.width, slice_texture.height,
+        0 /* num_mips */, Ogre::PF_BYTE_RGB);
+
+    Ogre::Pass* const pass = material_->getTechnique(0)->getPass(0);
+    pass->setSceneBlending(Ogre::SBF_ONE, Ogre::SBF_ONE_MINUS_SOURCE_ALPHA);
+    Ogre::TextureUnitState* const texture_unit =
+        pass->getNumTextureUnitStates() > 0 ? pass->getTextureUnitState(0)
+                                            : pass->createTextureUnitState();
+
+    texture_unit->setTextureName(texture_->getName());
+    texture_unit->setTextureFiltering(Ogre::TFO_NONE);
   }
-  const std::string texture_name =
-      absl::StrCat(kSubmapTexturePrefix, GetSliceIdentifier(id_, slice_id_));
-  texture_ = Ogre::TextureManager::getSingleton().loadRawData(
-      texture_name, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
-      pixel_stream, submap_texture.width, submap_texture.height,
-      Ogre::PF_BYTE_RGB, Ogre::TEX_TYPE_2D, 0);
-
-  Ogre::Pass* const pass = material_->getTechnique(0)->getPass(0);
-  pass->setSceneBlending(Ogre::SBF_ONE, Ogre::SBF_ONE_MINUS_SOURCE_ALPHA);
-  Ogre::TextureUnitState* const texture_unit =
-      pass->getNumTextureUnitStates() > 0 ? pass->getTextureUnitState(0)
-                                          : pass->createTextureUnitState();
-
-  texture_unit->setTextureName(texture_->getName());
-  texture_unit->setTextureFiltering(Ogre::TFO_NONE);
+  texture_->getBuffer()->blitFromMemory(
+      Ogre::PixelBox(slice_texture.width, slice_texture.height, 1,
+                     Ogre::PF_BYTE_RGB,
+                     const_cast<char*>(slice_texture.rgb.data())));
 }
 
 void OgreSlice::SetAlpha(const float alpha) {
@@ -17,6 +17,9 @@
 #ifndef CARTOGRAPHER_RVIZ_SRC_OGRE_SLICE_H_
 #define CARTOGRAPHER_RVIZ_SRC_OGRE_SLICE_H_
 
+#include <memory>
+#include <vector>
+
 #include "Eigen/Core"
 #include "Eigen/Geometry"
 #include "OgreManualObject.h"
@@ -28,12 +31,33 @@
 #include "OgreVector3.h"
 #include "cartographer/io/submap_painter.h"
 #include "cartographer/mapping/id.h"
+#include "cartographer/transform/rigid_transform.h"
 
 namespace cartographer_rviz {
 
 Ogre::Vector3 ToOgre(const Eigen::Vector3d& v);
 Ogre::Quaternion ToOgre(const Eigen::Quaterniond& q);
 
+// A slice texture in the pixel format uploaded to Ogre. Ogre does not upload
+// RG textures, therefore it is RGB with a blue channel of 0.
+struct SliceTexture {
+  std::vector<char> rgb;
+  int width;
+  int height;
+  double resolution;
+  ::cartographer::transform::Rigid3d slice_pose;
+};
+
+struct SliceTextures {
+  int version;
+  std::vector<SliceTexture> textures;
+};
+
+// Converts 'submap_textures' for uploading, which is meant to be done off the
+// Ogre thread.
+std::unique_ptr<SliceTextures> ToSliceTextures(
+    const ::cartographer::io::SubmapTextures& submap_textures);
+
 // A class containing the Ogre code to visualize a slice texture of a submap.
 // Member functions are expected to be called from the Ogre thread.
 class OgreSlice {
@@ -49,8 +73,8 @@ class OgreSlice {
   OgreSlice& operator=(const OgreSlice&) = delete;
 
   // Updates the texture and pose of the submap using new data from
-  // 'submap_texture'.
-  void Update(const ::cartographer::io::SubmapTexture& submap_texture);
+  // 'slice_texture'. The texture is reused if its size did not change.
+  void Update(const SliceTexture& slice_texture);
 
   // Changes the opacity of the submap to 'alpha'.
   void SetAlpha(float alpha);
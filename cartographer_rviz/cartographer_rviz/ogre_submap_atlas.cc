@@ -0,0 +1,266 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_rviz/ogre_submap_atlas.h"
+
+#include <algorithm>
+
+#include "OgreHardwarePixelBuffer.h"
+#include "OgreMaterialManager.h"
+#include "OgreTechnique.h"
+#include "OgreTextureManager.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "cartographer_rviz/ogre_slice.h"
+#include "glog/logging.h"
+
+namespace cartographer_rviz {
+
+namespace {
+
+constexpr char kSubmapAtlasSourceMaterialName[] =
+    "cartographer_ros/SubmapAtlas";
+constexpr char kSubmapAtlasPrefix[] = "SubmapAtlas";
+// Pages are square with this many pixels per side.
+constexpr int kPageSizePixels = 1024;
+// Slots are square with a power of two pixels per side, at least this many.
+constexpr int kMinSlotSizePixels = 64;
+
+int GetSlotSize(const int width, const int height) {
+  int slot_size = kMinSlotSizePixels;
+  while (slot_size < std::max(width, height)) {
+    slot_size *= 2;
+  }
+  return slot_size;
+}
+
+}  // namespace
+
+OgreSubmapAtlas::OgreSubmapAtlas(const std::string& name,
+                                 Ogre::SceneManager* const scene_manager,
+                                 Ogre::SceneNode* const map_node)
+    : name_(name), scene_manager_(scene_manager), map_node_(map_node) {}
+
+OgreSubmapAtlas::~OgreSubmapAtlas() {
+  for (const std::unique_ptr<Page>& page : pages_) {
+    Ogre::MaterialManager::getSingleton().remove(page->material->getHandle());
+    Ogre::TextureManager::getSingleton().remove(page->texture->getHandle());
+    scene_manager_->destroySceneNode(page->scene_node);
+    scene_manager_->destroyManualObject(page->manual_object);
+  }
+}
+
+bool OgreSubmapAtlas::Update(
+    const ::cartographer::mapping::SubmapId& id,
+    const ::cartographer::transform::Rigid3d& submap_pose,
+    const SliceTexture& slice_texture) {
+  const int slot_size = GetSlotSize(slice_texture.width, slice_texture.height);
+  auto it = slices_.find(id);
+  if (it != slices_.end() &&
+      pages_[it->second.page_index]->slot_size != slot_size) {
+    Remove(id);
+    it = slices_.end();
+  }
+  if (slot_size > kPageSizePixels) {
+    return false;
+  }
+  Slice* const slice =
+      it == slices_.end() ? AllocateSlice(id, slot_size) : &it->second;
+  slice->width = slice_texture.width;
+  slice->height = slice_texture.height;
+  slice->resolution = slice_texture.resolution;
+  slice->slice_pose = slice_texture.slice_pose;
+  slice->submap_pose = submap_pose;
+
+  Page* const page = pages_[slice->page_index].get();
+  const int slots_per_row = kPageSizePixels / page->slot_size;
+  const int x = slice->slot % slots_per_row * page->slot_size;
+  const int y = slice->slot / slots_per_row * page->slot_size;
+  page->texture->getBuffer()->blitFromMemory(
+      Ogre::PixelBox(slice_texture.width, slice_texture.height, 1,
+                     Ogre::PF_BYTE_RGB,
+                     const_cast<char*>(slice_texture.rgb.data())),
+      Ogre::Image::Box(x, y, x + slice_texture.width,
+                       y + slice_texture.height));
+  page->changed = true;
+  return true;
+}
+
+void OgreSubmapAtlas::SetPose(
+    const ::cartographer::mapping::SubmapId& id,
+    const ::cartographer::transform::Rigid3d& submap_pose) {
+  const auto it = slices_.find(id);
+  if (it == slices_.end()) {
+    return;
+  }
+  it->second.submap_pose = submap_pose;
+  pages_[it->second.page_index]->changed = true;
+}
+
+void OgreSubmapAtlas::SetAlpha(const ::cartographer::mapping::SubmapId& id,
+                               const float alpha) {
+  const auto it = slices_.find(id);
+  if (it == slices_.end() || it->second.alpha == alpha) {
+    return;
+  }
+  it->second.alpha = alpha;
+  pages_[it->second.page_index]->changed = true;
+}
+
+void OgreSubmapAtlas::SetVisibility(const ::cartographer::mapping::SubmapId& id,
+                                    const bool visibility) {
+  const auto it = slices_.find(id);
+  if (it == slices_.end() || it->second.visibility == visibility) {
+    return;
+  }
+  it->second.visibility = visibility;
+  pages_[it->second.page_index]->changed = true;
+}
+
+void OgreSubmapAtlas::Remove(const ::cartographer::mapping::SubmapId& id) {
+  const auto it = slices_.find(id);
+  if (it == slices_.end()) {
+    return;
+  }
+  Page* const page = pages_[it->second.page_index].get();
+  page->free_slots.push_back(it->second.slot);
+  page->changed = true;
+  slices_.erase(it);
+}
+
+void OgreSubmapAtlas::UpdateOgreObjects() {
+  for (size_t page_index = 0; page_index < pages_.size(); ++page_index) {
+    Page* const page = pages_[page_index].get();
+    if (!page->changed) {
+      continue;
+    }
+    page->changed = false;
+    page->manual_object->clear();
+    bool begun = false;
+    int num_vertices = 0;
+    // Slices are drawn in the order of their submap ids.
+    for (const auto& entry : slices_) {
+      const Slice& slice = entry.second;
+      if (slice.page_index != static_cast<int>(page_index) ||
+          !slice.visibility || slice.alpha == 0.f) {
+        continue;
+      }
+      if (!begun) {
+        page->manual_object->begin(page->material->getName(),
+                                   Ogre::RenderOperation::OT_TRIANGLE_LIST);
+        begun = true;
+      }
+      AddQuad(*page, slice, num_vertices);
+      num_vertices += 4;
+    }
+    if (begun) {
+      page->manual_object->end();
+    }
+  }
+}
+
+OgreSubmapAtlas::Slice* OgreSubmapAtlas::AllocateSlice(
+    const ::cartographer::mapping::SubmapId& id, const int slot_size) {
+  int page_index = 0;
+  while (page_index < static_cast<int>(pages_.size()) &&
+         (pages_[page_index]->slot_size != slot_size ||
+          pages_[page_index]->free_slots.empty())) {
+    ++page_index;
+  }
+  if (page_index == static_cast<int>(pages_.size())) {
+    const std::string page_name =
+        absl::StrCat(kSubmapAtlasPrefix, name_, "-", page_index);
+    auto page = absl::make_unique<Page>();
+    page->slot_size = slot_size;
+    const int num_slots = (kPageSizePixels / slot_size) *
+                          (kPageSizePixels / slot_size);
+    for (int slot = num_slots - 1; slot >= 0; --slot) {
+      page->free_slots.push_back(slot);
+    }
+    page->texture = Ogre::TextureManager::getSingleton().createManual(
+        page_name, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
+        Ogre::TEX_TYPE_2D, kPageSizePixels, kPageSizePixels, 0,
+        Ogre::PF_BYTE_RGB);
+    page->material = Ogre::MaterialManager::getSingleton().getByName(
+        kSubmapAtlasSourceMaterialName);
+    page->material = page->material->clone(page_name);
+    page->material->setReceiveShadows(false);
+    page->material->getTechnique(0)->setLightingEnabled(false);
+    page->material->setCullingMode(Ogre::CULL_NONE);
+    page->material->setDepthBias(-1.f, 0.f);
+    page->material->setDepthWriteEnabled(false);
+    Ogre::Pass* const pass = page->material->getTechnique(0)->getPass(0);
+    pass->setSceneBlending(Ogre::SBF_ONE, Ogre::SBF_ONE_MINUS_SOURCE_ALPHA);
+    Ogre::TextureUnitState* const texture_unit =
+        pass->getNumTextureUnitStates() > 0 ? pass->getTextureUnitState(0)
+                                            : pass->createTextureUnitState();
+    texture_unit->setTextureName(page->texture->getName());
+    texture_unit->setTextureFiltering(Ogre::TFO_NONE);
+    page->scene_node = map_node_->createChildSceneNode();
+    page->manual_object = scene_manager_->createManualObject(page_name);
+    page->scene_node->attachObject(page->manual_object);
+    pages_.push_back(std::move(page));
+  }
+  Page* const page = pages_[page_index].get();
+  Slice& slice = slices_[id];
+  slice.page_index = page_index;
+  slice.slot = page->free_slots.back();
+  page->free_slots.pop_back();
+  return &slice;
+}
+
+void OgreSubmapAtlas::AddQuad(const Page& page, const Slice& slice,
+                              const int first_vertex) {
+  const ::cartographer::transform::Rigid3d pose =
+      slice.submap_pose * slice.slice_pose;
+  const double metric_width = slice.resolution * slice.width;
+  const double metric_height = slice.resolution * slice.height;
+  const int slots_per_row = kPageSizePixels / page.slot_size;
+  const float min_u = static_cast<float>(slice.slot % slots_per_row *
+                                         page.slot_size) /
+                      kPageSizePixels;
+  const float min_v = static_cast<float>(slice.slot / slots_per_row *
+                                         page.slot_size) /
+                      kPageSizePixels;
+  const float max_u = min_u + static_cast<float>(slice.width) / kPageSizePixels;
+  const float max_v =
+      min_v + static_cast<float>(slice.height) / kPageSizePixels;
+  // The same corners as of an 'OgreSlice', in the map frame.
+  Ogre::ManualObject* const manual_object = page.manual_object;
+  // Bottom left
+  manual_object->position(
+      ToOgre(pose * Eigen::Vector3d(-metric_height, 0., 0.)));
+  manual_object->textureCoord(min_u, max_v);
+  manual_object->colour(1.f, 1.f, 1.f, slice.alpha);
+  // Bottom right
+  manual_object->position(
+      ToOgre(pose * Eigen::Vector3d(-metric_height, -metric_width, 0.)));
+  manual_object->textureCoord(max_u, max_v);
+  manual_object->colour(1.f, 1.f, 1.f, slice.alpha);
+  // Top left
+  manual_object->position(ToOgre(pose * Eigen::Vector3d(0., 0., 0.)));
+  manual_object->textureCoord(min_u, min_v);
+  manual_object->colour(1.f, 1.f, 1.f, slice.alpha);
+  // Top right
+  manual_object->position(
+      ToOgre(pose * Eigen::Vector3d(0., -metric_width, 0.)));
+  manual_object->textureCoord(max_u, min_v);
+  manual_object->colour(1.f, 1.f, 1.f, slice.alpha);
+  manual_object->quad(first_vertex, first_vertex + 1, first_vertex + 3,
+                      first_vertex + 2);
+}
+
+}  // namespace cartographer_rviz
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_RVIZ_SRC_OGRE_SUBMAP_ATLAS_H_
+#define CARTOGRAPHER_RVIZ_SRC_OGRE_SUBMAP_ATLAS_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "OgreManualObject.h"
+#include "OgreMaterial.h"
+#include "OgreSceneManager.h"
+#include "OgreSceneNode.h"
+#include "OgreTexture.h"
+#include "cartographer/mapping/id.h"
+#include "cartographer/transform/rigid_transform.h"
+#include "cartographer_rviz/ogre_slice.h"
+
+namespace cartographer_rviz {
+
+// Draws one slice of many submaps in a few draw calls. The slice textures are
+// packed into the slots of large textures, called pages, and each page is
+// drawn as a single object of quads in the map frame. The alpha of each
+// submap is passed as a vertex color to the shader. Member functions are
+// expected to be called from the Ogre thread.
+class OgreSubmapAtlas {
+ public:
+  // 'name' must be unique among all atlases.
+  OgreSubmapAtlas(const std::string& name, Ogre::SceneManager* scene_manager,
+                  Ogre::SceneNode* map_node);
+  ~OgreSubmapAtlas();
+
+  OgreSubmapAtlas(const OgreSubmapAtlas&) = delete;
+  OgreSubmapAtlas& operator=(const OgreSubmapAtlas&) = delete;
+
+  // Uploads the texture of the submap 'id' whose pose in the map frame is
+  // 'submap_pose'. Returns false and removes the submap if the texture is too
+  // large for a page.
+  bool Update(const ::cartographer::mapping::SubmapId& id,
+              const ::cartographer::transform::Rigid3d& submap_pose,
+              const SliceTexture& slice_texture);
+
+  // These do nothing for submaps not in the atlas.
+  void SetPose(const ::cartographer::mapping::SubmapId& id,
+               const ::cartographer::transform::Rigid3d& submap_pose);
+  void SetAlpha(const ::cartographer::mapping::SubmapId& id, float alpha);
+  void SetVisibility(const ::cartographer::mapping::SubmapId& id,
+                     bool visibility);
+  void Remove(const ::cartographer::mapping::SubmapId& id);
+
+  // Rebuilds the quads of the pages that changed since the last call.
+  void UpdateOgreObjects();
+
+ private:
+  struct Page {
+    int slot_size;
+    Ogre::TexturePtr texture;
+    Ogre::MaterialPtr material;
+    Ogre::SceneNode* scene_node;
+    Ogre::ManualObject* manual_object;
+    std::vector<int> free_slots;
+    bool changed = false;
+  };
+
+  struct Slice {
+    int page_index;
+    int slot;
+    int width;
+    int height;
+    double resolution;
+    ::cartographer::transform::Rigid3d slice_pose;
+    ::cartographer::transform::Rigid3d submap_pose;
+    float alpha = 1.f;
+    bool visibility = true;
+  };
+
+  // Returns the slice of 'id' with a free slot of 'slot_size' pixels.
+  Slice* AllocateSlice(const ::cartographer::mapping::SubmapId& id,
+                       int slot_size);
+  void AddQuad(const Page& page, const Slice& slice, int first_vertex);
+
+  const std::string name_;
+  Ogre::SceneManager* const scene_manager_;
+  Ogre::SceneNode* const map_node_;
+  std::vector<std::unique_ptr<Page>> pages_;
+  std::map<::cartographer::mapping::SubmapId, Slice> slices_;
+};
+
+}  // namespace cartographer_rviz
+
+#endif  // CARTOGRAPHER_RVIZ_SRC_OGRE_SUBMAP_ATLAS_H_
@@ -16,11 +16,20 @@
 
 #include "cartographer_rviz/submaps_display.h"
 
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <utility>
+#include <vector>
+
 #include "OgreResourceGroupManager.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
 #include "absl/synchronization/mutex.h"
 #include "cartographer/mapping/id.h"
-#include "cartographer_ros_msgs/SubmapList.h"
+#include "cartographer_ros_msgs/BatchSubmapQuery.h"
+#include "cartographer_ros_msgs/ResyncSubmapList.h"
+#include "cartographer_ros_msgs/SubmapListUpdate.h"
 #include "cartographer_ros_msgs/SubmapQuery.h"
 #include "geometry_msgs/TransformStamped.h"
 #include "pluginlib/class_list_macros.h"
@@ -30,24 +39,45 @@
 #include "rviz/frame_manager.h"
 #include "rviz/properties/bool_property.h"
 #include "rviz/properties/string_property.h"
+#include "rviz/view_controller.h"
+#include "rviz/view_manager.h"
 
 namespace cartographer_rviz {
 
 namespace {
 
-constexpr int kMaxOnGoingRequestsPerTrajectory = 6;
+constexpr size_t kMaxSubmapsInBatchQuery = 12;
+// When ranking submaps to fetch, each missing version counts as much as being
+// this much closer to the camera.
+constexpr double kMetersPerMissingVersion = 1.;
+// Uploading textures stops for the current frame after this time. At least
+// one submap is uploaded per frame.
+constexpr std::chrono::milliseconds kMaxTextureUploadTimePerFrame(4);
 constexpr char kMaterialsDirectory[] = "/ogre_media/materials";
 constexpr char kGlsl120Directory[] = "/glsl120";
 constexpr char kScriptsDirectory[] = "/scripts";
 constexpr char kDefaultTrackingFrame[] = "base_link";
+constexpr char kDefaultBatchSubmapQueryServiceName[] = "/batch_submap_query";
 constexpr char kDefaultSubmapQueryServiceName[] = "/submap_query";
+constexpr char kDefaultResyncServiceName[] = "/resync_submap_list";
+// A full submap list update is requested at most this often.
+constexpr double kSubmapListResyncPeriodSec = 1.;
 
 }  // namespace
 
 SubmapsDisplay::SubmapsDisplay() : tf_listener_(tf_buffer_) {
+  batch_submap_query_service_property_ = new ::rviz::StringProperty(
+      "Batch submap query service", kDefaultBatchSubmapQueryServiceName,
+      "Batch submap query service to connect to.", this, SLOT(Reset()));
   submap_query_service_property_ = new ::rviz::StringProperty(
       "Submap query service", kDefaultSubmapQueryServiceName,
-      "Submap query service to connect to.", this, SLOT(Reset()));
+      "Submap query service to connect to if the batch submap query service "
+      "does not exist.",
+      this, SLOT(Reset()));
+  resync_service_property_ = new ::rviz::StringProperty(
+      "Submap list resync service", kDefaultResyncServiceName,
+      "Service requesting all submaps after a missed submap list update.",
+      this, SLOT(Reset()));
   tracking_frame_property_ = new ::rviz::StringProperty(
       "Tracking frame", kDefaultTrackingFrame,
       "Tracking frame, used for fading out submaps.", this);
@@ -57,6 +87,30 @@ SubmapsDisplay::SubmapsDisplay() : tf_listener_(tf_buffer_) {
   slice_low_resolution_enabled_ = new ::rviz::BoolProperty(
       "Low Resolution", false, "Display low resolution slices.", this,
       SLOT(ResolutionToggled()), this);
+  texture_atlases_enabled_ = new ::rviz::BoolProperty(
+      "Texture Atlases", false,
+      "Draw the slices of each trajectory from a few large textures in a few "
+      "draw calls, which is much faster for many submaps.",
+      this, SLOT(Reset()));
+  level_of_detail_enabled_ = new ::rviz::BoolProperty(
+      "Automatic Level of Detail", false,
+      "Choose the slice resolution by the distance to the camera and hide "
+      "submaps outside of the view. Overrides the resolution toggles.",
+      this, SLOT(LevelOfDetailToggled()), this);
+  level_of_detail_distance_ = new ::rviz::FloatProperty(
+      "Level of Detail Distance", 50.f,
+      "Distance in meters from the camera beyond which low resolution slices "
+      "are shown.",
+      level_of_detail_enabled_);
+  level_of_detail_distance_->setMin(0.f);
+  texture_memory_budget_in_mb_ = new ::rviz::IntProperty(
+      "Texture Memory Budget", 512,
+      "Megabytes of submap textures above which the textures of the submaps "
+      "farthest outside of the view are released.",
+      level_of_detail_enabled_);
+  texture_memory_budget_in_mb_->setMin(0);
+  batch_client_ =
+      update_nh_.serviceClient<::cartographer_ros_msgs::BatchSubmapQuery>("");
   client_ = update_nh_.serviceClient<::cartographer_ros_msgs::SubmapQuery>("");
   trajectories_category_ = new ::rviz::Property(
       "Submaps", QVariant(), "List of all submaps, organized by trajectories.",
@@ -87,7 +141,22 @@ SubmapsDisplay::SubmapsDisplay() : tf_listener_(tf_buffer_) {
 }
 
 SubmapsDisplay::~SubmapsDisplay() {
+  batch_client_.shutdown();
   client_.shutdown();
+  resync_client_.shutdown();
+  std::future<void> batch_query_future;
+  std::future<void> resync_future;
+  {
+    absl::MutexLock locker(&mutex_);
+    batch_query_future = std::move(batch_query_future_);
+    resync_future = std::move(resync_future_);
+  }
+  if (batch_query_future.valid()) {
+    batch_query_future.wait();
+  }
+  if (resync_future.valid()) {
+    resync_future.wait();
+  }
   trajectories_.clear();
   scene_manager_->destroySceneNode(map_node_);
 }
@@ -95,8 +164,14 @@ SubmapsDisplay::~SubmapsDisplay() {
 void SubmapsDisplay::Reset() { reset(); }
 
 void SubmapsDisplay::CreateClient() {
+  batch_client_ =
+      update_nh_.serviceClient<::cartographer_ros_msgs::BatchSubmapQuery>(
+          batch_submap_query_service_property_->getStdString());
   client_ = update_nh_.serviceClient<::cartographer_ros_msgs::SubmapQuery>(
       submap_query_service_property_->getStdString());
+  resync_client_ =
+      update_nh_.serviceClient<::cartographer_ros_msgs::ResyncSubmapList>(
+          resync_service_property_->getStdString());
 }
 
 void SubmapsDisplay::onInitialize() {
@@ -108,18 +183,54 @@ void SubmapsDisplay::onInitialize() {
 void SubmapsDisplay::reset() {
   MFDClass::reset();
   absl::MutexLock locker(&mutex_);
+  batch_client_.shutdown();
   client_.shutdown();
+  resync_client_.shutdown();
   trajectories_.clear();
+  submap_list_synced_ = false;
   CreateClient();
 }
 
 void SubmapsDisplay::processMessage(
-    const ::cartographer_ros_msgs::SubmapList::ConstPtr& msg) {
+    const ::cartographer_ros_msgs::SubmapListUpdate::ConstPtr& msg) {
   absl::MutexLock locker(&mutex_);
-  map_frame_ = absl::make_unique<std::string>(msg->header.frame_id);
+  const bool follows_last_update =
+      submap_list_synced_ &&
+      msg->sequence_number == submap_list_sequence_number_ + 1;
+  if (msg->full || follows_last_update) {
+    ApplySubmapListUpdate(*msg);
+    return;
+  }
+  submap_list_synced_ = false;
+  // An update was missed, so the next full update is requested. Until it
+  // arrives, updates keep being ignored, so this is rate limited. The service
+  // is called in the background to not block rendering.
+  const ros::WallTime now = ros::WallTime::now();
+  if (now < next_resync_time_ ||
+      (resync_future_.valid() &&
+       resync_future_.wait_for(std::chrono::seconds(0)) !=
+           std::future_status::ready)) {
+    return;
+  }
+  next_resync_time_ = now + ros::WallDuration(kSubmapListResyncPeriodSec);
+  const ros::ServiceClient client = resync_client_;
+  resync_future_ = std::async(std::launch::async, [client]() {
+    ros::ServiceClient resync_client = client;
+    ::cartographer_ros_msgs::ResyncSubmapList srv;
+    if (!resync_client.call(srv)) {
+      ROS_WARN("Failed to request a full submap list update.");
+    }
+  });
+}
+
+void SubmapsDisplay::ApplySubmapListUpdate(
+    const ::cartographer_ros_msgs::SubmapListUpdate& msg) {
+  submap_list_synced_ = true;
+  submap_list_sequence_number_ = msg.sequence_number;
+  map_frame_ = absl::make_unique<std::string>(msg.header.frame_id);
   // In case Cartographer node is relaunched, destroy trajectories from the
   // previous instance.
-  for (const ::cartographer_ros_msgs::SubmapEntry& submap_entry : msg->submap) {
+  for (const ::cartographer_ros_msgs::SubmapEntry& submap_entry : msg.submap) {
     const size_t trajectory_id = submap_entry.trajectory_id;
     if (trajectories_.count(trajectory_id) == 0) {
       continue;
@@ -135,11 +246,9 @@ void SubmapsDisplay::processMessage(
   }
   using ::cartographer::mapping::SubmapId;
   std::set<SubmapId> listed_submaps;
-  std::set<int> listed_trajectories;
-  for (const ::cartographer_ros_msgs::SubmapEntry& submap_entry : msg->submap) {
+  for (const ::cartographer_ros_msgs::SubmapEntry& submap_entry : msg.submap) {
     const SubmapId id{submap_entry.trajectory_id, submap_entry.submap_index};
     listed_submaps.insert(id);
-    listed_trajectories.insert(submap_entry.trajectory_id);
     if (trajectories_.count(id.trajectory_id) == 0) {
       trajectories_.insert(std::make_pair(
           id.trajectory_id,
@@ -154,6 +263,15 @@ void SubmapsDisplay::processMessage(
                       .arg(id.trajectory_id),
                   trajectories_category_),
               pose_markers_all_enabled_->getBool())));
+      if (texture_atlases_enabled_->getBool()) {
+        auto& atlases = trajectories_[id.trajectory_id]->atlases;
+        for (int slice_index = 0; slice_index < kNumberOfSlicesPerSubmap;
+             ++slice_index) {
+          atlases.push_back(absl::make_unique<OgreSubmapAtlas>(
+              absl::StrCat(id.trajectory_id, "-", slice_index), scene_manager_,
+              map_node_));
+        }
+      }
     }
     auto& trajectory_visibility = trajectories_[id.trajectory_id]->visibility;
     auto& trajectory_submaps = trajectories_[id.trajectory_id]->submaps;
@@ -163,63 +281,219 @@ void SubmapsDisplay::processMessage(
       // TODO(ojura): Add RViz properties for adjusting submap pose axes
       constexpr float kSubmapPoseAxesLength = 0.3f;
       constexpr float kSubmapPoseAxesRadius = 0.06f;
+      std::vector<OgreSubmapAtlas*> atlases;
+      for (const auto& atlas : trajectories_[id.trajectory_id]->atlases) {
+        atlases.push_back(atlas.get());
+      }
       trajectory_submaps.emplace(
           id.submap_index,
           absl::make_unique<DrawableSubmap>(
               id, context_, map_node_, trajectory_visibility.get(),
               trajectory_visibility->getBool(),
               pose_markers_visibility->getBool(), kSubmapPoseAxesLength,
-              kSubmapPoseAxesRadius));
+              kSubmapPoseAxesRadius, atlases));
       trajectory_submaps.at(id.submap_index)
           ->SetSliceVisibility(0, slice_high_resolution_enabled_->getBool());
       trajectory_submaps.at(id.submap_index)
           ->SetSliceVisibility(1, slice_low_resolution_enabled_->getBool());
     }
-    trajectory_submaps.at(id.submap_index)->Update(msg->header, submap_entry);
+    trajectory_submaps.at(id.submap_index)->Update(msg.header, submap_entry);
+  }
+  if (msg.full) {
+    // Remove all submaps not mentioned in the full update.
+    for (const auto& trajectory_by_id : trajectories_) {
+      const int trajectory_id = trajectory_by_id.first;
+      auto& trajectory_submaps = trajectory_by_id.second->submaps;
+      for (auto it = trajectory_submaps.begin();
+           it != trajectory_submaps.end();) {
+        if (listed_submaps.count(SubmapId{trajectory_id, it->first}) == 0) {
+          it = trajectory_submaps.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+  for (const ::cartographer_ros_msgs::SubmapId& removed_submap :
+       msg.removed_submap) {
+    const auto it = trajectories_.find(removed_submap.trajectory_id);
+    if (it != trajectories_.end()) {
+      it->second->submaps.erase(removed_submap.submap_index);
+    }
   }
-  // Remove all deleted trajectories not mentioned in the SubmapList.
+  // Remove all deleted trajectories, which have no submaps left.
   for (auto it = trajectories_.begin(); it != trajectories_.end();) {
-    if (listed_trajectories.count(it->first) == 0) {
+    if (it->second->submaps.empty()) {
       it = trajectories_.erase(it);
     } else {
       ++it;
     }
   }
-  // Remove all submaps not mentioned in the SubmapList.
+}
+
+void SubmapsDisplay::MaybeFetchTextures() {
+  if (batch_query_future_.valid() &&
+      batch_query_future_.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+    return;
+  }
+  const Ogre::Camera* const camera = GetCamera();
+  std::vector<std::pair<double, DrawableSubmap*>> pending_submaps;
   for (const auto& trajectory_by_id : trajectories_) {
-    const int trajectory_id = trajectory_by_id.first;
-    auto& trajectory_submaps = trajectory_by_id.second->submaps;
-    for (auto it = trajectory_submaps.begin();
-         it != trajectory_submaps.end();) {
-      if (listed_submaps.count(
-              SubmapId{static_cast<int>(trajectory_id), it->first}) == 0) {
-        it = trajectory_submaps.erase(it);
-      } else {
-        ++it;
+    for (const auto& submap_entry : trajectory_by_id.second->submaps) {
+      DrawableSubmap* const submap = submap_entry.second.get();
+      if (submap->hidden()) {
+        continue;
+      }
+      const int num_missing_versions = submap->NumMissingVersions();
+      if (num_missing_versions == 0) {
+        continue;
       }
+      double distance = 0.;
+      if (camera != nullptr) {
+        const Ogre::Sphere sphere = submap->GetBoundingSphere();
+        distance = std::max(
+            0.f, camera->getDerivedPosition().distance(sphere.getCenter()) -
+                     sphere.getRadius());
+      }
+      pending_submaps.emplace_back(
+          distance - kMetersPerMissingVersion * num_missing_versions, submap);
     }
   }
+  std::sort(pending_submaps.begin(), pending_submaps.end(),
+            [](const std::pair<double, DrawableSubmap*>& lhs,
+               const std::pair<double, DrawableSubmap*>& rhs) {
+              return lhs.first < rhs.first;
+            });
+  std::map<::cartographer::mapping::SubmapId, int> known_submap_versions;
+  for (const auto& entry : pending_submaps) {
+    if (known_submap_versions.size() >= kMaxSubmapsInBatchQuery) {
+      break;
+    }
+    int known_version;
+    if (entry.second->StartFetchingTexture(&known_version)) {
+      known_submap_versions[entry.second->id()] = known_version;
+    }
+  }
+  if (known_submap_versions.empty()) {
+    return;
+  }
+  // The clients are copied, so that 'reset()' can replace them meanwhile.
+  const ros::ServiceClient batch_client = batch_client_;
+  const ros::ServiceClient client = client_;
+  batch_query_future_ = std::async(
+      std::launch::async,
+      [this, batch_client, client, known_submap_versions]() {
+        ros::ServiceClient query_batch_client = batch_client;
+        ros::ServiceClient query_client = client;
+        auto fetched_textures = ::cartographer_ros::FetchSubmapTextures(
+            known_submap_versions, &query_batch_client, &query_client);
+        // Converting the textures here leaves only copying them to Ogre.
+        std::map<::cartographer::mapping::SubmapId,
+                 std::unique_ptr<SliceTextures>>
+            slice_textures;
+        for (const auto& entry : fetched_textures) {
+          slice_textures.emplace(entry.first, ToSliceTextures(*entry.second));
+        }
+        absl::MutexLock locker(&mutex_);
+        for (const auto& entry : known_submap_versions) {
+          const ::cartographer::mapping::SubmapId& id = entry.first;
+          // Submaps may have been removed while the query was in progress.
+          const auto trajectory_it = trajectories_.find(id.trajectory_id);
+          if (trajectory_it == trajectories_.end()) {
+            continue;
+          }
+          const auto submap_it =
+              trajectory_it->second->submaps.find(id.submap_index);
+          if (submap_it == trajectory_it->second->submaps.end()) {
+            continue;
+          }
+          auto fetched_it = slice_textures.find(id);
+          submap_it->second->FinishFetchingTexture(
+              fetched_it == slice_textures.end()
+                  ? nullptr
+                  : std::move(fetched_it->second));
+        }
+      });
 }
 
-void SubmapsDisplay::update(const float wall_dt, const float ros_dt) {
-  absl::MutexLock locker(&mutex_);
-  // Schedule fetching of new submap textures.
-  for (const auto& trajectory_by_id : trajectories_) {
-    int num_ongoing_requests = 0;
-    for (const auto& submap_entry : trajectory_by_id.second->submaps) {
-      if (submap_entry.second->QueryInProgress()) {
-        ++num_ongoing_requests;
+Ogre::Camera* SubmapsDisplay::GetCamera() {
+  ::rviz::ViewController* const view_controller =
+      context_->getViewManager()->getCurrent();
+  return view_controller == nullptr ? nullptr : view_controller->getCamera();
+}
+
+void SubmapsDisplay::UpdateLevelOfDetail() {
+  const Ogre::Camera* const camera = GetCamera();
+  if (camera == nullptr) {
+    return;
+  }
+  const Ogre::Vector3 camera_position = camera->getDerivedPosition();
+  const float level_of_detail_distance = level_of_detail_distance_->getFloat();
+  size_t texture_bytes = 0;
+  std::vector<std::pair<float, DrawableSubmap*>> evictable_submaps;
+  for (auto& trajectory_by_id : trajectories_) {
+    for (auto& submap_entry : trajectory_by_id.second->submaps) {
+      DrawableSubmap* const submap = submap_entry.second.get();
+      const Ogre::Sphere sphere = submap->GetBoundingSphere();
+      const float distance =
+          std::max(0.f, camera_position.distance(sphere.getCenter()) -
+                            sphere.getRadius());
+      const bool high_resolution = distance < level_of_detail_distance;
+      if (submap->slice_visibility(0) != high_resolution ||
+          submap->slice_visibility(1) == high_resolution) {
+        submap->SetSliceVisibility(0, high_resolution);
+        submap->SetSliceVisibility(1, !high_resolution);
+      }
+      submap->SetCulled(!camera->isVisible(sphere));
+      texture_bytes += submap->texture_bytes();
+      if (submap->culled() && submap->texture_bytes() > 0) {
+        evictable_submaps.emplace_back(distance, submap);
       }
     }
-    for (auto it = trajectory_by_id.second->submaps.rbegin();
-         it != trajectory_by_id.second->submaps.rend() &&
-         num_ongoing_requests < kMaxOnGoingRequestsPerTrajectory;
-         ++it) {
-      if (it->second->MaybeFetchTexture(&client_)) {
-        ++num_ongoing_requests;
+  }
+  const size_t texture_memory_budget =
+      static_cast<size_t>(texture_memory_budget_in_mb_->getInt()) << 20;
+  std::sort(evictable_submaps.begin(), evictable_submaps.end(),
+            [](const std::pair<float, DrawableSubmap*>& lhs,
+               const std::pair<float, DrawableSubmap*>& rhs) {
+              return lhs.first > rhs.first;
+            });
+  for (const auto& entry : evictable_submaps) {
+    if (texture_bytes <= texture_memory_budget) {
+      break;
+    }
+    texture_bytes -= entry.second->texture_bytes();
+    entry.second->EvictTextures();
+    texture_bytes += entry.second->texture_bytes();
+  }
+}
+
+void SubmapsDisplay::UploadTextures() {
+  const auto deadline =
+      std::chrono::steady_clock::now() + kMaxTextureUploadTimePerFrame;
+  for (auto& trajectory_by_id : trajectories_) {
+    for (auto& submap_entry : trajectory_by_id.second->submaps) {
+      if (!submap_entry.second->texture_upload_pending()) {
+        continue;
+      }
+      if (std::chrono::steady_clock::now() > deadline) {
+        // Continue in the next frame.
+        context_->queueRender();
+        return;
       }
+      submap_entry.second->UploadTextures();
     }
   }
+}
+
+void SubmapsDisplay::update(const float wall_dt, const float ros_dt) {
+  absl::MutexLock locker(&mutex_);
+  if (level_of_detail_enabled_->getBool()) {
+    UpdateLevelOfDetail();
+  }
+  MaybeFetchTextures();
+  UploadTextures();
   if (map_frame_ == nullptr) {
     return;
   }
@@ -239,6 +513,11 @@ void SubmapsDisplay::update(const float wall_dt, const float ros_dt) {
   } catch (const tf2::TransformException& ex) {
     ROS_WARN_THROTTLE(1., "Could not compute submap fading: %s", ex.what());
   }
+  for (auto& trajectory_by_id : trajectories_) {
+    for (auto& atlas : trajectory_by_id.second->atlases) {
+      atlas->UpdateOgreObjects();
+    }
+  }
   // Update the map frame to fixed frame transform.
   Ogre::Vector3 position;
   Ogre::Quaternion orientation;
@@ -278,6 +557,22 @@ void SubmapsDisplay::ResolutionToggled() {
   }
 }
 
+void SubmapsDisplay::LevelOfDetailToggled() {
+  if (level_of_detail_enabled_->getBool()) {
+    // Applied in 'update()'.
+    return;
+  }
+  {
+    absl::MutexLock locker(&mutex_);
+    for (auto& trajectory_by_id : trajectories_) {
+      for (auto& submap_entry : trajectory_by_id.second->submaps) {
+        submap_entry.second->SetCulled(false);
+      }
+    }
+  }
+  ResolutionToggled();
+}
+
 void Trajectory::AllEnabledToggled() {
   const bool visible = visibility->getBool();
   for (auto& submap_entry : submaps) {
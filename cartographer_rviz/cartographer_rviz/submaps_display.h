@@ -17,18 +17,22 @@
 #ifndef CARTOGRAPHER_RVIZ_SRC_SUBMAPS_DISPLAY_H_
 #define CARTOGRAPHER_RVIZ_SRC_SUBMAPS_DISPLAY_H_
 
+#include <future>
 #include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "OgreCamera.h"
 #include "absl/synchronization/mutex.h"
 #include "cartographer/common/port.h"
-#include "cartographer_ros_msgs/SubmapList.h"
+#include "cartographer_ros_msgs/SubmapListUpdate.h"
 #include "cartographer_rviz/drawable_submap.h"
+#include "cartographer_rviz/ogre_submap_atlas.h"
 #include "rviz/message_filter_display.h"
 #include "rviz/properties/bool_property.h"
 #include "rviz/properties/float_property.h"
+#include "rviz/properties/int_property.h"
 #include "tf2_ros/buffer.h"
 #include "tf2_ros/transform_listener.h"
 
@@ -46,6 +50,9 @@ struct Trajectory : public QObject {
 
   std::unique_ptr<::rviz::BoolProperty> visibility;
   std::unique_ptr<::rviz::BoolProperty> pose_markers_visibility;
+  // One per slice if texture atlases are enabled. Declared before 'submaps'
+  // which use them.
+  std::vector<std::unique_ptr<OgreSubmapAtlas>> atlases;
   std::map<int, std::unique_ptr<DrawableSubmap>> submaps;
 
  private Q_SLOTS:
@@ -59,8 +66,8 @@ struct Trajectory : public QObject {
 // We show an X-ray view of the map which is achieved by shipping textures for
 // every submap containing pre-multiplied alpha and grayscale values, these are
 // then alpha blended together.
-class SubmapsDisplay
-    : public ::rviz::MessageFilterDisplay<::cartographer_ros_msgs::SubmapList> {
+class SubmapsDisplay : public ::rviz::MessageFilterDisplay<
+                           ::cartographer_ros_msgs::SubmapListUpdate> {
   Q_OBJECT
 
  public:
@@ -75,28 +82,65 @@ class SubmapsDisplay
   void AllEnabledToggled();
   void PoseMarkersEnabledToggled();
   void ResolutionToggled();
+  void LevelOfDetailToggled();
 
  private:
   void CreateClient();
+  // Applies 'msg', which is either full or follows the last applied update.
+  void ApplySubmapListUpdate(
+      const ::cartographer_ros_msgs::SubmapListUpdate& msg)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Returns the camera of the current view or 'nullptr'.
+  Ogre::Camera* GetCamera();
+  // Starts a batch query for the visible submaps that need new textures,
+  // unless one is still in progress. Submaps closest to the camera and
+  // missing the most versions go first.
+  void MaybeFetchTextures() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Chooses the slice of each submap by its distance to the camera, culls
+  // submaps outside of the view and evicts textures of culled submaps, the
+  // farthest first, while over the texture memory budget.
+  void UpdateLevelOfDetail() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Uploads fetched textures until the time per frame for uploads is spent.
+  void UploadTextures() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   // These are called by RViz and therefore do not adhere to the style guide.
   void onInitialize() override;
   void reset() override;
   void processMessage(
-      const ::cartographer_ros_msgs::SubmapList::ConstPtr& msg) override;
+      const ::cartographer_ros_msgs::SubmapListUpdate::ConstPtr& msg) override;
   void update(float wall_dt, float ros_dt) override;
 
   ::tf2_ros::Buffer tf_buffer_;
   ::tf2_ros::TransformListener tf_listener_;
+  ros::ServiceClient batch_client_;
+  ::rviz::StringProperty* batch_submap_query_service_property_;
+  // Only used if the batch submap query service does not exist.
   ros::ServiceClient client_;
   ::rviz::StringProperty* submap_query_service_property_;
+  ros::ServiceClient resync_client_;
+  ::rviz::StringProperty* resync_service_property_;
+  // Calls 'resync_client_' after a missed update. Another call is only made
+  // once it returned and 'next_resync_time_' passed.
+  std::future<void> resync_future_ GUARDED_BY(mutex_);
+  ros::WallTime next_resync_time_ GUARDED_BY(mutex_);
+  // Runs the batch query and passes the results to the submaps under 'mutex_'.
+  // Submaps are only destroyed under 'mutex_' or once this is done.
+  std::future<void> batch_query_future_ GUARDED_BY(mutex_);
   std::unique_ptr<std::string> map_frame_;
   ::rviz::StringProperty* tracking_frame_property_;
   Ogre::SceneNode* map_node_ = nullptr;  // Represents the map frame.
   std::map<int, std::unique_ptr<Trajectory>> trajectories_ GUARDED_BY(mutex_);
+  // Whether 'trajectories_' reflects all submap list updates up to
+  // 'submap_list_sequence_number_'. Otherwise, non-full updates are ignored.
+  bool submap_list_synced_ GUARDED_BY(mutex_) = false;
+  uint64_t submap_list_sequence_number_ GUARDED_BY(mutex_) = 0;
   absl::Mutex mutex_;
   ::rviz::BoolProperty* slice_high_resolution_enabled_;
   ::rviz::BoolProperty* slice_low_resolution_enabled_;
+  ::rviz::BoolProperty* texture_atlases_enabled_;
+  ::rviz::BoolProperty* level_of_detail_enabled_;
+  ::rviz::FloatProperty* level_of_detail_distance_;
+  ::rviz::IntProperty* texture_memory_budget_in_mb_;
   ::rviz::Property* trajectories_category_;
   ::rviz::BoolProperty* visibility_all_enabled_;
   ::rviz::BoolProperty* pose_markers_all_enabled_;
@@ -0,0 +1,30 @@
+/*
+ * Copyright 2020 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#version 120
+
+attribute vec4 uv0;
+attribute vec4 colour;
+
+varying vec2 out_submap_texture_coordinate;
+varying float out_alpha;
+
+void main()
+{
+  out_submap_texture_coordinate = vec2(uv0);
+  out_alpha = colour.a;
+  gl_Position = ftransform();
+}